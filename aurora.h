@@ -56,6 +56,7 @@ char* strcpy(char* dest, const char* src);
 char* strncpy(char* dest, const char* src, size_t n);
 void* memset(void* ptr, int value, size_t num);
 void* memcpy(void* dest, const void* src, size_t num);
+void* memmove(void* dest, const void* src, size_t num);
 int memcmp(const void* ptr1, const void* ptr2, size_t num);
 
 /* Kernel Version Information */
@@ -123,6 +124,7 @@ typedef UINT32 NTSTATUS;
 #define STATUS_INVALID_HANDLE           0xC0000008
 #define STATUS_NOT_SUPPORTED            0xC00000BB
 #define STATUS_TIMEOUT                  0x00000102
+#define STATUS_PENDING                  0x00000103
 #define STATUS_NO_MORE_ENTRIES          0x8000001A
 #define STATUS_BUFFER_TOO_SMALL         0xC0000023
 #define STATUS_OBJECT_NAME_COLLISION    0xC0000035
@@ -347,6 +349,23 @@ UINT64 AuroraGetSystemTime(void);
 UINT32 AuroraGetCurrentProcessId(void);
 UINT32 AuroraGetCurrentThreadId(void);
 
+/* Kernel command line ("name=value" pairs separated by spaces) */
+void AuroraSetCommandLine(IN PCSTR CommandLine);
+BOOL AuroraGetBootParameter(IN PCSTR Name, OUT PCHAR Value, IN UINT32 ValueSize);
+UINT64 AuroraParseSize(IN PCSTR Text, IN UINT64 Default);
+
+/* CRC32 (IEEE) and CRC32C (Castagnoli); start with 0, chain by passing the last result */
+typedef enum _AURORA_CRC {
+    AuroraCrcIeee = 0,
+    AuroraCrcCastagnoli = 1
+} AURORA_CRC;
+
+void AuroraCrc32Initialize(void);
+UINT32 AuroraCrc32(IN AURORA_CRC Kind, IN UINT32 Crc, IN const void* Data, IN UINT64 Size);
+UINT32 AuroraCrc32Combine(IN AURORA_CRC Kind, IN UINT32 Crc1, IN UINT32 Crc2, IN UINT64 Length2);
+UINT32 AuroraCrc32CombineOperator(IN AURORA_CRC Kind, IN UINT64 Length2);
+UINT32 AuroraCrc32CombineWith(IN AURORA_CRC Kind, IN UINT32 Operator, IN UINT32 Crc1, IN UINT32 Crc2);
+
 /* Aurora Synchronization Functions */
 void AuroraAcquireSpinLock(IN PAURORA_SPINLOCK SpinLock, OUT PAURORA_IRQL OldIrql);
 void AuroraReleaseSpinLock(IN PAURORA_SPINLOCK SpinLock, IN AURORA_IRQL OldIrql);
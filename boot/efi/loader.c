@@ -168,6 +168,16 @@ static EFI_STATUS LoadKernel(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE* SystemTab
         return Status;
     }
 
+    // Pass the image load options (UCS-2) through as the ASCII kernel command line
+    if(LoadedImage->LoadOptions && LoadedImage->LoadOptionsSize){
+        CHAR16* Opt = (CHAR16*)LoadedImage->LoadOptions;
+        UINTN Chars = LoadedImage->LoadOptionsSize / sizeof(CHAR16), i, n = 0;
+        for(i = 0; i < Chars && Opt[i] && n < sizeof(g_BootInfo.cmdline) - 1; i++){
+            g_BootInfo.cmdline[n++] = (Opt[i] < 0x80) ? (char)Opt[i] : '?';
+        }
+        g_BootInfo.cmdline[n] = '\0';
+    }
+
     // Get FileSystem protocol from the device handle
     Status = uefi_call_wrapper(SystemTable->BootServices->HandleProtocol, 3,
                                LoadedImage->DeviceHandle, &gEfiSimpleFileSystemProtocolGuid, (VOID**)&Fs);
@@ -329,8 +339,8 @@ static void __attribute__((noreturn)) TransferControl(VOID* KernelEntry, aurora_
 {
     Print(L"[EFI] Transferring control to kernel at 0x%lx\r\n", (UINTN)KernelEntry);
     
-    // Function pointer for kernel entry
-    void (*KernelMain)(aurora_boot_info_t*) = (void(*)(aurora_boot_info_t*))KernelEntry;
+    // Function pointer for kernel entry; see AURORA_BOOT_ENTRY_ABI
+    aurora_kernel_entry_t KernelMain = (aurora_kernel_entry_t)KernelEntry;
     
     // Jump to kernel
     KernelMain(BootInfo);
@@ -377,6 +387,14 @@ EFI_STATUS EFIAPI efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE* SystemTable
         g_BootInfo.flags |= AURORA_BOOT_FLAG_GRAPHICS;
     }
     
+    // ACPI root pointer, so the kernel finds the MADT without a BIOS area
+    VOID* Rsdp = NULL;
+    if(!EFI_ERROR(LibGetSystemConfigurationTable(&Acpi20TableGuid, &Rsdp)) ||
+       !EFI_ERROR(LibGetSystemConfigurationTable(&AcpiTableGuid, &Rsdp))) {
+        g_BootInfo.acpi_rsdp_address = (UINT64)(UINTN)Rsdp;
+        g_BootInfo.flags |= AURORA_BOOT_FLAG_ACPI;
+    }
+    
     // Get memory map
     Status = GetMemoryMap(SystemTable);
     if(EFI_ERROR(Status)) {
@@ -155,7 +155,7 @@ void legacy_main(void) {
     switch_to_long_mode();
     
     // Calculate kernel entry point
-    void (*kernel_entry)(aurora_boot_info_t*) = (void(*)(aurora_boot_info_t*))(KERNEL_LOAD_ADDRESS + entry_rva);
+    aurora_kernel_entry_t kernel_entry = (aurora_kernel_entry_t)(KERNEL_LOAD_ADDRESS + entry_rva);
     
     // Transfer control to kernel
     kernel_entry(g_boot_info);
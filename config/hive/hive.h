@@ -38,6 +38,8 @@ typedef enum _CELL_TYPE {
     CellTypeKey = 0x6B6E,      /* 'nk' */
     CellTypeValue = 0x6B76,    /* 'vk' */
     CellTypeSubkeys = 0x666C,  /* 'lf' */
+    CellTypeHashLeaf = 0x686C, /* 'lh' */
+    CellTypeIndexRoot = 0x6972, /* 'ri' */
     CellTypeData = 0x6264,     /* 'db' */
     CellTypeSecurity = 0x6B73, /* 'sk' */
     CellTypeSecurityDescriptor = 5,
@@ -113,6 +115,270 @@ typedef struct _VALUE_CELL {
     CHAR Name[1];
 } VALUE_CELL, *PVALUE_CELL;
 
+/*
+ * Subkey index cells. A key's SubKeysList is a hash leaf ('lh') holding
+ * up to HIVE_INDEX_LEAF_MAX entries, or for larger keys a root index ('ri')
+ * of such leaves. Leaf entries are kept sorted by name hash and then by
+ * name, and the leaves of a root index follow each other in that order,
+ * so a lookup is a binary search with a name compare only on a hash match.
+ */
+#define HIVE_INDEX_LEAF_MAX     512
+#define HIVE_INDEX_ROOT_MAX     0xFFFF
+
+typedef struct _HIVE_INDEX_ENTRY {
+    UINT32 Cell;
+    UINT32 Hash;
+} HIVE_INDEX_ENTRY, *PHIVE_INDEX_ENTRY;
+
+typedef struct _HASH_LEAF_CELL {
+    UINT16 Count;
+    UINT16 Spare;
+    HIVE_INDEX_ENTRY Entries[1];
+} HASH_LEAF_CELL, *PHASH_LEAF_CELL;
+
+typedef struct _INDEX_ROOT_CELL {
+    UINT16 Count;
+    UINT16 Spare;
+    UINT32 Leaves[1];
+} INDEX_ROOT_CELL, *PINDEX_ROOT_CELL;
+
+/*
+ * Free space. Free cells sit on size-class lists threaded through the cells
+ * themselves; classes are exact below 256 bytes and powers of two above,
+ * and a bitmap of non-empty classes finds a fitting list in O(1). A free
+ * cell repeats its size in its last 4 bytes (a boundary tag), and a bitmap
+ * with one bit per 8-byte granule marks where free cells start, so a freed
+ * cell merges with a free predecessor without scanning for it.
+ */
+#define HIVE_CELL_GRANULE       8
+#define HIVE_MIN_FREE_CELL      24
+#define HIVE_FREE_CLASSES       56
+
+typedef struct _FREE_CELL {
+    CELL_HEADER Header;
+    UINT32 Next;                /* offsets on the class list, 0 at the ends */
+    UINT32 Prev;
+} FREE_CELL, *PFREE_CELL;
+
+typedef struct _HIVE_FREE_SPACE {
+    UINT32 Heads[HIVE_FREE_CLASSES];
+    UINT64 ClassBitmap;
+    PUINT32 StartBitmap;
+    UINT32 StartBitmapWords;
+    UINT32 FreeCells;
+    UINT32 FreeBytes;
+} HIVE_FREE_SPACE, *PHIVE_FREE_SPACE;
+
+/*
+ * Hive files. A hive is stored as a HIVE_FILE_HEADER followed by the hive
+ * image. Files written with HIVE_FILE_FLAG_JOURNALED are updated in place
+ * from the journal below, so their whole-file checksum is not kept; the
+ * hive header's PrimarySequence names the last log merged into them.
+ */
+#define HIVE_FILE_SIGNATURE     0x66676572  /* 'regf' */
+#define HIVE_BACKUP_SIGNATURE   0x6B636162  /* 'back' */
+#define HIVE_LOG_SIGNATURE      0x676F6C72  /* 'rlog' */
+#define HIVE_FILE_FLAG_JOURNALED 0x00000001
+
+typedef struct _HIVE_FILE_HEADER {
+    UINT32 Signature;           /* File signature */
+    UINT32 Version;             /* File format version */
+    UINT32 HiveSize;            /* Size of hive data */
+    UINT32 Checksum;            /* File checksum */
+    UINT64 Timestamp;           /* Last modification time */
+    UINT32 Flags;               /* File flags */
+    UINT32 Reserved[3];         /* Reserved for future use */
+} HIVE_FILE_HEADER, *PHIVE_FILE_HEADER;
+
+/*
+ * Journal. Cell writes set bits in a dirty map of 512-byte sectors, and
+ * HiveFlush writes just those sectors to <file>.LOG1 or <file>.LOG2, in
+ * turn, as one sequence-numbered, checksummed log. Each log carries every
+ * sector not yet merged into the primary file, so the newest valid log is
+ * all recovery needs. The primary file is brought up to date lazily, every
+ * HIVE_RECONCILE_INTERVAL flushes and when the hive is closed.
+ */
+#define HIVE_SECTOR_SIZE        512
+#define HIVE_RECONCILE_INTERVAL 8
+#define HIVE_LOG_FILE_MAX       256
+
+typedef struct _HIVE_LOG_HEADER {
+    UINT32 Signature;           /* HIVE_LOG_SIGNATURE */
+    UINT32 Sequence;
+    UINT32 HiveSize;
+    UINT32 RunCount;            /* HIVE_LOG_RUNs, from the second sector */
+    UINT32 SectorCount;         /* data sectors, after the run table */
+    UINT32 Checksum;            /* CRC32 of the whole log with this zero */
+} HIVE_LOG_HEADER, *PHIVE_LOG_HEADER;
+
+typedef struct _HIVE_LOG_RUN {
+    UINT32 Sector;
+    UINT32 Count;
+} HIVE_LOG_RUN, *PHIVE_LOG_RUN;
+
+typedef struct _HIVE_JOURNAL {
+    PUINT32 DirtyBitmap;        /* sectors written since the last flush */
+    PUINT32 PendingBitmap;      /* sectors logged but not in the primary file */
+    UINT32 BitmapWords;
+    UINT32 Sequence;            /* of the last log written or replayed */
+    UINT32 FlushCount;          /* logs written since the last reconcile */
+    CHAR FileName[HIVE_LOG_FILE_MAX];
+} HIVE_JOURNAL, *PHIVE_JOURNAL;
+
+/*
+ * Demand loading. A large hive file is read a bin at a time: loading reads
+ * only the bin holding the header, and the cell accessors fault in the bins
+ * a cell covers the first time it is touched. Walks over the whole hive,
+ * such as saving or rebuilding the free lists, fault in everything first.
+ * The image stays one allocation, so cell pointers remain plain pointers.
+ */
+#define HIVE_BIN_SHIFT          14
+#define HIVE_BIN_SIZE           (1u << HIVE_BIN_SHIFT)
+#define HIVE_DEMAND_LOAD_MIN    (1024 * 1024)
+
+typedef struct _HIVE_BIN_MAP {
+    PVOID File;                 /* open hive file, NULL once all bins are in */
+    UINT64 FileOffset;          /* file offset of hive offset 0 */
+    UINT32 BinCount;
+    UINT32 ResidentCount;
+    AURORA_SPINLOCK Lock;
+    PUINT32 Loading;            /* one bit per bin being read, after Resident */
+    UINT32 Resident[1];         /* one bit per bin */
+} HIVE_BIN_MAP, *PHIVE_BIN_MAP;
+
+/* Readers count themselves in a slot picked by processor number, so
+   entering a read section only writes a line that processor owns */
+#define HIVE_READER_SLOTS       16
+
+typedef struct _HIVE_READER_SLOT {
+    volatile INT32 Count;       /* may go negative when a reader migrates */
+    UINT32 Pad[15];
+} HIVE_READER_SLOT, *PHIVE_READER_SLOT;
+
+/* Per-key change generations. A writer bumps the slot a key hashes to
+   whenever the key's values or subkeys change, so a cached read of the key
+   is current while its generation is unchanged. Keys sharing a slot only
+   cost each other extra misses. */
+#define HIVE_KEY_GENERATION_SHIFT   8
+#define HIVE_KEY_GENERATION_SLOTS   (1u << HIVE_KEY_GENERATION_SHIFT)
+
+typedef struct _HIVE_SYNC {
+    volatile UINT32 Sequence;   /* odd while a writer holds the hive */
+    AURORA_SPINLOCK WriterLock;
+    AURORA_IRQL WriterIrql;     /* IRQL the outermost writer came in at */
+    UINT32 OwnerThread;
+    UINT32 RecursionCount;
+    PUINT32 Deferred;           /* cells freed while readers were inside */
+    UINT32 DeferredCount;
+    UINT32 DeferredCapacity;
+    HIVE_READER_SLOT Readers[HIVE_READER_SLOTS];
+    volatile UINT32 KeyGenerations[HIVE_KEY_GENERATION_SLOTS];
+    UINT32 ChangeGeneration;    /* bumped on every key change, see hivenotify.c */
+    volatile UINT32 Watchers;   /* registered watchers, 0 skips notification */
+    UINT32 SubtreeWatchers;
+} HIVE_SYNC, *PHIVE_SYNC;
+
+/* Per-bin CRCs behind HiveCalculateFullChecksum. Writes mark their bins
+   stale through HiveMarkDirtyRange; a full checksum recomputes only the
+   stale bins and combines the rest */
+typedef struct _HIVE_CHECKSUM_CACHE {
+    UINT32 Algorithm;
+    UINT32 BinCount;
+    SIZE_T Size;                /* hive size the bins were cut from */
+    PUINT32 Stale;              /* one bit per bin */
+    UINT32 BinChecksum[1];
+} HIVE_CHECKSUM_CACHE, *PHIVE_CHECKSUM_CACHE;
+
+/*
+ * Compaction. The hive cannot grow, so compaction works on the tail: the
+ * bins past the live data plus a quarter of headroom. HiveCompactStep moves
+ * live cells out of those bins, sparsest bin first, into free space below
+ * them, a bounded number of bytes per call. A reverse-reference pass over
+ * the key tree finds the one slot naming each cell to move; the plan is
+ * kept between steps while no other writer runs. Once the tail holds no
+ * live cells it is cut off. Key cells stay put, since NTCore hands their
+ * offsets out as key handles.
+ */
+#define HIVE_COMPACT_STEP_BYTES     (64 * 1024)
+#define HIVE_COMPACT_THRESHOLD      40      /* HiveGetFragmentationLevel */
+#define HIVE_COMPACT_NO_REF         0xFFFFFFFF
+
+typedef struct _HIVE_CELL_REF {
+    UINT32 Target;              /* tail cell to move */
+    UINT32 Slot;                /* hive offset of the UINT32 naming it */
+    UINT32 Owner;               /* ref of the tail cell holding Slot, or HIVE_COMPACT_NO_REF */
+    UINT32 Moved;               /* new offset, 0 until moved */
+} HIVE_CELL_REF, *PHIVE_CELL_REF;
+
+typedef struct _HIVE_COMPACTOR {
+    UINT32 Sequence;            /* Sync.Sequence at the end of the last step */
+    SIZE_T Size;                /* hive size the plan was made for, 0 for none */
+    UINT32 TailStart;           /* bin aligned; cells from here move down */
+    PUINT32 BinLive;            /* live bytes per bin */
+    UINT32 BinCapacity;
+    PHIVE_CELL_REF Refs;
+    PUINT32 Order;              /* indices into Refs, sparsest bin first */
+    UINT32 RefCount;
+    UINT32 RefCapacity;
+    UINT32 Next;                /* position in Order */
+    UINT32 CellsMoved;
+    UINT32 BytesReleased;
+} HIVE_COMPACTOR, *PHIVE_COMPACTOR;
+
+/*
+ * Change notification. A watcher names a key, or with HIVE_NOTIFY_SUBTREE
+ * the key and everything below it, and either an event to set or a notify
+ * port to queue on. A watcher has at most one notification outstanding:
+ * changes before the consumer reads it fold into it, and once read the
+ * next one is held until Window system time ticks have passed since the
+ * last, so a burst of writes costs one wakeup. The notification carries
+ * the hive change generation of the last change it covers.
+ */
+#define HIVE_NOTIFY_SUBTREE         0x00000001  /* watcher filter */
+#define HIVE_NOTIFY_KEY_DELETED     0x00000001  /* notification flag */
+
+typedef enum _HIVE_WATCH_STATE {
+    HiveWatchIdle = 0,
+    HiveWatchHeld = 1,          /* changed within the window, not yet delivered */
+    HiveWatchSignaled = 2       /* delivered, not yet read */
+} HIVE_WATCH_STATE;
+
+/* Ports queue signaled watchers, so one consumer can wait on many keys */
+typedef struct _HIVE_NOTIFY_PORT {
+    struct _HIVE_WATCHER* Head;
+    struct _HIVE_WATCHER* Tail;
+    UINT32 Count;
+    AURORA_EVENT Event;         /* set while the queue is not empty */
+} HIVE_NOTIFY_PORT, *PHIVE_NOTIFY_PORT;
+
+typedef struct _HIVE_WATCHER {
+    struct _HIVE_WATCHER* HashNext;
+    struct _HIVE_WATCHER* QueueNext;    /* held list or port queue */
+    struct _HIVE* Hive;
+    UINT32 KeyCell;
+    UINT32 Filter;
+    BOOLEAN Hashed;             /* FALSE once the key or hive is gone */
+    HIVE_WATCH_STATE State;
+    UINT64 Window;
+    UINT64 LastDelivery;
+    PAURORA_EVENT Event;
+    PHIVE_NOTIFY_PORT Port;
+    PVOID Context;
+    UINT32 ChangedKey;          /* pending notification */
+    UINT32 Generation;
+    UINT32 ChangeCount;
+    UINT32 Flags;
+} HIVE_WATCHER, *PHIVE_WATCHER;
+
+typedef struct _HIVE_NOTIFICATION {
+    PVOID Context;
+    UINT32 KeyCell;             /* watched key */
+    UINT32 ChangedKey;          /* key of the last change, below KeyCell for subtrees */
+    UINT32 Generation;
+    UINT32 ChangeCount;         /* changes folded into this notification */
+    UINT32 Flags;
+} HIVE_NOTIFICATION, *PHIVE_NOTIFICATION;
+
 /* Hive Structure */
 typedef struct _HIVE {
     PHIVE_HEADER Header;
@@ -127,8 +393,15 @@ typedef struct _HIVE {
     BOOL ReadOnly;
     UINT32 RefCount;
     UINT32 RootKeyOffset;
+    UINT32 Generation;          /* bumped when keys are deleted; stales path hints */
+    struct _HIVE_FREE_SPACE* FreeSpace;
+    struct _HIVE_JOURNAL* Journal;  /* NULL for hives with no backing file */
+    struct _HIVE_BIN_MAP* Bins;     /* NULL unless demand loaded */
+    struct _HIVE_CHECKSUM_CACHE* Checksums; /* NULL until a full checksum is taken */
+    struct _HIVE_COMPACTOR* Compactor;      /* NULL until compaction first runs */
     CHAR Name[256];
-    AURORA_SPINLOCK Lock;
+    AURORA_SPINLOCK Lock;       /* allocator and free lists */
+    HIVE_SYNC Sync;             /* writers and lockless readers, see hivesync.c */
     struct _HIVE* Next;
 } HIVE, *PHIVE;
 
@@ -156,6 +429,9 @@ NTSTATUS HiveLoad(IN PHIVE Hive, IN PVOID HiveData, IN UINT32 HiveSize);
 NTSTATUS HiveLoadFromData(IN PHIVE Hive, IN PVOID HiveData, IN UINT32 HiveSize);
 NTSTATUS HiveUnload(IN PHIVE Hive);
 NTSTATUS HiveFlush(IN PHIVE Hive);
+VOID HiveMarkDirty(IN PHIVE Hive);
+VOID HiveMarkDirtyRange(IN PHIVE Hive, IN PVOID Address, IN SIZE_T Length);
+VOID HiveMarkCellDirty(IN PHIVE Hive, IN UINT32 CellOffset);
 NTSTATUS HiveInitializeSystem(void);
 VOID HiveShutdownSystem(void);
 PHIVE HiveFindByName(IN PCSTR Name);
@@ -163,8 +439,24 @@ NTSTATUS HiveAddToList(IN PHIVE Hive);
 NTSTATUS HiveRemoveFromList(IN PHIVE Hive);
 NTSTATUS HiveClose(IN PHIVE Hive);
 NTSTATUS HiveSaveToFile(IN PHIVE Hive, IN PCSTR FileName);
+NTSTATUS HiveLoadFromFile(IN PCSTR FileName, OUT PHIVE* Hive);
+NTSTATUS HiveSetBackingFile(IN PHIVE Hive, IN PCSTR FileName);
 NTSTATUS HiveCreateBackup(IN PHIVE Hive, IN PCSTR BackupPath);
 NTSTATUS HiveCompact(IN PHIVE Hive);
+NTSTATUS HiveCompactStep(IN PHIVE Hive, IN UINT32 Budget, OUT PBOOLEAN Done);
+BOOLEAN HiveNeedsCompaction(IN PHIVE Hive);
+VOID HiveCompactRelease(IN PHIVE Hive);
+NTSTATUS HiveCreateNotifyPort(OUT PHIVE_NOTIFY_PORT* Port);
+NTSTATUS HiveRegisterWatcher(IN PHIVE Hive, IN UINT32 KeyCell, IN UINT32 Filter, IN UINT64 Window,
+                             IN PAURORA_EVENT Event, IN PHIVE_NOTIFY_PORT Port, IN PVOID Context,
+                             OUT PHIVE_WATCHER* Watcher);
+NTSTATUS HiveCancelWatcher(IN PHIVE_WATCHER Watcher);
+NTSTATUS HiveReadNotification(IN PHIVE_WATCHER Watcher, OUT PHIVE_NOTIFICATION Notification);
+NTSTATUS HiveWaitForNotification(IN PHIVE_WATCHER Watcher, IN UINT32 TimeoutMs, OUT PHIVE_NOTIFICATION Notification);
+NTSTATUS HiveRemoveNotification(IN PHIVE_NOTIFY_PORT Port, IN UINT32 TimeoutMs, OUT PHIVE_NOTIFICATION Notification);
+VOID HiveNotifyChange(IN PHIVE Hive, IN UINT32 KeyCell, IN UINT32 Flags);
+VOID HiveNotifyTick(void);
+VOID HiveNotifyRelease(IN PHIVE Hive);
 NTSTATUS HiveCheckIntegrity(IN PHIVE Hive, IN PVOID BaseAddress, IN SIZE_T Size);
 
 /* Cell Management */
@@ -176,11 +468,24 @@ PVALUE_CELL HiveGetValueCell(IN PHIVE Hive, IN UINT32 CellOffset);
 BOOL HiveValidateCell(IN PHIVE Hive, IN UINT32 CellOffset);
 BOOL HiveBinValidateBlock(IN PHIVE Hive, IN UINT32 Offset);
 NTSTATUS HiveCellResize(IN PHIVE Hive, IN UINT32 CellOffset, IN SIZE_T NewSize);
+UINT32 HiveCreateKeyCell(IN PHIVE Hive, IN PCSTR KeyName, IN UINT32 ParentCell);
+UINT32 HiveCreateValueCell(IN PHIVE Hive, IN PCSTR ValueName, IN UINT32 Type, IN PVOID Data, IN UINT32 DataSize);
+NTSTATUS HiveDeleteCell(IN PHIVE Hive, IN UINT32 CellOffset);
+SIZE_T HiveGetCellSize(IN PHIVE Hive, IN UINT32 CellOffset);
+UINT32 HiveResizeCell(IN PHIVE Hive, IN UINT32 OldCellOffset, IN SIZE_T NewSize);
 BOOL HiveCheckKeyCell(IN PHIVE Hive, IN UINT32 CellOffset);
 BOOL HiveCheckValueCell(IN PHIVE Hive, IN UINT32 CellOffset);
 NTSTATUS HiveBinCompact(IN PHIVE Hive);
-
-/* Key Operations */
+NTSTATUS HiveBinMapCreate(IN PHIVE Hive, IN PVOID File, IN UINT64 FileOffset, IN UINT32 ResidentBytes);
+VOID HiveBinMapRelease(IN PHIVE Hive);
+NTSTATUS HiveFaultRange(IN PHIVE Hive, IN UINT32 Offset, IN SIZE_T Length);
+BOOL HiveFaultCell(IN PHIVE Hive, IN UINT32 CellOffset);
+
+/* Key Operations. Paths are '\\'-separated and relative to the hive's root
+ * key; names compare case-insensitively. HiveCreateKey opens the key when
+ * it already exists and creates missing parents. Values of 4 bytes or less
+ * live inline in their value cell. */
+UINT32 HiveHashName(IN PCSTR Name, IN UINT32 Length);
 NTSTATUS HiveCreateKey(IN PHIVE Hive, IN PCSTR KeyPath, OUT PUINT32 KeyCell);
 NTSTATUS HiveFindKey(IN PHIVE Hive, IN PCSTR KeyPath, OUT PUINT32 KeyCell);
 NTSTATUS HiveDeleteKey(IN PHIVE Hive, IN PCSTR KeyPath);
@@ -215,11 +520,34 @@ typedef struct _HIVE_STATISTICS {
 
 NTSTATUS HiveGetStatistics(IN PHIVE Hive, OUT PHIVE_STATISTICS Statistics);
 NTSTATUS HiveRebuildFreeSpaceMap(IN PHIVE Hive);
+NTSTATUS HiveFreeSpaceInitialize(void);
+VOID HiveFreeSpaceShutdown(void);
 VOID HiveFreeSpaceClear(IN PHIVE Hive);
 VOID HiveFreeSpaceAdd(IN PHIVE Hive, IN UINT32 Offset, IN UINT32 Size);
+VOID HiveFreeSpaceRelease(IN PHIVE Hive);
+UINT32 HiveFindFreeSpace(IN PHIVE Hive, IN SIZE_T RequiredSize);
+UINT32 HiveAllocateFromFreeSpace(IN PHIVE Hive, IN SIZE_T Size);
+UINT32 HiveAllocateBelow(IN PHIVE Hive, IN SIZE_T Size, IN UINT32 Limit);
+UINT32 HiveTrailingFreeCell(IN PHIVE Hive);
+NTSTATUS HiveMarkSpaceAsFree(IN PHIVE Hive, IN UINT32 Offset, IN SIZE_T Size);
+UINT32 HiveGetFragmentationLevel(IN PHIVE Hive);
 UINT32 HiveCalculateCompactedSize(IN PHIVE Hive);
 NTSTATUS HiveCopyCompacted(IN PHIVE SourceHive, IN PHIVE DestHive);
 NTSTATUS HiveApplyTransactionLog(IN PHIVE Hive, IN PCSTR LogFile);
+NTSTATUS HiveCreateLogEntry(IN PHIVE Hive, IN UINT32 Operation, IN UINT32 Offset, IN PVOID Data, IN UINT32 Size);
+UINT32 HiveCalculateCrc32Checksum(IN PVOID Data, IN UINT32 Size);
+UINT32 HiveCalculateCrc32cChecksum(IN PVOID Data, IN UINT32 Size);
+VOID HiveChecksumInvalidate(IN PHIVE Hive, IN SIZE_T Offset, IN SIZE_T Length);
+VOID HiveChecksumRelease(IN PHIVE Hive);
+
+/* Journal */
+NTSTATUS HiveJournalAttach(IN PHIVE Hive, IN PCSTR FileName, IN UINT32 Sequence);
+VOID HiveJournalRelease(IN PHIVE Hive);
+VOID HiveJournalDiscardLogs(IN PCSTR FileName);
+NTSTATUS HiveJournalWrite(IN PHIVE Hive);
+NTSTATUS HiveJournalReconcile(IN PHIVE Hive);
+NTSTATUS HiveJournalTruncate(IN PHIVE Hive, IN UINT32 NewSize);
+NTSTATUS HiveJournalRecover(IN PHIVE Hive, IN PCSTR FileName, IN UINT32 MinSequence, OUT PUINT32 Sequence);
 NTSTATUS HiveCreateCompactedCopy(IN PHIVE SourceHive, OUT PHIVE* CompactedHive);
 UINT32 HiveCalculateFileChecksum(IN PVOID FileData, IN UINT32 FileSize);
 VOID HiveExtractNameFromPath(IN PCSTR FilePath, OUT PCHAR Name, IN UINT32 NameSize);
@@ -253,19 +581,37 @@ typedef enum _HINT_TYPE {
     HintTypeCacheWarm = 4
 } HINT_TYPE;
 
+/*
+ * Hint cache: a fixed-budget hash table from (hive, key path) to key cell,
+ * so repeated path lookups skip the index walk. Paths are hashed in a
+ * normalized form (upcased, single separators). Entries remember the hive
+ * generation they were made in and are dropped on lookup once it moves.
+ */
+#define HIVE_HINT_BUDGET        (128 * 1024)
+#define HIVE_HINT_PATH_MAX      128
+
 /* Hint Entry Structure */
 typedef struct _HINT_ENTRY {
-    HINT_TYPE Type;
+    struct _HINT_ENTRY* HashNext;   /* bucket chain, or free list */
+    struct _HINT_ENTRY* LruPrev;    /* toward most recently used */
+    struct _HINT_ENTRY* LruNext;
+    PHIVE Hive;
+    UINT32 PathHash;
+    UINT32 Generation;
     UINT32 CellOffset;
-    CHAR Path[256];
+    HINT_TYPE Type;
     UINT32 AccessCount;
-    UINT64 LastAccess;
-    struct _HINT_ENTRY* Next;
+    UINT32 PathLength;
+    CHAR Path[HIVE_HINT_PATH_MAX + 1];
 } HINT_ENTRY, *PHINT_ENTRY;
 
 /* Hint Cache Structure */
 typedef struct _HINT_CACHE {
-    PHINT_ENTRY Entries;
+    PHINT_ENTRY* Buckets;
+    UINT32 BucketMask;
+    PHINT_ENTRY FreeList;
+    PHINT_ENTRY LruHead;
+    PHINT_ENTRY LruTail;
     UINT32 Count;
     UINT32 MaxEntries;
     AURORA_SPINLOCK Lock;
@@ -293,6 +639,9 @@ typedef struct _HINT_CACHE {
 #ifndef STATUS_INVALID_VALUE_TYPE
 #define STATUS_INVALID_VALUE_TYPE       0xC0000004L
 #endif
+#ifndef STATUS_CANNOT_DELETE
+#define STATUS_CANNOT_DELETE            0xC0000121L
+#endif
 #ifndef STATUS_NOT_FOUND
 #define STATUS_NOT_FOUND                0xC0000225L
 #endif
@@ -341,8 +690,23 @@ typedef struct _HINT_CACHE {
 /* Synchronization */
 VOID HiveAcquireLock(IN PHIVE Hive);
 VOID HiveReleaseLock(IN PHIVE Hive);
+NTSTATUS HiveAcquireSharedLock(IN PHIVE Hive, IN UINT32 Timeout);
+NTSTATUS HiveReleaseSharedLock(IN PHIVE Hive);
+NTSTATUS HiveAcquireExclusiveLock(IN PHIVE Hive, IN UINT32 Timeout);
+NTSTATUS HiveReleaseExclusiveLock(IN PHIVE Hive);
+UINT32 HiveReadBegin(IN PHIVE Hive);
+BOOL HiveReadRetry(IN PHIVE Hive, IN UINT32 Sequence);
+BOOL HiveDeferFreeCell(IN PHIVE Hive, IN UINT32 CellOffset);
+VOID HiveSyncRelease(IN PHIVE Hive);
+VOID HiveKeyChanged(IN PHIVE Hive, IN UINT32 KeyCell);
+VOID HiveKeyDeleted(IN PHIVE Hive, IN UINT32 KeyCell);
+UINT32 HiveGetKeyGeneration(IN PHIVE Hive, IN UINT32 KeyCell);
 
 /* Hint Management */
+NTSTATUS HiveHintInitialize(void);
+VOID HiveHintShutdown(void);
+NTSTATUS HiveAddHint(IN PHIVE Hive, IN HINT_TYPE Type, IN UINT32 CellOffset, IN PCSTR Path);
+UINT32 HiveLookupHint(IN PHIVE Hive, IN PCSTR Path);
 NTSTATUS HiveUpdateHints(IN PHIVE Hive);
 VOID HiveClearHints(IN PHIVE Hive);
 
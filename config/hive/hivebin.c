@@ -4,6 +4,8 @@
  */
 
 #include "hive.h"
+#include "../../include/fs.h"
+#include "../../include/hal.h"
 
 /* Binary block management for hive operations */
 
@@ -16,40 +18,8 @@ UINT32 HiveBinAllocateBlock(IN PHIVE Hive, IN SIZE_T Size)
         return 0;
     }
 
-    HiveAcquireLock(Hive);
-
-    /* Align size to 8-byte boundary */
-    SIZE_T AlignedSize = (Size + 7) & ~7;
-    
-    /* Search for free block */
-    UINT32 Offset = sizeof(HIVE_HEADER);
-    while (Offset < Hive->Size) {
-        PCELL_HEADER Cell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + Offset);
-        
-        if (Cell->Size > 0 && (UINT32)Cell->Size >= AlignedSize) {
-            /* Found suitable free block */
-            if ((UINT32)Cell->Size > AlignedSize + sizeof(CELL_HEADER)) {
-                /* Split the block */
-                PCELL_HEADER NewCell = (PCELL_HEADER)((UINT8*)Cell + AlignedSize);
-                NewCell->Size = Cell->Size - (INT32)AlignedSize;
-                NewCell->Signature = 0;
-                NewCell->Flags = 0;
-            }
-            
-            Cell->Size = -(INT32)AlignedSize;
-            Cell->Signature = 0;
-            Cell->Flags = 0;
-            
-            Hive->Dirty = TRUE;
-            HiveReleaseLock(Hive);
-            return Offset;
-        }
-        
-        Offset += abs(Cell->Size);
-    }
-
-    HiveReleaseLock(Hive);
-    return 0; /* No suitable block found */
+    /* Size-class lists in hivefree.c find the block */
+    return HiveAllocateFromFreeSpace(Hive, Size);
 }
 
 /*
@@ -57,46 +27,15 @@ UINT32 HiveBinAllocateBlock(IN PHIVE Hive, IN SIZE_T Size)
  */
 VOID HiveBinFreeBlock(IN PHIVE Hive, IN UINT32 Offset)
 {
-    if (!Hive || Offset == 0 || Offset >= Hive->Size) {
+    if (!Hive || Offset == 0 || Offset >= Hive->Size || !HiveFaultCell(Hive, Offset)) {
         return;
     }
 
-    HiveAcquireLock(Hive);
-
     PCELL_HEADER Cell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + Offset);
     if (Cell->Size < 0) {
-        /* Mark as free */
-        Cell->Size = -Cell->Size;
-        Cell->Signature = 0;
-        Cell->Flags = 0;
-        
-        /* Try to coalesce with next block */
-        UINT32 NextOffset = Offset + Cell->Size;
-        if (NextOffset < Hive->Size) {
-            PCELL_HEADER NextCell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + NextOffset);
-            if (NextCell->Size > 0) {
-                Cell->Size += NextCell->Size;
-            }
-        }
-        
-        /* Try to coalesce with previous block */
-        UINT32 PrevOffset = sizeof(HIVE_HEADER);
-        while (PrevOffset < Offset) {
-            PCELL_HEADER PrevCell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + PrevOffset);
-            UINT32 PrevEnd = PrevOffset + abs(PrevCell->Size);
-            
-            if (PrevEnd == Offset && PrevCell->Size > 0) {
-                PrevCell->Size += Cell->Size;
-                break;
-            }
-            
-            PrevOffset = PrevEnd;
-        }
-        
-        Hive->Dirty = TRUE;
+        /* Coalesces with free neighbours without walking the hive */
+        HiveMarkSpaceAsFree(Hive, Offset, (SIZE_T)(-Cell->Size));
     }
-
-    HiveReleaseLock(Hive);
 }
 
 /*
@@ -104,7 +43,7 @@ VOID HiveBinFreeBlock(IN PHIVE Hive, IN UINT32 Offset)
  */
 PVOID HiveBinGetData(IN PHIVE Hive, IN UINT32 Offset, IN SIZE_T Size)
 {
-    if (!Hive || Offset == 0 || Offset >= Hive->Size) {
+    if (!Hive || Offset == 0 || Offset >= Hive->Size || !HiveFaultCell(Hive, Offset)) {
         return NULL;
     }
 
@@ -132,6 +71,7 @@ NTSTATUS HiveBinWriteData(IN PHIVE Hive, IN UINT32 Offset, IN PVOID Data, IN SIZ
 
     HiveAcquireLock(Hive);
     memcpy(BlockData, Data, Size);
+    HiveMarkDirtyRange(Hive, BlockData, Size);
     Hive->Dirty = TRUE;
     HiveReleaseLock(Hive);
 
@@ -161,7 +101,7 @@ NTSTATUS HiveBinReadData(IN PHIVE Hive, IN UINT32 Offset, OUT PVOID Data, IN SIZ
  */
 BOOL HiveBinValidateBlock(IN PHIVE Hive, IN UINT32 Offset)
 {
-    if (!Hive || Offset == 0 || Offset >= Hive->Size) {
+    if (!Hive || Offset == 0 || Offset >= Hive->Size || !HiveFaultCell(Hive, Offset)) {
         return FALSE;
     }
 
@@ -189,6 +129,11 @@ NTSTATUS HiveBinCompact(IN PHIVE Hive)
         return STATUS_INVALID_PARAMETER;
     }
 
+    NTSTATUS Status = HiveFaultRange(Hive, 0, Hive->Size);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
     HiveAcquireLock(Hive);
 
     UINT32 ReadOffset = sizeof(HIVE_HEADER);
@@ -221,6 +166,10 @@ NTSTATUS HiveBinCompact(IN PHIVE Hive)
         FreeCell->Flags = 0;
     }
     
+    /* Cells moved; the free lists start over from the new layout */
+    HiveRebuildFreeSpaceMap(Hive);
+    HiveMarkDirtyRange(Hive, (UINT8*)Hive->BaseAddress + sizeof(HIVE_HEADER), Hive->Size - sizeof(HIVE_HEADER));
+
     Hive->Dirty = TRUE;
     HiveReleaseLock(Hive);
 
@@ -241,6 +190,11 @@ NTSTATUS HiveBinGetStatistics(IN PHIVE Hive, OUT PUINT32 AllocatedBlocks, OUT PU
     *TotalSize = 0;
     *FreeSize = 0;
 
+    NTSTATUS Status = HiveFaultRange(Hive, 0, Hive->Size);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
     UINT32 Offset = sizeof(HIVE_HEADER);
     while (Offset < Hive->Size) {
         PCELL_HEADER Cell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + Offset);
@@ -257,4 +211,172 @@ NTSTATUS HiveBinGetStatistics(IN PHIVE Hive, OUT PUINT32 AllocatedBlocks, OUT PU
     }
 
     return STATUS_SUCCESS;
-}
\ No newline at end of file
+}
+
+/*
+ * Start demand loading a hive whose first ResidentBytes are already in its
+ * image. The map takes over File and closes it once every bin is in.
+ */
+NTSTATUS HiveBinMapCreate(IN PHIVE Hive, IN PVOID File, IN UINT64 FileOffset, IN UINT32 ResidentBytes)
+{
+    if (!Hive || !Hive->BaseAddress || !File || Hive->Bins) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    UINT32 BinCount = (UINT32)((Hive->Size + HIVE_BIN_SIZE - 1) >> HIVE_BIN_SHIFT);
+    UINT32 Words = (BinCount + 31) / 32;
+    PHIVE_BIN_MAP Bins = (PHIVE_BIN_MAP)AuroraAllocateMemory(sizeof(HIVE_BIN_MAP) + 2 * Words * sizeof(UINT32));
+    if (!Bins) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    memset(Bins, 0, sizeof(HIVE_BIN_MAP) + 2 * Words * sizeof(UINT32));
+    Bins->Loading = Bins->Resident + Words;
+    Bins->File = File;
+    Bins->FileOffset = FileOffset;
+    Bins->BinCount = BinCount;
+
+    /* Only whole bins count as resident */
+    UINT32 Resident = ResidentBytes >= Hive->Size ? BinCount : ResidentBytes >> HIVE_BIN_SHIFT;
+    for (UINT32 Bin = 0; Bin < Resident; Bin++) {
+        Bins->Resident[Bin / 32] |= 1u << (Bin % 32);
+    }
+    Bins->ResidentCount = Resident;
+
+    Hive->Bins = Bins;
+    if (Resident == BinCount) {
+        FsClose((PFS_HANDLE)File);
+        Bins->File = NULL;
+    }
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Stop demand loading; bins not yet read stay unread
+ */
+VOID HiveBinMapRelease(IN PHIVE Hive)
+{
+    if (!Hive || !Hive->Bins) {
+        return;
+    }
+
+    if (Hive->Bins->File) {
+        FsClose((PFS_HANDLE)Hive->Bins->File);
+    }
+    AuroraFreeMemory(Hive->Bins);
+    Hive->Bins = NULL;
+}
+
+/*
+ * Make sure the bins covering [Offset, Offset + Length) are in memory.
+ * Each run of missing bins is one read. The map lock is dropped for the
+ * read itself: the run is marked loading first, and other faulters that
+ * need a loading bin wait for it to turn resident or be given up.
+ */
+NTSTATUS HiveFaultRange(IN PHIVE Hive, IN UINT32 Offset, IN SIZE_T Length)
+{
+    if (!Hive) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PHIVE_BIN_MAP Bins = Hive->Bins;
+    if (!Bins || Bins->ResidentCount == Bins->BinCount || Length == 0) {
+        return STATUS_SUCCESS;
+    }
+    if (Offset >= Hive->Size) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (Length > Hive->Size - Offset) {
+        Length = Hive->Size - Offset;
+    }
+
+    UINT32 First = Offset >> HIVE_BIN_SHIFT;
+    UINT32 Last = (UINT32)((Offset + Length - 1) >> HIVE_BIN_SHIFT);
+    NTSTATUS Status = STATUS_SUCCESS;
+    AURORA_IRQL OldIrql;
+
+    AuroraAcquireSpinLock(&Bins->Lock, &OldIrql);
+
+    UINT32 Bin = First;
+    while (Bin <= Last && Bins->File) {
+        UINT32 Mask = 1u << (Bin % 32);
+        if (Bins->Resident[Bin / 32] & Mask) {
+            Bin++;
+            continue;
+        }
+        
+        /* Another faulter is reading it; look again once it is done */
+        if (Bins->Loading[Bin / 32] & Mask) {
+            AuroraReleaseSpinLock(&Bins->Lock, OldIrql);
+            HalCpuPause();
+            AuroraAcquireSpinLock(&Bins->Lock, &OldIrql);
+            continue;
+        }
+
+        UINT32 End = Bin;
+        while (End <= Last && !((Bins->Resident[End / 32] | Bins->Loading[End / 32]) & (1u << (End % 32)))) {
+            Bins->Loading[End / 32] |= 1u << (End % 32);
+            End++;
+        }
+
+        SIZE_T Start = (SIZE_T)Bin << HIVE_BIN_SHIFT;
+        SIZE_T Stop = (SIZE_T)End << HIVE_BIN_SHIFT;
+        if (Stop > Hive->Size) {
+            Stop = Hive->Size;
+        }
+
+        /* The file stays open while any bin is not resident */
+        PFS_HANDLE File = (PFS_HANDLE)Bins->File;
+        AuroraReleaseSpinLock(&Bins->Lock, OldIrql);
+
+        UINT64 Read = 0;
+        Status = FsReadAt(File, Bins->FileOffset + Start, (UINT8*)Hive->BaseAddress + Start, Stop - Start, &Read);
+        if (NT_SUCCESS(Status) && Read != Stop - Start) {
+            Status = STATUS_INVALID_FILE_FORMAT;
+        }
+
+        AuroraAcquireSpinLock(&Bins->Lock, &OldIrql);
+        if (NT_SUCCESS(Status)) {
+            Bins->ResidentCount += End - Bin;
+        }
+        for (UINT32 i = Bin; i < End; i++) {
+            Bins->Loading[i / 32] &= ~(1u << (i % 32));
+            if (NT_SUCCESS(Status)) {
+                Bins->Resident[i / 32] |= 1u << (i % 32);
+            }
+        }
+        if (!NT_SUCCESS(Status)) {
+            break;
+        }
+        Bin = End;
+    }
+
+    /* Nothing left to read; the file is not needed any more */
+    if (Bins->ResidentCount == Bins->BinCount && Bins->File) {
+        FsClose((PFS_HANDLE)Bins->File);
+        Bins->File = NULL;
+    }
+
+    AuroraReleaseSpinLock(&Bins->Lock, OldIrql);
+    return Status;
+}
+
+/*
+ * Fault in the cell at CellOffset: its header first, then whatever bins
+ * the size in the header says it spans
+ */
+BOOL HiveFaultCell(IN PHIVE Hive, IN UINT32 CellOffset)
+{
+    PHIVE_BIN_MAP Bins = Hive->Bins;
+    if (!Bins || Bins->ResidentCount == Bins->BinCount) {
+        return TRUE;
+    }
+
+    if (!NT_SUCCESS(HiveFaultRange(Hive, CellOffset, sizeof(CELL_HEADER)))) {
+        return FALSE;
+    }
+
+    PCELL_HEADER Cell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + CellOffset);
+    UINT32 Size = Cell->Size < 0 ? (UINT32)-Cell->Size : (UINT32)Cell->Size;
+    return NT_SUCCESS(HiveFaultRange(Hive, CellOffset, Size));
+}
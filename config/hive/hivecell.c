@@ -34,6 +34,11 @@ VOID HiveFreeCell(IN PHIVE Hive, IN UINT32 CellOffset)
         return;
     }
 
+    /* Lockless readers may still be walking through it */
+    if (HiveDeferFreeCell(Hive, CellOffset)) {
+        return;
+    }
+
     HiveBinFreeBlock(Hive, CellOffset);
 }
 
@@ -42,7 +47,7 @@ VOID HiveFreeCell(IN PHIVE Hive, IN UINT32 CellOffset)
  */
 PVOID HiveGetCell(IN PHIVE Hive, IN UINT32 CellOffset)
 {
-    if (!Hive || CellOffset == 0 || CellOffset >= Hive->Size) {
+    if (!Hive || CellOffset == 0 || CellOffset >= Hive->Size || !HiveFaultCell(Hive, CellOffset)) {
         return NULL;
     }
 
@@ -61,7 +66,7 @@ PVOID HiveGetCell(IN PHIVE Hive, IN UINT32 CellOffset)
  */
 BOOL HiveValidateCell(IN PHIVE Hive, IN UINT32 CellOffset)
 {
-    if (!Hive || CellOffset == 0 || CellOffset >= Hive->Size) {
+    if (!Hive || CellOffset == 0 || CellOffset >= Hive->Size || !HiveFaultCell(Hive, CellOffset)) {
         return FALSE;
     }
 
@@ -139,6 +144,7 @@ UINT32 HiveCreateKeyCell(IN PHIVE Hive, IN PCSTR KeyName, IN UINT32 ParentCell)
     /* Copy key name */
     memcpy(KeyCell->Name, KeyName, NameLength);
 
+    HiveMarkCellDirty(Hive, CellOffset);
     Hive->Dirty = TRUE;
     return CellOffset;
 }
@@ -202,6 +208,7 @@ UINT32 HiveCreateValueCell(IN PHIVE Hive, IN PCSTR ValueName, IN UINT32 Type, IN
             }
             
             memcpy(DataCell, Data, DataSize);
+            HiveMarkCellDirty(Hive, DataOffset);
             ValueCell->DataOffset = DataOffset;
         }
     } else {
@@ -211,6 +218,7 @@ UINT32 HiveCreateValueCell(IN PHIVE Hive, IN PCSTR ValueName, IN UINT32 Type, IN
     /* Copy value name */
     memcpy(ValueCell->Name, ValueName, NameLength);
 
+    HiveMarkCellDirty(Hive, CellOffset);
     Hive->Dirty = TRUE;
     return CellOffset;
 }
@@ -322,6 +330,7 @@ UINT32 HiveResizeCell(IN PHIVE Hive, IN UINT32 OldCellOffset, IN SIZE_T NewSize)
         PCELL_HEADER NewHeader = (PCELL_HEADER)((UINT8*)NewData - sizeof(CELL_HEADER));
         NewHeader->Signature = OldHeader->Signature;
         NewHeader->Flags = OldHeader->Flags;
+        HiveMarkCellDirty(Hive, NewCellOffset);
     }
 
     /* Free old cell */
@@ -180,6 +180,11 @@ NTSTATUS HivePerformIntegrityCheck(IN PHIVE Hive, OUT PUINT32 ErrorCount)
         (*ErrorCount)++;
     }
 
+    NTSTATUS Status = HiveFaultRange(Hive, 0, Hive->Size);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
     /* Walk through all cells */
     UINT32 Offset = sizeof(HIVE_HEADER);
     while (Hive->Header && Offset < Hive->Header->Length) {
@@ -284,6 +289,13 @@ NTSTATUS HiveCheckIntegrity(IN PHIVE Hive, IN PVOID BaseAddress, IN SIZE_T Size)
     }
 
     /* Minimal structural pass */
+    if (BaseAddress == Hive->BaseAddress) {
+        NTSTATUS Status = HiveFaultRange(Hive, 0, Size);
+        if (!NT_SUCCESS(Status)) {
+            return Status;
+        }
+    }
+
     UINT32 Offset = sizeof(HIVE_HEADER);
     while (Offset + sizeof(CELL_HEADER) <= Size) {
         PCELL_HEADER Cell = (PCELL_HEADER)((UINT8*)BaseAddress + Offset);
@@ -0,0 +1,487 @@
+/*
+ * Aurora Kernel - Registry Hive Incremental Compaction
+ * Copyright (c) 2024 NTCore Project
+ *
+ * Compaction runs in steps, each under the writer lock for at most
+ * HIVE_COMPACT_STEP_BYTES of moved cells, so lockless readers only ever
+ * retry around one short step. A step plans when it has no plan or another
+ * writer ran since the last one: it counts live bytes per bin, picks the
+ * tail to empty and walks the key tree once, recording for every cell in
+ * the tail the slot that names it. Each moved cell is copied below the
+ * tail, its slot repointed and the old copy freed; cells in the tail that
+ * hold slots of other tail cells are tracked through Owner, so the slot is
+ * found wherever its holder currently lives. When the plan is used up, the
+ * free space at the end of the hive is released in whole bins.
+ */
+
+#include "hive.h"
+
+/* Bytes from the end of the live data to the start of the tail, as a
+   fraction of the live data, kept for allocations after compaction */
+#define HIVE_COMPACT_HEADROOM_SHIFT 2
+
+/* Keys the planning pass has yet to walk */
+typedef struct _HIVE_COMPACT_STACK {
+    PUINT32 Keys;
+    UINT32 Count;
+    UINT32 Capacity;
+} HIVE_COMPACT_STACK, *PHIVE_COMPACT_STACK;
+
+/*
+ * Compaction state of a hive, allocated on first use
+ */
+static PHIVE_COMPACTOR HiveGetCompactor(IN PHIVE Hive)
+{
+    if (!Hive->Compactor) {
+        PHIVE_COMPACTOR Compactor = (PHIVE_COMPACTOR)AuroraAllocateMemory(sizeof(HIVE_COMPACTOR));
+        if (!Compactor) {
+            return NULL;
+        }
+        memset(Compactor, 0, sizeof(HIVE_COMPACTOR));
+        Hive->Compactor = Compactor;
+    }
+
+    return Hive->Compactor;
+}
+
+/*
+ * Forget the current plan; the next step makes a new one
+ */
+static VOID HiveCompactResetPlan(IN PHIVE_COMPACTOR Compactor)
+{
+    Compactor->Size = 0;
+    Compactor->RefCount = 0;
+    Compactor->Next = 0;
+}
+
+/*
+ * Free a hive's compaction state
+ */
+VOID HiveCompactRelease(IN PHIVE Hive)
+{
+    if (!Hive || !Hive->Compactor) {
+        return;
+    }
+
+    AuroraFreeMemory(Hive->Compactor->BinLive);
+    AuroraFreeMemory(Hive->Compactor->Refs);
+    AuroraFreeMemory(Hive->Compactor->Order);
+    AuroraFreeMemory(Hive->Compactor);
+    Hive->Compactor = NULL;
+}
+
+/*
+ * Record the slot naming Target if Target lies in the tail. Returns the
+ * new ref, or HIVE_COMPACT_NO_REF for cells that stay where they are.
+ */
+static UINT32 HiveCompactAddRef(IN PHIVE Hive, IN PHIVE_COMPACTOR Compactor, IN UINT32 Target,
+                                IN PUINT32 Slot, IN UINT32 Owner, IN OUT NTSTATUS* Status)
+{
+    if (Target < Compactor->TailStart || Target >= Hive->Size || !NT_SUCCESS(*Status)) {
+        return HIVE_COMPACT_NO_REF;
+    }
+
+    if (Compactor->RefCount == Compactor->RefCapacity) {
+        UINT32 Capacity = Compactor->RefCapacity ? Compactor->RefCapacity * 2 : 256;
+        PHIVE_CELL_REF Refs = (PHIVE_CELL_REF)AuroraAllocateMemory(Capacity * sizeof(HIVE_CELL_REF));
+        PUINT32 Order = (PUINT32)AuroraAllocateMemory(Capacity * sizeof(UINT32));
+        if (!Refs || !Order) {
+            AuroraFreeMemory(Refs);
+            AuroraFreeMemory(Order);
+            *Status = STATUS_INSUFFICIENT_RESOURCES;
+            return HIVE_COMPACT_NO_REF;
+        }
+        if (Compactor->RefCount) {
+            memcpy(Refs, Compactor->Refs, Compactor->RefCount * sizeof(HIVE_CELL_REF));
+        }
+        AuroraFreeMemory(Compactor->Refs);
+        AuroraFreeMemory(Compactor->Order);
+        Compactor->Refs = Refs;
+        Compactor->Order = Order;
+        Compactor->RefCapacity = Capacity;
+    }
+
+    PHIVE_CELL_REF Ref = &Compactor->Refs[Compactor->RefCount];
+    Ref->Target = Target;
+    Ref->Slot = (UINT32)((UINT8*)Slot - (UINT8*)Hive->BaseAddress);
+    Ref->Owner = Owner;
+    Ref->Moved = 0;
+    return Compactor->RefCount++;
+}
+
+/*
+ * Queue a key for the planning pass, growing the stack on the heap
+ */
+static VOID HiveCompactPush(IN OUT PHIVE_COMPACT_STACK Stack, IN UINT32 KeyOffset, IN OUT NTSTATUS* Status)
+{
+    if (!NT_SUCCESS(*Status)) {
+        return;
+    }
+
+    if (Stack->Count == Stack->Capacity) {
+        UINT32 Capacity = Stack->Capacity ? Stack->Capacity * 2 : 64;
+        PUINT32 Keys = (PUINT32)AuroraAllocateMemory(Capacity * sizeof(UINT32));
+        if (!Keys) {
+            *Status = STATUS_INSUFFICIENT_RESOURCES;
+            return;
+        }
+        if (Stack->Count) {
+            memcpy(Keys, Stack->Keys, Stack->Count * sizeof(UINT32));
+        }
+        AuroraFreeMemory(Stack->Keys);
+        Stack->Keys = Keys;
+        Stack->Capacity = Capacity;
+    }
+
+    Stack->Keys[Stack->Count++] = KeyOffset;
+}
+
+/*
+ * Reverse-reference pass over one key: its value list, values and value
+ * data, and its subkey index. Subkeys are pushed on Stack for the caller.
+ */
+static VOID HiveCompactWalkKey(IN PHIVE Hive, IN PHIVE_COMPACTOR Compactor, IN UINT32 KeyOffset,
+                               IN OUT PHIVE_COMPACT_STACK Stack, IN OUT NTSTATUS* Status)
+{
+    PKEY_CELL Key = HiveGetKeyCell(Hive, KeyOffset);
+    if (!Key || !NT_SUCCESS(*Status)) {
+        return;
+    }
+
+    if (Key->ValuesCount && Key->ValuesList) {
+        UINT32 ListRef = HiveCompactAddRef(Hive, Compactor, Key->ValuesList, &Key->ValuesList, HIVE_COMPACT_NO_REF, Status);
+        PUINT32 List = (PUINT32)HiveGetCell(Hive, Key->ValuesList);
+        for (UINT32 i = 0; List && i < Key->ValuesCount; i++) {
+            UINT32 ValueRef = HiveCompactAddRef(Hive, Compactor, List[i], &List[i], ListRef, Status);
+            PVALUE_CELL Value = HiveGetValueCell(Hive, List[i]);
+            if (Value && Value->DataLength > 4 && Value->DataOffset) {
+                HiveCompactAddRef(Hive, Compactor, Value->DataOffset, &Value->DataOffset, ValueRef, Status);
+            }
+        }
+    }
+
+    if (!Key->SubKeysCount || !HiveValidateCell(Hive, Key->SubKeysList)) {
+        return;
+    }
+
+    UINT32 IndexRef = HiveCompactAddRef(Hive, Compactor, Key->SubKeysList, &Key->SubKeysList, HIVE_COMPACT_NO_REF, Status);
+    PCELL_HEADER Header = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + Key->SubKeysList);
+
+    if (Header->Signature == CellTypeIndexRoot) {
+        PINDEX_ROOT_CELL Root = (PINDEX_ROOT_CELL)HiveGetCell(Hive, Key->SubKeysList);
+        for (UINT32 i = 0; i < Root->Count; i++) {
+            HiveCompactAddRef(Hive, Compactor, Root->Leaves[i], &Root->Leaves[i], IndexRef, Status);
+        }
+        for (UINT32 i = 0; i < Root->Count; i++) {
+            PHASH_LEAF_CELL Leaf = (PHASH_LEAF_CELL)HiveGetCell(Hive, Root->Leaves[i]);
+            for (UINT32 j = 0; Leaf && j < Leaf->Count; j++) {
+                HiveCompactPush(Stack, Leaf->Entries[j].Cell, Status);
+            }
+        }
+    } else if (Header->Signature == CellTypeHashLeaf) {
+        PHASH_LEAF_CELL Leaf = (PHASH_LEAF_CELL)HiveGetCell(Hive, Key->SubKeysList);
+        for (UINT32 j = 0; j < Leaf->Count; j++) {
+            HiveCompactPush(Stack, Leaf->Entries[j].Cell, Status);
+        }
+    }
+}
+
+/*
+ * Walk the key tree from Root without recursion. A hive cannot hold more
+ * keys than fit in it, so visiting more means a cycle in a damaged hive
+ * and fails the plan.
+ */
+static VOID HiveCompactWalkTree(IN PHIVE Hive, IN PHIVE_COMPACTOR Compactor, IN UINT32 Root, IN OUT NTSTATUS* Status)
+{
+    HIVE_COMPACT_STACK Stack = { NULL, 0, 0 };
+    UINT32 MaxKeys = (UINT32)(Hive->Size / (sizeof(CELL_HEADER) + sizeof(KEY_CELL)));
+    UINT32 Visited = 0;
+
+    HiveCompactPush(&Stack, Root, Status);
+    while (Stack.Count && NT_SUCCESS(*Status)) {
+        if (++Visited > MaxKeys) {
+            *Status = STATUS_UNSUCCESSFUL;
+            break;
+        }
+        HiveCompactWalkKey(Hive, Compactor, Stack.Keys[--Stack.Count], &Stack, Status);
+    }
+
+    AuroraFreeMemory(Stack.Keys);
+}
+
+/*
+ * Sort the move order so the sparsest tail bins are emptied first
+ */
+static VOID HiveCompactSortOrder(IN PHIVE_COMPACTOR Compactor)
+{
+    PUINT32 Order = Compactor->Order;
+    UINT32 Count = Compactor->RefCount;
+
+    for (UINT32 i = 0; i < Count; i++) {
+        Order[i] = i;
+    }
+
+    /* Shell sort on (live bytes of the bin, offset) */
+    for (UINT32 Gap = Count / 2; Gap > 0; Gap /= 2) {
+        for (UINT32 i = Gap; i < Count; i++) {
+            UINT32 Index = Order[i];
+            UINT32 Target = Compactor->Refs[Index].Target;
+            UINT32 Live = Compactor->BinLive[Target >> HIVE_BIN_SHIFT];
+            UINT32 j = i;
+            while (j >= Gap) {
+                UINT32 Other = Compactor->Refs[Order[j - Gap]].Target;
+                UINT32 OtherLive = Compactor->BinLive[Other >> HIVE_BIN_SHIFT];
+                if (OtherLive < Live || (OtherLive == Live && Other < Target)) {
+                    break;
+                }
+                Order[j] = Order[j - Gap];
+                j -= Gap;
+            }
+            Order[j] = Index;
+        }
+    }
+}
+
+/*
+ * Count live bytes per bin, choose the tail and collect the slots naming
+ * the cells in it
+ */
+static NTSTATUS HiveCompactPlan(IN PHIVE Hive, IN PHIVE_COMPACTOR Compactor)
+{
+    HiveCompactResetPlan(Compactor);
+
+    NTSTATUS Status = HiveFaultRange(Hive, 0, Hive->Size);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
+    UINT32 BinCount = (UINT32)((Hive->Size + HIVE_BIN_SIZE - 1) >> HIVE_BIN_SHIFT);
+    if (BinCount > Compactor->BinCapacity) {
+        PUINT32 BinLive = (PUINT32)AuroraAllocateMemory(BinCount * sizeof(UINT32));
+        if (!BinLive) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        AuroraFreeMemory(Compactor->BinLive);
+        Compactor->BinLive = BinLive;
+        Compactor->BinCapacity = BinCount;
+    }
+    memset(Compactor->BinLive, 0, BinCount * sizeof(UINT32));
+
+    UINT32 Live = sizeof(HIVE_HEADER);
+    UINT32 Offset = sizeof(HIVE_HEADER);
+    while (Offset < Hive->Size) {
+        PCELL_HEADER Cell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + Offset);
+        if (Cell->Size == 0) {
+            return STATUS_UNSUCCESSFUL;
+        }
+        if (Cell->Size < 0) {
+            Compactor->BinLive[Offset >> HIVE_BIN_SHIFT] += (UINT32)-Cell->Size;
+            Live += (UINT32)-Cell->Size;
+        }
+        Offset += Cell->Size < 0 ? (UINT32)-Cell->Size : (UINT32)Cell->Size;
+    }
+
+    UINT64 Keep = (UINT64)Live + (Live >> HIVE_COMPACT_HEADROOM_SHIFT);
+    Keep = (Keep + HIVE_BIN_SIZE - 1) & ~(UINT64)(HIVE_BIN_SIZE - 1);
+    Compactor->TailStart = Keep < Hive->Size ? (UINT32)Keep : (UINT32)Hive->Size;
+    Compactor->Size = Hive->Size;
+
+    if (Compactor->TailStart < Hive->Size && Hive->RootKeyOffset) {
+        HiveCompactWalkTree(Hive, Compactor, Hive->RootKeyOffset, &Status);
+        if (!NT_SUCCESS(Status)) {
+            HiveCompactResetPlan(Compactor);
+            return Status;
+        }
+        HiveCompactSortOrder(Compactor);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Copy one tail cell below the tail and repoint the slot naming it. FALSE
+ * when no free cell below the tail fits; the cell then stays.
+ */
+static BOOLEAN HiveCompactMove(IN PHIVE Hive, IN PHIVE_COMPACTOR Compactor, IN PHIVE_CELL_REF Ref, OUT PUINT32 Bytes)
+{
+    UINT32 Slot = Ref->Slot;
+    if (Ref->Owner != HIVE_COMPACT_NO_REF && Compactor->Refs[Ref->Owner].Moved) {
+        PHIVE_CELL_REF Owner = &Compactor->Refs[Ref->Owner];
+        Slot = Owner->Moved + (Ref->Slot - Owner->Target);
+    }
+
+    PUINT32 SlotPointer = (PUINT32)((UINT8*)Hive->BaseAddress + Slot);
+    PCELL_HEADER Cell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + Ref->Target);
+    *Bytes = 0;
+    if (*SlotPointer != Ref->Target || Cell->Size >= 0) {
+        return FALSE;
+    }
+
+    UINT32 Size = (UINT32)-Cell->Size;
+    UINT32 NewOffset = HiveAllocateBelow(Hive, Size, Compactor->TailStart);
+    if (!NewOffset) {
+        return FALSE;
+    }
+
+    PCELL_HEADER NewCell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + NewOffset);
+    memcpy(NewCell + 1, Cell + 1, Size - sizeof(CELL_HEADER));
+    NewCell->Signature = Cell->Signature;
+    NewCell->Flags = Cell->Flags;
+    HiveMarkCellDirty(Hive, NewOffset);
+
+    *SlotPointer = NewOffset;
+    HiveMarkDirtyRange(Hive, SlotPointer, sizeof(UINT32));
+    Ref->Moved = NewOffset;
+
+    HiveFreeCell(Hive, Ref->Target);
+    *Bytes = Size;
+    return TRUE;
+}
+
+/*
+ * Cut the free space at the end of the hive back to whole bins. The
+ * released bytes first become a free cell of their own, so the image is
+ * valid at the old size as well as the new one.
+ */
+static NTSTATUS HiveCompactTrim(IN PHIVE Hive, IN PHIVE_COMPACTOR Compactor)
+{
+    UINT32 FreeStart = HiveTrailingFreeCell(Hive);
+    if (!FreeStart) {
+        return STATUS_SUCCESS;
+    }
+
+    UINT32 NewSize = (FreeStart + HIVE_BIN_SIZE - 1) & ~(HIVE_BIN_SIZE - 1);
+    if (NewSize < Compactor->TailStart) {
+        NewSize = Compactor->TailStart;
+    }
+    if (NewSize + HIVE_MIN_FREE_CELL > Hive->Size) {
+        return STATUS_SUCCESS;
+    }
+
+    UINT32 OldSize = (UINT32)Hive->Size;
+    UINT8* Base = (UINT8*)Hive->BaseAddress;
+
+    /* Split the trailing free cell at NewSize, tags included; the lists
+       are stale until the rebuild below, and nothing allocates before it */
+    HiveAcquireLock(Hive);
+    if (NewSize > FreeStart) {
+        PCELL_HEADER Kept = (PCELL_HEADER)(Base + FreeStart);
+        Kept->Size = (INT32)(NewSize - FreeStart);
+        HiveMarkDirtyRange(Hive, Kept, sizeof(CELL_HEADER));
+        if (NewSize - FreeStart >= HIVE_MIN_FREE_CELL) {
+            *(PUINT32)(Base + NewSize - sizeof(UINT32)) = NewSize - FreeStart;
+            HiveMarkDirtyRange(Hive, Base + NewSize - sizeof(UINT32), sizeof(UINT32));
+        }
+    }
+    PCELL_HEADER Released = (PCELL_HEADER)(Base + NewSize);
+    Released->Size = (INT32)(OldSize - NewSize);
+    Released->Signature = CellTypeFree;
+    Released->Flags = 0;
+    *(PUINT32)(Base + OldSize - sizeof(UINT32)) = OldSize - NewSize;
+    HiveMarkDirtyRange(Hive, Released, sizeof(CELL_HEADER));
+    HiveMarkDirtyRange(Hive, Base + OldSize - sizeof(UINT32), sizeof(UINT32));
+    HiveReleaseLock(Hive);
+
+    NTSTATUS Status = STATUS_SUCCESS;
+    if (Hive->Journal) {
+        Status = HiveJournalTruncate(Hive, NewSize);
+    } else {
+        Hive->Size = NewSize;
+        if (Hive->Header) {
+            Hive->Header->Size = NewSize;
+            HiveMarkDirtyRange(Hive, &Hive->Header->Size, sizeof(UINT32));
+        }
+    }
+
+    /* The lists are rebuilt either way: the split above left them stale */
+    HiveRebuildFreeSpaceMap(Hive);
+    if (NT_SUCCESS(Status)) {
+        Compactor->BytesReleased += OldSize - NewSize;
+        Hive->Dirty = TRUE;
+    }
+    return Status;
+}
+
+/*
+ * Move up to Budget bytes of cells out of the tail. Done is set once the
+ * tail has been emptied as far as it will go and released.
+ */
+NTSTATUS HiveCompactStep(IN PHIVE Hive, IN UINT32 Budget, OUT PBOOLEAN Done)
+{
+    if (!Hive || !Hive->BaseAddress || !Done) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    *Done = FALSE;
+    if (Hive->ReadOnly) {
+        return STATUS_ACCESS_DENIED;
+    }
+
+    NTSTATUS Status = HiveAcquireExclusiveLock(Hive, 0);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
+    PHIVE_COMPACTOR Compactor = HiveGetCompactor(Hive);
+    if (!Compactor) {
+        HiveReleaseExclusiveLock(Hive);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    /* Any other writer since the last step may have moved the slots */
+    if (Compactor->Size != Hive->Size || Compactor->Sequence + 2 != Hive->Sync.Sequence) {
+        Status = HiveCompactPlan(Hive, Compactor);
+    }
+
+    UINT32 Moved = 0;
+    while (NT_SUCCESS(Status) && Compactor->Next < Compactor->RefCount && Moved < Budget) {
+        PHIVE_CELL_REF Ref = &Compactor->Refs[Compactor->Order[Compactor->Next++]];
+        UINT32 Bytes;
+        if (HiveCompactMove(Hive, Compactor, Ref, &Bytes)) {
+            Compactor->CellsMoved++;
+            Moved += Bytes;
+        }
+    }
+
+    if (NT_SUCCESS(Status) && Compactor->Next >= Compactor->RefCount) {
+        Status = HiveCompactTrim(Hive, Compactor);
+        HiveCompactResetPlan(Compactor);
+        *Done = TRUE;
+    }
+
+    Compactor->Sequence = Hive->Sync.Sequence;
+    HiveReleaseExclusiveLock(Hive);
+    return Status;
+}
+
+/*
+ * Whether free space is scattered enough, and plentiful enough, for
+ * compaction to give bins back
+ */
+BOOLEAN HiveNeedsCompaction(IN PHIVE Hive)
+{
+    if (!Hive || !Hive->BaseAddress || Hive->ReadOnly || !Hive->FreeSpace) {
+        return FALSE;
+    }
+
+    return Hive->FreeSpace->FreeBytes >= 2 * HIVE_BIN_SIZE &&
+           HiveGetFragmentationLevel(Hive) >= HIVE_COMPACT_THRESHOLD;
+}
+
+/*
+ * Compact a hive completely, one step at a time
+ */
+NTSTATUS HiveCompact(IN PHIVE Hive)
+{
+    if (!Hive) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    BOOLEAN Done = FALSE;
+    NTSTATUS Status = STATUS_SUCCESS;
+    while (NT_SUCCESS(Status) && !Done) {
+        Status = HiveCompactStep(Hive, HIVE_COMPACT_STEP_BYTES, &Done);
+    }
+
+    return Status;
+}
@@ -1,6 +1,12 @@
 /*
  * Aurora Kernel - Hive Free Space Management
  * Copyright (c) 2024 NTCore Project
+ *
+ * Each hive keeps its free cells on segregated size-class lists (see
+ * HIVE_FREE_SPACE in hive.h). Allocation takes the head of the first
+ * non-empty class that is guaranteed to fit, found with one bitmap scan;
+ * freeing merges with both neighbours through the next cell's header and
+ * the previous cell's boundary tag. Neither walks the hive.
  */
 
 #include "hive.h"
@@ -10,45 +16,201 @@
 #define abs(x) ((x) < 0 ? -(x) : (x))
 #endif
 
-/* Forward declarations */
+/* Cells looked at on a power-of-two list before moving up a class */
+#define HIVE_FREE_SCAN_LIMIT    8
+
+/* Cells looked at per class when the allocation must sit below a limit */
+#define HIVE_BELOW_SCAN_LIMIT   32
+
 static NTSTATUS HiveCoalesceFreeSpace(IN PHIVE Hive, IN UINT32 Offset);
 
-/* API helpers declared in header but not yet implemented elsewhere */
+static PFREE_CELL HiveFreeCellAt(IN PHIVE Hive, IN UINT32 Offset)
+{
+    return (PFREE_CELL)((UINT8*)Hive->BaseAddress + Offset);
+}
+
+/*
+ * Size class of a free cell: exact below 256 bytes, powers of two above
+ */
+static UINT32 HiveSizeClass(IN UINT32 Size)
+{
+    if (Size < 256) {
+        return Size / HIVE_CELL_GRANULE;
+    }
+
+    UINT32 Class = 32 + (31 - (UINT32)__builtin_clz(Size)) - 8;
+    return Class < HIVE_FREE_CLASSES ? Class : HIVE_FREE_CLASSES - 1;
+}
+
+/*
+ * Smallest size a cell on a class list can have
+ */
+static UINT32 HiveClassFloor(IN UINT32 Class)
+{
+    return Class < 32 ? Class * HIVE_CELL_GRANULE : 1u << (Class - 32 + 8);
+}
+
+static BOOL HiveIsFreeStart(IN PHIVE_FREE_SPACE State, IN UINT32 Offset)
+{
+    UINT32 Granule = Offset / HIVE_CELL_GRANULE;
+    return (State->StartBitmap[Granule / 32] >> (Granule % 32)) & 1;
+}
+
+static VOID HiveSetFreeStart(IN PHIVE_FREE_SPACE State, IN UINT32 Offset, IN BOOL Set)
+{
+    UINT32 Granule = Offset / HIVE_CELL_GRANULE;
+    if (Set) {
+        State->StartBitmap[Granule / 32] |= 1u << (Granule % 32);
+    } else {
+        State->StartBitmap[Granule / 32] &= ~(1u << (Granule % 32));
+    }
+}
+
+/*
+ * Put a free cell on its class list and write its boundary tag. Cells too
+ * small to hold the links are left as untracked slack.
+ */
+static VOID HiveFreeListInsert(IN PHIVE Hive, IN UINT32 Offset, IN UINT32 Size)
+{
+    PHIVE_FREE_SPACE State = Hive->FreeSpace;
+    PFREE_CELL Cell = HiveFreeCellAt(Hive, Offset);
+
+    Cell->Header.Size = (INT32)Size;
+    Cell->Header.Signature = CellTypeFree;
+    Cell->Header.Flags = 0;
+    if (Size < HIVE_MIN_FREE_CELL || (Size % HIVE_CELL_GRANULE) || (Offset % HIVE_CELL_GRANULE)) {
+        HiveMarkDirtyRange(Hive, Cell, sizeof(CELL_HEADER));
+        return;
+    }
+
+    UINT32 Class = HiveSizeClass(Size);
+    Cell->Prev = 0;
+    Cell->Next = State->Heads[Class];
+    if (Cell->Next) {
+        PFREE_CELL Next = HiveFreeCellAt(Hive, Cell->Next);
+        Next->Prev = Offset;
+        HiveMarkDirtyRange(Hive, &Next->Prev, sizeof(UINT32));
+    }
+    State->Heads[Class] = Offset;
+    State->ClassBitmap |= 1ull << Class;
+
+    *(PUINT32)((UINT8*)Cell + Size - sizeof(UINT32)) = Size;
+    HiveMarkDirtyRange(Hive, Cell, sizeof(FREE_CELL));
+    HiveMarkDirtyRange(Hive, (UINT8*)Cell + Size - sizeof(UINT32), sizeof(UINT32));
+    HiveSetFreeStart(State, Offset, TRUE);
+    State->FreeCells++;
+    State->FreeBytes += Size;
+}
+
+/*
+ * Take a tracked free cell off its class list
+ */
+static VOID HiveFreeListRemove(IN PHIVE Hive, IN UINT32 Offset)
+{
+    PHIVE_FREE_SPACE State = Hive->FreeSpace;
+    PFREE_CELL Cell = HiveFreeCellAt(Hive, Offset);
+    UINT32 Class = HiveSizeClass((UINT32)Cell->Header.Size);
+
+    if (Cell->Prev) {
+        PFREE_CELL Prev = HiveFreeCellAt(Hive, Cell->Prev);
+        Prev->Next = Cell->Next;
+        HiveMarkDirtyRange(Hive, &Prev->Next, sizeof(UINT32));
+    } else {
+        State->Heads[Class] = Cell->Next;
+        if (!Cell->Next) {
+            State->ClassBitmap &= ~(1ull << Class);
+        }
+    }
+    if (Cell->Next) {
+        PFREE_CELL Next = HiveFreeCellAt(Hive, Cell->Next);
+        Next->Prev = Cell->Prev;
+        HiveMarkDirtyRange(Hive, &Next->Prev, sizeof(UINT32));
+    }
+
+    HiveSetFreeStart(State, Offset, FALSE);
+    State->FreeCells--;
+    State->FreeBytes -= (UINT32)Cell->Header.Size;
+}
+
+/*
+ * Reset a hive's free lists, allocating them on first use
+ */
 VOID HiveFreeSpaceClear(IN PHIVE Hive)
 {
-    UNREFERENCED_PARAMETER(Hive);
-    /* In a full implementation, this would clear per-hive tracking structures. */
+    if (!Hive) {
+        return;
+    }
+
+    UINT32 Words = (UINT32)((Hive->Size / HIVE_CELL_GRANULE + 31) / 32);
+    PHIVE_FREE_SPACE State = Hive->FreeSpace;
+
+    if (State && State->StartBitmapWords != Words) {
+        HiveFreeSpaceRelease(Hive);
+        State = NULL;
+    }
+
+    if (!State) {
+        State = (PHIVE_FREE_SPACE)AuroraAllocateMemory(sizeof(HIVE_FREE_SPACE));
+        if (!State) {
+            return;
+        }
+        State->StartBitmap = (PUINT32)AuroraAllocateMemory(Words * sizeof(UINT32));
+        if (!State->StartBitmap) {
+            AuroraFreeMemory(State);
+            return;
+        }
+        State->StartBitmapWords = Words;
+        Hive->FreeSpace = State;
+    }
+
+    memset(State->Heads, 0, sizeof(State->Heads));
+    memset(State->StartBitmap, 0, Words * sizeof(UINT32));
+    State->ClassBitmap = 0;
+    State->FreeCells = 0;
+    State->FreeBytes = 0;
 }
 
+/*
+ * Record a free extent, merging it with free neighbours
+ */
 VOID HiveFreeSpaceAdd(IN PHIVE Hive, IN UINT32 Offset, IN UINT32 Size)
 {
-    UNREFERENCED_PARAMETER(Hive);
-    UNREFERENCED_PARAMETER(Offset);
-    UNREFERENCED_PARAMETER(Size);
-    /* In a full implementation, this would record a free extent for the hive. */
-}
+    if (!Hive || Offset < sizeof(HIVE_HEADER) || Size == 0 || Offset + Size > Hive->Size) {
+        return;
+    }
+
+    if (!Hive->FreeSpace) {
+        HiveFreeSpaceClear(Hive);
+        if (!Hive->FreeSpace) {
+            return;
+        }
+    }
 
-/* Free space management for registry hive */
+    PCELL_HEADER Cell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + Offset);
+    Cell->Size = (INT32)Size;
+    HiveCoalesceFreeSpace(Hive, Offset);
+}
 
-/* Free space tracking structure */
-typedef struct _FREE_SPACE_ENTRY {
-    UINT32 Offset;
-    UINT32 Size;
-    struct _FREE_SPACE_ENTRY* Next;
-} FREE_SPACE_ENTRY, *PFREE_SPACE_ENTRY;
+/*
+ * Drop a hive's free lists; the cells themselves are untouched
+ */
+VOID HiveFreeSpaceRelease(IN PHIVE Hive)
+{
+    if (!Hive || !Hive->FreeSpace) {
+        return;
+    }
 
-/* Global free space list */
-static PFREE_SPACE_ENTRY g_FreeSpaceList = NULL;
-static AURORA_SPINLOCK g_FreeSpaceLock;
+    AuroraFreeMemory(Hive->FreeSpace->StartBitmap);
+    AuroraFreeMemory(Hive->FreeSpace);
+    Hive->FreeSpace = NULL;
+}
 
 /*
  * Initialize free space management
  */
 NTSTATUS HiveFreeSpaceInitialize(void)
 {
-    g_FreeSpaceList = NULL;
-    /* Initialize spinlock - simplified for kernel */
-    g_FreeSpaceLock = 0;
+    /* Free space is tracked per hive; nothing global to set up */
     return STATUS_SUCCESS;
 }
 
@@ -57,12 +219,32 @@ NTSTATUS HiveFreeSpaceInitialize(void)
  */
 VOID HiveFreeSpaceShutdown(void)
 {
-    /* Clean up free space list */
-    while (g_FreeSpaceList) {
-        PFREE_SPACE_ENTRY Entry = g_FreeSpaceList;
-        g_FreeSpaceList = g_FreeSpaceList->Next;
-        /* Free entry memory - would use kernel allocator */
+}
+
+/*
+ * Free lists of a hive, built from a scan the first time they are needed
+ */
+static PHIVE_FREE_SPACE HiveGetFreeSpace(IN PHIVE Hive)
+{
+    if (!Hive->FreeSpace && Hive->BaseAddress) {
+        HiveRebuildFreeSpaceMap(Hive);
+    }
+
+    return Hive->FreeSpace;
+}
+
+/*
+ * Bytes a request takes as a cell: granule aligned, and big enough to be
+ * put back on a free list later
+ */
+static UINT32 HiveFreeRequestSize(IN SIZE_T Size)
+{
+    SIZE_T AlignedSize = (Size + HIVE_CELL_GRANULE - 1) & ~(SIZE_T)(HIVE_CELL_GRANULE - 1);
+    if (AlignedSize < HIVE_MIN_FREE_CELL) {
+        AlignedSize = HIVE_MIN_FREE_CELL;
     }
+
+    return AlignedSize > 0x7FFFFFFF ? 0 : (UINT32)AlignedSize;
 }
 
 /*
@@ -74,22 +256,38 @@ UINT32 HiveFindFreeSpace(IN PHIVE Hive, IN SIZE_T RequiredSize)
         return 0;
     }
 
-    /* Align size to 8-byte boundary */
-    SIZE_T AlignedSize = (RequiredSize + 7) & ~7;
-    
-    UINT32 Offset = sizeof(HIVE_HEADER);
-    while (Offset < Hive->Size) {
-        PCELL_HEADER Cell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + Offset);
-        
-        /* Check if this is a free block */
-        if (Cell->Size > 0 && (UINT32)Cell->Size >= AlignedSize) {
-            return Offset;
+    PHIVE_FREE_SPACE State = HiveGetFreeSpace(Hive);
+    UINT32 AlignedSize = HiveFreeRequestSize(RequiredSize);
+    if (!State || !AlignedSize) {
+        return 0;
+    }
+
+    UINT32 Class = HiveSizeClass(AlignedSize);
+
+    /* Cells on a power-of-two list may still be too small; look at a few */
+    if (Class >= 32) {
+        UINT32 Offset = State->Heads[Class];
+        for (UINT32 i = 0; Offset && i < HIVE_FREE_SCAN_LIMIT; i++) {
+            PFREE_CELL Cell = HiveFreeCellAt(Hive, Offset);
+            if ((UINT32)Cell->Header.Size >= AlignedSize) {
+                return Offset;
+            }
+            Offset = Cell->Next;
         }
-        
-        Offset += abs(Cell->Size);
+        Class++;
     }
 
-    return 0; /* No suitable free space found */
+    if (Class >= HIVE_FREE_CLASSES) {
+        return 0;
+    }
+
+    /* Every cell on a higher list fits */
+    UINT64 Candidates = State->ClassBitmap & (~0ull << Class);
+    if (!Candidates) {
+        return 0;
+    }
+
+    return State->Heads[__builtin_ctzll(Candidates)];
 }
 
 /*
@@ -107,14 +305,19 @@ NTSTATUS HiveMarkSpaceAsFree(IN PHIVE Hive, IN UINT32 Offset, IN SIZE_T Size)
 
     HiveAcquireLock(Hive);
 
+    if (!HiveGetFreeSpace(Hive)) {
+        HiveReleaseLock(Hive);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
     PCELL_HEADER Cell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + Offset);
     Cell->Size = (INT32)Size;
     Cell->Signature = 0;
     Cell->Flags = 0;
-    
-    /* Try to coalesce with adjacent free blocks */
+
+    /* Merge with adjacent free blocks and put the result on its list */
     HiveCoalesceFreeSpace(Hive, Offset);
-    
+
     Hive->Dirty = TRUE;
     HiveReleaseLock(Hive);
 
@@ -122,43 +325,54 @@ NTSTATUS HiveMarkSpaceAsFree(IN PHIVE Hive, IN UINT32 Offset, IN SIZE_T Size)
 }
 
 /*
- * Coalesce adjacent free spaces
+ * Merge an untracked free cell with its free neighbours and track the
+ * result. The next cell is found through this cell's size, the previous one
+ * through the boundary tag just below Offset, checked against the start
+ * bitmap since allocated data can look like a tag.
  */
 static NTSTATUS HiveCoalesceFreeSpace(IN PHIVE Hive, IN UINT32 Offset)
 {
-    if (!Hive || Offset == 0) {
+    if (!Hive || Offset == 0 || !Hive->FreeSpace) {
         return STATUS_INVALID_PARAMETER;
     }
 
+    PHIVE_FREE_SPACE State = Hive->FreeSpace;
+
     PCELL_HEADER Cell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + Offset);
     if (Cell->Size <= 0) {
         return STATUS_INVALID_PARAMETER; /* Not a free block */
     }
 
+    UINT32 Start = Offset;
+    UINT32 Size = (UINT32)Cell->Size;
+
     /* Coalesce with next block */
-    UINT32 NextOffset = Offset + Cell->Size;
-    if (NextOffset < Hive->Size) {
+    UINT32 NextOffset = Offset + Size;
+    if (NextOffset + sizeof(CELL_HEADER) <= Hive->Size) {
         PCELL_HEADER NextCell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + NextOffset);
-        if (NextCell->Size > 0) {
-            Cell->Size += NextCell->Size;
+        if (NextCell->Size > 0 && NextOffset + (UINT32)NextCell->Size <= Hive->Size) {
+            if (!(NextOffset % HIVE_CELL_GRANULE) && HiveIsFreeStart(State, NextOffset)) {
+                HiveFreeListRemove(Hive, NextOffset);
+            }
+            Size += (UINT32)NextCell->Size;
         }
     }
 
     /* Coalesce with previous block */
-    UINT32 PrevOffset = sizeof(HIVE_HEADER);
-    while (PrevOffset < Offset) {
-        PCELL_HEADER PrevCell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + PrevOffset);
-        UINT32 PrevEnd = PrevOffset + abs(PrevCell->Size);
-        
-        if (PrevEnd == Offset && PrevCell->Size > 0) {
-            /* Previous block is free and adjacent */
-            PrevCell->Size += Cell->Size;
-            break;
+    if (!(Offset % HIVE_CELL_GRANULE) && Offset >= sizeof(HIVE_HEADER) + HIVE_MIN_FREE_CELL) {
+        UINT32 Tag = *(PUINT32)((UINT8*)Hive->BaseAddress + Offset - sizeof(UINT32));
+        if (Tag >= HIVE_MIN_FREE_CELL && !(Tag % HIVE_CELL_GRANULE) && Tag <= Offset - sizeof(HIVE_HEADER)) {
+            UINT32 PrevOffset = Offset - Tag;
+            PCELL_HEADER PrevCell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + PrevOffset);
+            if (HiveIsFreeStart(State, PrevOffset) && PrevCell->Size == (INT32)Tag) {
+                HiveFreeListRemove(Hive, PrevOffset);
+                Start = PrevOffset;
+                Size += Tag;
+            }
         }
-        
-        PrevOffset = PrevEnd;
     }
 
+    HiveFreeListInsert(Hive, Start, Size);
     return STATUS_SUCCESS;
 }
 
@@ -175,27 +389,32 @@ NTSTATUS HiveGetFreeSpaceStatistics(IN PHIVE Hive, OUT PUINT32 FreeBlocks, OUT P
     *TotalFreeSize = 0;
     *LargestFreeBlock = 0;
 
-    UINT32 Offset = sizeof(HIVE_HEADER);
-    while (Offset < Hive->Size) {
-        PCELL_HEADER Cell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + Offset);
-        
-        if (Cell->Size > 0) {
-            (*FreeBlocks)++;
-            *TotalFreeSize += Cell->Size;
-            
-            if ((UINT32)Cell->Size > *LargestFreeBlock) {
-                *LargestFreeBlock = Cell->Size;
+    PHIVE_FREE_SPACE State = HiveGetFreeSpace(Hive);
+    if (!State) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    *FreeBlocks = State->FreeCells;
+    *TotalFreeSize = State->FreeBytes;
+
+    /* The largest cell is on the highest non-empty list */
+    if (State->ClassBitmap) {
+        UINT32 Offset = State->Heads[63 - __builtin_clzll(State->ClassBitmap)];
+        while (Offset) {
+            PFREE_CELL Cell = HiveFreeCellAt(Hive, Offset);
+            if ((UINT32)Cell->Header.Size > *LargestFreeBlock) {
+                *LargestFreeBlock = (UINT32)Cell->Header.Size;
             }
+            Offset = Cell->Next;
         }
-        
-        Offset += abs(Cell->Size);
     }
 
     return STATUS_SUCCESS;
 }
 
 /*
- * Defragment hive free space
+ * Defragment hive free space. Frees coalesce as they happen, so this only
+ * matters for hives loaded with adjacent free cells; a rebuild merges them.
  */
 NTSTATUS HiveDefragmentFreeSpace(IN PHIVE Hive)
 {
@@ -204,33 +423,38 @@ NTSTATUS HiveDefragmentFreeSpace(IN PHIVE Hive)
     }
 
     HiveAcquireLock(Hive);
-
-    BOOL Changed = TRUE;
-    while (Changed) {
-        Changed = FALSE;
-        
-        UINT32 Offset = sizeof(HIVE_HEADER);
-        while (Offset < Hive->Size) {
-            PCELL_HEADER Cell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + Offset);
-            
-            if (Cell->Size > 0) {
-                /* Try to coalesce this free block */
-                UINT32 OriginalSize = Cell->Size;
-                HiveCoalesceFreeSpace(Hive, Offset);
-                
-                if (Cell->Size != OriginalSize) {
-                    Changed = TRUE;
-                }
-            }
-            
-            Offset += abs(Cell->Size);
-        }
-    }
-    
+    NTSTATUS Status = HiveRebuildFreeSpaceMap(Hive);
     Hive->Dirty = TRUE;
     HiveReleaseLock(Hive);
 
-    return STATUS_SUCCESS;
+    return Status;
+}
+
+/*
+ * Allocate AlignedSize bytes at the start of a tracked free cell, putting
+ * the rest back on a list. Called with the hive lock held.
+ */
+static UINT32 HiveTakeFreeCell(IN PHIVE Hive, IN UINT32 FreeOffset, IN UINT32 AlignedSize)
+{
+    PCELL_HEADER FreeCell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + FreeOffset);
+    UINT32 FreeSize = (UINT32)FreeCell->Size;
+    HiveFreeListRemove(Hive, FreeOffset);
+
+    /* Split off the rest when it can stand as a free cell */
+    if (FreeSize - AlignedSize >= HIVE_MIN_FREE_CELL) {
+        HiveFreeListInsert(Hive, FreeOffset + AlignedSize, FreeSize - AlignedSize);
+    } else {
+        AlignedSize = FreeSize;
+    }
+
+    /* Mark the allocated block */
+    FreeCell->Size = -(INT32)AlignedSize;
+    FreeCell->Signature = 0;
+    FreeCell->Flags = 0;
+    HiveMarkDirtyRange(Hive, FreeCell, sizeof(CELL_HEADER));
+
+    Hive->Dirty = TRUE;
+    return FreeOffset;
 }
 
 /*
@@ -242,42 +466,91 @@ UINT32 HiveAllocateFromFreeSpace(IN PHIVE Hive, IN SIZE_T Size)
         return 0;
     }
 
-    /* Align size to 8-byte boundary */
-    SIZE_T AlignedSize = (Size + 7) & ~7;
-    
+    UINT32 AlignedSize = HiveFreeRequestSize(Size);
+
+    HiveAcquireLock(Hive);
+
     UINT32 FreeOffset = HiveFindFreeSpace(Hive, AlignedSize);
-    if (FreeOffset == 0) {
+    if (FreeOffset != 0) {
+        FreeOffset = HiveTakeFreeCell(Hive, FreeOffset, AlignedSize);
+    }
+
+    HiveReleaseLock(Hive);
+    return FreeOffset;
+}
+
+/*
+ * Allocate a block that ends at or below Limit, for the compactor moving
+ * cells down. Only the first few cells of each fitting class are looked
+ * at, so this can fail while low space exists.
+ */
+UINT32 HiveAllocateBelow(IN PHIVE Hive, IN SIZE_T Size, IN UINT32 Limit)
+{
+    if (!Hive || Size == 0) {
+        return 0;
+    }
+
+    UINT32 AlignedSize = HiveFreeRequestSize(Size);
+    if (!AlignedSize || AlignedSize > Limit) {
         return 0;
     }
 
     HiveAcquireLock(Hive);
 
-    PCELL_HEADER FreeCell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + FreeOffset);
-    
-    /* Check if we need to split the free block */
-    if ((UINT32)FreeCell->Size > AlignedSize + sizeof(CELL_HEADER)) {
-        /* Split the block */
-        UINT32 RemainingSize = FreeCell->Size - AlignedSize;
-        PCELL_HEADER NewFreeCell = (PCELL_HEADER)((UINT8*)FreeCell + AlignedSize);
-        
-        NewFreeCell->Size = RemainingSize;
-        NewFreeCell->Signature = 0;
-        NewFreeCell->Flags = 0;
-    }
-    
-    /* Mark the allocated block */
-    FreeCell->Size = -(INT32)AlignedSize;
-    FreeCell->Signature = 0;
-    FreeCell->Flags = 0;
-    
-    Hive->Dirty = TRUE;
+    PHIVE_FREE_SPACE State = HiveGetFreeSpace(Hive);
+    UINT32 Found = 0;
+
+    for (UINT32 Class = HiveSizeClass(AlignedSize); State && !Found && Class < HIVE_FREE_CLASSES; Class++) {
+        if (!(State->ClassBitmap & (1ull << Class))) {
+            continue;
+        }
+        UINT32 Offset = State->Heads[Class];
+        for (UINT32 i = 0; Offset && i < HIVE_BELOW_SCAN_LIMIT; i++) {
+            PFREE_CELL Cell = HiveFreeCellAt(Hive, Offset);
+            if ((UINT32)Cell->Header.Size >= AlignedSize && Offset <= Limit - AlignedSize) {
+                Found = Offset;
+                break;
+            }
+            Offset = Cell->Next;
+        }
+    }
+
+    if (Found) {
+        Found = HiveTakeFreeCell(Hive, Found, AlignedSize);
+    }
+
     HiveReleaseLock(Hive);
+    return Found;
+}
 
-    return FreeOffset;
+/*
+ * Offset of the free cell ending at the end of the hive, found through its
+ * boundary tag; 0 when the last cell is allocated
+ */
+UINT32 HiveTrailingFreeCell(IN PHIVE Hive)
+{
+    if (!Hive || !Hive->BaseAddress || Hive->Size < sizeof(HIVE_HEADER) + HIVE_MIN_FREE_CELL) {
+        return 0;
+    }
+
+    PHIVE_FREE_SPACE State = HiveGetFreeSpace(Hive);
+    if (!State || (Hive->Size % HIVE_CELL_GRANULE)) {
+        return 0;
+    }
+
+    UINT32 Tag = *(PUINT32)((UINT8*)Hive->BaseAddress + Hive->Size - sizeof(UINT32));
+    if (Tag < HIVE_MIN_FREE_CELL || (Tag % HIVE_CELL_GRANULE) || Tag > Hive->Size - sizeof(HIVE_HEADER)) {
+        return 0;
+    }
+
+    UINT32 Offset = (UINT32)Hive->Size - Tag;
+    PCELL_HEADER Cell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + Offset);
+    return (HiveIsFreeStart(State, Offset) && Cell->Size == (INT32)Tag) ? Offset : 0;
 }
 
 /*
- * Check free space fragmentation level
+ * Check free space fragmentation level, from the running totals the free
+ * lists keep
  */
 UINT32 HiveGetFragmentationLevel(IN PHIVE Hive)
 {
@@ -285,25 +558,27 @@ UINT32 HiveGetFragmentationLevel(IN PHIVE Hive)
         return 100; /* Maximum fragmentation */
     }
 
-    UINT32 FreeBlocks = 0;
-    UINT32 TotalFreeSize = 0;
-    UINT32 LargestFreeBlock = 0;
-    
-    NTSTATUS Status = HiveGetFreeSpaceStatistics(Hive, &FreeBlocks, &TotalFreeSize, &LargestFreeBlock);
-    if (!NT_SUCCESS(Status) || TotalFreeSize == 0) {
+    PHIVE_FREE_SPACE State = HiveGetFreeSpace(Hive);
+    if (!State || State->FreeBytes == 0) {
         return 0; /* No fragmentation if no free space */
     }
 
-    /* Calculate fragmentation percentage */
     /* Higher number of blocks relative to total size indicates more fragmentation */
-    UINT32 FragmentationScore = (FreeBlocks * 100) / (TotalFreeSize / 1024 + 1);
-    
-    /* Also consider largest block ratio */
-    UINT32 LargestBlockRatio = (LargestFreeBlock * 100) / TotalFreeSize;
-    
+    UINT32 FragmentationScore = (State->FreeCells * 100) / (State->FreeBytes / 1024 + 1);
+
+    /* The largest block is on the highest non-empty list: exact when it is
+     * alone there, else at least the floor of that class */
+    UINT32 TopClass = 63 - (UINT32)__builtin_clzll(State->ClassBitmap);
+    PFREE_CELL Top = HiveFreeCellAt(Hive, State->Heads[TopClass]);
+    UINT64 LargestFreeBlock = Top->Next ? HiveClassFloor(TopClass) : (UINT32)Top->Header.Size;
+    UINT32 LargestBlockRatio = (UINT32)(LargestFreeBlock * 100 / State->FreeBytes);
+    if (LargestBlockRatio > 100) {
+        LargestBlockRatio = 100;
+    }
+
     /* Combine metrics (lower largest block ratio = higher fragmentation) */
     UINT32 FinalScore = FragmentationScore + (100 - LargestBlockRatio);
-    
+
     return (FinalScore > 100) ? 100 : FinalScore;
 }
 
@@ -322,8 +597,8 @@ NTSTATUS HiveOptimizeFreeSpace(IN PHIVE Hive)
         return Status;
     }
 
-    /* Then compact the hive to move all free space to the end */
-    Status = HiveBinCompact(Hive);
+    /* Then move cells out of the tail and release it */
+    Status = HiveCompact(Hive);
     if (!NT_SUCCESS(Status)) {
         return Status;
     }
@@ -343,19 +618,27 @@ NTSTATUS HiveGetFreeSpaceMap(IN PHIVE Hive, OUT PUINT32 FreeSpaceMap, IN UINT32
     *EntriesReturned = 0;
     UINT32 MapIndex = 0;
 
+    NTSTATUS Status = HiveFaultRange(Hive, 0, Hive->Size);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
     UINT32 Offset = sizeof(HIVE_HEADER);
     while (Offset < Hive->Size && MapIndex < MapSize - 1) {
         PCELL_HEADER Cell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + Offset);
-        
+        if (Cell->Size == 0) {
+            break;
+        }
+
         if (Cell->Size > 0) {
             /* Store offset and size as pairs */
             FreeSpaceMap[MapIndex++] = Offset;
             FreeSpaceMap[MapIndex++] = Cell->Size;
             (*EntriesReturned)++;
         }
-        
+
         Offset += abs(Cell->Size);
     }
 
     return STATUS_SUCCESS;
-}
\ No newline at end of file
+}
@@ -1,6 +1,11 @@
 /*
  * Aurora Kernel - Hive Hint Management
  * Copyright (c) 2024 NTCore Project
+ *
+ * The hint cache remembers which key cell a path resolved to. Entries are
+ * carved from one allocation of HIVE_HINT_BUDGET bytes at initialization;
+ * when they run out the least recently used entry is recycled. Lookups,
+ * inserts and evictions are O(1).
  */
 
 #include "hive.h"
@@ -10,166 +15,275 @@
 #define abs(x) ((x) < 0 ? -(x) : (x))
 #endif
 
-/* Forward declarations */
-static PHINT_ENTRY HiveFindHint(IN HINT_TYPE Type, IN UINT32 CellOffset, IN PCSTR Path);
-static VOID HiveRemoveOldestHint(void);
-
-/* Hint management for optimizing hive operations */
-
 /* Global hint cache */
-static HINT_CACHE g_HintCache = { NULL, 0, 1024, 0 };
+static HINT_CACHE g_HintCache = { NULL, 0, NULL, NULL, NULL, 0, 0, 0 };
 
 /*
- * Initialize hint management system
+ * Normalize a key path for hashing: upcased, no leading, trailing or
+ * repeated separators. Returns the length, or -1 if it does not fit.
  */
-NTSTATUS HiveHintInitialize(void)
+static INT32 HiveNormalizePath(IN PCSTR Path, OUT PCHAR Buffer)
 {
-    g_HintCache.Entries = NULL;
-    g_HintCache.Count = 0;
-    g_HintCache.MaxEntries = 1024;
-    g_HintCache.Lock = 0;
-    
-    return STATUS_SUCCESS;
+    UINT32 Length = 0;
+
+    while (*Path) {
+        if (*Path == '\\') {
+            Path++;
+            continue;
+        }
+        if (Length) {
+            if (Length >= HIVE_HINT_PATH_MAX) {
+                return -1;
+            }
+            Buffer[Length++] = '\\';
+        }
+        while (*Path && *Path != '\\') {
+            if (Length >= HIVE_HINT_PATH_MAX) {
+                return -1;
+            }
+            CHAR c = *Path++;
+            Buffer[Length++] = (c >= 'a' && c <= 'z') ? (CHAR)(c - 'a' + 'A') : c;
+        }
+    }
+
+    return (INT32)Length;
+}
+
+static VOID HiveLruUnlink(IN PHINT_ENTRY Entry)
+{
+    if (Entry->LruPrev) {
+        Entry->LruPrev->LruNext = Entry->LruNext;
+    } else {
+        g_HintCache.LruHead = Entry->LruNext;
+    }
+
+    if (Entry->LruNext) {
+        Entry->LruNext->LruPrev = Entry->LruPrev;
+    } else {
+        g_HintCache.LruTail = Entry->LruPrev;
+    }
+}
+
+static VOID HiveLruPushFront(IN PHINT_ENTRY Entry)
+{
+    Entry->LruPrev = NULL;
+    Entry->LruNext = g_HintCache.LruHead;
+    if (g_HintCache.LruHead) {
+        g_HintCache.LruHead->LruPrev = Entry;
+    } else {
+        g_HintCache.LruTail = Entry;
+    }
+    g_HintCache.LruHead = Entry;
+}
+
+static UINT32 HiveHintBucket(IN PHIVE Hive, IN UINT32 PathHash)
+{
+    UINT32 Hash = PathHash ^ (UINT32)((UINT64)(ULONG_PTR)Hive >> 4) * 0x9E3779B1u;
+    return (Hash ^ (Hash >> 16)) & g_HintCache.BucketMask;
 }
 
 /*
- * Shutdown hint management system
+ * Take an entry out of the table and put it back on the free list
  */
-VOID HiveHintShutdown(void)
+static VOID HiveRemoveHint(IN PHINT_ENTRY Entry)
 {
-    /* Clean up hint entries */
-    while (g_HintCache.Entries) {
-        PHINT_ENTRY Entry = g_HintCache.Entries;
-        g_HintCache.Entries = g_HintCache.Entries->Next;
-        /* Free entry - would use kernel allocator */
-    }
-    
-    g_HintCache.Count = 0;
+    PHINT_ENTRY* Link = &g_HintCache.Buckets[HiveHintBucket(Entry->Hive, Entry->PathHash)];
+
+    while (*Link && *Link != Entry) {
+        Link = &(*Link)->HashNext;
+    }
+    if (*Link) {
+        *Link = Entry->HashNext;
+    }
+
+    HiveLruUnlink(Entry);
+    Entry->Hive = NULL;
+    Entry->HashNext = g_HintCache.FreeList;
+    g_HintCache.FreeList = Entry;
+    g_HintCache.Count--;
 }
 
 /*
- * Add a hint entry
+ * Find the entry for a normalized path
  */
-NTSTATUS HiveAddHint(IN PHIVE Hive, IN HINT_TYPE Type, IN UINT32 CellOffset, IN PCSTR Path)
+static PHINT_ENTRY HiveFindHint(IN PHIVE Hive, IN UINT32 PathHash, IN PCSTR Path, IN UINT32 Length)
 {
-    if (!Hive || CellOffset == 0) {
-        return STATUS_INVALID_PARAMETER;
+    PHINT_ENTRY Current = g_HintCache.Buckets[HiveHintBucket(Hive, PathHash)];
+
+    while (Current) {
+        if (Current->Hive == Hive && Current->PathHash == PathHash &&
+            Current->PathLength == Length && memcmp(Current->Path, Path, Length) == 0) {
+            return Current;
+        }
+        Current = Current->HashNext;
     }
 
-    /* Check if hint already exists */
-    PHINT_ENTRY ExistingHint = HiveFindHint(Type, CellOffset, Path);
-    if (ExistingHint) {
-        /* Update existing hint */
-        ExistingHint->AccessCount++;
-        ExistingHint->LastAccess = 0; /* TODO: Get current time */
-        return STATUS_SUCCESS;
+    return NULL;
+}
+
+/*
+ * Recycle the least recently used entry
+ */
+static VOID HiveRemoveOldestHint(void)
+{
+    if (g_HintCache.LruTail) {
+        HiveRemoveHint(g_HintCache.LruTail);
     }
+}
 
-    /* Check cache limit */
-    if (g_HintCache.Count >= g_HintCache.MaxEntries) {
-        /* Remove oldest hint */
-        HiveRemoveOldestHint();
+/*
+ * Initialize hint management system
+ */
+NTSTATUS HiveHintInitialize(void)
+{
+    UINT32 Buckets = 1;
+
+    memset(&g_HintCache, 0, sizeof(g_HintCache));
+
+    /* About one bucket per entry, all inside the budget */
+    while (Buckets * 2 * (sizeof(PHINT_ENTRY) + sizeof(HINT_ENTRY)) <= HIVE_HINT_BUDGET) {
+        Buckets *= 2;
     }
 
-    /* Create new hint entry */
-    /* In real implementation, would use kernel allocator */
-    PHINT_ENTRY NewHint = NULL; /* KernAllocateMemory(sizeof(HINT_ENTRY)); */
-    if (!NewHint) {
+    UINT8* Memory = (UINT8*)AuroraAllocateMemory(HIVE_HINT_BUDGET);
+    if (!Memory) {
         return STATUS_INSUFFICIENT_RESOURCES;
     }
+    memset(Memory, 0, HIVE_HINT_BUDGET);
 
-    NewHint->Type = Type;
-    NewHint->CellOffset = CellOffset;
-    NewHint->AccessCount = 1;
-    NewHint->LastAccess = 0; /* TODO: Get current time */
-    
-    if (Path) {
-        strncpy(NewHint->Path, Path, sizeof(NewHint->Path) - 1);
-        NewHint->Path[sizeof(NewHint->Path) - 1] = '\0';
-    } else {
-        NewHint->Path[0] = '\0';
-    }
+    g_HintCache.Buckets = (PHINT_ENTRY*)Memory;
+    g_HintCache.BucketMask = Buckets - 1;
+    g_HintCache.MaxEntries = (UINT32)((HIVE_HINT_BUDGET - Buckets * sizeof(PHINT_ENTRY)) / sizeof(HINT_ENTRY));
 
-    /* Add to cache */
-    NewHint->Next = g_HintCache.Entries;
-    g_HintCache.Entries = NewHint;
-    g_HintCache.Count++;
+    PHINT_ENTRY Pool = (PHINT_ENTRY)(Memory + Buckets * sizeof(PHINT_ENTRY));
+    for (UINT32 i = g_HintCache.MaxEntries; i > 0; i--) {
+        Pool[i - 1].HashNext = g_HintCache.FreeList;
+        g_HintCache.FreeList = &Pool[i - 1];
+    }
 
     return STATUS_SUCCESS;
 }
 
 /*
- * Find hint entry
+ * Shutdown hint management system
  */
-static PHINT_ENTRY HiveFindHint(IN HINT_TYPE Type, IN UINT32 CellOffset, IN PCSTR Path)
+VOID HiveHintShutdown(void)
 {
-    PHINT_ENTRY Current = g_HintCache.Entries;
-    
-    while (Current) {
-        if (Current->Type == Type && Current->CellOffset == CellOffset) {
-            if (Path && Current->Path[0] != '\0') {
-                if (strcmp(Current->Path, Path) == 0) {
-                    return Current;
-                }
-            } else if (!Path || Path[0] == '\0') {
-                return Current;
-            }
-        }
-        Current = Current->Next;
+    if (g_HintCache.Buckets) {
+        AuroraFreeMemory(g_HintCache.Buckets);
     }
-    
-    return NULL;
+
+    memset(&g_HintCache, 0, sizeof(g_HintCache));
 }
 
 /*
- * Remove oldest hint entry
+ * Remember that Path resolves to the key at CellOffset
  */
-static VOID HiveRemoveOldestHint(void)
+NTSTATUS HiveAddHint(IN PHIVE Hive, IN HINT_TYPE Type, IN UINT32 CellOffset, IN PCSTR Path)
 {
-    if (!g_HintCache.Entries) {
-        return;
+    CHAR Normalized[HIVE_HINT_PATH_MAX];
+    AURORA_IRQL OldIrql;
+
+    if (!Hive || CellOffset == 0 || !Path) {
+        return STATUS_INVALID_PARAMETER;
     }
 
-    PHINT_ENTRY Oldest = g_HintCache.Entries;
-    PHINT_ENTRY* OldestPrev = &g_HintCache.Entries;
-    PHINT_ENTRY Current = g_HintCache.Entries;
-    PHINT_ENTRY* CurrentPrev = &g_HintCache.Entries;
+    if (!g_HintCache.Buckets) {
+        return STATUS_NOT_INITIALIZED;
+    }
 
-    /* Find oldest entry */
-    while (Current) {
-        if (Current->LastAccess < Oldest->LastAccess) {
-            Oldest = Current;
-            OldestPrev = CurrentPrev;
-        }
-        
-        CurrentPrev = &Current->Next;
-        Current = Current->Next;
+    /* Long paths are not cached */
+    INT32 Length = HiveNormalizePath(Path, Normalized);
+    if (Length < 0) {
+        return STATUS_NOT_SUPPORTED;
     }
 
-    /* Remove oldest entry */
-    *OldestPrev = Oldest->Next;
-    /* Free oldest - would use kernel allocator */
-    g_HintCache.Count--;
+    UINT32 PathHash = HiveHashName(Normalized, (UINT32)Length);
+
+    AuroraAcquireSpinLock(&g_HintCache.Lock, &OldIrql);
+
+    /* Check if hint already exists */
+    PHINT_ENTRY Entry = HiveFindHint(Hive, PathHash, Normalized, (UINT32)Length);
+    if (Entry) {
+        Entry->Type = Type;
+        Entry->CellOffset = CellOffset;
+        Entry->Generation = Hive->Generation;
+        Entry->AccessCount++;
+        HiveLruUnlink(Entry);
+        HiveLruPushFront(Entry);
+        AuroraReleaseSpinLock(&g_HintCache.Lock, OldIrql);
+        return STATUS_SUCCESS;
+    }
+
+    if (!g_HintCache.FreeList) {
+        HiveRemoveOldestHint();
+    }
+
+    Entry = g_HintCache.FreeList;
+    g_HintCache.FreeList = Entry->HashNext;
+
+    Entry->Hive = Hive;
+    Entry->PathHash = PathHash;
+    Entry->Generation = Hive->Generation;
+    Entry->CellOffset = CellOffset;
+    Entry->Type = Type;
+    Entry->AccessCount = 1;
+    Entry->PathLength = (UINT32)Length;
+    memcpy(Entry->Path, Normalized, (UINT32)Length);
+    Entry->Path[Length] = '\0';
+
+    PHINT_ENTRY* Bucket = &g_HintCache.Buckets[HiveHintBucket(Hive, PathHash)];
+    Entry->HashNext = *Bucket;
+    *Bucket = Entry;
+    HiveLruPushFront(Entry);
+    g_HintCache.Count++;
+
+    AuroraReleaseSpinLock(&g_HintCache.Lock, OldIrql);
+    return STATUS_SUCCESS;
 }
 
 /*
- * Update hint access statistics
+ * Key cell a path was last seen to resolve to, or 0. Hints from an older
+ * hive generation are dropped here rather than when the generation moves.
  */
-NTSTATUS HiveUpdateHintAccess(IN UINT32 CellOffset, IN PCSTR Path)
+UINT32 HiveLookupHint(IN PHIVE Hive, IN PCSTR Path)
 {
-    PHINT_ENTRY Hint = HiveFindHint(HintTypeKeyAccess, CellOffset, Path);
-    if (Hint) {
-        Hint->AccessCount++;
-        Hint->LastAccess = 0; /* TODO: Get current time */
-        return STATUS_SUCCESS;
+    CHAR Normalized[HIVE_HINT_PATH_MAX];
+    AURORA_IRQL OldIrql;
+    UINT32 CellOffset = 0;
+
+    if (!Hive || !Path || !g_HintCache.Buckets) {
+        return 0;
     }
 
-    /* Create new hint if not found */
-    return HiveAddHint(NULL, HintTypeKeyAccess, CellOffset, Path);
+    INT32 Length = HiveNormalizePath(Path, Normalized);
+    if (Length < 0) {
+        return 0;
+    }
+
+    UINT32 PathHash = HiveHashName(Normalized, (UINT32)Length);
+
+    AuroraAcquireSpinLock(&g_HintCache.Lock, &OldIrql);
+
+    PHINT_ENTRY Entry = HiveFindHint(Hive, PathHash, Normalized, (UINT32)Length);
+    if (Entry) {
+        if (Entry->Generation != Hive->Generation || !HiveGetKeyCell(Hive, Entry->CellOffset)) {
+            HiveRemoveHint(Entry);
+        } else {
+            Entry->AccessCount++;
+            HiveLruUnlink(Entry);
+            HiveLruPushFront(Entry);
+            CellOffset = Entry->CellOffset;
+        }
+    }
+
+    AuroraReleaseSpinLock(&g_HintCache.Lock, OldIrql);
+    return CellOffset;
 }
 
 /*
- * Get frequently accessed paths
+ * Get frequently accessed paths. The strings belong to the cache and are
+ * only good until the next hint operation.
  */
 NTSTATUS HiveGetFrequentPaths(OUT PCHAR* Paths, IN UINT32 MaxPaths, OUT PUINT32 PathCount)
 {
@@ -178,57 +292,90 @@ NTSTATUS HiveGetFrequentPaths(OUT PCHAR* Paths, IN UINT32 MaxPaths, OUT PUINT32
     }
 
     *PathCount = 0;
-    PHINT_ENTRY Current = g_HintCache.Entries;
-    
-    /* Sort hints by access count (simple bubble sort for demonstration) */
+    PHINT_ENTRY Current = g_HintCache.LruHead;
+
     PHINT_ENTRY SortedHints[256];
     UINT32 HintCount = 0;
-    
-    /* Collect hints with paths */
+
+    /* Collect hints that were hit at least once, most recent first */
     while (Current && HintCount < 256) {
-        if (Current->Path[0] != '\0' && Current->AccessCount > 1) {
+        if (Current->AccessCount > 1) {
             SortedHints[HintCount++] = Current;
         }
-        Current = Current->Next;
-    }
-    
-    /* Simple sort by access count */
-    for (UINT32 i = 0; i < HintCount - 1; i++) {
-        for (UINT32 j = 0; j < HintCount - i - 1; j++) {
-            if (SortedHints[j]->AccessCount < SortedHints[j + 1]->AccessCount) {
-                PHINT_ENTRY Temp = SortedHints[j];
-                SortedHints[j] = SortedHints[j + 1];
-                SortedHints[j + 1] = Temp;
-            }
+        Current = Current->LruNext;
+    }
+
+    /* Sort by access count */
+    for (UINT32 i = 1; i < HintCount; i++) {
+        PHINT_ENTRY Hint = SortedHints[i];
+        UINT32 j = i;
+        while (j > 0 && SortedHints[j - 1]->AccessCount < Hint->AccessCount) {
+            SortedHints[j] = SortedHints[j - 1];
+            j--;
         }
+        SortedHints[j] = Hint;
     }
-    
+
     /* Return top paths */
     UINT32 ReturnCount = (HintCount < MaxPaths) ? HintCount : MaxPaths;
     for (UINT32 i = 0; i < ReturnCount; i++) {
-        /* In real implementation, would allocate and copy strings */
         Paths[i] = SortedHints[i]->Path;
     }
-    
+
     *PathCount = ReturnCount;
     return STATUS_SUCCESS;
 }
 
 /*
- * Clear all hints for a hive
+ * Clear all hints for a hive; called when it is closed
  */
 VOID HiveClearHints(IN PHIVE Hive)
 {
-    UNREFERENCED_PARAMETER(Hive);
-    
-    /* Clear all hints - in real implementation would filter by hive */
-    while (g_HintCache.Entries) {
-        PHINT_ENTRY Entry = g_HintCache.Entries;
-        g_HintCache.Entries = g_HintCache.Entries->Next;
-        /* Free entry */
-    }
-    
-    g_HintCache.Count = 0;
+    AURORA_IRQL OldIrql;
+
+    AuroraAcquireSpinLock(&g_HintCache.Lock, &OldIrql);
+
+    PHINT_ENTRY Current = g_HintCache.LruHead;
+    while (Current) {
+        PHINT_ENTRY Next = Current->LruNext;
+        if (!Hive || Current->Hive == Hive) {
+            HiveRemoveHint(Current);
+        }
+        Current = Next;
+    }
+
+    AuroraReleaseSpinLock(&g_HintCache.Lock, OldIrql);
+}
+
+/*
+ * Full path of a key from its parent chain; 0 for the root or if too long
+ */
+static UINT32 HiveBuildKeyPath(IN PHIVE Hive, IN UINT32 KeyCell, OUT PCHAR Buffer)
+{
+    CHAR Reversed[HIVE_HINT_PATH_MAX + 1];
+    UINT32 Start = sizeof(Reversed);
+
+    PKEY_CELL Key = HiveGetKeyCell(Hive, KeyCell);
+    while (Key && KeyCell != Hive->RootKeyOffset) {
+        if (Start < (UINT32)Key->NameLength + 1) {
+            return 0;
+        }
+        Start -= Key->NameLength;
+        memcpy(&Reversed[Start], Key->Name, Key->NameLength);
+        Reversed[--Start] = '\\';
+        KeyCell = Key->Parent;
+        Key = HiveGetKeyCell(Hive, KeyCell);
+    }
+
+    if (!Key || Start == sizeof(Reversed)) {
+        return 0;
+    }
+
+    /* Drop the leading separator */
+    UINT32 Length = sizeof(Reversed) - Start - 1;
+    memcpy(Buffer, &Reversed[Start + 1], Length);
+    Buffer[Length] = '\0';
+    return Length;
 }
 
 /*
@@ -236,27 +383,38 @@ VOID HiveClearHints(IN PHIVE Hive)
  */
 NTSTATUS HiveUpdateHints(IN PHIVE Hive)
 {
+    CHAR Path[HIVE_HINT_PATH_MAX + 1];
+
     if (!Hive) {
         return STATUS_INVALID_PARAMETER;
     }
 
+    NTSTATUS Status = HiveFaultRange(Hive, 0, Hive->Size);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
     /* Analyze hive structure and update hints */
     UINT32 Offset = sizeof(HIVE_HEADER);
     while (Offset < Hive->Size) {
         PCELL_HEADER Cell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + Offset);
-        
+        if (Cell->Size == 0) {
+            break;
+        }
+
         if (Cell->Size < 0) {
             /* Allocated cell - check if it's frequently accessed */
             if (Cell->Signature == CellTypeKey) {
                 PKEY_CELL KeyCell = (PKEY_CELL)((UINT8*)Cell + sizeof(CELL_HEADER));
-                
+
                 /* Create hint for keys with many subkeys or values */
-                if (KeyCell->SubKeysCount > 10 || KeyCell->ValuesCount > 20) {
-                    HiveAddHint(Hive, HintTypeFrequentPath, Offset, NULL);
+                if ((KeyCell->SubKeysCount > 10 || KeyCell->ValuesCount > 20) &&
+                    HiveBuildKeyPath(Hive, Offset, Path)) {
+                    HiveAddHint(Hive, HintTypeFrequentPath, Offset, Path);
                 }
             }
         }
-        
+
         Offset += abs(Cell->Size);
     }
 
@@ -277,7 +435,7 @@ NTSTATUS HiveGetHintStatistics(OUT PUINT32 TotalHints, OUT PUINT32 KeyHints, OUT
     *ValueHints = 0;
     *PathHints = 0;
 
-    PHINT_ENTRY Current = g_HintCache.Entries;
+    PHINT_ENTRY Current = g_HintCache.LruHead;
     while (Current) {
         switch (Current->Type) {
             case HintTypeKeyAccess:
@@ -292,7 +450,7 @@ NTSTATUS HiveGetHintStatistics(OUT PUINT32 TotalHints, OUT PUINT32 KeyHints, OUT
             default:
                 break;
         }
-        Current = Current->Next;
+        Current = Current->LruNext;
     }
 
     return STATUS_SUCCESS;
@@ -308,14 +466,14 @@ NTSTATUS HiveOptimizeWithHints(IN PHIVE Hive)
     }
 
     /* Use hints to optimize hive layout */
-    PHINT_ENTRY Current = g_HintCache.Entries;
-    
+    PHINT_ENTRY Current = g_HintCache.LruHead;
+
     while (Current) {
-        if (Current->Type == HintTypeFrequentPath && Current->AccessCount > 100) {
+        if (Current->Hive == Hive && Current->Type == HintTypeFrequentPath && Current->AccessCount > 100) {
             /* Move frequently accessed cells closer to the beginning */
             /* This would involve complex hive restructuring */
         }
-        Current = Current->Next;
+        Current = Current->LruNext;
     }
 
     return STATUS_SUCCESS;
@@ -330,19 +488,17 @@ NTSTATUS HivePreloadHintedCells(IN PHIVE Hive)
         return STATUS_INVALID_PARAMETER;
     }
 
-    PHINT_ENTRY Current = g_HintCache.Entries;
-    
+    PHINT_ENTRY Current = g_HintCache.LruHead;
+
     while (Current) {
-        if (Current->AccessCount > 50) {
-            /* Preload frequently accessed cells into cache */
-            PVOID CellData = HiveGetCell(Hive, Current->CellOffset);
-            if (CellData) {
-                /* Cell is now in memory/cache */
-                HiveAddHint(Hive, HintTypeCacheWarm, Current->CellOffset, Current->Path);
+        if (Current->Hive == Hive && Current->AccessCount > 50) {
+            /* Touch frequently accessed cells so they are resident */
+            if (HiveGetCell(Hive, Current->CellOffset)) {
+                Current->Type = HintTypeCacheWarm;
             }
         }
-        Current = Current->Next;
+        Current = Current->LruNext;
     }
 
     return STATUS_SUCCESS;
-}
\ No newline at end of file
+}
@@ -79,8 +79,7 @@ NTSTATUS HiveInitialize(OUT PHIVE* Hive, IN PCSTR Name, IN HIVE_TYPE Type)
     }
 
     /* Allocate hive structure */
-    /* In real implementation, would use kernel allocator */
-    PHIVE NewHive = NULL; /* KernAllocateMemory(sizeof(HIVE)); */
+    PHIVE NewHive = (PHIVE)AuroraAllocateMemory(sizeof(HIVE));
     if (!NewHive) {
         return STATUS_INSUFFICIENT_RESOURCES;
     }
@@ -122,8 +121,7 @@ NTSTATUS HiveCreate(IN PHIVE Hive, IN UINT32 InitialSize)
     }
 
     /* Allocate hive memory */
-    /* In real implementation, would use kernel allocator */
-    PVOID HiveMemory = NULL; /* KernAllocateMemory(InitialSize); */
+    PVOID HiveMemory = AuroraAllocateMemory(InitialSize);
     if (!HiveMemory) {
         return STATUS_INSUFFICIENT_RESOURCES;
     }
@@ -191,6 +189,16 @@ NTSTATUS HiveLoad(IN PHIVE Hive, IN PVOID HiveData, IN UINT32 HiveSize)
         return STATUS_HIVE_CHECKSUM_MISMATCH;
     }
     
+    /* A demand-loaded hive only has its first bins resident; the cell walk
+       would fault in the whole file, so it is left to the first allocation */
+    if (Hive->Bins && Hive->BaseAddress == HiveData) {
+        Hive->Size = HiveSize;
+        Hive->Header = Header;
+        Hive->RootKeyOffset = Header->RootKeyOffset;
+        HiveFreeSpaceRelease(Hive);
+        return STATUS_SUCCESS;
+    }
+    
     /* Perform integrity check */
     NTSTATUS Status = HiveCheckIntegrity(Hive, HiveData, HiveSize);
     if (!NT_SUCCESS(Status)) {
@@ -231,11 +239,25 @@ NTSTATUS HiveClose(IN PHIVE Hive)
         HiveFlush(Hive);
     }
     
+    /* Bring the primary file up to date and drop the journal */
+    if (Hive->Journal) {
+        if (!Hive->ReadOnly) {
+            HiveJournalReconcile(Hive);
+        }
+        HiveJournalRelease(Hive);
+    }
+    
     /* Remove from global hive list */
     HiveRemoveFromList(Hive);
     
     /* Clear hints for this hive */
     HiveClearHints(Hive);
+    HiveFreeSpaceRelease(Hive);
+    HiveBinMapRelease(Hive);
+    HiveChecksumRelease(Hive);
+    HiveCompactRelease(Hive);
+    HiveNotifyRelease(Hive);
+    HiveSyncRelease(Hive);
     
     /* Free hive memory */
     if (Hive->BaseAddress) {
@@ -387,12 +409,26 @@ NTSTATUS HiveFlush(IN PHIVE Hive)
         return STATUS_INVALID_PARAMETER;
     }
 
+    /* Periodic flushes also push out notifications whose window ran out */
+    HiveNotifyTick();
+
+    if (Hive->ReadOnly) {
+        return Hive->DirtyFlag ? STATUS_ACCESS_DENIED : STATUS_SUCCESS;
+    }
+    
+    /* Writers must not change cells between the checksum and the log, and
+       two flushes must not interleave their journal writes */
+    HiveAcquireExclusiveLock(Hive, 0);
     if (!Hive->DirtyFlag) {
+        HiveReleaseExclusiveLock(Hive);
         return STATUS_SUCCESS; /* Nothing to flush */
     }
     
-    if (Hive->ReadOnly) {
-        return STATUS_ACCESS_DENIED;
+    /* Fragmented hives get one bounded compaction step per flush; its
+       moves go out in the same log */
+    if (HiveNeedsCompaction(Hive)) {
+        BOOLEAN Done;
+        HiveCompactStep(Hive, HIVE_COMPACT_STEP_BYTES, &Done);
     }
     
     /* Update header timestamp */
@@ -400,16 +436,22 @@ NTSTATUS HiveFlush(IN PHIVE Hive)
         Hive->Header->Timestamp = 0; /* TODO: Get current time */
         
         /* Recalculate checksum */
-        UINT32 OldChecksum = Hive->Header->Checksum;
         Hive->Header->Checksum = 0;
         Hive->Header->Checksum = HiveCalculateChecksum(Hive->Header);
+        HiveMarkDirtyRange(Hive, Hive->Header, sizeof(HIVE_HEADER) - sizeof(Hive->Header->Reserved));
     }
     
-    /* In real implementation, would write to disk/storage */
-    /* Status = StorageWriteHive(Hive->Name, Hive->BaseAddress, Hive->Size); */
+    /* Hives with a backing file log their dirty sectors */
+    NTSTATUS Status = STATUS_SUCCESS;
+    if (Hive->Journal) {
+        Status = HiveJournalWrite(Hive);
+    }
+    if (NT_SUCCESS(Status)) {
+        Hive->DirtyFlag = FALSE;
+    }
     
-    Hive->DirtyFlag = FALSE;
-    return STATUS_SUCCESS;
+    HiveReleaseExclusiveLock(Hive);
+    return Status;
 }
 
 /*
@@ -445,6 +487,11 @@ NTSTATUS HiveRebuildFreeSpaceMap(IN PHIVE Hive)
     /* Clear existing free space map */
     HiveFreeSpaceClear(Hive);
     
+    NTSTATUS Status = HiveFaultRange(Hive, 0, Hive->Size);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
     /* Scan hive and rebuild free space map */
     UINT32 Offset = sizeof(HIVE_HEADER);
     while (Offset < Hive->Size) {
@@ -475,6 +522,11 @@ NTSTATUS HiveGetStatistics(IN PHIVE Hive, OUT PHIVE_STATISTICS Statistics)
     Statistics->TotalSize = Hive->Size;
     Statistics->HeaderSize = sizeof(HIVE_HEADER);
     
+    NTSTATUS Status = HiveFaultRange(Hive, 0, Hive->Size);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
     /* Scan hive and collect statistics */
     UINT32 Offset = sizeof(HIVE_HEADER);
     while (Offset < Hive->Size) {
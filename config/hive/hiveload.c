@@ -4,6 +4,7 @@
  */
 
 #include "hive.h"
+#include "../../include/fs.h"
 
 #ifndef abs
 #define abs(x) ((x) < 0 ? -(x) : (x))
@@ -48,22 +49,6 @@ static const char* simple_strrchr(const char* str, int c) {
     return last;
 }
 
-/* File format constants */
-#define HIVE_FILE_SIGNATURE 0x66676572  /* 'regf' */
-#define HIVE_BACKUP_SIGNATURE 0x6B636162 /* 'back' */
-#define HIVE_LOG_SIGNATURE 0x676F6C72   /* 'rlog' */
-
-/* File header structure */
-typedef struct _HIVE_FILE_HEADER {
-    UINT32 Signature;           /* File signature */
-    UINT32 Version;             /* File format version */
-    UINT32 HiveSize;            /* Size of hive data */
-    UINT32 Checksum;            /* File checksum */
-    UINT64 Timestamp;           /* Last modification time */
-    UINT32 Flags;               /* File flags */
-    UINT32 Reserved[3];         /* Reserved for future use */
-} HIVE_FILE_HEADER, *PHIVE_FILE_HEADER;
-
 /* Load operation context */
 typedef struct _HIVE_LOAD_CONTEXT {
     PHIVE Hive;
@@ -74,7 +59,8 @@ typedef struct _HIVE_LOAD_CONTEXT {
 } HIVE_LOAD_CONTEXT, *PHIVE_LOAD_CONTEXT;
 
 /*
- * Load hive from file data
+ * Load hive from file, replaying its newest journal log if the primary
+ * file was not brought up to date before the last shutdown
  */
 NTSTATUS HiveLoadFromFile(IN PCSTR FileName, OUT PHIVE* Hive)
 {
@@ -84,109 +70,232 @@ NTSTATUS HiveLoadFromFile(IN PCSTR FileName, OUT PHIVE* Hive)
 
     *Hive = NULL;
 
-    /* In real implementation, would read from file system */
-    PVOID FileData = NULL;
-    UINT32 FileSize = 0;
-    
-    /* Simulate file reading */
-    /* NTSTATUS Status = FileSystemReadFile(FileName, &FileData, &FileSize); */
-    /* if (!NT_SUCCESS(Status)) { */
-    /*     return Status; */
-    /* } */
+    PFS_HANDLE Handle;
+    NTSTATUS Status = FsOpen(FileName, &Handle);
+    if (!NT_SUCCESS(Status)) {
+        return Status == STATUS_OBJECT_NAME_NOT_FOUND ? STATUS_FILE_NOT_FOUND : Status;
+    }
+
+    /* Validate file header */
+    HIVE_FILE_HEADER FileHeader;
+    UINT64 Read = 0;
+    Status = FsReadAt(Handle, 0, &FileHeader, sizeof(FileHeader), &Read);
+    if (NT_SUCCESS(Status) && Read != sizeof(FileHeader)) {
+        Status = STATUS_INVALID_FILE_FORMAT;
+    }
+    if (NT_SUCCESS(Status) && FileHeader.Signature != HIVE_FILE_SIGNATURE) {
+        Status = STATUS_INVALID_FILE_SIGNATURE;
+    }
+    if (NT_SUCCESS(Status) && FileHeader.HiveSize < sizeof(HIVE_HEADER)) {
+        Status = STATUS_INVALID_FILE_FORMAT;
+    }
     
-    /* For now, return error since we can't actually read files */
-    return STATUS_FILE_NOT_FOUND;
+    UINT32 HiveSize = FileHeader.HiveSize;
+    UINT32 FileSize = sizeof(HIVE_FILE_HEADER) + HiveSize;
+    BOOL Journaled = (FileHeader.Flags & HIVE_FILE_FLAG_JOURNALED) != 0;
     
-    /* The rest would be implemented as follows: */
+    /* Large journaled hives only read the bins holding the hive header now;
+       the rest is read as cells are touched. Unjournaled files need every
+       byte for the file checksum. */
+    BOOL DemandLoad = Journaled && HiveSize >= HIVE_DEMAND_LOAD_MIN;
+    UINT32 ReadSize = FileSize;
+    if (DemandLoad) {
+        ReadSize = sizeof(HIVE_FILE_HEADER) + ((sizeof(HIVE_HEADER) + HIVE_BIN_SIZE - 1) & ~(HIVE_BIN_SIZE - 1));
+    }
     
-    /* Validate file header */
-    if (FileSize < sizeof(HIVE_FILE_HEADER)) {
-        return STATUS_INVALID_FILE_FORMAT;
+    PUINT8 FileData = NULL;
+    if (NT_SUCCESS(Status)) {
+        FileData = (PUINT8)AuroraAllocateMemory(FileSize);
+        if (!FileData) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+    if (NT_SUCCESS(Status)) {
+        Status = FsReadAt(Handle, 0, FileData, ReadSize, &Read);
+        if (NT_SUCCESS(Status) && Read != ReadSize) {
+            Status = STATUS_INVALID_FILE_FORMAT;
+        }
     }
     
-    PHIVE_FILE_HEADER FileHeader = (PHIVE_FILE_HEADER)FileData;
-    if (FileHeader->Signature != HIVE_FILE_SIGNATURE) {
-        return STATUS_INVALID_FILE_SIGNATURE;
+    /* A demand-loaded hive keeps the file open until every bin is read */
+    if (!DemandLoad || !NT_SUCCESS(Status)) {
+        FsClose(Handle);
+        Handle = NULL;
     }
     
-    /* Verify file checksum */
-    UINT32 StoredChecksum = FileHeader->Checksum;
-    FileHeader->Checksum = 0;
-    UINT32 CalculatedChecksum = HiveCalculateFileChecksum(FileData, FileSize);
-    FileHeader->Checksum = StoredChecksum;
+    /* Verify file checksum; journaled files are updated in place and have none */
+    if (NT_SUCCESS(Status) && !Journaled) {
+        PHIVE_FILE_HEADER Header = (PHIVE_FILE_HEADER)FileData;
+        Header->Checksum = 0;
+        if (HiveCalculateFileChecksum(FileData, FileSize) != FileHeader.Checksum) {
+            Status = STATUS_FILE_CHECKSUM_MISMATCH;
+        }
+        Header->Checksum = FileHeader.Checksum;
+    }
     
-    if (StoredChecksum != CalculatedChecksum) {
-        return STATUS_FILE_CHECKSUM_MISMATCH;
+    if (!NT_SUCCESS(Status)) {
+        if (FileData) {
+            AuroraFreeMemory(FileData);
+        }
+        return Status;
     }
     
+    PVOID HiveData = FileData + sizeof(HIVE_FILE_HEADER);
+    UINT32 PrimarySequence = ((PHIVE_HEADER)HiveData)->PrimarySequence;
+    UINT32 Sequence = PrimarySequence;
+    
     /* Extract hive name from filename */
     CHAR HiveName[64];
     HiveExtractNameFromPath(FileName, HiveName, sizeof(HiveName));
     
     /* Create hive structure */
     PHIVE NewHive;
-    NTSTATUS Status = HiveInitialize(&NewHive, HiveName, HiveTypeUser);
+    Status = HiveInitialize(&NewHive, HiveName, HiveTypeUser);
     if (!NT_SUCCESS(Status)) {
+        if (Handle) {
+            FsClose(Handle);
+        }
+        AuroraFreeMemory(FileData);
         return Status;
     }
     
-    /* Load hive data */
-    PVOID HiveData = (UINT8*)FileData + sizeof(HIVE_FILE_HEADER);
-    UINT32 HiveSize = FileHeader->HiveSize;
+    NewHive->BaseAddress = HiveData;
+    NewHive->Size = HiveSize;
+    if (DemandLoad) {
+        Status = HiveBinMapCreate(NewHive, Handle, sizeof(HIVE_FILE_HEADER), ReadSize - sizeof(HIVE_FILE_HEADER));
+        if (!NT_SUCCESS(Status)) {
+            FsClose(Handle);
+        }
+    }
+    
+    /* Replay the newest log over the image; touched bins are read first */
+    if (NT_SUCCESS(Status) && Journaled) {
+        HiveJournalRecover(NewHive, FileName, PrimarySequence, &Sequence);
+    }
     
-    Status = HiveLoad(NewHive, HiveData, HiveSize);
+    /* Load hive data */
+    if (NT_SUCCESS(Status)) {
+        Status = HiveLoad(NewHive, HiveData, HiveSize);
+    }
     if (!NT_SUCCESS(Status)) {
         HiveClose(NewHive);
+        AuroraFreeMemory(FileData);
         return Status;
     }
     
+    if (Journaled) {
+        Status = HiveJournalAttach(NewHive, FileName, Sequence);
+        
+        /* A replayed log may span any sector; merge the whole image back */
+        if (NT_SUCCESS(Status) && Sequence != PrimarySequence) {
+            Status = HiveFaultRange(NewHive, 0, HiveSize);
+        }
+        if (NT_SUCCESS(Status) && Sequence != PrimarySequence) {
+            memset(NewHive->Journal->PendingBitmap, 0xFF, NewHive->Journal->BitmapWords * sizeof(UINT32));
+            Status = HiveJournalReconcile(NewHive);
+        }
+        if (!NT_SUCCESS(Status)) {
+            HiveClose(NewHive);
+            AuroraFreeMemory(FileData);
+            return Status;
+        }
+    }
+    
     *Hive = NewHive;
     return STATUS_SUCCESS;
 }
 
 /*
- * Save hive to file data
+ * Save hive to file
  */
 NTSTATUS HiveSaveToFile(IN PHIVE Hive, IN PCSTR FileName)
 {
-    if (!Hive || !FileName) {
+    if (!Hive || !FileName || !Hive->BaseAddress || !Hive->Header) {
         return STATUS_INVALID_PARAMETER;
     }
 
-    /* Calculate total file size */
-    UINT32 FileSize = sizeof(HIVE_FILE_HEADER) + Hive->Size;
-    
-    /* Allocate file buffer */
-    PVOID FileData = NULL; /* KernAllocateMemory(FileSize); */
-    if (!FileData) {
-        return STATUS_INSUFFICIENT_RESOURCES;
+    /* Bins not yet read would be written out as zeroes */
+    NTSTATUS Status = HiveFaultRange(Hive, 0, Hive->Size);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
+    /* A full image supersedes every log written so far */
+    PHIVE_JOURNAL Journal = Hive->Journal;
+    BOOL Primary = Journal && strcmp(Journal->FileName, FileName) == 0;
+    if (Primary) {
+        Hive->Header->PrimarySequence = Journal->Sequence;
+        Hive->Header->SecondarySequence = Journal->Sequence;
+        Hive->Header->Checksum = 0;
+        Hive->Header->Checksum = HiveCalculateChecksum(Hive->Header);
     }
     
     /* Prepare file header */
-    PHIVE_FILE_HEADER FileHeader = (PHIVE_FILE_HEADER)FileData;
-    FileHeader->Signature = HIVE_FILE_SIGNATURE;
-    FileHeader->Version = HIVE_VERSION;
-    FileHeader->HiveSize = Hive->Size;
-    FileHeader->Timestamp = 0; /* TODO: Get current time */
-    FileHeader->Flags = 0;
-    memset(FileHeader->Reserved, 0, sizeof(FileHeader->Reserved));
+    HIVE_FILE_HEADER FileHeader;
+    memset(&FileHeader, 0, sizeof(FileHeader));
+    FileHeader.Signature = HIVE_FILE_SIGNATURE;
+    FileHeader.Version = HIVE_VERSION;
+    FileHeader.HiveSize = (UINT32)Hive->Size;
+    FileHeader.Timestamp = 0; /* TODO: Get current time */
+    FileHeader.Flags = HIVE_FILE_FLAG_JOURNALED;
+    
+    PFS_HANDLE Handle;
+    Status = FsOpen(FileName, &Handle);
+    if (Status == STATUS_OBJECT_NAME_NOT_FOUND) {
+        Status = FsCreate(FileName, 0, &Handle);
+    }
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
     
-    /* Copy hive data */
-    PVOID HiveDataDest = (UINT8*)FileData + sizeof(HIVE_FILE_HEADER);
-    memcpy(HiveDataDest, Hive->BaseAddress, Hive->Size);
+    UINT64 Written = 0;
+    Status = FsWriteAt(Handle, 0, &FileHeader, sizeof(FileHeader), &Written);
+    if (NT_SUCCESS(Status) && Written == sizeof(FileHeader)) {
+        Status = FsWriteAt(Handle, sizeof(FileHeader), Hive->BaseAddress, Hive->Size, &Written);
+        if (NT_SUCCESS(Status) && Written != Hive->Size) {
+            Status = STATUS_DISK_FULL;
+        }
+    } else if (NT_SUCCESS(Status)) {
+        Status = STATUS_DISK_FULL;
+    }
+    if (NT_SUCCESS(Status)) {
+        Status = FsFlush(Handle);
+    }
     
-    /* Calculate and set file checksum */
-    FileHeader->Checksum = 0;
-    FileHeader->Checksum = HiveCalculateFileChecksum(FileData, FileSize);
+    FsClose(Handle);
     
-    /* Write to file system */
-    /* NTSTATUS Status = FileSystemWriteFile(FileName, FileData, FileSize); */
+    if (NT_SUCCESS(Status) && Primary) {
+        memset(Journal->DirtyBitmap, 0, 2 * Journal->BitmapWords * sizeof(UINT32));
+        Journal->FlushCount = 0;
+        Hive->DirtyFlag = FALSE;
+    }
     
-    /* Free file buffer */
-    /* KernFreeMemory(FileData); */
+    return Status;
+}
+
+/*
+ * Write a hive out to FileName and journal all later flushes against it
+ */
+NTSTATUS HiveSetBackingFile(IN PHIVE Hive, IN PCSTR FileName)
+{
+    if (!Hive || !FileName || !Hive->Header) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    NTSTATUS Status = HiveJournalAttach(Hive, FileName, Hive->Header->PrimarySequence);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
     
-    /* For now, return success since we can't actually write files */
-    return STATUS_SUCCESS;
+    /* Logs left by an earlier file of this name must not replay over ours */
+    HiveJournalDiscardLogs(FileName);
+    
+    Status = HiveSaveToFile(Hive, FileName);
+    if (!NT_SUCCESS(Status)) {
+        HiveJournalRelease(Hive);
+    }
+    
+    return Status;
 }
 
 /*
@@ -429,39 +538,6 @@ NTSTATUS HiveLoadWithTransactionLog(IN PCSTR HiveFile, IN PCSTR LogFile, OUT PHI
     return STATUS_SUCCESS;
 }
 
-/*
- * Apply transaction log to hive
- */
-NTSTATUS HiveApplyTransactionLog(IN PHIVE Hive, IN PCSTR LogFile)
-{
-    if (!Hive || !LogFile) {
-        return STATUS_INVALID_PARAMETER;
-    }
-
-    /* This would read and apply transaction log entries */
-    /* For now, return success (no-op) */
-    return STATUS_SUCCESS;
-}
-
-/*
- * Create transaction log entry
- */
-NTSTATUS HiveCreateLogEntry(IN PHIVE Hive, IN UINT32 Operation, IN UINT32 Offset, IN PVOID Data, IN UINT32 Size)
-{
-    if (!Hive) {
-        return STATUS_INVALID_PARAMETER;
-    }
-
-    /* This would create a transaction log entry for the operation */
-    /* For now, return success (no-op) */
-    UNREFERENCED_PARAMETER(Operation);
-    UNREFERENCED_PARAMETER(Offset);
-    UNREFERENCED_PARAMETER(Data);
-    UNREFERENCED_PARAMETER(Size);
-    
-    return STATUS_SUCCESS;
-}
-
 /*
  * Compact hive during save
  */
@@ -536,6 +612,10 @@ UINT32 HiveCalculateCompactedSize(IN PHIVE Hive)
 
     UINT32 CompactedSize = sizeof(HIVE_HEADER);
     
+    if (!NT_SUCCESS(HiveFaultRange(Hive, 0, Hive->Size))) {
+        return 0;
+    }
+    
     /* Scan hive and count allocated cells */
     UINT32 Offset = sizeof(HIVE_HEADER);
     while (Offset < Hive->Size) {
@@ -567,6 +647,11 @@ NTSTATUS HiveCopyCompacted(IN PHIVE SourceHive, IN PHIVE DestHive)
     /* Copy header */
     memcpy(DestHive->Header, SourceHive->Header, sizeof(HIVE_HEADER));
     
+    NTSTATUS Status = HiveFaultRange(SourceHive, 0, SourceHive->Size);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
     /* Copy allocated cells sequentially */
     UINT32 SourceOffset = sizeof(HIVE_HEADER);
     UINT32 DestOffset = sizeof(HIVE_HEADER);
@@ -0,0 +1,656 @@
+/*
+ * Aurora Kernel - Registry Hive Journal
+ * Copyright (c) 2024 NTCore Project
+ *
+ * Writes reach the primary hive file in two steps. HiveFlush first writes
+ * the dirty sectors to one of two log files, alternating by sequence
+ * number, with a run table saying where each sector goes and a CRC over
+ * the whole log. Later, the sectors are copied into the primary file and
+ * its header is stamped with the sequence of the log it now contains. A
+ * crash between the two leaves a log newer than the primary file, which
+ * loading replays; a torn log fails its CRC and the other log is used.
+ */
+
+#include "hive.h"
+#include "../../include/fs.h"
+
+/*
+ * Build "<primary>.LOG1" or "<primary>.LOG2" for a sequence number
+ */
+static BOOL HiveLogFileName(IN PCSTR FileName, IN UINT32 Sequence, OUT PCHAR Buffer)
+{
+    SIZE_T Length = strlen(FileName);
+
+    if (Length + 6 >= HIVE_LOG_FILE_MAX) {
+        return FALSE;
+    }
+
+    memcpy(Buffer, FileName, Length);
+    memcpy(Buffer + Length, (Sequence & 1) ? ".LOG1" : ".LOG2", 6);
+    return TRUE;
+}
+
+/*
+ * Open a file for writing, creating it if needed
+ */
+static NTSTATUS HiveOpenForWrite(IN PCSTR FileName, OUT PFS_HANDLE* Handle)
+{
+    NTSTATUS Status = FsOpen(FileName, Handle);
+    if (Status == STATUS_OBJECT_NAME_NOT_FOUND || Status == STATUS_FILE_NOT_FOUND) {
+        Status = FsCreate(FileName, 0, Handle);
+    }
+    return Status;
+}
+
+/*
+ * Write a buffer in full
+ */
+static NTSTATUS HiveWriteFully(IN PFS_HANDLE Handle, IN UINT64 Offset, IN PVOID Buffer, IN UINT64 Size)
+{
+    UINT64 Written = 0;
+    NTSTATUS Status = FsWriteAt(Handle, Offset, Buffer, Size, &Written);
+    if (NT_SUCCESS(Status) && Written != Size) {
+        Status = STATUS_DISK_FULL;
+    }
+    return Status;
+}
+
+static UINT32 HiveSectorCount(IN PHIVE Hive)
+{
+    return (UINT32)((Hive->Size + HIVE_SECTOR_SIZE - 1) / HIVE_SECTOR_SIZE);
+}
+
+static BOOL HiveSectorTest(IN PUINT32 Bitmap, IN UINT32 Sector)
+{
+    return (Bitmap[Sector / 32] >> (Sector % 32)) & 1;
+}
+
+/*
+ * Find the next run of set bits at or after *Sector; FALSE when none
+ */
+static BOOL HiveNextRun(IN PUINT32 Bitmap, IN UINT32 Sectors, IN OUT PUINT32 Sector, OUT PUINT32 Count)
+{
+    UINT32 Start = *Sector;
+
+    while (Start < Sectors) {
+        UINT32 Word = Bitmap[Start / 32] >> (Start % 32);
+        if (Word) {
+            Start += __builtin_ctz(Word);
+            break;
+        }
+        Start = (Start | 31) + 1;
+    }
+    if (Start >= Sectors) {
+        return FALSE;
+    }
+
+    UINT32 End = Start + 1;
+    while (End < Sectors && HiveSectorTest(Bitmap, End)) {
+        End++;
+    }
+
+    *Sector = Start;
+    *Count = End - Start;
+    return TRUE;
+}
+
+/*
+ * Mark bytes of the hive image as written
+ */
+VOID HiveMarkDirtyRange(IN PHIVE Hive, IN PVOID Address, IN SIZE_T Length)
+{
+    if (!Hive || Hive->ReadOnly) {
+        return;
+    }
+
+    Hive->DirtyFlag = TRUE;
+
+    if (!Address || Length == 0) {
+        return;
+    }
+
+    SIZE_T Offset = (SIZE_T)((UINT8*)Address - (UINT8*)Hive->BaseAddress);
+    if (Offset >= Hive->Size) {
+        return;
+    }
+    if (Length > Hive->Size - Offset) {
+        Length = Hive->Size - Offset;
+    }
+
+    HiveChecksumInvalidate(Hive, Offset, Length);
+
+    PHIVE_JOURNAL Journal = Hive->Journal;
+    if (!Journal) {
+        return;
+    }
+
+    UINT32 First = (UINT32)(Offset / HIVE_SECTOR_SIZE);
+    UINT32 Last = (UINT32)((Offset + Length - 1) / HIVE_SECTOR_SIZE);
+    for (UINT32 Sector = First; Sector <= Last; Sector++) {
+        Journal->DirtyBitmap[Sector / 32] |= 1u << (Sector % 32);
+    }
+}
+
+/*
+ * Mark a whole cell, header included, as written
+ */
+VOID HiveMarkCellDirty(IN PHIVE Hive, IN UINT32 CellOffset)
+{
+    if (!Hive || !Hive->BaseAddress || CellOffset < sizeof(HIVE_HEADER) || CellOffset >= Hive->Size) {
+        return;
+    }
+
+    PCELL_HEADER Cell = (PCELL_HEADER)((UINT8*)Hive->BaseAddress + CellOffset);
+    INT32 Size = Cell->Size < 0 ? -Cell->Size : Cell->Size;
+    HiveMarkDirtyRange(Hive, Cell, Size ? (SIZE_T)Size : sizeof(CELL_HEADER));
+}
+
+/*
+ * Start journaling a hive whose image matches FileName up to log Sequence
+ */
+NTSTATUS HiveJournalAttach(IN PHIVE Hive, IN PCSTR FileName, IN UINT32 Sequence)
+{
+    if (!Hive || !Hive->BaseAddress || !FileName || strlen(FileName) + 6 >= HIVE_LOG_FILE_MAX) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    UINT32 Words = (HiveSectorCount(Hive) + 31) / 32;
+    PHIVE_JOURNAL Journal = Hive->Journal;
+
+    if (!Journal || Journal->BitmapWords != Words) {
+        HiveJournalRelease(Hive);
+        Journal = (PHIVE_JOURNAL)AuroraAllocateMemory(sizeof(HIVE_JOURNAL) + 2 * Words * sizeof(UINT32));
+        if (!Journal) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        Journal->DirtyBitmap = (PUINT32)(Journal + 1);
+        Journal->PendingBitmap = Journal->DirtyBitmap + Words;
+        Journal->BitmapWords = Words;
+        Hive->Journal = Journal;
+    }
+
+    memset(Journal->DirtyBitmap, 0, 2 * Words * sizeof(UINT32));
+    Journal->Sequence = Sequence;
+    Journal->FlushCount = 0;
+    strcpy(Journal->FileName, FileName);
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Stop journaling; unreconciled logs stay on disk for the next load
+ */
+VOID HiveJournalRelease(IN PHIVE Hive)
+{
+    if (Hive && Hive->Journal) {
+        AuroraFreeMemory(Hive->Journal);
+        Hive->Journal = NULL;
+    }
+}
+
+/*
+ * Delete both logs of a hive file
+ */
+VOID HiveJournalDiscardLogs(IN PCSTR FileName)
+{
+    CHAR LogFile[HIVE_LOG_FILE_MAX];
+
+    for (UINT32 i = 1; i <= 2; i++) {
+        if (FileName && HiveLogFileName(FileName, i, LogFile)) {
+            FsRemove(LogFile);
+        }
+    }
+}
+
+/*
+ * Write every sector not yet in the primary file as the next log
+ */
+NTSTATUS HiveJournalWrite(IN PHIVE Hive)
+{
+    if (!Hive || !Hive->Journal) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PHIVE_JOURNAL Journal = Hive->Journal;
+    UINT32 Sectors = HiveSectorCount(Hive);
+    UINT32 RunCount = 0;
+    UINT32 DataSectors = 0;
+    UINT32 Sector = 0;
+    UINT32 Count;
+
+    for (UINT32 i = 0; i < Journal->BitmapWords; i++) {
+        Journal->PendingBitmap[i] |= Journal->DirtyBitmap[i];
+        Journal->DirtyBitmap[i] = 0;
+    }
+
+    while (HiveNextRun(Journal->PendingBitmap, Sectors, &Sector, &Count)) {
+        RunCount++;
+        DataSectors += Count;
+        Sector += Count;
+    }
+    if (RunCount == 0) {
+        return STATUS_SUCCESS;
+    }
+
+    UINT32 TableSize = (RunCount * sizeof(HIVE_LOG_RUN) + HIVE_SECTOR_SIZE - 1) & ~(HIVE_SECTOR_SIZE - 1);
+    UINT32 LogSize = HIVE_SECTOR_SIZE + TableSize + DataSectors * HIVE_SECTOR_SIZE;
+    UINT8* Log = (UINT8*)AuroraAllocateMemory(LogSize);
+    if (!Log) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    memset(Log, 0, HIVE_SECTOR_SIZE + TableSize);
+
+    PHIVE_LOG_HEADER LogHeader = (PHIVE_LOG_HEADER)Log;
+    PHIVE_LOG_RUN Runs = (PHIVE_LOG_RUN)(Log + HIVE_SECTOR_SIZE);
+    UINT8* Data = Log + HIVE_SECTOR_SIZE + TableSize;
+
+    LogHeader->Signature = HIVE_LOG_SIGNATURE;
+    LogHeader->Sequence = Journal->Sequence + 1;
+    LogHeader->HiveSize = (UINT32)Hive->Size;
+    LogHeader->RunCount = RunCount;
+    LogHeader->SectorCount = DataSectors;
+
+    /* The last sector of the image may be partial; its tail logs as zeros */
+    RunCount = 0;
+    Sector = 0;
+    while (HiveNextRun(Journal->PendingBitmap, Sectors, &Sector, &Count)) {
+        SIZE_T Offset = (SIZE_T)Sector * HIVE_SECTOR_SIZE;
+        SIZE_T Bytes = (SIZE_T)Count * HIVE_SECTOR_SIZE;
+        if (Offset + Bytes > Hive->Size) {
+            memset(Data + Hive->Size - Offset, 0, Offset + Bytes - Hive->Size);
+            Bytes = Hive->Size - Offset;
+        }
+        memcpy(Data, (UINT8*)Hive->BaseAddress + Offset, Bytes);
+        Runs[RunCount].Sector = Sector;
+        Runs[RunCount].Count = Count;
+        RunCount++;
+        Data += (SIZE_T)Count * HIVE_SECTOR_SIZE;
+        Sector += Count;
+    }
+
+    LogHeader->Checksum = HiveCalculateCrc32Checksum(Log, LogSize);
+
+    CHAR LogFile[HIVE_LOG_FILE_MAX];
+    PFS_HANDLE Handle;
+    NTSTATUS Status = STATUS_INVALID_PARAMETER;
+
+    if (HiveLogFileName(Journal->FileName, LogHeader->Sequence, LogFile)) {
+        Status = HiveOpenForWrite(LogFile, &Handle);
+    }
+    if (NT_SUCCESS(Status)) {
+        Status = HiveWriteFully(Handle, 0, Log, LogSize);
+        if (NT_SUCCESS(Status)) {
+            Status = FsFlush(Handle);
+        }
+        FsClose(Handle);
+    }
+
+    /* On failure the sectors stay pending and go out with the next log */
+    if (NT_SUCCESS(Status)) {
+        Journal->Sequence = LogHeader->Sequence;
+        Journal->FlushCount++;
+    }
+
+    AuroraFreeMemory(Log);
+
+    if (NT_SUCCESS(Status) && Journal->FlushCount >= HIVE_RECONCILE_INTERVAL) {
+        Status = HiveJournalReconcile(Hive);
+    }
+    return Status;
+}
+
+/*
+ * Copy logged sectors into the primary file, then stamp its header
+ */
+NTSTATUS HiveJournalReconcile(IN PHIVE Hive)
+{
+    if (!Hive || !Hive->Journal || !Hive->Header) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PHIVE_JOURNAL Journal = Hive->Journal;
+    UINT32 Sectors = HiveSectorCount(Hive);
+    UINT32 Sector = sizeof(HIVE_HEADER) / HIVE_SECTOR_SIZE;
+    UINT32 Count;
+    PFS_HANDLE Handle;
+
+    if (Journal->Sequence == Hive->Header->PrimarySequence) {
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS Status = FsOpen(Journal->FileName, &Handle);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
+    /* Cells first; the header goes last, once they are on disk */
+    while (NT_SUCCESS(Status) && HiveNextRun(Journal->PendingBitmap, Sectors, &Sector, &Count)) {
+        SIZE_T Offset = (SIZE_T)Sector * HIVE_SECTOR_SIZE;
+        SIZE_T Bytes = (SIZE_T)Count * HIVE_SECTOR_SIZE;
+        if (Offset + Bytes > Hive->Size) {
+            Bytes = Hive->Size - Offset;
+        }
+        Status = HiveWriteFully(Handle, sizeof(HIVE_FILE_HEADER) + Offset,
+                                (UINT8*)Hive->BaseAddress + Offset, Bytes);
+        Sector += Count;
+    }
+    if (NT_SUCCESS(Status)) {
+        Status = FsFlush(Handle);
+    }
+
+    if (NT_SUCCESS(Status)) {
+        Hive->Header->PrimarySequence = Journal->Sequence;
+        Hive->Header->SecondarySequence = Journal->Sequence;
+        Hive->Header->Checksum = 0;
+        Hive->Header->Checksum = HiveCalculateChecksum(Hive->Header);
+        Status = HiveWriteFully(Handle, sizeof(HIVE_FILE_HEADER), Hive->Header, sizeof(HIVE_HEADER));
+        if (NT_SUCCESS(Status)) {
+            Status = FsFlush(Handle);
+        }
+    }
+
+    FsClose(Handle);
+
+    if (NT_SUCCESS(Status)) {
+        memset(Journal->PendingBitmap, 0, Journal->BitmapWords * sizeof(UINT32));
+        Journal->FlushCount = 0;
+    }
+    return Status;
+}
+
+/*
+ * Cut a journaled hive down to NewSize bytes. The caller has already made
+ * the bytes from NewSize on a free cell of their own, so the image is valid
+ * at either size. Everything is reconciled at the old size first; then the
+ * first sector, which holds both size fields, is rewritten in one write.
+ */
+NTSTATUS HiveJournalTruncate(IN PHIVE Hive, IN UINT32 NewSize)
+{
+    if (!Hive || !Hive->Journal || !Hive->Header || NewSize < sizeof(HIVE_HEADER) || NewSize >= Hive->Size) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    NTSTATUS Status = HiveJournalWrite(Hive);
+    if (NT_SUCCESS(Status)) {
+        Status = HiveJournalReconcile(Hive);
+    }
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
+    UINT8 Sector[HIVE_SECTOR_SIZE];
+    PHIVE_FILE_HEADER FileHeader = (PHIVE_FILE_HEADER)Sector;
+    PFS_HANDLE Handle;
+    UINT64 Read = 0;
+
+    Status = FsOpen(Hive->Journal->FileName, &Handle);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
+    Status = FsReadAt(Handle, 0, FileHeader, sizeof(HIVE_FILE_HEADER), &Read);
+    if (NT_SUCCESS(Status) && Read != sizeof(HIVE_FILE_HEADER)) {
+        Status = STATUS_END_OF_FILE;
+    }
+
+    if (NT_SUCCESS(Status)) {
+        Hive->Header->Size = NewSize;
+        Hive->Header->Checksum = 0;
+        Hive->Header->Checksum = HiveCalculateChecksum(Hive->Header);
+        FileHeader->HiveSize = NewSize;
+        memcpy(Sector + sizeof(HIVE_FILE_HEADER), Hive->Header, sizeof(Sector) - sizeof(HIVE_FILE_HEADER));
+        Status = HiveWriteFully(Handle, 0, Sector, sizeof(Sector));
+        if (NT_SUCCESS(Status)) {
+            Status = FsFlush(Handle);
+        }
+    }
+
+    FsClose(Handle);
+
+    if (!NT_SUCCESS(Status)) {
+        Hive->Header->Size = (UINT32)Hive->Size;
+        Hive->Header->Checksum = 0;
+        Hive->Header->Checksum = HiveCalculateChecksum(Hive->Header);
+        return Status;
+    }
+
+    /* Nothing is pending, so the bitmaps start over at the new size */
+    CHAR FileName[HIVE_LOG_FILE_MAX];
+    UINT32 Sequence = Hive->Journal->Sequence;
+    strcpy(FileName, Hive->Journal->FileName);
+    Hive->Size = NewSize;
+    return HiveJournalAttach(Hive, FileName, Sequence);
+}
+
+/*
+ * Read a log and check it fits a hive of HiveSize bytes; the caller frees
+ * *Log. Logs at or below MinSequence are refused as already applied.
+ */
+static NTSTATUS HiveReadLog(IN PCSTR LogFile, IN UINT32 HiveSize, IN UINT32 MinSequence, OUT UINT8** Log)
+{
+    HIVE_LOG_HEADER LogHeader;
+    PFS_HANDLE Handle;
+    UINT64 Read = 0;
+
+    *Log = NULL;
+
+    NTSTATUS Status = FsOpen(LogFile, &Handle);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
+    Status = FsReadAt(Handle, 0, &LogHeader, sizeof(LogHeader), &Read);
+    if (NT_SUCCESS(Status) && Read != sizeof(LogHeader)) {
+        Status = STATUS_INVALID_FILE_FORMAT;
+    }
+
+    UINT32 Sectors = (HiveSize + HIVE_SECTOR_SIZE - 1) / HIVE_SECTOR_SIZE;
+    if (NT_SUCCESS(Status) && (LogHeader.Signature != HIVE_LOG_SIGNATURE || LogHeader.HiveSize != HiveSize ||
+                               LogHeader.RunCount == 0 || LogHeader.RunCount > Sectors ||
+                               LogHeader.SectorCount > Sectors)) {
+        Status = STATUS_INVALID_FILE_FORMAT;
+    }
+    if (NT_SUCCESS(Status) && (INT32)(LogHeader.Sequence - MinSequence) <= 0) {
+        Status = STATUS_NOT_FOUND;
+    }
+
+    UINT32 TableSize = (LogHeader.RunCount * sizeof(HIVE_LOG_RUN) + HIVE_SECTOR_SIZE - 1) & ~(HIVE_SECTOR_SIZE - 1);
+    UINT32 LogSize = HIVE_SECTOR_SIZE + TableSize + LogHeader.SectorCount * HIVE_SECTOR_SIZE;
+    UINT8* Buffer = NULL;
+
+    if (NT_SUCCESS(Status)) {
+        Buffer = (UINT8*)AuroraAllocateMemory(LogSize);
+        if (!Buffer) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+    if (NT_SUCCESS(Status)) {
+        Status = FsReadAt(Handle, 0, Buffer, LogSize, &Read);
+        if (NT_SUCCESS(Status) && Read != LogSize) {
+            Status = STATUS_FILE_CHECKSUM_MISMATCH;
+        }
+    }
+
+    FsClose(Handle);
+
+    if (NT_SUCCESS(Status)) {
+        PHIVE_LOG_HEADER Header = (PHIVE_LOG_HEADER)Buffer;
+        UINT32 Stored = Header->Checksum;
+        Header->Checksum = 0;
+        if (HiveCalculateCrc32Checksum(Buffer, LogSize) != Stored) {
+            Status = STATUS_FILE_CHECKSUM_MISMATCH;
+        }
+        Header->Checksum = Stored;
+    }
+
+    /* The runs must cover exactly the data sectors, inside the hive */
+    if (NT_SUCCESS(Status)) {
+        PHIVE_LOG_RUN Runs = (PHIVE_LOG_RUN)(Buffer + HIVE_SECTOR_SIZE);
+        UINT32 Total = 0;
+        for (UINT32 i = 0; i < LogHeader.RunCount && NT_SUCCESS(Status); i++) {
+            if (Runs[i].Count == 0 || Runs[i].Sector >= Sectors || Runs[i].Count > Sectors - Runs[i].Sector) {
+                Status = STATUS_INVALID_FILE_FORMAT;
+            }
+            Total += Runs[i].Count;
+        }
+        if (NT_SUCCESS(Status) && Total != LogHeader.SectorCount) {
+            Status = STATUS_INVALID_FILE_FORMAT;
+        }
+    }
+
+    if (!NT_SUCCESS(Status)) {
+        if (Buffer) {
+            AuroraFreeMemory(Buffer);
+        }
+        return Status;
+    }
+
+    *Log = Buffer;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Copy a validated log's sectors into the hive image. Bins not read in yet
+ * are faulted in first, so the sectors land on current data.
+ */
+static NTSTATUS HiveReplayLog(IN UINT8* Log, IN PHIVE Hive, IN PUINT32 Bitmap OPTIONAL)
+{
+    PHIVE_LOG_HEADER LogHeader = (PHIVE_LOG_HEADER)Log;
+    PHIVE_LOG_RUN Runs = (PHIVE_LOG_RUN)(Log + HIVE_SECTOR_SIZE);
+    UINT32 TableSize = (LogHeader->RunCount * sizeof(HIVE_LOG_RUN) + HIVE_SECTOR_SIZE - 1) & ~(HIVE_SECTOR_SIZE - 1);
+    UINT8* Data = Log + HIVE_SECTOR_SIZE + TableSize;
+
+    for (UINT32 i = 0; i < LogHeader->RunCount; i++) {
+        SIZE_T Offset = (SIZE_T)Runs[i].Sector * HIVE_SECTOR_SIZE;
+        SIZE_T Bytes = (SIZE_T)Runs[i].Count * HIVE_SECTOR_SIZE;
+        if (Offset + Bytes > Hive->Size) {
+            Bytes = Hive->Size - Offset;
+        }
+        NTSTATUS Status = HiveFaultRange(Hive, (UINT32)Offset, Bytes);
+        if (!NT_SUCCESS(Status)) {
+            return Status;
+        }
+        memcpy((UINT8*)Hive->BaseAddress + Offset, Data, Bytes);
+        HiveChecksumInvalidate(Hive, Offset, Bytes);
+        Data += (SIZE_T)Runs[i].Count * HIVE_SECTOR_SIZE;
+
+        if (Bitmap) {
+            for (UINT32 Sector = Runs[i].Sector; Sector < Runs[i].Sector + Runs[i].Count; Sector++) {
+                Bitmap[Sector / 32] |= 1u << (Sector % 32);
+            }
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Replay the newest valid log of a hive file past MinSequence into the
+ * image read from that file, before the hive is loaded from it. *Sequence
+ * is the log replayed, or MinSequence.
+ */
+NTSTATUS HiveJournalRecover(IN PHIVE Hive, IN PCSTR FileName, IN UINT32 MinSequence, OUT PUINT32 Sequence)
+{
+    if (!Hive || !Hive->BaseAddress || !FileName || !Sequence) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    NTSTATUS Status = STATUS_SUCCESS;
+
+    CHAR LogFile[HIVE_LOG_FILE_MAX];
+    UINT8* Logs[2] = { NULL, NULL };
+
+    *Sequence = MinSequence;
+
+    for (UINT32 i = 0; i < 2; i++) {
+        if (HiveLogFileName(FileName, i + 1, LogFile)) {
+            HiveReadLog(LogFile, (UINT32)Hive->Size, MinSequence, &Logs[i]);
+        }
+    }
+
+    /* Each log holds everything since the last reconcile, so one is enough */
+    UINT8* Newest = Logs[0];
+    if (Logs[1] && (!Newest || (INT32)(((PHIVE_LOG_HEADER)Logs[1])->Sequence -
+                                        ((PHIVE_LOG_HEADER)Newest)->Sequence) > 0)) {
+        Newest = Logs[1];
+    }
+
+    if (Newest) {
+        Status = HiveReplayLog(Newest, Hive, NULL);
+        if (NT_SUCCESS(Status)) {
+            *Sequence = ((PHIVE_LOG_HEADER)Newest)->Sequence;
+        }
+    }
+
+    for (UINT32 i = 0; i < 2; i++) {
+        if (Logs[i]) {
+            AuroraFreeMemory(Logs[i]);
+        }
+    }
+    return Status;
+}
+
+/*
+ * Apply one log file to a loaded hive if it is valid and newer than what
+ * the hive holds. The replayed sectors are logged again at the next flush.
+ */
+NTSTATUS HiveApplyTransactionLog(IN PHIVE Hive, IN PCSTR LogFile)
+{
+    if (!Hive || !LogFile || !Hive->BaseAddress || !Hive->Header) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    UINT32 MinSequence = Hive->Journal ? Hive->Journal->Sequence : Hive->Header->PrimarySequence;
+    UINT8* Log;
+
+    NTSTATUS Status = HiveReadLog(LogFile, (UINT32)Hive->Size, MinSequence, &Log);
+    if (Status == STATUS_NOT_FOUND || Status == STATUS_OBJECT_NAME_NOT_FOUND) {
+        return STATUS_SUCCESS;
+    }
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
+    Status = HiveReplayLog(Log, Hive, Hive->Journal ? Hive->Journal->DirtyBitmap : NULL);
+    if (!NT_SUCCESS(Status)) {
+        AuroraFreeMemory(Log);
+        return Status;
+    }
+    if (Hive->Journal) {
+        Hive->Journal->Sequence = ((PHIVE_LOG_HEADER)Log)->Sequence;
+    }
+    AuroraFreeMemory(Log);
+
+    Hive->RootKeyOffset = Hive->Header->RootKeyOffset;
+    Hive->Generation++;
+    Hive->DirtyFlag = TRUE;
+    HiveClearHints(Hive);
+    return HiveRebuildFreeSpaceMap(Hive);
+}
+
+/*
+ * Record a write of Size bytes at hive Offset, copying Data there first
+ * when given. The bytes go out in the next log.
+ */
+NTSTATUS HiveCreateLogEntry(IN PHIVE Hive, IN UINT32 Operation, IN UINT32 Offset, IN PVOID Data, IN UINT32 Size)
+{
+    UNREFERENCED_PARAMETER(Operation);
+
+    if (!Hive || !Hive->BaseAddress || Offset >= Hive->Size || Size > Hive->Size - Offset) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (Hive->ReadOnly) {
+        return STATUS_ACCESS_DENIED;
+    }
+
+    NTSTATUS Status = HiveFaultRange(Hive, Offset, Size);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
+    UINT8* Target = (UINT8*)Hive->BaseAddress + Offset;
+    if (Data) {
+        memcpy(Target, Data, Size);
+    }
+    HiveMarkDirtyRange(Hive, Target, Size);
+    return STATUS_SUCCESS;
+}
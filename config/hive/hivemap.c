@@ -8,7 +8,11 @@
 /* Memory mapping constants */
 #define HIVE_MAP_GRANULARITY 4096      /* 4KB page size */
 #define HIVE_MAX_MAPPED_VIEWS 64       /* Maximum mapped views per hive */
-#define HIVE_VIEW_SIZE (64 * 1024)     /* 64KB view size */
+
+/* Offset to view lookup: bits 31..24 pick a leaf, bits 23..14 a bin in it */
+#define HIVE_VIEW_LEAF_SHIFT 24
+#define HIVE_VIEW_LEAF_SLOTS (1u << (HIVE_VIEW_LEAF_SHIFT - HIVE_BIN_SHIFT))
+#define HIVE_VIEW_TOP_SLOTS (1u << (32 - HIVE_VIEW_LEAF_SHIFT))
 
 /* Memory mapping structures */
 typedef struct _HIVE_VIEW {
@@ -27,6 +31,8 @@ typedef struct _HIVE_MAPPING {
     AURORA_SPINLOCK Lock;       /* Synchronization lock */
     PVOID BaseMapping;          /* Base mapping address */
     UINT32 MappingSize;         /* Total mapping size */
+    PHIVE_VIEW* ViewTable[HIVE_VIEW_TOP_SLOTS]; /* Bin to view, leaves allocated on use */
+    struct _HIVE_MAPPING* Next; /* Next mapping in global list */
 } HIVE_MAPPING, *PHIVE_MAPPING;
 
 /* Global mapping list */
@@ -51,9 +57,55 @@ VOID HiveMapShutdown(void)
 {
     /* Unmap all hives */
     while (g_HiveMappings) {
-        PHIVE_MAPPING Mapping = g_HiveMappings;
-        g_HiveMappings = (PHIVE_MAPPING)Mapping->Views; /* Reuse Next pointer */
-        HiveUnmapHive(Mapping->Hive);
+        HiveUnmapHive(g_HiveMappings->Hive);
+    }
+}
+
+/*
+ * Slot holding the view for the bin at Offset, optionally creating its leaf
+ */
+static PHIVE_VIEW* HiveViewSlot(IN PHIVE_MAPPING Mapping, IN UINT32 Offset, IN BOOL Create)
+{
+    PHIVE_VIEW* Leaf = Mapping->ViewTable[Offset >> HIVE_VIEW_LEAF_SHIFT];
+    if (!Leaf) {
+        if (!Create) {
+            return NULL;
+        }
+        Leaf = (PHIVE_VIEW*)AuroraAllocateMemory(HIVE_VIEW_LEAF_SLOTS * sizeof(PHIVE_VIEW));
+        if (!Leaf) {
+            return NULL;
+        }
+        memset(Leaf, 0, HIVE_VIEW_LEAF_SLOTS * sizeof(PHIVE_VIEW));
+        Mapping->ViewTable[Offset >> HIVE_VIEW_LEAF_SHIFT] = Leaf;
+    }
+
+    return &Leaf[(Offset >> HIVE_BIN_SHIFT) & (HIVE_VIEW_LEAF_SLOTS - 1)];
+}
+
+/*
+ * View covering a mapped address, or NULL
+ */
+static PHIVE_VIEW HiveViewFromAddress(IN PHIVE_MAPPING Mapping, IN PVOID Address)
+{
+    if (Address < Mapping->BaseMapping ||
+        Address >= (PVOID)((UINT8*)Mapping->BaseMapping + Mapping->MappingSize)) {
+        return NULL;
+    }
+
+    PHIVE_VIEW* Slot = HiveViewSlot(Mapping, (UINT32)((UINT8*)Address - (UINT8*)Mapping->BaseMapping), FALSE);
+    return Slot ? *Slot : NULL;
+}
+
+/*
+ * Drop a view from the bins it was entered for
+ */
+static VOID HiveViewTableRemove(IN PHIVE_MAPPING Mapping, IN PHIVE_VIEW View)
+{
+    for (UINT32 Offset = View->FileOffset; Offset < View->FileOffset + View->Size; Offset += HIVE_BIN_SIZE) {
+        PHIVE_VIEW* Slot = HiveViewSlot(Mapping, Offset, FALSE);
+        if (Slot && *Slot == View) {
+            *Slot = NULL;
+        }
     }
 }
 
@@ -62,7 +114,7 @@ VOID HiveMapShutdown(void)
  */
 NTSTATUS HiveMapHive(IN PHIVE Hive, OUT PVOID* BaseAddress)
 {
-    if (!Hive || !BaseAddress) {
+    if (!Hive || !BaseAddress || !Hive->BaseAddress) {
         return STATUS_INVALID_PARAMETER;
     }
 
@@ -76,7 +128,7 @@ NTSTATUS HiveMapHive(IN PHIVE Hive, OUT PVOID* BaseAddress)
     }
     
     /* Create new mapping */
-    PHIVE_MAPPING Mapping = NULL; /* KernAllocateMemory(sizeof(HIVE_MAPPING)); */
+    PHIVE_MAPPING Mapping = (PHIVE_MAPPING)AuroraAllocateMemory(sizeof(HIVE_MAPPING));
     if (!Mapping) {
         return STATUS_INSUFFICIENT_RESOURCES;
     }
@@ -87,28 +139,19 @@ NTSTATUS HiveMapHive(IN PHIVE Hive, OUT PVOID* BaseAddress)
     Mapping->ViewCount = 0;
     Mapping->Lock = 0;
     
-    /* Calculate mapping size (align to page boundary) */
-    UINT32 MappingSize = (Hive->Size + HIVE_MAP_GRANULARITY - 1) & ~(HIVE_MAP_GRANULARITY - 1);
-    
-    /* Map hive data into virtual memory */
-    /* In real implementation, would use memory manager */
-    PVOID MappedAddress = NULL; /* MmMapViewOfSection(...); */
-    if (!MappedAddress) {
-        /* KernFreeMemory(Mapping); */
-        return STATUS_INSUFFICIENT_RESOURCES;
-    }
-    
-    /* For simulation, use the hive's existing base address */
-    MappedAddress = Hive->BaseAddress;
-    
-    Mapping->BaseMapping = MappedAddress;
-    Mapping->MappingSize = MappingSize;
+    /* The hive image is one reservation; bins in it are read on demand, so
+       mapping only records the range and views fault their bins in */
+    Mapping->BaseMapping = Hive->BaseAddress;
+    Mapping->MappingSize = (UINT32)Hive->Size;
     
     /* Add to global mapping list */
-    Mapping->Views = (PHIVE_VIEW)g_HiveMappings; /* Reuse Views pointer for list linkage */
+    AURORA_IRQL OldIrql;
+    AuroraAcquireSpinLock(&g_MappingLock, &OldIrql);
+    Mapping->Next = g_HiveMappings;
     g_HiveMappings = Mapping;
+    AuroraReleaseSpinLock(&g_MappingLock, OldIrql);
     
-    *BaseAddress = MappedAddress;
+    *BaseAddress = Mapping->BaseMapping;
     return STATUS_SUCCESS;
 }
 
@@ -133,31 +176,26 @@ NTSTATUS HiveUnmapHive(IN PHIVE Hive)
     while (Mapping->Views) {
         PHIVE_VIEW View = Mapping->Views;
         Mapping->Views = View->Next;
-        
-        /* Unmap view */
-        /* MmUnmapViewOfSection(View->VirtualAddress); */
-        
-        /* Free view structure */
-        /* KernFreeMemory(View); */
+        AuroraFreeMemory(View);
         Mapping->ViewCount--;
     }
     
-    /* Unmap base mapping */
-    if (Mapping->BaseMapping && Mapping->BaseMapping != Hive->BaseAddress) {
-        /* MmUnmapViewOfSection(Mapping->BaseMapping); */
+    for (UINT32 i = 0; i < HIVE_VIEW_TOP_SLOTS; i++) {
+        if (Mapping->ViewTable[i]) {
+            AuroraFreeMemory(Mapping->ViewTable[i]);
+        }
     }
     
     /* Remove from global list */
     HiveRemoveMapping(Mapping);
-    
-    /* Free mapping structure */
-    /* KernFreeMemory(Mapping); */
+    AuroraFreeMemory(Mapping);
     
     return STATUS_SUCCESS;
 }
 
 /*
- * Map a view of hive data
+ * Map a view of hive data. Views are whole bins, so any cell inside one
+ * is found by a table lookup on its offset.
  */
 NTSTATUS HiveMapView(IN PHIVE Hive, IN UINT32 Offset, IN UINT32 Size, OUT PVOID* ViewAddress)
 {
@@ -183,11 +221,15 @@ NTSTATUS HiveMapView(IN PHIVE Hive, IN UINT32 Offset, IN UINT32 Size, OUT PVOID*
         }
     }
     
+    if (Offset >= Mapping->MappingSize || Size > Mapping->MappingSize - Offset) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    
     /* Check if view already exists */
     PHIVE_VIEW ExistingView = HiveFindView(Mapping, Offset, Size);
     if (ExistingView) {
         ExistingView->RefCount++;
-        *ViewAddress = ExistingView->VirtualAddress;
+        *ViewAddress = (UINT8*)Mapping->BaseMapping + Offset;
         return STATUS_SUCCESS;
     }
     
@@ -196,31 +238,50 @@ NTSTATUS HiveMapView(IN PHIVE Hive, IN UINT32 Offset, IN UINT32 Size, OUT PVOID*
         return STATUS_TOO_MANY_VIEWS;
     }
     
+    /* Align offset and size to bin boundaries */
+    UINT32 AlignedOffset = Offset & ~(HIVE_BIN_SIZE - 1);
+    UINT32 AlignedSize = ((Offset + Size - AlignedOffset) + HIVE_BIN_SIZE - 1) & ~(HIVE_BIN_SIZE - 1);
+    if (AlignedSize > Mapping->MappingSize - AlignedOffset) {
+        AlignedSize = Mapping->MappingSize - AlignedOffset;
+    }
+    
+    /* Bring the bins in before anyone dereferences the view */
+    NTSTATUS Status = HiveFaultRange(Hive, AlignedOffset, AlignedSize);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+    
     /* Create new view */
-    PHIVE_VIEW View = NULL; /* KernAllocateMemory(sizeof(HIVE_VIEW)); */
+    PHIVE_VIEW View = (PHIVE_VIEW)AuroraAllocateMemory(sizeof(HIVE_VIEW));
     if (!View) {
         return STATUS_INSUFFICIENT_RESOURCES;
     }
     
-    /* Align offset and size to page boundaries */
-    UINT32 AlignedOffset = Offset & ~(HIVE_MAP_GRANULARITY - 1);
-    UINT32 AlignedSize = ((Offset + Size - AlignedOffset) + HIVE_MAP_GRANULARITY - 1) & ~(HIVE_MAP_GRANULARITY - 1);
-    
-    /* Map view */
-    PVOID ViewAddr = (UINT8*)Mapping->BaseMapping + AlignedOffset;
-    
-    View->VirtualAddress = ViewAddr;
+    View->VirtualAddress = (UINT8*)Mapping->BaseMapping + AlignedOffset;
     View->FileOffset = AlignedOffset;
     View->Size = AlignedSize;
     View->RefCount = 1;
     View->Dirty = FALSE;
     View->Next = Mapping->Views;
     
+    /* Bins already owned by an overlapping view keep pointing at it */
+    for (UINT32 BinOffset = AlignedOffset; BinOffset < AlignedOffset + AlignedSize; BinOffset += HIVE_BIN_SIZE) {
+        PHIVE_VIEW* Slot = HiveViewSlot(Mapping, BinOffset, TRUE);
+        if (!Slot) {
+            HiveViewTableRemove(Mapping, View);
+            AuroraFreeMemory(View);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        if (!*Slot) {
+            *Slot = View;
+        }
+    }
+    
     Mapping->Views = View;
     Mapping->ViewCount++;
     
     /* Calculate actual view address (accounting for alignment) */
-    *ViewAddress = (UINT8*)ViewAddr + (Offset - AlignedOffset);
+    *ViewAddress = (UINT8*)View->VirtualAddress + (Offset - AlignedOffset);
     
     return STATUS_SUCCESS;
 }
@@ -240,39 +301,33 @@ NTSTATUS HiveUnmapView(IN PHIVE Hive, IN PVOID ViewAddress)
     }
     
     /* Find view */
+    PHIVE_VIEW View = HiveViewFromAddress(Mapping, ViewAddress);
+    if (!View) {
+        return STATUS_NOT_FOUND;
+    }
+    
+    /* Decrement reference count */
+    if (--View->RefCount > 0) {
+        return STATUS_SUCCESS;
+    }
+    
+    /* Flush if dirty */
+    if (View->Dirty) {
+        HiveFlushView(Mapping, View);
+    }
+    
+    /* Remove view from table and list */
+    HiveViewTableRemove(Mapping, View);
+    
     PHIVE_VIEW* ViewPtr = &Mapping->Views;
-    while (*ViewPtr) {
-        PHIVE_VIEW View = *ViewPtr;
-        
-        /* Check if address is within this view */
-        if (ViewAddress >= View->VirtualAddress && 
-            ViewAddress < (UINT8*)View->VirtualAddress + View->Size) {
-            
-            /* Decrement reference count */
-            if (--View->RefCount == 0) {
-                /* Remove view from list */
-                *ViewPtr = View->Next;
-                Mapping->ViewCount--;
-                
-                /* Flush if dirty */
-                if (View->Dirty) {
-                    HiveFlushView(Mapping, View);
-                }
-                
-                /* Unmap view */
-                /* MmUnmapViewOfSection(View->VirtualAddress); */
-                
-                /* Free view structure */
-                /* KernFreeMemory(View); */
-            }
-            
-            return STATUS_SUCCESS;
-        }
-        
-        ViewPtr = &View->Next;
+    while (*ViewPtr != View) {
+        ViewPtr = &(*ViewPtr)->Next;
     }
+    *ViewPtr = View->Next;
+    Mapping->ViewCount--;
     
-    return STATUS_NOT_FOUND;
+    AuroraFreeMemory(View);
+    return STATUS_SUCCESS;
 }
 
 /*
@@ -290,20 +345,14 @@ NTSTATUS HiveMarkViewDirty(IN PHIVE Hive, IN PVOID ViewAddress)
     }
     
     /* Find view containing the address */
-    PHIVE_VIEW View = Mapping->Views;
-    while (View) {
-        if (ViewAddress >= View->VirtualAddress && 
-            ViewAddress < (UINT8*)View->VirtualAddress + View->Size) {
-            
-            View->Dirty = TRUE;
-            Hive->DirtyFlag = TRUE;
-            return STATUS_SUCCESS;
-        }
-        
-        View = View->Next;
+    PHIVE_VIEW View = HiveViewFromAddress(Mapping, ViewAddress);
+    if (!View) {
+        return STATUS_NOT_FOUND;
     }
     
-    return STATUS_NOT_FOUND;
+    View->Dirty = TRUE;
+    Hive->DirtyFlag = TRUE;
+    return STATUS_SUCCESS;
 }
 
 /*
@@ -333,7 +382,7 @@ NTSTATUS HiveFlushMappedViews(IN PHIVE_MAPPING Mapping)
 }
 
 /*
- * Flush a single view
+ * Flush a single view; its bytes go out with the next journal write
  */
 NTSTATUS HiveFlushView(IN PHIVE_MAPPING Mapping, IN PHIVE_VIEW View)
 {
@@ -341,8 +390,7 @@ NTSTATUS HiveFlushView(IN PHIVE_MAPPING Mapping, IN PHIVE_VIEW View)
         return STATUS_INVALID_PARAMETER;
     }
 
-    /* In real implementation, would write view data back to storage */
-    /* For now, just mark as clean */
+    HiveMarkDirtyRange(Mapping->Hive, View->VirtualAddress, View->Size);
     View->Dirty = FALSE;
     
     return STATUS_SUCCESS;
@@ -362,33 +410,32 @@ PHIVE_MAPPING HiveFindMapping(IN PHIVE Hive)
         if (Current->Hive == Hive) {
             return Current;
         }
-        Current = (PHIVE_MAPPING)Current->Views; /* Reuse Views pointer for list linkage */
+        Current = Current->Next;
     }
     
     return NULL;
 }
 
 /*
- * Find view within mapping
+ * Find the view holding [Offset, Offset + Size)
  */
 PHIVE_VIEW HiveFindView(IN PHIVE_MAPPING Mapping, IN UINT32 Offset, IN UINT32 Size)
 {
-    if (!Mapping) {
+    if (!Mapping || Offset >= Mapping->MappingSize) {
         return NULL;
     }
 
-    PHIVE_VIEW View = Mapping->Views;
-    while (View) {
-        /* Check if requested range overlaps with existing view */
-        if (Offset >= View->FileOffset && 
-            Offset + Size <= View->FileOffset + View->Size) {
-            return View;
-        }
-        
-        View = View->Next;
+    PHIVE_VIEW* Slot = HiveViewSlot(Mapping, Offset, FALSE);
+    if (!Slot || !*Slot) {
+        return NULL;
     }
     
-    return NULL;
+    PHIVE_VIEW View = *Slot;
+    if (Offset + Size > View->FileOffset + View->Size) {
+        return NULL;
+    }
+    
+    return View;
 }
 
 /*
@@ -400,20 +447,19 @@ VOID HiveRemoveMapping(IN PHIVE_MAPPING Mapping)
         return;
     }
 
-    if (g_HiveMappings == Mapping) {
-        g_HiveMappings = (PHIVE_MAPPING)Mapping->Views; /* Reuse Views pointer */
-        return;
-    }
+    AURORA_IRQL OldIrql;
+    AuroraAcquireSpinLock(&g_MappingLock, &OldIrql);
     
-    PHIVE_MAPPING Current = g_HiveMappings;
-    while (Current) {
-        PHIVE_MAPPING Next = (PHIVE_MAPPING)Current->Views;
-        if (Next == Mapping) {
-            Current->Views = (PHIVE_VIEW)Next->Views; /* Reuse Views pointer */
-            return;
+    PHIVE_MAPPING* Link = &g_HiveMappings;
+    while (*Link) {
+        if (*Link == Mapping) {
+            *Link = Mapping->Next;
+            break;
         }
-        Current = Next;
+        Link = &(*Link)->Next;
     }
+    
+    AuroraReleaseSpinLock(&g_MappingLock, OldIrql);
 }
 
 /*
@@ -458,27 +504,8 @@ NTSTATUS HivePrefaultPages(IN PHIVE Hive, IN UINT32 Offset, IN UINT32 Size)
         return STATUS_INVALID_PARAMETER;
     }
 
-    PHIVE_MAPPING Mapping = HiveFindMapping(Hive);
-    if (!Mapping) {
-        return STATUS_NOT_FOUND;
-    }
-    
-    /* Touch pages to bring them into memory */
-    UINT32 PageSize = HIVE_MAP_GRANULARITY;
-    UINT32 StartPage = Offset / PageSize;
-    UINT32 EndPage = (Offset + Size + PageSize - 1) / PageSize;
-    
-    for (UINT32 Page = StartPage; Page < EndPage; Page++) {
-        UINT32 PageOffset = Page * PageSize;
-        if (PageOffset < Mapping->MappingSize) {
-            /* Touch page to fault it in */
-            volatile UINT8* PageAddr = (UINT8*)Mapping->BaseMapping + PageOffset;
-            UINT8 Dummy = *PageAddr;
-            UNREFERENCED_PARAMETER(Dummy);
-        }
-    }
-    
-    return STATUS_SUCCESS;
+    /* Read any bins of the range not yet in memory */
+    return HiveFaultRange(Hive, Offset, Size);
 }
 
 /*
@@ -0,0 +1,465 @@
+/*
+ * Aurora Kernel - Registry Hive Change Notification
+ * Copyright (c) 2024 NTCore Project
+ *
+ * Writers report each changed key through HiveKeyChanged. With watchers
+ * registered on the hive, the change is matched against watchers on the key
+ * itself and subtree watchers on the key's ancestors, found by walking the
+ * Parent links to the root. A matching watcher that is idle is delivered
+ * to at once if its coalescing window since the last delivery has passed,
+ * and is otherwise parked on the held list until HiveNotifyTick finds the
+ * window over. A watcher that is held or delivered only absorbs the change.
+ * There is no timer to run the tick, so while any watcher has a window,
+ * notification waits wake in slices and tick themselves: a change parked
+ * after a waiter went to sleep still goes out about when its window ends,
+ * whether or not anything is written after it. All watcher and port state
+ * is under one lock; hives with no watchers never take it.
+ */
+
+#include "hive.h"
+
+#define HIVE_NOTIFY_BUCKETS     64
+#define HIVE_NOTIFY_MAX_DEPTH   512     /* bounds the ancestor walk on a damaged hive */
+#define HIVE_NOTIFY_WAIT_SLICE  50      /* ms; waits wake this often while any watcher has a window */
+
+static PHIVE_WATCHER g_WatchBuckets[HIVE_NOTIFY_BUCKETS];
+static PHIVE_WATCHER g_HeldList = NULL;
+static volatile UINT32 g_WindowedWatchers = 0;  /* registered watchers with a window */
+static AURORA_SPINLOCK g_NotifyLock = 0;
+
+/*
+ * Bucket for watchers of a key
+ */
+static PHIVE_WATCHER* HiveWatchBucket(IN PHIVE Hive, IN UINT32 KeyCell)
+{
+    UINT32 Hash = (UINT32)(ULONG_PTR)Hive ^ ((KeyCell >> 3) * 0x9E3779B1u);
+    return &g_WatchBuckets[(Hash >> 16) & (HIVE_NOTIFY_BUCKETS - 1)];
+}
+
+/*
+ * Stop a watcher from matching changes
+ */
+static VOID HiveWatchUnhash(IN PHIVE_WATCHER Watcher)
+{
+    if (!Watcher->Hashed) {
+        return;
+    }
+
+    PHIVE_WATCHER* Link = HiveWatchBucket(Watcher->Hive, Watcher->KeyCell);
+    while (*Link != Watcher) {
+        Link = &(*Link)->HashNext;
+    }
+    *Link = Watcher->HashNext;
+
+    Watcher->Hashed = FALSE;
+    Watcher->Hive->Sync.Watchers--;
+    if (Watcher->Filter & HIVE_NOTIFY_SUBTREE) {
+        Watcher->Hive->Sync.SubtreeWatchers--;
+    }
+}
+
+/*
+ * Take a watcher off the held list or a port queue. Tail, when given, is
+ * set to the last watcher left on the queue.
+ */
+static VOID HiveWatchDequeue(IN PHIVE_WATCHER* Head, OUT PHIVE_WATCHER* Tail, IN PHIVE_WATCHER Watcher)
+{
+    PHIVE_WATCHER Last = NULL;
+    PHIVE_WATCHER* Link = Head;
+
+    while (*Link) {
+        if (*Link == Watcher) {
+            *Link = Watcher->QueueNext;
+        } else {
+            Last = *Link;
+            Link = &Last->QueueNext;
+        }
+    }
+
+    if (Tail) {
+        *Tail = Last;
+    }
+}
+
+/*
+ * Hand a watcher's pending notification to its consumer
+ */
+static VOID HiveWatchDeliver(IN PHIVE_WATCHER Watcher, IN UINT64 Now)
+{
+    Watcher->State = HiveWatchSignaled;
+    Watcher->LastDelivery = Now;
+
+    if (Watcher->Port) {
+        PHIVE_NOTIFY_PORT Port = Watcher->Port;
+        Watcher->QueueNext = NULL;
+        if (Port->Tail) {
+            Port->Tail->QueueNext = Watcher;
+        } else {
+            Port->Head = Watcher;
+        }
+        Port->Tail = Watcher;
+        Port->Count++;
+        AuroraSetEvent(&Port->Event);
+    } else if (Watcher->Event) {
+        AuroraSetEvent(Watcher->Event);
+    }
+}
+
+/*
+ * Fold a change into a watcher, delivering it if the watcher is idle and
+ * outside its window
+ */
+static VOID HiveWatchFire(IN PHIVE_WATCHER Watcher, IN UINT32 ChangedKey, IN UINT32 Flags, IN UINT64 Now)
+{
+    Watcher->ChangedKey = ChangedKey;
+    Watcher->Generation = Watcher->Hive->Sync.ChangeGeneration;
+    Watcher->ChangeCount++;
+    Watcher->Flags |= Flags;
+
+    if (Watcher->State != HiveWatchIdle) {
+        return;
+    }
+
+    if (Watcher->LastDelivery == 0 || Now - Watcher->LastDelivery >= Watcher->Window) {
+        HiveWatchDeliver(Watcher, Now);
+        return;
+    }
+
+    Watcher->State = HiveWatchHeld;
+    Watcher->QueueNext = g_HeldList;
+    g_HeldList = Watcher;
+}
+
+/*
+ * Copy out a delivered notification and re-arm the watcher
+ */
+static VOID HiveWatchConsume(IN PHIVE_WATCHER Watcher, OUT PHIVE_NOTIFICATION Notification)
+{
+    Notification->Context = Watcher->Context;
+    Notification->KeyCell = Watcher->KeyCell;
+    Notification->ChangedKey = Watcher->ChangedKey;
+    Notification->Generation = Watcher->Generation;
+    Notification->ChangeCount = Watcher->ChangeCount;
+    Notification->Flags = Watcher->Flags;
+
+    Watcher->State = HiveWatchIdle;
+    Watcher->ChangeCount = 0;
+    Watcher->Flags = 0;
+}
+
+/*
+ * Create a port that watchers can queue their notifications on
+ */
+NTSTATUS HiveCreateNotifyPort(OUT PHIVE_NOTIFY_PORT* Port)
+{
+    if (!Port) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PHIVE_NOTIFY_PORT NewPort = (PHIVE_NOTIFY_PORT)AuroraAllocateMemory(sizeof(HIVE_NOTIFY_PORT));
+    if (!NewPort) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    memset(NewPort, 0, sizeof(HIVE_NOTIFY_PORT));
+    AuroraInitializeEvent(&NewPort->Event, FALSE, FALSE);
+
+    *Port = NewPort;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Watch a key for changes. Notifications set Event, or queue on Port when
+ * one is given, where they come back with Context. Window is the least
+ * time between two notifications, in system time ticks.
+ */
+NTSTATUS HiveRegisterWatcher(IN PHIVE Hive, IN UINT32 KeyCell, IN UINT32 Filter, IN UINT64 Window,
+                             IN PAURORA_EVENT Event, IN PHIVE_NOTIFY_PORT Port, IN PVOID Context,
+                             OUT PHIVE_WATCHER* Watcher)
+{
+    AURORA_IRQL OldIrql;
+
+    if (!Hive || !Watcher || (!Event && !Port) || (Filter & ~HIVE_NOTIFY_SUBTREE)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PHIVE_WATCHER NewWatcher = (PHIVE_WATCHER)AuroraAllocateMemory(sizeof(HIVE_WATCHER));
+    if (!NewWatcher) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    memset(NewWatcher, 0, sizeof(HIVE_WATCHER));
+    NewWatcher->Hive = Hive;
+    NewWatcher->KeyCell = KeyCell;
+    NewWatcher->Filter = Filter;
+    NewWatcher->Window = Window;
+    NewWatcher->Event = Event;
+    NewWatcher->Port = Port;
+    NewWatcher->Context = Context;
+
+    /* Writers are held off so the key cannot go away before it is watched */
+    HiveAcquireExclusiveLock(Hive, 0);
+    if (!HiveGetKeyCell(Hive, KeyCell)) {
+        HiveReleaseExclusiveLock(Hive);
+        AuroraFreeMemory(NewWatcher);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    AuroraAcquireSpinLock(&g_NotifyLock, &OldIrql);
+    PHIVE_WATCHER* Bucket = HiveWatchBucket(Hive, KeyCell);
+    NewWatcher->HashNext = *Bucket;
+    *Bucket = NewWatcher;
+    NewWatcher->Hashed = TRUE;
+    if (Filter & HIVE_NOTIFY_SUBTREE) {
+        Hive->Sync.SubtreeWatchers++;
+    }
+    Hive->Sync.Watchers++;
+    if (Window) {
+        g_WindowedWatchers++;
+    }
+    AuroraReleaseSpinLock(&g_NotifyLock, OldIrql);
+
+    HiveReleaseExclusiveLock(Hive);
+
+    *Watcher = NewWatcher;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Stop watching and drop any notification not yet read
+ */
+NTSTATUS HiveCancelWatcher(IN PHIVE_WATCHER Watcher)
+{
+    AURORA_IRQL OldIrql;
+
+    if (!Watcher) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    AuroraAcquireSpinLock(&g_NotifyLock, &OldIrql);
+    HiveWatchUnhash(Watcher);
+    if (Watcher->State == HiveWatchHeld) {
+        HiveWatchDequeue(&g_HeldList, NULL, Watcher);
+    } else if (Watcher->State == HiveWatchSignaled && Watcher->Port) {
+        HiveWatchDequeue(&Watcher->Port->Head, &Watcher->Port->Tail, Watcher);
+        Watcher->Port->Count--;
+    }
+    Watcher->State = HiveWatchIdle;
+    if (Watcher->Window) {
+        g_WindowedWatchers--;
+    }
+    AuroraReleaseSpinLock(&g_NotifyLock, OldIrql);
+
+    AuroraFreeMemory(Watcher);
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Read the notification of a watcher that signals an event. Returns
+ * STATUS_NO_MORE_ENTRIES if none has been delivered.
+ */
+NTSTATUS HiveReadNotification(IN PHIVE_WATCHER Watcher, OUT PHIVE_NOTIFICATION Notification)
+{
+    AURORA_IRQL OldIrql;
+    NTSTATUS Status = STATUS_NO_MORE_ENTRIES;
+
+    if (!Watcher || !Notification || Watcher->Port) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    HiveNotifyTick();
+
+    AuroraAcquireSpinLock(&g_NotifyLock, &OldIrql);
+    if (Watcher->State == HiveWatchSignaled) {
+        HiveWatchConsume(Watcher, Notification);
+        Status = STATUS_SUCCESS;
+    }
+    AuroraReleaseSpinLock(&g_NotifyLock, OldIrql);
+
+    return Status;
+}
+
+/*
+ * Wait on an event for up to *RemainingMs, in slices while any watcher has
+ * a window, so a notification held after the wait began is delivered when
+ * its window ends. FALSE once the time is used up.
+ */
+static BOOLEAN HiveNotifyWaitSlice(IN PAURORA_EVENT Event, IN OUT PUINT32 RemainingMs)
+{
+    if (*RemainingMs == 0) {
+        return FALSE;
+    }
+
+    UINT32 Slice = *RemainingMs;
+    if ((g_HeldList || g_WindowedWatchers) && Slice > HIVE_NOTIFY_WAIT_SLICE) {
+        Slice = HIVE_NOTIFY_WAIT_SLICE;
+    }
+
+    NTSTATUS Status = AuroraWaitForSingleObject(Event, Slice);
+    if (Status == STATUS_TIMEOUT) {
+        *RemainingMs -= Slice;
+    } else if (!NT_SUCCESS(Status)) {
+        *RemainingMs = 0;
+    }
+    return TRUE;
+}
+
+/*
+ * Wait up to TimeoutMs for a watcher that signals an event
+ */
+NTSTATUS HiveWaitForNotification(IN PHIVE_WATCHER Watcher, IN UINT32 TimeoutMs, OUT PHIVE_NOTIFICATION Notification)
+{
+    if (!Watcher || !Notification || Watcher->Port || !Watcher->Event) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    do {
+        if (NT_SUCCESS(HiveReadNotification(Watcher, Notification))) {
+            return STATUS_SUCCESS;
+        }
+    } while (HiveNotifyWaitSlice(Watcher->Event, &TimeoutMs));
+
+    return STATUS_TIMEOUT;
+}
+
+/*
+ * Take the next notification queued on a port, waiting up to TimeoutMs
+ */
+NTSTATUS HiveRemoveNotification(IN PHIVE_NOTIFY_PORT Port, IN UINT32 TimeoutMs, OUT PHIVE_NOTIFICATION Notification)
+{
+    AURORA_IRQL OldIrql;
+
+    if (!Port || !Notification) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    do {
+        HiveNotifyTick();
+
+        AuroraAcquireSpinLock(&g_NotifyLock, &OldIrql);
+        PHIVE_WATCHER Watcher = Port->Head;
+        if (Watcher) {
+            Port->Head = Watcher->QueueNext;
+            if (!Port->Head) {
+                Port->Tail = NULL;
+            } else {
+                /* The event is auto-reset; leave it set for the next waiter */
+                AuroraSetEvent(&Port->Event);
+            }
+            Port->Count--;
+            HiveWatchConsume(Watcher, Notification);
+            AuroraReleaseSpinLock(&g_NotifyLock, OldIrql);
+            return STATUS_SUCCESS;
+        }
+        AuroraReleaseSpinLock(&g_NotifyLock, OldIrql);
+    } while (HiveNotifyWaitSlice(&Port->Event, &TimeoutMs));
+
+    return STATUS_TIMEOUT;
+}
+
+/*
+ * Match a change to a key against the hive's watchers. Called through
+ * HiveKeyChanged with the hive held exclusively.
+ */
+VOID HiveNotifyChange(IN PHIVE Hive, IN UINT32 KeyCell, IN UINT32 Flags)
+{
+    AURORA_IRQL OldIrql;
+    UINT64 Now = AuroraGetSystemTime();
+
+    AuroraAcquireSpinLock(&g_NotifyLock, &OldIrql);
+
+    PHIVE_WATCHER* Link = HiveWatchBucket(Hive, KeyCell);
+    while (*Link) {
+        PHIVE_WATCHER Watcher = *Link;
+        if (Watcher->Hive != Hive || Watcher->KeyCell != KeyCell) {
+            Link = &Watcher->HashNext;
+            continue;
+        }
+        HiveWatchFire(Watcher, KeyCell, Flags, Now);
+        if (Flags & HIVE_NOTIFY_KEY_DELETED) {
+            /* The cell may come back as another key */
+            HiveWatchUnhash(Watcher);
+        } else {
+            Link = &Watcher->HashNext;
+        }
+    }
+
+    /* A deleted key's parent reports the deletion to the watchers above */
+    if (Hive->Sync.SubtreeWatchers && !(Flags & HIVE_NOTIFY_KEY_DELETED)) {
+        UINT32 Cell = KeyCell;
+        for (UINT32 Depth = 0; Depth < HIVE_NOTIFY_MAX_DEPTH && Cell != Hive->RootKeyOffset; Depth++) {
+            PKEY_CELL Key = HiveGetKeyCell(Hive, Cell);
+            if (!Key || Key->Parent == 0) {
+                break;
+            }
+            Cell = Key->Parent;
+            for (PHIVE_WATCHER Watcher = *HiveWatchBucket(Hive, Cell); Watcher; Watcher = Watcher->HashNext) {
+                if (Watcher->Hive == Hive && Watcher->KeyCell == Cell && (Watcher->Filter & HIVE_NOTIFY_SUBTREE)) {
+                    HiveWatchFire(Watcher, KeyCell, 0, Now);
+                }
+            }
+        }
+    }
+
+    AuroraReleaseSpinLock(&g_NotifyLock, OldIrql);
+}
+
+/*
+ * Deliver held notifications whose window has passed
+ */
+VOID HiveNotifyTick(void)
+{
+    AURORA_IRQL OldIrql;
+
+    if (!g_HeldList) {
+        return;
+    }
+
+    UINT64 Now = AuroraGetSystemTime();
+
+    AuroraAcquireSpinLock(&g_NotifyLock, &OldIrql);
+    PHIVE_WATCHER* Link = &g_HeldList;
+    while (*Link) {
+        PHIVE_WATCHER Watcher = *Link;
+        if (Now - Watcher->LastDelivery >= Watcher->Window) {
+            *Link = Watcher->QueueNext;
+            HiveWatchDeliver(Watcher, Now);
+        } else {
+            Link = &Watcher->QueueNext;
+        }
+    }
+    AuroraReleaseSpinLock(&g_NotifyLock, OldIrql);
+}
+
+/*
+ * Detach the watchers of a hive being closed. Each gets a last
+ * notification flagged as a deletion; the watchers stay valid until
+ * cancelled.
+ */
+VOID HiveNotifyRelease(IN PHIVE Hive)
+{
+    AURORA_IRQL OldIrql;
+
+    if (!Hive || !Hive->Sync.Watchers) {
+        return;
+    }
+
+    UINT64 Now = AuroraGetSystemTime();
+
+    AuroraAcquireSpinLock(&g_NotifyLock, &OldIrql);
+    for (UINT32 i = 0; i < HIVE_NOTIFY_BUCKETS; i++) {
+        PHIVE_WATCHER* Link = &g_WatchBuckets[i];
+        while (*Link) {
+            PHIVE_WATCHER Watcher = *Link;
+            if (Watcher->Hive != Hive) {
+                Link = &Watcher->HashNext;
+                continue;
+            }
+            *Link = Watcher->HashNext;
+            Watcher->Hashed = FALSE;
+            Watcher->LastDelivery = 0;
+            HiveWatchFire(Watcher, Watcher->KeyCell, HIVE_NOTIFY_KEY_DELETED, Now);
+        }
+    }
+    Hive->Sync.Watchers = 0;
+    Hive->Sync.SubtreeWatchers = 0;
+    AuroraReleaseSpinLock(&g_NotifyLock, OldIrql);
+}
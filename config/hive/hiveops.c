@@ -1,84 +1,873 @@
 /*
- * Aurora Kernel - Registry Hive Operations (stubs)
+ * Aurora Kernel - Registry Hive Key and Value Operations
+ * Copyright (c) 2024 NTCore Project
  */
 
 #include "hive.h"
 
-NTSTATUS HiveCreateKey(IN PHIVE Hive, IN PCSTR KeyPath, OUT PUINT32 KeyCell)
+#define HIVE_INDEX_LEAF_INITIAL     4
+#define HIVE_INDEX_ROOT_INITIAL     4
+#define HIVE_VALUE_LIST_INITIAL     4
+
+/* Bytes in front of the entry arrays of index cells */
+#define HIVE_LEAF_HEADER    (sizeof(HASH_LEAF_CELL) - sizeof(HIVE_INDEX_ENTRY))
+#define HIVE_ROOT_HEADER    (sizeof(INDEX_ROOT_CELL) - sizeof(UINT32))
+
+/*
+ * Cell header in front of the data HiveGetCell returns
+ */
+static PCELL_HEADER HiveCellHeader(IN PHIVE Hive, IN UINT32 CellOffset)
+{
+    HiveFaultCell(Hive, CellOffset);
+    return (PCELL_HEADER)((UINT8*)Hive->BaseAddress + CellOffset);
+}
+
+/*
+ * Get an index cell, checking it is the expected kind
+ */
+static PVOID HiveGetIndexCell(IN PHIVE Hive, IN UINT32 CellOffset, IN UINT16 Signature)
+{
+    if (!HiveValidateCell(Hive, CellOffset) || HiveCellHeader(Hive, CellOffset)->Signature != Signature) {
+        return NULL;
+    }
+
+    return HiveGetCell(Hive, CellOffset);
+}
+
+static CHAR HiveUpcase(IN CHAR c)
+{
+    return (c >= 'a' && c <= 'z') ? (CHAR)(c - 'a' + 'A') : c;
+}
+
+/*
+ * Hash a key name for 'lh' leaves; case-insensitive like name compares
+ */
+UINT32 HiveHashName(IN PCSTR Name, IN UINT32 Length)
+{
+    UINT32 Hash = 0;
+
+    for (UINT32 i = 0; i < Length; i++) {
+        Hash = Hash * 37 + (UINT8)HiveUpcase(Name[i]);
+    }
+
+    return Hash;
+}
+
+/*
+ * Case-insensitive order of two names
+ */
+static INT32 HiveCompareNames(IN PCSTR Name1, IN UINT32 Length1, IN PCSTR Name2, IN UINT32 Length2)
+{
+    UINT32 Length = Length1 < Length2 ? Length1 : Length2;
+
+    for (UINT32 i = 0; i < Length; i++) {
+        CHAR c1 = HiveUpcase(Name1[i]);
+        CHAR c2 = HiveUpcase(Name2[i]);
+        if (c1 != c2) {
+            return (INT32)(UINT8)c1 - (INT32)(UINT8)c2;
+        }
+    }
+
+    return (INT32)Length1 - (INT32)Length2;
+}
+
+/*
+ * Order of (Hash, Name) against an index entry. The key cell is only
+ * touched when the hashes are equal.
+ */
+static INT32 HiveCompareEntry(IN PHIVE Hive, IN UINT32 Hash, IN PCSTR Name, IN UINT32 Length, IN PHIVE_INDEX_ENTRY Entry)
 {
-    UNREFERENCED_PARAMETER(Hive);
-    if (!KeyPath || !KeyCell) return STATUS_INVALID_PARAMETER;
-    /* Stub: pretend key created/found */
-    *KeyCell = 1;
+    if (Hash != Entry->Hash) {
+        return Hash < Entry->Hash ? -1 : 1;
+    }
+
+    PKEY_CELL Key = HiveGetKeyCell(Hive, Entry->Cell);
+    if (!Key) {
+        return -1;
+    }
+
+    return HiveCompareNames(Name, Length, Key->Name, Key->NameLength);
+}
+
+/* ---------------------------------------------------------------------------
+ * Subkey index
+ * --------------------------------------------------------------------------- */
+
+/*
+ * First position in a leaf not ordered before (Hash, Name)
+ */
+static UINT32 HiveLeafSearch(IN PHIVE Hive, IN PHASH_LEAF_CELL Leaf, IN UINT32 Hash, IN PCSTR Name, IN UINT32 Length, OUT PBOOLEAN Found)
+{
+    UINT32 Low = 0;
+    UINT32 High = Leaf->Count;
+
+    while (Low < High) {
+        UINT32 Middle = Low + (High - Low) / 2;
+        if (HiveCompareEntry(Hive, Hash, Name, Length, &Leaf->Entries[Middle]) > 0) {
+            Low = Middle + 1;
+        } else {
+            High = Middle;
+        }
+    }
+
+    *Found = Low < Leaf->Count && HiveCompareEntry(Hive, Hash, Name, Length, &Leaf->Entries[Low]) == 0;
+    return Low;
+}
+
+/*
+ * Slot of the leaf that (Hash, Name) belongs in: the first leaf whose last
+ * entry is not ordered before it, else the last leaf. Leaves are never empty.
+ */
+static UINT32 HiveRootSearch(IN PHIVE Hive, IN PINDEX_ROOT_CELL Root, IN UINT32 Hash, IN PCSTR Name, IN UINT32 Length)
+{
+    UINT32 Low = 0;
+    UINT32 High = Root->Count - 1;
+
+    while (Low < High) {
+        UINT32 Middle = Low + (High - Low) / 2;
+        PHASH_LEAF_CELL Leaf = (PHASH_LEAF_CELL)HiveGetIndexCell(Hive, Root->Leaves[Middle], CellTypeHashLeaf);
+        if (Leaf && Leaf->Count &&
+            HiveCompareEntry(Hive, Hash, Name, Length, &Leaf->Entries[Leaf->Count - 1]) > 0) {
+            Low = Middle + 1;
+        } else {
+            High = Middle;
+        }
+    }
+
+    return Low;
+}
+
+/*
+ * Leaf of Parent's index that (Hash, Name) belongs in. RootOffset and Slot
+ * locate it in a root index; RootOffset is 0 when the leaf is the index.
+ */
+static PHASH_LEAF_CELL HiveFindLeaf(IN PHIVE Hive, IN PKEY_CELL Parent, IN UINT32 Hash, IN PCSTR Name, IN UINT32 Length,
+                                    OUT PUINT32 LeafOffset, OUT PUINT32 RootOffset, OUT PUINT32 Slot)
+{
+    UINT32 Offset = Parent->SubKeysList;
+
+    *RootOffset = 0;
+    *Slot = 0;
+    if (!Offset) {
+        return NULL;
+    }
+
+    if (HiveValidateCell(Hive, Offset) && HiveCellHeader(Hive, Offset)->Signature == CellTypeIndexRoot) {
+        PINDEX_ROOT_CELL Root = (PINDEX_ROOT_CELL)HiveGetCell(Hive, Offset);
+        if (!Root->Count) {
+            return NULL;
+        }
+        *RootOffset = Offset;
+        *Slot = HiveRootSearch(Hive, Root, Hash, Name, Length);
+        Offset = Root->Leaves[*Slot];
+    }
+
+    *LeafOffset = Offset;
+    return (PHASH_LEAF_CELL)HiveGetIndexCell(Hive, Offset, CellTypeHashLeaf);
+}
+
+/*
+ * Find the subkey Name of Parent; 0 if there is none
+ */
+static UINT32 HiveLookupSubkey(IN PHIVE Hive, IN PKEY_CELL Parent, IN PCSTR Name, IN UINT32 Length)
+{
+    UINT32 Hash = HiveHashName(Name, Length);
+    UINT32 LeafOffset, RootOffset, Slot;
+    BOOLEAN Found;
+
+    PHASH_LEAF_CELL Leaf = HiveFindLeaf(Hive, Parent, Hash, Name, Length, &LeafOffset, &RootOffset, &Slot);
+    if (!Leaf) {
+        return 0;
+    }
+
+    UINT32 Index = HiveLeafSearch(Hive, Leaf, Hash, Name, Length, &Found);
+    return Found ? Leaf->Entries[Index].Cell : 0;
+}
+
+/*
+ * Allocate an empty index cell with room for Entries entries
+ */
+static UINT32 HiveAllocateIndexCell(IN PHIVE Hive, IN UINT16 Signature, IN UINT32 Entries)
+{
+    SIZE_T Size = Signature == CellTypeHashLeaf ? HIVE_LEAF_HEADER + Entries * sizeof(HIVE_INDEX_ENTRY)
+                                                : HIVE_ROOT_HEADER + Entries * sizeof(UINT32);
+    UINT32 CellOffset = HiveAllocateCell(Hive, Size);
+    if (CellOffset == 0) {
+        return 0;
+    }
+
+    PCELL_HEADER Header = HiveCellHeader(Hive, CellOffset);
+    Header->Signature = Signature;
+    Header->Flags = 0;
+    memset(HiveGetCell(Hive, CellOffset), 0, Size);
+    HiveMarkCellDirty(Hive, CellOffset);
+    return CellOffset;
+}
+
+/*
+ * Make room for one more entry in the index cell at *CellOffset, moving it
+ * to a cell twice the size when it is full. Capacity comes from the cell size.
+ */
+static PVOID HiveGrowIndexCell(IN PHIVE Hive, IN OUT PUINT32 CellOffset, IN UINT32 Count, IN UINT32 Maximum)
+{
+    BOOLEAN Leaf = HiveCellHeader(Hive, *CellOffset)->Signature == CellTypeHashLeaf;
+    SIZE_T HeaderSize = Leaf ? HIVE_LEAF_HEADER : HIVE_ROOT_HEADER;
+    SIZE_T EntrySize = Leaf ? sizeof(HIVE_INDEX_ENTRY) : sizeof(UINT32);
+    UINT32 Capacity = (UINT32)((HiveGetCellSize(Hive, *CellOffset) - HeaderSize) / EntrySize);
+
+    if (Count < Capacity) {
+        return HiveGetCell(Hive, *CellOffset);
+    }
+    if (Count >= Maximum) {
+        return NULL;
+    }
+
+    Capacity = Capacity * 2 < Maximum ? Capacity * 2 : Maximum;
+    UINT32 NewOffset = HiveResizeCell(Hive, *CellOffset, HeaderSize + Capacity * EntrySize);
+    if (NewOffset == 0) {
+        return NULL;
+    }
+
+    *CellOffset = NewOffset;
+    return HiveGetCell(Hive, NewOffset);
+}
+
+/*
+ * Split the full leaf in Slot of the root index at *RootOffset; its upper
+ * half moves to a new leaf in the next slot
+ */
+static NTSTATUS HiveSplitLeaf(IN PHIVE Hive, IN OUT PUINT32 RootOffset, IN UINT32 Slot)
+{
+    PINDEX_ROOT_CELL Root = (PINDEX_ROOT_CELL)HiveGetCell(Hive, *RootOffset);
+
+    Root = (PINDEX_ROOT_CELL)HiveGrowIndexCell(Hive, RootOffset, Root->Count, HIVE_INDEX_ROOT_MAX);
+    if (!Root) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    UINT32 NewOffset = HiveAllocateIndexCell(Hive, CellTypeHashLeaf, HIVE_INDEX_LEAF_MAX);
+    if (NewOffset == 0) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    PHASH_LEAF_CELL Leaf = (PHASH_LEAF_CELL)HiveGetCell(Hive, Root->Leaves[Slot]);
+    PHASH_LEAF_CELL NewLeaf = (PHASH_LEAF_CELL)HiveGetCell(Hive, NewOffset);
+    UINT32 Keep = Leaf->Count / 2;
+
+    NewLeaf->Count = (UINT16)(Leaf->Count - Keep);
+    memcpy(NewLeaf->Entries, &Leaf->Entries[Keep], NewLeaf->Count * sizeof(HIVE_INDEX_ENTRY));
+    Leaf->Count = (UINT16)Keep;
+    HiveMarkDirtyRange(Hive, NewLeaf, HIVE_LEAF_HEADER + NewLeaf->Count * sizeof(HIVE_INDEX_ENTRY));
+    HiveMarkDirtyRange(Hive, Leaf, HIVE_LEAF_HEADER);
+
+    memmove(&Root->Leaves[Slot + 2], &Root->Leaves[Slot + 1], (Root->Count - Slot - 1) * sizeof(UINT32));
+    Root->Leaves[Slot + 1] = NewOffset;
+    Root->Count++;
+    HiveMarkDirtyRange(Hive, Root, HIVE_ROOT_HEADER);
+    HiveMarkDirtyRange(Hive, &Root->Leaves[Slot + 1], (Root->Count - Slot - 1) * sizeof(UINT32));
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Add Child, named Name, to Parent's subkey index
+ */
+static NTSTATUS HiveIndexInsert(IN PHIVE Hive, IN PKEY_CELL Parent, IN UINT32 Child, IN PCSTR Name, IN UINT32 Length)
+{
+    UINT32 Hash = HiveHashName(Name, Length);
+    UINT32 LeafOffset, RootOffset, Slot;
+    PUINT32 LeafReference;
+    BOOLEAN Found;
+    NTSTATUS Status;
+
+    if (!Parent->SubKeysList) {
+        Parent->SubKeysList = HiveAllocateIndexCell(Hive, CellTypeHashLeaf, HIVE_INDEX_LEAF_INITIAL);
+        if (!Parent->SubKeysList) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        HiveMarkDirtyRange(Hive, Parent, sizeof(KEY_CELL));
+    }
+
+    PHASH_LEAF_CELL Leaf = HiveFindLeaf(Hive, Parent, Hash, Name, Length, &LeafOffset, &RootOffset, &Slot);
+    if (!Leaf) {
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    if (Leaf->Count >= HIVE_INDEX_LEAF_MAX) {
+        /* A full leaf on its own becomes the first leaf of a root index */
+        if (!RootOffset) {
+            RootOffset = HiveAllocateIndexCell(Hive, CellTypeIndexRoot, HIVE_INDEX_ROOT_INITIAL);
+            if (!RootOffset) {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+            PINDEX_ROOT_CELL Root = (PINDEX_ROOT_CELL)HiveGetCell(Hive, RootOffset);
+            Root->Leaves[0] = LeafOffset;
+            Root->Count = 1;
+            HiveMarkDirtyRange(Hive, Root, HIVE_ROOT_HEADER + sizeof(UINT32));
+            Parent->SubKeysList = RootOffset;
+            HiveMarkDirtyRange(Hive, Parent, sizeof(KEY_CELL));
+        }
+
+        Status = HiveSplitLeaf(Hive, &Parent->SubKeysList, Slot);
+        if (!NT_SUCCESS(Status)) {
+            return Status;
+        }
+
+        /* Entries past the lower half's last one go to the new leaf */
+        PINDEX_ROOT_CELL Root = (PINDEX_ROOT_CELL)HiveGetCell(Hive, Parent->SubKeysList);
+        Leaf = (PHASH_LEAF_CELL)HiveGetCell(Hive, Root->Leaves[Slot]);
+        if (HiveCompareEntry(Hive, Hash, Name, Length, &Leaf->Entries[Leaf->Count - 1]) > 0) {
+            Slot++;
+        }
+        RootOffset = Parent->SubKeysList;
+        HiveMarkDirtyRange(Hive, Parent, sizeof(KEY_CELL));
+    }
+
+    if (RootOffset) {
+        LeafReference = &((PINDEX_ROOT_CELL)HiveGetCell(Hive, RootOffset))->Leaves[Slot];
+    } else {
+        LeafReference = &Parent->SubKeysList;
+    }
+
+    Leaf = (PHASH_LEAF_CELL)HiveGetCell(Hive, *LeafReference);
+    UINT32 Index = HiveLeafSearch(Hive, Leaf, Hash, Name, Length, &Found);
+    if (Found) {
+        return STATUS_KEY_ALREADY_EXISTS;
+    }
+
+    Leaf = (PHASH_LEAF_CELL)HiveGrowIndexCell(Hive, LeafReference, Leaf->Count, HIVE_INDEX_LEAF_MAX);
+    if (!Leaf) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    memmove(&Leaf->Entries[Index + 1], &Leaf->Entries[Index], (Leaf->Count - Index) * sizeof(HIVE_INDEX_ENTRY));
+    Leaf->Entries[Index].Cell = Child;
+    Leaf->Entries[Index].Hash = Hash;
+    Leaf->Count++;
+    HiveMarkDirtyRange(Hive, LeafReference, sizeof(UINT32));
+    HiveMarkDirtyRange(Hive, Leaf, HIVE_LEAF_HEADER);
+    HiveMarkDirtyRange(Hive, &Leaf->Entries[Index], (Leaf->Count - Index) * sizeof(HIVE_INDEX_ENTRY));
+
+    Parent->SubKeysCount++;
+    if (Length > Parent->MaxNameLen) {
+        Parent->MaxNameLen = Length;
+    }
+    HiveMarkDirtyRange(Hive, Parent, sizeof(KEY_CELL));
+
     return STATUS_SUCCESS;
 }
 
+/*
+ * Remove the subkey Name from Parent's index. Emptied leaves are freed, and
+ * a root index left with one leaf gives way to that leaf.
+ */
+static NTSTATUS HiveIndexRemove(IN PHIVE Hive, IN PKEY_CELL Parent, IN PCSTR Name, IN UINT32 Length)
+{
+    UINT32 Hash = HiveHashName(Name, Length);
+    UINT32 LeafOffset, RootOffset, Slot;
+    BOOLEAN Found;
+
+    PHASH_LEAF_CELL Leaf = HiveFindLeaf(Hive, Parent, Hash, Name, Length, &LeafOffset, &RootOffset, &Slot);
+    if (!Leaf) {
+        return STATUS_NOT_FOUND;
+    }
+
+    UINT32 Index = HiveLeafSearch(Hive, Leaf, Hash, Name, Length, &Found);
+    if (!Found) {
+        return STATUS_NOT_FOUND;
+    }
+
+    memmove(&Leaf->Entries[Index], &Leaf->Entries[Index + 1], (Leaf->Count - Index - 1) * sizeof(HIVE_INDEX_ENTRY));
+    Leaf->Count--;
+    HiveMarkDirtyRange(Hive, Leaf, HIVE_LEAF_HEADER);
+    HiveMarkDirtyRange(Hive, &Leaf->Entries[Index], (Leaf->Count - Index) * sizeof(HIVE_INDEX_ENTRY));
+    Parent->SubKeysCount--;
+    HiveMarkDirtyRange(Hive, Parent, sizeof(KEY_CELL));
+
+    if (!RootOffset) {
+        if (!Leaf->Count) {
+            HiveFreeCell(Hive, LeafOffset);
+            Parent->SubKeysList = 0;
+        }
+        return STATUS_SUCCESS;
+    }
+
+    PINDEX_ROOT_CELL Root = (PINDEX_ROOT_CELL)HiveGetCell(Hive, RootOffset);
+    if (!Leaf->Count) {
+        HiveFreeCell(Hive, LeafOffset);
+        memmove(&Root->Leaves[Slot], &Root->Leaves[Slot + 1], (Root->Count - Slot - 1) * sizeof(UINT32));
+        Root->Count--;
+        HiveMarkDirtyRange(Hive, Root, HIVE_ROOT_HEADER);
+        HiveMarkDirtyRange(Hive, &Root->Leaves[Slot], (Root->Count - Slot) * sizeof(UINT32));
+    }
+
+    if (Root->Count <= 1) {
+        Parent->SubKeysList = Root->Count ? Root->Leaves[0] : 0;
+        HiveFreeCell(Hive, RootOffset);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Subkey number Index of Parent in index order; 0 past the end
+ */
+static UINT32 HiveSubkeyAt(IN PHIVE Hive, IN PKEY_CELL Parent, IN UINT32 Index)
+{
+    UINT32 Offset = Parent->SubKeysList;
+
+    if (Index >= Parent->SubKeysCount || !HiveValidateCell(Hive, Offset)) {
+        return 0;
+    }
+
+    if (HiveCellHeader(Hive, Offset)->Signature == CellTypeIndexRoot) {
+        PINDEX_ROOT_CELL Root = (PINDEX_ROOT_CELL)HiveGetCell(Hive, Offset);
+        for (UINT32 i = 0; i < Root->Count; i++) {
+            PHASH_LEAF_CELL Leaf = (PHASH_LEAF_CELL)HiveGetIndexCell(Hive, Root->Leaves[i], CellTypeHashLeaf);
+            if (!Leaf) {
+                return 0;
+            }
+            if (Index < Leaf->Count) {
+                return Leaf->Entries[Index].Cell;
+            }
+            Index -= Leaf->Count;
+        }
+        return 0;
+    }
+
+    PHASH_LEAF_CELL Leaf = (PHASH_LEAF_CELL)HiveGetIndexCell(Hive, Offset, CellTypeHashLeaf);
+    return (Leaf && Index < Leaf->Count) ? Leaf->Entries[Index].Cell : 0;
+}
+
+/*
+ * Walk KeyPath down from the root key, one index lookup per component.
+ * With Create set, missing keys (the root key included) are created.
+ */
+static NTSTATUS HiveWalkPath(IN PHIVE Hive, IN PCSTR KeyPath, IN BOOLEAN Create, OUT PUINT32 KeyCell)
+{
+    UINT32 Current = Hive->RootKeyOffset;
+    NTSTATUS Status;
+
+    if (!Current) {
+        if (!Create) {
+            return STATUS_NOT_FOUND;
+        }
+        Current = HiveCreateKeyCell(Hive, "", 0);
+        if (!Current) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        Hive->RootKeyOffset = Current;
+        if (Hive->Header) {
+            Hive->Header->RootKeyOffset = Current;
+            Hive->Header->RootCell = Current;
+            HiveMarkDirtyRange(Hive, Hive->Header, sizeof(HIVE_HEADER) - sizeof(Hive->Header->Reserved));
+        }
+        HiveMarkDirty(Hive);
+    }
+
+    while (*KeyPath) {
+        if (*KeyPath == '\\') {
+            KeyPath++;
+            continue;
+        }
+
+        PCSTR End = KeyPath;
+        while (*End && *End != '\\') {
+            End++;
+        }
+
+        UINT32 Length = (UINT32)(End - KeyPath);
+        if (Length > HIVE_MAX_NAME_LENGTH) {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        PKEY_CELL Parent = HiveGetKeyCell(Hive, Current);
+        if (!Parent) {
+            return STATUS_INTERNAL_ERROR;
+        }
+
+        UINT32 Child = HiveLookupSubkey(Hive, Parent, KeyPath, Length);
+        if (!Child) {
+            CHAR Name[HIVE_MAX_NAME_LENGTH + 1];
+
+            if (!Create) {
+                return STATUS_NOT_FOUND;
+            }
+
+            memcpy(Name, KeyPath, Length);
+            Name[Length] = '\0';
+            Child = HiveCreateKeyCell(Hive, Name, Current);
+            if (!Child) {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+
+            Status = HiveIndexInsert(Hive, Parent, Child, KeyPath, Length);
+            if (!NT_SUCCESS(Status)) {
+                HiveFreeCell(Hive, Child);
+                return Status;
+            }
+            HiveKeyChanged(Hive, Current);
+            HiveMarkDirty(Hive);
+        }
+
+        Current = Child;
+        KeyPath = End;
+    }
+
+    *KeyCell = Current;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Copy a name out NUL-terminated; BufferSize becomes the bytes needed
+ */
+static NTSTATUS HiveCopyName(IN PCSTR Name, IN UINT32 Length, OUT PCHAR Buffer, IN OUT PUINT32 BufferSize)
+{
+    if (!Buffer || *BufferSize <= Length) {
+        *BufferSize = Length + 1;
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    memcpy(Buffer, Name, Length);
+    Buffer[Length] = '\0';
+    *BufferSize = Length + 1;
+    return STATUS_SUCCESS;
+}
+
+/* ---------------------------------------------------------------------------
+ * Keys
+ * --------------------------------------------------------------------------- */
+
+NTSTATUS HiveCreateKey(IN PHIVE Hive, IN PCSTR KeyPath, OUT PUINT32 KeyCell)
+{
+    NTSTATUS Status = HiveFindKey(Hive, KeyPath, KeyCell);
+    if (Status != STATUS_NOT_FOUND) {
+        return Status;
+    }
+
+    if (Hive->ReadOnly) {
+        return STATUS_ACCESS_DENIED;
+    }
+
+    Status = HiveWalkPath(Hive, KeyPath, TRUE, KeyCell);
+    if (NT_SUCCESS(Status)) {
+        HiveAddHint(Hive, HintTypeKeyAccess, *KeyCell, KeyPath);
+    }
+
+    return Status;
+}
+
+/*
+ * Resolve a key path, through the hint cache when the path was seen before
+ */
 NTSTATUS HiveFindKey(IN PHIVE Hive, IN PCSTR KeyPath, OUT PUINT32 KeyCell)
 {
-    UNREFERENCED_PARAMETER(Hive);
-    if (!KeyPath || !KeyCell) return STATUS_INVALID_PARAMETER;
-    return STATUS_NOT_FOUND;
+    if (!Hive || !Hive->BaseAddress || !KeyPath || !KeyCell) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    UINT32 Hinted = HiveLookupHint(Hive, KeyPath);
+    if (Hinted) {
+        *KeyCell = Hinted;
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS Status = HiveWalkPath(Hive, KeyPath, FALSE, KeyCell);
+    if (NT_SUCCESS(Status)) {
+        HiveAddHint(Hive, HintTypeKeyAccess, *KeyCell, KeyPath);
+    }
+
+    return Status;
 }
 
+/*
+ * Delete a key with no subkeys, along with its values
+ */
 NTSTATUS HiveDeleteKey(IN PHIVE Hive, IN PCSTR KeyPath)
 {
-    UNREFERENCED_PARAMETER(Hive);
-    UNREFERENCED_PARAMETER(KeyPath);
-    return STATUS_NOT_IMPLEMENTED;
+    UINT32 KeyCell;
+
+    if (!Hive || !Hive->BaseAddress || !KeyPath) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (Hive->ReadOnly) {
+        return STATUS_ACCESS_DENIED;
+    }
+
+    NTSTATUS Status = HiveFindKey(Hive, KeyPath, &KeyCell);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
+    PKEY_CELL Key = HiveGetKeyCell(Hive, KeyCell);
+    if (!Key) {
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    if (KeyCell == Hive->RootKeyOffset || Key->SubKeysCount) {
+        return STATUS_CANNOT_DELETE;
+    }
+
+    PKEY_CELL Parent = HiveGetKeyCell(Hive, Key->Parent);
+    if (!Parent) {
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    Status = HiveIndexRemove(Hive, Parent, Key->Name, Key->NameLength);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
+    if (Key->ValuesList) {
+        PUINT32 List = (PUINT32)HiveGetCell(Hive, Key->ValuesList);
+        for (UINT32 i = 0; List && i < Key->ValuesCount; i++) {
+            HiveDeleteCell(Hive, List[i]);
+        }
+        HiveFreeCell(Hive, Key->ValuesList);
+    }
+
+    HiveKeyDeleted(Hive, KeyCell);
+    HiveKeyChanged(Hive, Key->Parent);
+    HiveFreeCell(Hive, KeyCell);
+
+    /* Cached paths may lead to the freed cell or through it */
+    Hive->Generation++;
+    HiveMarkDirty(Hive);
+    return STATUS_SUCCESS;
 }
 
 NTSTATUS HiveEnumerateKeys(IN PHIVE Hive, IN UINT32 ParentKey, IN UINT32 Index, OUT PCHAR KeyName, IN OUT PUINT32 NameSize)
 {
-    UNREFERENCED_PARAMETER(Hive);
-    UNREFERENCED_PARAMETER(ParentKey);
-    UNREFERENCED_PARAMETER(Index);
-    UNREFERENCED_PARAMETER(KeyName);
-    UNREFERENCED_PARAMETER(NameSize);
-    return STATUS_NOT_IMPLEMENTED;
+    if (!Hive || !NameSize) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PKEY_CELL Parent = HiveGetKeyCell(Hive, ParentKey);
+    if (!Parent) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PKEY_CELL Key = HiveGetKeyCell(Hive, HiveSubkeyAt(Hive, Parent, Index));
+    if (!Key) {
+        return STATUS_NO_MORE_ENTRIES;
+    }
+
+    return HiveCopyName(Key->Name, Key->NameLength, KeyName, NameSize);
 }
 
+/* ---------------------------------------------------------------------------
+ * Values
+ * --------------------------------------------------------------------------- */
+
+/*
+ * Find the value ValueName of Key and its slot in the value list
+ */
+static PVALUE_CELL HiveLookupValue(IN PHIVE Hive, IN PKEY_CELL Key, IN PCSTR ValueName, OUT PUINT32 Index)
+{
+    UINT32 Length = (UINT32)strlen(ValueName);
+    PUINT32 List = Key->ValuesList ? (PUINT32)HiveGetCell(Hive, Key->ValuesList) : NULL;
+
+    for (UINT32 i = 0; List && i < Key->ValuesCount; i++) {
+        PVALUE_CELL Value = HiveGetValueCell(Hive, List[i]);
+        if (Value && HiveCompareNames(ValueName, Length, Value->Name, Value->NameLength) == 0) {
+            *Index = i;
+            return Value;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Value list of Key with room for one more entry
+ */
+static PUINT32 HiveGrowValueList(IN PHIVE Hive, IN PKEY_CELL Key)
+{
+    if (!Key->ValuesList) {
+        Key->ValuesList = HiveAllocateCell(Hive, HIVE_VALUE_LIST_INITIAL * sizeof(UINT32));
+        if (!Key->ValuesList) {
+            return NULL;
+        }
+    }
+
+    UINT32 Capacity = (UINT32)(HiveGetCellSize(Hive, Key->ValuesList) / sizeof(UINT32));
+    if (Key->ValuesCount >= Capacity) {
+        UINT32 NewList = HiveResizeCell(Hive, Key->ValuesList, Capacity * 2 * sizeof(UINT32));
+        if (!NewList) {
+            return NULL;
+        }
+        Key->ValuesList = NewList;
+    }
+
+    return (PUINT32)HiveGetCell(Hive, Key->ValuesList);
+}
+
+/*
+ * Set a value, replacing one of the same name
+ */
 NTSTATUS HiveSetValue(IN PHIVE Hive, IN UINT32 KeyCell, IN PCSTR ValueName, IN UINT32 Type, IN PVOID Data, IN UINT32 DataSize)
 {
-    UNREFERENCED_PARAMETER(Hive);
-    UNREFERENCED_PARAMETER(KeyCell);
-    UNREFERENCED_PARAMETER(ValueName);
-    UNREFERENCED_PARAMETER(Type);
-    UNREFERENCED_PARAMETER(Data);
-    UNREFERENCED_PARAMETER(DataSize);
-    return STATUS_NOT_IMPLEMENTED;
+    UINT32 Index;
+
+    if (!Hive || !ValueName || (!Data && DataSize) || DataSize > HIVE_MAX_VALUE_SIZE) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    UINT32 NameLength = (UINT32)strlen(ValueName);
+    if (NameLength > HIVE_MAX_NAME_LENGTH) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (Hive->ReadOnly) {
+        return STATUS_ACCESS_DENIED;
+    }
+
+    PKEY_CELL Key = HiveGetKeyCell(Hive, KeyCell);
+    if (!Key) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    /* Data of 4 bytes or less is stored inline in the value cell */
+    UINT32 ValueCell = HiveCreateValueCell(Hive, ValueName, Type, Data, DataSize);
+    if (!ValueCell) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (HiveLookupValue(Hive, Key, ValueName, &Index)) {
+        PUINT32 List = (PUINT32)HiveGetCell(Hive, Key->ValuesList);
+        HiveDeleteCell(Hive, List[Index]);
+        List[Index] = ValueCell;
+        HiveMarkDirtyRange(Hive, &List[Index], sizeof(UINT32));
+    } else {
+        PUINT32 List = HiveGrowValueList(Hive, Key);
+        if (!List) {
+            HiveDeleteCell(Hive, ValueCell);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        List[Key->ValuesCount++] = ValueCell;
+        HiveMarkDirtyRange(Hive, &List[Key->ValuesCount - 1], sizeof(UINT32));
+    }
+
+    if (NameLength > Key->MaxValueNameLen) {
+        Key->MaxValueNameLen = NameLength;
+    }
+    if (DataSize > Key->MaxValueDataLen) {
+        Key->MaxValueDataLen = DataSize;
+    }
+    HiveMarkDirtyRange(Hive, Key, sizeof(KEY_CELL));
+    HiveKeyChanged(Hive, KeyCell);
+
+    HiveMarkDirty(Hive);
+    return STATUS_SUCCESS;
 }
 
+/*
+ * Read a value. DataSize is the buffer size on input and the data size on
+ * output; a NULL Data just asks for the size.
+ */
 NTSTATUS HiveGetValue(IN PHIVE Hive, IN UINT32 KeyCell, IN PCSTR ValueName, OUT PUINT32 Type, OUT PVOID Data, IN OUT PUINT32 DataSize)
 {
-    UNREFERENCED_PARAMETER(Hive);
-    UNREFERENCED_PARAMETER(KeyCell);
-    UNREFERENCED_PARAMETER(ValueName);
-    UNREFERENCED_PARAMETER(Type);
-    UNREFERENCED_PARAMETER(Data);
-    UNREFERENCED_PARAMETER(DataSize);
-    return STATUS_NOT_FOUND;
+    UINT32 Index;
+
+    if (!Hive || !ValueName || !DataSize) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PKEY_CELL Key = HiveGetKeyCell(Hive, KeyCell);
+    if (!Key) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    PVALUE_CELL Value = HiveLookupValue(Hive, Key, ValueName, &Index);
+    if (!Value) {
+        return STATUS_NOT_FOUND;
+    }
+
+    if (Type) {
+        *Type = Value->Type;
+    }
+
+    UINT32 Length = Value->DataLength;
+    if (!Data) {
+        *DataSize = Length;
+        return STATUS_SUCCESS;
+    }
+    if (*DataSize < Length) {
+        *DataSize = Length;
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    if (Length <= 4) {
+        memcpy(Data, &Value->DataOffset, Length);
+    } else {
+        PVOID Cell = HiveGetCell(Hive, Value->DataOffset);
+        if (!Cell) {
+            return STATUS_INTERNAL_ERROR;
+        }
+        memcpy(Data, Cell, Length);
+    }
+
+    *DataSize = Length;
+    return STATUS_SUCCESS;
 }
 
 NTSTATUS HiveDeleteValue(IN PHIVE Hive, IN UINT32 KeyCell, IN PCSTR ValueName)
 {
-    UNREFERENCED_PARAMETER(Hive);
-    UNREFERENCED_PARAMETER(KeyCell);
-    UNREFERENCED_PARAMETER(ValueName);
-    return STATUS_NOT_IMPLEMENTED;
+    UINT32 Index;
+
+    if (!Hive || !ValueName) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (Hive->ReadOnly) {
+        return STATUS_ACCESS_DENIED;
+    }
+
+    PKEY_CELL Key = HiveGetKeyCell(Hive, KeyCell);
+    if (!Key) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (!HiveLookupValue(Hive, Key, ValueName, &Index)) {
+        return STATUS_NOT_FOUND;
+    }
+
+    PUINT32 List = (PUINT32)HiveGetCell(Hive, Key->ValuesList);
+    HiveDeleteCell(Hive, List[Index]);
+    memmove(&List[Index], &List[Index + 1], (Key->ValuesCount - Index - 1) * sizeof(UINT32));
+    if (--Key->ValuesCount == 0) {
+        HiveFreeCell(Hive, Key->ValuesList);
+        Key->ValuesList = 0;
+    } else {
+        HiveMarkDirtyRange(Hive, &List[Index], (Key->ValuesCount - Index) * sizeof(UINT32));
+    }
+    HiveMarkDirtyRange(Hive, Key, sizeof(KEY_CELL));
+    HiveKeyChanged(Hive, KeyCell);
+
+    HiveMarkDirty(Hive);
+    return STATUS_SUCCESS;
 }
 
 NTSTATUS HiveEnumerateValues(IN PHIVE Hive, IN UINT32 KeyCell, IN UINT32 Index, OUT PCHAR ValueName, IN OUT PUINT32 NameSize)
 {
-    UNREFERENCED_PARAMETER(Hive);
-    UNREFERENCED_PARAMETER(KeyCell);
-    UNREFERENCED_PARAMETER(Index);
-    UNREFERENCED_PARAMETER(ValueName);
-    UNREFERENCED_PARAMETER(NameSize);
-    return STATUS_NOT_IMPLEMENTED;
-}
+    if (!Hive || !NameSize) {
+        return STATUS_INVALID_PARAMETER;
+    }
 
-NTSTATUS HiveCompact(IN PHIVE Hive)
-{
-    UNREFERENCED_PARAMETER(Hive);
-    return STATUS_SUCCESS;
+    PKEY_CELL Key = HiveGetKeyCell(Hive, KeyCell);
+    if (!Key) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (Index >= Key->ValuesCount || !Key->ValuesList) {
+        return STATUS_NO_MORE_ENTRIES;
+    }
+
+    PUINT32 List = (PUINT32)HiveGetCell(Hive, Key->ValuesList);
+    PVALUE_CELL Value = List ? HiveGetValueCell(Hive, List[Index]) : NULL;
+    if (!Value) {
+        return STATUS_INTERNAL_ERROR;
+    }
+
+    return HiveCopyName(Value->Name, Value->NameLength, ValueName, NameSize);
 }
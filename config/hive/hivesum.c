@@ -19,13 +19,10 @@ typedef enum _CHECKSUM_ALGORITHM {
     ChecksumAlgorithmXOR = 1,
     ChecksumAlgorithmCRC32 = 2,
     ChecksumAlgorithmMD5 = 3,
-    ChecksumAlgorithmSHA1 = 4
+    ChecksumAlgorithmSHA1 = 4,
+    ChecksumAlgorithmCRC32C = 5
 } CHECKSUM_ALGORITHM;
 
-/* CRC32 lookup table */
-static UINT32 g_Crc32Table[256];
-static BOOLEAN g_Crc32TableInitialized = FALSE;
-
 /* Checksum context structure */
 typedef struct _CHECKSUM_CONTEXT {
     CHECKSUM_ALGORITHM Algorithm;
@@ -35,31 +32,19 @@ typedef struct _CHECKSUM_CONTEXT {
 } CHECKSUM_CONTEXT, *PCHECKSUM_CONTEXT;
 
 /*
- * Initialize CRC32 lookup table
+ * Build the shared CRC tables ahead of the first checksum
  */
 VOID HiveInitializeCrc32Table(void)
 {
-    if (g_Crc32TableInitialized) {
-        return;
-    }
+    AuroraCrc32Initialize();
+}
 
-    UINT32 Polynomial = 0xEDB88320; /* IEEE 802.3 polynomial */
-    
-    for (UINT32 i = 0; i < 256; i++) {
-        UINT32 Crc = i;
-        
-        for (UINT32 j = 0; j < 8; j++) {
-            if (Crc & 1) {
-                Crc = (Crc >> 1) ^ Polynomial;
-            } else {
-                Crc >>= 1;
-            }
-        }
-        
-        g_Crc32Table[i] = Crc;
-    }
-    
-    g_Crc32TableInitialized = TRUE;
+/*
+ * Map a CRC checksum algorithm to its polynomial
+ */
+static AURORA_CRC HiveCrcKind(IN CHECKSUM_ALGORITHM Algorithm)
+{
+    return Algorithm == ChecksumAlgorithmCRC32C ? AuroraCrcCastagnoli : AuroraCrcIeee;
 }
 
 /*
@@ -103,24 +88,15 @@ UINT32 HiveCalculateXorChecksum(IN PVOID Data, IN UINT32 Size)
  */
 UINT32 HiveCalculateCrc32Checksum(IN PVOID Data, IN UINT32 Size)
 {
-    if (!Data || Size == 0) {
-        return 0;
-    }
+    return AuroraCrc32(AuroraCrcIeee, 0, Data, Size);
+}
 
-    /* Initialize CRC32 table if needed */
-    if (!g_Crc32TableInitialized) {
-        HiveInitializeCrc32Table();
-    }
-    
-    UINT32 Crc = 0xFFFFFFFF;
-    PUINT8 ByteData = (PUINT8)Data;
-    
-    for (UINT32 i = 0; i < Size; i++) {
-        UINT8 TableIndex = (Crc ^ ByteData[i]) & 0xFF;
-        Crc = (Crc >> 8) ^ g_Crc32Table[TableIndex];
-    }
-    
-    return ~Crc;
+/*
+ * Calculate CRC32C checksum, in hardware where the CPU has it
+ */
+UINT32 HiveCalculateCrc32cChecksum(IN PVOID Data, IN UINT32 Size)
+{
+    return AuroraCrc32(AuroraCrcCastagnoli, 0, Data, Size);
 }
 
 /*
@@ -160,6 +136,124 @@ BOOLEAN HiveVerifyChecksum(IN PHIVE_HEADER Header)
     return (StoredChecksum == CalculatedChecksum);
 }
 
+/*
+ * Mark the cached CRCs of the bins covering a hive range as stale
+ */
+VOID HiveChecksumInvalidate(IN PHIVE Hive, IN SIZE_T Offset, IN SIZE_T Length)
+{
+    PHIVE_CHECKSUM_CACHE Cache = Hive ? Hive->Checksums : NULL;
+    if (!Cache || Length == 0 || Offset >= Cache->Size) {
+        return;
+    }
+
+    UINT32 First = (UINT32)(Offset >> HIVE_BIN_SHIFT);
+    UINT32 Last = (UINT32)((Offset + Length - 1) >> HIVE_BIN_SHIFT);
+    if (Last >= Cache->BinCount) {
+        Last = Cache->BinCount - 1;
+    }
+    for (UINT32 Bin = First; Bin <= Last; Bin++) {
+        Cache->Stale[Bin / 32] |= 1u << (Bin % 32);
+    }
+}
+
+/*
+ * Drop the per-bin checksum cache
+ */
+VOID HiveChecksumRelease(IN PHIVE Hive)
+{
+    if (!Hive || !Hive->Checksums) {
+        return;
+    }
+
+    AuroraFreeMemory(Hive->Checksums);
+    Hive->Checksums = NULL;
+}
+
+/*
+ * Size the per-bin cache to the hive, keeping the CRCs of bins that were
+ * complete before the hive grew
+ */
+static PHIVE_CHECKSUM_CACHE HiveChecksumCacheFor(IN PHIVE Hive, IN CHECKSUM_ALGORITHM Algorithm)
+{
+    PHIVE_CHECKSUM_CACHE Old = Hive->Checksums;
+    if (Old && Old->Algorithm == (UINT32)Algorithm && Old->Size == Hive->Size) {
+        return Old;
+    }
+
+    UINT32 BinCount = (UINT32)((Hive->Size + HIVE_BIN_SIZE - 1) >> HIVE_BIN_SHIFT);
+    UINT32 Words = (BinCount + 31) / 32;
+    SIZE_T Bytes = sizeof(HIVE_CHECKSUM_CACHE) + BinCount * sizeof(UINT32) + Words * sizeof(UINT32);
+
+    PHIVE_CHECKSUM_CACHE Cache = (PHIVE_CHECKSUM_CACHE)AuroraAllocateMemory(Bytes);
+    if (!Cache) {
+        return NULL;
+    }
+    memset(Cache, 0, Bytes);
+    Cache->Algorithm = Algorithm;
+    Cache->BinCount = BinCount;
+    Cache->Size = Hive->Size;
+    Cache->Stale = &Cache->BinChecksum[BinCount];
+    memset(Cache->Stale, 0xFF, Words * sizeof(UINT32));
+
+    if (Old && Old->Algorithm == (UINT32)Algorithm) {
+        UINT32 Whole = (UINT32)(Old->Size >> HIVE_BIN_SHIFT);
+        if (Whole > BinCount) {
+            Whole = BinCount;
+        }
+        for (UINT32 Bin = 0; Bin < Whole; Bin++) {
+            if (!(Old->Stale[Bin / 32] & (1u << (Bin % 32)))) {
+                Cache->BinChecksum[Bin] = Old->BinChecksum[Bin];
+                Cache->Stale[Bin / 32] &= ~(1u << (Bin % 32));
+            }
+        }
+    }
+
+    HiveChecksumRelease(Hive);
+    Hive->Checksums = Cache;
+    return Cache;
+}
+
+/*
+ * CRC the whole hive from per-bin CRCs, recomputing only bins written
+ * since the last call. The header bin is always recomputed because the
+ * header is rewritten on flush without going through the dirty ranges.
+ */
+static UINT32 HiveCalculateBinnedCrc(IN PHIVE Hive, IN CHECKSUM_ALGORITHM Algorithm)
+{
+    AURORA_CRC Kind = HiveCrcKind(Algorithm);
+
+    HiveAcquireLock(Hive);
+
+    PHIVE_CHECKSUM_CACHE Cache = HiveChecksumCacheFor(Hive, Algorithm);
+    if (!Cache) {
+        HiveReleaseLock(Hive);
+        return AuroraCrc32(Kind, 0, Hive->BaseAddress, Hive->Size);
+    }
+
+    Cache->Stale[0] |= 1;
+
+    UINT32 BinOperator = AuroraCrc32CombineOperator(Kind, HIVE_BIN_SIZE);
+    UINT32 Crc = 0;
+    for (UINT32 Bin = 0; Bin < Cache->BinCount; Bin++) {
+        SIZE_T Offset = (SIZE_T)Bin << HIVE_BIN_SHIFT;
+        SIZE_T Length = Hive->Size - Offset < HIVE_BIN_SIZE ? Hive->Size - Offset : HIVE_BIN_SIZE;
+
+        if (Cache->Stale[Bin / 32] & (1u << (Bin % 32))) {
+            Cache->BinChecksum[Bin] = AuroraCrc32(Kind, 0, (UINT8*)Hive->BaseAddress + Offset, Length);
+            Cache->Stale[Bin / 32] &= ~(1u << (Bin % 32));
+        }
+
+        if (Length == HIVE_BIN_SIZE) {
+            Crc = AuroraCrc32CombineWith(Kind, BinOperator, Crc, Cache->BinChecksum[Bin]);
+        } else {
+            Crc = AuroraCrc32Combine(Kind, Crc, Cache->BinChecksum[Bin], Length);
+        }
+    }
+
+    HiveReleaseLock(Hive);
+    return Crc;
+}
+
 /*
  * Calculate checksum for entire hive
  */
@@ -169,12 +263,17 @@ UINT32 HiveCalculateFullChecksum(IN PHIVE Hive, IN CHECKSUM_ALGORITHM Algorithm)
         return 0;
     }
 
+    if (!NT_SUCCESS(HiveFaultRange(Hive, 0, Hive->Size))) {
+        return 0;
+    }
+
     switch (Algorithm) {
         case ChecksumAlgorithmXOR:
             return HiveCalculateXorChecksum(Hive->BaseAddress, Hive->Size);
             
         case ChecksumAlgorithmCRC32:
-            return HiveCalculateCrc32Checksum(Hive->BaseAddress, Hive->Size);
+        case ChecksumAlgorithmCRC32C:
+            return HiveCalculateBinnedCrc(Hive, Algorithm);
             
         default:
             return 0;
@@ -195,6 +294,11 @@ NTSTATUS HiveCalculateIncrementalChecksum(IN PHIVE Hive, IN UINT32 StartOffset,
         return STATUS_INVALID_PARAMETER;
     }
     
+    NTSTATUS Status = HiveFaultRange(Hive, StartOffset, Size);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+    
     PVOID Data = (UINT8*)Hive->BaseAddress + StartOffset;
     
     switch (Algorithm) {
@@ -203,7 +307,8 @@ NTSTATUS HiveCalculateIncrementalChecksum(IN PHIVE Hive, IN UINT32 StartOffset,
             break;
             
         case ChecksumAlgorithmCRC32:
-            *Checksum = HiveCalculateCrc32Checksum(Data, Size);
+        case ChecksumAlgorithmCRC32C:
+            *Checksum = AuroraCrc32(HiveCrcKind(Algorithm), 0, Data, Size);
             break;
             
         default:
@@ -231,10 +336,8 @@ NTSTATUS HiveInitializeChecksumContext(OUT PCHECKSUM_CONTEXT Context, IN CHECKSU
             break;
             
         case ChecksumAlgorithmCRC32:
-            if (!g_Crc32TableInitialized) {
-                HiveInitializeCrc32Table();
-            }
-            Context->CurrentValue = 0xFFFFFFFF;
+        case ChecksumAlgorithmCRC32C:
+            Context->CurrentValue = 0;
             break;
             
         default:
@@ -254,8 +357,6 @@ NTSTATUS HiveUpdateChecksumContext(IN OUT PCHECKSUM_CONTEXT Context, IN PVOID Da
         return STATUS_INVALID_PARAMETER;
     }
 
-    PUINT8 ByteData = (PUINT8)Data;
-    
     switch (Context->Algorithm) {
         case ChecksumAlgorithmXOR:
             {
@@ -284,12 +385,8 @@ NTSTATUS HiveUpdateChecksumContext(IN OUT PCHECKSUM_CONTEXT Context, IN PVOID Da
             break;
             
         case ChecksumAlgorithmCRC32:
-            {
-                for (UINT32 i = 0; i < Size; i++) {
-                    UINT8 TableIndex = (Context->CurrentValue ^ ByteData[i]) & 0xFF;
-                    Context->CurrentValue = (Context->CurrentValue >> 8) ^ g_Crc32Table[TableIndex];
-                }
-            }
+        case ChecksumAlgorithmCRC32C:
+            Context->CurrentValue = AuroraCrc32(HiveCrcKind(Context->Algorithm), Context->CurrentValue, Data, Size);
             break;
             
         default:
@@ -315,7 +412,8 @@ NTSTATUS HiveFinalizeChecksumContext(IN PCHECKSUM_CONTEXT Context, OUT PUINT32 F
             break;
             
         case ChecksumAlgorithmCRC32:
-            *FinalChecksum = ~Context->CurrentValue;
+        case ChecksumAlgorithmCRC32C:
+            *FinalChecksum = Context->CurrentValue;
             break;
             
         default:
@@ -325,6 +423,48 @@ NTSTATUS HiveFinalizeChecksumContext(IN PCHECKSUM_CONTEXT Context, OUT PUINT32 F
     return STATUS_SUCCESS;
 }
 
+/*
+ * Append a context over the bytes that follow Context's, as if its data
+ * had been fed to Context directly
+ */
+NTSTATUS HiveCombineChecksumContext(IN OUT PCHECKSUM_CONTEXT Context, IN PCHECKSUM_CONTEXT Next)
+{
+    if (!Context || !Next || Context->Algorithm != Next->Algorithm) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    switch (Context->Algorithm) {
+        case ChecksumAlgorithmXOR:
+            {
+                /* Each whole dword in Next rotates the running value once more;
+                   a partial trailing dword in Context breaks the alignment */
+                if (Context->BytesProcessed % sizeof(UINT32)) {
+                    return STATUS_NOT_SUPPORTED;
+                }
+                UINT32 Shift = (Next->BytesProcessed / sizeof(UINT32)) % 32;
+                UINT32 Value = Context->CurrentValue;
+                if (Shift) {
+                    Value = (Value << Shift) | (Value >> (32 - Shift));
+                }
+                Context->CurrentValue = Value ^ Next->CurrentValue;
+            }
+            break;
+
+        case ChecksumAlgorithmCRC32:
+        case ChecksumAlgorithmCRC32C:
+            Context->CurrentValue = AuroraCrc32Combine(HiveCrcKind(Context->Algorithm),
+                                                       Context->CurrentValue, Next->CurrentValue,
+                                                       Next->BytesProcessed);
+            break;
+
+        default:
+            return STATUS_NOT_SUPPORTED;
+    }
+
+    Context->BytesProcessed += Next->BytesProcessed;
+    return STATUS_SUCCESS;
+}
+
 /*
  * Calculate checksum for hive cell
  */
@@ -440,6 +580,11 @@ NTSTATUS HiveVerifyIntegrityWithChecksums(IN PHIVE Hive, OUT PBOOLEAN IsValid)
         return STATUS_SUCCESS; /* Invalid but function succeeded */
     }
     
+    NTSTATUS Status = HiveFaultRange(Hive, 0, Hive->Size);
+    if (!NT_SUCCESS(Status)) {
+        return Status;
+    }
+
     /* Verify cell checksums */
     UINT32 Offset = sizeof(HIVE_HEADER);
     while (Offset < Hive->Size) {
@@ -526,6 +671,8 @@ PCSTR HiveGetChecksumAlgorithmName(IN CHECKSUM_ALGORITHM Algorithm)
             return "MD5";
         case ChecksumAlgorithmSHA1:
             return "SHA1";
+        case ChecksumAlgorithmCRC32C:
+            return "CRC32C";
         default:
             return "Unknown";
     }
@@ -572,6 +719,7 @@ BOOLEAN HiveIsValidChecksumAlgorithm(IN CHECKSUM_ALGORITHM Algorithm)
     switch (Algorithm) {
         case ChecksumAlgorithmXOR:
         case ChecksumAlgorithmCRC32:
+        case ChecksumAlgorithmCRC32C:
         case ChecksumAlgorithmMD5:
         case ChecksumAlgorithmSHA1:
             return TRUE;
@@ -588,6 +736,7 @@ UINT32 HiveGetChecksumSize(IN CHECKSUM_ALGORITHM Algorithm)
     switch (Algorithm) {
         case ChecksumAlgorithmXOR:
         case ChecksumAlgorithmCRC32:
+        case ChecksumAlgorithmCRC32C:
             return sizeof(UINT32);
         case ChecksumAlgorithmMD5:
             return 16; /* 128 bits */
@@ -1,9 +1,19 @@
 /*
  * Aurora Kernel - Registry Hive Synchronization
  * Copyright (c) 2024 NTCore Project
+ *
+ * Writers serialize on the hive's writer lock and bump its sequence count
+ * on entry and exit. Readers take no lock: they sample the sequence with
+ * HiveReadBegin, read, and start over if HiveReadRetry says a writer came
+ * in between. The hive image is never unmapped, so a racing reader sees
+ * stale cells but never freed memory. Readers also count themselves in a
+ * per-processor slot while inside a read section, and cells a writer frees
+ * while any reader is inside are held back until the slots drain, so a
+ * reader that followed an old offset still finds the old cell there.
  */
 
 #include "hive.h"
+#include "../../include/hal.h"
 
 /* Synchronization constants */
 #define HIVE_MAX_READERS 64
@@ -119,7 +129,49 @@ VOID HiveDestroyRWLock(IN PHIVE_RWLOCK RWLock)
 }
 
 /*
- * Acquire shared (read) lock
+ * Slot a reader on this processor counts itself in
+ */
+static PHIVE_READER_SLOT HiveReaderSlot(IN PHIVE Hive)
+{
+    return &Hive->Sync.Readers[HalGetCurrentProcessorNumber() % HIVE_READER_SLOTS];
+}
+
+/*
+ * Whether any reader is inside a read section. Only the sum is meaningful:
+ * a reader may leave on a different processor than it entered on.
+ */
+static BOOL HiveReadersActive(IN PHIVE Hive)
+{
+    INT32 Count = 0;
+    for (UINT32 i = 0; i < HIVE_READER_SLOTS; i++) {
+        Count += Hive->Sync.Readers[i].Count;
+    }
+    return Count != 0;
+}
+
+/*
+ * Hand cells held back for readers to the allocator; writer lock held
+ */
+static VOID HiveReclaimDeferredCells(IN PHIVE Hive)
+{
+    PHIVE_SYNC Sync = &Hive->Sync;
+    PUINT32 Deferred = Sync->Deferred;
+    UINT32 Count = Sync->DeferredCount;
+
+    /* A reader arriving meanwhile makes HiveFreeCell defer into a new array */
+    Sync->Deferred = NULL;
+    Sync->DeferredCount = 0;
+    Sync->DeferredCapacity = 0;
+
+    for (UINT32 i = 0; i < Count; i++) {
+        HiveFreeCell(Hive, Deferred[i]);
+    }
+    AuroraFreeMemory(Deferred);
+}
+
+/*
+ * Enter a read section. Never waits for writers; callers bracket their
+ * reads with HiveReadBegin/HiveReadRetry and redo them on a retry.
  */
 NTSTATUS HiveAcquireSharedLock(IN PHIVE Hive, IN UINT32 Timeout)
 {
@@ -127,50 +179,8 @@ NTSTATUS HiveAcquireSharedLock(IN PHIVE Hive, IN UINT32 Timeout)
         return STATUS_INVALID_PARAMETER;
     }
 
-    PHIVE_RWLOCK RWLock = (PHIVE_RWLOCK)&Hive->Lock;
-    UINT32 CurrentThread = 0; /* TODO: Get current thread ID */
-    
-    /* Check for recursive lock by same thread */
-    if (RWLock->OwnerThread == CurrentThread && RWLock->WriterCount > 0) {
-        RWLock->RecursionCount++;
-        return STATUS_SUCCESS;
-    }
-    
-    /* Try to acquire lock immediately */
-    if (RWLock->WriterCount == 0 && RWLock->WaitingWriters == 0) {
-        RWLock->ReaderCount++;
-        return STATUS_SUCCESS;
-    }
-    
-    /* Need to wait - add to wait queue */
-    PHIVE_LOCK_REQUEST Request = NULL; /* KernAllocateMemory(sizeof(HIVE_LOCK_REQUEST)); */
-    if (!Request) {
-        return STATUS_INSUFFICIENT_RESOURCES;
-    }
-    
-    Request->Type = HiveLockShared;
-    Request->ThreadId = CurrentThread;
-    Request->RequestTime = 0; /* TODO: Get current time */
-    Request->Timeout = Timeout;
-    Request->Next = RWLock->WaitQueue;
-    
-    RWLock->WaitQueue = Request;
-    RWLock->WaitingReaders++;
-    
-    /* Wait for lock to become available */
-    /* In real implementation, would use kernel synchronization primitives */
-    /* For now, simulate immediate success */
-    RWLock->WaitingReaders--;
-    RWLock->ReaderCount++;
-    
-    /* Remove from wait queue */
-    if (RWLock->WaitQueue == Request) {
-        RWLock->WaitQueue = Request->Next;
-    }
-    
-    /* Free request */
-    /* KernFreeMemory(Request); */
-    
+    UNREFERENCED_PARAMETER(Timeout);
+    __sync_fetch_and_add(&HiveReaderSlot(Hive)->Count, 1);
     return STATUS_SUCCESS;
 }
 
@@ -183,59 +193,32 @@ NTSTATUS HiveAcquireExclusiveLock(IN PHIVE Hive, IN UINT32 Timeout)
         return STATUS_INVALID_PARAMETER;
     }
 
-    PHIVE_RWLOCK RWLock = (PHIVE_RWLOCK)&Hive->Lock;
-    UINT32 CurrentThread = 0; /* TODO: Get current thread ID */
+    PHIVE_SYNC Sync = &Hive->Sync;
+    UINT32 CurrentThread = AuroraGetCurrentThreadId();
     
-    /* Check for recursive lock by same thread */
-    if (RWLock->OwnerThread == CurrentThread && RWLock->WriterCount > 0) {
-        RWLock->RecursionCount++;
-        return STATUS_SUCCESS;
-    }
+    UNREFERENCED_PARAMETER(Timeout);
     
-    /* Try to acquire lock immediately */
-    if (RWLock->ReaderCount == 0 && RWLock->WriterCount == 0) {
-        RWLock->WriterCount = 1;
-        RWLock->OwnerThread = CurrentThread;
-        RWLock->RecursionCount = 1;
+    /* Check for recursive lock by same thread */
+    if (Sync->RecursionCount > 0 && Sync->OwnerThread == CurrentThread) {
+        Sync->RecursionCount++;
         return STATUS_SUCCESS;
     }
     
-    /* Need to wait - add to wait queue */
-    PHIVE_LOCK_REQUEST Request = NULL; /* KernAllocateMemory(sizeof(HIVE_LOCK_REQUEST)); */
-    if (!Request) {
-        return STATUS_INSUFFICIENT_RESOURCES;
-    }
-    
-    Request->Type = HiveLockExclusive;
-    Request->ThreadId = CurrentThread;
-    Request->RequestTime = 0; /* TODO: Get current time */
-    Request->Timeout = Timeout;
-    Request->Next = RWLock->WaitQueue;
-    
-    RWLock->WaitQueue = Request;
-    RWLock->WaitingWriters++;
-    
-    /* Wait for lock to become available */
-    /* In real implementation, would use kernel synchronization primitives */
-    /* For now, simulate immediate success */
-    RWLock->WaitingWriters--;
-    RWLock->WriterCount = 1;
-    RWLock->OwnerThread = CurrentThread;
-    RWLock->RecursionCount = 1;
+    AURORA_IRQL OldIrql;
+    AuroraAcquireSpinLock(&Sync->WriterLock, &OldIrql);
+    Sync->WriterIrql = OldIrql;
+    Sync->OwnerThread = CurrentThread;
+    Sync->RecursionCount = 1;
     
-    /* Remove from wait queue */
-    if (RWLock->WaitQueue == Request) {
-        RWLock->WaitQueue = Request->Next;
-    }
-    
-    /* Free request */
-    /* KernFreeMemory(Request); */
+    /* Odd: readers that sample from here on wait, earlier ones retry */
+    Sync->Sequence++;
+    HalMemoryBarrier();
     
     return STATUS_SUCCESS;
 }
 
 /*
- * Release shared (read) lock
+ * Leave a read section
  */
 NTSTATUS HiveReleaseSharedLock(IN PHIVE Hive)
 {
@@ -243,19 +226,7 @@ NTSTATUS HiveReleaseSharedLock(IN PHIVE Hive)
         return STATUS_INVALID_PARAMETER;
     }
 
-    PHIVE_RWLOCK RWLock = (PHIVE_RWLOCK)&Hive->Lock;
-    
-    if (RWLock->ReaderCount == 0) {
-        return STATUS_INVALID_LOCK_STATE;
-    }
-    
-    RWLock->ReaderCount--;
-    
-    /* Wake up waiting writers if no more readers */
-    if (RWLock->ReaderCount == 0 && RWLock->WaitingWriters > 0) {
-        HiveWakeupWaiters(RWLock, HiveLockExclusive);
-    }
-    
+    __sync_fetch_and_sub(&HiveReaderSlot(Hive)->Count, 1);
     return STATUS_SUCCESS;
 }
 
@@ -268,31 +239,171 @@ NTSTATUS HiveReleaseExclusiveLock(IN PHIVE Hive)
         return STATUS_INVALID_PARAMETER;
     }
 
-    PHIVE_RWLOCK RWLock = (PHIVE_RWLOCK)&Hive->Lock;
-    UINT32 CurrentThread = 0; /* TODO: Get current thread ID */
+    PHIVE_SYNC Sync = &Hive->Sync;
+    UINT32 CurrentThread = AuroraGetCurrentThreadId();
     
-    if (RWLock->WriterCount == 0 || RWLock->OwnerThread != CurrentThread) {
+    if (Sync->RecursionCount == 0 || Sync->OwnerThread != CurrentThread) {
         return STATUS_INVALID_LOCK_STATE;
     }
     
     /* Handle recursive locks */
-    if (--RWLock->RecursionCount > 0) {
+    if (--Sync->RecursionCount > 0) {
         return STATUS_SUCCESS;
     }
     
-    RWLock->WriterCount = 0;
-    RWLock->OwnerThread = 0;
-    
-    /* Wake up waiting readers or writers */
-    if (RWLock->WaitingReaders > 0) {
-        HiveWakeupWaiters(RWLock, HiveLockShared);
-    } else if (RWLock->WaitingWriters > 0) {
-        HiveWakeupWaiters(RWLock, HiveLockExclusive);
+    /* Held-back cells can go once no reader is left to look at them */
+    if (Sync->DeferredCount > 0 && !HiveReadersActive(Hive)) {
+        Sync->RecursionCount = 1;
+        HiveReclaimDeferredCells(Hive);
+        Sync->RecursionCount = 0;
     }
     
+    HalMemoryBarrier();
+    Sync->Sequence++;
+    Sync->OwnerThread = 0;
+    AuroraReleaseSpinLock(&Sync->WriterLock, Sync->WriterIrql);
+    
     return STATUS_SUCCESS;
 }
 
+/*
+ * Start an optimistic read: returns the sequence to hand to HiveReadRetry,
+ * waiting out a writer that is in the middle of a change
+ */
+UINT32 HiveReadBegin(IN PHIVE Hive)
+{
+    PHIVE_SYNC Sync = &Hive->Sync;
+
+    for (;;) {
+        UINT32 Sequence = Sync->Sequence;
+        
+        /* A writer reading its own hive sees its own changes */
+        if (!(Sequence & 1) ||
+            (Sync->RecursionCount > 0 && Sync->OwnerThread == AuroraGetCurrentThreadId())) {
+            HalMemoryBarrier();
+            return Sequence;
+        }
+        HalCpuPause();
+    }
+}
+
+/*
+ * Whether a writer changed the hive since HiveReadBegin returned Sequence
+ */
+BOOL HiveReadRetry(IN PHIVE Hive, IN UINT32 Sequence)
+{
+    HalMemoryBarrier();
+    return Hive->Sync.Sequence != Sequence;
+}
+
+/*
+ * Hold a cell back from the allocator while readers may still be looking
+ * at it. Returns FALSE if the cell should be freed now.
+ */
+BOOL HiveDeferFreeCell(IN PHIVE Hive, IN UINT32 CellOffset)
+{
+    PHIVE_SYNC Sync = &Hive->Sync;
+
+    if (Sync->RecursionCount == 0 || !HiveReadersActive(Hive)) {
+        return FALSE;
+    }
+    
+    if (Sync->DeferredCount == Sync->DeferredCapacity) {
+        UINT32 Capacity = Sync->DeferredCapacity ? Sync->DeferredCapacity * 2 : 32;
+        PUINT32 Deferred = (PUINT32)AuroraAllocateMemory(Capacity * sizeof(UINT32));
+        if (!Deferred) {
+            /* Readers still retry on the sequence; they only lose the old cell */
+            return FALSE;
+        }
+        if (Sync->Deferred) {
+            memcpy(Deferred, Sync->Deferred, Sync->DeferredCount * sizeof(UINT32));
+            AuroraFreeMemory(Sync->Deferred);
+        }
+        Sync->Deferred = Deferred;
+        Sync->DeferredCapacity = Capacity;
+    }
+    
+    Sync->Deferred[Sync->DeferredCount++] = CellOffset;
+    return TRUE;
+}
+
+/*
+ * Slot of the key generation table a key cell hashes to
+ */
+static volatile UINT32* HiveKeyGenerationSlot(IN PHIVE Hive, IN UINT32 KeyCell)
+{
+    UINT32 Slot = ((KeyCell >> 3) * 0x9E3779B1u) >> (32 - HIVE_KEY_GENERATION_SHIFT);
+    return &Hive->Sync.KeyGenerations[Slot];
+}
+
+/*
+ * Record a change to a key's values or subkeys. Called by writers with
+ * the hive held exclusively, after the change is in place.
+ */
+VOID HiveKeyChanged(IN PHIVE Hive, IN UINT32 KeyCell)
+{
+    if (!Hive || KeyCell == 0) {
+        return;
+    }
+
+    HalMemoryBarrier();
+    (*HiveKeyGenerationSlot(Hive, KeyCell))++;
+    Hive->Sync.ChangeGeneration++;
+
+    if (Hive->Sync.Watchers) {
+        HiveNotifyChange(Hive, KeyCell, 0);
+    }
+}
+
+/*
+ * Record the deletion of a key. Its watchers get a last notification and
+ * stop matching, since the cell may come back as another key.
+ */
+VOID HiveKeyDeleted(IN PHIVE Hive, IN UINT32 KeyCell)
+{
+    if (!Hive || KeyCell == 0) {
+        return;
+    }
+
+    HalMemoryBarrier();
+    (*HiveKeyGenerationSlot(Hive, KeyCell))++;
+    Hive->Sync.ChangeGeneration++;
+
+    if (Hive->Sync.Watchers) {
+        HiveNotifyChange(Hive, KeyCell, HIVE_NOTIFY_KEY_DELETED);
+    }
+}
+
+/*
+ * Current change generation of a key. The hive generation is folded in so
+ * that a log replay, which rewrites cells wholesale, moves every key on.
+ */
+UINT32 HiveGetKeyGeneration(IN PHIVE Hive, IN UINT32 KeyCell)
+{
+    if (!Hive) {
+        return 0;
+    }
+
+    UINT32 Generation = *HiveKeyGenerationSlot(Hive, KeyCell) + Hive->Generation;
+    HalMemoryBarrier();
+    return Generation;
+}
+
+/*
+ * Drop synchronization state of a hive being closed
+ */
+VOID HiveSyncRelease(IN PHIVE Hive)
+{
+    if (!Hive || !Hive->Sync.Deferred) {
+        return;
+    }
+
+    AuroraFreeMemory(Hive->Sync.Deferred);
+    Hive->Sync.Deferred = NULL;
+    Hive->Sync.DeferredCount = 0;
+    Hive->Sync.DeferredCapacity = 0;
+}
+
 /*
  * Wake up waiting threads
  */
@@ -478,8 +589,7 @@ BOOLEAN HiveIsLocked(IN PHIVE Hive)
         return FALSE;
     }
 
-    PHIVE_RWLOCK RWLock = (PHIVE_RWLOCK)&Hive->Lock;
-    return (RWLock->ReaderCount > 0 || RWLock->WriterCount > 0);
+    return Hive->Sync.RecursionCount > 0 || HiveReadersActive(Hive);
 }
 
 /*
@@ -492,12 +602,16 @@ NTSTATUS HiveGetLockStatistics(IN PHIVE Hive, OUT PUINT32 ReaderCount, OUT PUINT
         return STATUS_INVALID_PARAMETER;
     }
 
-    PHIVE_RWLOCK RWLock = (PHIVE_RWLOCK)&Hive->Lock;
+    INT32 Readers = 0;
+    for (UINT32 i = 0; i < HIVE_READER_SLOTS; i++) {
+        Readers += Hive->Sync.Readers[i].Count;
+    }
     
-    *ReaderCount = RWLock->ReaderCount;
-    *WriterCount = RWLock->WriterCount;
-    *WaitingReaders = RWLock->WaitingReaders;
-    *WaitingWriters = RWLock->WaitingWriters;
+    /* Readers never wait; waiting writers spin on the writer lock uncounted */
+    *ReaderCount = Readers > 0 ? (UINT32)Readers : 0;
+    *WriterCount = Hive->Sync.RecursionCount > 0 ? 1 : 0;
+    *WaitingReaders = 0;
+    *WaitingWriters = 0;
     
     return STATUS_SUCCESS;
 }
@@ -535,21 +649,19 @@ NTSTATUS HiveForceUnlock(IN PHIVE Hive)
         return STATUS_INVALID_PARAMETER;
     }
 
-    PHIVE_RWLOCK RWLock = (PHIVE_RWLOCK)&Hive->Lock;
-    
-    /* Clear all lock counts */
-    RWLock->ReaderCount = 0;
-    RWLock->WriterCount = 0;
-    RWLock->WaitingReaders = 0;
-    RWLock->WaitingWriters = 0;
-    RWLock->OwnerThread = 0;
-    RWLock->RecursionCount = 0;
+    PHIVE_SYNC Sync = &Hive->Sync;
     
-    /* Clear wait queue */
-    while (RWLock->WaitQueue) {
-        PHIVE_LOCK_REQUEST Request = RWLock->WaitQueue;
-        RWLock->WaitQueue = Request->Next;
-        /* Free request */
+    /* Clear all lock counts; an odd sequence would stall readers forever */
+    for (UINT32 i = 0; i < HIVE_READER_SLOTS; i++) {
+        Sync->Readers[i].Count = 0;
+    }
+    if (Sync->RecursionCount > 0) {
+        Sync->RecursionCount = 0;
+        Sync->OwnerThread = 0;
+        AuroraReleaseSpinLock(&Sync->WriterLock, Sync->WriterIrql);
+    }
+    if (Sync->Sequence & 1) {
+        Sync->Sequence++;
     }
     
     return STATUS_SUCCESS;
@@ -565,9 +677,7 @@ BOOLEAN HiveCheckDeadlock(IN PHIVE Hive, IN UINT32 ThreadId)
     }
 
     /* Simple deadlock detection - check if thread already holds a lock */
-    PHIVE_RWLOCK RWLock = (PHIVE_RWLOCK)&Hive->Lock;
-    
-    if (RWLock->OwnerThread == ThreadId && RWLock->WriterCount > 0) {
+    if (Hive->Sync.OwnerThread == ThreadId && Hive->Sync.RecursionCount > 0) {
         /* Thread already holds exclusive lock */
         return FALSE; /* Not a deadlock, just recursive */
     }
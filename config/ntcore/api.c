@@ -28,6 +28,54 @@ typedef enum _NTCORE_VALUE_TYPE {
     NTCoreValueMultiString = 5
 } NTCORE_VALUE_TYPE, *PNTCORE_VALUE_TYPE;
 
+/*
+ * One entry of a batched get or set. For a get, Data/BufferSize describe
+ * the caller's buffer (Data may be NULL to ask for the size) and Type,
+ * DataSize, Status and Generation come back. For a set, Type, Data and
+ * DataSize go in and Status and Generation come back.
+ */
+typedef struct _NTCORE_VALUE_REQUEST {
+    UINT32 KeyHandle;
+    PCSTR ValueName;
+    NTCORE_VALUE_TYPE Type;
+    PVOID Data;
+    UINT32 BufferSize;
+    UINT32 DataSize;
+    NTSTATUS Status;
+    UINT32 Generation;          /* key change generation the result belongs to */
+    BOOLEAN FromCache;
+} NTCORE_VALUE_REQUEST, *PNTCORE_VALUE_REQUEST;
+
+/*
+ * Client value cache. Entries are direct mapped by (key, value name) and
+ * stamped with the key's change generation; an entry is used only while
+ * the key's generation is unchanged, so a hit never walks the hive. Values
+ * that are absent are cached too, as are values small enough to copy.
+ */
+#define NTCORE_CACHE_DEFAULT_ENTRIES    256
+#define NTCORE_CACHE_MAX_ENTRIES        4096
+#define NTCORE_CACHE_NAME_MAX           31
+#define NTCORE_CACHE_DATA_MAX           64
+
+typedef struct _NTCORE_CACHE_ENTRY {
+    UINT32 KeyHandle;           /* 0 for an empty entry */
+    UINT32 Generation;
+    NTSTATUS Status;            /* STATUS_SUCCESS or STATUS_NOT_FOUND */
+    UINT32 Type;                /* hive value type */
+    UINT32 DataLength;
+    CHAR Name[NTCORE_CACHE_NAME_MAX + 1];
+    UINT8 Data[NTCORE_CACHE_DATA_MAX];
+} NTCORE_CACHE_ENTRY, *PNTCORE_CACHE_ENTRY;
+
+typedef struct _NTCORE_VALUE_CACHE {
+    PHIVE Hive;                 /* hive the entries were read from */
+    UINT32 Mask;
+    UINT32 Hits;
+    UINT32 Misses;
+    AURORA_SPINLOCK Lock;
+    NTCORE_CACHE_ENTRY Entries[1];
+} NTCORE_VALUE_CACHE, *PNTCORE_VALUE_CACHE;
+
 /* Configuration context */
 typedef struct _NTCORE_CONFIG_CONTEXT {
     PHIVE SystemHive;
@@ -42,6 +90,98 @@ static NTCORE_CONFIG_CONTEXT g_ConfigContext = { NULL, 0, FALSE, 0 };
 /* Forward declarations (internal) */
 NTSTATUS NTCoreCreateRootKeys(void);
 
+/*
+ * Read a value without blocking writers; the read is redone if a writer
+ * changed the hive while it ran
+ */
+static NTSTATUS NTCoreReadValue(IN UINT32 KeyHandle, IN PCSTR ValueName, OUT PUINT32 ValueType,
+                                OUT PVOID Buffer, IN OUT PUINT32 DataSize)
+{
+    PHIVE Hive = g_ConfigContext.SystemHive;
+    UINT32 BufferSize = *DataSize;
+    UINT32 Sequence;
+    NTSTATUS Status;
+    
+    HiveAcquireSharedLock(Hive, 0);
+    do {
+        Sequence = HiveReadBegin(Hive);
+        *DataSize = BufferSize;
+        Status = HiveGetValue(Hive, KeyHandle, ValueName, ValueType, Buffer, DataSize);
+    } while (HiveReadRetry(Hive, Sequence));
+    HiveReleaseSharedLock(Hive);
+    
+    return Status;
+}
+
+/*
+ * Store a value with the hive held exclusively
+ */
+static NTSTATUS NTCoreWriteValue(IN UINT32 KeyHandle, IN PCSTR ValueName, IN VALUE_TYPE Type,
+                                 IN PVOID Data, IN UINT32 DataSize)
+{
+    PHIVE Hive = g_ConfigContext.SystemHive;
+    
+    HiveAcquireExclusiveLock(Hive, 0);
+    NTSTATUS Status = HiveSetValue(Hive, KeyHandle, ValueName, Type, Data, DataSize);
+    HiveReleaseExclusiveLock(Hive);
+    
+    return Status;
+}
+
+/*
+ * Map an NTCore value type to the hive's; FALSE for an unknown type
+ */
+static BOOLEAN NTCoreToHiveType(IN NTCORE_VALUE_TYPE Type, OUT VALUE_TYPE* HiveType)
+{
+    switch (Type) {
+        case NTCoreValueString:
+            *HiveType = ValueTypeString;
+            break;
+        case NTCoreValueDword:
+            *HiveType = ValueTypeDword;
+            break;
+        case NTCoreValueQword:
+            *HiveType = ValueTypeQword;
+            break;
+        case NTCoreValueBinary:
+            *HiveType = ValueTypeBinary;
+            break;
+        case NTCoreValueMultiString:
+            *HiveType = ValueTypeMultiString;
+            break;
+        default:
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ * Map a hive value type to NTCore's; FALSE for types NTCore has no name for
+ */
+static BOOLEAN NTCoreFromHiveType(IN UINT32 HiveType, OUT PNTCORE_VALUE_TYPE Type)
+{
+    switch (HiveType) {
+        case ValueTypeString:
+            *Type = NTCoreValueString;
+            break;
+        case ValueTypeDword:
+            *Type = NTCoreValueDword;
+            break;
+        case ValueTypeQword:
+            *Type = NTCoreValueQword;
+            break;
+        case ValueTypeBinary:
+            *Type = NTCoreValueBinary;
+            break;
+        case ValueTypeMultiString:
+            *Type = NTCoreValueMultiString;
+            break;
+        default:
+            return FALSE;
+    }
+    return TRUE;
+}
+
 /*
  * Initialize NTCore configuration system
  */
@@ -185,8 +325,18 @@ NTSTATUS NTCoreOpenKey(IN PCSTR KeyPath, OUT PUINT32 KeyHandle)
     }
     
     /* Find key in hive */
+    PHIVE Hive = g_ConfigContext.SystemHive;
     UINT32 KeyOffset;
-    NTSTATUS Status = HiveFindKey(g_ConfigContext.SystemHive, KeyPath, &KeyOffset);
+    UINT32 Sequence;
+    NTSTATUS Status;
+    
+    HiveAcquireSharedLock(Hive, 0);
+    do {
+        Sequence = HiveReadBegin(Hive);
+        Status = HiveFindKey(Hive, KeyPath, &KeyOffset);
+    } while (HiveReadRetry(Hive, Sequence));
+    HiveReleaseSharedLock(Hive);
+    
     if (!NT_SUCCESS(Status)) {
         return Status;
     }
@@ -210,7 +360,9 @@ NTSTATUS NTCoreCreateKey(IN PCSTR KeyPath, OUT PUINT32 KeyHandle)
     
     /* Create key in hive */
     UINT32 KeyOffset;
+    HiveAcquireExclusiveLock(g_ConfigContext.SystemHive, 0);
     NTSTATUS Status = HiveCreateKey(g_ConfigContext.SystemHive, KeyPath, &KeyOffset);
+    HiveReleaseExclusiveLock(g_ConfigContext.SystemHive);
     if (!NT_SUCCESS(Status)) {
         return Status;
     }
@@ -233,7 +385,11 @@ NTSTATUS NTCoreDeleteKey(IN PCSTR KeyPath)
     }
     
     /* Delete key from hive */
-    return HiveDeleteKey(g_ConfigContext.SystemHive, KeyPath);
+    HiveAcquireExclusiveLock(g_ConfigContext.SystemHive, 0);
+    NTSTATUS Status = HiveDeleteKey(g_ConfigContext.SystemHive, KeyPath);
+    HiveReleaseExclusiveLock(g_ConfigContext.SystemHive);
+    
+    return Status;
 }
 
 /*
@@ -250,8 +406,7 @@ NTSTATUS NTCoreSetStringValue(IN UINT32 KeyHandle, IN PCSTR ValueName, IN PCSTR
     }
     
     UINT32 ValueLength = strlen(Value) + 1; /* Include null terminator */
-    return HiveSetValue(g_ConfigContext.SystemHive, KeyHandle, ValueName, 
-                       ValueTypeString, (PVOID)Value, ValueLength);
+    return NTCoreWriteValue(KeyHandle, ValueName, ValueTypeString, (PVOID)Value, ValueLength);
 }
 
 /*
@@ -270,8 +425,7 @@ NTSTATUS NTCoreGetStringValue(IN UINT32 KeyHandle, IN PCSTR ValueName, OUT PCHAR
     UINT32 ValueType;
     UINT32 DataSize = BufferSize;
     
-    NTSTATUS Status = HiveGetValue(g_ConfigContext.SystemHive, KeyHandle, ValueName, 
-                                  &ValueType, Buffer, &DataSize);
+    NTSTATUS Status = NTCoreReadValue(KeyHandle, ValueName, &ValueType, Buffer, &DataSize);
     if (!NT_SUCCESS(Status)) {
         return Status;
     }
@@ -301,8 +455,7 @@ NTSTATUS NTCoreSetDwordValue(IN UINT32 KeyHandle, IN PCSTR ValueName, IN UINT32
         return STATUS_NOT_INITIALIZED;
     }
     
-    return HiveSetValue(g_ConfigContext.SystemHive, KeyHandle, ValueName, 
-                       ValueTypeDword, &Value, sizeof(UINT32));
+    return NTCoreWriteValue(KeyHandle, ValueName, ValueTypeDword, &Value, sizeof(UINT32));
 }
 
 /*
@@ -321,8 +474,7 @@ NTSTATUS NTCoreGetDwordValue(IN UINT32 KeyHandle, IN PCSTR ValueName, OUT PUINT3
     UINT32 ValueType;
     UINT32 DataSize = sizeof(UINT32);
     
-    NTSTATUS Status = HiveGetValue(g_ConfigContext.SystemHive, KeyHandle, ValueName, 
-                                  &ValueType, Value, &DataSize);
+    NTSTATUS Status = NTCoreReadValue(KeyHandle, ValueName, &ValueType, Value, &DataSize);
     if (!NT_SUCCESS(Status)) {
         return Status;
     }
@@ -347,8 +499,7 @@ NTSTATUS NTCoreSetBinaryValue(IN UINT32 KeyHandle, IN PCSTR ValueName, IN PVOID
         return STATUS_NOT_INITIALIZED;
     }
     
-    return HiveSetValue(g_ConfigContext.SystemHive, KeyHandle, ValueName, 
-                       ValueTypeBinary, Data, DataSize);
+    return NTCoreWriteValue(KeyHandle, ValueName, ValueTypeBinary, Data, DataSize);
 }
 
 /*
@@ -366,8 +517,7 @@ NTSTATUS NTCoreGetBinaryValue(IN UINT32 KeyHandle, IN PCSTR ValueName, OUT PVOID
     
     UINT32 ValueType;
     
-    NTSTATUS Status = HiveGetValue(g_ConfigContext.SystemHive, KeyHandle, ValueName, 
-                                  &ValueType, Buffer, BufferSize);
+    NTSTATUS Status = NTCoreReadValue(KeyHandle, ValueName, &ValueType, Buffer, BufferSize);
     if (!NT_SUCCESS(Status)) {
         return Status;
     }
@@ -392,7 +542,11 @@ NTSTATUS NTCoreDeleteValue(IN UINT32 KeyHandle, IN PCSTR ValueName)
         return STATUS_NOT_INITIALIZED;
     }
     
-    return HiveDeleteValue(g_ConfigContext.SystemHive, KeyHandle, ValueName);
+    HiveAcquireExclusiveLock(g_ConfigContext.SystemHive, 0);
+    NTSTATUS Status = HiveDeleteValue(g_ConfigContext.SystemHive, KeyHandle, ValueName);
+    HiveReleaseExclusiveLock(g_ConfigContext.SystemHive);
+    
+    return Status;
 }
 
 /*
@@ -588,29 +742,12 @@ NTSTATUS NTCoreSetValue(IN UINT32 KeyHandle, IN PCSTR ValueName, IN NTCORE_VALUE
         return STATUS_NOT_INITIALIZED;
     }
     
-    /* Convert NTCore type to hive type */
     VALUE_TYPE HiveType;
-    switch (Type) {
-        case NTCoreValueString:
-            HiveType = ValueTypeString;
-            break;
-        case NTCoreValueDword:
-            HiveType = ValueTypeDword;
-            break;
-        case NTCoreValueQword:
-            HiveType = ValueTypeQword;
-            break;
-        case NTCoreValueBinary:
-            HiveType = ValueTypeBinary;
-            break;
-        case NTCoreValueMultiString:
-            HiveType = ValueTypeMultiString;
-            break;
-        default:
-            return STATUS_INVALID_PARAMETER;
+    if (!NTCoreToHiveType(Type, &HiveType)) {
+        return STATUS_INVALID_PARAMETER;
     }
     
-    return HiveSetValue(g_ConfigContext.SystemHive, KeyHandle, ValueName, HiveType, Data, DataSize);
+    return NTCoreWriteValue(KeyHandle, ValueName, HiveType, Data, DataSize);
 }
 
 /*
@@ -628,32 +765,301 @@ NTSTATUS NTCoreGetValue(IN UINT32 KeyHandle, IN PCSTR ValueName, OUT PNTCORE_VAL
     }
     
     UINT32 HiveType;
-    NTSTATUS Status = HiveGetValue(g_ConfigContext.SystemHive, KeyHandle, ValueName, 
-                                  &HiveType, Buffer, BufferSize);
+    NTSTATUS Status = NTCoreReadValue(KeyHandle, ValueName, &HiveType, Buffer, BufferSize);
     if (!NT_SUCCESS(Status)) {
         return Status;
     }
     
-    /* Convert hive type to NTCore type */
-    switch (HiveType) {
-        case ValueTypeString:
-            *Type = NTCoreValueString;
-            break;
-        case ValueTypeDword:
-            *Type = NTCoreValueDword;
-            break;
-        case ValueTypeQword:
-            *Type = NTCoreValueQword;
-            break;
-        case ValueTypeBinary:
-            *Type = NTCoreValueBinary;
-            break;
-        case ValueTypeMultiString:
-            *Type = NTCoreValueMultiString;
-            break;
-        default:
-            return STATUS_INVALID_VALUE_TYPE;
+    if (!NTCoreFromHiveType(HiveType, Type)) {
+        return STATUS_INVALID_VALUE_TYPE;
     }
     
     return STATUS_SUCCESS;
-}
\ No newline at end of file
+}
+/*
+ * Create a value cache for NTCoreGetValues. EntryCount is rounded up to a
+ * power of two; 0 picks a default.
+ */
+NTSTATUS NTCoreCreateValueCache(IN UINT32 EntryCount, OUT PNTCORE_VALUE_CACHE* Cache)
+{
+    if (!Cache || EntryCount > NTCORE_CACHE_MAX_ENTRIES) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    UINT32 Entries = 1;
+    while (Entries < (EntryCount ? EntryCount : NTCORE_CACHE_DEFAULT_ENTRIES)) {
+        Entries *= 2;
+    }
+
+    SIZE_T Size = sizeof(NTCORE_VALUE_CACHE) + (Entries - 1) * sizeof(NTCORE_CACHE_ENTRY);
+    PNTCORE_VALUE_CACHE NewCache = (PNTCORE_VALUE_CACHE)AuroraAllocateMemory(Size);
+    if (!NewCache) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    memset(NewCache, 0, Size);
+
+    NewCache->Mask = Entries - 1;
+
+    *Cache = NewCache;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Destroy a value cache
+ */
+VOID NTCoreDestroyValueCache(IN PNTCORE_VALUE_CACHE Cache)
+{
+    if (Cache) {
+        AuroraFreeMemory(Cache);
+    }
+}
+
+/*
+ * Get value cache hit and miss counts
+ */
+NTSTATUS NTCoreGetValueCacheStatistics(IN PNTCORE_VALUE_CACHE Cache, OUT PUINT32 Hits, OUT PUINT32 Misses)
+{
+    if (!Cache || !Hits || !Misses) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    *Hits = Cache->Hits;
+    *Misses = Cache->Misses;
+    return STATUS_SUCCESS;
+}
+
+/*
+ * Cache entry a (key, value name) pair maps to, or NULL if the name is
+ * too long to cache
+ */
+static PNTCORE_CACHE_ENTRY NTCoreCacheSlot(IN PNTCORE_VALUE_CACHE Cache, IN UINT32 KeyHandle,
+                                           IN PCSTR ValueName, OUT PUINT32 NameLength)
+{
+    *NameLength = (UINT32)strlen(ValueName);
+    if (*NameLength > NTCORE_CACHE_NAME_MAX) {
+        return NULL;
+    }
+
+    UINT32 Hash = HiveHashName(ValueName, *NameLength) ^ (KeyHandle * 0x9E3779B1u);
+    return &Cache->Entries[(Hash ^ (Hash >> 16)) & Cache->Mask];
+}
+
+/*
+ * Answer a get from the cache if it holds the value at the key's current
+ * generation. Fills in the request the way a hive read would.
+ */
+static BOOLEAN NTCoreCacheLookup(IN PNTCORE_VALUE_CACHE Cache, IN OUT PNTCORE_VALUE_REQUEST Request)
+{
+    UINT32 NameLength;
+    AURORA_IRQL OldIrql;
+    BOOLEAN Hit = FALSE;
+
+    PNTCORE_CACHE_ENTRY Entry = NTCoreCacheSlot(Cache, Request->KeyHandle, Request->ValueName, &NameLength);
+    if (!Entry) {
+        return FALSE;
+    }
+
+    AuroraAcquireSpinLock(&Cache->Lock, &OldIrql);
+    if (Entry->KeyHandle == Request->KeyHandle && Entry->Generation == Request->Generation &&
+        memcmp(Entry->Name, Request->ValueName, NameLength + 1) == 0) {
+        Request->Status = Entry->Status;
+        Request->Type = (NTCORE_VALUE_TYPE)Entry->Type;
+        Request->DataSize = Entry->DataLength;
+        if (Entry->Status == STATUS_SUCCESS && Request->Data) {
+            if (Request->BufferSize < Entry->DataLength) {
+                Request->Status = STATUS_BUFFER_TOO_SMALL;
+            } else {
+                memcpy(Request->Data, Entry->Data, Entry->DataLength);
+            }
+        }
+        Hit = TRUE;
+    }
+    AuroraReleaseSpinLock(&Cache->Lock, OldIrql);
+
+    return Hit;
+}
+
+/*
+ * Remember the outcome of a get that went to the hive. Only complete
+ * reads of small values and lookups of absent values are kept.
+ */
+static VOID NTCoreCacheStore(IN PNTCORE_VALUE_CACHE Cache, IN PNTCORE_VALUE_REQUEST Request)
+{
+    UINT32 NameLength;
+    AURORA_IRQL OldIrql;
+
+    if (Request->FromCache) {
+        __sync_fetch_and_add(&Cache->Hits, 1);
+        return;
+    }
+    __sync_fetch_and_add(&Cache->Misses, 1);
+
+    if (!(Request->Status == STATUS_NOT_FOUND ||
+          (Request->Status == STATUS_SUCCESS && Request->Data && Request->DataSize <= NTCORE_CACHE_DATA_MAX))) {
+        return;
+    }
+
+    PNTCORE_CACHE_ENTRY Entry = NTCoreCacheSlot(Cache, Request->KeyHandle, Request->ValueName, &NameLength);
+    if (!Entry) {
+        return;
+    }
+
+    AuroraAcquireSpinLock(&Cache->Lock, &OldIrql);
+    Entry->KeyHandle = Request->KeyHandle;
+    Entry->Generation = Request->Generation;
+    Entry->Status = Request->Status;
+    Entry->Type = (UINT32)Request->Type;
+    Entry->DataLength = Request->Status == STATUS_SUCCESS ? Request->DataSize : 0;
+    memcpy(Entry->Name, Request->ValueName, NameLength + 1);
+    memcpy(Entry->Data, Request->Data, Entry->DataLength);
+    AuroraReleaseSpinLock(&Cache->Lock, OldIrql);
+}
+
+/*
+ * Read one entry of a batch, from the cache when it is current
+ */
+static VOID NTCoreBatchReadValue(IN PHIVE Hive, IN PNTCORE_VALUE_CACHE Cache, IN OUT PNTCORE_VALUE_REQUEST Request)
+{
+    UINT32 HiveType;
+
+    Request->FromCache = FALSE;
+    if (!Request->ValueName) {
+        Request->Status = STATUS_INVALID_PARAMETER;
+        return;
+    }
+
+    /* Sampled before the read, so a change that races it moves the generation on */
+    Request->Generation = HiveGetKeyGeneration(Hive, Request->KeyHandle);
+    if (Cache && NTCoreCacheLookup(Cache, Request)) {
+        Request->FromCache = TRUE;
+        return;
+    }
+
+    Request->DataSize = Request->BufferSize;
+    Request->Status = HiveGetValue(Hive, Request->KeyHandle, Request->ValueName, &HiveType,
+                                   Request->Data, &Request->DataSize);
+    if ((NT_SUCCESS(Request->Status) || Request->Status == STATUS_BUFFER_TOO_SMALL) &&
+        !NTCoreFromHiveType(HiveType, &Request->Type)) {
+        Request->Status = STATUS_INVALID_VALUE_TYPE;
+    }
+}
+
+/*
+ * Get many values in one read section. The batch is read as a whole and
+ * redone if a writer got in, so the results are one consistent snapshot.
+ * With a cache, values whose key has not changed since they were cached
+ * are answered without touching the hive. Each request gets its own
+ * status; the return is the first failure, or STATUS_SUCCESS.
+ */
+NTSTATUS NTCoreGetValues(IN PNTCORE_VALUE_CACHE Cache, IN OUT PNTCORE_VALUE_REQUEST Requests, IN UINT32 Count)
+{
+    if (!Requests || Count == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (!g_ConfigContext.Initialized) {
+        return STATUS_NOT_INITIALIZED;
+    }
+    
+    PHIVE Hive = g_ConfigContext.SystemHive;
+    UINT32 Sequence;
+
+    /* Entries read from a hive since replaced mean nothing */
+    if (Cache && Cache->Hive != Hive) {
+        AURORA_IRQL OldIrql;
+        AuroraAcquireSpinLock(&Cache->Lock, &OldIrql);
+        for (UINT32 i = 0; i <= Cache->Mask; i++) {
+            Cache->Entries[i].KeyHandle = 0;
+        }
+        Cache->Hive = Hive;
+        AuroraReleaseSpinLock(&Cache->Lock, OldIrql);
+    }
+    
+    HiveAcquireSharedLock(Hive, 0);
+    do {
+        Sequence = HiveReadBegin(Hive);
+        for (UINT32 i = 0; i < Count; i++) {
+            NTCoreBatchReadValue(Hive, Cache, &Requests[i]);
+        }
+    } while (HiveReadRetry(Hive, Sequence));
+    HiveReleaseSharedLock(Hive);
+    
+    NTSTATUS Status = STATUS_SUCCESS;
+    for (UINT32 i = 0; i < Count; i++) {
+        if (Cache && Requests[i].ValueName) {
+            NTCoreCacheStore(Cache, &Requests[i]);
+        }
+        if (NT_SUCCESS(Status) && !NT_SUCCESS(Requests[i].Status)) {
+            Status = Requests[i].Status;
+        }
+    }
+    
+    return Status;
+}
+
+/*
+ * Set many values with the hive held exclusively once. Entries are applied
+ * in order; a failed entry does not stop the ones after it. Each request
+ * gets its own status; the return is the first failure, or STATUS_SUCCESS.
+ */
+NTSTATUS NTCoreSetValues(IN OUT PNTCORE_VALUE_REQUEST Requests, IN UINT32 Count)
+{
+    if (!Requests || Count == 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    if (!g_ConfigContext.Initialized) {
+        return STATUS_NOT_INITIALIZED;
+    }
+    
+    PHIVE Hive = g_ConfigContext.SystemHive;
+    NTSTATUS Status = STATUS_SUCCESS;
+    
+    HiveAcquireExclusiveLock(Hive, 0);
+    for (UINT32 i = 0; i < Count; i++) {
+        PNTCORE_VALUE_REQUEST Request = &Requests[i];
+        VALUE_TYPE HiveType;
+        
+        Request->FromCache = FALSE;
+        if (!Request->ValueName || !Request->Data || Request->DataSize == 0 ||
+            !NTCoreToHiveType(Request->Type, &HiveType)) {
+            Request->Status = STATUS_INVALID_PARAMETER;
+        } else {
+            Request->Status = HiveSetValue(Hive, Request->KeyHandle, Request->ValueName, HiveType,
+                                           Request->Data, Request->DataSize);
+        }
+        Request->Generation = HiveGetKeyGeneration(Hive, Request->KeyHandle);
+        
+        if (NT_SUCCESS(Status) && !NT_SUCCESS(Request->Status)) {
+            Status = Request->Status;
+        }
+    }
+    HiveReleaseExclusiveLock(Hive);
+    
+    return Status;
+}
+
+/*
+ * Watch a configuration key, and with WatchSubtree everything below it.
+ * Notifications set Event, or queue on Port when one is given; changes
+ * closer together than Window system time ticks arrive as one.
+ */
+NTSTATUS NTCoreNotifyKeyChange(IN UINT32 KeyHandle, IN BOOLEAN WatchSubtree, IN UINT64 Window,
+                               IN PAURORA_EVENT Event, IN PHIVE_NOTIFY_PORT Port, IN PVOID Context,
+                               OUT PHIVE_WATCHER* Watcher)
+{
+    if (!g_ConfigContext.Initialized) {
+        return STATUS_NOT_INITIALIZED;
+    }
+    
+    return HiveRegisterWatcher(g_ConfigContext.SystemHive, KeyHandle, WatchSubtree ? HIVE_NOTIFY_SUBTREE : 0,
+                               Window, Event, Port, Context, Watcher);
+}
+
+/*
+ * Stop watching a configuration key
+ */
+NTSTATUS NTCoreCancelKeyNotify(IN PHIVE_WATCHER Watcher)
+{
+    return HiveCancelWatcher(Watcher);
+}
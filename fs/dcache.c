@@ -0,0 +1,698 @@
+/*
+ * Aurora Kernel - VFS dentry cache
+ *
+ * Path components are cached as dentries hashed on (parent, name). A walk
+ * first runs without the cache lock, validated by a sequence count that
+ * every unhash or recycle bumps; only a miss, a racing writer or a recycled
+ * dentry sends it down the locked, reference-counted walk, which is also
+ * the only place drivers are asked to resolve names. Names that do not
+ * exist are cached as negative dentries, and unreferenced dentries are
+ * reclaimed in LRU order once more than FS_DCACHE_MAX_UNUSED of them are
+ * cached. Referenced dentries (open files, mountpoints and their parents)
+ * are never reclaimed, so the pool grows with them, bounded only by memory.
+ *
+ * Walks start at the namespace root and track a (mount, dentry) pair; a
+ * dentry with mounts attached is looked up in the mount hash and the walk
+ * continues at the mounted root, and ".." at a mount root steps back out
+ * to the mountpoint first.
+ */
+
+#include "../aurora.h"
+#include "../include/kern.h"
+#include "../include/fs.h"
+#include "../include/hal.h"
+#include "vfs.h"
+
+#define FS_WALK_RETRY   STATUS_PENDING  /* fast walk could not decide */
+
+static PFS_DENTRY g_DcacheHash[FS_DCACHE_BUCKETS];
+static PFS_DENTRY g_DcacheFree;                 /* recycled dentries, linked through HashNext */
+static PFS_DENTRY g_LruHead;                    /* most recently released */
+static PFS_DENTRY g_LruTail;
+static UINT32 g_LruCount;
+static volatile UINT32 g_DcachePooled;          /* dentries ever allocated */
+static volatile UINT32 g_DcacheSeq;             /* odd while a writer is unhashing */
+static AURORA_SPINLOCK g_DcacheLock;
+static FS_DCACHE_STATS g_DcacheStats;
+
+NTSTATUS FsDcacheInitialize(void)
+{
+    AuroraInitializeSpinLock(&g_DcacheLock);
+    memset(g_DcacheHash, 0, sizeof(g_DcacheHash));
+    memset(&g_DcacheStats, 0, sizeof(g_DcacheStats));
+    g_LruHead = g_LruTail = NULL;
+    g_LruCount = 0;
+    g_DcacheSeq = 0;
+    return STATUS_SUCCESS;
+}
+
+void FsDcacheLock(OUT PAURORA_IRQL Irql)
+{
+    AuroraAcquireSpinLock(&g_DcacheLock, Irql);
+}
+
+void FsDcacheUnlock(IN AURORA_IRQL Irql)
+{
+    AuroraReleaseSpinLock(&g_DcacheLock, Irql);
+}
+
+/* Brackets any change a lockless walker must not see half done; lock held */
+void FsDcacheWriteBegin(void)
+{
+    g_DcacheSeq++;
+    HalMemoryBarrier();
+}
+
+void FsDcacheWriteEnd(void)
+{
+    HalMemoryBarrier();
+    g_DcacheSeq++;
+}
+
+static UINT32 FsDcacheHashName(PFS_DENTRY Parent, PCSTR Name, UINT32 Length)
+{
+    UINT32 h = 2166136261u ^ (UINT32)((ULONG_PTR)Parent >> 4);
+    for (UINT32 i = 0; i < Length; i++) {
+        h ^= (UINT8)Name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Safe without the lock: chains only ever point at pool dentries, and the
+ * step bound (no chain is longer than the pool) stops a walker that raced
+ * onto a recycled chain. */
+static PFS_DENTRY FsDcacheFind(PFS_DENTRY Parent, PCSTR Name, UINT32 Length, UINT32 Hash)
+{
+    UINT32 steps = 0;
+    for (PFS_DENTRY d = g_DcacheHash[Hash & (FS_DCACHE_BUCKETS - 1)]; d && steps < g_DcachePooled; d = d->HashNext, steps++) {
+        if (d->Hash == Hash && d->Parent == Parent && d->NameLength == Length && memcmp(d->Name, Name, Length) == 0) return d;
+    }
+    return NULL;
+}
+
+/* ---------------------------------------------------------------------------
+ * References and LRU
+ * --------------------------------------------------------------------------- */
+
+static void FsLruUnlink(PFS_DENTRY D)
+{
+    if (!(D->Flags & FS_DENTRY_ON_LRU)) return;
+    if (D->LruPrev) D->LruPrev->LruNext = D->LruNext; else g_LruHead = D->LruNext;
+    if (D->LruNext) D->LruNext->LruPrev = D->LruPrev; else g_LruTail = D->LruPrev;
+    D->LruPrev = D->LruNext = NULL;
+    D->Flags &= ~FS_DENTRY_ON_LRU;
+    g_LruCount--;
+}
+
+static void FsLruPushFront(PFS_DENTRY D)
+{
+    FsLruUnlink(D);
+    D->LruPrev = NULL;
+    D->LruNext = g_LruHead;
+    if (g_LruHead) g_LruHead->LruPrev = D; else g_LruTail = D;
+    g_LruHead = D;
+    D->Flags |= FS_DENTRY_ON_LRU;
+    g_LruCount++;
+}
+
+void FsDentryGetLocked(IN PFS_DENTRY Dentry)
+{
+    __sync_fetch_and_add(&Dentry->RefCount, 1);
+}
+
+/* Lockless reference: fails on a dentry that is being recycled */
+static BOOL FsDentryTryGet(PFS_DENTRY D)
+{
+    for (;;) {
+        UINT32 ref = D->RefCount;
+        if (ref & FS_DENTRY_DEAD) return FALSE;
+        if (__sync_bool_compare_and_swap(&D->RefCount, ref, ref + 1)) return TRUE;
+    }
+}
+
+/* A dentry whose count drops to zero becomes a reclaim candidate. Entries
+ * re-referenced by lockless walkers stay on the LRU and are skipped by
+ * reclaim, which is cheaper than taking the lock on every fast-path hit. */
+void FsDentryPutLocked(IN PFS_DENTRY Dentry)
+{
+    if (__sync_sub_and_fetch(&Dentry->RefCount, 1) == 0 && !(Dentry->Flags & FS_DENTRY_ROOT)) FsLruPushFront(Dentry);
+}
+
+void FsDentryPut(IN PFS_DENTRY Dentry)
+{
+    AURORA_IRQL irql;
+    if (!Dentry) return;
+    AuroraAcquireSpinLock(&g_DcacheLock, &irql);
+    FsDentryPutLocked(Dentry);
+    AuroraReleaseSpinLock(&g_DcacheLock, irql);
+}
+
+/* ---------------------------------------------------------------------------
+ * Allocation and reclaim
+ * --------------------------------------------------------------------------- */
+
+static void FsDcacheUnhashLocked(PFS_DENTRY D)
+{
+    PFS_DENTRY* link = &g_DcacheHash[D->Hash & (FS_DCACHE_BUCKETS - 1)];
+    if (!(D->Flags & FS_DENTRY_HASHED)) return;
+    while (*link && *link != D) link = &(*link)->HashNext;
+    if (*link) *link = D->HashNext;
+    /* D->HashNext is left intact so a walker standing on D can still move on */
+    D->Flags &= ~FS_DENTRY_HASHED;
+    g_DcacheStats.Dentries--;
+    if (D->Flags & FS_DENTRY_NEGATIVE) g_DcacheStats.Negative--;
+}
+
+/* Drop what a dead dentry holds; it must already be unhashed */
+static void FsDcacheRetireLocked(PFS_DENTRY D)
+{
+    PFS_VOLUME vol = D->Volume;
+    PFS_DRIVER drv = vol ? vol->Driver : NULL;
+    /* ReleaseNode runs under the cache lock and must not block */
+    if (D->Node && drv && drv->Ops.ReleaseNode) drv->Ops.ReleaseNode(vol->VolumeData, D->Node);
+    D->Node = NULL;
+    /* Unreferenced, so no handle has the cache and it was written back */
+    FsPageCacheDestroy(D->Cache);
+    D->Cache = NULL;
+    if (D->Parent && D->Parent != D) FsDentryPutLocked(D->Parent);
+    D->Parent = NULL;
+}
+
+static PFS_DENTRY FsDcacheReclaimLocked(void)
+{
+    while (g_LruTail) {
+        PFS_DENTRY d = g_LruTail;
+        FsLruUnlink(d);
+        if (!__sync_bool_compare_and_swap(&d->RefCount, 0, FS_DENTRY_DEAD)) continue; /* in use again */
+        FsDcacheWriteBegin();
+        FsDcacheUnhashLocked(d);
+        FsDcacheWriteEnd();
+        FsDcacheRetireLocked(d);
+        g_DcacheStats.Reclaimed++;
+        return d;
+    }
+    return NULL;
+}
+
+static PFS_DENTRY FsDcacheAllocLocked(void)
+{
+    PFS_DENTRY d = g_DcacheFree, chunk;
+    if (d) {
+        g_DcacheFree = d->HashNext;
+        return d;
+    }
+    /* Past the target, reuse an unreferenced dentry rather than grow */
+    if (g_LruCount > FS_DCACHE_MAX_UNUSED && (d = FsDcacheReclaimLocked()) != NULL) return d;
+    chunk = (PFS_DENTRY)AuroraAllocateMemory(FS_DCACHE_CHUNK * sizeof(FS_DENTRY));
+    if (!chunk) return FsDcacheReclaimLocked(); /* out of memory: the LRU is all that is left */
+    memset(chunk, 0, FS_DCACHE_CHUNK * sizeof(FS_DENTRY));
+    for (UINT32 i = 1; i < FS_DCACHE_CHUNK; i++) {
+        chunk[i].RefCount = FS_DENTRY_DEAD;
+        chunk[i].HashNext = g_DcacheFree;
+        g_DcacheFree = &chunk[i];
+    }
+    g_DcachePooled += FS_DCACHE_CHUNK;
+    chunk[0].RefCount = FS_DENTRY_DEAD;
+    return &chunk[0];
+}
+
+static void FsDcacheFreeLocked(PFS_DENTRY D)
+{
+    D->RefCount = FS_DENTRY_DEAD;
+    D->Volume = NULL;
+    D->HashNext = g_DcacheFree;
+    g_DcacheFree = D;
+}
+
+/* Initialise a dead dentry and publish it in the hash table with one reference */
+static BOOL FsDcacheInsertLocked(PFS_DENTRY D, PFS_DENTRY Parent, PCSTR Name, UINT32 Length, UINT32 Hash, PVOID Node, UINT32 Flags)
+{
+    if (Length >= FS_DENTRY_INLINE_NAME) {
+        /* Long-name buffers stay with the dentry for its lifetime so stale readers never touch freed memory */
+        if (!D->LongName) D->LongName = (PCHAR)AuroraAllocateMemory(FS_NAME_MAX + 1);
+        if (!D->LongName) return FALSE;
+        D->Name = D->LongName;
+    } else {
+        D->Name = D->InlineName;
+    }
+    memcpy(D->Name, Name, Length);
+    D->Name[Length] = '\0';
+    D->NameLength = (UINT16)Length;
+    D->Parent = Parent;
+    D->Volume = Parent->Volume;
+    D->Node = Node;
+    D->Mounted = 0;
+    D->Cache = NULL;
+    D->Hash = Hash;
+    D->Flags = Flags | FS_DENTRY_HASHED;
+    D->LruPrev = D->LruNext = NULL;
+    FsDentryGetLocked(Parent);
+
+    D->HashNext = g_DcacheHash[Hash & (FS_DCACHE_BUCKETS - 1)];
+    HalMemoryBarrier(); /* fields before the link that publishes them */
+    D->RefCount = 1;
+    g_DcacheHash[Hash & (FS_DCACHE_BUCKETS - 1)] = D;
+    g_DcacheStats.Dentries++;
+    if (Flags & FS_DENTRY_NEGATIVE) g_DcacheStats.Negative++;
+    return TRUE;
+}
+
+/* ---------------------------------------------------------------------------
+ * Walks
+ * --------------------------------------------------------------------------- */
+
+/* Next component of Path; returns FALSE at the end */
+static BOOL FsNextComponent(PCSTR* Path, PCSTR* Name, PUINT32 Length)
+{
+    PCSTR p = *Path;
+    while (*p == '/' || *p == '\\') p++;
+    if (!*p) {
+        *Path = p;
+        return FALSE;
+    }
+    *Name = p;
+    while (*p && *p != '/' && *p != '\\') p++;
+    *Length = (UINT32)(p - *Name);
+    *Path = p;
+    return TRUE;
+}
+
+/* Step onto whatever is mounted on *D; no references, caller revalidates */
+static BOOL FsDcacheCrossFast(PFS_MOUNT* Mount, PFS_DENTRY* D)
+{
+    for (UINT32 depth = 0; (*D)->Mounted; depth++) {
+        PFS_MOUNT m = FsMountLookup(*Mount, *D);
+        if (!m) break;
+        if (!m->Root || depth >= 64) return FALSE;
+        *Mount = m;
+        *D = m->Root;
+    }
+    return TRUE;
+}
+
+static NTSTATUS FsDcacheWalkFast(PCSTR Path, PFS_MOUNT* OutMount, PFS_DENTRY* Out)
+{
+    PFS_MOUNT mnt = FsMountRoot();
+    PFS_DENTRY cur;
+    PCSTR name;
+    UINT32 len;
+    UINT32 seq = g_DcacheSeq;
+    if (seq & 1) return FS_WALK_RETRY;
+    HalMemoryBarrier();
+
+    cur = mnt->Root;
+    if (!FsDcacheCrossFast(&mnt, &cur)) return FS_WALK_RETRY;
+    while (FsNextComponent(&Path, &name, &len)) {
+        if (len == 1 && name[0] == '.') continue;
+        if (len == 2 && name[0] == '.' && name[1] == '.') {
+            for (UINT32 depth = 0; cur == mnt->Root && mnt->Parent; depth++) {
+                if (depth >= 64) return FS_WALK_RETRY;
+                cur = mnt->Mountpoint;
+                mnt = mnt->Parent;
+                if (!cur || !mnt) return FS_WALK_RETRY;
+            }
+            cur = cur->Parent;
+            if (!cur || !FsDcacheCrossFast(&mnt, &cur)) return FS_WALK_RETRY;
+            continue;
+        }
+        if (len > FS_NAME_MAX) return FS_WALK_RETRY;
+        PFS_DENTRY child = FsDcacheFind(cur, name, len, FsDcacheHashName(cur, name, len));
+        if (!child) return FS_WALK_RETRY;
+        if (child->Flags & FS_DENTRY_NEGATIVE) {
+            HalMemoryBarrier();
+            return g_DcacheSeq == seq ? STATUS_OBJECT_NAME_NOT_FOUND : FS_WALK_RETRY;
+        }
+        cur = child;
+        if (!FsDcacheCrossFast(&mnt, &cur)) return FS_WALK_RETRY;
+    }
+    /* The mount reference comes first: an unmount that sees it stays busy */
+    if (!FsMountTryGet(mnt)) return FS_WALK_RETRY;
+    if (!FsDentryTryGet(cur)) {
+        FsMountPut(mnt);
+        return FS_WALK_RETRY;
+    }
+    HalMemoryBarrier();
+    if (g_DcacheSeq != seq || cur->Volume != mnt->Volume) {
+        FsDentryPut(cur);
+        FsMountPut(mnt);
+        return FS_WALK_RETRY;
+    }
+    *OutMount = mnt;
+    *Out = cur;
+    return STATUS_SUCCESS;
+}
+
+static BOOL FsIsNotFound(NTSTATUS Status)
+{
+    return Status == STATUS_OBJECT_NAME_NOT_FOUND || Status == STATUS_NOT_FOUND;
+}
+
+/* Referenced counterpart of FsDcacheCrossFast; swaps the caller's references */
+static void FsDcacheCrossLocked(PFS_MOUNT* Mount, PFS_DENTRY* D)
+{
+    while ((*D)->Mounted) {
+        PFS_MOUNT m = FsMountLookup(*Mount, *D);
+        if (!m) break;
+        FsMountGet(m);
+        FsDentryGetLocked(m->Root);
+        FsDentryPutLocked(*D);
+        FsMountPut(*Mount);
+        *Mount = m;
+        *D = m->Root;
+    }
+}
+
+static void FsDcacheDropWalk(PFS_MOUNT Mount, PFS_DENTRY D)
+{
+    FsDentryPut(D);
+    FsMountPut(Mount);
+}
+
+/* Reference-counted walk under the lock; the lock is dropped around driver lookups */
+static NTSTATUS FsDcacheWalkLocked(PCSTR Path, UINT32 WalkFlags, PFS_MOUNT* OutMount, PFS_DENTRY* Out)
+{
+    PFS_MOUNT mnt = FsMountRoot();
+    PFS_DENTRY cur = mnt->Root;
+    PCSTR name;
+    UINT32 len;
+    AURORA_IRQL irql;
+
+    AuroraAcquireSpinLock(&g_DcacheLock, &irql);
+    FsMountGet(mnt);
+    FsDentryGetLocked(cur);
+    FsDcacheCrossLocked(&mnt, &cur);
+    AuroraReleaseSpinLock(&g_DcacheLock, irql);
+
+    while (FsNextComponent(&Path, &name, &len)) {
+        PFS_VOLUME vol = cur->Volume;
+        PFS_DRIVER drv = vol->Driver;
+        PFS_DENTRY child;
+        PVOID node = NULL;
+        UINT32 nodeFlags = 0, flags = 0;
+        UINT32 hash;
+
+        if (len == 1 && name[0] == '.') continue;
+        if (len == 2 && name[0] == '.' && name[1] == '.') {
+            AuroraAcquireSpinLock(&g_DcacheLock, &irql);
+            while (cur == mnt->Root && mnt->Parent) {
+                child = mnt->Mountpoint;
+                FsMountGet(mnt->Parent);
+                FsDentryGetLocked(child);
+                FsDentryPutLocked(cur);
+                FsMountPut(mnt);
+                mnt = mnt->Parent;
+                cur = child;
+            }
+            child = cur->Parent;
+            FsDentryGetLocked(child);
+            FsDentryPutLocked(cur);
+            cur = child;
+            FsDcacheCrossLocked(&mnt, &cur);
+            AuroraReleaseSpinLock(&g_DcacheLock, irql);
+            continue;
+        }
+        if (len > FS_NAME_MAX) {
+            FsDcacheDropWalk(mnt, cur);
+            return STATUS_OBJECT_NAME_NOT_FOUND;
+        }
+        if ((cur->Flags & (FS_DENTRY_RESOLVED | FS_DENTRY_ROOT)) && !(cur->Flags & FS_DENTRY_DIRECTORY)) {
+            FsDcacheDropWalk(mnt, cur);
+            return STATUS_NOT_A_DIRECTORY;
+        }
+
+        hash = FsDcacheHashName(cur, name, len);
+        AuroraAcquireSpinLock(&g_DcacheLock, &irql);
+        child = FsDcacheFind(cur, name, len, hash);
+        if (child) FsDentryGetLocked(child);
+        AuroraReleaseSpinLock(&g_DcacheLock, irql);
+
+        if (!child) {
+            if (!drv) {
+                /* The root namespace only holds directories made for mountpoints */
+                if (!(WalkFlags & FS_WALK_CREATE)) {
+                    FsDcacheDropWalk(mnt, cur);
+                    return STATUS_OBJECT_NAME_NOT_FOUND;
+                }
+                flags = FS_DENTRY_RESOLVED | FS_DENTRY_DIRECTORY;
+            } else if (drv->Ops.Lookup) {
+                NTSTATUS st = drv->Ops.Lookup(vol->VolumeData, cur->Node, name, len, &node, &nodeFlags);
+                g_DcacheStats.DriverLookups++;
+                if (FsIsNotFound(st)) {
+                    flags = FS_DENTRY_NEGATIVE;
+                    node = NULL;
+                } else if (!NT_SUCCESS(st)) {
+                    FsDcacheDropWalk(mnt, cur);
+                    return st;
+                } else {
+                    flags = FS_DENTRY_RESOLVED | ((nodeFlags & FS_NODE_DIRECTORY) ? FS_DENTRY_DIRECTORY : 0);
+                }
+            }
+
+            AuroraAcquireSpinLock(&g_DcacheLock, &irql);
+            child = FsDcacheFind(cur, name, len, hash); /* lost a race with another walker? */
+            if (child) {
+                FsDentryGetLocked(child);
+            } else {
+                child = FsDcacheAllocLocked();
+                if (child && !FsDcacheInsertLocked(child, cur, name, len, hash, node, flags)) {
+                    FsDcacheFreeLocked(child);
+                    child = NULL;
+                }
+                if (child) node = NULL; /* now owned by the dentry */
+            }
+            if (node && drv && drv->Ops.ReleaseNode) drv->Ops.ReleaseNode(vol->VolumeData, node);
+            AuroraReleaseSpinLock(&g_DcacheLock, irql);
+            if (!child) {
+                FsDcacheDropWalk(mnt, cur);
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+        }
+
+        AuroraAcquireSpinLock(&g_DcacheLock, &irql);
+        FsDentryPutLocked(cur);
+        cur = child;
+        if (!(cur->Flags & FS_DENTRY_NEGATIVE)) FsDcacheCrossLocked(&mnt, &cur);
+        AuroraReleaseSpinLock(&g_DcacheLock, irql);
+        if (cur->Flags & FS_DENTRY_NEGATIVE) {
+            FsDcacheDropWalk(mnt, cur);
+            return STATUS_OBJECT_NAME_NOT_FOUND;
+        }
+    }
+    *OutMount = mnt;
+    *Out = cur;
+    return STATUS_SUCCESS;
+}
+
+/* Resolve an absolute Path in the namespace tree. Returns a referenced mount
+ * and dentry, or STATUS_OBJECT_NAME_NOT_FOUND when a component is known not
+ * to exist. */
+NTSTATUS FsDcacheWalk(IN PCSTR Path, IN UINT32 Flags, OUT PFS_MOUNT* Mount, OUT PFS_DENTRY* Dentry)
+{
+    NTSTATUS st;
+    if (!Path || !Mount || !Dentry) return STATUS_INVALID_PARAMETER;
+    st = FsDcacheWalkFast(Path, Mount, Dentry);
+    if (st != FS_WALK_RETRY) {
+        g_DcacheStats.FastWalks++;
+        if (st == STATUS_OBJECT_NAME_NOT_FOUND) g_DcacheStats.NegativeHits++;
+        return st;
+    }
+    g_DcacheStats.SlowWalks++;
+    return FsDcacheWalkLocked(Path, Flags, Mount, Dentry);
+}
+
+/* Volume-relative path of a referenced dentry, for drivers without Lookup.
+ * Parent links of a referenced dentry are pinned, so no lock is needed. */
+NTSTATUS FsDcacheBuildPath(IN PFS_DENTRY Dentry, OUT PCHAR Buffer, IN UINT32 Size)
+{
+    UINT32 total = 0, pos;
+    PFS_DENTRY d;
+    if (!Dentry || !Buffer || Size < 2) return STATUS_INVALID_PARAMETER;
+    for (d = Dentry; !(d->Flags & FS_DENTRY_ROOT); d = d->Parent) total += d->NameLength + 1;
+    if (total == 0) {
+        Buffer[0] = '/';
+        Buffer[1] = '\0';
+        return STATUS_SUCCESS;
+    }
+    if (total + 1 > Size) return STATUS_NAME_TOO_LONG;
+    Buffer[total] = '\0';
+    pos = total;
+    for (d = Dentry; !(d->Flags & FS_DENTRY_ROOT); d = d->Parent) {
+        pos -= d->NameLength;
+        memcpy(Buffer + pos, d->Name, d->NameLength);
+        Buffer[--pos] = '/';
+    }
+    return STATUS_SUCCESS;
+}
+
+/* The driver reported the name missing after an unresolved walk */
+void FsDcacheMarkNegative(IN PFS_DENTRY Dentry)
+{
+    AURORA_IRQL irql;
+    if (!Dentry || (Dentry->Flags & (FS_DENTRY_ROOT | FS_DENTRY_NEGATIVE)) || Dentry->Mounted) return;
+    AuroraAcquireSpinLock(&g_DcacheLock, &irql);
+    FsDcacheWriteBegin();
+    Dentry->Flags |= FS_DENTRY_NEGATIVE;
+    FsDcacheWriteEnd();
+    if (Dentry->Flags & FS_DENTRY_HASHED) g_DcacheStats.Negative++;
+    AuroraReleaseSpinLock(&g_DcacheLock, irql);
+}
+
+/* The driver created Name in Parent: revive a negative dentry for it or
+ * cache the name. Takes over the driver's reference on Node. */
+void FsDcacheInstantiate(IN PFS_DENTRY Parent, IN PCSTR Name, IN UINT32 Length, IN PVOID Node, IN UINT32 NodeFlags)
+{
+    PFS_VOLUME vol = Parent->Volume;
+    PFS_DRIVER drv = vol->Driver;
+    UINT32 hash = FsDcacheHashName(Parent, Name, Length);
+    UINT32 flags = FS_DENTRY_RESOLVED | ((NodeFlags & FS_NODE_DIRECTORY) ? FS_DENTRY_DIRECTORY : 0);
+    PFS_DENTRY child;
+    AURORA_IRQL irql;
+
+    AuroraAcquireSpinLock(&g_DcacheLock, &irql);
+    child = FsDcacheFind(Parent, Name, Length, hash);
+    if (child && (child->Flags & FS_DENTRY_NEGATIVE)) {
+        /* A removed name keeps its old node until now */
+        PVOID old = child->Node;
+        FsDcacheWriteBegin();
+        child->Node = Node;
+        child->Flags = (child->Flags & ~FS_DENTRY_NEGATIVE) | flags;
+        FsDcacheWriteEnd();
+        g_DcacheStats.Negative--;
+        Node = old;
+    } else if (!child) {
+        child = FsDcacheAllocLocked();
+        if (child && FsDcacheInsertLocked(child, Parent, Name, Length, hash, Node, flags)) {
+            Node = NULL;
+            FsDentryPutLocked(child);
+        } else if (child) {
+            FsDcacheFreeLocked(child);
+        }
+    }
+    if (Node && drv && drv->Ops.ReleaseNode) drv->Ops.ReleaseNode(vol->VolumeData, Node);
+    AuroraReleaseSpinLock(&g_DcacheLock, irql);
+}
+
+/* The driver removed the name of a referenced dentry. The node stays with
+ * the now negative dentry until it is revived or recycled, since walkers
+ * that got the dentry before the removal may still open it. */
+void FsDcacheRemoved(IN PFS_DENTRY Dentry)
+{
+    AURORA_IRQL irql;
+    AuroraAcquireSpinLock(&g_DcacheLock, &irql);
+    FsDcacheWriteBegin();
+    Dentry->Flags = (Dentry->Flags & ~(FS_DENTRY_RESOLVED | FS_DENTRY_DIRECTORY)) | FS_DENTRY_NEGATIVE;
+    FsDcacheWriteEnd();
+    if (Dentry->Flags & FS_DENTRY_HASHED) g_DcacheStats.Negative++;
+    /* Callers refuse removal while the cache is open */
+    FsPageCacheDestroy(Dentry->Cache);
+    Dentry->Cache = NULL;
+    AuroraReleaseSpinLock(&g_DcacheLock, irql);
+}
+
+/* ---------------------------------------------------------------------------
+ * Volume lifetime
+ * --------------------------------------------------------------------------- */
+
+NTSTATUS FsDcacheCreateVolume(IN PFS_DRIVER Driver, IN PVOID VolumeData, OUT PFS_VOLUME* Volume)
+{
+    AURORA_IRQL irql;
+    PFS_DENTRY root;
+    PFS_VOLUME vol;
+    if (!Volume) return STATUS_INVALID_PARAMETER;
+    vol = (PFS_VOLUME)AuroraAllocateMemory(sizeof(FS_VOLUME));
+    if (!vol) return STATUS_INSUFFICIENT_RESOURCES;
+    memset(vol, 0, sizeof(*vol));
+    vol->Driver = Driver;
+    vol->VolumeData = VolumeData;
+
+    AuroraAcquireSpinLock(&g_DcacheLock, &irql);
+    root = FsDcacheAllocLocked();
+    if (root) {
+        root->Name = root->InlineName;
+        root->InlineName[0] = '\0';
+        root->NameLength = 0;
+        root->Parent = root;
+        root->Volume = vol;
+        root->Node = NULL;
+        root->Mounted = 0;
+        root->Cache = NULL;
+        root->Flags = FS_DENTRY_ROOT | FS_DENTRY_DIRECTORY;
+        root->HashNext = NULL;
+        root->RefCount = 1; /* held by the volume */
+        vol->Root = root;
+    }
+    AuroraReleaseSpinLock(&g_DcacheLock, irql);
+    if (!root) {
+        AuroraFreeMemory(vol);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    *Volume = vol;
+    return STATUS_SUCCESS;
+}
+
+/* Tear down every dentry of a volume no longer mounted anywhere. Each hashed
+ * dentry holds exactly one reference on its parent and the volume holds one
+ * on the root, so any count beyond that is an open handle or a walk in
+ * flight. */
+NTSTATUS FsDcacheReleaseVolume(IN PFS_VOLUME Volume)
+{
+    AURORA_IRQL irql;
+    UINT64 refs, dentries = 0;
+    if (!Volume || !Volume->Root) return STATUS_SUCCESS;
+
+    AuroraAcquireSpinLock(&g_DcacheLock, &irql);
+    if (Volume->MountCount) {
+        AuroraReleaseSpinLock(&g_DcacheLock, irql);
+        return STATUS_DEVICE_BUSY;
+    }
+    refs = Volume->Root->RefCount;
+    for (UINT32 b = 0; b < FS_DCACHE_BUCKETS; b++) {
+        for (PFS_DENTRY d = g_DcacheHash[b]; d; d = d->HashNext) {
+            if (d->Volume != Volume) continue;
+            refs += d->RefCount;
+            dentries++;
+        }
+    }
+    if (refs != dentries + 1) {
+        AuroraReleaseSpinLock(&g_DcacheLock, irql);
+        return STATUS_DEVICE_BUSY;
+    }
+
+    FsDcacheWriteBegin();
+    for (UINT32 b = 0; b < FS_DCACHE_BUCKETS; b++) {
+        PFS_DENTRY* link = &g_DcacheHash[b];
+        while (*link) {
+            PFS_DENTRY d = *link;
+            if (d->Volume != Volume) {
+                link = &d->HashNext;
+                continue;
+            }
+            *link = d->HashNext;
+            d->Flags &= ~FS_DENTRY_HASHED;
+            g_DcacheStats.Dentries--;
+            if (d->Flags & FS_DENTRY_NEGATIVE) g_DcacheStats.Negative--;
+            FsLruUnlink(d);
+            if (d->Node && Volume->Driver && Volume->Driver->Ops.ReleaseNode) Volume->Driver->Ops.ReleaseNode(Volume->VolumeData, d->Node);
+            d->Node = NULL;
+            FsPageCacheDestroy(d->Cache);
+            d->Cache = NULL;
+            d->Parent = NULL;
+            FsDcacheFreeLocked(d);
+        }
+    }
+    FsDcacheWriteEnd();
+    Volume->Root->Parent = NULL;
+    FsPageCacheDestroy(Volume->Root->Cache);
+    Volume->Root->Cache = NULL;
+    FsDcacheFreeLocked(Volume->Root);
+    Volume->Root = NULL;
+    AuroraReleaseSpinLock(&g_DcacheLock, irql);
+    AuroraFreeMemory(Volume);
+    return STATUS_SUCCESS;
+}
+
+void FsDcacheQueryStats(OUT PFS_DCACHE_STATS Stats)
+{
+    if (Stats) *Stats = g_DcacheStats;
+}
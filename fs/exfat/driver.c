@@ -1,21 +1,1401 @@
-/* exFAT driver enhanced stub */
+/*
+ * Aurora Kernel - exFAT file system driver
+ *
+ * Streams flagged NoFatChain are contiguous: offsets map to clusters
+ * arithmetically and the FAT is never consulted, which is the common case
+ * for large media files. Fragmented streams fall back to an extent list
+ * built from the FAT once per open.
+ *
+ * Free space comes from the allocation bitmap, held in memory with per-sector
+ * dirty bits and searched next-fit from a hint. Directory entry sets are
+ * parsed once per directory into a small LRU of caches; each cached set keeps
+ * the stream extension's NameHash, so a lookup compares 16-bit hashes and
+ * only does the up-cased name compare on a hash match.
+ */
 #include "../../aurora.h"
 #include "../../include/kern.h"
 #include "../../include/fs.h"
+#include "../../include/io.h"
+#include "../../include/mem.h"
 
-typedef struct _EXFAT_VOLUME { UINT32 Dummy; } EXFAT_VOLUME, *PEXFAT_VOLUME;
+#define EXFAT_FIRST_CLUSTER     2
+#define EXFAT_BAD_CLUSTER       0xFFFFFFF7
+#define EXFAT_EOC               0xFFFFFFFF
+
+#define EXFAT_ENTRY_SIZE        32
+#define EXFAT_TYPE_END          0x00
+#define EXFAT_TYPE_IN_USE       0x80
+#define EXFAT_TYPE_SECONDARY    0x40
+#define EXFAT_TYPE_BITMAP       0x81
+#define EXFAT_TYPE_UPCASE       0x82
+#define EXFAT_TYPE_FILE         0x85
+#define EXFAT_TYPE_STREAM       0xC0
+#define EXFAT_TYPE_NAME         0xC1
+
+#define EXFAT_ATTR_READ_ONLY    0x0001
+#define EXFAT_ATTR_DIRECTORY    0x0010
+#define EXFAT_ATTR_ARCHIVE      0x0020
+
+#define EXFAT_FLAG_ALLOC_POSSIBLE 0x01
+#define EXFAT_FLAG_NO_FAT_CHAIN   0x02
+
+#define EXFAT_VOLUME_DIRTY      0x0002
+#define EXFAT_ACTIVE_FAT        0x0001
+
+#define EXFAT_NAME_MAX          255
+#define EXFAT_NAME_PER_ENTRY    15
+#define EXFAT_MAX_SECONDARY     18      /* stream + 17 name entries */
+#define EXFAT_DIR_CACHE_SLOTS   16
+#define EXFAT_FAT_CACHE_SLOTS   32
+#define EXFAT_SLOT_EMPTY        0xFFFFFFFF
+#define EXFAT_EXTENTS_INITIAL   8
+
+#pragma pack(push,1)
+typedef struct _EXFAT_BOOT_SECTOR {
+    UINT8  JumpBoot[3];
+    CHAR   FileSystemName[8];
+    UINT8  MustBeZero[53];
+    UINT64 PartitionOffset;
+    UINT64 VolumeLength;
+    UINT32 FatOffset;
+    UINT32 FatLength;
+    UINT32 ClusterHeapOffset;
+    UINT32 ClusterCount;
+    UINT32 RootCluster;
+    UINT32 VolumeSerialNumber;
+    UINT16 FileSystemRevision;
+    UINT16 VolumeFlags;
+    UINT8  BytesPerSectorShift;
+    UINT8  SectorsPerClusterShift;
+    UINT8  NumberOfFats;
+    UINT8  DriveSelect;
+    UINT8  PercentInUse;
+    UINT8  Reserved[7];
+} EXFAT_BOOT_SECTOR, *PEXFAT_BOOT_SECTOR;
+
+typedef struct _EXFAT_FILE_ENTRY {
+    UINT8  Type;
+    UINT8  SecondaryCount;
+    UINT16 SetChecksum;
+    UINT16 Attributes;
+    UINT16 Reserved1;
+    UINT32 CreateTimestamp;
+    UINT32 ModifyTimestamp;
+    UINT32 AccessTimestamp;
+    UINT8  Create10ms;
+    UINT8  Modify10ms;
+    UINT8  CreateUtcOffset;
+    UINT8  ModifyUtcOffset;
+    UINT8  AccessUtcOffset;
+    UINT8  Reserved2[7];
+} EXFAT_FILE_ENTRY, *PEXFAT_FILE_ENTRY;
+
+typedef struct _EXFAT_STREAM_ENTRY {
+    UINT8  Type;
+    UINT8  Flags;
+    UINT8  Reserved1;
+    UINT8  NameLength;
+    UINT16 NameHash;
+    UINT16 Reserved2;
+    UINT64 ValidDataLength;
+    UINT32 Reserved3;
+    UINT32 FirstCluster;
+    UINT64 DataLength;
+} EXFAT_STREAM_ENTRY, *PEXFAT_STREAM_ENTRY;
+
+typedef struct _EXFAT_NAME_ENTRY {
+    UINT8  Type;
+    UINT8  Flags;
+    UINT16 Name[EXFAT_NAME_PER_ENTRY];
+} EXFAT_NAME_ENTRY, *PEXFAT_NAME_ENTRY;
+
+/* Allocation bitmap (0x81) and up-case table (0x82) share this layout */
+typedef struct _EXFAT_META_ENTRY {
+    UINT8  Type;
+    UINT8  Flags;
+    UINT8  Reserved1[2];
+    UINT32 TableChecksum;
+    UINT8  Reserved2[12];
+    UINT32 FirstCluster;
+    UINT64 DataLength;
+} EXFAT_META_ENTRY, *PEXFAT_META_ENTRY;
+#pragma pack(pop)
+
+typedef struct _EXFAT_EXTENT {
+    UINT32 FileCluster;
+    UINT32 Cluster;
+    UINT32 Length;
+} EXFAT_EXTENT, *PEXFAT_EXTENT;
+
+/* Cluster mapping of one stream (file, directory or metadata file) */
+typedef struct _EXFAT_STREAM {
+    UINT32 FirstCluster;
+    BOOL   NoFatChain;      /* contiguous: cluster = FirstCluster + index */
+    UINT32 Clusters;        /* allocated clusters */
+    PEXFAT_EXTENT Runs;     /* FAT-chained streams only, built on first use */
+    UINT32 RunCount;
+    UINT32 RunCapacity;
+    BOOL   RunsBuilt;
+} EXFAT_STREAM, *PEXFAT_STREAM;
+
+/* One parsed entry set, as kept in a directory cache */
+typedef struct _EXFAT_CACHED_SET {
+    UINT16 NameHash;
+    UINT8  NameLength;
+    UINT8  SecondaryCount;
+    UINT16 Attributes;
+    UINT8  StreamFlags;
+    UINT32 FirstCluster;
+    UINT64 DataLength;
+    UINT64 ValidDataLength;
+    UINT64 SetOffset;       /* byte offset of the file entry in the directory */
+    UINT32 NameIndex;       /* into the cache's name pool */
+} EXFAT_CACHED_SET, *PEXFAT_CACHED_SET;
+
+typedef struct _EXFAT_DIR_CACHE {
+    UINT32 DirCluster;      /* 0 = slot unused */
+    UINT32 LastUse;
+    PEXFAT_CACHED_SET Sets;
+    UINT32 Count;
+    UINT32 Capacity;
+    UINT16* Names;
+    UINT32 NamesUsed;
+    UINT32 NamesCapacity;
+} EXFAT_DIR_CACHE, *PEXFAT_DIR_CACHE;
+
+typedef struct _EXFAT_VOLUME {
+    PAIO_DEVICE_OBJECT Device;
+    UINT32 BlocksPerSector;
+    UINT32 BytesPerSector;
+    UINT32 SectorShift;
+    UINT32 SectorsPerCluster;
+    UINT32 BytesPerCluster;
+    UINT32 ClusterShift;
+    UINT32 FatOffset;       /* sector of the active FAT */
+    UINT32 FatLength;
+    UINT32 HeapOffset;
+    UINT32 ClusterCount;
+    UINT32 RootCluster;
+    UINT16 VolumeFlags;
+    BOOL   ReadOnly;
+    BOOL   MarkedDirty;     /* VolumeDirty set on disk by this mount */
+    /* FAT sector cache (only FAT-chained streams touch it) */
+    UINT8*  FatCache;
+    UINT32  FatSlot[EXFAT_FAT_CACHE_SLOTS];
+    BOOL    FatDirty[EXFAT_FAT_CACHE_SLOTS];
+    /* Allocation bitmap */
+    EXFAT_STREAM BitmapStream;
+    UINT8*  Bitmap;
+    UINT32  BitmapBytes;    /* rounded up to whole sectors */
+    UINT32* BitmapDirty;    /* one bit per bitmap sector */
+    UINT32  NextFree;       /* next-fit hint (cluster number) */
+    UINT32  FreeCount;
+    /* Names */
+    UINT16* UpCase;         /* 65536 entries, NULL = ASCII folding only */
+    /* Directory entry-set caches */
+    EXFAT_DIR_CACHE DirCache[EXFAT_DIR_CACHE_SLOTS];
+    UINT32 CacheClock;
+    UINT8* Scratch;         /* one sector */
+    UINT8* DirBuffer;       /* one cluster */
+    AURORA_SPINLOCK Lock;
+} EXFAT_VOLUME, *PEXFAT_VOLUME;
+
+typedef struct _EXFAT_FILE {
+    PEXFAT_VOLUME Volume;
+    EXFAT_STREAM Stream;
+    UINT64 Size;
+    UINT64 ValidSize;       /* bytes past this read as zeros */
+    UINT16 Attributes;
+    BOOL   Modified;
+    UINT64 Position;
+    EXFAT_STREAM Parent;    /* directory holding the entry set (unused for the root) */
+    UINT32 ParentCluster;
+    UINT64 SetOffset;
+    UINT8  SecondaryCount;
+    BOOL   IsRoot;
+} EXFAT_FILE, *PEXFAT_FILE;
+
+/* Receives each entry set (or lone primary entry) of a directory; TRUE stops the scan */
+typedef BOOL (*PEXFAT_SET_VISITOR)(IN PEXFAT_VOLUME Vol, IN UINT8* Entries, IN UINT32 Count, IN UINT64 Offset, IN PVOID Context);
+
+static PVOID ExfatAllocate(UINT32 Size)
+{
+    PVOID p;
+    if (Size >= 4096) {
+        p = MemAllocPages((Size + 4095) / 4096);
+        if (p) {
+            memset(p, 0, Size);
+            return p;
+        }
+    }
+    p = AuroraAllocateMemory(Size);
+    if (p) memset(p, 0, Size);
+    return p;
+}
+
+/* ---------------------------------------------------------------------------
+ * Sector I/O and the FAT
+ * --------------------------------------------------------------------------- */
+
+static NTSTATUS ExfatReadSectors(PEXFAT_VOLUME Vol, UINT32 Sector, UINT32 Count, PVOID Buffer)
+{
+    return BlockRead(Vol->Device, (UINT64)Sector * Vol->BlocksPerSector, Count * Vol->BlocksPerSector, Buffer);
+}
+
+static NTSTATUS ExfatWriteSectors(PEXFAT_VOLUME Vol, UINT32 Sector, UINT32 Count, PVOID Buffer)
+{
+    if (Vol->ReadOnly) return STATUS_MEDIA_WRITE_PROTECTED;
+    return BlockWrite(Vol->Device, (UINT64)Sector * Vol->BlocksPerSector, Count * Vol->BlocksPerSector, Buffer);
+}
+
+static UINT32 ExfatClusterToSector(PEXFAT_VOLUME Vol, UINT32 Cluster)
+{
+    return Vol->HeapOffset + ((Cluster - EXFAT_FIRST_CLUSTER) << (Vol->ClusterShift - Vol->SectorShift));
+}
+
+static BOOL ExfatIsDataCluster(PEXFAT_VOLUME Vol, UINT32 Cluster)
+{
+    return Cluster >= EXFAT_FIRST_CLUSTER && Cluster < Vol->ClusterCount + EXFAT_FIRST_CLUSTER;
+}
+
+static NTSTATUS ExfatFatSlot(PEXFAT_VOLUME Vol, UINT32 Cluster, PUINT32* Entry, PUINT32 Slot)
+{
+    UINT32 perSector = Vol->BytesPerSector / 4;
+    UINT32 sector = Cluster / perSector;
+    UINT32 slot = sector % EXFAT_FAT_CACHE_SLOTS;
+    UINT8* buf = Vol->FatCache + slot * Vol->BytesPerSector;
+    NTSTATUS st;
+
+    if (sector >= Vol->FatLength) return STATUS_DISK_CORRUPT_ERROR;
+    if (Vol->FatSlot[slot] != sector) {
+        if (Vol->FatSlot[slot] != EXFAT_SLOT_EMPTY && Vol->FatDirty[slot]) {
+            st = ExfatWriteSectors(Vol, Vol->FatOffset + Vol->FatSlot[slot], 1, buf);
+            if (!NT_SUCCESS(st)) return st;
+            Vol->FatDirty[slot] = FALSE;
+        }
+        Vol->FatSlot[slot] = EXFAT_SLOT_EMPTY;
+        st = ExfatReadSectors(Vol, Vol->FatOffset + sector, 1, buf);
+        if (!NT_SUCCESS(st)) return st;
+        Vol->FatSlot[slot] = sector;
+    }
+    *Entry = (PUINT32)buf + Cluster % perSector;
+    *Slot = slot;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS ExfatGetFat(PEXFAT_VOLUME Vol, UINT32 Cluster, PUINT32 Value)
+{
+    PUINT32 entry;
+    UINT32 slot;
+    NTSTATUS st = ExfatFatSlot(Vol, Cluster, &entry, &slot);
+    if (NT_SUCCESS(st)) *Value = *entry;
+    return st;
+}
+
+static NTSTATUS ExfatSetFat(PEXFAT_VOLUME Vol, UINT32 Cluster, UINT32 Value)
+{
+    PUINT32 entry;
+    UINT32 slot;
+    NTSTATUS st = ExfatFatSlot(Vol, Cluster, &entry, &slot);
+    if (!NT_SUCCESS(st)) return st;
+    *entry = Value;
+    Vol->FatDirty[slot] = TRUE;
+    return STATUS_SUCCESS;
+}
+
+/* ---------------------------------------------------------------------------
+ * Stream mapping
+ * --------------------------------------------------------------------------- */
+
+static NTSTATUS ExfatAppendRun(PEXFAT_STREAM S, UINT32 Cluster)
+{
+    UINT32 index = S->Clusters;
+    if (S->RunCount) {
+        PEXFAT_EXTENT last = &S->Runs[S->RunCount - 1];
+        if (last->Cluster + last->Length == Cluster) {
+            last->Length++;
+            return STATUS_SUCCESS;
+        }
+        index = last->FileCluster + last->Length;
+    } else {
+        index = 0;
+    }
+    if (S->RunCount == S->RunCapacity) {
+        UINT32 capacity = S->RunCapacity ? S->RunCapacity * 2 : EXFAT_EXTENTS_INITIAL;
+        PEXFAT_EXTENT runs = (PEXFAT_EXTENT)AuroraAllocateMemory(capacity * sizeof(EXFAT_EXTENT));
+        if (!runs) return STATUS_INSUFFICIENT_RESOURCES;
+        if (S->RunCount) memcpy(runs, S->Runs, S->RunCount * sizeof(EXFAT_EXTENT));
+        if (S->Runs) AuroraFreeMemory(S->Runs);
+        S->Runs = runs;
+        S->RunCapacity = capacity;
+    }
+    S->Runs[S->RunCount].FileCluster = index;
+    S->Runs[S->RunCount].Cluster = Cluster;
+    S->Runs[S->RunCount].Length = 1;
+    S->RunCount++;
+    return STATUS_SUCCESS;
+}
+
+/* Walk the FAT chain once. Clusters == 0 means "until end of chain". */
+static NTSTATUS ExfatBuildRuns(PEXFAT_VOLUME Vol, PEXFAT_STREAM S)
+{
+    UINT32 cluster = S->FirstCluster, count = 0;
+    S->RunCount = 0;
+    while (cluster != EXFAT_EOC && (S->Clusters == 0 || count < S->Clusters)) {
+        if (!ExfatIsDataCluster(Vol, cluster) || count >= Vol->ClusterCount) return STATUS_DISK_CORRUPT_ERROR;
+        NTSTATUS st = ExfatAppendRun(S, cluster);
+        if (!NT_SUCCESS(st)) return st;
+        count++;
+        st = ExfatGetFat(Vol, cluster, &cluster);
+        if (!NT_SUCCESS(st)) return st;
+        if (cluster == EXFAT_BAD_CLUSTER) return STATUS_DISK_CORRUPT_ERROR;
+    }
+    if (S->Clusters && count < S->Clusters) return STATUS_DISK_CORRUPT_ERROR;
+    S->Clusters = count;
+    S->RunsBuilt = TRUE;
+    return STATUS_SUCCESS;
+}
+
+static void ExfatReleaseStream(PEXFAT_STREAM S)
+{
+    if (S->Runs) AuroraFreeMemory(S->Runs);
+    S->Runs = NULL;
+    S->RunCount = S->RunCapacity = 0;
+    S->RunsBuilt = FALSE;
+}
+
+/* Map stream cluster Vcn; RunLeft receives how many clusters stay contiguous from there */
+static NTSTATUS ExfatMap(PEXFAT_VOLUME Vol, PEXFAT_STREAM S, UINT32 Vcn, PUINT32 Cluster, PUINT32 RunLeft)
+{
+    if (S->NoFatChain) {
+        if (Vcn >= S->Clusters) return STATUS_DISK_CORRUPT_ERROR;
+        *Cluster = S->FirstCluster + Vcn;
+        *RunLeft = S->Clusters - Vcn;
+        return STATUS_SUCCESS;
+    }
+    if (!S->RunsBuilt) {
+        NTSTATUS st = ExfatBuildRuns(Vol, S);
+        if (!NT_SUCCESS(st)) return st;
+    }
+    UINT32 lo = 0, hi = S->RunCount;
+    while (lo < hi) {
+        UINT32 mid = lo + (hi - lo) / 2;
+        PEXFAT_EXTENT run = &S->Runs[mid];
+        if (Vcn < run->FileCluster) hi = mid;
+        else if (Vcn >= run->FileCluster + run->Length) lo = mid + 1;
+        else {
+            *Cluster = run->Cluster + (Vcn - run->FileCluster);
+            *RunLeft = run->Length - (Vcn - run->FileCluster);
+            return STATUS_SUCCESS;
+        }
+    }
+    return STATUS_DISK_CORRUPT_ERROR;
+}
+
+/* Move Length bytes at stream Offset, whole sectors directly and one request per contiguous run */
+static NTSTATUS ExfatTransfer(PEXFAT_VOLUME Vol, PEXFAT_STREAM S, UINT64 Offset, UINT8* Buffer, UINT32 Length, BOOL Write)
+{
+    UINT32 bps = Vol->BytesPerSector;
+    NTSTATUS st;
+    while (Length) {
+        UINT32 cluster, runLeft, n;
+        UINT32 inCluster = (UINT32)(Offset & (Vol->BytesPerCluster - 1));
+        st = ExfatMap(Vol, S, (UINT32)(Offset >> Vol->ClusterShift), &cluster, &runLeft);
+        if (!NT_SUCCESS(st)) return st;
+
+        UINT64 runBytes = ((UINT64)runLeft << Vol->ClusterShift) - inCluster;
+        UINT32 sector = ExfatClusterToSector(Vol, cluster) + (inCluster >> Vol->SectorShift);
+        UINT32 inSector = inCluster & (bps - 1);
+        UINT32 chunk = runBytes < Length ? (UINT32)runBytes : Length;
+
+        if (inSector || chunk < bps) {
+            n = bps - inSector;
+            if (n > chunk) n = chunk;
+            st = ExfatReadSectors(Vol, sector, 1, Vol->Scratch);
+            if (!NT_SUCCESS(st)) return st;
+            if (Write) {
+                memcpy(Vol->Scratch + inSector, Buffer, n);
+                st = ExfatWriteSectors(Vol, sector, 1, Vol->Scratch);
+                if (!NT_SUCCESS(st)) return st;
+            } else {
+                memcpy(Buffer, Vol->Scratch + inSector, n);
+            }
+        } else {
+            n = chunk & ~(bps - 1);
+            st = Write ? ExfatWriteSectors(Vol, sector, n >> Vol->SectorShift, Buffer)
+                       : ExfatReadSectors(Vol, sector, n >> Vol->SectorShift, Buffer);
+            if (!NT_SUCCESS(st)) return st;
+        }
+        Offset += n;
+        Buffer += n;
+        Length -= n;
+    }
+    return STATUS_SUCCESS;
+}
+
+/* ---------------------------------------------------------------------------
+ * Allocation bitmap
+ * --------------------------------------------------------------------------- */
+
+static BOOL ExfatBitmapTest(PEXFAT_VOLUME Vol, UINT32 Cluster)
+{
+    UINT32 bit = Cluster - EXFAT_FIRST_CLUSTER;
+    return (Vol->Bitmap[bit >> 3] >> (bit & 7)) & 1;
+}
+
+static void ExfatBitmapSet(PEXFAT_VOLUME Vol, UINT32 Cluster, BOOL Used)
+{
+    UINT32 bit = Cluster - EXFAT_FIRST_CLUSTER;
+    UINT32 sector = (bit >> 3) >> Vol->SectorShift;
+    if (Used) Vol->Bitmap[bit >> 3] |= (UINT8)(1u << (bit & 7));
+    else Vol->Bitmap[bit >> 3] &= (UINT8)~(1u << (bit & 7));
+    Vol->BitmapDirty[sector >> 5] |= 1u << (sector & 31);
+}
+
+/* Next-fit search from Goal (or the hint); whole 32-bit words of used
+ * clusters are skipped without testing bits */
+static NTSTATUS ExfatAllocateCluster(PEXFAT_VOLUME Vol, UINT32 Goal, PUINT32 Cluster)
+{
+    UINT32 start, bit, scanned = 0;
+    if (Vol->FreeCount == 0) return STATUS_DISK_FULL;
+    start = ExfatIsDataCluster(Vol, Goal) ? Goal : Vol->NextFree;
+    if (!ExfatIsDataCluster(Vol, start)) start = EXFAT_FIRST_CLUSTER;
+    bit = start - EXFAT_FIRST_CLUSTER;
+
+    while (scanned < Vol->ClusterCount) {
+        if (bit >= Vol->ClusterCount) bit = 0;
+        if (!(bit & 31) && bit + 32 <= Vol->ClusterCount && ((PUINT32)Vol->Bitmap)[bit >> 5] == 0xFFFFFFFF) {
+            bit += 32;
+            scanned += 32;
+            continue;
+        }
+        if (!((Vol->Bitmap[bit >> 3] >> (bit & 7)) & 1)) {
+            *Cluster = bit + EXFAT_FIRST_CLUSTER;
+            ExfatBitmapSet(Vol, *Cluster, TRUE);
+            Vol->FreeCount--;
+            Vol->NextFree = *Cluster + 1;
+            return STATUS_SUCCESS;
+        }
+        bit++;
+        scanned++;
+    }
+    Vol->FreeCount = 0;
+    return STATUS_DISK_FULL;
+}
+
+static NTSTATUS ExfatFlushBitmap(PEXFAT_VOLUME Vol)
+{
+    UINT32 sectors = Vol->BitmapBytes >> Vol->SectorShift;
+    for (UINT32 s = 0; s < sectors; s++) {
+        if (!(Vol->BitmapDirty[s >> 5] & (1u << (s & 31)))) continue;
+        NTSTATUS st = ExfatTransfer(Vol, &Vol->BitmapStream, (UINT64)s << Vol->SectorShift,
+                                    Vol->Bitmap + (s << Vol->SectorShift), Vol->BytesPerSector, TRUE);
+        if (!NT_SUCCESS(st)) return st;
+        Vol->BitmapDirty[s >> 5] &= ~(1u << (s & 31));
+    }
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS ExfatLoadBitmap(PEXFAT_VOLUME Vol, PEXFAT_META_ENTRY Entry)
+{
+    UINT32 need = (Vol->ClusterCount + 7) / 8;
+    UINT32 sectors;
+    if (Entry->DataLength < need || !ExfatIsDataCluster(Vol, Entry->FirstCluster)) return STATUS_DISK_CORRUPT_ERROR;
+    Vol->BitmapStream.FirstCluster = Entry->FirstCluster;
+    Vol->BitmapStream.NoFatChain = FALSE;
+    Vol->BitmapStream.Clusters = (UINT32)((Entry->DataLength + Vol->BytesPerCluster - 1) >> Vol->ClusterShift);
+    sectors = (need + Vol->BytesPerSector - 1) >> Vol->SectorShift;
+    Vol->BitmapBytes = sectors << Vol->SectorShift;
+    Vol->Bitmap = (UINT8*)ExfatAllocate((Vol->BitmapBytes + 3) & ~3u);
+    Vol->BitmapDirty = (UINT32*)ExfatAllocate(((sectors + 31) / 32) * sizeof(UINT32));
+    if (!Vol->Bitmap || !Vol->BitmapDirty) return STATUS_INSUFFICIENT_RESOURCES;
+    NTSTATUS st = ExfatTransfer(Vol, &Vol->BitmapStream, 0, Vol->Bitmap, Vol->BitmapBytes, FALSE);
+    if (!NT_SUCCESS(st)) return st;
+
+    Vol->FreeCount = 0;
+    for (UINT32 c = EXFAT_FIRST_CLUSTER; c < Vol->ClusterCount + EXFAT_FIRST_CLUSTER; c++) {
+        if (!ExfatBitmapTest(Vol, c)) Vol->FreeCount++;
+    }
+    Vol->NextFree = EXFAT_FIRST_CLUSTER;
+    return STATUS_SUCCESS;
+}
+
+/* ---------------------------------------------------------------------------
+ * Names
+ * --------------------------------------------------------------------------- */
+
+static UINT16 ExfatUpCaseChar(PEXFAT_VOLUME Vol, UINT16 Ch)
+{
+    if (Vol->UpCase) return Vol->UpCase[Ch];
+    return (Ch >= 'a' && Ch <= 'z') ? (UINT16)(Ch - 32) : Ch;
+}
+
+/* NameHash over the up-cased name, as stored in the stream extension */
+static UINT16 ExfatNameHash(PEXFAT_VOLUME Vol, const UINT16* Name, UINT32 Length)
+{
+    UINT16 hash = 0;
+    for (UINT32 i = 0; i < Length; i++) {
+        UINT16 c = ExfatUpCaseChar(Vol, Name[i]);
+        hash = (UINT16)(((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c & 0xFF));
+        hash = (UINT16)(((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c >> 8));
+    }
+    return hash;
+}
+
+static UINT16 ExfatSetChecksum(const UINT8* Set, UINT32 Entries)
+{
+    UINT16 sum = 0;
+    for (UINT32 i = 0; i < Entries * EXFAT_ENTRY_SIZE; i++) {
+        if (i == 2 || i == 3) continue;
+        sum = (UINT16)(((sum & 1) ? 0x8000 : 0) + (sum >> 1) + Set[i]);
+    }
+    return sum;
+}
+
+/* UTF-8 path component to UTF-16; returns the length or 0 if too long */
+static UINT32 ExfatUtf8ToUtf16(PCSTR Text, UINT32 Bytes, UINT16* Out)
+{
+    UINT32 n = 0, i = 0;
+    while (i < Bytes) {
+        UINT8 c = (UINT8)Text[i];
+        UINT16 ch;
+        if (n == EXFAT_NAME_MAX) return 0;
+        if (c < 0x80) { ch = c; i += 1; }
+        else if ((c & 0xE0) == 0xC0 && i + 1 < Bytes) { ch = (UINT16)(((c & 0x1F) << 6) | (Text[i + 1] & 0x3F)); i += 2; }
+        else if ((c & 0xF0) == 0xE0 && i + 2 < Bytes) { ch = (UINT16)(((c & 0x0F) << 12) | ((Text[i + 1] & 0x3F) << 6) | (Text[i + 2] & 0x3F)); i += 3; }
+        else { ch = '?'; i += 1; }
+        Out[n++] = ch;
+    }
+    return n;
+}
+
+/* UTF-16 name to NUL-terminated UTF-8; Out holds 3 bytes per unit plus one */
+static UINT32 ExfatUtf16ToUtf8(const UINT16* Name, UINT32 Length, PCHAR Out)
+{
+    UINT32 n = 0;
+    for (UINT32 i = 0; i < Length; i++) {
+        UINT32 ch = Name[i];
+        if (ch >= 0xD800 && ch <= 0xDBFF && i + 1 < Length && Name[i + 1] >= 0xDC00 && Name[i + 1] <= 0xDFFF) {
+            ch = 0x10000 + ((ch - 0xD800) << 10) + (Name[++i] - 0xDC00);
+            Out[n++] = (CHAR)(0xF0 | (ch >> 18));
+            Out[n++] = (CHAR)(0x80 | ((ch >> 12) & 0x3F));
+            Out[n++] = (CHAR)(0x80 | ((ch >> 6) & 0x3F));
+            Out[n++] = (CHAR)(0x80 | (ch & 0x3F));
+        } else if (ch < 0x80) {
+            Out[n++] = (CHAR)ch;
+        } else if (ch < 0x800) {
+            Out[n++] = (CHAR)(0xC0 | (ch >> 6));
+            Out[n++] = (CHAR)(0x80 | (ch & 0x3F));
+        } else {
+            Out[n++] = (CHAR)(0xE0 | (ch >> 12));
+            Out[n++] = (CHAR)(0x80 | ((ch >> 6) & 0x3F));
+            Out[n++] = (CHAR)(0x80 | (ch & 0x3F));
+        }
+    }
+    Out[n] = '\0';
+    return n;
+}
+
+/* The up-case table is stored compressed: 0xFFFF, N marks N identity mappings */
+static NTSTATUS ExfatLoadUpCase(PEXFAT_VOLUME Vol, PEXFAT_META_ENTRY Entry)
+{
+    EXFAT_STREAM stream;
+    UINT16* raw;
+    UINT32 bytes, count, out = 0;
+    if (Entry->DataLength == 0 || Entry->DataLength > 0x20000 || !ExfatIsDataCluster(Vol, Entry->FirstCluster)) return STATUS_DISK_CORRUPT_ERROR;
+    bytes = (UINT32)Entry->DataLength;
+    memset(&stream, 0, sizeof(stream));
+    stream.FirstCluster = Entry->FirstCluster;
+    stream.Clusters = (bytes + Vol->BytesPerCluster - 1) >> Vol->ClusterShift;
+    raw = (UINT16*)ExfatAllocate(bytes + 2);
+    Vol->UpCase = (UINT16*)ExfatAllocate(0x10000 * sizeof(UINT16));
+    if (!raw || !Vol->UpCase) return STATUS_INSUFFICIENT_RESOURCES;
+    NTSTATUS st = ExfatTransfer(Vol, &stream, 0, (UINT8*)raw, bytes, FALSE);
+    ExfatReleaseStream(&stream);
+    if (!NT_SUCCESS(st)) return st;
+
+    count = bytes / 2;
+    for (UINT32 i = 0; i < count && out < 0x10000; i++) {
+        if (raw[i] == 0xFFFF && i + 1 < count) {
+            for (UINT32 run = raw[++i]; run && out < 0x10000; run--, out++) Vol->UpCase[out] = (UINT16)out;
+        } else {
+            Vol->UpCase[out++] = raw[i];
+        }
+    }
+    while (out < 0x10000) {
+        Vol->UpCase[out] = (UINT16)out;
+        out++;
+    }
+    AuroraFreeMemory(raw);
+    return STATUS_SUCCESS;
+}
+
+/* ---------------------------------------------------------------------------
+ * Directories
+ * --------------------------------------------------------------------------- */
+
+/* Assemble entry sets across cluster boundaries and hand them to Visitor.
+ * Sets with a bad checksum or a broken secondary sequence are skipped. */
+static NTSTATUS ExfatScanDirectory(PEXFAT_VOLUME Vol, PEXFAT_STREAM Dir, PEXFAT_SET_VISITOR Visitor, PVOID Context)
+{
+    UINT8 set[(EXFAT_MAX_SECONDARY + 1) * EXFAT_ENTRY_SIZE];
+    UINT32 have = 0, need = 0;
+    UINT64 setOffset = 0;
+    NTSTATUS st;
+
+    for (UINT32 vcn = 0; vcn < Dir->Clusters; vcn++) {
+        UINT32 cluster, runLeft;
+        st = ExfatMap(Vol, Dir, vcn, &cluster, &runLeft);
+        if (!NT_SUCCESS(st)) return st;
+        st = ExfatReadSectors(Vol, ExfatClusterToSector(Vol, cluster), Vol->SectorsPerCluster, Vol->DirBuffer);
+        if (!NT_SUCCESS(st)) return st;
+
+        for (UINT32 off = 0; off < Vol->BytesPerCluster; off += EXFAT_ENTRY_SIZE) {
+            UINT8* e = Vol->DirBuffer + off;
+            UINT64 pos = ((UINT64)vcn << Vol->ClusterShift) + off;
+            if (e[0] == EXFAT_TYPE_END) return STATUS_SUCCESS;
+            if (!(e[0] & EXFAT_TYPE_IN_USE)) {
+                need = 0;
+                continue;
+            }
+            if (e[0] & EXFAT_TYPE_SECONDARY) {
+                if (need == 0) continue; /* orphaned secondary */
+                memcpy(set + have * EXFAT_ENTRY_SIZE, e, EXFAT_ENTRY_SIZE);
+                if (++have < need) continue;
+                need = 0;
+                if (ExfatSetChecksum(set, have) != ((PEXFAT_FILE_ENTRY)set)->SetChecksum) continue;
+                if (Visitor(Vol, set, have, setOffset, Context)) return STATUS_SUCCESS;
+                continue;
+            }
+            /* primary entry */
+            need = 0;
+            if (e[0] == EXFAT_TYPE_FILE) {
+                UINT32 secondary = e[1];
+                if (secondary < 2 || secondary > EXFAT_MAX_SECONDARY) continue;
+                memcpy(set, e, EXFAT_ENTRY_SIZE);
+                have = 1;
+                need = secondary + 1;
+                setOffset = pos;
+                continue;
+            }
+            if (Visitor(Vol, e, 1, pos, Context)) return STATUS_SUCCESS;
+        }
+    }
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS ExfatCacheGrow(PEXFAT_DIR_CACHE Cache, UINT32 NameChars)
+{
+    if (Cache->Count == Cache->Capacity) {
+        UINT32 capacity = Cache->Capacity ? Cache->Capacity * 2 : 32;
+        PEXFAT_CACHED_SET sets = (PEXFAT_CACHED_SET)AuroraAllocateMemory(capacity * sizeof(EXFAT_CACHED_SET));
+        if (!sets) return STATUS_INSUFFICIENT_RESOURCES;
+        if (Cache->Count) memcpy(sets, Cache->Sets, Cache->Count * sizeof(EXFAT_CACHED_SET));
+        if (Cache->Sets) AuroraFreeMemory(Cache->Sets);
+        Cache->Sets = sets;
+        Cache->Capacity = capacity;
+    }
+    if (Cache->NamesUsed + NameChars > Cache->NamesCapacity) {
+        UINT32 capacity = Cache->NamesCapacity ? Cache->NamesCapacity * 2 : 1024;
+        while (capacity < Cache->NamesUsed + NameChars) capacity *= 2;
+        UINT16* names = (UINT16*)AuroraAllocateMemory(capacity * sizeof(UINT16));
+        if (!names) return STATUS_INSUFFICIENT_RESOURCES;
+        if (Cache->NamesUsed) memcpy(names, Cache->Names, Cache->NamesUsed * sizeof(UINT16));
+        if (Cache->Names) AuroraFreeMemory(Cache->Names);
+        Cache->Names = names;
+        Cache->NamesCapacity = capacity;
+    }
+    return STATUS_SUCCESS;
+}
+
+static BOOL ExfatCacheVisitor(IN PEXFAT_VOLUME Vol, IN UINT8* Entries, IN UINT32 Count, IN UINT64 Offset, IN PVOID Context)
+{
+    PEXFAT_DIR_CACHE cache = (PEXFAT_DIR_CACHE)Context;
+    PEXFAT_FILE_ENTRY file = (PEXFAT_FILE_ENTRY)Entries;
+    PEXFAT_STREAM_ENTRY stream = (PEXFAT_STREAM_ENTRY)(Entries + EXFAT_ENTRY_SIZE);
+    PEXFAT_CACHED_SET set;
+    UINT32 nameLen;
+
+    if (Entries[0] != EXFAT_TYPE_FILE || stream->Type != EXFAT_TYPE_STREAM) return FALSE;
+    nameLen = stream->NameLength;
+    if (nameLen == 0 || (nameLen + EXFAT_NAME_PER_ENTRY - 1) / EXFAT_NAME_PER_ENTRY > Count - 2) return FALSE;
+    if (!NT_SUCCESS(ExfatCacheGrow(cache, nameLen))) {
+        cache->DirCluster = 0; /* incomplete: do not trust this cache */
+        return TRUE;
+    }
+
+    set = &cache->Sets[cache->Count++];
+    set->NameHash = stream->NameHash;
+    set->NameLength = (UINT8)nameLen;
+    set->SecondaryCount = file->SecondaryCount;
+    set->Attributes = file->Attributes;
+    set->StreamFlags = stream->Flags;
+    set->FirstCluster = stream->FirstCluster;
+    set->DataLength = stream->DataLength;
+    set->ValidDataLength = stream->ValidDataLength;
+    set->SetOffset = Offset;
+    set->NameIndex = cache->NamesUsed;
+    for (UINT32 i = 0; i < nameLen; i++) {
+        PEXFAT_NAME_ENTRY ne = (PEXFAT_NAME_ENTRY)(Entries + (2 + i / EXFAT_NAME_PER_ENTRY) * EXFAT_ENTRY_SIZE);
+        cache->Names[cache->NamesUsed++] = ne->Name[i % EXFAT_NAME_PER_ENTRY];
+    }
+    UNREFERENCED_PARAMETER(Vol);
+    return FALSE;
+}
+
+static void ExfatCacheInvalidate(PEXFAT_VOLUME Vol, UINT32 DirCluster)
+{
+    for (UINT32 i = 0; i < EXFAT_DIR_CACHE_SLOTS; i++) {
+        if (Vol->DirCache[i].DirCluster == DirCluster) Vol->DirCache[i].DirCluster = 0;
+    }
+}
+
+/* Return the cache for a directory, scanning it on a miss */
+static NTSTATUS ExfatGetDirCache(PEXFAT_VOLUME Vol, PEXFAT_STREAM Dir, PEXFAT_DIR_CACHE* Out)
+{
+    PEXFAT_DIR_CACHE victim = &Vol->DirCache[0];
+    for (UINT32 i = 0; i < EXFAT_DIR_CACHE_SLOTS; i++) {
+        PEXFAT_DIR_CACHE c = &Vol->DirCache[i];
+        if (c->DirCluster == Dir->FirstCluster) {
+            c->LastUse = ++Vol->CacheClock;
+            *Out = c;
+            return STATUS_SUCCESS;
+        }
+        if (victim->DirCluster && (!c->DirCluster || c->LastUse < victim->LastUse)) victim = c;
+    }
+
+    victim->DirCluster = Dir->FirstCluster;
+    victim->Count = 0;
+    victim->NamesUsed = 0;
+    NTSTATUS st = ExfatScanDirectory(Vol, Dir, ExfatCacheVisitor, victim);
+    if (!NT_SUCCESS(st) || victim->DirCluster != Dir->FirstCluster) {
+        victim->DirCluster = 0;
+        return NT_SUCCESS(st) ? STATUS_INSUFFICIENT_RESOURCES : st;
+    }
+    victim->LastUse = ++Vol->CacheClock;
+    *Out = victim;
+    return STATUS_SUCCESS;
+}
+
+static PEXFAT_CACHED_SET ExfatCacheLookup(PEXFAT_VOLUME Vol, PEXFAT_DIR_CACHE Cache, const UINT16* Name, UINT32 Length)
+{
+    UINT16 hash = ExfatNameHash(Vol, Name, Length);
+    for (UINT32 i = 0; i < Cache->Count; i++) {
+        PEXFAT_CACHED_SET set = &Cache->Sets[i];
+        if (set->NameHash != hash || set->NameLength != Length) continue;
+        const UINT16* candidate = Cache->Names + set->NameIndex;
+        UINT32 j;
+        for (j = 0; j < Length; j++) {
+            if (ExfatUpCaseChar(Vol, candidate[j]) != ExfatUpCaseChar(Vol, Name[j])) break;
+        }
+        if (j == Length) return set;
+    }
+    return NULL;
+}
+
+static void ExfatStreamFromSet(PEXFAT_VOLUME Vol, PEXFAT_CACHED_SET Set, PEXFAT_STREAM Stream)
+{
+    memset(Stream, 0, sizeof(*Stream));
+    if (!(Set->StreamFlags & EXFAT_FLAG_ALLOC_POSSIBLE) || Set->FirstCluster == 0) return;
+    Stream->FirstCluster = Set->FirstCluster;
+    Stream->NoFatChain = (Set->StreamFlags & EXFAT_FLAG_NO_FAT_CHAIN) != 0;
+    Stream->Clusters = (UINT32)((Set->DataLength + Vol->BytesPerCluster - 1) >> Vol->ClusterShift);
+}
+
+static void ExfatRootStream(PEXFAT_VOLUME Vol, PEXFAT_STREAM Stream)
+{
+    memset(Stream, 0, sizeof(*Stream));
+    Stream->FirstCluster = Vol->RootCluster; /* always FAT-chained; length comes from the chain */
+}
+
+static NTSTATUS ExfatResolvePath(PEXFAT_VOLUME Vol, PCSTR Path, PEXFAT_FILE File)
+{
+    UINT16 name[EXFAT_NAME_MAX];
+    EXFAT_STREAM dir;
+    NTSTATUS st;
+
+    memset(File, 0, sizeof(*File));
+    File->Volume = Vol;
+    File->IsRoot = TRUE;
+    File->Attributes = EXFAT_ATTR_DIRECTORY;
+    ExfatRootStream(Vol, &dir);
+    st = ExfatBuildRuns(Vol, &dir);
+    if (!NT_SUCCESS(st)) return st;
+
+    while (*Path) {
+        while (*Path == '/' || *Path == '\\') Path++;
+        if (!*Path) break;
+        PCSTR end = Path;
+        while (*end && *end != '/' && *end != '\\') end++;
+        if (!(File->Attributes & EXFAT_ATTR_DIRECTORY)) {
+            st = STATUS_NOT_A_DIRECTORY;
+            break;
+        }
+        UINT32 len = ExfatUtf8ToUtf16(Path, (UINT32)(end - Path), name);
+        PEXFAT_DIR_CACHE cache;
+        st = len ? ExfatGetDirCache(Vol, &dir, &cache) : STATUS_OBJECT_NAME_NOT_FOUND;
+        if (!NT_SUCCESS(st)) break;
+        PEXFAT_CACHED_SET set = ExfatCacheLookup(Vol, cache, name, len);
+        if (!set) {
+            st = STATUS_OBJECT_NAME_NOT_FOUND;
+            break;
+        }
+
+        /* The current directory becomes the parent of what we found */
+        ExfatReleaseStream(&File->Parent);
+        File->Parent = dir;
+        File->ParentCluster = dir.FirstCluster;
+        File->SetOffset = set->SetOffset;
+        File->SecondaryCount = set->SecondaryCount;
+        File->Attributes = set->Attributes;
+        File->Size = set->DataLength;
+        File->ValidSize = set->ValidDataLength;
+        File->IsRoot = FALSE;
+        ExfatStreamFromSet(Vol, set, &File->Stream);
+        dir = File->Stream;
+        dir.Runs = NULL;
+        dir.RunCount = dir.RunCapacity = 0;
+        dir.RunsBuilt = FALSE;
+        Path = end;
+    }
+
+    if (File->IsRoot) {
+        File->Stream = dir;
+    } else if (dir.Runs) {
+        ExfatReleaseStream(&dir);
+    }
+    return st;
+}
+
+/* Rewrite the stream extension of an open file and refresh the set checksum */
+static NTSTATUS ExfatUpdateSet(PEXFAT_FILE File)
+{
+    PEXFAT_VOLUME vol = File->Volume;
+    UINT8 set[(EXFAT_MAX_SECONDARY + 1) * EXFAT_ENTRY_SIZE];
+    UINT32 bytes = (File->SecondaryCount + 1u) * EXFAT_ENTRY_SIZE;
+    NTSTATUS st;
+
+    if (File->IsRoot) return STATUS_SUCCESS;
+    st = ExfatTransfer(vol, &File->Parent, File->SetOffset, set, bytes, FALSE);
+    if (!NT_SUCCESS(st)) return st;
+    PEXFAT_FILE_ENTRY fe = (PEXFAT_FILE_ENTRY)set;
+    PEXFAT_STREAM_ENTRY se = (PEXFAT_STREAM_ENTRY)(set + EXFAT_ENTRY_SIZE);
+    if (fe->Type != EXFAT_TYPE_FILE || se->Type != EXFAT_TYPE_STREAM) return STATUS_DISK_CORRUPT_ERROR;
+
+    se->Flags = (UINT8)((se->Flags & ~(EXFAT_FLAG_ALLOC_POSSIBLE | EXFAT_FLAG_NO_FAT_CHAIN)) |
+                        (File->Stream.Clusters ? EXFAT_FLAG_ALLOC_POSSIBLE : 0) |
+                        (File->Stream.Clusters && File->Stream.NoFatChain ? EXFAT_FLAG_NO_FAT_CHAIN : 0));
+    se->FirstCluster = File->Stream.Clusters ? File->Stream.FirstCluster : 0;
+    se->DataLength = File->Size;
+    se->ValidDataLength = File->ValidSize;
+    if (!(File->Attributes & EXFAT_ATTR_DIRECTORY)) fe->Attributes |= EXFAT_ATTR_ARCHIVE;
+    fe->SetChecksum = ExfatSetChecksum(set, File->SecondaryCount + 1u);
+
+    st = ExfatTransfer(vol, &File->Parent, File->SetOffset, set, bytes, TRUE);
+    ExfatCacheInvalidate(vol, File->ParentCluster);
+    return st;
+}
+
+/* ---------------------------------------------------------------------------
+ * Allocation for files
+ * --------------------------------------------------------------------------- */
+
+/* Grow the stream to Clusters clusters. A NoFatChain stream stays
+ * FAT-less while the next cluster after its end is free; otherwise its
+ * existing run is written into the FAT and it becomes a normal chain. */
+static NTSTATUS ExfatExtendStream(PEXFAT_VOLUME Vol, PEXFAT_STREAM S, UINT32 Clusters)
+{
+    NTSTATUS st;
+    if (!S->NoFatChain && S->Clusters && !S->RunsBuilt) {
+        st = ExfatBuildRuns(Vol, S);
+        if (!NT_SUCCESS(st)) return st;
+    }
+    while (S->Clusters < Clusters) {
+        UINT32 tail = 0, cluster;
+        if (S->Clusters) {
+            if (S->NoFatChain) tail = S->FirstCluster + S->Clusters - 1;
+            else tail = S->Runs[S->RunCount - 1].Cluster + S->Runs[S->RunCount - 1].Length - 1;
+        }
+        st = ExfatAllocateCluster(Vol, tail ? tail + 1 : 0, &cluster);
+        if (!NT_SUCCESS(st)) return st;
+
+        if (S->Clusters == 0) {
+            S->FirstCluster = cluster;
+            S->NoFatChain = TRUE;
+        } else if (S->NoFatChain && cluster == tail + 1) {
+            /* still contiguous: nothing to record in the FAT */
+        } else {
+            if (S->NoFatChain) {
+                /* Materialise the run as a chain */
+                S->RunCount = 0;
+                for (UINT32 i = 0; i < S->Clusters; i++) {
+                    UINT32 c = S->FirstCluster + i;
+                    st = ExfatSetFat(Vol, c, i + 1 < S->Clusters ? c + 1 : EXFAT_EOC);
+                    if (NT_SUCCESS(st)) st = ExfatAppendRun(S, c);
+                    if (!NT_SUCCESS(st)) return st;
+                }
+                S->NoFatChain = FALSE;
+                S->RunsBuilt = TRUE;
+            }
+            st = ExfatSetFat(Vol, tail, cluster);
+            if (NT_SUCCESS(st)) st = ExfatSetFat(Vol, cluster, EXFAT_EOC);
+            if (!NT_SUCCESS(st)) return st;
+        }
+        if (!S->NoFatChain) {
+            st = ExfatAppendRun(S, cluster);
+            if (!NT_SUCCESS(st)) return st;
+            S->RunsBuilt = TRUE;
+        }
+        S->Clusters++;
+    }
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS ExfatZeroRange(PEXFAT_FILE File, UINT64 From, UINT64 To)
+{
+    PEXFAT_VOLUME vol = File->Volume;
+    while (From < To) {
+        UINT32 n = (To - From) > vol->BytesPerCluster ? vol->BytesPerCluster : (UINT32)(To - From);
+        memset(vol->DirBuffer, 0, n);
+        NTSTATUS st = ExfatTransfer(vol, &File->Stream, From, vol->DirBuffer, n, TRUE);
+        if (!NT_SUCCESS(st)) return st;
+        From += n;
+    }
+    return STATUS_SUCCESS;
+}
+
+/* ---------------------------------------------------------------------------
+ * Volume
+ * --------------------------------------------------------------------------- */
+
+static NTSTATUS ExfatSetVolumeDirty(PEXFAT_VOLUME Vol, BOOL Dirty)
+{
+    /* VolumeFlags is excluded from the boot checksum, so only sector 0 changes */
+    NTSTATUS st = ExfatReadSectors(Vol, 0, 1, Vol->Scratch);
+    if (!NT_SUCCESS(st)) return st;
+    PEXFAT_BOOT_SECTOR bs = (PEXFAT_BOOT_SECTOR)Vol->Scratch;
+    if (Dirty) bs->VolumeFlags |= EXFAT_VOLUME_DIRTY;
+    else bs->VolumeFlags = (UINT16)((bs->VolumeFlags & ~EXFAT_VOLUME_DIRTY) | (Vol->VolumeFlags & EXFAT_VOLUME_DIRTY));
+    st = ExfatWriteSectors(Vol, 0, 1, Vol->Scratch);
+    if (NT_SUCCESS(st)) st = BlockFlush(Vol->Device);
+    return st;
+}
+
+static NTSTATUS ExfatFlushVolume(PEXFAT_VOLUME Vol)
+{
+    NTSTATUS st;
+    if (Vol->ReadOnly) return STATUS_SUCCESS;
+    for (UINT32 i = 0; i < EXFAT_FAT_CACHE_SLOTS; i++) {
+        if (Vol->FatSlot[i] == EXFAT_SLOT_EMPTY || !Vol->FatDirty[i]) continue;
+        st = ExfatWriteSectors(Vol, Vol->FatOffset + Vol->FatSlot[i], 1, Vol->FatCache + i * Vol->BytesPerSector);
+        if (!NT_SUCCESS(st)) return st;
+        Vol->FatDirty[i] = FALSE;
+    }
+    st = ExfatFlushBitmap(Vol);
+    if (NT_SUCCESS(st)) st = BlockFlush(Vol->Device);
+    return st;
+}
+
+static UINT32 ExfatBootChecksum(const UINT8* Region, UINT32 Bytes)
+{
+    UINT32 sum = 0;
+    for (UINT32 i = 0; i < Bytes; i++) {
+        if (i == 106 || i == 107 || i == 112) continue; /* VolumeFlags, PercentInUse */
+        sum = ((sum & 1) ? 0x80000000 : 0) + (sum >> 1) + Region[i];
+    }
+    return sum;
+}
+
+static NTSTATUS ExfatParseBoot(PEXFAT_VOLUME Vol, PEXFAT_BOOT_SECTOR Bs, UINT32 DevBlockSize)
+{
+    if (memcmp(Bs->FileSystemName, "EXFAT   ", 8) != 0) return STATUS_UNRECOGNIZED_VOLUME;
+    for (UINT32 i = 0; i < sizeof(Bs->MustBeZero); i++) {
+        if (Bs->MustBeZero[i]) return STATUS_UNRECOGNIZED_VOLUME;
+    }
+    if (Bs->BytesPerSectorShift < 9 || Bs->BytesPerSectorShift > 12) return STATUS_UNRECOGNIZED_VOLUME;
+    if (Bs->SectorsPerClusterShift > 25 - Bs->BytesPerSectorShift) return STATUS_UNRECOGNIZED_VOLUME;
+    if (Bs->NumberOfFats < 1 || Bs->NumberOfFats > 2) return STATUS_UNRECOGNIZED_VOLUME;
+
+    Vol->SectorShift = Bs->BytesPerSectorShift;
+    Vol->BytesPerSector = 1u << Vol->SectorShift;
+    Vol->SectorsPerCluster = 1u << Bs->SectorsPerClusterShift;
+    Vol->ClusterShift = Vol->SectorShift + Bs->SectorsPerClusterShift;
+    Vol->BytesPerCluster = 1u << Vol->ClusterShift;
+    Vol->VolumeFlags = Bs->VolumeFlags;
+    /* TexFAT volumes name the active FAT in VolumeFlags */
+    Vol->FatOffset = Bs->FatOffset + ((Bs->NumberOfFats == 2 && (Bs->VolumeFlags & EXFAT_ACTIVE_FAT)) ? Bs->FatLength : 0);
+    Vol->FatLength = Bs->FatLength;
+    Vol->HeapOffset = Bs->ClusterHeapOffset;
+    Vol->ClusterCount = Bs->ClusterCount;
+    Vol->RootCluster = Bs->RootCluster;
+
+    if (Vol->BytesPerSector % DevBlockSize) return STATUS_NOT_SUPPORTED;
+    if ((UINT64)(Vol->ClusterCount + EXFAT_FIRST_CLUSTER) * 4 > ((UINT64)Vol->FatLength << Vol->SectorShift)) return STATUS_DISK_CORRUPT_ERROR;
+    if (!ExfatIsDataCluster(Vol, Vol->RootCluster)) return STATUS_DISK_CORRUPT_ERROR;
+    Vol->BlocksPerSector = Vol->BytesPerSector / DevBlockSize;
+    return STATUS_SUCCESS;
+}
+
+typedef struct _EXFAT_META_SCAN {
+    EXFAT_META_ENTRY Bitmap;
+    EXFAT_META_ENTRY UpCase;
+    BOOL HaveBitmap;
+    BOOL HaveUpCase;
+    UINT32 ActiveFat;
+} EXFAT_META_SCAN, *PEXFAT_META_SCAN;
+
+static BOOL ExfatMetaVisitor(IN PEXFAT_VOLUME Vol, IN UINT8* Entries, IN UINT32 Count, IN UINT64 Offset, IN PVOID Context)
+{
+    PEXFAT_META_SCAN scan = (PEXFAT_META_SCAN)Context;
+    PEXFAT_META_ENTRY e = (PEXFAT_META_ENTRY)Entries;
+    UNREFERENCED_PARAMETER(Vol);
+    UNREFERENCED_PARAMETER(Count);
+    UNREFERENCED_PARAMETER(Offset);
+    /* With two FATs there are two bitmaps; BitmapFlags bit 0 says which FAT it belongs to */
+    if (e->Type == EXFAT_TYPE_BITMAP && (e->Flags & 1) == scan->ActiveFat) {
+        scan->Bitmap = *e;
+        scan->HaveBitmap = TRUE;
+    } else if (e->Type == EXFAT_TYPE_UPCASE) {
+        scan->UpCase = *e;
+        scan->HaveUpCase = TRUE;
+    }
+    return scan->HaveBitmap && scan->HaveUpCase;
+}
+
+/* Options are comma separated; "ro" mounts read-only */
+static BOOL ExfatHasOption(PCSTR Options, PCSTR Name)
+{
+    UINT32 len = (UINT32)strlen(Name);
+    if (!Options) return FALSE;
+    while (*Options) {
+        PCSTR end = Options;
+        while (*end && *end != ',') end++;
+        if ((UINT32)(end - Options) == len && strncmp(Options, Name, len) == 0) return TRUE;
+        Options = *end ? end + 1 : end;
+    }
+    return FALSE;
+}
 
 static NTSTATUS exfat_mount(IN PCSTR Device, IN PCSTR Options, OUT PVOID* VolumeCtx)
 {
-    UNREFERENCED_PARAMETER(Device);
-    UNREFERENCED_PARAMETER(Options);
-    static EXFAT_VOLUME vol = {0};
-    *VolumeCtx = &vol;
+    PAIO_DEVICE_OBJECT dev;
+    PBLOCK_DEVICE_EXTENSION ext;
+    PEXFAT_VOLUME vol;
+    EXFAT_STREAM root;
+    EXFAT_META_SCAN meta;
+    UINT8* region;
+    NTSTATUS st;
+
+    if (!Device || !VolumeCtx) return STATUS_INVALID_PARAMETER;
+    dev = IoGetDeviceByName(Device);
+    if (!dev || (dev->DeviceType >> 16) != IO_DEVICE_CLASS_BLOCK || !dev->DeviceExtension) return STATUS_NOT_FOUND;
+    ext = (PBLOCK_DEVICE_EXTENSION)dev->DeviceExtension;
+    if (ext->BlockSize == 0 || ext->BlockSize > 4096) return STATUS_NOT_SUPPORTED;
+
+    vol = (PEXFAT_VOLUME)ExfatAllocate(sizeof(EXFAT_VOLUME));
+    region = (UINT8*)ExfatAllocate(12 * 4096); /* main boot region at the largest sector size */
+    if (!vol || !region) return STATUS_INSUFFICIENT_RESOURCES;
+    vol->Device = dev;
+    vol->ReadOnly = ExfatHasOption(Options, "ro");
+    AuroraInitializeSpinLock(&vol->Lock);
+
+    st = BlockRead(dev, 0, (512 + ext->BlockSize - 1) / ext->BlockSize, region);
+    if (!NT_SUCCESS(st)) return st;
+    st = ExfatParseBoot(vol, (PEXFAT_BOOT_SECTOR)region, ext->BlockSize);
+    if (!NT_SUCCESS(st)) return st;
+
+    /* Sectors 0-10 are covered by the checksum repeated through sector 11 */
+    st = ExfatReadSectors(vol, 0, 12, region);
+    if (!NT_SUCCESS(st)) return st;
+    if (ExfatBootChecksum(region, 11 * vol->BytesPerSector) != *(PUINT32)(region + 11 * vol->BytesPerSector)) {
+        return STATUS_DISK_CORRUPT_ERROR;
+    }
+    AuroraFreeMemory(region);
+
+    vol->Scratch = (UINT8*)ExfatAllocate(vol->BytesPerSector);
+    vol->DirBuffer = (UINT8*)ExfatAllocate(vol->BytesPerCluster);
+    vol->FatCache = (UINT8*)ExfatAllocate(EXFAT_FAT_CACHE_SLOTS * vol->BytesPerSector);
+    if (!vol->Scratch || !vol->DirBuffer || !vol->FatCache) return STATUS_INSUFFICIENT_RESOURCES;
+    for (UINT32 i = 0; i < EXFAT_FAT_CACHE_SLOTS; i++) vol->FatSlot[i] = EXFAT_SLOT_EMPTY;
+
+    ExfatRootStream(vol, &root);
+    st = ExfatBuildRuns(vol, &root);
+    if (!NT_SUCCESS(st)) return st;
+    memset(&meta, 0, sizeof(meta));
+    meta.ActiveFat = (vol->VolumeFlags & EXFAT_ACTIVE_FAT) ? 1 : 0;
+    st = ExfatScanDirectory(vol, &root, ExfatMetaVisitor, &meta);
+    ExfatReleaseStream(&root);
+    if (!NT_SUCCESS(st)) return st;
+    if (!meta.HaveBitmap) return STATUS_DISK_CORRUPT_ERROR;
+    st = ExfatLoadBitmap(vol, &meta.Bitmap);
+    if (!NT_SUCCESS(st)) return st;
+    if (meta.HaveUpCase && !NT_SUCCESS(ExfatLoadUpCase(vol, &meta.UpCase))) vol->UpCase = NULL;
+
+    AuroraDebugPrint("[exfat] %s: %u clusters of %u bytes, %u free", Device, vol->ClusterCount,
+                     vol->BytesPerCluster, vol->FreeCount);
+    *VolumeCtx = vol;
     return STATUS_SUCCESS;
 }
+
 static NTSTATUS exfat_unmount(IN PVOID VolumeCtx)
 {
-    UNREFERENCED_PARAMETER(VolumeCtx);
+    PEXFAT_VOLUME vol = (PEXFAT_VOLUME)VolumeCtx;
+    NTSTATUS st;
+    if (!vol) return STATUS_INVALID_PARAMETER;
+    st = ExfatFlushVolume(vol);
+    if (NT_SUCCESS(st) && vol->MarkedDirty) {
+        st = ExfatSetVolumeDirty(vol, FALSE);
+        if (NT_SUCCESS(st)) vol->MarkedDirty = FALSE;
+    }
+    return st;
+}
+
+/* ---------------------------------------------------------------------------
+ * File operations
+ * --------------------------------------------------------------------------- */
+
+static NTSTATUS exfat_open(IN PVOID VolumeCtx, IN PCSTR Path, OUT FS_FILE* File)
+{
+    PEXFAT_VOLUME vol = (PEXFAT_VOLUME)VolumeCtx;
+    PEXFAT_FILE file;
+    NTSTATUS st;
+
+    if (!vol || !Path || !File) return STATUS_INVALID_PARAMETER;
+    file = (PEXFAT_FILE)ExfatAllocate(sizeof(EXFAT_FILE));
+    if (!file) return STATUS_INSUFFICIENT_RESOURCES;
+
+    AURORA_IRQL irql;
+    AuroraAcquireSpinLock(&vol->Lock, &irql);
+    st = ExfatResolvePath(vol, Path, file);
+    if (NT_SUCCESS(st) && file->ValidSize > file->Size) file->ValidSize = file->Size;
+    AuroraReleaseSpinLock(&vol->Lock, irql);
+    if (!NT_SUCCESS(st)) {
+        ExfatReleaseStream(&file->Parent);
+        ExfatReleaseStream(&file->Stream);
+        AuroraFreeMemory(file);
+        return st;
+    }
+    *File = file;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS exfat_close(IN FS_FILE File)
+{
+    PEXFAT_FILE file = (PEXFAT_FILE)File;
+    NTSTATUS st = STATUS_SUCCESS;
+    if (!file) return STATUS_INVALID_PARAMETER;
+    if (file->Modified) {
+        AURORA_IRQL irql;
+        AuroraAcquireSpinLock(&file->Volume->Lock, &irql);
+        st = ExfatFlushVolume(file->Volume);
+        AuroraReleaseSpinLock(&file->Volume->Lock, irql);
+    }
+    ExfatReleaseStream(&file->Stream);
+    ExfatReleaseStream(&file->Parent);
+    AuroraFreeMemory(file);
+    return st;
+}
+
+/* Positional reads and writes under the volume lock; the file position is
+ * left alone. Segments are fed to the 32-bit transfer helper in pieces. */
+#define EXFAT_TRANSFER_CHUNK    0x40000000u
+
+static NTSTATUS exfat_read_at(IN FS_FILE File, IN UINT64 Offset, IN PFS_IO_SEGMENT Segments, IN UINT32 SegmentCount, OUT PUINT64 BytesRead)
+{
+    PEXFAT_FILE file = (PEXFAT_FILE)File;
+    UINT64 done = 0;
+    NTSTATUS st = STATUS_SUCCESS;
+    if (BytesRead) *BytesRead = 0;
+    if (!file || (!Segments && SegmentCount)) return STATUS_INVALID_PARAMETER;
+    if (file->Attributes & EXFAT_ATTR_DIRECTORY) return STATUS_FILE_IS_A_DIRECTORY;
+    for (UINT32 i = 0; i < SegmentCount; i++) {
+        if (!Segments[i].Buffer && Segments[i].Length) return STATUS_INVALID_PARAMETER;
+    }
+
+    AURORA_IRQL irql;
+    AuroraAcquireSpinLock(&file->Volume->Lock, &irql);
+    for (UINT32 i = 0; i < SegmentCount && NT_SUCCESS(st); i++) {
+        UINT8* out = (UINT8*)Segments[i].Buffer;
+        UINT64 len = Segments[i].Length;
+        while (len && Offset + done < file->Size) {
+            UINT64 pos = Offset + done;
+            UINT32 n = len > EXFAT_TRANSFER_CHUNK ? EXFAT_TRANSFER_CHUNK : (UINT32)len;
+            UINT32 valid = 0;
+            if (n > file->Size - pos) n = (UINT32)(file->Size - pos);
+            /* Bytes between ValidDataLength and DataLength read as zeros without touching the disk */
+            if (pos < file->ValidSize) {
+                UINT64 left = file->ValidSize - pos;
+                valid = left < n ? (UINT32)left : n;
+            }
+            if (valid) {
+                st = ExfatTransfer(file->Volume, &file->Stream, pos, out, valid, FALSE);
+                if (!NT_SUCCESS(st)) break;
+            }
+            if (n > valid) memset(out + valid, 0, n - valid);
+            out += n;
+            len -= n;
+            done += n;
+        }
+        if (len) break;
+    }
+    AuroraReleaseSpinLock(&file->Volume->Lock, irql);
+    if (!NT_SUCCESS(st) && !done) return st;
+    if (BytesRead) *BytesRead = done;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS exfat_write_at(IN FS_FILE File, IN UINT64 Offset, IN PFS_IO_SEGMENT Segments, IN UINT32 SegmentCount, OUT PUINT64 BytesWritten)
+{
+    PEXFAT_FILE file = (PEXFAT_FILE)File;
+    PEXFAT_VOLUME vol;
+    UINT64 end = Offset, pos = Offset;
+    NTSTATUS st;
+    if (BytesWritten) *BytesWritten = 0;
+    if (!file || (!Segments && SegmentCount)) return STATUS_INVALID_PARAMETER;
+    vol = file->Volume;
+    if (vol->ReadOnly || (file->Attributes & EXFAT_ATTR_READ_ONLY)) return STATUS_MEDIA_WRITE_PROTECTED;
+    if (file->Attributes & EXFAT_ATTR_DIRECTORY) return STATUS_FILE_IS_A_DIRECTORY;
+    for (UINT32 i = 0; i < SegmentCount; i++) {
+        if (!Segments[i].Buffer && Segments[i].Length) return STATUS_INVALID_PARAMETER;
+        end += Segments[i].Length;
+    }
+    if (end == Offset) return STATUS_SUCCESS;
+    if (((end + vol->BytesPerCluster - 1) >> vol->ClusterShift) > 0xFFFFFFFFull) return STATUS_FILE_TOO_LARGE;
+
+    AURORA_IRQL irql;
+    AuroraAcquireSpinLock(&vol->Lock, &irql);
+    st = STATUS_SUCCESS;
+    if (!vol->MarkedDirty) {
+        st = ExfatSetVolumeDirty(vol, TRUE);
+        if (NT_SUCCESS(st)) vol->MarkedDirty = TRUE;
+    }
+    if (NT_SUCCESS(st)) st = ExfatExtendStream(vol, &file->Stream, (UINT32)((end + vol->BytesPerCluster - 1) >> vol->ClusterShift));
+    /* Anything between the old valid length and the write becomes real zeros */
+    if (NT_SUCCESS(st) && Offset > file->ValidSize) st = ExfatZeroRange(file, file->ValidSize, Offset);
+    for (UINT32 i = 0; i < SegmentCount && NT_SUCCESS(st); i++) {
+        UINT8* in = (UINT8*)Segments[i].Buffer;
+        UINT64 len = Segments[i].Length;
+        while (len && NT_SUCCESS(st)) {
+            UINT32 n = len > EXFAT_TRANSFER_CHUNK ? EXFAT_TRANSFER_CHUNK : (UINT32)len;
+            st = ExfatTransfer(vol, &file->Stream, pos, in, n, TRUE);
+            in += n;
+            pos += n;
+            len -= n;
+        }
+    }
+    if (NT_SUCCESS(st)) {
+        if (end > file->Size) file->Size = end;
+        if (end > file->ValidSize) {
+            file->ValidSize = end;
+            file->Modified = TRUE;
+            st = ExfatUpdateSet(file);
+        }
+    }
+    AuroraReleaseSpinLock(&vol->Lock, irql);
+    if (!NT_SUCCESS(st)) return st;
+    if (BytesWritten) *BytesWritten = end - Offset;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS exfat_read(IN FS_FILE File, OUT PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesRead)
+{
+    PEXFAT_FILE file = (PEXFAT_FILE)File;
+    FS_IO_SEGMENT seg;
+    UINT64 done = 0;
+    NTSTATUS st;
+    if (BytesRead) *BytesRead = 0;
+    if (!file) return STATUS_INVALID_PARAMETER;
+    seg.Buffer = Buffer;
+    seg.Length = Size;
+    st = exfat_read_at(File, file->Position, &seg, 1, &done);
+    if (!NT_SUCCESS(st)) return st;
+    file->Position += done;
+    if (BytesRead) *BytesRead = (UINT32)done;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS exfat_write(IN FS_FILE File, IN PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesWritten)
+{
+    PEXFAT_FILE file = (PEXFAT_FILE)File;
+    FS_IO_SEGMENT seg;
+    UINT64 done = 0;
+    NTSTATUS st;
+    if (BytesWritten) *BytesWritten = 0;
+    if (!file) return STATUS_INVALID_PARAMETER;
+    seg.Buffer = Buffer;
+    seg.Length = Size;
+    st = exfat_write_at(File, file->Position, &seg, 1, &done);
+    if (!NT_SUCCESS(st)) return st;
+    file->Position += done;
+    if (BytesWritten) *BytesWritten = (UINT32)done;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS exfat_seek(IN FS_FILE File, IN INT64 Offset, IN UINT32 Origin, OUT PUINT64 NewPosition)
+{
+    PEXFAT_FILE file = (PEXFAT_FILE)File;
+    INT64 base;
+    if (!file) return STATUS_INVALID_PARAMETER;
+    switch (Origin) {
+        case FS_SEEK_SET: base = 0; break;
+        case FS_SEEK_CUR: base = (INT64)file->Position; break;
+        case FS_SEEK_END: base = (INT64)file->Size; break;
+        default: return STATUS_INVALID_PARAMETER;
+    }
+    if (base + Offset < 0) return STATUS_INVALID_PARAMETER;
+    file->Position = (UINT64)(base + Offset);
+    if (NewPosition) *NewPosition = file->Position;
+    return STATUS_SUCCESS;
+}
+
+/* The cursor is the byte offset of the next entry set in the directory;
+ * sets never move once written, so it survives changes elsewhere. The
+ * directory cache keeps sets in on-disk order, so resuming is a binary
+ * search. */
+static NTSTATUS exfat_read_dir(IN FS_FILE File, IN OUT PUINT64 Cursor, OUT PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesReturned)
+{
+    PEXFAT_FILE file = (PEXFAT_FILE)File;
+    PEXFAT_VOLUME vol;
+    PEXFAT_DIR_CACHE cache;
+    CHAR name[EXFAT_NAME_MAX * 3 + 1];
+    AURORA_IRQL irql;
+    UINT64 cursor;
+    UINT32 used = 0, lo, hi;
+    BOOL full = FALSE;
+    NTSTATUS st;
+
+    if (BytesReturned) *BytesReturned = 0;
+    if (!file || !Cursor || !BytesReturned) return STATUS_INVALID_PARAMETER;
+    if (!(file->Attributes & EXFAT_ATTR_DIRECTORY)) return STATUS_NOT_A_DIRECTORY;
+    vol = file->Volume;
+    cursor = *Cursor;
+
+    AuroraAcquireSpinLock(&vol->Lock, &irql);
+    st = ExfatGetDirCache(vol, &file->Stream, &cache);
+    if (NT_SUCCESS(st)) {
+        lo = 0;
+        hi = cache->Count;
+        while (lo < hi) {
+            UINT32 mid = lo + (hi - lo) / 2;
+            if (cache->Sets[mid].SetOffset < cursor) lo = mid + 1; else hi = mid;
+        }
+        for (; lo < cache->Count; lo++) {
+            PEXFAT_CACHED_SET set = &cache->Sets[lo];
+            BOOL dir = (set->Attributes & EXFAT_ATTR_DIRECTORY) != 0;
+            UINT64 next = set->SetOffset + (set->SecondaryCount + 1u) * EXFAT_ENTRY_SIZE;
+            UINT32 length = ExfatUtf16ToUtf8(cache->Names + set->NameIndex, set->NameLength, name);
+            if (!FsPackDirent(Buffer, Size, &used, name, length, dir ? FS_DT_DIRECTORY : FS_DT_FILE, dir ? 0 : set->DataLength, next)) {
+                full = TRUE;
+                break;
+            }
+            cursor = next;
+        }
+    }
+    AuroraReleaseSpinLock(&vol->Lock, irql);
+    if (!NT_SUCCESS(st)) return st;
+    if (!used) return full ? STATUS_BUFFER_TOO_SMALL : STATUS_NO_MORE_ENTRIES;
+    *Cursor = cursor;
+    *BytesReturned = used;
     return STATUS_SUCCESS;
 }
 
@@ -25,5 +1405,14 @@ void FsAdapterRegisterExfat(void)
     drv.Name = "exfat";
     drv.Ops.Mount = exfat_mount;
     drv.Ops.Unmount = exfat_unmount;
+    drv.Ops.Open = exfat_open;
+    drv.Ops.Close = exfat_close;
+    drv.Ops.Read = exfat_read;
+    drv.Ops.Write = exfat_write;
+    drv.Ops.Seek = exfat_seek;
+    drv.Ops.ReadAt = exfat_read_at;
+    drv.Ops.WriteAt = exfat_write_at;
+    drv.Ops.ReadDir = exfat_read_dir;
+    drv.Flags = FS_DRIVER_CACHED;
     FsRegisterDriver(&drv);
 }
@@ -1,23 +1,1461 @@
-/* FAT32 driver enhanced stub */
+/*
+ * Aurora Kernel - FAT32 file system driver
+ *
+ * Volumes are mounted from a block device by name (e.g. "ram0"). The FAT is
+ * kept in memory: small FATs are loaded whole at mount, larger ones go
+ * through a direct-mapped cache of FAT sectors. Either way modified sectors
+ * carry a dirty bit and are written back (to every FAT copy when mirroring
+ * is on) when the volume is flushed.
+ *
+ * Every open file converts its cluster chain into an extent list of
+ * contiguous runs, so a seek is a binary search over the runs instead of a
+ * walk down the chain, and reads/writes are issued as one block request per
+ * contiguous run rather than per cluster. The chain, size and extents live
+ * in one node per directory entry, shared by every handle open on it, so a
+ * handle never works from a size or chain another one has since changed.
+ *
+ * Free space is indexed as a sorted list of free runs, built from the FAT
+ * on the first allocation. A file grows by whole runs: writeback from the
+ * page cache announces the full dirty range first, so data that piled up
+ * in memory gets one contiguous run sized to it instead of a cluster per
+ * write. FsAllocate reserves clusters ahead of the data the same way.
+ */
 #include "../../aurora.h"
 #include "../../include/kern.h"
 #include "../../include/fs.h"
+#include "../../include/io.h"
+#include "../../include/mem.h"
+
+#define FAT32_ENTRY_MASK        0x0FFFFFFF
+#define FAT32_BAD_CLUSTER       0x0FFFFFF7
+#define FAT32_EOC_MIN           0x0FFFFFF8
+#define FAT32_EOC               0x0FFFFFFF
+#define FAT32_FIRST_CLUSTER     2
+#define FAT32_MIN_CLUSTERS      65525
+#define FAT32_FREE_UNKNOWN      0xFFFFFFFF
+
+#define FAT32_RESIDENT_LIMIT    (1024 * 1024)  /* FATs up to this size stay fully in memory */
+#define FAT32_CACHE_SLOTS       64             /* FAT sectors cached for larger volumes */
+#define FAT32_SLOT_EMPTY        0xFFFFFFFF
+#define FAT32_EXTENTS_INITIAL   8
+#define FAT32_FREE_RUNS_INITIAL 512            /* one page of free runs */
+
+#define FAT32_FSINFO_LEAD_SIG   0x41615252
+#define FAT32_FSINFO_STRUCT_SIG 0x61417272
+
+#define FAT_ATTR_READ_ONLY      0x01
+#define FAT_ATTR_HIDDEN         0x02
+#define FAT_ATTR_SYSTEM         0x04
+#define FAT_ATTR_VOLUME_ID      0x08
+#define FAT_ATTR_DIRECTORY      0x10
+#define FAT_ATTR_ARCHIVE        0x20
+#define FAT_ATTR_LFN            0x0F
+
+#define FAT_DIRENT_FREE         0xE5
+#define FAT_DIRENT_END          0x00
+#define FAT_LFN_LAST            0x40
+#define FAT_LFN_CHARS           13
+#define FAT_NAME_MAX            255
+
+#define FAT_NTRES_LOWER_BASE    0x08
+#define FAT_NTRES_LOWER_EXT     0x10
+
+#pragma pack(push,1)
+typedef struct _FAT32_BPB {
+    UINT8  Jump[3];
+    CHAR   OemName[8];
+    UINT16 BytesPerSector;
+    UINT8  SectorsPerCluster;
+    UINT16 ReservedSectors;
+    UINT8  NumFats;
+    UINT16 RootEntries;
+    UINT16 TotalSectors16;
+    UINT8  Media;
+    UINT16 FatSize16;
+    UINT16 SectorsPerTrack;
+    UINT16 NumHeads;
+    UINT32 HiddenSectors;
+    UINT32 TotalSectors32;
+    UINT32 FatSize32;
+    UINT16 ExtFlags;
+    UINT16 FsVersion;
+    UINT32 RootCluster;
+    UINT16 FsInfoSector;
+    UINT16 BackupBootSector;
+    UINT8  Reserved[12];
+    UINT8  DriveNumber;
+    UINT8  Reserved1;
+    UINT8  BootSignature;
+    UINT32 VolumeId;
+    CHAR   VolumeLabel[11];
+    CHAR   FsType[8];
+} FAT32_BPB, *PFAT32_BPB;
+
+typedef struct _FAT_DIRENT {
+    UINT8  Name[11];
+    UINT8  Attributes;
+    UINT8  NtReserved;
+    UINT8  CreateTimeTenth;
+    UINT16 CreateTime;
+    UINT16 CreateDate;
+    UINT16 AccessDate;
+    UINT16 FirstClusterHigh;
+    UINT16 WriteTime;
+    UINT16 WriteDate;
+    UINT16 FirstClusterLow;
+    UINT32 FileSize;
+} FAT_DIRENT, *PFAT_DIRENT;
+
+typedef struct _FAT_LFN_ENTRY {
+    UINT8  Order;
+    UINT16 Name1[5];
+    UINT8  Attributes;
+    UINT8  Type;
+    UINT8  Checksum;
+    UINT16 Name2[6];
+    UINT16 FirstClusterLow;
+    UINT16 Name3[2];
+} FAT_LFN_ENTRY, *PFAT_LFN_ENTRY;
+#pragma pack(pop)
+
+/* A run of clusters contiguous both in the file and on disk */
+typedef struct _FAT32_EXTENT {
+    UINT32 FileCluster;     /* first cluster index within the file */
+    UINT32 Cluster;         /* first cluster on disk */
+    UINT32 Length;          /* clusters in the run */
+} FAT32_EXTENT, *PFAT32_EXTENT;
+
+typedef struct _FAT32_EXTENT_LIST {
+    PFAT32_EXTENT Runs;     /* sorted by FileCluster */
+    UINT32 Count;
+    UINT32 Capacity;
+    UINT32 Clusters;        /* total clusters covered */
+} FAT32_EXTENT_LIST, *PFAT32_EXTENT_LIST;
+
+/* A run of free clusters in the volume's free-extent index */
+typedef struct _FAT32_FREE_RUN {
+    UINT32 Cluster;
+    UINT32 Length;
+} FAT32_FREE_RUN, *PFAT32_FREE_RUN;
+
+/* An open file or directory, one per directory entry however many handles
+ * are open on it */
+typedef struct _FAT32_NODE {
+    struct _FAT32_NODE* Next;   /* volume's open-node list */
+    UINT32 RefCount;            /* handles open on the node */
+    UINT32 FirstCluster;
+    UINT32 Size;
+    UINT8  Attributes;
+    BOOL   Modified;
+    UINT32 DirentSector;        /* absolute sector of the 32-byte entry (0 for the root) */
+    UINT32 DirentOffset;
+    FAT32_EXTENT_LIST Extents;
+} FAT32_NODE, *PFAT32_NODE;
 
 typedef struct _FAT32_VOLUME {
-    UINT32 Dummy;
+    PAIO_DEVICE_OBJECT Device;
+    UINT32 BlocksPerSector;     /* device blocks per FAT sector */
+    UINT32 BytesPerSector;
+    UINT32 SectorsPerCluster;
+    UINT32 BytesPerCluster;
+    UINT32 ClusterShift;        /* log2(BytesPerCluster) */
+    UINT32 ReservedSectors;
+    UINT32 NumFats;
+    UINT32 FatSectors;          /* sectors per FAT copy */
+    UINT32 ActiveFat;           /* the only FAT written when mirroring is off */
+    BOOL   Mirror;
+    UINT32 FirstDataSector;
+    UINT32 ClusterCount;        /* data clusters, numbered 2..ClusterCount+1 */
+    UINT32 RootCluster;
+    UINT32 FsInfoSector;
+    UINT32 FreeCount;           /* FAT32_FREE_UNKNOWN if not known */
+    UINT32 NextFree;            /* allocation hint */
+    BOOL   ReadOnly;
+    BOOL   FsInfoDirty;
+    /* FAT cache */
+    BOOL    FatResident;        /* whole FAT in FatBuffer, indexed by sector */
+    UINT8*  FatBuffer;
+    UINT32* SlotSector;         /* cached mode: FAT sector held by each slot */
+    UINT32* DirtyBits;          /* one bit per resident sector or cache slot */
+    UINT32  DirtyCount;
+    UINT8*  Scratch;            /* one sector, for partial-sector I/O and dirents */
+    UINT8*  DirBuffer;          /* one cluster, for directory scans */
+    /* Free-extent index */
+    BOOL    FreeIndexValid;     /* FALSE until built, or after running out of memory */
+    PFAT32_FREE_RUN FreeRuns;   /* sorted by Cluster, never touching each other */
+    UINT32  FreeRunCount;
+    UINT32  FreeRunCapacity;
+    PFAT32_NODE Nodes;          /* open nodes */
+    AURORA_SPINLOCK Lock;
 } FAT32_VOLUME, *PFAT32_VOLUME;
 
+/* A handle: only the position is its own */
+typedef struct _FAT32_FILE {
+    PFAT32_VOLUME Volume;
+    PFAT32_NODE Node;
+    UINT64 Position;
+} FAT32_FILE, *PFAT32_FILE;
+
+/* Directory scan callback: return TRUE to stop. Next is the byte offset in
+ * the directory just past the entry. */
+typedef BOOL (*PFAT32_DIR_VISITOR)(IN PCSTR Name, IN PFAT_DIRENT Entry, IN UINT32 Sector, IN UINT32 Offset, IN UINT32 Next, IN PVOID Context);
+
+/* Page-sized and larger blocks come from the page allocator, the rest from
+ * the pool; Fat32Free tells them apart by the same Size */
+static PVOID Fat32Allocate(UINT32 Size)
+{
+    PVOID p = Size >= 4096 ? MemAllocPages((Size + 4095) / 4096) : AuroraAllocateMemory(Size);
+    if (p) memset(p, 0, Size);
+    return p;
+}
+
+static void Fat32Free(PVOID Block, UINT32 Size)
+{
+    if (!Block) return;
+    if (Size >= 4096) MemFreePages(Block, (Size + 4095) / 4096);
+    else AuroraFreeMemory(Block);
+}
+
+static UINT32 Fat32Log2(UINT32 Value)
+{
+    UINT32 shift = 0;
+    while ((1u << shift) < Value) shift++;
+    return shift;
+}
+
+static BOOL Fat32IsPowerOfTwo(UINT32 Value)
+{
+    return Value && !(Value & (Value - 1));
+}
+
+/* ---------------------------------------------------------------------------
+ * Sector I/O
+ * --------------------------------------------------------------------------- */
+
+static NTSTATUS Fat32ReadSectors(PFAT32_VOLUME Vol, UINT32 Sector, UINT32 Count, PVOID Buffer)
+{
+    return BlockRead(Vol->Device, (UINT64)Sector * Vol->BlocksPerSector, Count * Vol->BlocksPerSector, Buffer);
+}
+
+static NTSTATUS Fat32WriteSectors(PFAT32_VOLUME Vol, UINT32 Sector, UINT32 Count, PVOID Buffer)
+{
+    if (Vol->ReadOnly) return STATUS_MEDIA_WRITE_PROTECTED;
+    return BlockWrite(Vol->Device, (UINT64)Sector * Vol->BlocksPerSector, Count * Vol->BlocksPerSector, Buffer);
+}
+
+static UINT32 Fat32ClusterToSector(PFAT32_VOLUME Vol, UINT32 Cluster)
+{
+    return Vol->FirstDataSector + (Cluster - FAT32_FIRST_CLUSTER) * Vol->SectorsPerCluster;
+}
+
+static BOOL Fat32IsDataCluster(PFAT32_VOLUME Vol, UINT32 Cluster)
+{
+    return Cluster >= FAT32_FIRST_CLUSTER && Cluster < Vol->ClusterCount + FAT32_FIRST_CLUSTER;
+}
+
+/* ---------------------------------------------------------------------------
+ * FAT cache
+ * --------------------------------------------------------------------------- */
+
+static void Fat32SetDirty(PFAT32_VOLUME Vol, UINT32 Index)
+{
+    UINT32 bit = 1u << (Index & 31);
+    if (!(Vol->DirtyBits[Index >> 5] & bit)) {
+        Vol->DirtyBits[Index >> 5] |= bit;
+        Vol->DirtyCount++;
+    }
+}
+
+static BOOL Fat32TestAndClearDirty(PFAT32_VOLUME Vol, UINT32 Index)
+{
+    UINT32 bit = 1u << (Index & 31);
+    if (!(Vol->DirtyBits[Index >> 5] & bit)) return FALSE;
+    Vol->DirtyBits[Index >> 5] &= ~bit;
+    Vol->DirtyCount--;
+    return TRUE;
+}
+
+/* Write one FAT sector to every copy (or the active copy when mirroring is off) */
+static NTSTATUS Fat32WriteFatSector(PFAT32_VOLUME Vol, UINT32 FatSector, PVOID Data)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    for (UINT32 i = 0; i < Vol->NumFats; i++) {
+        if (!Vol->Mirror && i != Vol->ActiveFat) continue;
+        NTSTATUS st = Fat32WriteSectors(Vol, Vol->ReservedSectors + i * Vol->FatSectors + FatSector, 1, Data);
+        if (!NT_SUCCESS(st)) status = st;
+    }
+    return status;
+}
+
+static NTSTATUS Fat32FatSectorData(PFAT32_VOLUME Vol, UINT32 FatSector, UINT8** Data, PUINT32 DirtyIndex)
+{
+    if (FatSector >= Vol->FatSectors) return STATUS_DISK_CORRUPT_ERROR;
+    if (Vol->FatResident) {
+        *Data = Vol->FatBuffer + FatSector * Vol->BytesPerSector;
+        *DirtyIndex = FatSector;
+        return STATUS_SUCCESS;
+    }
+
+    UINT32 slot = FatSector % FAT32_CACHE_SLOTS;
+    UINT8* buf = Vol->FatBuffer + slot * Vol->BytesPerSector;
+    if (Vol->SlotSector[slot] != FatSector) {
+        if (Vol->SlotSector[slot] != FAT32_SLOT_EMPTY && Fat32TestAndClearDirty(Vol, slot)) {
+            NTSTATUS st = Fat32WriteFatSector(Vol, Vol->SlotSector[slot], buf);
+            if (!NT_SUCCESS(st)) {
+                Fat32SetDirty(Vol, slot);
+                return st;
+            }
+        }
+        Vol->SlotSector[slot] = FAT32_SLOT_EMPTY;
+        NTSTATUS st = Fat32ReadSectors(Vol, Vol->ReservedSectors + Vol->ActiveFat * Vol->FatSectors + FatSector, 1, buf);
+        if (!NT_SUCCESS(st)) return st;
+        Vol->SlotSector[slot] = FatSector;
+    }
+    *Data = buf;
+    *DirtyIndex = slot;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS Fat32GetEntry(PFAT32_VOLUME Vol, UINT32 Cluster, PUINT32 Value)
+{
+    UINT32 offset = Cluster * 4;
+    UINT32 dirty;
+    UINT8* data;
+    NTSTATUS st = Fat32FatSectorData(Vol, offset / Vol->BytesPerSector, &data, &dirty);
+    if (!NT_SUCCESS(st)) return st;
+    *Value = *(UINT32*)(data + offset % Vol->BytesPerSector) & FAT32_ENTRY_MASK;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS Fat32SetEntry(PFAT32_VOLUME Vol, UINT32 Cluster, UINT32 Value)
+{
+    UINT32 offset = Cluster * 4;
+    UINT32 dirty;
+    UINT8* data;
+    if (Vol->ReadOnly) return STATUS_MEDIA_WRITE_PROTECTED;
+    NTSTATUS st = Fat32FatSectorData(Vol, offset / Vol->BytesPerSector, &data, &dirty);
+    if (!NT_SUCCESS(st)) return st;
+    UINT32* entry = (UINT32*)(data + offset % Vol->BytesPerSector);
+    *entry = (*entry & ~FAT32_ENTRY_MASK) | (Value & FAT32_ENTRY_MASK); /* top nibble is reserved */
+    Fat32SetDirty(Vol, dirty);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS Fat32FlushFat(PFAT32_VOLUME Vol)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+    UINT32 count = Vol->FatResident ? Vol->FatSectors : FAT32_CACHE_SLOTS;
+    for (UINT32 i = 0; i < count && Vol->DirtyCount; i++) {
+        if (!Fat32TestAndClearDirty(Vol, i)) continue;
+        UINT32 sector = Vol->FatResident ? i : Vol->SlotSector[i];
+        NTSTATUS st = Fat32WriteFatSector(Vol, sector, Vol->FatBuffer + i * Vol->BytesPerSector);
+        if (!NT_SUCCESS(st)) {
+            Fat32SetDirty(Vol, i);
+            status = st;
+        }
+    }
+    return status;
+}
+
+static NTSTATUS Fat32InitFatCache(PFAT32_VOLUME Vol)
+{
+    UINT32 fatBytes = Vol->FatSectors * Vol->BytesPerSector;
+    UINT32 slots;
+    if (fatBytes <= FAT32_RESIDENT_LIMIT) {
+        Vol->FatResident = TRUE;
+        slots = Vol->FatSectors;
+        Vol->FatBuffer = (UINT8*)Fat32Allocate(fatBytes);
+        if (!Vol->FatBuffer) return STATUS_INSUFFICIENT_RESOURCES;
+        NTSTATUS st = Fat32ReadSectors(Vol, Vol->ReservedSectors + Vol->ActiveFat * Vol->FatSectors, Vol->FatSectors, Vol->FatBuffer);
+        if (!NT_SUCCESS(st)) return st;
+    } else {
+        Vol->FatResident = FALSE;
+        slots = FAT32_CACHE_SLOTS;
+        Vol->FatBuffer = (UINT8*)Fat32Allocate(FAT32_CACHE_SLOTS * Vol->BytesPerSector);
+        Vol->SlotSector = (UINT32*)Fat32Allocate(FAT32_CACHE_SLOTS * sizeof(UINT32));
+        if (!Vol->FatBuffer || !Vol->SlotSector) return STATUS_INSUFFICIENT_RESOURCES;
+        for (UINT32 i = 0; i < FAT32_CACHE_SLOTS; i++) Vol->SlotSector[i] = FAT32_SLOT_EMPTY;
+    }
+    Vol->DirtyBits = (UINT32*)Fat32Allocate(((slots + 31) / 32) * sizeof(UINT32));
+    if (!Vol->DirtyBits) return STATUS_INSUFFICIENT_RESOURCES;
+    Vol->DirtyCount = 0;
+    return STATUS_SUCCESS;
+}
+
+/* ---------------------------------------------------------------------------
+ * Cluster allocation
+ * --------------------------------------------------------------------------- */
+
+/* Index of the first free run ending after Cluster */
+static UINT32 Fat32FreeRunSearch(PFAT32_VOLUME Vol, UINT32 Cluster)
+{
+    UINT32 lo = 0, hi = Vol->FreeRunCount;
+    while (lo < hi) {
+        UINT32 mid = lo + (hi - lo) / 2;
+        if (Vol->FreeRuns[mid].Cluster + Vol->FreeRuns[mid].Length <= Cluster) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static NTSTATUS Fat32FreeRunInsert(PFAT32_VOLUME Vol, UINT32 Index, UINT32 Cluster, UINT32 Length)
+{
+    if (Vol->FreeRunCount == Vol->FreeRunCapacity) {
+        UINT32 capacity = Vol->FreeRunCapacity ? Vol->FreeRunCapacity * 2 : FAT32_FREE_RUNS_INITIAL;
+        UINT32 pages = (UINT32)(((UINT64)capacity * sizeof(FAT32_FREE_RUN) + 4095) / 4096);
+        PFAT32_FREE_RUN runs = (PFAT32_FREE_RUN)MemAllocPages(pages);
+        if (!runs) return STATUS_INSUFFICIENT_RESOURCES;
+        if (Vol->FreeRunCount) memcpy(runs, Vol->FreeRuns, Vol->FreeRunCount * sizeof(FAT32_FREE_RUN));
+        if (Vol->FreeRuns) MemFreePages(Vol->FreeRuns, (UINT32)(((UINT64)Vol->FreeRunCapacity * sizeof(FAT32_FREE_RUN) + 4095) / 4096));
+        Vol->FreeRuns = runs;
+        Vol->FreeRunCapacity = capacity;
+    }
+    if (Index < Vol->FreeRunCount) {
+        memmove(&Vol->FreeRuns[Index + 1], &Vol->FreeRuns[Index], (Vol->FreeRunCount - Index) * sizeof(FAT32_FREE_RUN));
+    }
+    Vol->FreeRuns[Index].Cluster = Cluster;
+    Vol->FreeRuns[Index].Length = Length;
+    Vol->FreeRunCount++;
+    return STATUS_SUCCESS;
+}
+
+static void Fat32FreeRunRemove(PFAT32_VOLUME Vol, UINT32 Index)
+{
+    Vol->FreeRunCount--;
+    if (Index < Vol->FreeRunCount) {
+        memmove(&Vol->FreeRuns[Index], &Vol->FreeRuns[Index + 1], (Vol->FreeRunCount - Index) * sizeof(FAT32_FREE_RUN));
+    }
+}
+
+/* One pass over the FAT; also gives an exact free count */
+static NTSTATUS Fat32BuildFreeIndex(PFAT32_VOLUME Vol)
+{
+    UINT32 start = 0, length = 0, freeCount = 0, value;
+    NTSTATUS st;
+
+    Vol->FreeRunCount = 0;
+    for (UINT32 c = FAT32_FIRST_CLUSTER; c <= Vol->ClusterCount + 1; c++) {
+        st = Fat32GetEntry(Vol, c, &value);
+        if (!NT_SUCCESS(st)) return st;
+        if (value == 0) {
+            if (!length) start = c;
+            length++;
+            if (c < Vol->ClusterCount + 1) continue;
+        }
+        if (length) {
+            st = Fat32FreeRunInsert(Vol, Vol->FreeRunCount, start, length);
+            if (!NT_SUCCESS(st)) return st;
+            freeCount += length;
+            length = 0;
+        }
+    }
+    if (freeCount != Vol->FreeCount) {
+        Vol->FreeCount = freeCount;
+        Vol->FsInfoDirty = TRUE;
+    }
+    Vol->FreeIndexValid = TRUE;
+    return STATUS_SUCCESS;
+}
+
+/* Put clusters whose FAT entries were just cleared back in the index. If
+ * the index cannot grow it is dropped and rebuilt from the FAT later. */
+static void Fat32FreeRunAdd(PFAT32_VOLUME Vol, UINT32 Cluster, UINT32 Length)
+{
+    if (Vol->FreeCount != FAT32_FREE_UNKNOWN) Vol->FreeCount += Length;
+    Vol->FsInfoDirty = TRUE;
+    if (!Vol->FreeIndexValid) return;
+
+    UINT32 i = Fat32FreeRunSearch(Vol, Cluster);
+    BOOL joinPrev = i > 0 && Vol->FreeRuns[i - 1].Cluster + Vol->FreeRuns[i - 1].Length == Cluster;
+    BOOL joinNext = i < Vol->FreeRunCount && Vol->FreeRuns[i].Cluster == Cluster + Length;
+    if (joinPrev && joinNext) {
+        Vol->FreeRuns[i - 1].Length += Length + Vol->FreeRuns[i].Length;
+        Fat32FreeRunRemove(Vol, i);
+    } else if (joinPrev) {
+        Vol->FreeRuns[i - 1].Length += Length;
+    } else if (joinNext) {
+        Vol->FreeRuns[i].Cluster = Cluster;
+        Vol->FreeRuns[i].Length += Length;
+    } else if (!NT_SUCCESS(Fat32FreeRunInsert(Vol, i, Cluster, Length))) {
+        Vol->FreeIndexValid = FALSE;
+    }
+}
+
+/* Allocate up to Want clusters as one run, chained to each other and ending
+ * in EOC; the caller links the run in. Goal is taken when free (the cluster
+ * after a file's tail keeps the file in one piece); otherwise the run comes
+ * from the smallest free run that holds all of Want, or failing that from
+ * the largest, so a request is only split when no free run is big enough. */
+static NTSTATUS Fat32AllocateRun(PFAT32_VOLUME Vol, UINT32 Goal, UINT32 Want, PUINT32 Cluster, PUINT32 Length)
+{
+    UINT32 i, best = 0, largest = 0, start, take, end;
+    BOOL fits = FALSE;
+    NTSTATUS st;
+
+    if (!Vol->FreeIndexValid) {
+        st = Fat32BuildFreeIndex(Vol);
+        if (!NT_SUCCESS(st)) return st;
+    }
+    if (!Vol->FreeRunCount) {
+        Vol->FreeCount = 0;
+        return STATUS_DISK_FULL;
+    }
+
+    i = Fat32IsDataCluster(Vol, Goal) ? Fat32FreeRunSearch(Vol, Goal) : Vol->FreeRunCount;
+    if (i < Vol->FreeRunCount && Vol->FreeRuns[i].Cluster <= Goal) {
+        start = Goal;
+    } else {
+        for (UINT32 n = 0; n < Vol->FreeRunCount; n++) {
+            UINT32 len = Vol->FreeRuns[n].Length;
+            if (len >= Want && (!fits || len < Vol->FreeRuns[best].Length)) {
+                best = n;
+                fits = TRUE;
+                if (len == Want) break;
+            }
+            if (len > Vol->FreeRuns[largest].Length) largest = n;
+        }
+        i = fits ? best : largest;
+        start = Vol->FreeRuns[i].Cluster;
+    }
+    end = Vol->FreeRuns[i].Cluster + Vol->FreeRuns[i].Length;
+    take = end - start < Want ? end - start : Want;
+
+    for (UINT32 n = 0; n < take; n++) {
+        st = Fat32SetEntry(Vol, start + n, n + 1 < take ? start + n + 1 : FAT32_EOC);
+        if (!NT_SUCCESS(st)) {
+            while (n--) Fat32SetEntry(Vol, start + n, 0);
+            return st;
+        }
+    }
+
+    /* Carve [start, start + take) out of run i */
+    if (start == Vol->FreeRuns[i].Cluster) {
+        Vol->FreeRuns[i].Cluster += take;
+        Vol->FreeRuns[i].Length -= take;
+        if (!Vol->FreeRuns[i].Length) Fat32FreeRunRemove(Vol, i);
+    } else {
+        Vol->FreeRuns[i].Length = start - Vol->FreeRuns[i].Cluster;
+        if (start + take < end && !NT_SUCCESS(Fat32FreeRunInsert(Vol, i + 1, start + take, end - start - take))) {
+            Vol->FreeIndexValid = FALSE;
+        }
+    }
+    if (Vol->FreeCount != FAT32_FREE_UNKNOWN) Vol->FreeCount -= take;
+    Vol->NextFree = start + take;
+    Vol->FsInfoDirty = TRUE;
+    *Cluster = start;
+    *Length = take;
+    return STATUS_SUCCESS;
+}
+
+/* Free the chain starting at Cluster, a contiguous stretch at a time */
+static NTSTATUS Fat32FreeChain(PFAT32_VOLUME Vol, UINT32 Cluster)
+{
+    UINT32 start = Cluster, length = 0, next;
+    NTSTATUS st;
+
+    while (Cluster < FAT32_EOC_MIN) {
+        if (!Fat32IsDataCluster(Vol, Cluster)) return STATUS_DISK_CORRUPT_ERROR;
+        st = Fat32GetEntry(Vol, Cluster, &next);
+        if (NT_SUCCESS(st)) st = Fat32SetEntry(Vol, Cluster, 0);
+        if (!NT_SUCCESS(st)) {
+            if (length) Fat32FreeRunAdd(Vol, start, length);
+            return st;
+        }
+        length++;
+        if (next != Cluster + 1) {
+            Fat32FreeRunAdd(Vol, start, length);
+            start = next;
+            length = 0;
+        }
+        if (next == 0 || next == FAT32_BAD_CLUSTER) return STATUS_DISK_CORRUPT_ERROR;
+        Cluster = next;
+    }
+    return STATUS_SUCCESS;
+}
+
+/* ---------------------------------------------------------------------------
+ * Extent lists
+ * --------------------------------------------------------------------------- */
+
+static NTSTATUS Fat32ExtentAppend(PFAT32_EXTENT_LIST List, UINT32 Cluster, UINT32 Length)
+{
+    if (List->Count) {
+        PFAT32_EXTENT last = &List->Runs[List->Count - 1];
+        if (last->Cluster + last->Length == Cluster) {
+            last->Length += Length;
+            List->Clusters += Length;
+            return STATUS_SUCCESS;
+        }
+    }
+    if (List->Count == List->Capacity) {
+        UINT32 capacity = List->Capacity ? List->Capacity * 2 : FAT32_EXTENTS_INITIAL;
+        PFAT32_EXTENT runs = (PFAT32_EXTENT)AuroraAllocateMemory(capacity * sizeof(FAT32_EXTENT));
+        if (!runs) return STATUS_INSUFFICIENT_RESOURCES;
+        if (List->Count) memcpy(runs, List->Runs, List->Count * sizeof(FAT32_EXTENT));
+        if (List->Runs) AuroraFreeMemory(List->Runs);
+        List->Runs = runs;
+        List->Capacity = capacity;
+    }
+    List->Runs[List->Count].FileCluster = List->Clusters;
+    List->Runs[List->Count].Cluster = Cluster;
+    List->Runs[List->Count].Length = Length;
+    List->Count++;
+    List->Clusters += Length;
+    return STATUS_SUCCESS;
+}
+
+/* Walk the chain once and record it as runs */
+static NTSTATUS Fat32BuildExtents(PFAT32_VOLUME Vol, UINT32 FirstCluster, PFAT32_EXTENT_LIST List)
+{
+    UINT32 cluster = FirstCluster;
+    memset(List, 0, sizeof(*List));
+    if (cluster == 0) return STATUS_SUCCESS;
+    while (cluster < FAT32_EOC_MIN) {
+        if (!Fat32IsDataCluster(Vol, cluster) || List->Clusters >= Vol->ClusterCount) return STATUS_DISK_CORRUPT_ERROR;
+        NTSTATUS st = Fat32ExtentAppend(List, cluster, 1);
+        if (!NT_SUCCESS(st)) return st;
+        st = Fat32GetEntry(Vol, cluster, &cluster);
+        if (!NT_SUCCESS(st)) return st;
+        if (cluster == 0 || cluster == FAT32_BAD_CLUSTER) return STATUS_DISK_CORRUPT_ERROR;
+    }
+    return STATUS_SUCCESS;
+}
+
+static void Fat32FreeExtents(PFAT32_EXTENT_LIST List)
+{
+    if (List->Runs) AuroraFreeMemory(List->Runs);
+    memset(List, 0, sizeof(*List));
+}
+
+/* Binary search for the run holding file cluster Vcn */
+static PFAT32_EXTENT Fat32ExtentLookup(PFAT32_EXTENT_LIST List, UINT32 Vcn)
+{
+    UINT32 lo = 0, hi = List->Count;
+    while (lo < hi) {
+        UINT32 mid = lo + (hi - lo) / 2;
+        PFAT32_EXTENT run = &List->Runs[mid];
+        if (Vcn < run->FileCluster) hi = mid;
+        else if (Vcn >= run->FileCluster + run->Length) lo = mid + 1;
+        else return run;
+    }
+    return NULL;
+}
+
+/* Grow the chain to at least Clusters clusters. The missing clusters are
+ * asked for as one run; the chain only breaks when no free run holds them. */
+static NTSTATUS Fat32ExtendChain(PFAT32_VOLUME Vol, PFAT32_NODE Node, UINT32 Clusters)
+{
+    PFAT32_EXTENT_LIST list = &Node->Extents;
+    while (list->Clusters < Clusters) {
+        UINT32 tail = 0, cluster, length;
+        if (list->Count) {
+            PFAT32_EXTENT last = &list->Runs[list->Count - 1];
+            tail = last->Cluster + last->Length - 1;
+        }
+        NTSTATUS st = Fat32AllocateRun(Vol, tail ? tail + 1 : 0, Clusters - list->Clusters, &cluster, &length);
+        if (!NT_SUCCESS(st)) return st;
+        /* Record the run before linking it, so a failure leaves nothing to undo on disk */
+        st = Fat32ExtentAppend(list, cluster, length);
+        if (NT_SUCCESS(st) && tail) {
+            st = Fat32SetEntry(Vol, tail, cluster);
+            if (!NT_SUCCESS(st)) {
+                /* Take the run back out of the list; it may have merged into the tail */
+                list->Clusters -= length;
+                if (list->Runs[list->Count - 1].Length == length) list->Count--;
+                else list->Runs[list->Count - 1].Length -= length;
+            }
+        }
+        if (!NT_SUCCESS(st)) {
+            Fat32FreeChain(Vol, cluster);
+            return st;
+        }
+        if (!tail) Node->FirstCluster = cluster;
+        Node->Modified = TRUE;
+    }
+    return STATUS_SUCCESS;
+}
+
+/* ---------------------------------------------------------------------------
+ * Data transfer
+ * --------------------------------------------------------------------------- */
+
+/* Move Length bytes at file Offset. Whole sectors go straight between the
+ * caller's buffer and the disk, one request per contiguous run; only a
+ * partial head or tail sector is staged in the scratch sector. */
+static NTSTATUS Fat32Transfer(PFAT32_VOLUME Vol, PFAT32_NODE Node, UINT64 Offset, UINT8* Buffer, UINT32 Length, BOOL Write)
+{
+    UINT32 bps = Vol->BytesPerSector;
+    NTSTATUS st;
+
+    while (Length) {
+        UINT32 vcn = (UINT32)(Offset >> Vol->ClusterShift);
+        UINT32 inCluster = (UINT32)(Offset & (Vol->BytesPerCluster - 1));
+        PFAT32_EXTENT run = Fat32ExtentLookup(&Node->Extents, vcn);
+        if (!run) return STATUS_DISK_CORRUPT_ERROR;
+
+        UINT32 runIndex = vcn - run->FileCluster;
+        UINT64 runBytes = ((UINT64)(run->Length - runIndex) << Vol->ClusterShift) - inCluster;
+        UINT32 sector = Fat32ClusterToSector(Vol, run->Cluster + runIndex) + inCluster / bps;
+        UINT32 inSector = inCluster % bps;
+        UINT32 chunk = runBytes < Length ? (UINT32)runBytes : Length;
+        UINT32 n;
+
+        if (inSector || chunk < bps) {
+            n = bps - inSector;
+            if (n > chunk) n = chunk;
+            st = Fat32ReadSectors(Vol, sector, 1, Vol->Scratch);
+            if (!NT_SUCCESS(st)) return st;
+            if (Write) {
+                memcpy(Vol->Scratch + inSector, Buffer, n);
+                st = Fat32WriteSectors(Vol, sector, 1, Vol->Scratch);
+                if (!NT_SUCCESS(st)) return st;
+            } else {
+                memcpy(Buffer, Vol->Scratch + inSector, n);
+            }
+        } else {
+            n = chunk & ~(bps - 1);
+            st = Write ? Fat32WriteSectors(Vol, sector, n / bps, Buffer)
+                       : Fat32ReadSectors(Vol, sector, n / bps, Buffer);
+            if (!NT_SUCCESS(st)) return st;
+        }
+        Offset += n;
+        Buffer += n;
+        Length -= n;
+    }
+    return STATUS_SUCCESS;
+}
+
+/* Zero [From, To) of the file; used when a write lands past end of file */
+static NTSTATUS Fat32ZeroRange(PFAT32_VOLUME Vol, PFAT32_NODE Node, UINT64 From, UINT64 To)
+{
+    UINT8* zero = Vol->DirBuffer; /* cluster-sized, free outside directory scans */
+    while (From < To) {
+        UINT32 n = (To - From) > Vol->BytesPerCluster ? Vol->BytesPerCluster : (UINT32)(To - From);
+        memset(zero, 0, n);
+        NTSTATUS st = Fat32Transfer(Vol, Node, From, zero, n, TRUE);
+        if (!NT_SUCCESS(st)) return st;
+        From += n;
+    }
+    return STATUS_SUCCESS;
+}
+
+/* ---------------------------------------------------------------------------
+ * Directories
+ * --------------------------------------------------------------------------- */
+
+static UINT8 Fat32ShortNameChecksum(const UINT8* Name)
+{
+    UINT8 sum = 0;
+    for (UINT32 i = 0; i < 11; i++) sum = (UINT8)(((sum & 1) << 7) + (sum >> 1) + Name[i]);
+    return sum;
+}
+
+/* "FOO     TXT" -> "FOO.TXT", honouring the NT lower-case flags */
+static void Fat32ShortNameToString(PFAT_DIRENT Entry, PCHAR Out)
+{
+    UINT32 n = 0;
+    for (UINT32 i = 0; i < 8 && Entry->Name[i] != ' '; i++) {
+        CHAR c = (CHAR)Entry->Name[i];
+        if (i == 0 && (UINT8)c == 0x05) c = (CHAR)0xE5;
+        if ((Entry->NtReserved & FAT_NTRES_LOWER_BASE) && c >= 'A' && c <= 'Z') c = (CHAR)(c + 32);
+        Out[n++] = c;
+    }
+    if (Entry->Name[8] != ' ') {
+        Out[n++] = '.';
+        for (UINT32 i = 8; i < 11 && Entry->Name[i] != ' '; i++) {
+            CHAR c = (CHAR)Entry->Name[i];
+            if ((Entry->NtReserved & FAT_NTRES_LOWER_EXT) && c >= 'A' && c <= 'Z') c = (CHAR)(c + 32);
+            Out[n++] = c;
+        }
+    }
+    Out[n] = '\0';
+}
+
+static CHAR Fat32UpCase(CHAR c)
+{
+    return (c >= 'a' && c <= 'z') ? (CHAR)(c - 32) : c;
+}
+
+/* FAT names compare case-insensitively; Length bounds the path component */
+static BOOL Fat32NameEquals(PCSTR Name, PCSTR Component, UINT32 Length)
+{
+    UINT32 i;
+    for (i = 0; i < Length; i++) {
+        if (!Name[i] || Fat32UpCase(Name[i]) != Fat32UpCase(Component[i])) return FALSE;
+    }
+    return Name[i] == '\0';
+}
+
+/* Visit every live entry of a directory from byte offset Start (0 or the
+ * end of an earlier entry) with its long name, or the 8.3 name when there is
+ * no valid LFN set. Volume labels are skipped. */
+static NTSTATUS Fat32ScanDirectory(PFAT32_VOLUME Vol, UINT32 DirCluster, UINT32 Start, PFAT32_DIR_VISITOR Visitor, PVOID Context)
+{
+    UINT32 vcn = 0;
+    FAT32_EXTENT_LIST list;
+    CHAR name[FAT_NAME_MAX + 1];
+    UINT8 lfnChecksum = 0;
+    INT32 lfnNext = -1;         /* next expected LFN ordinal, -1 when no set is open */
+    BOOL lfnValid = FALSE;
+    NTSTATUS st = Fat32BuildExtents(Vol, DirCluster, &list);
+    if (!NT_SUCCESS(st)) return st;
+
+    for (UINT32 r = 0; r < list.Count; r++) {
+        for (UINT32 c = 0; c < list.Runs[r].Length; c++, vcn++) {
+            UINT32 sector = Fat32ClusterToSector(Vol, list.Runs[r].Cluster + c);
+            UINT32 base = vcn << Vol->ClusterShift;
+            if (base + Vol->BytesPerCluster <= Start) continue;
+            st = Fat32ReadSectors(Vol, sector, Vol->SectorsPerCluster, Vol->DirBuffer);
+            if (!NT_SUCCESS(st)) goto out;
+
+            for (UINT32 off = Start > base ? Start - base : 0; off < Vol->BytesPerCluster; off += sizeof(FAT_DIRENT)) {
+                PFAT_DIRENT de = (PFAT_DIRENT)(Vol->DirBuffer + off);
+                if (de->Name[0] == FAT_DIRENT_END) goto out;
+                if (de->Name[0] == FAT_DIRENT_FREE) {
+                    lfnNext = -1;
+                    continue;
+                }
+                if ((de->Attributes & 0x3F) == FAT_ATTR_LFN) {
+                    PFAT_LFN_ENTRY lfn = (PFAT_LFN_ENTRY)de;
+                    UINT32 ord = lfn->Order & 0x1F;
+                    UINT16 chars[FAT_LFN_CHARS];
+                    if (lfn->Order & FAT_LFN_LAST) {
+                        lfnNext = (INT32)ord;
+                        lfnChecksum = lfn->Checksum;
+                        lfnValid = ord >= 1 && ord * FAT_LFN_CHARS <= FAT_NAME_MAX + FAT_LFN_CHARS;
+                        if (lfnValid) memset(name, 0, sizeof(name));
+                    }
+                    if (lfnNext < 0 || ord != (UINT32)lfnNext || lfn->Checksum != lfnChecksum || !lfnValid) {
+                        lfnNext = -1;
+                        continue;
+                    }
+                    memcpy(chars, lfn->Name1, sizeof(lfn->Name1));
+                    memcpy(chars + 5, lfn->Name2, sizeof(lfn->Name2));
+                    memcpy(chars + 11, lfn->Name3, sizeof(lfn->Name3));
+                    for (UINT32 i = 0; i < FAT_LFN_CHARS; i++) {
+                        UINT32 pos = (ord - 1) * FAT_LFN_CHARS + i;
+                        if (chars[i] == 0x0000 || chars[i] == 0xFFFF || pos >= FAT_NAME_MAX) break;
+                        name[pos] = chars[i] < 0x80 ? (CHAR)chars[i] : '?'; /* no UCS-2 in the VFS yet */
+                    }
+                    lfnNext--;
+                    continue;
+                }
+
+                /* Short entry: it closes any LFN set that precedes it */
+                BOOL haveLfn = lfnNext == 0 && lfnChecksum == Fat32ShortNameChecksum(de->Name);
+                lfnNext = -1;
+                if (de->Attributes & FAT_ATTR_VOLUME_ID) continue;
+                if (!haveLfn) Fat32ShortNameToString(de, name);
+                if (Visitor(name, de, sector + off / Vol->BytesPerSector, off % Vol->BytesPerSector,
+                            base + off + (UINT32)sizeof(FAT_DIRENT), Context)) {
+                    goto out;
+                }
+            }
+        }
+    }
+out:
+    Fat32FreeExtents(&list);
+    return st;
+}
+
+typedef struct _FAT32_LOOKUP {
+    PCSTR Component;
+    UINT32 Length;
+    BOOL Found;
+    FAT_DIRENT Entry;
+    UINT32 Sector;
+    UINT32 Offset;
+} FAT32_LOOKUP, *PFAT32_LOOKUP;
+
+static BOOL Fat32LookupVisitor(IN PCSTR Name, IN PFAT_DIRENT Entry, IN UINT32 Sector, IN UINT32 Offset, IN UINT32 Next, IN PVOID Context)
+{
+    PFAT32_LOOKUP lookup = (PFAT32_LOOKUP)Context;
+    if (!Fat32NameEquals(Name, lookup->Component, lookup->Length)) return FALSE;
+    lookup->Found = TRUE;
+    lookup->Entry = *Entry;
+    lookup->Sector = Sector;
+    lookup->Offset = Offset;
+    UNREFERENCED_PARAMETER(Next);
+    return TRUE;
+}
+
+typedef struct _FAT32_READDIR {
+    PVOID Buffer;
+    UINT32 Size;
+    UINT32 Used;
+    UINT32 Cursor;
+    BOOL Full;
+} FAT32_READDIR, *PFAT32_READDIR;
+
+static BOOL Fat32ReadDirVisitor(IN PCSTR Name, IN PFAT_DIRENT Entry, IN UINT32 Sector, IN UINT32 Offset, IN UINT32 Next, IN PVOID Context)
+{
+    PFAT32_READDIR rd = (PFAT32_READDIR)Context;
+    BOOL dir = (Entry->Attributes & FAT_ATTR_DIRECTORY) != 0;
+    UNREFERENCED_PARAMETER(Sector);
+    UNREFERENCED_PARAMETER(Offset);
+    /* The VFS namespace has no "." or ".." */
+    if (Name[0] == '.' && (Name[1] == '\0' || (Name[1] == '.' && Name[2] == '\0'))) return FALSE;
+    if (!FsPackDirent(rd->Buffer, rd->Size, &rd->Used, Name, (UINT32)strlen(Name), dir ? FS_DT_DIRECTORY : FS_DT_FILE,
+                      dir ? 0 : Entry->FileSize, Next)) {
+        rd->Full = TRUE;
+        return TRUE;
+    }
+    rd->Cursor = Next;
+    return FALSE;
+}
+
+static UINT32 Fat32DirentCluster(PFAT_DIRENT Entry)
+{
+    return ((UINT32)Entry->FirstClusterHigh << 16) | Entry->FirstClusterLow;
+}
+
+/* Resolve an absolute path to its directory entry */
+static NTSTATUS Fat32ResolvePath(PFAT32_VOLUME Vol, PCSTR Path, PFAT32_NODE Node)
+{
+    UINT32 dirCluster = Vol->RootCluster;
+    FAT32_LOOKUP lookup;
+
+    memset(Node, 0, sizeof(*Node));
+    Node->FirstCluster = Vol->RootCluster;
+    Node->Attributes = FAT_ATTR_DIRECTORY;
+
+    while (*Path) {
+        while (*Path == '/' || *Path == '\\') Path++;
+        if (!*Path) break;
+        PCSTR end = Path;
+        while (*end && *end != '/' && *end != '\\') end++;
+        if (!(Node->Attributes & FAT_ATTR_DIRECTORY)) return STATUS_NOT_A_DIRECTORY;
+
+        memset(&lookup, 0, sizeof(lookup));
+        lookup.Component = Path;
+        lookup.Length = (UINT32)(end - Path);
+        NTSTATUS st = Fat32ScanDirectory(Vol, dirCluster, 0, Fat32LookupVisitor, &lookup);
+        if (!NT_SUCCESS(st)) return st;
+        if (!lookup.Found) return STATUS_OBJECT_NAME_NOT_FOUND;
+
+        Node->FirstCluster = Fat32DirentCluster(&lookup.Entry);
+        Node->Size = lookup.Entry.FileSize;
+        Node->Attributes = lookup.Entry.Attributes;
+        Node->DirentSector = lookup.Sector;
+        Node->DirentOffset = lookup.Offset;
+        /* ".." pointing at the root is stored as cluster 0 */
+        if ((Node->Attributes & FAT_ATTR_DIRECTORY) && Node->FirstCluster == 0) Node->FirstCluster = Vol->RootCluster;
+        dirCluster = Node->FirstCluster;
+        Path = end;
+    }
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS Fat32UpdateDirent(PFAT32_VOLUME Vol, PFAT32_NODE Node)
+{
+    if (!Node->DirentSector) return STATUS_SUCCESS; /* the root has no entry */
+    NTSTATUS st = Fat32ReadSectors(Vol, Node->DirentSector, 1, Vol->Scratch);
+    if (!NT_SUCCESS(st)) return st;
+    PFAT_DIRENT de = (PFAT_DIRENT)(Vol->Scratch + Node->DirentOffset);
+    de->FirstClusterHigh = (UINT16)(Node->FirstCluster >> 16);
+    de->FirstClusterLow = (UINT16)Node->FirstCluster;
+    de->FileSize = Node->Size;
+    if (!(Node->Attributes & FAT_ATTR_DIRECTORY)) de->Attributes |= FAT_ATTR_ARCHIVE;
+    return Fat32WriteSectors(Vol, Node->DirentSector, 1, Vol->Scratch);
+}
+
+/* Free the clusters past the ones Size needs: preallocation nothing was
+ * written to, or the rest of an extension that failed part way */
+static NTSTATUS Fat32TrimChain(PFAT32_VOLUME Vol, PFAT32_NODE Node)
+{
+    PFAT32_EXTENT_LIST list = &Node->Extents;
+    UINT32 keep = (UINT32)(((UINT64)Node->Size + Vol->BytesPerCluster - 1) >> Vol->ClusterShift);
+    PFAT32_EXTENT run;
+    NTSTATUS st;
+
+    if (list->Clusters <= keep) return STATUS_SUCCESS;
+    run = Fat32ExtentLookup(list, keep);
+    if (!run) return STATUS_DISK_CORRUPT_ERROR;
+    UINT32 first = run->Cluster + (keep - run->FileCluster);
+    if (keep) {
+        PFAT32_EXTENT last = Fat32ExtentLookup(list, keep - 1);
+        st = Fat32SetEntry(Vol, last->Cluster + (keep - 1 - last->FileCluster), FAT32_EOC);
+        if (!NT_SUCCESS(st)) return st;
+        list->Count = (UINT32)(last - list->Runs) + 1;
+        last->Length = keep - last->FileCluster;
+    } else {
+        Node->FirstCluster = 0;
+        list->Count = 0;
+    }
+    list->Clusters = keep;
+    Node->Modified = TRUE;
+    st = Fat32FreeChain(Vol, first);
+    if (!keep && NT_SUCCESS(st)) st = Fat32UpdateDirent(Vol, Node);
+    return st;
+}
+
+/* ---------------------------------------------------------------------------
+ * Volume
+ * --------------------------------------------------------------------------- */
+
+static NTSTATUS Fat32WriteFsInfo(PFAT32_VOLUME Vol)
+{
+    if (!Vol->FsInfoDirty || !Vol->FsInfoSector || Vol->ReadOnly) return STATUS_SUCCESS;
+    NTSTATUS st = Fat32ReadSectors(Vol, Vol->FsInfoSector, 1, Vol->Scratch);
+    if (!NT_SUCCESS(st)) return st;
+    if (*(UINT32*)Vol->Scratch != FAT32_FSINFO_LEAD_SIG || *(UINT32*)(Vol->Scratch + 484) != FAT32_FSINFO_STRUCT_SIG) {
+        return STATUS_SUCCESS;
+    }
+    *(UINT32*)(Vol->Scratch + 488) = Vol->FreeCount;
+    *(UINT32*)(Vol->Scratch + 492) = Vol->NextFree;
+    st = Fat32WriteSectors(Vol, Vol->FsInfoSector, 1, Vol->Scratch);
+    if (NT_SUCCESS(st)) Vol->FsInfoDirty = FALSE;
+    return st;
+}
+
+static NTSTATUS Fat32FlushVolume(PFAT32_VOLUME Vol)
+{
+    NTSTATUS st;
+    if (Vol->ReadOnly) return STATUS_SUCCESS;
+    st = Fat32FlushFat(Vol);
+    if (NT_SUCCESS(st)) st = Fat32WriteFsInfo(Vol);
+    if (NT_SUCCESS(st)) st = BlockFlush(Vol->Device);
+    return st;
+}
+
+static NTSTATUS Fat32ParseBpb(PFAT32_VOLUME Vol, PFAT32_BPB Bpb, UINT8* Sector)
+{
+    UINT32 totalSectors, dataSectors;
+
+    if (Sector[510] != 0x55 || Sector[511] != 0xAA) return STATUS_UNRECOGNIZED_VOLUME;
+    if (Bpb->Jump[0] != 0xEB && Bpb->Jump[0] != 0xE9) return STATUS_UNRECOGNIZED_VOLUME;
+    if (!Fat32IsPowerOfTwo(Bpb->BytesPerSector) || Bpb->BytesPerSector < 512 || Bpb->BytesPerSector > 4096) return STATUS_UNRECOGNIZED_VOLUME;
+    if (!Fat32IsPowerOfTwo(Bpb->SectorsPerCluster)) return STATUS_UNRECOGNIZED_VOLUME;
+    if (Bpb->ReservedSectors == 0 || Bpb->NumFats == 0) return STATUS_UNRECOGNIZED_VOLUME;
+    /* FAT32 has no fixed root directory and only the 32-bit FAT size */
+    if (Bpb->RootEntries != 0 || Bpb->FatSize16 != 0 || Bpb->FatSize32 == 0) return STATUS_UNRECOGNIZED_VOLUME;
+
+    totalSectors = Bpb->TotalSectors16 ? Bpb->TotalSectors16 : Bpb->TotalSectors32;
+    Vol->BytesPerSector = Bpb->BytesPerSector;
+    Vol->SectorsPerCluster = Bpb->SectorsPerCluster;
+    Vol->BytesPerCluster = Vol->BytesPerSector * Vol->SectorsPerCluster;
+    Vol->ClusterShift = Fat32Log2(Vol->BytesPerCluster);
+    Vol->ReservedSectors = Bpb->ReservedSectors;
+    Vol->NumFats = Bpb->NumFats;
+    Vol->FatSectors = Bpb->FatSize32;
+    Vol->Mirror = !(Bpb->ExtFlags & 0x80);
+    Vol->ActiveFat = Vol->Mirror ? 0 : (Bpb->ExtFlags & 0x0F);
+    Vol->FirstDataSector = Vol->ReservedSectors + Vol->NumFats * Vol->FatSectors;
+    Vol->RootCluster = Bpb->RootCluster;
+    Vol->FsInfoSector = Bpb->FsInfoSector;
+
+    if (Vol->ActiveFat >= Vol->NumFats || totalSectors <= Vol->FirstDataSector) return STATUS_UNRECOGNIZED_VOLUME;
+    dataSectors = totalSectors - Vol->FirstDataSector;
+    Vol->ClusterCount = dataSectors / Vol->SectorsPerCluster;
+    if (Vol->ClusterCount < FAT32_MIN_CLUSTERS) return STATUS_UNRECOGNIZED_VOLUME;
+    /* The FAT must be able to describe every cluster */
+    if ((UINT64)(Vol->ClusterCount + FAT32_FIRST_CLUSTER) * 4 > (UINT64)Vol->FatSectors * Vol->BytesPerSector) {
+        return STATUS_DISK_CORRUPT_ERROR;
+    }
+    if (!Fat32IsDataCluster(Vol, Vol->RootCluster)) return STATUS_DISK_CORRUPT_ERROR;
+    return STATUS_SUCCESS;
+}
+
+static void Fat32ReadFsInfo(PFAT32_VOLUME Vol)
+{
+    Vol->FreeCount = FAT32_FREE_UNKNOWN;
+    Vol->NextFree = FAT32_FIRST_CLUSTER;
+    if (Vol->FsInfoSector == 0 || Vol->FsInfoSector >= Vol->ReservedSectors) Vol->FsInfoSector = 0;
+    else if (NT_SUCCESS(Fat32ReadSectors(Vol, Vol->FsInfoSector, 1, Vol->Scratch)) &&
+             *(UINT32*)Vol->Scratch == FAT32_FSINFO_LEAD_SIG &&
+             *(UINT32*)(Vol->Scratch + 484) == FAT32_FSINFO_STRUCT_SIG) {
+        UINT32 freeCount = *(UINT32*)(Vol->Scratch + 488);
+        UINT32 nextFree = *(UINT32*)(Vol->Scratch + 492);
+        if (freeCount <= Vol->ClusterCount) Vol->FreeCount = freeCount;
+        if (Fat32IsDataCluster(Vol, nextFree)) Vol->NextFree = nextFree;
+    }
+
+    /* The free count is only a hint; recount when the whole FAT is in memory
+     * anyway, indexing the free runs on the way. Larger FATs are read for
+     * the index on the first allocation. */
+    if (Vol->FatResident) Fat32BuildFreeIndex(Vol);
+}
+
+/* Options are comma separated; "ro" mounts read-only */
+static BOOL Fat32HasOption(PCSTR Options, PCSTR Name)
+{
+    UINT32 len = (UINT32)strlen(Name);
+    if (!Options) return FALSE;
+    while (*Options) {
+        PCSTR end = Options;
+        while (*end && *end != ',') end++;
+        if ((UINT32)(end - Options) == len && strncmp(Options, Name, len) == 0) return TRUE;
+        Options = *end ? end + 1 : end;
+    }
+    return FALSE;
+}
+
+static void Fat32FreeVolume(PFAT32_VOLUME Vol)
+{
+    UINT32 slots = Vol->FatResident ? Vol->FatSectors : FAT32_CACHE_SLOTS;
+    Fat32Free(Vol->FatBuffer, slots * Vol->BytesPerSector);
+    Fat32Free(Vol->SlotSector, FAT32_CACHE_SLOTS * sizeof(UINT32));
+    Fat32Free(Vol->DirtyBits, ((slots + 31) / 32) * sizeof(UINT32));
+    if (Vol->FreeRuns) MemFreePages(Vol->FreeRuns, (UINT32)(((UINT64)Vol->FreeRunCapacity * sizeof(FAT32_FREE_RUN) + 4095) / 4096));
+    Fat32Free(Vol->Scratch, Vol->BytesPerSector);
+    Fat32Free(Vol->DirBuffer, Vol->BytesPerCluster);
+    Fat32Free(Vol, sizeof(FAT32_VOLUME));
+}
+
 static NTSTATUS fat32_mount(IN PCSTR Device, IN PCSTR Options, OUT PVOID* VolumeCtx)
 {
-    UNREFERENCED_PARAMETER(Device);
-    UNREFERENCED_PARAMETER(Options);
-    static FAT32_VOLUME vol = {0};
-    *VolumeCtx = &vol;
+    PAIO_DEVICE_OBJECT dev;
+    PBLOCK_DEVICE_EXTENSION ext;
+    PFAT32_VOLUME vol;
+    UINT8* boot;
+    NTSTATUS st;
+
+    if (!Device || !VolumeCtx) return STATUS_INVALID_PARAMETER;
+    dev = IoGetDeviceByName(Device);
+    if (!dev || (dev->DeviceType >> 16) != IO_DEVICE_CLASS_BLOCK || !dev->DeviceExtension) return STATUS_NOT_FOUND;
+    ext = (PBLOCK_DEVICE_EXTENSION)dev->DeviceExtension;
+    if (ext->BlockSize == 0 || ext->BlockSize > 4096) return STATUS_NOT_SUPPORTED;
+
+    vol = (PFAT32_VOLUME)Fat32Allocate(sizeof(FAT32_VOLUME));
+    boot = (UINT8*)Fat32Allocate(4096);
+    if (!vol || !boot) {
+        st = STATUS_INSUFFICIENT_RESOURCES;
+        goto fail;
+    }
+    vol->Device = dev;
+    vol->ReadOnly = Fat32HasOption(Options, "ro");
+    AuroraInitializeSpinLock(&vol->Lock);
+
+    /* Read enough device blocks to cover a 512-byte boot sector */
+    st = BlockRead(dev, 0, (512 + ext->BlockSize - 1) / ext->BlockSize, boot);
+    if (NT_SUCCESS(st)) st = Fat32ParseBpb(vol, (PFAT32_BPB)boot, boot);
+    if (NT_SUCCESS(st) && vol->BytesPerSector % ext->BlockSize) st = STATUS_NOT_SUPPORTED;
+    if (!NT_SUCCESS(st)) goto fail;
+    vol->BlocksPerSector = vol->BytesPerSector / ext->BlockSize;
+    Fat32Free(boot, 4096);
+    boot = NULL;
+
+    vol->Scratch = (UINT8*)Fat32Allocate(vol->BytesPerSector);
+    vol->DirBuffer = (UINT8*)Fat32Allocate(vol->BytesPerCluster);
+    if (!vol->Scratch || !vol->DirBuffer) {
+        st = STATUS_INSUFFICIENT_RESOURCES;
+        goto fail;
+    }
+    st = Fat32InitFatCache(vol);
+    if (!NT_SUCCESS(st)) goto fail;
+    Fat32ReadFsInfo(vol);
+
+    AuroraDebugPrint("[fat32] %s: %u clusters of %u bytes, FAT %s", Device, vol->ClusterCount,
+                     vol->BytesPerCluster, vol->FatResident ? "resident" : "cached");
+    *VolumeCtx = vol;
     return STATUS_SUCCESS;
+
+fail:
+    Fat32Free(boot, 4096);
+    if (vol) Fat32FreeVolume(vol);
+    return st;
 }
+
+/* The VFS only unmounts once every handle is closed, so no nodes remain */
 static NTSTATUS fat32_unmount(IN PVOID VolumeCtx)
 {
-    UNREFERENCED_PARAMETER(VolumeCtx);
+    PFAT32_VOLUME vol = (PFAT32_VOLUME)VolumeCtx;
+    NTSTATUS st;
+    if (!vol) return STATUS_INVALID_PARAMETER;
+    if (vol->Nodes) return STATUS_DEVICE_BUSY;
+    st = Fat32FlushVolume(vol);
+    if (!NT_SUCCESS(st)) return st;
+    Fat32FreeVolume(vol);
+    return STATUS_SUCCESS;
+}
+
+/* ---------------------------------------------------------------------------
+ * File operations
+ * --------------------------------------------------------------------------- */
+
+/* Reference the open node for Path, creating it on first open. Nodes are
+ * keyed by where their directory entry sits (the root has none). */
+static NTSTATUS Fat32GetNode(PFAT32_VOLUME Vol, PCSTR Path, PFAT32_NODE* Node)
+{
+    FAT32_NODE found;
+    PFAT32_NODE node;
+    NTSTATUS st = Fat32ResolvePath(Vol, Path, &found);
+    if (!NT_SUCCESS(st)) return st;
+
+    for (node = Vol->Nodes; node; node = node->Next) {
+        if (node->DirentSector == found.DirentSector && node->DirentOffset == found.DirentOffset) {
+            node->RefCount++;
+            *Node = node;
+            return STATUS_SUCCESS;
+        }
+    }
+
+    node = (PFAT32_NODE)Fat32Allocate(sizeof(FAT32_NODE));
+    if (!node) return STATUS_INSUFFICIENT_RESOURCES;
+    *node = found;
+    st = Fat32BuildExtents(Vol, node->FirstCluster, &node->Extents);
+    if (!NT_SUCCESS(st)) {
+        Fat32FreeExtents(&node->Extents);
+        Fat32Free(node, sizeof(FAT32_NODE));
+        return st;
+    }
+    /* A size beyond the chain means a damaged entry; clamp rather than read garbage */
+    if (!(node->Attributes & FAT_ATTR_DIRECTORY) && ((UINT64)node->Extents.Clusters << Vol->ClusterShift) < node->Size) {
+        node->Size = (UINT32)((UINT64)node->Extents.Clusters << Vol->ClusterShift);
+    }
+    node->RefCount = 1;
+    node->Next = Vol->Nodes;
+    Vol->Nodes = node;
+    *Node = node;
+    return STATUS_SUCCESS;
+}
+
+/* Drop a handle's reference. The last one trims the chain back to the size
+ * and flushes the volume if anything was written through the node. */
+static NTSTATUS Fat32PutNode(PFAT32_VOLUME Vol, PFAT32_NODE Node)
+{
+    PFAT32_NODE* link;
+    NTSTATUS st = STATUS_SUCCESS;
+
+    if (--Node->RefCount) return STATUS_SUCCESS;
+    if (Node->Modified) {
+        /* FAT cannot record clusters held past the end of file, and chkdsk
+         * takes a chain longer than the size for damage, so they go here */
+        if (!(Node->Attributes & FAT_ATTR_DIRECTORY)) st = Fat32TrimChain(Vol, Node);
+        NTSTATUS flush = Fat32FlushVolume(Vol);
+        if (NT_SUCCESS(st)) st = flush;
+    }
+    for (link = &Vol->Nodes; *link != Node; link = &(*link)->Next) {}
+    *link = Node->Next;
+    Fat32FreeExtents(&Node->Extents);
+    Fat32Free(Node, sizeof(FAT32_NODE));
+    return st;
+}
+
+static NTSTATUS fat32_open(IN PVOID VolumeCtx, IN PCSTR Path, OUT FS_FILE* File)
+{
+    PFAT32_VOLUME vol = (PFAT32_VOLUME)VolumeCtx;
+    PFAT32_FILE file;
+    NTSTATUS st;
+
+    if (!vol || !Path || !File) return STATUS_INVALID_PARAMETER;
+    file = (PFAT32_FILE)Fat32Allocate(sizeof(FAT32_FILE));
+    if (!file) return STATUS_INSUFFICIENT_RESOURCES;
+    file->Volume = vol;
+
+    AURORA_IRQL irql;
+    AuroraAcquireSpinLock(&vol->Lock, &irql);
+    st = Fat32GetNode(vol, Path, &file->Node);
+    AuroraReleaseSpinLock(&vol->Lock, irql);
+    if (!NT_SUCCESS(st)) {
+        Fat32Free(file, sizeof(FAT32_FILE));
+        return st;
+    }
+    *File = file;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fat32_close(IN FS_FILE File)
+{
+    PFAT32_FILE file = (PFAT32_FILE)File;
+    AURORA_IRQL irql;
+    NTSTATUS st;
+    if (!file) return STATUS_INVALID_PARAMETER;
+    AuroraAcquireSpinLock(&file->Volume->Lock, &irql);
+    st = Fat32PutNode(file->Volume, file->Node);
+    AuroraReleaseSpinLock(&file->Volume->Lock, irql);
+    Fat32Free(file, sizeof(FAT32_FILE));
+    return st;
+}
+
+/* Positional reads and writes under the volume lock; the file position is
+ * left alone. FAT32 files stay below 4 GiB, so clamped lengths fit the
+ * 32-bit transfer helpers. */
+static NTSTATUS fat32_read_at(IN FS_FILE File, IN UINT64 Offset, IN PFS_IO_SEGMENT Segments, IN UINT32 SegmentCount, OUT PUINT64 BytesRead)
+{
+    PFAT32_FILE file = (PFAT32_FILE)File;
+    PFAT32_NODE node;
+    UINT64 done = 0;
+    NTSTATUS st = STATUS_SUCCESS;
+    if (BytesRead) *BytesRead = 0;
+    if (!file || (!Segments && SegmentCount)) return STATUS_INVALID_PARAMETER;
+    node = file->Node;
+    if (node->Attributes & FAT_ATTR_DIRECTORY) return STATUS_FILE_IS_A_DIRECTORY;
+    for (UINT32 i = 0; i < SegmentCount; i++) {
+        if (!Segments[i].Buffer && Segments[i].Length) return STATUS_INVALID_PARAMETER;
+    }
+
+    AURORA_IRQL irql;
+    AuroraAcquireSpinLock(&file->Volume->Lock, &irql);
+    for (UINT32 i = 0; i < SegmentCount && Offset + done < node->Size; i++) {
+        UINT64 len = Segments[i].Length;
+        if (len > node->Size - (Offset + done)) len = node->Size - (Offset + done);
+        st = Fat32Transfer(file->Volume, node, Offset + done, (UINT8*)Segments[i].Buffer, (UINT32)len, FALSE);
+        if (!NT_SUCCESS(st)) break;
+        done += len;
+    }
+    AuroraReleaseSpinLock(&file->Volume->Lock, irql);
+    if (!NT_SUCCESS(st) && !done) return st;
+    if (BytesRead) *BytesRead = done;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fat32_write_at(IN FS_FILE File, IN UINT64 Offset, IN PFS_IO_SEGMENT Segments, IN UINT32 SegmentCount, OUT PUINT64 BytesWritten)
+{
+    PFAT32_FILE file = (PFAT32_FILE)File;
+    PFAT32_VOLUME vol;
+    PFAT32_NODE node;
+    UINT32 firstCluster;
+    UINT64 end = Offset, pos = Offset;
+    NTSTATUS st;
+    if (BytesWritten) *BytesWritten = 0;
+    if (!file || (!Segments && SegmentCount)) return STATUS_INVALID_PARAMETER;
+    vol = file->Volume;
+    node = file->Node;
+    if (vol->ReadOnly || (node->Attributes & FAT_ATTR_READ_ONLY)) return STATUS_MEDIA_WRITE_PROTECTED;
+    if (node->Attributes & FAT_ATTR_DIRECTORY) return STATUS_FILE_IS_A_DIRECTORY;
+    for (UINT32 i = 0; i < SegmentCount; i++) {
+        if (!Segments[i].Buffer && Segments[i].Length) return STATUS_INVALID_PARAMETER;
+        end += Segments[i].Length;
+        if (end > 0xFFFFFFFFull) return STATUS_FILE_TOO_LARGE;
+    }
+    if (end == Offset) return STATUS_SUCCESS;
+
+    AURORA_IRQL irql;
+    AuroraAcquireSpinLock(&vol->Lock, &irql);
+    firstCluster = node->FirstCluster;
+    /* One chain extension covers every segment */
+    st = Fat32ExtendChain(vol, node, (UINT32)((end + vol->BytesPerCluster - 1) >> vol->ClusterShift));
+    if (NT_SUCCESS(st) && Offset > node->Size) st = Fat32ZeroRange(vol, node, node->Size, Offset);
+    for (UINT32 i = 0; i < SegmentCount && NT_SUCCESS(st); i++) {
+        if (!Segments[i].Length) continue;
+        st = Fat32Transfer(vol, node, pos, (UINT8*)Segments[i].Buffer, (UINT32)Segments[i].Length, TRUE);
+        pos += Segments[i].Length;
+    }
+    if (NT_SUCCESS(st) && (end > node->Size || firstCluster != node->FirstCluster)) {
+        node->Size = end > node->Size ? (UINT32)end : node->Size;
+        node->Modified = TRUE;
+        st = Fat32UpdateDirent(vol, node);
+    }
+    AuroraReleaseSpinLock(&vol->Lock, irql);
+    if (!NT_SUCCESS(st)) return st;
+    if (BytesWritten) *BytesWritten = end - Offset;
+    return STATUS_SUCCESS;
+}
+
+/* FAT has no allocated-but-unwritten state, so growing the size zeroes the
+ * new range on disk. With FS_ALLOCATE_KEEP_SIZE the clusters are only
+ * chained on, for writes to land in later; the last close frees any left
+ * unused. */
+static NTSTATUS fat32_allocate(IN FS_FILE File, IN UINT64 Offset, IN UINT64 Length, IN UINT32 Flags)
+{
+    PFAT32_FILE file = (PFAT32_FILE)File;
+    PFAT32_VOLUME vol;
+    PFAT32_NODE node;
+    UINT32 firstCluster, size;
+    UINT64 end = Offset + Length;
+    NTSTATUS st;
+    if (!file || end < Offset || (Flags & ~FS_ALLOCATE_KEEP_SIZE)) return STATUS_INVALID_PARAMETER;
+    vol = file->Volume;
+    node = file->Node;
+    if (vol->ReadOnly || (node->Attributes & FAT_ATTR_READ_ONLY)) return STATUS_MEDIA_WRITE_PROTECTED;
+    if (node->Attributes & FAT_ATTR_DIRECTORY) return STATUS_FILE_IS_A_DIRECTORY;
+    if (end > 0xFFFFFFFFull) return STATUS_FILE_TOO_LARGE;
+    if (!Length) return STATUS_SUCCESS;
+
+    AURORA_IRQL irql;
+    AuroraAcquireSpinLock(&vol->Lock, &irql);
+    firstCluster = node->FirstCluster;
+    size = node->Size;
+    st = Fat32ExtendChain(vol, node, (UINT32)((end + vol->BytesPerCluster - 1) >> vol->ClusterShift));
+    if (NT_SUCCESS(st) && !(Flags & FS_ALLOCATE_KEEP_SIZE) && end > node->Size) {
+        st = Fat32ZeroRange(vol, node, node->Size, end);
+        if (NT_SUCCESS(st)) node->Size = (UINT32)end;
+    }
+    if (firstCluster != node->FirstCluster || size != node->Size) {
+        NTSTATUS dirent = Fat32UpdateDirent(vol, node);
+        if (NT_SUCCESS(st)) st = dirent;
+    }
+    AuroraReleaseSpinLock(&vol->Lock, irql);
+    return st;
+}
+
+static NTSTATUS fat32_read(IN FS_FILE File, OUT PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesRead)
+{
+    PFAT32_FILE file = (PFAT32_FILE)File;
+    FS_IO_SEGMENT seg;
+    UINT64 done = 0;
+    NTSTATUS st;
+    if (BytesRead) *BytesRead = 0;
+    if (!file) return STATUS_INVALID_PARAMETER;
+    seg.Buffer = Buffer;
+    seg.Length = Size;
+    st = fat32_read_at(File, file->Position, &seg, 1, &done);
+    if (!NT_SUCCESS(st)) return st;
+    file->Position += done;
+    if (BytesRead) *BytesRead = (UINT32)done;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fat32_write(IN FS_FILE File, IN PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesWritten)
+{
+    PFAT32_FILE file = (PFAT32_FILE)File;
+    FS_IO_SEGMENT seg;
+    UINT64 done = 0;
+    NTSTATUS st;
+    if (BytesWritten) *BytesWritten = 0;
+    if (!file) return STATUS_INVALID_PARAMETER;
+    seg.Buffer = Buffer;
+    seg.Length = Size;
+    st = fat32_write_at(File, file->Position, &seg, 1, &done);
+    if (!NT_SUCCESS(st)) return st;
+    file->Position += done;
+    if (BytesWritten) *BytesWritten = (UINT32)done;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS fat32_seek(IN FS_FILE File, IN INT64 Offset, IN UINT32 Origin, OUT PUINT64 NewPosition)
+{
+    PFAT32_FILE file = (PFAT32_FILE)File;
+    INT64 base;
+    if (!file) return STATUS_INVALID_PARAMETER;
+    switch (Origin) {
+        case FS_SEEK_SET: base = 0; break;
+        case FS_SEEK_CUR: base = (INT64)file->Position; break;
+        case FS_SEEK_END: base = (INT64)file->Node->Size; break;
+        default: return STATUS_INVALID_PARAMETER;
+    }
+    if (base + Offset < 0) return STATUS_INVALID_PARAMETER;
+    file->Position = (UINT64)(base + Offset);
+    if (NewPosition) *NewPosition = file->Position;
+    return STATUS_SUCCESS;
+}
+
+/* The cursor is a byte offset into the directory. Deleting a FAT entry only
+ * marks its slot free, so the offsets of the others never move. */
+static NTSTATUS fat32_read_dir(IN FS_FILE File, IN OUT PUINT64 Cursor, OUT PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesReturned)
+{
+    PFAT32_FILE file = (PFAT32_FILE)File;
+    FAT32_READDIR rd;
+    AURORA_IRQL irql;
+    NTSTATUS st;
+
+    if (BytesReturned) *BytesReturned = 0;
+    if (!file || !Cursor || !BytesReturned) return STATUS_INVALID_PARAMETER;
+    if (!(file->Node->Attributes & FAT_ATTR_DIRECTORY)) return STATUS_NOT_A_DIRECTORY;
+    if (*Cursor > 0xFFFFFFFFull) return STATUS_NO_MORE_ENTRIES;
+    memset(&rd, 0, sizeof(rd));
+    rd.Buffer = Buffer;
+    rd.Size = Size;
+    rd.Cursor = (UINT32)*Cursor;
+
+    AuroraAcquireSpinLock(&file->Volume->Lock, &irql);
+    st = Fat32ScanDirectory(file->Volume, file->Node->FirstCluster, rd.Cursor, Fat32ReadDirVisitor, &rd);
+    AuroraReleaseSpinLock(&file->Volume->Lock, irql);
+    if (!NT_SUCCESS(st)) return st;
+    if (!rd.Used) return rd.Full ? STATUS_BUFFER_TOO_SMALL : STATUS_NO_MORE_ENTRIES;
+    *Cursor = rd.Cursor;
+    *BytesReturned = rd.Used;
     return STATUS_SUCCESS;
 }
 
@@ -27,5 +1465,15 @@ void FsAdapterRegisterFat32(void)
     drv.Name = "fat32";
     drv.Ops.Mount = fat32_mount;
     drv.Ops.Unmount = fat32_unmount;
+    drv.Ops.Open = fat32_open;
+    drv.Ops.Close = fat32_close;
+    drv.Ops.Read = fat32_read;
+    drv.Ops.Write = fat32_write;
+    drv.Ops.Seek = fat32_seek;
+    drv.Ops.ReadAt = fat32_read_at;
+    drv.Ops.WriteAt = fat32_write_at;
+    drv.Ops.ReadDir = fat32_read_dir;
+    drv.Ops.Allocate = fat32_allocate;
+    drv.Flags = FS_DRIVER_CACHED;
     FsRegisterDriver(&drv);
 }
@@ -5,9 +5,9 @@
 #include "../aurora.h"
 #include "../include/kern.h"
 #include "../include/fs.h"
+#include "vfs.h"
 
 static BOOL g_FsInitialized = FALSE;
-static FS_MOUNT g_Mounts[FS_MAX_MOUNTS];
 static FS_DRIVER g_Drivers[FS_MAX_DRIVERS];
 static UINT32 g_DriverCount = 0;
 static AURORA_SPINLOCK g_FsLock;
@@ -16,14 +16,17 @@ static AURORA_SPINLOCK g_FsLock;
 void FsAdapterRegisterFat32(void);
 void FsAdapterRegisterExfat(void);
 void FsAdapterRegisterNtfs(void);
+void FsAdapterRegisterTmpfs(void);
 
 NTSTATUS FsInitialize(void)
 {
     if (g_FsInitialized) return STATUS_ALREADY_INITIALIZED;
     AuroraInitializeSpinLock(&g_FsLock);
-    memset(g_Mounts, 0, sizeof(g_Mounts));
     memset(g_Drivers, 0, sizeof(g_Drivers));
     g_DriverCount = 0;
+    FsDcacheInitialize();
+    NTSTATUS st = FsMountInitialize();
+    if (!NT_SUCCESS(st)) return st;
 
     /* Register built-in adapters (stubs) */
     FsRegisterBuiltInDrivers();
@@ -74,62 +77,266 @@ static PFS_DRIVER FsFindDriverByName(IN PCSTR Name)
     return NULL;
 }
 
-NTSTATUS FsMount(IN PCSTR Device, IN PCSTR FsType, IN PCSTR MountName, IN PCSTR Options)
+NTSTATUS FsMount(IN PCSTR Device, IN PCSTR FsType, IN PCSTR MountPath, IN PCSTR Options)
 {
-    if (!Device || !FsType || !MountName) return STATUS_INVALID_PARAMETER;
+    if (!Device || !FsType || !MountPath) return STATUS_INVALID_PARAMETER;
     PFS_DRIVER drv = FsFindDriverByName(FsType);
     if (!drv || !drv->Ops.Mount) return STATUS_NOT_SUPPORTED;
 
-    AURORA_IRQL irql;
-    AuroraAcquireSpinLock(&g_FsLock, &irql);
+    /* perform driver mount before touching the tree */
+    PVOID volCtx = NULL;
+    PFS_VOLUME vol;
+    NTSTATUS st = drv->Ops.Mount(Device, Options, &volCtx);
+    if (!NT_SUCCESS(st)) return st;
 
-    /* find free mount slot and ensure unique name */
-    INT32 freeIdx = -1;
-    for (UINT32 i = 0; i < FS_MAX_MOUNTS; ++i) {
-        if (g_Mounts[i].Name[0] == '\0' && freeIdx == -1) freeIdx = (INT32)i;
-        if (g_Mounts[i].Name[0] != '\0' && strcmp(g_Mounts[i].Name, MountName) == 0) {
-            AuroraReleaseSpinLock(&g_FsLock, irql);
-            return STATUS_OBJECT_NAME_COLLISION;
-        }
+    st = FsDcacheCreateVolume(drv, volCtx, &vol);
+    if (NT_SUCCESS(st)) {
+        st = FsMountAttach(vol, vol->Root, MountPath);
+        if (!NT_SUCCESS(st)) FsDcacheReleaseVolume(vol);
     }
-    if (freeIdx < 0) {
-        AuroraReleaseSpinLock(&g_FsLock, irql);
-        return STATUS_INSUFFICIENT_RESOURCES;
+    if (!NT_SUCCESS(st) && drv->Ops.Unmount) drv->Ops.Unmount(volCtx);
+    return st;
+}
+
+/* Show the directory at SourcePath also at TargetPath. The volume stays
+ * mounted until every mount showing part of it is gone. */
+NTSTATUS FsBindMount(IN PCSTR SourcePath, IN PCSTR TargetPath)
+{
+    PFS_MOUNT mount;
+    PFS_DENTRY dentry;
+    NTSTATUS st;
+
+    if (!SourcePath || !TargetPath) return STATUS_INVALID_PARAMETER;
+    st = FsDcacheWalk(SourcePath, 0, &mount, &dentry);
+    if (!NT_SUCCESS(st)) return st;
+    if ((dentry->Flags & (FS_DENTRY_RESOLVED | FS_DENTRY_ROOT)) && !(dentry->Flags & FS_DENTRY_DIRECTORY)) {
+        st = STATUS_NOT_A_DIRECTORY;
+    } else {
+        st = FsMountAttach(mount->Volume, dentry, TargetPath);
     }
-    AuroraReleaseSpinLock(&g_FsLock, irql);
+    FsDentryPut(dentry);
+    FsMountPut(mount);
+    return st;
+}
 
-    /* perform driver mount outside lock */
-    PVOID volCtx = NULL;
-    NTSTATUS st = drv->Ops.Mount(Device, Options, &volCtx);
+NTSTATUS FsUnmount(IN PCSTR MountPath)
+{
+    PFS_VOLUME vol;
+    if (!MountPath) return STATUS_INVALID_PARAMETER;
+    /* Fails while handles are open through the mount */
+    NTSTATUS st = FsMountDetach(MountPath, &vol);
+    if (!NT_SUCCESS(st) || !vol) return st;
+
+    PFS_DRIVER drv = vol->Driver;
+    PVOID ctx = vol->VolumeData;
+    st = FsDcacheReleaseVolume(vol);
     if (!NT_SUCCESS(st)) return st;
+    if (drv && drv->Ops.Unmount) return drv->Ops.Unmount(ctx);
+    return STATUS_SUCCESS;
+}
 
-    AuroraAcquireSpinLock(&g_FsLock, &irql);
-    strncpy(g_Mounts[freeIdx].Name, MountName, sizeof(g_Mounts[freeIdx].Name) - 1);
-    g_Mounts[freeIdx].FsDriver = drv;
-    g_Mounts[freeIdx].VolumeData = volCtx;
-    AuroraReleaseSpinLock(&g_FsLock, irql);
+NTSTATUS FsOpen(IN PCSTR Path, OUT PFS_HANDLE* Handle)
+{
+    PFS_MOUNT mount;
+    PFS_VOLUME vol;
+    PFS_DRIVER drv;
+    PFS_DENTRY dentry;
+    FS_FILE file = NULL;
+    NTSTATUS st;
+
+    if (!Path || !Handle) return STATUS_INVALID_PARAMETER;
+    st = FsDcacheWalk(Path, 0, &mount, &dentry);
+    if (!NT_SUCCESS(st)) return st;
+    vol = mount->Volume;
+    drv = vol->Driver;
+
+    if (!drv) {
+        /* Namespace directory with nothing mounted on it */
+        st = STATUS_FILE_IS_A_DIRECTORY;
+    } else if (drv->Ops.OpenNode && (dentry->Flags & (FS_DENTRY_RESOLVED | FS_DENTRY_ROOT))) {
+        /* Name resolved entirely from the cache */
+        st = drv->Ops.OpenNode(vol->VolumeData, dentry->Node, &file);
+    } else if (drv->Ops.Open) {
+        CHAR path[FS_PATH_MAX];
+        st = FsDcacheBuildPath(dentry, path, sizeof(path));
+        if (NT_SUCCESS(st)) st = drv->Ops.Open(vol->VolumeData, path, &file);
+        if (st == STATUS_OBJECT_NAME_NOT_FOUND || st == STATUS_NOT_FOUND) FsDcacheMarkNegative(dentry);
+    } else {
+        st = STATUS_NOT_SUPPORTED;
+    }
+    if (!NT_SUCCESS(st)) {
+        FsDentryPut(dentry);
+        FsMountPut(mount);
+        return st;
+    }
+
+    PFS_HANDLE h = (PFS_HANDLE)AuroraAllocateMemory(sizeof(FS_HANDLE));
+    if (!h) {
+        if (drv->Ops.Close) drv->Ops.Close(file);
+        FsDentryPut(dentry);
+        FsMountPut(mount);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    memset(h, 0, sizeof(*h));
+    h->Mount = mount;
+    h->Driver = drv;
+    h->File = file;
+    h->Dentry = dentry; /* with the mount reference, keeps the volume busy until FsClose */
+    h->RefCount = 1;
+    FsPageCacheAttach(h);
+    *Handle = h;
     return STATUS_SUCCESS;
 }
 
-NTSTATUS FsUnmount(IN PCSTR MountName)
+/* Split Path into its parent directory and last component */
+static NTSTATUS FsSplitPath(PCSTR Path, PCHAR Parent, UINT32 Size, PCSTR* Name, PUINT32 Length)
 {
-    if (!MountName) return STATUS_INVALID_PARAMETER;
-    AURORA_IRQL irql;
-    AuroraAcquireSpinLock(&g_FsLock, &irql);
-    for (UINT32 i = 0; i < FS_MAX_MOUNTS; ++i) {
-        if (g_Mounts[i].Name[0] != '\0' && strcmp(g_Mounts[i].Name, MountName) == 0) {
-            PFS_DRIVER drv = (PFS_DRIVER)g_Mounts[i].FsDriver;
-            PVOID ctx = g_Mounts[i].VolumeData;
-            g_Mounts[i].Name[0] = '\0';
-            g_Mounts[i].FsDriver = NULL;
-            g_Mounts[i].VolumeData = NULL;
-            AuroraReleaseSpinLock(&g_FsLock, irql);
-            if (drv && drv->Ops.Unmount) return drv->Ops.Unmount(ctx);
-            return STATUS_SUCCESS;
+    UINT32 end = (UINT32)strlen(Path), start;
+    while (end > 0 && Path[end - 1] == '/') end--;
+    start = end;
+    while (start > 0 && Path[start - 1] != '/') start--;
+    if (end == start || (end - start == 1 && Path[start] == '.') ||
+        (end - start == 2 && Path[start] == '.' && Path[start + 1] == '.')) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    if (end - start > FS_NAME_MAX || start + 2 > Size) return STATUS_NAME_TOO_LONG;
+    memcpy(Parent, Path, start);
+    Parent[start] = '\0';
+    if (start == 0) {
+        Parent[0] = '/';
+        Parent[1] = '\0';
+    }
+    *Name = Path + start;
+    *Length = end - start;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS FsCreate(IN PCSTR Path, IN UINT32 Flags, OUT PFS_HANDLE* Handle)
+{
+    CHAR parent[FS_PATH_MAX];
+    PFS_MOUNT mount;
+    PFS_DENTRY dir;
+    PFS_VOLUME vol;
+    PCSTR name;
+    UINT32 len;
+    PVOID node = NULL;
+    NTSTATUS st;
+
+    if (!Path || ((Flags & FS_NODE_DIRECTORY) && Handle)) return STATUS_INVALID_PARAMETER;
+    st = FsSplitPath(Path, parent, sizeof(parent), &name, &len);
+    if (!NT_SUCCESS(st)) return st;
+    st = FsDcacheWalk(parent, 0, &mount, &dir);
+    if (!NT_SUCCESS(st)) return st;
+    vol = mount->Volume;
+    if (!vol->Driver || !vol->Driver->Ops.Create || !vol->Driver->Ops.Lookup) {
+        st = STATUS_NOT_SUPPORTED;
+    } else if (!(dir->Flags & FS_DENTRY_DIRECTORY)) {
+        st = STATUS_NOT_A_DIRECTORY;
+    } else {
+        st = vol->Driver->Ops.Create(vol->VolumeData, dir->Node, name, len, Flags & FS_NODE_DIRECTORY, &node);
+        if (NT_SUCCESS(st)) FsDcacheInstantiate(dir, name, len, node, Flags & FS_NODE_DIRECTORY);
+    }
+    FsDentryPut(dir);
+    FsMountPut(mount);
+    if (NT_SUCCESS(st) && Handle) st = FsOpen(Path, Handle);
+    return st;
+}
+
+NTSTATUS FsRemove(IN PCSTR Path)
+{
+    PFS_MOUNT mount;
+    PFS_DENTRY dentry;
+    PFS_VOLUME vol;
+    NTSTATUS st;
+
+    if (!Path) return STATUS_INVALID_PARAMETER;
+    st = FsDcacheWalk(Path, 0, &mount, &dentry);
+    if (!NT_SUCCESS(st)) return st;
+    vol = mount->Volume;
+    if (!vol->Driver || !vol->Driver->Ops.Remove) {
+        st = STATUS_NOT_SUPPORTED;
+    } else if ((dentry->Flags & FS_DENTRY_ROOT) || dentry == mount->Root || dentry->Mounted ||
+               (dentry->Cache && dentry->Cache->OpenCount)) {
+        st = STATUS_DEVICE_BUSY;
+    } else {
+        st = vol->Driver->Ops.Remove(vol->VolumeData, dentry->Parent->Node, dentry->Name, dentry->NameLength);
+        if (NT_SUCCESS(st)) FsDcacheRemoved(dentry);
+    }
+    FsDentryPut(dentry);
+    FsMountPut(mount);
+    return st;
+}
+
+NTSTATUS FsClose(IN PFS_HANDLE Handle)
+{
+    NTSTATUS st, closeSt;
+    if (!Handle) return STATUS_INVALID_PARAMETER;
+    /* Asynchronous requests keep the handle open */
+    if (__sync_sub_and_fetch(&Handle->RefCount, 1) != 0) return STATUS_SUCCESS;
+    st = FsPageCacheDetach(Handle);
+    if (Handle->Driver->Ops.Close) {
+        closeSt = Handle->Driver->Ops.Close(Handle->File);
+        if (NT_SUCCESS(st)) st = closeSt;
+    }
+    FsDentryPut(Handle->Dentry);
+    FsMountPut(Handle->Mount);
+    AuroraFreeMemory(Handle);
+    return st;
+}
+
+NTSTATUS FsRead(IN PFS_HANDLE Handle, OUT PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesRead)
+{
+    if (!Handle) return STATUS_INVALID_PARAMETER;
+    if (Handle->Cache) {
+        UINT64 done;
+        NTSTATUS st = FsPageCacheRead(Handle, Handle->Position, Buffer, Size, &done);
+        Handle->Position += done;
+        if (BytesRead) *BytesRead = (UINT32)done;
+        return st;
+    }
+    if (!Handle->Driver->Ops.Read) return STATUS_NOT_SUPPORTED;
+    return Handle->Driver->Ops.Read(Handle->File, Buffer, Size, BytesRead);
+}
+
+NTSTATUS FsWrite(IN PFS_HANDLE Handle, IN PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesWritten)
+{
+    if (!Handle) return STATUS_INVALID_PARAMETER;
+    if (Handle->Cache) {
+        UINT64 done;
+        NTSTATUS st = FsPageCacheWrite(Handle, Handle->Position, Buffer, Size, &done);
+        Handle->Position += done;
+        if (BytesWritten) *BytesWritten = (UINT32)done;
+        return st;
+    }
+    if (!Handle->Driver->Ops.Write) return STATUS_NOT_SUPPORTED;
+    return Handle->Driver->Ops.Write(Handle->File, Buffer, Size, BytesWritten);
+}
+
+NTSTATUS FsSeek(IN PFS_HANDLE Handle, IN INT64 Offset, IN UINT32 Origin, OUT PUINT64 NewPosition)
+{
+    if (!Handle) return STATUS_INVALID_PARAMETER;
+    if (Handle->Cache) {
+        /* The cache knows the size, including data not yet written back */
+        INT64 base;
+        switch (Origin) {
+            case FS_SEEK_SET: base = 0; break;
+            case FS_SEEK_CUR: base = (INT64)Handle->Position; break;
+            case FS_SEEK_END: base = (INT64)Handle->Cache->FileSize; break;
+            default: return STATUS_INVALID_PARAMETER;
         }
+        if (base + Offset < 0) return STATUS_INVALID_PARAMETER;
+        Handle->Position = (UINT64)(base + Offset);
+        if (NewPosition) *NewPosition = Handle->Position;
+        return STATUS_SUCCESS;
     }
-    AuroraReleaseSpinLock(&g_FsLock, irql);
-    return STATUS_NOT_FOUND;
+    if (!Handle->Driver->Ops.Seek) return STATUS_NOT_SUPPORTED;
+    return Handle->Driver->Ops.Seek(Handle->File, Offset, Origin, NewPosition);
+}
+
+NTSTATUS FsFlush(IN PFS_HANDLE Handle)
+{
+    if (!Handle) return STATUS_INVALID_PARAMETER;
+    return FsPageCacheWriteback(Handle);
 }
 
 void FsRegisterBuiltInDrivers(void)
@@ -143,4 +350,7 @@ void FsRegisterBuiltInDrivers(void)
 #if AURORA_FS_ENABLE_NTFS
     FsAdapterRegisterNtfs();
 #endif
+#if AURORA_FS_ENABLE_TMPFS
+    FsAdapterRegisterTmpfs();
+#endif
 }
@@ -0,0 +1,243 @@
+/*
+ * Aurora Kernel - VFS positional, vectored and asynchronous I/O
+ *
+ * Transfers here name their own 64-bit offset and may scatter over several
+ * buffers, so threads sharing a handle never contend for its position and
+ * a large transfer is one call. Cached files go through the page cache;
+ * other files go to the driver's ReadAt/WriteAt, or to Seek plus Read or
+ * Write in pieces for drivers without them (which then do serialize on the
+ * driver position). Asynchronous requests complete through a callback in
+ * the manner of BLOCK_REQUEST: the driver's Submit queues them itself,
+ * otherwise they run on the VFS I/O workers or, before those are started,
+ * on the submitting thread.
+ */
+
+#include "../aurora.h"
+#include "../include/kern.h"
+#include "../include/fs.h"
+#include "vfs.h"
+
+#ifndef FS_IO_MAX_WORKERS
+#define FS_IO_MAX_WORKERS   4
+#endif
+#define FS_IO_IDLE_SLEEP    1               /* ms a worker sleeps on an empty queue */
+#define FS_IO_LEGACY_CHUNK  0x40000000u     /* per call when falling back to 32-bit Read/Write */
+
+static PFS_IO_REQUEST g_IoHead;
+static PFS_IO_REQUEST g_IoTail;
+static AURORA_SPINLOCK g_IoLock;
+static UINT32 g_IoWorkers;
+
+/* Seek plus Read or Write for drivers without positional ops */
+static NTSTATUS FsIoLegacyTransfer(PFS_HANDLE H, BOOL Write, UINT64 Offset, UINT8* Buffer, UINT64 Size, PUINT64 Done)
+{
+    PFS_DRIVER drv = H->Driver;
+    NTSTATUS st = drv->Ops.Seek(H->File, (INT64)Offset, FS_SEEK_SET, NULL);
+    *Done = 0;
+    while (NT_SUCCESS(st) && *Done < Size) {
+        UINT32 want = Size - *Done > FS_IO_LEGACY_CHUNK ? FS_IO_LEGACY_CHUNK : (UINT32)(Size - *Done);
+        UINT32 got = 0;
+        st = Write ? drv->Ops.Write(H->File, Buffer + *Done, want, &got) : drv->Ops.Read(H->File, Buffer + *Done, want, &got);
+        if (NT_SUCCESS(st)) *Done += got;
+        if (got < want) break;
+    }
+    return *Done ? STATUS_SUCCESS : st;
+}
+
+static NTSTATUS FsIoTransfer(PFS_HANDLE H, BOOL Write, UINT64 Offset, PFS_IO_SEGMENT Segments, UINT32 SegmentCount, PUINT64 Done)
+{
+    PFS_DRIVER drv = H->Driver;
+    UINT64 total = 0;
+    NTSTATUS st = STATUS_SUCCESS;
+
+    *Done = 0;
+    if (!Segments && SegmentCount) return STATUS_INVALID_PARAMETER;
+    if (!H->Cache) {
+        if (!Write && drv->Ops.ReadAt) return drv->Ops.ReadAt(H->File, Offset, Segments, SegmentCount, Done);
+        if (Write && drv->Ops.WriteAt) return drv->Ops.WriteAt(H->File, Offset, Segments, SegmentCount, Done);
+        if (!drv->Ops.Seek || !(Write ? drv->Ops.Write : drv->Ops.Read)) return STATUS_NOT_SUPPORTED;
+    }
+    for (UINT32 i = 0; i < SegmentCount; i++) {
+        UINT64 got = 0;
+        if (!Segments[i].Buffer && Segments[i].Length) {
+            st = STATUS_INVALID_PARAMETER;
+            break;
+        }
+        if (H->Cache && Write) {
+            st = FsPageCacheWrite(H, Offset + total, Segments[i].Buffer, Segments[i].Length, &got);
+        } else if (H->Cache) {
+            st = FsPageCacheRead(H, Offset + total, Segments[i].Buffer, Segments[i].Length, &got);
+        } else {
+            st = FsIoLegacyTransfer(H, Write, Offset + total, (UINT8*)Segments[i].Buffer, Segments[i].Length, &got);
+        }
+        total += got;
+        if (!NT_SUCCESS(st) || got < Segments[i].Length) break;
+    }
+    *Done = total;
+    /* Like Read, a partial transfer succeeds with a short count */
+    return total ? STATUS_SUCCESS : st;
+}
+
+/* ---------------------------------------------------------------------------
+ * Synchronous API
+ * --------------------------------------------------------------------------- */
+
+NTSTATUS FsReadAt(IN PFS_HANDLE Handle, IN UINT64 Offset, OUT PVOID Buffer, IN UINT64 Size, OUT PUINT64 BytesRead)
+{
+    FS_IO_SEGMENT seg;
+    seg.Buffer = Buffer;
+    seg.Length = Size;
+    return FsReadV(Handle, Offset, &seg, 1, BytesRead);
+}
+
+NTSTATUS FsWriteAt(IN PFS_HANDLE Handle, IN UINT64 Offset, IN PVOID Buffer, IN UINT64 Size, OUT PUINT64 BytesWritten)
+{
+    FS_IO_SEGMENT seg;
+    seg.Buffer = Buffer;
+    seg.Length = Size;
+    return FsWriteV(Handle, Offset, &seg, 1, BytesWritten);
+}
+
+NTSTATUS FsReadV(IN PFS_HANDLE Handle, IN UINT64 Offset, IN PFS_IO_SEGMENT Segments, IN UINT32 SegmentCount, OUT PUINT64 BytesRead)
+{
+    UINT64 done;
+    NTSTATUS st;
+    if (!Handle) return STATUS_INVALID_PARAMETER;
+    st = FsIoTransfer(Handle, FALSE, Offset, Segments, SegmentCount, &done);
+    if (BytesRead) *BytesRead = done;
+    return st;
+}
+
+NTSTATUS FsWriteV(IN PFS_HANDLE Handle, IN UINT64 Offset, IN PFS_IO_SEGMENT Segments, IN UINT32 SegmentCount, OUT PUINT64 BytesWritten)
+{
+    UINT64 done;
+    NTSTATUS st;
+    if (!Handle) return STATUS_INVALID_PARAMETER;
+    st = FsIoTransfer(Handle, TRUE, Offset, Segments, SegmentCount, &done);
+    if (BytesWritten) *BytesWritten = done;
+    return st;
+}
+
+NTSTATUS FsAllocate(IN PFS_HANDLE Handle, IN UINT64 Offset, IN UINT64 Length, IN UINT32 Flags)
+{
+    NTSTATUS st;
+    if (!Handle || Offset + Length < Offset || (Flags & ~FS_ALLOCATE_KEEP_SIZE)) return STATUS_INVALID_PARAMETER;
+    if (!Handle->Driver->Ops.Allocate) return STATUS_NOT_SUPPORTED;
+    st = Handle->Driver->Ops.Allocate(Handle->File, Offset, Length, Flags);
+    /* The cache holds the size cached readers see */
+    if (NT_SUCCESS(st) && Handle->Cache && !(Flags & FS_ALLOCATE_KEEP_SIZE)) FsPageCacheExtend(Handle, Offset + Length);
+    return st;
+}
+
+/* ---------------------------------------------------------------------------
+ * Asynchronous requests
+ * --------------------------------------------------------------------------- */
+
+/* Report a request finished. Drivers call this for requests they queued. */
+void FsCompleteIo(IN PFS_IO_REQUEST Request, IN NTSTATUS Status, IN UINT64 Information)
+{
+    PFS_HANDLE h;
+    if (!Request) return;
+    h = Request->Handle;
+    Request->Information = Information;
+    Request->Status = Status;
+    if (Request->Complete) Request->Complete(Request);
+    /* The request's reference; may be the last if the caller closed early */
+    FsClose(h);
+}
+
+static void FsIoExecute(PFS_IO_REQUEST Request)
+{
+    UINT64 done;
+    NTSTATUS st = FsIoTransfer(Request->Handle, Request->Major == FS_IO_WRITE, Request->Offset,
+                               Request->Segments, Request->SegmentCount, &done);
+    FsCompleteIo(Request, st, done);
+}
+
+static PFS_IO_REQUEST FsIoDequeue(void)
+{
+    PFS_IO_REQUEST req;
+    AURORA_IRQL irql;
+    AuroraAcquireSpinLock(&g_IoLock, &irql);
+    req = g_IoHead;
+    if (req) {
+        g_IoHead = req->Next;
+        if (!g_IoHead) g_IoTail = NULL;
+        req->Next = NULL;
+    }
+    AuroraReleaseSpinLock(&g_IoLock, irql);
+    return req;
+}
+
+static VOID FsIoWorkerThread(PVOID Context)
+{
+    (void)Context;
+    for (;;) {
+        PFS_IO_REQUEST req = FsIoDequeue();
+        if (req) {
+            FsIoExecute(req);
+        } else {
+            KernSleep(FS_IO_IDLE_SLEEP);
+        }
+    }
+}
+
+NTSTATUS FsSubmitIo(IN PFS_HANDLE Handle, IN PFS_IO_REQUEST Request)
+{
+    PFS_DRIVER drv;
+    AURORA_IRQL irql;
+    NTSTATUS st;
+
+    if (!Handle || !Request) return STATUS_INVALID_PARAMETER;
+    if ((Request->Major != FS_IO_READ && Request->Major != FS_IO_WRITE) || (!Request->Segments && Request->SegmentCount)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+    drv = Handle->Driver;
+    Request->Handle = Handle;
+    Request->Status = STATUS_PENDING;
+    Request->Information = 0;
+    Request->Next = NULL;
+    /* Dropped by FsCompleteIo */
+    __sync_fetch_and_add(&Handle->RefCount, 1);
+
+    if (!Handle->Cache && drv->Ops.Submit) {
+        st = drv->Ops.Submit(Handle->File, Request);
+        if (!NT_SUCCESS(st)) {
+            Request->Status = st;
+            __sync_fetch_and_sub(&Handle->RefCount, 1);
+        }
+        return st;
+    }
+    if (!g_IoWorkers) {
+        FsIoExecute(Request);
+        return STATUS_SUCCESS;
+    }
+    AuroraAcquireSpinLock(&g_IoLock, &irql);
+    if (g_IoTail) {
+        g_IoTail->Next = Request;
+    } else {
+        g_IoHead = Request;
+    }
+    g_IoTail = Request;
+    AuroraReleaseSpinLock(&g_IoLock, irql);
+    return STATUS_SUCCESS;
+}
+
+/* Start up to Count worker threads (FS_IO_MAX_WORKERS in all) to run
+ * requests the driver cannot queue itself */
+NTSTATUS FsStartIoWorkers(IN UINT32 Count)
+{
+    PPROCESS proc;
+    THREAD_ID tid;
+    NTSTATUS st = STATUS_SUCCESS;
+
+    if (!g_IoWorkers) AuroraInitializeSpinLock(&g_IoLock);
+    proc = KernGetCurrentProcess();
+    if (!proc) return STATUS_NOT_INITIALIZED;
+    while (Count-- && g_IoWorkers < FS_IO_MAX_WORKERS) {
+        st = KernCreateThread(proc->ProcessId, (PVOID)FsIoWorkerThread, NULL, PriorityLow, &tid);
+        if (!NT_SUCCESS(st)) break;
+        g_IoWorkers++;
+    }
+    return g_IoWorkers ? STATUS_SUCCESS : st;
+}
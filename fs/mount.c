@@ -0,0 +1,262 @@
+/*
+ * Aurora Kernel - VFS mount tree
+ *
+ * Every path is resolved from one namespace root, a driverless volume whose
+ * directories exist only to hold mountpoints. A mount attaches a volume
+ * root (or, for a bind mount, any directory dentry) to a dentry of another
+ * mount. Mounts are hashed on (parent mount, mountpoint dentry) and the
+ * dentry carries a count of mounts attached to it, so a walk pays one hash
+ * probe per mountpoint it crosses and nothing for ordinary components.
+ * Mount records are recycled through a free list so lockless walkers never
+ * touch freed memory; the dcache sequence count covers every change. The
+ * hash table doubles once it averages more than one mount per bucket.
+ */
+
+#include "../aurora.h"
+#include "../include/kern.h"
+#include "../include/fs.h"
+#include "../include/hal.h"
+#include "vfs.h"
+
+/* Mask and buckets are published together so a lockless walker never
+ * indexes one table with the other's size */
+typedef struct _FS_MOUNT_TABLE {
+    UINT32 Mask;                                /* buckets - 1 */
+    PFS_MOUNT Buckets[1];
+} FS_MOUNT_TABLE, *PFS_MOUNT_TABLE;
+
+static PFS_MOUNT_TABLE volatile g_MountHash;
+static PFS_MOUNT g_MountFree;                   /* recycled mounts, linked through HashNext */
+static PFS_MOUNT g_RootMount;
+static UINT32 g_MountCount;
+
+static UINT32 FsMountHash(PFS_MOUNT Parent, PFS_DENTRY Mountpoint)
+{
+    UINT64 k = ((UINT64)(ULONG_PTR)Parent >> 4) * 0x9E3779B97F4A7C15ull ^ ((UINT64)(ULONG_PTR)Mountpoint >> 4);
+    k ^= k >> 29;
+    k *= 0xBF58476D1CE4E5B9ull;
+    return (UINT32)(k ^ (k >> 32));
+}
+
+static PFS_MOUNT_TABLE FsMountTableAlloc(UINT32 Buckets)
+{
+    UINT64 size = sizeof(FS_MOUNT_TABLE) + (UINT64)(Buckets - 1) * sizeof(PFS_MOUNT);
+    PFS_MOUNT_TABLE t = (PFS_MOUNT_TABLE)AuroraAllocateMemory(size);
+    if (!t) return NULL;
+    memset(t, 0, size);
+    t->Mask = Buckets - 1;
+    return t;
+}
+
+/* Double the table once it averages more than one mount per bucket. Runs
+ * under the cache lock inside a write section, so a walker that sees a
+ * chain move retries; the old table is never freed since one may still be
+ * reading it. Without memory the chains just get longer. */
+static void FsMountGrowLocked(void)
+{
+    PFS_MOUNT_TABLE old = g_MountHash, t;
+    if (g_MountCount <= old->Mask + 1 || old->Mask + 1 >= 0x80000000u) return;
+    t = FsMountTableAlloc((old->Mask + 1) * 2);
+    if (!t) return;
+    for (UINT32 b = 0; b <= old->Mask; b++) {
+        PFS_MOUNT m = old->Buckets[b], next;
+        for (; m; m = next) {
+            next = m->HashNext;
+            m->HashNext = t->Buckets[m->Hash & t->Mask];
+            t->Buckets[m->Hash & t->Mask] = m;
+        }
+    }
+    HalMemoryBarrier();
+    g_MountHash = t;
+}
+
+NTSTATUS FsMountInitialize(void)
+{
+    PFS_VOLUME rootfs;
+    NTSTATUS st;
+    g_MountHash = FsMountTableAlloc(FS_MOUNT_HASH_BUCKETS);
+    if (!g_MountHash) return STATUS_INSUFFICIENT_RESOURCES;
+    g_MountFree = NULL;
+    g_MountCount = 0;
+
+    st = FsDcacheCreateVolume(NULL, NULL, &rootfs);
+    if (!NT_SUCCESS(st)) return st;
+    g_RootMount = (PFS_MOUNT)AuroraAllocateMemory(sizeof(FS_MOUNT));
+    if (!g_RootMount) return STATUS_INSUFFICIENT_RESOURCES;
+    memset(g_RootMount, 0, sizeof(*g_RootMount));
+    g_RootMount->Root = rootfs->Root;
+    g_RootMount->Volume = rootfs;
+    g_RootMount->RefCount = 1; /* never detached */
+    rootfs->MountCount = 1;
+    FsDentryGetLocked(rootfs->Root);
+    return STATUS_SUCCESS;
+}
+
+PFS_MOUNT FsMountRoot(void)
+{
+    return g_RootMount;
+}
+
+/* Mount attached to Mountpoint as seen through Parent. Safe without the lock
+ * for the same reasons as FsDcacheFind; callers revalidate. */
+PFS_MOUNT FsMountLookup(IN PFS_MOUNT Parent, IN PFS_DENTRY Mountpoint)
+{
+    PFS_MOUNT_TABLE t = g_MountHash;
+    UINT32 hash = FsMountHash(Parent, Mountpoint);
+    UINT32 steps = 0;
+    for (PFS_MOUNT m = t->Buckets[hash & t->Mask]; m && steps <= g_MountCount; m = m->HashNext, steps++) {
+        if (m->Hash == hash && m->Parent == Parent && m->Mountpoint == Mountpoint) return m;
+    }
+    return NULL;
+}
+
+/* ---------------------------------------------------------------------------
+ * References
+ * --------------------------------------------------------------------------- */
+
+BOOL FsMountTryGet(IN PFS_MOUNT Mount)
+{
+    for (;;) {
+        UINT32 ref = Mount->RefCount;
+        if (ref & FS_DENTRY_DEAD) return FALSE;
+        if (__sync_bool_compare_and_swap(&Mount->RefCount, ref, ref + 1)) return TRUE;
+    }
+}
+
+void FsMountGet(IN PFS_MOUNT Mount)
+{
+    __sync_fetch_and_add(&Mount->RefCount, 1);
+}
+
+/* The attachment reference is only dropped by FsMountDetach, so a put never
+ * frees anything */
+void FsMountPut(IN PFS_MOUNT Mount)
+{
+    if (Mount) __sync_fetch_and_sub(&Mount->RefCount, 1);
+}
+
+/* ---------------------------------------------------------------------------
+ * Attach and detach
+ * --------------------------------------------------------------------------- */
+
+static PFS_MOUNT FsMountAllocLocked(void)
+{
+    PFS_MOUNT m = g_MountFree;
+    if (m) {
+        g_MountFree = m->HashNext;
+        return m;
+    }
+    m = (PFS_MOUNT)AuroraAllocateMemory(sizeof(FS_MOUNT));
+    if (m) {
+        memset(m, 0, sizeof(*m));
+        m->RefCount = FS_DENTRY_DEAD;
+    }
+    return m;
+}
+
+/* Show Root (a dentry of Volume) at Target. Missing directories on the
+ * namespace root are created; a Target that is already a mount root is
+ * refused rather than stacked. */
+NTSTATUS FsMountAttach(IN PFS_VOLUME Volume, IN PFS_DENTRY Root, IN PCSTR Target)
+{
+    PFS_MOUNT parent, m;
+    PFS_DENTRY mp;
+    AURORA_IRQL irql;
+    NTSTATUS st;
+    UINT32 hash;
+
+    if (!Volume || !Root || !Target) return STATUS_INVALID_PARAMETER;
+    st = FsDcacheWalk(Target, FS_WALK_CREATE, &parent, &mp);
+    if (!NT_SUCCESS(st)) return st;
+    if (mp == parent->Root && parent->Parent) {
+        st = STATUS_OBJECT_NAME_COLLISION;
+    } else if ((mp->Flags & (FS_DENTRY_RESOLVED | FS_DENTRY_ROOT)) && !(mp->Flags & FS_DENTRY_DIRECTORY)) {
+        st = STATUS_NOT_A_DIRECTORY;
+    }
+    if (!NT_SUCCESS(st)) {
+        FsDentryPut(mp);
+        FsMountPut(parent);
+        return st;
+    }
+
+    hash = FsMountHash(parent, mp);
+    FsDcacheLock(&irql);
+    m = FsMountLookup(parent, mp) ? NULL : FsMountAllocLocked(); /* raced with another mount? */
+    if (!m) {
+        st = FsMountLookup(parent, mp) ? STATUS_OBJECT_NAME_COLLISION : STATUS_INSUFFICIENT_RESOURCES;
+        FsDentryPutLocked(mp);
+        FsMountPut(parent);
+        FsDcacheUnlock(irql);
+        return st;
+    }
+    /* The walk references on parent and mp become the mount's */
+    m->Parent = parent;
+    m->Mountpoint = mp;
+    m->Root = Root;
+    m->Volume = Volume;
+    m->Hash = hash;
+    FsDentryGetLocked(Root);
+    Volume->MountCount++;
+
+    FsDcacheWriteBegin();
+    m->HashNext = g_MountHash->Buckets[hash & g_MountHash->Mask];
+    m->RefCount = 1;
+    g_MountHash->Buckets[hash & g_MountHash->Mask] = m;
+    mp->Mounted++;
+    g_MountCount++;
+    FsMountGrowLocked();
+    FsDcacheWriteEnd();
+    FsDcacheUnlock(irql);
+    return STATUS_SUCCESS;
+}
+
+/* Detach the mount whose root Target names. Fails with STATUS_DEVICE_BUSY
+ * while handles are open through it or other mounts sit on top of it. When
+ * this was the volume's last mount the volume is returned for release. */
+NTSTATUS FsMountDetach(IN PCSTR Target, OUT PFS_VOLUME* Orphaned)
+{
+    PFS_MOUNT m;
+    PFS_DENTRY d;
+    PFS_MOUNT* link;
+    AURORA_IRQL irql;
+    NTSTATUS st;
+
+    if (!Target || !Orphaned) return STATUS_INVALID_PARAMETER;
+    *Orphaned = NULL;
+    st = FsDcacheWalk(Target, 0, &m, &d);
+    if (!NT_SUCCESS(st)) return STATUS_NOT_FOUND;
+    if (d != m->Root || !m->Parent) {
+        FsDentryPut(d);
+        FsMountPut(m);
+        return STATUS_NOT_FOUND;
+    }
+
+    FsDcacheLock(&irql);
+    FsDentryPutLocked(d);
+    /* Idle means the attachment plus our own walk reference */
+    if (!__sync_bool_compare_and_swap(&m->RefCount, 2, FS_DENTRY_DEAD)) {
+        FsMountPut(m);
+        FsDcacheUnlock(irql);
+        return STATUS_DEVICE_BUSY;
+    }
+    FsDcacheWriteBegin();
+    link = &g_MountHash->Buckets[m->Hash & g_MountHash->Mask];
+    while (*link && *link != m) link = &(*link)->HashNext;
+    if (*link) *link = m->HashNext;
+    m->Mountpoint->Mounted--;
+    g_MountCount--;
+    FsDcacheWriteEnd();
+
+    FsDentryPutLocked(m->Mountpoint);
+    FsMountPut(m->Parent);
+    FsDentryPutLocked(m->Root);
+    if (--m->Volume->MountCount == 0) *Orphaned = m->Volume;
+    m->Parent = NULL;
+    m->Mountpoint = NULL;
+    m->Root = NULL;
+    m->Volume = NULL;
+    m->HashNext = g_MountFree;
+    g_MountFree = m;
+    FsDcacheUnlock(irql);
+    return STATUS_SUCCESS;
+}
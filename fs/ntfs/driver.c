@@ -1,21 +1,1268 @@
-/* NTFS driver enhanced stub */
+/*
+ * Aurora Kernel - NTFS file system driver (read-only)
+ *
+ * Mount bootstraps $MFT from record 0 (following its attribute list if the
+ * MFT is fragmented enough to need one). MFT records are read through a
+ * hashed LRU cache that stores them already fixed up. Non-resident
+ * attributes are decoded once into sorted run arrays kept in a small
+ * refcounted cache, so VCN to LCN mapping is a binary search and
+ * physically adjacent runs have been merged into a single block request.
+ * Directory lookups descend the $I30 B+tree rather than scanning entries;
+ * enumeration walks it in order and resumes after the last name returned.
+ *
+ * Compressed and encrypted streams are refused at open.
+ */
 #include "../../aurora.h"
 #include "../../include/kern.h"
 #include "../../include/fs.h"
+#include "../../include/io.h"
+#include "../../include/mem.h"
 
-typedef struct _NTFS_VOLUME { UINT32 Dummy; } NTFS_VOLUME, *PNTFS_VOLUME;
+#define NTFS_SECTOR_STRIDE      512     /* update sequence stride, fixed by the format */
+#define NTFS_MFT_RECORD_MFT     0
+#define NTFS_MFT_RECORD_ROOT    5
+#define NTFS_MFT_RECORD_UPCASE  10
+#define NTFS_MFT_RECORD_USER    16      /* records below are metadata */
+#define NTFS_MFT_REF_MASK       0x0000FFFFFFFFFFFFULL
+
+#define NTFS_ATTR_ATTRIBUTE_LIST    0x20
+#define NTFS_ATTR_FILE_NAME         0x30
+#define NTFS_ATTR_DATA              0x80
+#define NTFS_ATTR_INDEX_ROOT        0x90
+#define NTFS_ATTR_INDEX_ALLOCATION  0xA0
+#define NTFS_ATTR_END               0xFFFFFFFF
+
+#define NTFS_ATTR_FLAG_COMPRESSED   0x0001
+#define NTFS_ATTR_FLAG_ENCRYPTED    0x4000
+
+#define NTFS_RECORD_IN_USE      0x0001
+#define NTFS_RECORD_DIRECTORY   0x0002
+
+#define NTFS_INDEX_ENTRY_NODE   0x0001
+#define NTFS_INDEX_ENTRY_END    0x0002
+#define NTFS_INDEX_LARGE        0x0001
+
+#define NTFS_NAMESPACE_DOS      2       /* 8.3 alias of a long name in another entry */
+#define NTFS_FILE_NAME_DIRECTORY 0x10000000
+
+#define NTFS_LCN_SPARSE         0xFFFFFFFFFFFFFFFFULL
+#define NTFS_MFT_CACHE_SLOTS    64
+#define NTFS_MFT_HASH_BUCKETS   128
+#define NTFS_RUN_CACHE_SLOTS    32
+#define NTFS_RUNS_INITIAL       8
+#define NTFS_NAME_MAX           255
+#define NTFS_MAX_DEPTH          32      /* B+tree descent guard */
+
+#pragma pack(push,1)
+typedef struct _NTFS_BOOT_SECTOR {
+    UINT8  JumpBoot[3];
+    CHAR   OemId[8];
+    UINT16 BytesPerSector;
+    UINT8  SectorsPerCluster;
+    UINT8  Reserved1[7];
+    UINT8  MediaDescriptor;
+    UINT8  Reserved2[18];
+    UINT64 TotalSectors;
+    UINT64 MftLcn;
+    UINT64 MftMirrorLcn;
+    INT8   ClustersPerMftRecord;
+    UINT8  Reserved3[3];
+    INT8   ClustersPerIndexBlock;
+    UINT8  Reserved4[3];
+    UINT64 SerialNumber;
+} NTFS_BOOT_SECTOR, *PNTFS_BOOT_SECTOR;
+
+typedef struct _NTFS_RECORD_HEADER {
+    CHAR   Signature[4];
+    UINT16 UsaOffset;
+    UINT16 UsaCount;
+    UINT64 Lsn;
+} NTFS_RECORD_HEADER, *PNTFS_RECORD_HEADER;
+
+typedef struct _NTFS_FILE_RECORD {
+    NTFS_RECORD_HEADER Header;
+    UINT16 SequenceNumber;
+    UINT16 LinkCount;
+    UINT16 AttributesOffset;
+    UINT16 Flags;
+    UINT32 BytesInUse;
+    UINT32 BytesAllocated;
+    UINT64 BaseRecord;
+    UINT16 NextAttributeId;
+} NTFS_FILE_RECORD, *PNTFS_FILE_RECORD;
+
+typedef struct _NTFS_ATTRIBUTE {
+    UINT32 Type;
+    UINT32 Length;
+    UINT8  NonResident;
+    UINT8  NameLength;
+    UINT16 NameOffset;
+    UINT16 Flags;
+    UINT16 Instance;
+    union {
+        struct {
+            UINT32 ValueLength;
+            UINT16 ValueOffset;
+        } Resident;
+        struct {
+            UINT64 LowestVcn;
+            UINT64 HighestVcn;
+            UINT16 MappingPairsOffset;
+            UINT16 CompressionUnit;
+            UINT32 Reserved;
+            UINT64 AllocatedSize;
+            UINT64 DataSize;
+            UINT64 InitializedSize;
+        } NonResident;
+    } u;
+} NTFS_ATTRIBUTE, *PNTFS_ATTRIBUTE;
+
+typedef struct _NTFS_ATTR_LIST_ENTRY {
+    UINT32 Type;
+    UINT16 Length;
+    UINT8  NameLength;
+    UINT8  NameOffset;
+    UINT64 StartingVcn;
+    UINT64 MftReference;
+    UINT16 Instance;
+} NTFS_ATTR_LIST_ENTRY, *PNTFS_ATTR_LIST_ENTRY;
+
+typedef struct _NTFS_FILE_NAME {
+    UINT64 ParentReference;
+    UINT64 Times[4];
+    UINT64 AllocatedSize;
+    UINT64 DataSize;
+    UINT32 FileAttributes;
+    UINT32 ReparseTag;
+    UINT8  NameLength;
+    UINT8  Namespace;
+    UINT16 Name[1];
+} NTFS_FILE_NAME, *PNTFS_FILE_NAME;
+
+typedef struct _NTFS_INDEX_HEADER {
+    UINT32 EntriesOffset;   /* relative to this header */
+    UINT32 IndexLength;
+    UINT32 AllocatedSize;
+    UINT8  Flags;
+    UINT8  Reserved[3];
+} NTFS_INDEX_HEADER, *PNTFS_INDEX_HEADER;
+
+typedef struct _NTFS_INDEX_ROOT {
+    UINT32 AttributeType;
+    UINT32 CollationRule;
+    UINT32 IndexBlockSize;
+    UINT8  ClustersPerIndexBlock;
+    UINT8  Reserved[3];
+    NTFS_INDEX_HEADER Header;
+} NTFS_INDEX_ROOT, *PNTFS_INDEX_ROOT;
+
+typedef struct _NTFS_INDEX_BLOCK {
+    NTFS_RECORD_HEADER Header;
+    UINT64 Vcn;
+    NTFS_INDEX_HEADER Index;
+} NTFS_INDEX_BLOCK, *PNTFS_INDEX_BLOCK;
+
+typedef struct _NTFS_INDEX_ENTRY {
+    UINT64 FileReference;
+    UINT16 Length;
+    UINT16 KeyLength;
+    UINT16 Flags;
+    UINT16 Reserved;
+} NTFS_INDEX_ENTRY, *PNTFS_INDEX_ENTRY;
+#pragma pack(pop)
+
+typedef struct _NTFS_RUN {
+    UINT64 Vcn;
+    UINT64 Lcn;             /* NTFS_LCN_SPARSE for holes */
+    UINT64 Length;
+} NTFS_RUN, *PNTFS_RUN;
+
+/* Decoded mapping pairs of one non-resident attribute */
+typedef struct _NTFS_RUNLIST {
+    UINT64 Record;
+    UINT32 Type;
+    UINT32 RefCount;
+    UINT32 LastUse;
+    BOOL   Valid;
+    PNTFS_RUN Runs;
+    UINT32 Count;
+    UINT32 Capacity;
+    UINT64 AllocatedSize;
+    UINT64 DataSize;
+    UINT64 InitializedSize;
+} NTFS_RUNLIST, *PNTFS_RUNLIST;
+
+typedef struct _NTFS_MFT_ENTRY {
+    UINT64 Record;
+    BOOL   Valid;
+    UINT8* Data;
+    struct _NTFS_MFT_ENTRY* HashNext;
+    struct _NTFS_MFT_ENTRY* LruPrev;
+    struct _NTFS_MFT_ENTRY* LruNext;
+} NTFS_MFT_ENTRY, *PNTFS_MFT_ENTRY;
+
+typedef struct _NTFS_VOLUME {
+    PAIO_DEVICE_OBJECT Device;
+    UINT32 DeviceBlockSize;
+    UINT32 BytesPerSector;
+    UINT32 SectorShift;
+    UINT32 BytesPerCluster;
+    UINT32 ClusterShift;
+    UINT64 TotalClusters;
+    UINT64 MftLcn;
+    UINT32 MftRecordSize;
+    UINT32 IndexBlockSize;
+    NTFS_RUNLIST Mft;       /* $MFT's own $DATA, never evicted */
+    UINT16* UpCase;         /* 65536 entries, NULL = ASCII folding only */
+    /* MFT record cache: hash on record number, LRU list with MRU at head */
+    NTFS_MFT_ENTRY MftEntries[NTFS_MFT_CACHE_SLOTS];
+    PNTFS_MFT_ENTRY MftHash[NTFS_MFT_HASH_BUCKETS];
+    PNTFS_MFT_ENTRY LruHead;
+    PNTFS_MFT_ENTRY LruTail;
+    UINT32 MftHits;
+    UINT32 MftMisses;
+    /* Runlist cache */
+    NTFS_RUNLIST RunCache[NTFS_RUN_CACHE_SLOTS];
+    UINT32 RunClock;
+    UINT8* Scratch;         /* one sector */
+    UINT8* IndexBuffer;     /* one index block */
+    UINT8* RecordBuffer;    /* one MFT record, for bootstrap */
+    UINT8* EnumRoot;        /* copy of a $INDEX_ROOT being enumerated */
+    UINT8* EnumBlocks[NTFS_MAX_DEPTH];  /* one index block per level, allocated on first use */
+    AURORA_SPINLOCK Lock;
+} NTFS_VOLUME, *PNTFS_VOLUME;
+
+typedef struct _NTFS_FILE {
+    PNTFS_VOLUME Volume;
+    UINT64 Record;
+    BOOL   IsDirectory;
+    UINT8* ResidentData;    /* copy of a resident $DATA value */
+    PNTFS_RUNLIST Runs;     /* referenced entry of the runlist cache */
+    UINT64 Size;
+    UINT64 InitializedSize;
+    UINT64 Position;
+    UINT16* ResumeName;     /* directories: last name ReadDir returned */
+    UINT32 ResumeLength;
+    UINT64 ResumeCursor;    /* the cursor handed back with it */
+} NTFS_FILE, *PNTFS_FILE;
+
+static PVOID NtfsAllocate(UINT32 Size)
+{
+    PVOID p;
+    if (Size >= 4096) {
+        p = MemAllocPages((Size + 4095) / 4096);
+        if (p) {
+            memset(p, 0, Size);
+            return p;
+        }
+    }
+    p = AuroraAllocateMemory(Size);
+    if (p) memset(p, 0, Size);
+    return p;
+}
+
+/* ---------------------------------------------------------------------------
+ * Runlists
+ * --------------------------------------------------------------------------- */
+
+static NTSTATUS NtfsAppendRun(PNTFS_RUNLIST List, UINT64 Vcn, UINT64 Lcn, UINT64 Length)
+{
+    if (List->Count) {
+        PNTFS_RUN last = &List->Runs[List->Count - 1];
+        if (last->Vcn + last->Length != Vcn) return STATUS_DISK_CORRUPT_ERROR;
+        /* Merge physically adjacent runs (and neighbouring holes) so reads coalesce */
+        if ((Lcn == NTFS_LCN_SPARSE && last->Lcn == NTFS_LCN_SPARSE) ||
+            (Lcn != NTFS_LCN_SPARSE && last->Lcn != NTFS_LCN_SPARSE && last->Lcn + last->Length == Lcn)) {
+            last->Length += Length;
+            return STATUS_SUCCESS;
+        }
+    } else if (Vcn != 0) {
+        return STATUS_DISK_CORRUPT_ERROR;
+    }
+    if (List->Count == List->Capacity) {
+        UINT32 capacity = List->Capacity ? List->Capacity * 2 : NTFS_RUNS_INITIAL;
+        PNTFS_RUN runs = (PNTFS_RUN)AuroraAllocateMemory(capacity * sizeof(NTFS_RUN));
+        if (!runs) return STATUS_INSUFFICIENT_RESOURCES;
+        if (List->Count) memcpy(runs, List->Runs, List->Count * sizeof(NTFS_RUN));
+        if (List->Runs) AuroraFreeMemory(List->Runs);
+        List->Runs = runs;
+        List->Capacity = capacity;
+    }
+    List->Runs[List->Count].Vcn = Vcn;
+    List->Runs[List->Count].Lcn = Lcn;
+    List->Runs[List->Count].Length = Length;
+    List->Count++;
+    return STATUS_SUCCESS;
+}
+
+/* Decode the mapping pairs of one attribute segment onto the end of List */
+static NTSTATUS NtfsDecodeMappingPairs(PNTFS_VOLUME Vol, PNTFS_ATTRIBUTE Attr, PNTFS_RUNLIST List)
+{
+    UINT8* p = (UINT8*)Attr + Attr->u.NonResident.MappingPairsOffset;
+    UINT8* end = (UINT8*)Attr + Attr->Length;
+    UINT64 vcn = Attr->u.NonResident.LowestVcn;
+    INT64 lcn = 0;
+
+    if (Attr->u.NonResident.MappingPairsOffset >= Attr->Length) return STATUS_DISK_CORRUPT_ERROR;
+    while (p < end && *p) {
+        UINT32 lenBytes = *p & 0x0F, offBytes = *p >> 4;
+        UINT64 length = 0;
+        INT64 delta = 0;
+        NTSTATUS st;
+        if (lenBytes == 0 || lenBytes > 8 || offBytes > 8 || p + 1 + lenBytes + offBytes > end) return STATUS_DISK_CORRUPT_ERROR;
+        p++;
+        for (UINT32 i = 0; i < lenBytes; i++) length |= (UINT64)p[i] << (8 * i);
+        p += lenBytes;
+        if (offBytes) {
+            for (UINT32 i = 0; i < offBytes; i++) delta |= (INT64)((UINT64)p[i] << (8 * i));
+            if (p[offBytes - 1] & 0x80) delta |= (INT64)(~0ULL << (8 * offBytes)); /* sign-extend */
+            p += offBytes;
+            lcn += delta;
+            if (lcn < 0 || (UINT64)lcn + length > Vol->TotalClusters) return STATUS_DISK_CORRUPT_ERROR;
+            st = NtfsAppendRun(List, vcn, (UINT64)lcn, length);
+        } else {
+            st = NtfsAppendRun(List, vcn, NTFS_LCN_SPARSE, length);
+        }
+        if (!NT_SUCCESS(st)) return st;
+        vcn += length;
+    }
+    return STATUS_SUCCESS;
+}
+
+/* Map Vcn; RunLeft receives the clusters remaining in its (merged) run */
+static NTSTATUS NtfsMapVcn(PNTFS_RUNLIST List, UINT64 Vcn, PUINT64 Lcn, PUINT64 RunLeft)
+{
+    UINT32 lo = 0, hi = List->Count;
+    while (lo < hi) {
+        UINT32 mid = lo + (hi - lo) / 2;
+        PNTFS_RUN run = &List->Runs[mid];
+        if (Vcn < run->Vcn) hi = mid;
+        else if (Vcn >= run->Vcn + run->Length) lo = mid + 1;
+        else {
+            *Lcn = run->Lcn == NTFS_LCN_SPARSE ? NTFS_LCN_SPARSE : run->Lcn + (Vcn - run->Vcn);
+            *RunLeft = run->Length - (Vcn - run->Vcn);
+            return STATUS_SUCCESS;
+        }
+    }
+    return STATUS_DISK_CORRUPT_ERROR;
+}
+
+static NTSTATUS NtfsReadSectors(PNTFS_VOLUME Vol, UINT64 Sector, UINT32 Count, PVOID Buffer)
+{
+    UINT32 perSector = Vol->BytesPerSector / Vol->DeviceBlockSize;
+    return BlockRead(Vol->Device, Sector * perSector, Count * perSector, Buffer);
+}
+
+/* Read Length bytes at Offset of a non-resident stream. Holes read as
+ * zeros; whole sectors go straight to the caller's buffer with one block
+ * request per merged run. */
+static NTSTATUS NtfsReadRuns(PNTFS_VOLUME Vol, PNTFS_RUNLIST List, UINT64 Offset, UINT8* Buffer, UINT32 Length)
+{
+    UINT32 bps = Vol->BytesPerSector;
+    NTSTATUS st;
+    while (Length) {
+        UINT64 lcn, runLeft;
+        UINT32 inCluster = (UINT32)(Offset & (Vol->BytesPerCluster - 1));
+        UINT32 n;
+        st = NtfsMapVcn(List, Offset >> Vol->ClusterShift, &lcn, &runLeft);
+        if (!NT_SUCCESS(st)) return st;
+
+        UINT64 runBytes = (runLeft << Vol->ClusterShift) - inCluster;
+        UINT32 chunk = runBytes < Length ? (UINT32)runBytes : Length;
+        if (lcn == NTFS_LCN_SPARSE) {
+            memset(Buffer, 0, chunk);
+            n = chunk;
+        } else {
+            UINT64 sector = ((lcn << Vol->ClusterShift) + inCluster) >> Vol->SectorShift;
+            UINT32 inSector = inCluster & (bps - 1);
+            if (inSector || chunk < bps) {
+                n = bps - inSector;
+                if (n > chunk) n = chunk;
+                st = NtfsReadSectors(Vol, sector, 1, Vol->Scratch);
+                if (!NT_SUCCESS(st)) return st;
+                memcpy(Buffer, Vol->Scratch + inSector, n);
+            } else {
+                n = chunk & ~(bps - 1);
+                st = NtfsReadSectors(Vol, sector, n >> Vol->SectorShift, Buffer);
+                if (!NT_SUCCESS(st)) return st;
+            }
+        }
+        Offset += n;
+        Buffer += n;
+        Length -= n;
+    }
+    return STATUS_SUCCESS;
+}
+
+/* ---------------------------------------------------------------------------
+ * MFT records
+ * --------------------------------------------------------------------------- */
+
+/* Verify and undo the update sequence array of a multi-sector record */
+static NTSTATUS NtfsApplyFixups(UINT8* Record, UINT32 Size, PCSTR Signature)
+{
+    PNTFS_RECORD_HEADER hdr = (PNTFS_RECORD_HEADER)Record;
+    UINT16* usa;
+    if (memcmp(hdr->Signature, Signature, 4) != 0) return STATUS_DISK_CORRUPT_ERROR;
+    if (hdr->UsaCount != Size / NTFS_SECTOR_STRIDE + 1 || (UINT32)hdr->UsaOffset + hdr->UsaCount * 2 > Size || (hdr->UsaOffset & 1)) {
+        return STATUS_DISK_CORRUPT_ERROR;
+    }
+    usa = (UINT16*)(Record + hdr->UsaOffset);
+    for (UINT32 i = 1; i < hdr->UsaCount; i++) {
+        UINT16* tail = (UINT16*)(Record + i * NTFS_SECTOR_STRIDE - 2);
+        if (*tail != usa[0]) return STATUS_DISK_CORRUPT_ERROR; /* torn write */
+        *tail = usa[i];
+    }
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS NtfsReadRecordUncached(PNTFS_VOLUME Vol, UINT64 Record, UINT8* Buffer)
+{
+    NTSTATUS st = NtfsReadRuns(Vol, &Vol->Mft, Record * Vol->MftRecordSize, Buffer, Vol->MftRecordSize);
+    if (!NT_SUCCESS(st)) return st;
+    st = NtfsApplyFixups(Buffer, Vol->MftRecordSize, "FILE");
+    if (!NT_SUCCESS(st)) return st;
+    PNTFS_FILE_RECORD fr = (PNTFS_FILE_RECORD)Buffer;
+    if (fr->AttributesOffset >= Vol->MftRecordSize || fr->BytesInUse > Vol->MftRecordSize) return STATUS_DISK_CORRUPT_ERROR;
+    return STATUS_SUCCESS;
+}
+
+static void NtfsLruUnlink(PNTFS_VOLUME Vol, PNTFS_MFT_ENTRY E)
+{
+    if (E->LruPrev) E->LruPrev->LruNext = E->LruNext; else Vol->LruHead = E->LruNext;
+    if (E->LruNext) E->LruNext->LruPrev = E->LruPrev; else Vol->LruTail = E->LruPrev;
+    E->LruPrev = E->LruNext = NULL;
+}
+
+static void NtfsLruPushFront(PNTFS_VOLUME Vol, PNTFS_MFT_ENTRY E)
+{
+    E->LruPrev = NULL;
+    E->LruNext = Vol->LruHead;
+    if (Vol->LruHead) Vol->LruHead->LruPrev = E; else Vol->LruTail = E;
+    Vol->LruHead = E;
+}
+
+/* Return a fixed-up record. The pointer stays valid until the next call
+ * that may evict, so callers copy out what they need before reading another. */
+static NTSTATUS NtfsGetRecord(PNTFS_VOLUME Vol, UINT64 Record, UINT8** Data)
+{
+    UINT32 bucket = (UINT32)(Record % NTFS_MFT_HASH_BUCKETS);
+    PNTFS_MFT_ENTRY e, *link;
+    NTSTATUS st;
+
+    for (e = Vol->MftHash[bucket]; e; e = e->HashNext) {
+        if (e->Record == Record) {
+            NtfsLruUnlink(Vol, e);
+            NtfsLruPushFront(Vol, e);
+            Vol->MftHits++;
+            *Data = e->Data;
+            return STATUS_SUCCESS;
+        }
+    }
+
+    /* Recycle the least recently used entry */
+    e = Vol->LruTail;
+    if (e->Valid) {
+        for (link = &Vol->MftHash[e->Record % NTFS_MFT_HASH_BUCKETS]; *link; link = &(*link)->HashNext) {
+            if (*link == e) {
+                *link = e->HashNext;
+                break;
+            }
+        }
+        e->Valid = FALSE;
+    }
+    Vol->MftMisses++;
+    st = NtfsReadRecordUncached(Vol, Record, e->Data);
+    if (!NT_SUCCESS(st)) return st;
+    e->Record = Record;
+    e->Valid = TRUE;
+    e->HashNext = Vol->MftHash[bucket];
+    Vol->MftHash[bucket] = e;
+    NtfsLruUnlink(Vol, e);
+    NtfsLruPushFront(Vol, e);
+    *Data = e->Data;
+    return STATUS_SUCCESS;
+}
+
+static BOOL NtfsNameIs(PNTFS_ATTRIBUTE Attr, const UINT16* Name, UINT32 NameLength)
+{
+    if (Attr->NameLength != NameLength) return FALSE;
+    return NameLength == 0 || memcmp((UINT8*)Attr + Attr->NameOffset, Name, NameLength * 2) == 0;
+}
+
+/* Find an attribute by type and name in one record; Instance ~0 matches any */
+static PNTFS_ATTRIBUTE NtfsFindAttribute(PNTFS_VOLUME Vol, UINT8* Record, UINT32 Type, const UINT16* Name, UINT32 NameLength, UINT32 Instance)
+{
+    PNTFS_FILE_RECORD fr = (PNTFS_FILE_RECORD)Record;
+    UINT32 off = fr->AttributesOffset;
+    while (off + 8 <= fr->BytesInUse) {
+        PNTFS_ATTRIBUTE attr = (PNTFS_ATTRIBUTE)(Record + off);
+        if (attr->Type == NTFS_ATTR_END) break;
+        if (attr->Length < 16 || off + attr->Length > Vol->MftRecordSize) break;
+        if (attr->Type == Type && NtfsNameIs(attr, Name, NameLength) && (Instance == 0xFFFFFFFF || attr->Instance == Instance)) {
+            return attr;
+        }
+        off += attr->Length;
+    }
+    return NULL;
+}
+
+static PVOID NtfsResidentValue(PNTFS_ATTRIBUTE Attr, PUINT32 Length)
+{
+    if (Attr->NonResident || (UINT32)Attr->u.Resident.ValueOffset + Attr->u.Resident.ValueLength > Attr->Length) return NULL;
+    *Length = Attr->u.Resident.ValueLength;
+    return (UINT8*)Attr + Attr->u.Resident.ValueOffset;
+}
+
+/* Build the complete runlist of a non-resident attribute. Segments held in
+ * extension records are found through $ATTRIBUTE_LIST, in VCN order. */
+static NTSTATUS NtfsLoadRunlist(PNTFS_VOLUME Vol, UINT64 Record, UINT32 Type, const UINT16* Name, UINT32 NameLength, PNTFS_RUNLIST List)
+{
+    UINT8* rec;
+    UINT8* listData = NULL;
+    UINT32 listLength = 0;
+    PNTFS_ATTRIBUTE attr;
+    NTSTATUS st;
+
+    List->Count = 0;
+    st = NtfsGetRecord(Vol, Record, &rec);
+    if (!NT_SUCCESS(st)) return st;
+    attr = NtfsFindAttribute(Vol, rec, NTFS_ATTR_ATTRIBUTE_LIST, NULL, 0, 0xFFFFFFFF);
+    if (!attr) {
+        attr = NtfsFindAttribute(Vol, rec, Type, Name, NameLength, 0xFFFFFFFF);
+        if (!attr) return STATUS_OBJECT_NAME_NOT_FOUND;
+        if (!attr->NonResident) return STATUS_INVALID_PARAMETER;
+        List->AllocatedSize = attr->u.NonResident.AllocatedSize;
+        List->DataSize = attr->u.NonResident.DataSize;
+        List->InitializedSize = attr->u.NonResident.InitializedSize;
+        return NtfsDecodeMappingPairs(Vol, attr, List);
+    }
+
+    /* Copy the attribute list out: the record buffer may be recycled below */
+    if (attr->NonResident) {
+        NTFS_RUNLIST listRuns;
+        memset(&listRuns, 0, sizeof(listRuns));
+        if (attr->u.NonResident.DataSize > 0x40000) return STATUS_DISK_CORRUPT_ERROR;
+        listLength = (UINT32)attr->u.NonResident.DataSize;
+        st = NtfsDecodeMappingPairs(Vol, attr, &listRuns);
+        listData = (UINT8*)NtfsAllocate(listLength);
+        if (NT_SUCCESS(st) && !listData) st = STATUS_INSUFFICIENT_RESOURCES;
+        if (NT_SUCCESS(st)) st = NtfsReadRuns(Vol, &listRuns, 0, listData, listLength);
+        if (listRuns.Runs) AuroraFreeMemory(listRuns.Runs);
+        if (!NT_SUCCESS(st)) return st;
+    } else {
+        PVOID value = NtfsResidentValue(attr, &listLength);
+        if (!value) return STATUS_DISK_CORRUPT_ERROR;
+        listData = (UINT8*)NtfsAllocate(listLength);
+        if (!listData) return STATUS_INSUFFICIENT_RESOURCES;
+        memcpy(listData, value, listLength);
+    }
+
+    st = STATUS_OBJECT_NAME_NOT_FOUND;
+    for (UINT32 off = 0; off + sizeof(NTFS_ATTR_LIST_ENTRY) <= listLength;) {
+        PNTFS_ATTR_LIST_ENTRY le = (PNTFS_ATTR_LIST_ENTRY)(listData + off);
+        if (le->Length < sizeof(NTFS_ATTR_LIST_ENTRY) || off + le->Length > listLength) {
+            st = STATUS_DISK_CORRUPT_ERROR;
+            break;
+        }
+        off += le->Length;
+        if (le->Type != Type || le->NameLength != NameLength) continue;
+        if (NameLength && memcmp((UINT8*)le + le->NameOffset, Name, NameLength * 2) != 0) continue;
+
+        st = NtfsGetRecord(Vol, le->MftReference & NTFS_MFT_REF_MASK, &rec);
+        if (!NT_SUCCESS(st)) break;
+        attr = NtfsFindAttribute(Vol, rec, Type, Name, NameLength, le->Instance);
+        if (!attr || !attr->NonResident) {
+            st = STATUS_DISK_CORRUPT_ERROR;
+            break;
+        }
+        if (attr->u.NonResident.LowestVcn == 0) {
+            List->AllocatedSize = attr->u.NonResident.AllocatedSize;
+            List->DataSize = attr->u.NonResident.DataSize;
+            List->InitializedSize = attr->u.NonResident.InitializedSize;
+        }
+        st = NtfsDecodeMappingPairs(Vol, attr, List);
+        if (!NT_SUCCESS(st)) break;
+    }
+    AuroraFreeMemory(listData);
+    return st;
+}
+
+/* Look up or decode a runlist; the caller holds a reference until NtfsReleaseRunlist */
+static NTSTATUS NtfsGetRunlist(PNTFS_VOLUME Vol, UINT64 Record, UINT32 Type, PNTFS_RUNLIST* Out)
+{
+    PNTFS_RUNLIST victim = NULL;
+    for (UINT32 i = 0; i < NTFS_RUN_CACHE_SLOTS; i++) {
+        PNTFS_RUNLIST rl = &Vol->RunCache[i];
+        if (rl->Valid && rl->Record == Record && rl->Type == Type) {
+            rl->RefCount++;
+            rl->LastUse = ++Vol->RunClock;
+            *Out = rl;
+            return STATUS_SUCCESS;
+        }
+        if (rl->RefCount) continue;
+        if (!victim || !rl->Valid || (victim->Valid && rl->LastUse < victim->LastUse)) victim = rl;
+    }
+    if (!victim) return STATUS_INSUFFICIENT_RESOURCES;
+
+    victim->Valid = FALSE;
+    NTSTATUS st = NtfsLoadRunlist(Vol, Record, Type, NULL, 0, victim);
+    if (Type == NTFS_ATTR_INDEX_ALLOCATION && st == STATUS_OBJECT_NAME_NOT_FOUND) {
+        static const UINT16 i30[] = { '$', 'I', '3', '0' };
+        st = NtfsLoadRunlist(Vol, Record, Type, i30, 4, victim);
+    }
+    if (!NT_SUCCESS(st)) return st;
+    victim->Record = Record;
+    victim->Type = Type;
+    victim->Valid = TRUE;
+    victim->RefCount = 1;
+    victim->LastUse = ++Vol->RunClock;
+    *Out = victim;
+    return STATUS_SUCCESS;
+}
+
+static void NtfsReleaseRunlist(PNTFS_RUNLIST List)
+{
+    if (List && List->RefCount) List->RefCount--;
+}
+
+/* ---------------------------------------------------------------------------
+ * $I30 lookups
+ * --------------------------------------------------------------------------- */
+
+static UINT16 NtfsUpCaseChar(PNTFS_VOLUME Vol, UINT16 Ch)
+{
+    if (Vol->UpCase) return Vol->UpCase[Ch];
+    return (Ch >= 'a' && Ch <= 'z') ? (UINT16)(Ch - 32) : Ch;
+}
+
+/* COLLATION_FILE_NAME: up-cased UTF-16 code unit order, shorter name first on a tie */
+static INT32 NtfsCollateName(PNTFS_VOLUME Vol, const UINT16* A, UINT32 ALength, const UINT16* B, UINT32 BLength)
+{
+    UINT32 n = ALength < BLength ? ALength : BLength;
+    for (UINT32 i = 0; i < n; i++) {
+        UINT16 a = NtfsUpCaseChar(Vol, A[i]), b = NtfsUpCaseChar(Vol, B[i]);
+        if (a != b) return a < b ? -1 : 1;
+    }
+    return ALength == BLength ? 0 : (ALength < BLength ? -1 : 1);
+}
+
+/* Search one index node. Returns TRUE with *Found set on a hit; otherwise
+ * *Child receives the subnode VCN to descend into, or ~0 for a leaf miss. */
+static NTSTATUS NtfsSearchNode(PNTFS_VOLUME Vol, PNTFS_INDEX_HEADER Header, UINT32 Limit, const UINT16* Name, UINT32 NameLength,
+                               PUINT64 Found, PUINT64 Child)
+{
+    UINT32 off = Header->EntriesOffset;
+    UINT32 end = Header->IndexLength < Limit ? Header->IndexLength : Limit;
+    *Child = ~0ULL;
+    while (off + sizeof(NTFS_INDEX_ENTRY) <= end) {
+        PNTFS_INDEX_ENTRY ie = (PNTFS_INDEX_ENTRY)((UINT8*)Header + off);
+        INT32 cmp = -1;
+        if (ie->Length < sizeof(NTFS_INDEX_ENTRY) || off + ie->Length > end) return STATUS_DISK_CORRUPT_ERROR;
+        if (!(ie->Flags & NTFS_INDEX_ENTRY_END)) {
+            PNTFS_FILE_NAME fn = (PNTFS_FILE_NAME)(ie + 1);
+            if (ie->KeyLength < sizeof(NTFS_FILE_NAME) - 2 + fn->NameLength * 2u) return STATUS_DISK_CORRUPT_ERROR;
+            cmp = NtfsCollateName(Vol, Name, NameLength, fn->Name, fn->NameLength);
+            if (cmp == 0) {
+                *Found = ie->FileReference & NTFS_MFT_REF_MASK;
+                return STATUS_SUCCESS;
+            }
+        }
+        /* Entries are sorted: the first key above Name (or the end marker) owns the subtree */
+        if (cmp < 0) {
+            if (ie->Flags & NTFS_INDEX_ENTRY_NODE) *Child = *(PUINT64)((UINT8*)ie + ie->Length - 8);
+            return STATUS_OBJECT_NAME_NOT_FOUND;
+        }
+        off += ie->Length;
+    }
+    return STATUS_DISK_CORRUPT_ERROR;
+}
+
+static NTSTATUS NtfsLookup(PNTFS_VOLUME Vol, UINT64 Directory, const UINT16* Name, UINT32 NameLength, PUINT64 Child)
+{
+    UINT8* rec;
+    UINT32 rootLength;
+    UINT64 vcn;
+    PNTFS_RUNLIST alloc;
+    NTSTATUS st;
+    static const UINT16 i30[] = { '$', 'I', '3', '0' };
+
+    st = NtfsGetRecord(Vol, Directory, &rec);
+    if (!NT_SUCCESS(st)) return st;
+    if (!(((PNTFS_FILE_RECORD)rec)->Flags & NTFS_RECORD_DIRECTORY)) return STATUS_NOT_A_DIRECTORY;
+    PNTFS_ATTRIBUTE attr = NtfsFindAttribute(Vol, rec, NTFS_ATTR_INDEX_ROOT, i30, 4, 0xFFFFFFFF);
+    PNTFS_INDEX_ROOT root = attr ? (PNTFS_INDEX_ROOT)NtfsResidentValue(attr, &rootLength) : NULL;
+    if (!root || rootLength < sizeof(NTFS_INDEX_ROOT)) return STATUS_DISK_CORRUPT_ERROR;
+
+    st = NtfsSearchNode(Vol, &root->Header, rootLength - 16, Name, NameLength, Child, &vcn);
+    if (st != STATUS_OBJECT_NAME_NOT_FOUND || vcn == ~0ULL) return st;
+
+    st = NtfsGetRunlist(Vol, Directory, NTFS_ATTR_INDEX_ALLOCATION, &alloc);
+    if (!NT_SUCCESS(st)) return st;
+    /* Index VCNs count clusters, or 512-byte units when blocks are smaller than a cluster */
+    UINT32 vcnUnit = Vol->IndexBlockSize >= Vol->BytesPerCluster ? Vol->BytesPerCluster : 512;
+    for (UINT32 depth = 0; depth < NTFS_MAX_DEPTH; depth++) {
+        PNTFS_INDEX_BLOCK blk = (PNTFS_INDEX_BLOCK)Vol->IndexBuffer;
+        st = NtfsReadRuns(Vol, alloc, vcn * vcnUnit, Vol->IndexBuffer, Vol->IndexBlockSize);
+        if (NT_SUCCESS(st)) st = NtfsApplyFixups(Vol->IndexBuffer, Vol->IndexBlockSize, "INDX");
+        if (NT_SUCCESS(st) && blk->Vcn != vcn) st = STATUS_DISK_CORRUPT_ERROR;
+        if (!NT_SUCCESS(st)) break;
+        st = NtfsSearchNode(Vol, &blk->Index, Vol->IndexBlockSize - 24, Name, NameLength, Child, &vcn);
+        if (st != STATUS_OBJECT_NAME_NOT_FOUND || vcn == ~0ULL) break;
+        st = STATUS_DISK_CORRUPT_ERROR; /* descent deeper than any real volume */
+    }
+    NtfsReleaseRunlist(alloc);
+    return st;
+}
+
+/* UTF-16 name to NUL-terminated UTF-8; Out holds 3 bytes per unit plus one */
+static UINT32 NtfsUtf16ToUtf8(const UINT16* Name, UINT32 Length, PCHAR Out)
+{
+    UINT32 n = 0;
+    for (UINT32 i = 0; i < Length; i++) {
+        UINT32 ch = Name[i];
+        if (ch >= 0xD800 && ch <= 0xDBFF && i + 1 < Length && Name[i + 1] >= 0xDC00 && Name[i + 1] <= 0xDFFF) {
+            ch = 0x10000 + ((ch - 0xD800) << 10) + (Name[++i] - 0xDC00);
+            Out[n++] = (CHAR)(0xF0 | (ch >> 18));
+            Out[n++] = (CHAR)(0x80 | ((ch >> 12) & 0x3F));
+            Out[n++] = (CHAR)(0x80 | ((ch >> 6) & 0x3F));
+            Out[n++] = (CHAR)(0x80 | (ch & 0x3F));
+        } else if (ch < 0x80) {
+            Out[n++] = (CHAR)ch;
+        } else if (ch < 0x800) {
+            Out[n++] = (CHAR)(0xC0 | (ch >> 6));
+            Out[n++] = (CHAR)(0x80 | (ch & 0x3F));
+        } else {
+            Out[n++] = (CHAR)(0xE0 | (ch >> 12));
+            Out[n++] = (CHAR)(0x80 | ((ch >> 6) & 0x3F));
+            Out[n++] = (CHAR)(0x80 | (ch & 0x3F));
+        }
+    }
+    Out[n] = '\0';
+    return n;
+}
+
+/* UTF-8 path component to UTF-16; returns the length or 0 if too long */
+static UINT32 NtfsUtf8ToUtf16(PCSTR Text, UINT32 Bytes, UINT16* Out)
+{
+    UINT32 n = 0, i = 0;
+    while (i < Bytes) {
+        UINT8 c = (UINT8)Text[i];
+        UINT16 ch;
+        if (n == NTFS_NAME_MAX) return 0;
+        if (c < 0x80) { ch = c; i += 1; }
+        else if ((c & 0xE0) == 0xC0 && i + 1 < Bytes) { ch = (UINT16)(((c & 0x1F) << 6) | (Text[i + 1] & 0x3F)); i += 2; }
+        else if ((c & 0xF0) == 0xE0 && i + 2 < Bytes) { ch = (UINT16)(((c & 0x0F) << 12) | ((Text[i + 1] & 0x3F) << 6) | (Text[i + 2] & 0x3F)); i += 3; }
+        else { ch = '?'; i += 1; }
+        Out[n++] = ch;
+    }
+    return n;
+}
+
+static NTSTATUS NtfsResolvePath(PNTFS_VOLUME Vol, PCSTR Path, PUINT64 Record)
+{
+    UINT16 name[NTFS_NAME_MAX];
+    UINT64 current = NTFS_MFT_RECORD_ROOT;
+    while (*Path) {
+        while (*Path == '/' || *Path == '\\') Path++;
+        if (!*Path) break;
+        PCSTR end = Path;
+        while (*end && *end != '/' && *end != '\\') end++;
+        UINT32 len = NtfsUtf8ToUtf16(Path, (UINT32)(end - Path), name);
+        if (!len) return STATUS_OBJECT_NAME_NOT_FOUND;
+        NTSTATUS st = NtfsLookup(Vol, current, name, len, &current);
+        if (!NT_SUCCESS(st)) return st;
+        Path = end;
+    }
+    *Record = current;
+    return STATUS_SUCCESS;
+}
+
+/* In-order walk of a directory index. Entries at or below After are passed
+ * over without visiting the subtrees that hold only smaller keys, so a
+ * resumed walk costs one descent, not a rescan. */
+typedef struct _NTFS_ENUM {
+    PNTFS_VOLUME Vol;
+    PNTFS_RUNLIST Alloc;        /* NULL when the whole index fits in $INDEX_ROOT */
+    UINT32 VcnUnit;
+    const UINT16* After;        /* NULL once past it, or from the start */
+    UINT32 AfterLength;
+    UINT64 Skip;                /* entries to count but not return */
+    UINT64 Ordinal;             /* entries counted so far: the cursor */
+    PVOID Buffer;
+    UINT32 Size;
+    UINT32 Used;
+    BOOL Full;
+    UINT16* Last;
+    UINT32 LastLength;
+} NTFS_ENUM, *PNTFS_ENUM;
+
+static void NtfsEnumEntry(PNTFS_ENUM E, PNTFS_INDEX_ENTRY Entry, PNTFS_FILE_NAME Name)
+{
+    CHAR utf8[NTFS_NAME_MAX * 3 + 1];
+    E->After = NULL; /* everything from here on sorts after it */
+    if (Name->Namespace == NTFS_NAMESPACE_DOS || (Entry->FileReference & NTFS_MFT_REF_MASK) < NTFS_MFT_RECORD_USER) return;
+    if (E->Skip) {
+        E->Skip--;
+    } else {
+        BOOL dir = (Name->FileAttributes & NTFS_FILE_NAME_DIRECTORY) != 0;
+        UINT32 length = NtfsUtf16ToUtf8(Name->Name, Name->NameLength, utf8);
+        /* Sizes are as recorded in the index, which NTFS updates lazily */
+        if (!FsPackDirent(E->Buffer, E->Size, &E->Used, utf8, length, dir ? FS_DT_DIRECTORY : FS_DT_FILE,
+                          dir ? 0 : Name->DataSize, E->Ordinal + 1)) {
+            E->Full = TRUE;
+            return;
+        }
+    }
+    E->Ordinal++;
+    memcpy(E->Last, Name->Name, Name->NameLength * sizeof(UINT16));
+    E->LastLength = Name->NameLength;
+}
+
+static NTSTATUS NtfsEnumBlock(PNTFS_ENUM E, UINT64 Vcn, UINT32 Depth);
+
+static NTSTATUS NtfsEnumNode(PNTFS_ENUM E, PNTFS_INDEX_HEADER Header, UINT32 Limit, UINT32 Depth)
+{
+    UINT32 off = Header->EntriesOffset;
+    UINT32 end = Header->IndexLength < Limit ? Header->IndexLength : Limit;
+    while (off + sizeof(NTFS_INDEX_ENTRY) <= end) {
+        PNTFS_INDEX_ENTRY ie = (PNTFS_INDEX_ENTRY)((UINT8*)Header + off);
+        PNTFS_FILE_NAME fn = NULL;
+        INT32 cmp = 1;
+        if (ie->Length < sizeof(NTFS_INDEX_ENTRY) || off + ie->Length > end) return STATUS_DISK_CORRUPT_ERROR;
+        if (!(ie->Flags & NTFS_INDEX_ENTRY_END)) {
+            fn = (PNTFS_FILE_NAME)(ie + 1);
+            if (ie->KeyLength < sizeof(NTFS_FILE_NAME) - 2 + fn->NameLength * 2u) return STATUS_DISK_CORRUPT_ERROR;
+            if (E->After) cmp = NtfsCollateName(E->Vol, fn->Name, fn->NameLength, E->After, E->AfterLength);
+        }
+        /* The subtree left of an entry holds only smaller keys */
+        if ((ie->Flags & NTFS_INDEX_ENTRY_NODE) && cmp > 0) {
+            NTSTATUS st = NtfsEnumBlock(E, *(PUINT64)((UINT8*)ie + ie->Length - 8), Depth + 1);
+            if (!NT_SUCCESS(st) || E->Full) return st;
+        }
+        if (!fn) return STATUS_SUCCESS;
+        if (cmp > 0) {
+            NtfsEnumEntry(E, ie, fn);
+            if (E->Full) return STATUS_SUCCESS;
+        }
+        off += ie->Length;
+    }
+    return STATUS_DISK_CORRUPT_ERROR;
+}
+
+static NTSTATUS NtfsEnumBlock(PNTFS_ENUM E, UINT64 Vcn, UINT32 Depth)
+{
+    PNTFS_VOLUME vol = E->Vol;
+    PNTFS_INDEX_BLOCK blk;
+    NTSTATUS st;
+    if (!E->Alloc || Depth >= NTFS_MAX_DEPTH) return STATUS_DISK_CORRUPT_ERROR;
+    if (!vol->EnumBlocks[Depth]) {
+        vol->EnumBlocks[Depth] = (UINT8*)NtfsAllocate(vol->IndexBlockSize);
+        if (!vol->EnumBlocks[Depth]) return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    blk = (PNTFS_INDEX_BLOCK)vol->EnumBlocks[Depth];
+    st = NtfsReadRuns(vol, E->Alloc, Vcn * E->VcnUnit, (UINT8*)blk, vol->IndexBlockSize);
+    if (NT_SUCCESS(st)) st = NtfsApplyFixups((UINT8*)blk, vol->IndexBlockSize, "INDX");
+    if (NT_SUCCESS(st) && blk->Vcn != Vcn) st = STATUS_DISK_CORRUPT_ERROR;
+    if (!NT_SUCCESS(st)) return st;
+    return NtfsEnumNode(E, &blk->Index, vol->IndexBlockSize - 24, Depth);
+}
+
+static NTSTATUS NtfsEnumDirectory(PNTFS_VOLUME Vol, UINT64 Directory, PNTFS_ENUM E)
+{
+    UINT8* rec;
+    UINT32 rootLength;
+    NTSTATUS st;
+    static const UINT16 i30[] = { '$', 'I', '3', '0' };
+
+    st = NtfsGetRecord(Vol, Directory, &rec);
+    if (!NT_SUCCESS(st)) return st;
+    PNTFS_ATTRIBUTE attr = NtfsFindAttribute(Vol, rec, NTFS_ATTR_INDEX_ROOT, i30, 4, 0xFFFFFFFF);
+    PNTFS_INDEX_ROOT root = attr ? (PNTFS_INDEX_ROOT)NtfsResidentValue(attr, &rootLength) : NULL;
+    if (!root || rootLength < sizeof(NTFS_INDEX_ROOT) || rootLength > Vol->MftRecordSize) return STATUS_DISK_CORRUPT_ERROR;
+    /* Loading the runlist may evict the record from the cache */
+    memcpy(Vol->EnumRoot, root, rootLength);
+    root = (PNTFS_INDEX_ROOT)Vol->EnumRoot;
+
+    E->Vol = Vol;
+    E->Alloc = NULL;
+    E->VcnUnit = Vol->IndexBlockSize >= Vol->BytesPerCluster ? Vol->BytesPerCluster : 512;
+    if (root->Header.Flags & NTFS_INDEX_LARGE) {
+        st = NtfsGetRunlist(Vol, Directory, NTFS_ATTR_INDEX_ALLOCATION, &E->Alloc);
+        if (!NT_SUCCESS(st)) return st;
+    }
+    st = NtfsEnumNode(E, &root->Header, rootLength - 16, 0);
+    NtfsReleaseRunlist(E->Alloc);
+    return st;
+}
+
+/* ---------------------------------------------------------------------------
+ * Mount
+ * --------------------------------------------------------------------------- */
+
+static NTSTATUS NtfsLoadUpCase(PNTFS_VOLUME Vol)
+{
+    PNTFS_RUNLIST rl;
+    NTSTATUS st = NtfsGetRunlist(Vol, NTFS_MFT_RECORD_UPCASE, NTFS_ATTR_DATA, &rl);
+    if (!NT_SUCCESS(st)) return st;
+    if (rl->DataSize != 0x20000) st = STATUS_DISK_CORRUPT_ERROR;
+    if (NT_SUCCESS(st)) {
+        Vol->UpCase = (UINT16*)NtfsAllocate(0x20000);
+        st = Vol->UpCase ? NtfsReadRuns(Vol, rl, 0, (UINT8*)Vol->UpCase, 0x20000) : STATUS_INSUFFICIENT_RESOURCES;
+    }
+    NtfsReleaseRunlist(rl);
+    rl->Valid = FALSE; /* read once; do not hold a cache slot */
+    if (!NT_SUCCESS(st)) Vol->UpCase = NULL;
+    return st;
+}
+
+/* Record 0 is read straight from MftLcn; its $DATA then maps every other record */
+static NTSTATUS NtfsBootstrapMft(PNTFS_VOLUME Vol)
+{
+    UINT32 sectors = Vol->MftRecordSize >> Vol->SectorShift;
+    PNTFS_ATTRIBUTE attr;
+    NTSTATUS st;
+
+    if (sectors == 0) sectors = 1;
+    st = NtfsReadSectors(Vol, (Vol->MftLcn << Vol->ClusterShift) >> Vol->SectorShift, sectors, Vol->RecordBuffer);
+    if (NT_SUCCESS(st)) st = NtfsApplyFixups(Vol->RecordBuffer, Vol->MftRecordSize, "FILE");
+    if (!NT_SUCCESS(st)) return st;
+
+    attr = NtfsFindAttribute(Vol, Vol->RecordBuffer, NTFS_ATTR_DATA, NULL, 0, 0xFFFFFFFF);
+    if (!attr || !attr->NonResident || attr->u.NonResident.LowestVcn != 0) return STATUS_DISK_CORRUPT_ERROR;
+    Vol->Mft.AllocatedSize = attr->u.NonResident.AllocatedSize;
+    Vol->Mft.DataSize = attr->u.NonResident.DataSize;
+    Vol->Mft.InitializedSize = attr->u.NonResident.InitializedSize;
+    st = NtfsDecodeMappingPairs(Vol, attr, &Vol->Mft);
+    if (!NT_SUCCESS(st)) return st;
+
+    /* A fragmented $MFT continues in extension records, which the first segment already maps */
+    if (NtfsFindAttribute(Vol, Vol->RecordBuffer, NTFS_ATTR_ATTRIBUTE_LIST, NULL, 0, 0xFFFFFFFF)) {
+        NTFS_RUNLIST full;
+        memset(&full, 0, sizeof(full));
+        st = NtfsLoadRunlist(Vol, NTFS_MFT_RECORD_MFT, NTFS_ATTR_DATA, NULL, 0, &full);
+        if (!NT_SUCCESS(st)) return st;
+        if (Vol->Mft.Runs) AuroraFreeMemory(Vol->Mft.Runs);
+        Vol->Mft = full;
+        /* Drop records cached through the partial map */
+        for (UINT32 i = 0; i < NTFS_MFT_CACHE_SLOTS; i++) Vol->MftEntries[i].Valid = FALSE;
+        memset(Vol->MftHash, 0, sizeof(Vol->MftHash));
+    }
+    Vol->Mft.Valid = TRUE;
+    Vol->Mft.RefCount = 1;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS NtfsParseBoot(PNTFS_VOLUME Vol, PNTFS_BOOT_SECTOR Bs)
+{
+    UINT32 spc;
+    if (memcmp(Bs->OemId, "NTFS    ", 8) != 0) return STATUS_UNRECOGNIZED_VOLUME;
+    if (Bs->BytesPerSector < 256 || Bs->BytesPerSector > 4096 || (Bs->BytesPerSector & (Bs->BytesPerSector - 1))) return STATUS_UNRECOGNIZED_VOLUME;
+    /* Values above 0x80 encode a negative power of two (clusters over 64 KiB) */
+    spc = Bs->SectorsPerCluster <= 0x80 ? Bs->SectorsPerCluster : 1u << (256 - Bs->SectorsPerCluster);
+    if (spc == 0 || (spc & (spc - 1)) || spc * Bs->BytesPerSector > 0x200000) return STATUS_UNRECOGNIZED_VOLUME;
+
+    Vol->BytesPerSector = Bs->BytesPerSector;
+    for (Vol->SectorShift = 0; (1u << Vol->SectorShift) < Vol->BytesPerSector; Vol->SectorShift++);
+    Vol->BytesPerCluster = spc * Bs->BytesPerSector;
+    for (Vol->ClusterShift = 0; (1u << Vol->ClusterShift) < Vol->BytesPerCluster; Vol->ClusterShift++);
+    Vol->TotalClusters = (Bs->TotalSectors * Bs->BytesPerSector) >> Vol->ClusterShift;
+    Vol->MftLcn = Bs->MftLcn;
+    /* Negative sizes mean 2^-n bytes rather than a cluster count */
+    Vol->MftRecordSize = Bs->ClustersPerMftRecord > 0 ? (UINT32)Bs->ClustersPerMftRecord * Vol->BytesPerCluster
+                                                      : 1u << (UINT32)(-Bs->ClustersPerMftRecord);
+    Vol->IndexBlockSize = Bs->ClustersPerIndexBlock > 0 ? (UINT32)Bs->ClustersPerIndexBlock * Vol->BytesPerCluster
+                                                        : 1u << (UINT32)(-Bs->ClustersPerIndexBlock);
+    if (Vol->MftRecordSize < 1024 || Vol->MftRecordSize > 0x10000 || (Vol->MftRecordSize % NTFS_SECTOR_STRIDE)) return STATUS_UNRECOGNIZED_VOLUME;
+    if (Vol->IndexBlockSize < 512 || Vol->IndexBlockSize > 0x10000 || (Vol->IndexBlockSize % NTFS_SECTOR_STRIDE)) return STATUS_UNRECOGNIZED_VOLUME;
+    if (Vol->MftLcn >= Vol->TotalClusters) return STATUS_DISK_CORRUPT_ERROR;
+    if (Vol->BytesPerSector % Vol->DeviceBlockSize) return STATUS_NOT_SUPPORTED;
+    return STATUS_SUCCESS;
+}
 
 static NTSTATUS ntfs_mount(IN PCSTR Device, IN PCSTR Options, OUT PVOID* VolumeCtx)
 {
-    UNREFERENCED_PARAMETER(Device);
-    UNREFERENCED_PARAMETER(Options);
-    static NTFS_VOLUME vol = {0};
-    *VolumeCtx = &vol;
+    PAIO_DEVICE_OBJECT dev;
+    PBLOCK_DEVICE_EXTENSION ext;
+    PNTFS_VOLUME vol;
+    UINT8* boot;
+    NTSTATUS st;
+    UNREFERENCED_PARAMETER(Options); /* always read-only */
+
+    if (!Device || !VolumeCtx) return STATUS_INVALID_PARAMETER;
+    dev = IoGetDeviceByName(Device);
+    if (!dev || (dev->DeviceType >> 16) != IO_DEVICE_CLASS_BLOCK || !dev->DeviceExtension) return STATUS_NOT_FOUND;
+    ext = (PBLOCK_DEVICE_EXTENSION)dev->DeviceExtension;
+    if (ext->BlockSize == 0 || ext->BlockSize > 4096) return STATUS_NOT_SUPPORTED;
+
+    vol = (PNTFS_VOLUME)NtfsAllocate(sizeof(NTFS_VOLUME));
+    boot = (UINT8*)NtfsAllocate(4096);
+    if (!vol || !boot) return STATUS_INSUFFICIENT_RESOURCES;
+    vol->Device = dev;
+    vol->DeviceBlockSize = ext->BlockSize;
+    AuroraInitializeSpinLock(&vol->Lock);
+
+    st = BlockRead(dev, 0, (512 + ext->BlockSize - 1) / ext->BlockSize, boot);
+    if (NT_SUCCESS(st)) st = NtfsParseBoot(vol, (PNTFS_BOOT_SECTOR)boot);
+    AuroraFreeMemory(boot);
+    if (!NT_SUCCESS(st)) return st;
+
+    vol->Scratch = (UINT8*)NtfsAllocate(vol->BytesPerSector);
+    vol->IndexBuffer = (UINT8*)NtfsAllocate(vol->IndexBlockSize);
+    vol->RecordBuffer = (UINT8*)NtfsAllocate(vol->MftRecordSize > vol->BytesPerSector ? vol->MftRecordSize : vol->BytesPerSector);
+    vol->EnumRoot = (UINT8*)NtfsAllocate(vol->MftRecordSize);
+    if (!vol->Scratch || !vol->IndexBuffer || !vol->RecordBuffer || !vol->EnumRoot) return STATUS_INSUFFICIENT_RESOURCES;
+    for (UINT32 i = 0; i < NTFS_MFT_CACHE_SLOTS; i++) {
+        vol->MftEntries[i].Data = (UINT8*)NtfsAllocate(vol->MftRecordSize);
+        if (!vol->MftEntries[i].Data) return STATUS_INSUFFICIENT_RESOURCES;
+        NtfsLruPushFront(vol, &vol->MftEntries[i]);
+    }
+
+    st = NtfsBootstrapMft(vol);
+    if (!NT_SUCCESS(st)) return st;
+    if (!NT_SUCCESS(NtfsLoadUpCase(vol))) {
+        AuroraDebugPrint("[ntfs] %s: no usable $UpCase, folding ASCII only", Device);
+    }
+
+    AuroraDebugPrint("[ntfs] %s: %u-byte clusters, %u-byte records, MFT in %u runs", Device,
+                     vol->BytesPerCluster, vol->MftRecordSize, vol->Mft.Count);
+    *VolumeCtx = vol;
     return STATUS_SUCCESS;
 }
+
 static NTSTATUS ntfs_unmount(IN PVOID VolumeCtx)
 {
-    UNREFERENCED_PARAMETER(VolumeCtx);
+    PNTFS_VOLUME vol = (PNTFS_VOLUME)VolumeCtx;
+    if (!vol) return STATUS_INVALID_PARAMETER;
+    for (UINT32 i = 0; i < NTFS_RUN_CACHE_SLOTS; i++) {
+        if (vol->RunCache[i].RefCount) return STATUS_DEVICE_BUSY;
+    }
+    return STATUS_SUCCESS;
+}
+
+/* ---------------------------------------------------------------------------
+ * File operations
+ * --------------------------------------------------------------------------- */
+
+static NTSTATUS NtfsOpenData(PNTFS_VOLUME Vol, PNTFS_FILE File)
+{
+    UINT8* rec;
+    PNTFS_ATTRIBUTE attr;
+    NTSTATUS st = NtfsGetRecord(Vol, File->Record, &rec);
+    if (!NT_SUCCESS(st)) return st;
+    PNTFS_FILE_RECORD fr = (PNTFS_FILE_RECORD)rec;
+    if (!(fr->Flags & NTFS_RECORD_IN_USE) || fr->BaseRecord != 0) return STATUS_OBJECT_NAME_NOT_FOUND;
+    if (fr->Flags & NTFS_RECORD_DIRECTORY) {
+        File->IsDirectory = TRUE;
+        return STATUS_SUCCESS;
+    }
+
+    attr = NtfsFindAttribute(Vol, rec, NTFS_ATTR_DATA, NULL, 0, 0xFFFFFFFF);
+    if (attr && !attr->NonResident) {
+        UINT32 length;
+        PVOID value = NtfsResidentValue(attr, &length);
+        if (!value) return STATUS_DISK_CORRUPT_ERROR;
+        File->ResidentData = (UINT8*)NtfsAllocate(length ? length : 1);
+        if (!File->ResidentData) return STATUS_INSUFFICIENT_RESOURCES;
+        memcpy(File->ResidentData, value, length);
+        File->Size = File->InitializedSize = length;
+        return STATUS_SUCCESS;
+    }
+    if (attr && (attr->Flags & (NTFS_ATTR_FLAG_COMPRESSED | NTFS_ATTR_FLAG_ENCRYPTED))) return STATUS_NOT_SUPPORTED;
+    if (!attr && !NtfsFindAttribute(Vol, rec, NTFS_ATTR_ATTRIBUTE_LIST, NULL, 0, 0xFFFFFFFF)) return STATUS_DISK_CORRUPT_ERROR;
+
+    st = NtfsGetRunlist(Vol, File->Record, NTFS_ATTR_DATA, &File->Runs);
+    if (!NT_SUCCESS(st)) return st;
+    File->Size = File->Runs->DataSize;
+    File->InitializedSize = File->Runs->InitializedSize < File->Size ? File->Runs->InitializedSize : File->Size;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS ntfs_open(IN PVOID VolumeCtx, IN PCSTR Path, OUT FS_FILE* File)
+{
+    PNTFS_VOLUME vol = (PNTFS_VOLUME)VolumeCtx;
+    PNTFS_FILE file;
+    NTSTATUS st;
+    if (!vol || !Path || !File) return STATUS_INVALID_PARAMETER;
+    file = (PNTFS_FILE)NtfsAllocate(sizeof(NTFS_FILE));
+    if (!file) return STATUS_INSUFFICIENT_RESOURCES;
+    file->Volume = vol;
+
+    AURORA_IRQL irql;
+    AuroraAcquireSpinLock(&vol->Lock, &irql);
+    st = NtfsResolvePath(vol, Path, &file->Record);
+    if (NT_SUCCESS(st)) st = NtfsOpenData(vol, file);
+    AuroraReleaseSpinLock(&vol->Lock, irql);
+    if (!NT_SUCCESS(st)) {
+        NtfsReleaseRunlist(file->Runs);
+        if (file->ResidentData) AuroraFreeMemory(file->ResidentData);
+        AuroraFreeMemory(file);
+        return st;
+    }
+    *File = file;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS ntfs_close(IN FS_FILE File)
+{
+    PNTFS_FILE file = (PNTFS_FILE)File;
+    if (!file) return STATUS_INVALID_PARAMETER;
+    AURORA_IRQL irql;
+    AuroraAcquireSpinLock(&file->Volume->Lock, &irql);
+    NtfsReleaseRunlist(file->Runs);
+    AuroraReleaseSpinLock(&file->Volume->Lock, irql);
+    if (file->ResidentData) AuroraFreeMemory(file->ResidentData);
+    if (file->ResumeName) AuroraFreeMemory(file->ResumeName);
+    AuroraFreeMemory(file);
+    return STATUS_SUCCESS;
+}
+
+/* Positional read; the file position is left alone. Segments are fed to the
+ * 32-bit run reader in pieces. */
+#define NTFS_TRANSFER_CHUNK     0x40000000u
+
+static NTSTATUS ntfs_read_at(IN FS_FILE File, IN UINT64 Offset, IN PFS_IO_SEGMENT Segments, IN UINT32 SegmentCount, OUT PUINT64 BytesRead)
+{
+    PNTFS_FILE file = (PNTFS_FILE)File;
+    UINT64 done = 0;
+    NTSTATUS st = STATUS_SUCCESS;
+    AURORA_IRQL irql;
+    if (BytesRead) *BytesRead = 0;
+    if (!file || (!Segments && SegmentCount)) return STATUS_INVALID_PARAMETER;
+    if (file->IsDirectory) return STATUS_FILE_IS_A_DIRECTORY;
+    for (UINT32 i = 0; i < SegmentCount; i++) {
+        if (!Segments[i].Buffer && Segments[i].Length) return STATUS_INVALID_PARAMETER;
+    }
+
+    for (UINT32 i = 0; i < SegmentCount && NT_SUCCESS(st); i++) {
+        UINT8* out = (UINT8*)Segments[i].Buffer;
+        UINT64 len = Segments[i].Length;
+        while (len && Offset + done < file->Size) {
+            UINT64 pos = Offset + done;
+            UINT32 n = len > NTFS_TRANSFER_CHUNK ? NTFS_TRANSFER_CHUNK : (UINT32)len;
+            UINT32 valid = 0;
+            if (n > file->Size - pos) n = (UINT32)(file->Size - pos);
+            if (pos < file->InitializedSize) {
+                UINT64 left = file->InitializedSize - pos;
+                valid = left < n ? (UINT32)left : n;
+            }
+            if (valid && file->ResidentData) {
+                memcpy(out, file->ResidentData + pos, valid);
+            } else if (valid) {
+                AuroraAcquireSpinLock(&file->Volume->Lock, &irql);
+                st = NtfsReadRuns(file->Volume, file->Runs, pos, out, valid);
+                AuroraReleaseSpinLock(&file->Volume->Lock, irql);
+                if (!NT_SUCCESS(st)) break;
+            }
+            /* Past InitializedSize the stream reads as zeros */
+            if (n > valid) memset(out + valid, 0, n - valid);
+            out += n;
+            len -= n;
+            done += n;
+        }
+        if (len) break;
+    }
+    if (!NT_SUCCESS(st) && !done) return st;
+    if (BytesRead) *BytesRead = done;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS ntfs_write_at(IN FS_FILE File, IN UINT64 Offset, IN PFS_IO_SEGMENT Segments, IN UINT32 SegmentCount, OUT PUINT64 BytesWritten)
+{
+    UNREFERENCED_PARAMETER(File);
+    UNREFERENCED_PARAMETER(Offset);
+    UNREFERENCED_PARAMETER(Segments);
+    UNREFERENCED_PARAMETER(SegmentCount);
+    if (BytesWritten) *BytesWritten = 0;
+    return STATUS_MEDIA_WRITE_PROTECTED;
+}
+
+static NTSTATUS ntfs_read(IN FS_FILE File, OUT PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesRead)
+{
+    PNTFS_FILE file = (PNTFS_FILE)File;
+    FS_IO_SEGMENT seg;
+    UINT64 done = 0;
+    NTSTATUS st;
+    if (BytesRead) *BytesRead = 0;
+    if (!file) return STATUS_INVALID_PARAMETER;
+    seg.Buffer = Buffer;
+    seg.Length = Size;
+    st = ntfs_read_at(File, file->Position, &seg, 1, &done);
+    if (!NT_SUCCESS(st)) return st;
+    file->Position += done;
+    if (BytesRead) *BytesRead = (UINT32)done;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS ntfs_write(IN FS_FILE File, IN PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesWritten)
+{
+    UNREFERENCED_PARAMETER(File);
+    UNREFERENCED_PARAMETER(Buffer);
+    UNREFERENCED_PARAMETER(Size);
+    if (BytesWritten) *BytesWritten = 0;
+    return STATUS_MEDIA_WRITE_PROTECTED;
+}
+
+static NTSTATUS ntfs_seek(IN FS_FILE File, IN INT64 Offset, IN UINT32 Origin, OUT PUINT64 NewPosition)
+{
+    PNTFS_FILE file = (PNTFS_FILE)File;
+    INT64 base;
+    if (!file) return STATUS_INVALID_PARAMETER;
+    switch (Origin) {
+        case FS_SEEK_SET: base = 0; break;
+        case FS_SEEK_CUR: base = (INT64)file->Position; break;
+        case FS_SEEK_END: base = (INT64)file->Size; break;
+        default: return STATUS_INVALID_PARAMETER;
+    }
+    if (base + Offset < 0) return STATUS_INVALID_PARAMETER;
+    file->Position = (UINT64)(base + Offset);
+    if (NewPosition) *NewPosition = file->Position;
+    return STATUS_SUCCESS;
+}
+
+/* The cursor counts the entries returned so far. Continuing from the last
+ * batch resumes after the name it ended on; any other cursor is reached by
+ * counting from the start. The volume is read-only, so counts are stable. */
+static NTSTATUS ntfs_read_dir(IN FS_FILE File, IN OUT PUINT64 Cursor, OUT PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesReturned)
+{
+    PNTFS_FILE file = (PNTFS_FILE)File;
+    NTFS_ENUM e;
+    AURORA_IRQL irql;
+    NTSTATUS st;
+
+    if (BytesReturned) *BytesReturned = 0;
+    if (!file || !Cursor || !BytesReturned) return STATUS_INVALID_PARAMETER;
+    if (!file->IsDirectory) return STATUS_NOT_A_DIRECTORY;
+    if (!file->ResumeName) {
+        file->ResumeName = (UINT16*)NtfsAllocate(NTFS_NAME_MAX * sizeof(UINT16));
+        if (!file->ResumeName) return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    memset(&e, 0, sizeof(e));
+    e.Buffer = Buffer;
+    e.Size = Size;
+    e.Last = file->ResumeName;
+    if (*Cursor && *Cursor == file->ResumeCursor) {
+        e.After = file->ResumeName;
+        e.AfterLength = file->ResumeLength;
+        e.Ordinal = *Cursor;
+    } else {
+        e.Skip = *Cursor;
+    }
+
+    AuroraAcquireSpinLock(&file->Volume->Lock, &irql);
+    st = NtfsEnumDirectory(file->Volume, file->Record, &e);
+    AuroraReleaseSpinLock(&file->Volume->Lock, irql);
+    if (!NT_SUCCESS(st)) {
+        file->ResumeCursor = 0; /* the name may be half overwritten */
+        return st;
+    }
+    if (e.LastLength) {
+        file->ResumeLength = e.LastLength;
+        file->ResumeCursor = e.Ordinal;
+    }
+    if (!e.Used) return e.Full ? STATUS_BUFFER_TOO_SMALL : STATUS_NO_MORE_ENTRIES;
+    *Cursor = e.Ordinal;
+    *BytesReturned = e.Used;
     return STATUS_SUCCESS;
 }
 
@@ -25,5 +1272,14 @@ void FsAdapterRegisterNtfs(void)
     drv.Name = "ntfs";
     drv.Ops.Mount = ntfs_mount;
     drv.Ops.Unmount = ntfs_unmount;
+    drv.Ops.Open = ntfs_open;
+    drv.Ops.Close = ntfs_close;
+    drv.Ops.Read = ntfs_read;
+    drv.Ops.Write = ntfs_write;
+    drv.Ops.Seek = ntfs_seek;
+    drv.Ops.ReadAt = ntfs_read_at;
+    drv.Ops.WriteAt = ntfs_write_at;
+    drv.Ops.ReadDir = ntfs_read_dir;
+    drv.Flags = FS_DRIVER_CACHED;
     FsRegisterDriver(&drv);
 }
@@ -0,0 +1,531 @@
+/*
+ * Aurora Kernel - VFS page cache
+ *
+ * File data of drivers flagged FS_DRIVER_CACHED is kept in whole pages in
+ * a per-file radix tree hanging off the file's dentry, so every handle of
+ * the file shares one copy. Reads fill missing pages from the driver up to
+ * FS_READAHEAD_PAGES at a time; writes only dirty pages, which are written
+ * back on FsFlush and when the last handle of the file goes away. Clean
+ * pages are dropped at that point once the cache as a whole grows past
+ * FS_PAGE_CACHE_HIGH_WATER, and with the dentry when it is reclaimed.
+ *
+ * Nothing is allocated on disk while data sits dirty here. Writeback first
+ * hands a driver with Allocate the whole dirty range, so a file written in
+ * many small pieces still gets its space as one run.
+ */
+
+#include "../aurora.h"
+#include "../include/kern.h"
+#include "../include/fs.h"
+#include "../include/mem.h"
+#include "vfs.h"
+
+#define FS_PAGE_SIZE        4096u
+#define FS_PAGE_SHIFT       12
+#define FS_RADIX_MAX_HEIGHT ((64 + FS_RADIX_SHIFT - 1) / FS_RADIX_SHIFT)
+
+static PFS_RADIX_NODE g_RadixFree;              /* recycled nodes, linked through Slots[0] */
+static FS_PAGE_CACHE_STATS g_PageCacheStats;
+
+/* ---------------------------------------------------------------------------
+ * Radix tree
+ * --------------------------------------------------------------------------- */
+
+static PFS_RADIX_NODE FsRadixAllocNode(void)
+{
+    PFS_RADIX_NODE n = g_RadixFree;
+    if (n) {
+        g_RadixFree = (PFS_RADIX_NODE)n->Slots[0];
+    } else {
+        n = (PFS_RADIX_NODE)AuroraAllocateMemory(sizeof(FS_RADIX_NODE));
+        if (!n) return NULL;
+    }
+    memset(n, 0, sizeof(*n));
+    return n;
+}
+
+static void FsRadixFreeNode(PFS_RADIX_NODE N)
+{
+    N->Slots[0] = g_RadixFree;
+    g_RadixFree = N;
+}
+
+static BOOL FsRadixFits(UINT32 Height, UINT64 Index)
+{
+    return Height * FS_RADIX_SHIFT >= 64 || (Index >> (Height * FS_RADIX_SHIFT)) == 0;
+}
+
+static UINT32 FsRadixSlot(UINT64 Index, UINT32 Level)
+{
+    return (UINT32)(Index >> ((Level - 1) * FS_RADIX_SHIFT)) & (FS_RADIX_SLOTS - 1);
+}
+
+/* Bottom-level node holding Index, recording the path when asked */
+static PFS_RADIX_NODE FsRadixLeaf(PFS_PAGE_CACHE C, UINT64 Index, PFS_RADIX_NODE* Path)
+{
+    PFS_RADIX_NODE n = C->Root;
+    if (!n || !FsRadixFits(C->Height, Index)) return NULL;
+    for (UINT32 level = C->Height; level > 1; level--) {
+        if (Path) *Path++ = n;
+        n = (PFS_RADIX_NODE)n->Slots[FsRadixSlot(Index, level)];
+        if (!n) return NULL;
+    }
+    if (Path) *Path = n;
+    return n;
+}
+
+static PVOID FsRadixLookup(PFS_PAGE_CACHE C, UINT64 Index)
+{
+    PFS_RADIX_NODE leaf = FsRadixLeaf(C, Index, NULL);
+    return leaf ? leaf->Slots[Index & (FS_RADIX_SLOTS - 1)] : NULL;
+}
+
+static BOOL FsRadixInsert(PFS_PAGE_CACHE C, UINT64 Index, PVOID Page)
+{
+    PFS_RADIX_NODE n;
+    if (!C->Root) {
+        C->Root = FsRadixAllocNode();
+        if (!C->Root) return FALSE;
+        C->Height = 1;
+    }
+    while (!FsRadixFits(C->Height, Index)) {
+        PFS_RADIX_NODE top = FsRadixAllocNode();
+        if (!top) return FALSE;
+        top->Slots[0] = C->Root;
+        top->Count = 1;
+        top->DirtyTags = C->Root->DirtyTags ? 1 : 0;
+        C->Root = top;
+        C->Height++;
+    }
+    n = C->Root;
+    for (UINT32 level = C->Height; level > 1; level--) {
+        UINT32 slot = FsRadixSlot(Index, level);
+        if (!n->Slots[slot]) {
+            PFS_RADIX_NODE child = FsRadixAllocNode();
+            if (!child) return FALSE;
+            n->Slots[slot] = child;
+            n->Count++;
+        }
+        n = (PFS_RADIX_NODE)n->Slots[slot];
+    }
+    if (n->Slots[Index & (FS_RADIX_SLOTS - 1)]) return FALSE;
+    n->Slots[Index & (FS_RADIX_SLOTS - 1)] = Page;
+    n->Count++;
+    C->Pages++;
+    __sync_fetch_and_add(&g_PageCacheStats.Pages, 1);
+    return TRUE;
+}
+
+static BOOL FsRadixIsDirty(PFS_PAGE_CACHE C, UINT64 Index)
+{
+    PFS_RADIX_NODE leaf = FsRadixLeaf(C, Index, NULL);
+    return leaf && (leaf->DirtyTags & (1ull << (Index & (FS_RADIX_SLOTS - 1))));
+}
+
+/* Set or clear the dirty tag of a cached page and of its ancestors */
+static void FsRadixTag(PFS_PAGE_CACHE C, UINT64 Index, BOOL Dirty)
+{
+    PFS_RADIX_NODE path[FS_RADIX_MAX_HEIGHT];
+    UINT64 bit = 1ull << (Index & (FS_RADIX_SLOTS - 1));
+    PFS_RADIX_NODE leaf = FsRadixLeaf(C, Index, path);
+    UINT32 depth = C->Height - 1;
+    if (!leaf || !leaf->Slots[Index & (FS_RADIX_SLOTS - 1)]) return;
+    if (((leaf->DirtyTags & bit) != 0) == (Dirty != FALSE)) return;
+
+    if (Dirty) {
+        for (UINT32 i = 0; i <= depth; i++) path[i]->DirtyTags |= 1ull << FsRadixSlot(Index, C->Height - i);
+        C->DirtyPages++;
+        __sync_fetch_and_add(&g_PageCacheStats.DirtyPages, 1);
+    } else {
+        leaf->DirtyTags &= ~bit;
+        for (INT32 i = (INT32)depth - 1; i >= 0 && path[i + 1]->DirtyTags == 0; i--) {
+            path[i]->DirtyTags &= ~(1ull << FsRadixSlot(Index, C->Height - i));
+        }
+        C->DirtyPages--;
+        __sync_fetch_and_sub(&g_PageCacheStats.DirtyPages, 1);
+    }
+}
+
+/* First dirty page index >= Start below N, which covers indexes from Base */
+static BOOL FsRadixNextDirty(PFS_RADIX_NODE N, UINT32 Level, UINT64 Base, UINT64 Start, PUINT64 Index)
+{
+    UINT32 shift = (Level - 1) * FS_RADIX_SHIFT;
+    UINT32 first = Start > Base ? (UINT32)((Start - Base) >> shift) : 0;
+    UINT64 tags = first < FS_RADIX_SLOTS ? N->DirtyTags & (~0ull << first) : 0;
+    while (tags) {
+        UINT32 slot = (UINT32)__builtin_ctzll(tags);
+        UINT64 childBase = Base + ((UINT64)slot << shift);
+        tags &= tags - 1;
+        if (Level == 1) {
+            *Index = childBase;
+            return TRUE;
+        }
+        if (FsRadixNextDirty((PFS_RADIX_NODE)N->Slots[slot], Level - 1, childBase, Start, Index)) return TRUE;
+    }
+    return FALSE;
+}
+
+/* Free the pages below N (only clean ones when CleanOnly) and any node left empty */
+static void FsRadixPrune(PFS_PAGE_CACHE C, PFS_RADIX_NODE N, UINT32 Level, BOOL CleanOnly)
+{
+    for (UINT32 slot = 0; slot < FS_RADIX_SLOTS && N->Count; slot++) {
+        PVOID p = N->Slots[slot];
+        BOOL dirty = (N->DirtyTags >> slot) & 1;
+        if (!p) continue;
+        if (Level == 1) {
+            if (CleanOnly && dirty) continue;
+            MemFreePages(p, 1);
+            C->Pages--;
+            __sync_fetch_and_sub(&g_PageCacheStats.Pages, 1);
+            if (dirty) {
+                C->DirtyPages--;
+                __sync_fetch_and_sub(&g_PageCacheStats.DirtyPages, 1);
+            }
+        } else {
+            FsRadixPrune(C, (PFS_RADIX_NODE)p, Level - 1, CleanOnly);
+            if (((PFS_RADIX_NODE)p)->Count) continue;
+            FsRadixFreeNode((PFS_RADIX_NODE)p);
+        }
+        N->Slots[slot] = NULL;
+        N->DirtyTags &= ~(1ull << slot);
+        N->Count--;
+    }
+}
+
+static void FsPageCachePruneLocked(PFS_PAGE_CACHE C, BOOL CleanOnly)
+{
+    if (!C->Root) return;
+    FsRadixPrune(C, C->Root, C->Height, CleanOnly);
+    if (C->Root->Count == 0) {
+        FsRadixFreeNode(C->Root);
+        C->Root = NULL;
+        C->Height = 0;
+    }
+}
+
+/* ---------------------------------------------------------------------------
+ * Filling and writeback
+ * --------------------------------------------------------------------------- */
+
+/* Read Index and up to Want-1 following uncached pages with one driver
+ * read. Pages past end of file are zero filled without touching the driver. */
+static NTSTATUS FsPageCacheFill(PFS_HANDLE H, UINT64 Index, UINT32 Want, PVOID* Page)
+{
+    PFS_PAGE_CACHE c = H->Cache;
+    PFS_DRIVER drv = H->Driver;
+    UINT64 offset = Index << FS_PAGE_SHIFT;
+    UINT64 lastIndex = c->FileSize ? (c->FileSize - 1) >> FS_PAGE_SHIFT : 0;
+    UINT32 count = 1, got = 0;
+    UINT8* chunk;
+    AURORA_IRQL irql;
+    NTSTATUS st = STATUS_SUCCESS;
+
+    AuroraAcquireSpinLock(&c->Lock, &irql);
+    while (count < Want && Index + count <= lastIndex && !FsRadixLookup(c, Index + count)) count++;
+    AuroraReleaseSpinLock(&c->Lock, irql);
+
+    chunk = (UINT8*)MemAllocPages(count);
+    if (!chunk && count > 1) {
+        count = 1;
+        chunk = (UINT8*)MemAllocPages(1);
+    }
+    if (!chunk) return STATUS_INSUFFICIENT_RESOURCES;
+
+    if (offset < c->FileSize) {
+        UINT64 len = (UINT64)count << FS_PAGE_SHIFT;
+        if (len > c->FileSize - offset) len = c->FileSize - offset;
+        if (drv->Ops.ReadAt) {
+            /* Leaves the driver position alone, so fills through one handle may overlap */
+            FS_IO_SEGMENT seg;
+            UINT64 got64 = 0;
+            seg.Buffer = chunk;
+            seg.Length = len;
+            st = drv->Ops.ReadAt(H->File, offset, &seg, 1, &got64);
+            got = (UINT32)got64;
+        } else {
+            st = drv->Ops.Seek(H->File, (INT64)offset, FS_SEEK_SET, NULL);
+            if (NT_SUCCESS(st)) st = drv->Ops.Read(H->File, chunk, (UINT32)len, &got);
+        }
+        __sync_fetch_and_add(&g_PageCacheStats.DriverReads, 1);
+        if (!NT_SUCCESS(st)) {
+            MemFreePages(chunk, count);
+            return st;
+        }
+    }
+    memset(chunk + got, 0, ((SIZE_T)count << FS_PAGE_SHIFT) - got);
+    __sync_fetch_and_add(&g_PageCacheStats.Misses, count);
+
+    /* Someone may have cached some of these while the lock was dropped */
+    AuroraAcquireSpinLock(&c->Lock, &irql);
+    for (UINT32 i = 0; i < count; i++) {
+        PVOID p = chunk + ((SIZE_T)i << FS_PAGE_SHIFT);
+        if (FsRadixLookup(c, Index + i) || !FsRadixInsert(c, Index + i, p)) MemFreePages(p, 1);
+    }
+    *Page = FsRadixLookup(c, Index);
+    AuroraReleaseSpinLock(&c->Lock, irql);
+    return *Page ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
+}
+
+/* Cached page for Index, filled from the driver unless Overwrite says the
+ * caller is about to replace all of its bytes that lie inside the file */
+static NTSTATUS FsPageCacheFind(PFS_HANDLE H, UINT64 Index, BOOL Overwrite, PVOID* Page)
+{
+    PFS_PAGE_CACHE c = H->Cache;
+    AURORA_IRQL irql;
+    PVOID p;
+
+    AuroraAcquireSpinLock(&c->Lock, &irql);
+    p = FsRadixLookup(c, Index);
+    if (!p && Overwrite) {
+        p = MemAllocPages(1);
+        if (p) {
+            memset(p, 0, FS_PAGE_SIZE);
+            if (!FsRadixInsert(c, Index, p)) {
+                MemFreePages(p, 1);
+                p = NULL;
+            }
+        }
+        AuroraReleaseSpinLock(&c->Lock, irql);
+        if (!p) return STATUS_INSUFFICIENT_RESOURCES;
+        *Page = p;
+        return STATUS_SUCCESS;
+    }
+    AuroraReleaseSpinLock(&c->Lock, irql);
+    if (p) {
+        __sync_fetch_and_add(&g_PageCacheStats.Hits, 1);
+        *Page = p;
+        return STATUS_SUCCESS;
+    }
+    return FsPageCacheFill(H, Index, FS_READAHEAD_PAGES, Page);
+}
+
+/* Write every dirty page back through the driver, merging pages that sit
+ * next to each other both in the file and in memory into one write */
+NTSTATUS FsPageCacheWriteback(IN PFS_HANDLE Handle)
+{
+    PFS_PAGE_CACHE c = Handle ? Handle->Cache : NULL;
+    PFS_DRIVER drv;
+    UINT64 index = 0;
+    AURORA_IRQL irql;
+
+    if (!c) return STATUS_SUCCESS;
+    drv = Handle->Driver;
+    if (drv->Ops.Allocate) {
+        UINT64 from = 0, size = 0;
+        AuroraAcquireSpinLock(&c->Lock, &irql);
+        if (c->DirtyPages && FsRadixNextDirty(c->Root, c->Height, 0, 0, &index) && (index << FS_PAGE_SHIFT) < c->FileSize) {
+            from = index << FS_PAGE_SHIFT;
+            size = c->FileSize - from;
+        }
+        AuroraReleaseSpinLock(&c->Lock, irql);
+        /* Only a placement hint; the writes below report running out of space */
+        if (size) drv->Ops.Allocate(Handle->File, from, size, FS_ALLOCATE_KEEP_SIZE);
+        index = 0;
+    }
+    for (;;) {
+        UINT8* first;
+        UINT32 count = 1, written;
+        UINT64 offset, len;
+        NTSTATUS st;
+
+        AuroraAcquireSpinLock(&c->Lock, &irql);
+        if (!c->DirtyPages || !FsRadixNextDirty(c->Root, c->Height, 0, index, &index)) {
+            AuroraReleaseSpinLock(&c->Lock, irql);
+            return STATUS_SUCCESS;
+        }
+        first = (UINT8*)FsRadixLookup(c, index);
+        FsRadixTag(c, index, FALSE);
+        while (count < FS_READAHEAD_PAGES && FsRadixIsDirty(c, index + count) &&
+               FsRadixLookup(c, index + count) == first + ((SIZE_T)count << FS_PAGE_SHIFT)) {
+            FsRadixTag(c, index + count, FALSE);
+            count++;
+        }
+        offset = index << FS_PAGE_SHIFT;
+        len = offset < c->FileSize ? c->FileSize - offset : 0;
+        AuroraReleaseSpinLock(&c->Lock, irql);
+
+        if (len > ((UINT64)count << FS_PAGE_SHIFT)) len = (UINT64)count << FS_PAGE_SHIFT;
+        st = STATUS_SUCCESS;
+        if (len && drv->Ops.WriteAt) {
+            FS_IO_SEGMENT seg;
+            UINT64 written64;
+            seg.Buffer = first;
+            seg.Length = len;
+            st = drv->Ops.WriteAt(Handle->File, offset, &seg, 1, &written64);
+        } else if (len) {
+            st = drv->Ops.Write ? drv->Ops.Seek(Handle->File, (INT64)offset, FS_SEEK_SET, NULL) : STATUS_NOT_SUPPORTED;
+            if (NT_SUCCESS(st)) st = drv->Ops.Write(Handle->File, first, (UINT32)len, &written);
+        }
+        if (!NT_SUCCESS(st)) {
+            AuroraAcquireSpinLock(&c->Lock, &irql);
+            for (UINT32 i = 0; i < count; i++) FsRadixTag(c, index + i, TRUE);
+            AuroraReleaseSpinLock(&c->Lock, irql);
+            return st;
+        }
+        __sync_fetch_and_add(&g_PageCacheStats.WritebackPages, count);
+        index += count;
+    }
+}
+
+/* ---------------------------------------------------------------------------
+ * Handle operations
+ * --------------------------------------------------------------------------- */
+
+/* Give a freshly opened handle the file's cache, creating it on first use */
+NTSTATUS FsPageCacheAttach(IN PFS_HANDLE Handle)
+{
+    PFS_DRIVER drv = Handle->Driver;
+    PFS_PAGE_CACHE c, fresh = NULL;
+    AURORA_IRQL irql;
+    UINT32 n;
+
+    Handle->Cache = NULL;
+    if (!(drv->Flags & FS_DRIVER_CACHED) || !drv->Ops.Seek || !drv->Ops.Read) return STATUS_SUCCESS;
+    /* Zero-length transfers let the driver refuse up front: reads fail on
+     * directories, writes on read-only files and volumes */
+    if (!NT_SUCCESS(drv->Ops.Read(Handle->File, NULL, 0, &n))) return STATUS_SUCCESS;
+    Handle->WriteStatus = drv->Ops.Write ? drv->Ops.Write(Handle->File, NULL, 0, &n) : STATUS_NOT_SUPPORTED;
+
+    FsDcacheLock(&irql);
+    c = Handle->Dentry->Cache;
+    if (!c) {
+        UINT64 size = 0;
+        FsDcacheUnlock(irql);
+        NTSTATUS st = drv->Ops.Seek(Handle->File, 0, FS_SEEK_END, &size);
+        if (!NT_SUCCESS(st)) return STATUS_SUCCESS;
+        fresh = (PFS_PAGE_CACHE)AuroraAllocateMemory(sizeof(FS_PAGE_CACHE));
+        if (!fresh) return STATUS_SUCCESS;
+        memset(fresh, 0, sizeof(*fresh));
+        AuroraInitializeSpinLock(&fresh->Lock);
+        fresh->FileSize = size;
+        FsDcacheLock(&irql);
+        c = Handle->Dentry->Cache;
+        if (!c) {
+            c = Handle->Dentry->Cache = fresh;
+            fresh = NULL;
+        }
+    }
+    c->OpenCount++;
+    FsDcacheUnlock(irql);
+    if (fresh) AuroraFreeMemory(fresh);
+    Handle->Cache = c;
+    Handle->Position = 0;
+    return STATUS_SUCCESS;
+}
+
+/* The last handle of a file writes its dirty pages back */
+NTSTATUS FsPageCacheDetach(IN PFS_HANDLE Handle)
+{
+    PFS_PAGE_CACHE c = Handle->Cache;
+    AURORA_IRQL irql;
+    NTSTATUS st = STATUS_SUCCESS;
+    BOOL last;
+
+    if (!c) return STATUS_SUCCESS;
+    FsDcacheLock(&irql);
+    last = --c->OpenCount == 0;
+    FsDcacheUnlock(irql);
+    if (last) {
+        st = FsPageCacheWriteback(Handle);
+        FsDcacheLock(&irql);
+        if (c->OpenCount == 0 && g_PageCacheStats.Pages > FS_PAGE_CACHE_HIGH_WATER) {
+            AURORA_IRQL cacheIrql;
+            AuroraAcquireSpinLock(&c->Lock, &cacheIrql);
+            FsPageCachePruneLocked(c, TRUE);
+            AuroraReleaseSpinLock(&c->Lock, cacheIrql);
+        }
+        FsDcacheUnlock(irql);
+    }
+    Handle->Cache = NULL;
+    return st;
+}
+
+/* Positional read; the handle position is the caller's business */
+NTSTATUS FsPageCacheRead(IN PFS_HANDLE Handle, IN UINT64 Offset, OUT PVOID Buffer, IN UINT64 Size, OUT PUINT64 BytesRead)
+{
+    PFS_PAGE_CACHE c = Handle->Cache;
+    UINT64 done = 0;
+
+    if (BytesRead) *BytesRead = 0;
+    if (!Buffer && Size) return STATUS_INVALID_PARAMETER;
+    if (Offset >= c->FileSize) return STATUS_SUCCESS;
+    if (Size > c->FileSize - Offset) Size = c->FileSize - Offset;
+
+    while (done < Size) {
+        UINT64 at = Offset + done;
+        UINT32 off = (UINT32)(at & (FS_PAGE_SIZE - 1));
+        UINT64 n = FS_PAGE_SIZE - off;
+        PVOID page;
+        NTSTATUS st;
+        if (n > Size - done) n = Size - done;
+        st = FsPageCacheFind(Handle, at >> FS_PAGE_SHIFT, FALSE, &page);
+        if (!NT_SUCCESS(st)) {
+            if (!done) return st;
+            break;
+        }
+        memcpy((UINT8*)Buffer + done, (UINT8*)page + off, (SIZE_T)n);
+        done += n;
+    }
+    if (BytesRead) *BytesRead = done;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS FsPageCacheWrite(IN PFS_HANDLE Handle, IN UINT64 Offset, IN PVOID Buffer, IN UINT64 Size, OUT PUINT64 BytesWritten)
+{
+    PFS_PAGE_CACHE c = Handle->Cache;
+    UINT64 done = 0;
+    AURORA_IRQL irql;
+
+    if (BytesWritten) *BytesWritten = 0;
+    if (!Buffer && Size) return STATUS_INVALID_PARAMETER;
+    if (!NT_SUCCESS(Handle->WriteStatus)) return Handle->WriteStatus;
+
+    while (done < Size) {
+        UINT64 at = Offset + done;
+        UINT64 index = at >> FS_PAGE_SHIFT;
+        UINT32 off = (UINT32)(at & (FS_PAGE_SIZE - 1));
+        UINT64 n = FS_PAGE_SIZE - off;
+        PVOID page;
+        NTSTATUS st;
+        if (n > Size - done) n = Size - done;
+        /* Nothing to preserve when the write covers the page or starts past EOF */
+        BOOL overwrite = (off == 0 && n == FS_PAGE_SIZE) || (index << FS_PAGE_SHIFT) >= c->FileSize;
+        st = FsPageCacheFind(Handle, index, overwrite, &page);
+        if (!NT_SUCCESS(st)) {
+            if (!done) return st;
+            break;
+        }
+        memcpy((UINT8*)page + off, (UINT8*)Buffer + done, (SIZE_T)n);
+        AuroraAcquireSpinLock(&c->Lock, &irql);
+        FsRadixTag(c, index, TRUE);
+        if (at + n > c->FileSize) c->FileSize = at + n;
+        AuroraReleaseSpinLock(&c->Lock, irql);
+        done += n;
+    }
+    if (BytesWritten) *BytesWritten = done;
+    return STATUS_SUCCESS;
+}
+
+/* Grow the cached size after the driver grew the file */
+void FsPageCacheExtend(IN PFS_HANDLE Handle, IN UINT64 Size)
+{
+    PFS_PAGE_CACHE c = Handle->Cache;
+    AURORA_IRQL irql;
+    if (!c) return;
+    AuroraAcquireSpinLock(&c->Lock, &irql);
+    if (Size > c->FileSize) c->FileSize = Size;
+    AuroraReleaseSpinLock(&c->Lock, irql);
+}
+
+/* Called with the dcache lock held when the owning dentry is retired */
+void FsPageCacheDestroy(IN PFS_PAGE_CACHE Cache)
+{
+    if (!Cache) return;
+    FsPageCachePruneLocked(Cache, FALSE);
+    AuroraFreeMemory(Cache);
+}
+
+void FsPageCacheQueryStats(OUT PFS_PAGE_CACHE_STATS Stats)
+{
+    if (Stats) *Stats = g_PageCacheStats;
+}
@@ -0,0 +1,111 @@
+/*
+ * Aurora Kernel - VFS directory enumeration
+ *
+ * A directory stream is an open handle on the directory plus the driver's
+ * cursor for the next entry. Each FsReadDir is one call into the driver,
+ * which packs as many FS_DIRENT records as the caller's buffer holds, type
+ * and size included, so listing a large directory costs a call per buffer
+ * rather than per name. What a cursor means is up to the driver; it only
+ * has to survive entries being added and removed around it.
+ */
+
+#include "../aurora.h"
+#include "../include/kern.h"
+#include "../include/fs.h"
+#include "vfs.h"
+
+typedef struct _FS_DIR_STREAM {
+    PFS_HANDLE Handle;
+    UINT64 Cursor;                  /* driver cursor of the next entry, 0 at the start */
+} FS_DIR_STREAM, *PFS_DIR_STREAM;
+
+/* Records start 8-byte aligned when Buffer is */
+BOOL FsPackDirent(OUT PVOID Buffer, IN UINT32 Size, IN OUT PUINT32 Used, IN PCSTR Name, IN UINT32 NameLength,
+                  IN UINT32 Type, IN UINT64 FileSize, IN UINT64 Cursor)
+{
+    UINT32 length = (FS_DIRENT_HEADER + NameLength + 1 + 7) & ~7u;
+    PFS_DIRENT d;
+    /* UTF-8 names may run past FS_NAME_MAX bytes; only RecordLength limits them */
+    if (!Buffer || !Used || NameLength > 0xFFFFu - FS_DIRENT_HEADER - 8 || *Used > Size || Size - *Used < length) return FALSE;
+    d = (PFS_DIRENT)((UINT8*)Buffer + *Used);
+    memset(d, 0, length);
+    d->Cursor = Cursor;
+    d->Size = FileSize;
+    d->RecordLength = (UINT16)length;
+    d->NameLength = (UINT16)NameLength;
+    d->Type = (UINT8)Type;
+    memcpy(d->Name, Name, NameLength);
+    *Used += length;
+    return TRUE;
+}
+
+NTSTATUS FsOpenDir(IN PCSTR Path, OUT FS_DIR* Dir)
+{
+    PFS_DIR_STREAM d;
+    PFS_HANDLE h;
+    UINT64 cursor = 0;
+    UINT32 used;
+    NTSTATUS st;
+
+    if (!Path || !Dir) return STATUS_INVALID_PARAMETER;
+    st = FsOpen(Path, &h);
+    /* Namespace directories with nothing mounted have no driver to ask */
+    if (st == STATUS_FILE_IS_A_DIRECTORY) return STATUS_NOT_SUPPORTED;
+    if (!NT_SUCCESS(st)) return st;
+    if (!h->Driver->Ops.ReadDir) {
+        FsClose(h);
+        return STATUS_NOT_SUPPORTED;
+    }
+    /* An empty batch lets the driver refuse anything but a directory */
+    st = h->Driver->Ops.ReadDir(h->File, &cursor, NULL, 0, &used);
+    if (!NT_SUCCESS(st) && st != STATUS_BUFFER_TOO_SMALL && st != STATUS_NO_MORE_ENTRIES) {
+        FsClose(h);
+        return st;
+    }
+    d = (PFS_DIR_STREAM)AuroraAllocateMemory(sizeof(FS_DIR_STREAM));
+    if (!d) {
+        FsClose(h);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    d->Handle = h;
+    d->Cursor = 0;
+    *Dir = d;
+    return STATUS_SUCCESS;
+}
+
+/* Like a handle's position, a stream's cursor is not shared safely between
+ * threads reading it at once */
+NTSTATUS FsReadDir(IN FS_DIR Dir, OUT PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesReturned)
+{
+    PFS_DIR_STREAM d = (PFS_DIR_STREAM)Dir;
+    UINT64 cursor;
+    UINT32 used = 0;
+    NTSTATUS st;
+
+    if (BytesReturned) *BytesReturned = 0;
+    if (!d || !BytesReturned || (!Buffer && Size)) return STATUS_INVALID_PARAMETER;
+    cursor = d->Cursor;
+    st = d->Handle->Driver->Ops.ReadDir(d->Handle->File, &cursor, Buffer, Size, &used);
+    if (!NT_SUCCESS(st)) return st;
+    d->Cursor = cursor;
+    *BytesReturned = used;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS FsSeekDir(IN FS_DIR Dir, IN UINT64 Cursor)
+{
+    PFS_DIR_STREAM d = (PFS_DIR_STREAM)Dir;
+    if (!d) return STATUS_INVALID_PARAMETER;
+    d->Cursor = Cursor;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS FsCloseDir(IN FS_DIR Dir)
+{
+    PFS_DIR_STREAM d = (PFS_DIR_STREAM)Dir;
+    NTSTATUS st;
+    if (!d) return STATUS_INVALID_PARAMETER;
+    st = FsClose(d->Handle);
+    AuroraFreeMemory(d);
+    return st;
+}
@@ -0,0 +1,920 @@
+/*
+ * Aurora Kernel - tmpfs, a RAM-backed file system
+ *
+ * Nothing here touches a device, which makes tmpfs both the scratch volume
+ * and the zero-I/O baseline for measuring the VFS itself. Each file keeps
+ * its pages in its own radix tree indexed by page number; holes are simply
+ * missing slots. Directories are chained hash tables that double when they
+ * fill, so lookups stay O(1) however large a directory grows; they also
+ * keep their entries in creation order, each stamped with a cookie that is
+ * never reused, which is what a ReadDir cursor names. Data pages
+ * count against the volume's size limit ("size=" at mount, in bytes with an
+ * optional k, m or g suffix).
+ *
+ * Pages can be pushed out to a swap or compression backend: TmpfsReclaim
+ * sweeps files with a second-chance clock, and a slot then holds the
+ * backend's token, marked by its low bit, until the page is touched again.
+ * The driver is not FS_DRIVER_CACHED; its pages would only be copied.
+ */
+#include "../../aurora.h"
+#include "../../include/kern.h"
+#include "../../include/fs.h"
+#include "../../include/mem.h"
+
+#define TMPFS_PAGE_SIZE         4096u
+#define TMPFS_PAGE_SHIFT        12
+#define TMPFS_RADIX_SHIFT       6
+#define TMPFS_RADIX_SLOTS       (1u << TMPFS_RADIX_SHIFT)
+#define TMPFS_DIR_MIN_BUCKETS   8       /* power of two */
+#define TMPFS_NAME_MAX          255
+#ifndef TMPFS_DEFAULT_MAX_PAGES
+#define TMPFS_DEFAULT_MAX_PAGES 16384   /* 64 MiB without a size= option */
+#endif
+
+/* A slot holding a backend token rather than a page */
+#define TMPFS_SWAPPED(Entry)    (((ULONG_PTR)(Entry)) & 1)
+#define TMPFS_SWAP_ENTRY(Slot)  ((PVOID)(ULONG_PTR)(((Slot) << 1) | 1))
+#define TMPFS_SWAP_SLOT(Entry)  (((UINT64)(ULONG_PTR)(Entry)) >> 1)
+
+typedef struct _TMPFS_RADIX_NODE {
+    PVOID Slots[TMPFS_RADIX_SLOTS];     /* child nodes, or page entries in the bottom level */
+    UINT64 Referenced;                  /* bottom level: pages touched since the clock passed */
+} TMPFS_RADIX_NODE, *PTMPFS_RADIX_NODE;
+
+typedef struct _TMPFS_INODE TMPFS_INODE, *PTMPFS_INODE;
+typedef struct _TMPFS_VOLUME TMPFS_VOLUME, *PTMPFS_VOLUME;
+
+typedef struct _TMPFS_DIRENT {
+    struct _TMPFS_DIRENT* Next;         /* hash chain */
+    struct _TMPFS_DIRENT* OrderPrev;    /* creation order, for enumeration */
+    struct _TMPFS_DIRENT* OrderNext;
+    UINT64 Cookie;
+    PTMPFS_INODE Inode;                 /* NULL for an enumeration marker */
+    UINT32 Hash;
+    UINT16 NameLength;
+    CHAR Name[1];
+} TMPFS_DIRENT, *PTMPFS_DIRENT;
+
+struct _TMPFS_INODE {
+    PTMPFS_INODE Prev;                  /* the volume's files, swept by reclaim */
+    PTMPFS_INODE Next;
+    PTMPFS_VOLUME Volume;
+    UINT32 RefCount;                    /* directory entry, VFS nodes and open files */
+    UINT32 OpenCount;
+    BOOL Linked;                        /* still named by a directory */
+    BOOL Directory;
+    UINT64 Size;
+    /* Files */
+    PTMPFS_RADIX_NODE Root;
+    UINT32 Height;                      /* levels below Root, 0 for an empty tree */
+    UINT64 Pages;                       /* resident and swapped */
+    /* Directories */
+    PTMPFS_DIRENT* Buckets;
+    UINT32 BucketCount;
+    UINT32 Entries;
+    PTMPFS_DIRENT First;                /* entries and markers in creation order */
+    PTMPFS_DIRENT Last;
+    UINT64 NextCookie;
+};
+
+struct _TMPFS_VOLUME {
+    PTMPFS_VOLUME Next;                 /* all mounted volumes, for reclaim */
+    AURORA_SPINLOCK Lock;
+    PTMPFS_INODE Root;
+    PTMPFS_INODE Files;
+    PTMPFS_INODE ClockHand;
+    UINT64 MaxPages;
+    UINT64 Pages;                       /* resident and swapped, against MaxPages */
+};
+
+typedef struct _TMPFS_FILE {
+    PTMPFS_INODE Inode;
+    UINT64 Position;
+    PTMPFS_DIRENT Marker;               /* directories: where the last ReadDir stopped */
+    BOOL MarkerLinked;
+} TMPFS_FILE, *PTMPFS_FILE;
+
+static PTMPFS_VOLUME g_TmpfsVolumes;
+static TMPFS_SWAP_BACKEND g_TmpfsSwap;
+static BOOL g_TmpfsHaveSwap;
+static AURORA_SPINLOCK g_TmpfsLock;     /* volume list and backend */
+static TMPFS_STATS g_TmpfsStats;
+
+/* ---------------------------------------------------------------------------
+ * File pages
+ * --------------------------------------------------------------------------- */
+
+static BOOL TmpfsRadixFits(UINT32 Height, UINT64 Index)
+{
+    return Height * TMPFS_RADIX_SHIFT >= 64 || (Index >> (Height * TMPFS_RADIX_SHIFT)) == 0;
+}
+
+static PTMPFS_RADIX_NODE TmpfsRadixAlloc(void)
+{
+    PTMPFS_RADIX_NODE n = (PTMPFS_RADIX_NODE)AuroraAllocateMemory(sizeof(TMPFS_RADIX_NODE));
+    if (n) memset(n, 0, sizeof(*n));
+    return n;
+}
+
+/* Bottom-level node for Index, built on demand when Create */
+static PTMPFS_RADIX_NODE TmpfsRadixLeaf(PTMPFS_INODE Inode, UINT64 Index, BOOL Create)
+{
+    PTMPFS_RADIX_NODE n;
+    if (!Create && (!Inode->Root || !TmpfsRadixFits(Inode->Height, Index))) return NULL;
+    if (!Inode->Root) {
+        Inode->Root = TmpfsRadixAlloc();
+        if (!Inode->Root) return NULL;
+        Inode->Height = 1;
+    }
+    while (!TmpfsRadixFits(Inode->Height, Index)) {
+        PTMPFS_RADIX_NODE top = TmpfsRadixAlloc();
+        if (!top) return NULL;
+        top->Slots[0] = Inode->Root;
+        Inode->Root = top;
+        Inode->Height++;
+    }
+    n = Inode->Root;
+    for (UINT32 level = Inode->Height; level > 1; level--) {
+        UINT32 slot = (UINT32)(Index >> ((level - 1) * TMPFS_RADIX_SHIFT)) & (TMPFS_RADIX_SLOTS - 1);
+        if (!n->Slots[slot]) {
+            if (!Create) return NULL;
+            n->Slots[slot] = TmpfsRadixAlloc();
+            if (!n->Slots[slot]) return NULL;
+        }
+        n = (PTMPFS_RADIX_NODE)n->Slots[slot];
+    }
+    return n;
+}
+
+static void TmpfsDropEntry(PTMPFS_VOLUME Vol, PVOID Entry)
+{
+    if (TMPFS_SWAPPED(Entry)) {
+        if (g_TmpfsHaveSwap && g_TmpfsSwap.Release) g_TmpfsSwap.Release(g_TmpfsSwap.Context, TMPFS_SWAP_SLOT(Entry));
+        g_TmpfsStats.SwappedPages--;
+    } else {
+        MemFreePages(Entry, 1);
+        g_TmpfsStats.Pages--;
+    }
+    Vol->Pages--;
+}
+
+static void TmpfsRadixFree(PTMPFS_VOLUME Vol, PTMPFS_RADIX_NODE N, UINT32 Level)
+{
+    for (UINT32 i = 0; i < TMPFS_RADIX_SLOTS; i++) {
+        if (!N->Slots[i]) continue;
+        if (Level == 1) {
+            TmpfsDropEntry(Vol, N->Slots[i]);
+        } else {
+            TmpfsRadixFree(Vol, (PTMPFS_RADIX_NODE)N->Slots[i], Level - 1);
+        }
+    }
+    AuroraFreeMemory(N);
+}
+
+/* Release every page of a file, done once it is unlinked and closed */
+static void TmpfsFreeData(PTMPFS_INODE Inode)
+{
+    if (Inode->Root) TmpfsRadixFree(Inode->Volume, Inode->Root, Inode->Height);
+    Inode->Root = NULL;
+    Inode->Height = 0;
+    Inode->Pages = 0;
+    Inode->Size = 0;
+}
+
+static NTSTATUS TmpfsSwapIn(PTMPFS_RADIX_NODE Leaf, UINT32 Slot)
+{
+    UINT64 token = TMPFS_SWAP_SLOT(Leaf->Slots[Slot]);
+    PVOID page;
+    NTSTATUS st;
+    if (!g_TmpfsHaveSwap) return STATUS_DISK_CORRUPT_ERROR;
+    page = MemAllocPages(1);
+    if (!page) return STATUS_INSUFFICIENT_RESOURCES;
+    st = g_TmpfsSwap.Load(g_TmpfsSwap.Context, token, page);
+    if (!NT_SUCCESS(st)) {
+        MemFreePages(page, 1);
+        return st;
+    }
+    if (g_TmpfsSwap.Release) g_TmpfsSwap.Release(g_TmpfsSwap.Context, token);
+    Leaf->Slots[Slot] = page;
+    g_TmpfsStats.SwappedPages--;
+    g_TmpfsStats.Pages++;
+    g_TmpfsStats.SwapIns++;
+    return STATUS_SUCCESS;
+}
+
+/* Resident page for Index, brought back from the backend if need be. A hole
+ * gives NULL unless Create, which allocates a zeroed page against the size
+ * limit. Called with the volume lock held. */
+static NTSTATUS TmpfsGetPage(PTMPFS_INODE Inode, UINT64 Index, BOOL Create, UINT8** Page)
+{
+    PTMPFS_VOLUME vol = Inode->Volume;
+    PTMPFS_RADIX_NODE leaf;
+    UINT32 slot = (UINT32)(Index & (TMPFS_RADIX_SLOTS - 1));
+    NTSTATUS st;
+
+    *Page = NULL;
+    if (Create && !TmpfsRadixLeaf(Inode, Index, FALSE) && vol->Pages >= vol->MaxPages) return STATUS_DISK_FULL;
+    leaf = TmpfsRadixLeaf(Inode, Index, Create);
+    if (!leaf) return Create ? STATUS_INSUFFICIENT_RESOURCES : STATUS_SUCCESS;
+    if (TMPFS_SWAPPED(leaf->Slots[slot])) {
+        st = TmpfsSwapIn(leaf, slot);
+        if (!NT_SUCCESS(st)) return st;
+    } else if (!leaf->Slots[slot] && Create) {
+        PVOID page;
+        if (vol->Pages >= vol->MaxPages) return STATUS_DISK_FULL;
+        page = MemAllocPages(1);
+        if (!page) return STATUS_INSUFFICIENT_RESOURCES;
+        memset(page, 0, TMPFS_PAGE_SIZE);
+        leaf->Slots[slot] = page;
+        vol->Pages++;
+        Inode->Pages++;
+        g_TmpfsStats.Pages++;
+    }
+    if (leaf->Slots[slot]) leaf->Referenced |= 1ull << slot;
+    *Page = (UINT8*)leaf->Slots[slot];
+    return STATUS_SUCCESS;
+}
+
+/* ---------------------------------------------------------------------------
+ * Reclaim
+ * --------------------------------------------------------------------------- */
+
+/* Push out pages below N not touched since the last sweep, giving the
+ * others a second chance. Returns FALSE once the backend refuses. */
+static BOOL TmpfsRadixReclaim(PTMPFS_RADIX_NODE N, UINT32 Level, UINT64 Want, PUINT64 Done)
+{
+    for (UINT32 i = 0; i < TMPFS_RADIX_SLOTS && *Done < Want; i++) {
+        PVOID entry = N->Slots[i];
+        UINT64 token;
+        if (!entry) continue;
+        if (Level > 1) {
+            if (!TmpfsRadixReclaim((PTMPFS_RADIX_NODE)entry, Level - 1, Want, Done)) return FALSE;
+            continue;
+        }
+        if (TMPFS_SWAPPED(entry)) continue;
+        if (N->Referenced & (1ull << i)) {
+            N->Referenced &= ~(1ull << i);
+            continue;
+        }
+        if (!NT_SUCCESS(g_TmpfsSwap.Store(g_TmpfsSwap.Context, entry, &token))) return FALSE;
+        N->Slots[i] = TMPFS_SWAP_ENTRY(token);
+        MemFreePages(entry, 1);
+        g_TmpfsStats.Pages--;
+        g_TmpfsStats.SwappedPages++;
+        g_TmpfsStats.SwapOuts++;
+        (*Done)++;
+    }
+    return TRUE;
+}
+
+static BOOL TmpfsReclaimVolume(PTMPFS_VOLUME Vol, UINT64 Want, PUINT64 Done)
+{
+    AURORA_IRQL irql;
+    BOOL more = TRUE;
+    AuroraAcquireSpinLock(&Vol->Lock, &irql);
+    /* Two laps: the first may only clear referenced bits */
+    for (UINT32 lap = 0; lap < 2 && more && *Done < Want && Vol->Files; lap++) {
+        PTMPFS_INODE start = Vol->ClockHand ? Vol->ClockHand : Vol->Files;
+        PTMPFS_INODE n = start;
+        do {
+            if (n->Root) more = TmpfsRadixReclaim(n->Root, n->Height, Want, Done);
+            n = n->Next ? n->Next : Vol->Files;
+        } while (n != start && more && *Done < Want);
+        Vol->ClockHand = n;
+    }
+    AuroraReleaseSpinLock(&Vol->Lock, irql);
+    return more;
+}
+
+NTSTATUS TmpfsSetSwapBackend(IN PTMPFS_SWAP_BACKEND Backend)
+{
+    AURORA_IRQL irql;
+    NTSTATUS st = STATUS_SUCCESS;
+    if (Backend && (!Backend->Store || !Backend->Load)) return STATUS_INVALID_PARAMETER;
+    AuroraAcquireSpinLock(&g_TmpfsLock, &irql);
+    if (g_TmpfsStats.SwappedPages) {
+        st = STATUS_DEVICE_BUSY; /* pages still live in the current backend */
+    } else if (Backend) {
+        g_TmpfsSwap = *Backend;
+        g_TmpfsHaveSwap = TRUE;
+    } else {
+        g_TmpfsHaveSwap = FALSE;
+    }
+    AuroraReleaseSpinLock(&g_TmpfsLock, irql);
+    return st;
+}
+
+/* Move up to Pages resident pages out to the backend; returns how many went */
+UINT64 TmpfsReclaim(IN UINT64 Pages)
+{
+    AURORA_IRQL irql;
+    UINT64 done = 0;
+    AuroraAcquireSpinLock(&g_TmpfsLock, &irql);
+    if (g_TmpfsHaveSwap) {
+        for (PTMPFS_VOLUME v = g_TmpfsVolumes; v && done < Pages; v = v->Next) {
+            if (!TmpfsReclaimVolume(v, Pages, &done)) break;
+        }
+    }
+    AuroraReleaseSpinLock(&g_TmpfsLock, irql);
+    return done;
+}
+
+void TmpfsQueryStats(OUT PTMPFS_STATS Stats)
+{
+    if (Stats) *Stats = g_TmpfsStats;
+}
+
+/* ---------------------------------------------------------------------------
+ * Inodes and directories
+ * --------------------------------------------------------------------------- */
+
+static PTMPFS_INODE TmpfsNewInode(PTMPFS_VOLUME Vol, BOOL Directory)
+{
+    PTMPFS_INODE n = (PTMPFS_INODE)AuroraAllocateMemory(sizeof(TMPFS_INODE));
+    if (!n) return NULL;
+    memset(n, 0, sizeof(*n));
+    n->Volume = Vol;
+    n->Directory = Directory;
+    if (Directory) {
+        n->Buckets = (PTMPFS_DIRENT*)AuroraAllocateMemory(TMPFS_DIR_MIN_BUCKETS * sizeof(PTMPFS_DIRENT));
+        if (!n->Buckets) {
+            AuroraFreeMemory(n);
+            return NULL;
+        }
+        memset(n->Buckets, 0, TMPFS_DIR_MIN_BUCKETS * sizeof(PTMPFS_DIRENT));
+        n->BucketCount = TMPFS_DIR_MIN_BUCKETS;
+    } else {
+        n->Next = Vol->Files;
+        if (Vol->Files) Vol->Files->Prev = n;
+        Vol->Files = n;
+    }
+    g_TmpfsStats.Inodes++;
+    return n;
+}
+
+static void TmpfsPutInode(PTMPFS_INODE Inode)
+{
+    PTMPFS_VOLUME vol = Inode->Volume;
+    if (--Inode->RefCount) return;
+    if (Inode->Directory) {
+        AuroraFreeMemory(Inode->Buckets);
+    } else {
+        TmpfsFreeData(Inode);
+        if (vol->ClockHand == Inode) vol->ClockHand = Inode->Next;
+        if (Inode->Prev) Inode->Prev->Next = Inode->Next; else vol->Files = Inode->Next;
+        if (Inode->Next) Inode->Next->Prev = Inode->Prev;
+    }
+    g_TmpfsStats.Inodes--;
+    AuroraFreeMemory(Inode);
+}
+
+static UINT32 TmpfsHashName(PCSTR Name, UINT32 Length)
+{
+    UINT32 h = 2166136261u;
+    for (UINT32 i = 0; i < Length; i++) {
+        h ^= (UINT8)Name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static PTMPFS_DIRENT* TmpfsDirFind(PTMPFS_INODE Dir, PCSTR Name, UINT32 Length, UINT32 Hash)
+{
+    PTMPFS_DIRENT* link = &Dir->Buckets[Hash & (Dir->BucketCount - 1)];
+    for (; *link; link = &(*link)->Next) {
+        PTMPFS_DIRENT e = *link;
+        if (e->Hash == Hash && e->NameLength == Length && memcmp(e->Name, Name, Length) == 0) break;
+    }
+    return link;
+}
+
+/* Double the table once it averages more than one entry per bucket */
+static void TmpfsDirGrow(PTMPFS_INODE Dir)
+{
+    UINT32 count = Dir->BucketCount * 2;
+    PTMPFS_DIRENT* buckets = (PTMPFS_DIRENT*)AuroraAllocateMemory(count * sizeof(PTMPFS_DIRENT));
+    if (!buckets) return; /* keep the longer chains */
+    memset(buckets, 0, count * sizeof(PTMPFS_DIRENT));
+    for (UINT32 b = 0; b < Dir->BucketCount; b++) {
+        PTMPFS_DIRENT e = Dir->Buckets[b];
+        while (e) {
+            PTMPFS_DIRENT next = e->Next;
+            e->Next = buckets[e->Hash & (count - 1)];
+            buckets[e->Hash & (count - 1)] = e;
+            e = next;
+        }
+    }
+    AuroraFreeMemory(Dir->Buckets);
+    Dir->Buckets = buckets;
+    Dir->BucketCount = count;
+}
+
+/* Insert E before Before in the directory's order list, or at the tail */
+static void TmpfsOrderLink(PTMPFS_INODE Dir, PTMPFS_DIRENT E, PTMPFS_DIRENT Before)
+{
+    E->OrderNext = Before;
+    E->OrderPrev = Before ? Before->OrderPrev : Dir->Last;
+    if (E->OrderPrev) E->OrderPrev->OrderNext = E; else Dir->First = E;
+    if (Before) Before->OrderPrev = E; else Dir->Last = E;
+}
+
+static void TmpfsOrderUnlink(PTMPFS_INODE Dir, PTMPFS_DIRENT E)
+{
+    if (E->OrderPrev) E->OrderPrev->OrderNext = E->OrderNext; else Dir->First = E->OrderNext;
+    if (E->OrderNext) E->OrderNext->OrderPrev = E->OrderPrev; else Dir->Last = E->OrderPrev;
+    E->OrderPrev = E->OrderNext = NULL;
+}
+
+static NTSTATUS TmpfsCheckName(PCSTR Name, UINT32 Length)
+{
+    if (!Name || !Length) return STATUS_INVALID_PARAMETER;
+    if (Length > TMPFS_NAME_MAX) return STATUS_NAME_TOO_LONG;
+    for (UINT32 i = 0; i < Length; i++) {
+        if (Name[i] == '/' || Name[i] == '\0') return STATUS_INVALID_PARAMETER;
+    }
+    return STATUS_SUCCESS;
+}
+
+/* Tear down a whole tree at unmount, whatever the reference counts say */
+static void TmpfsDestroyTree(PTMPFS_INODE Inode)
+{
+    if (Inode->Directory) {
+        for (UINT32 b = 0; b < Inode->BucketCount; b++) {
+            PTMPFS_DIRENT e = Inode->Buckets[b];
+            while (e) {
+                PTMPFS_DIRENT next = e->Next;
+                TmpfsDestroyTree(e->Inode);
+                AuroraFreeMemory(e);
+                e = next;
+            }
+        }
+    }
+    Inode->RefCount = 1;
+    TmpfsPutInode(Inode);
+}
+
+/* ---------------------------------------------------------------------------
+ * Volume operations
+ * --------------------------------------------------------------------------- */
+
+/* Options are comma separated; "size=N" takes a k, m or g suffix */
+static UINT64 TmpfsParseSize(PCSTR Options)
+{
+    while (Options && *Options) {
+        if (strncmp(Options, "size=", 5) == 0) {
+            UINT64 v = 0;
+            PCSTR p = Options + 5;
+            while (*p >= '0' && *p <= '9') v = v * 10 + (UINT64)(*p++ - '0');
+            if (*p == 'k' || *p == 'K') v <<= 10;
+            else if (*p == 'm' || *p == 'M') v <<= 20;
+            else if (*p == 'g' || *p == 'G') v <<= 30;
+            return (v + TMPFS_PAGE_SIZE - 1) >> TMPFS_PAGE_SHIFT;
+        }
+        while (*Options && *Options != ',') Options++;
+        if (*Options) Options++;
+    }
+    return TMPFS_DEFAULT_MAX_PAGES;
+}
+
+static NTSTATUS tmpfs_mount(IN PCSTR Device, IN PCSTR Options, OUT PVOID* VolumeCtx)
+{
+    PTMPFS_VOLUME vol;
+    AURORA_IRQL irql;
+    UNREFERENCED_PARAMETER(Device);
+    if (!VolumeCtx) return STATUS_INVALID_PARAMETER;
+    vol = (PTMPFS_VOLUME)AuroraAllocateMemory(sizeof(TMPFS_VOLUME));
+    if (!vol) return STATUS_INSUFFICIENT_RESOURCES;
+    memset(vol, 0, sizeof(*vol));
+    AuroraInitializeSpinLock(&vol->Lock);
+    vol->MaxPages = TmpfsParseSize(Options);
+    vol->Root = TmpfsNewInode(vol, TRUE);
+    if (!vol->Root) {
+        AuroraFreeMemory(vol);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    vol->Root->RefCount = 1; /* held by the volume */
+    vol->Root->Linked = TRUE;
+
+    AuroraAcquireSpinLock(&g_TmpfsLock, &irql);
+    vol->Next = g_TmpfsVolumes;
+    g_TmpfsVolumes = vol;
+    AuroraReleaseSpinLock(&g_TmpfsLock, irql);
+    *VolumeCtx = vol;
+    return STATUS_SUCCESS;
+}
+
+/* The VFS unmounts only once no handle or dentry refers to the volume */
+static NTSTATUS tmpfs_unmount(IN PVOID VolumeCtx)
+{
+    PTMPFS_VOLUME vol = (PTMPFS_VOLUME)VolumeCtx;
+    PTMPFS_VOLUME* link;
+    AURORA_IRQL irql;
+    if (!vol) return STATUS_INVALID_PARAMETER;
+    AuroraAcquireSpinLock(&g_TmpfsLock, &irql);
+    for (link = &g_TmpfsVolumes; *link && *link != vol; link = &(*link)->Next) {}
+    if (*link) *link = vol->Next;
+    TmpfsDestroyTree(vol->Root);
+    AuroraReleaseSpinLock(&g_TmpfsLock, irql);
+    AuroraFreeMemory(vol);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS TmpfsLookupLocked(PTMPFS_INODE Dir, PCSTR Name, UINT32 Length, PTMPFS_INODE* Inode)
+{
+    PTMPFS_DIRENT e;
+    if (!Dir->Directory) return STATUS_NOT_A_DIRECTORY;
+    if (Length > TMPFS_NAME_MAX) return STATUS_OBJECT_NAME_NOT_FOUND;
+    e = *TmpfsDirFind(Dir, Name, Length, TmpfsHashName(Name, Length));
+    if (!e) return STATUS_OBJECT_NAME_NOT_FOUND;
+    *Inode = e->Inode;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS tmpfs_lookup(IN PVOID VolumeCtx, IN PVOID DirNode, IN PCSTR Name, IN UINT32 NameLength, OUT PVOID* Node, OUT PUINT32 NodeFlags)
+{
+    PTMPFS_VOLUME vol = (PTMPFS_VOLUME)VolumeCtx;
+    PTMPFS_INODE inode;
+    AURORA_IRQL irql;
+    NTSTATUS st;
+    if (!vol || !Name || !Node || !NodeFlags) return STATUS_INVALID_PARAMETER;
+    AuroraAcquireSpinLock(&vol->Lock, &irql);
+    st = TmpfsLookupLocked(DirNode ? (PTMPFS_INODE)DirNode : vol->Root, Name, NameLength, &inode);
+    if (NT_SUCCESS(st)) {
+        inode->RefCount++;
+        *Node = inode;
+        *NodeFlags = inode->Directory ? FS_NODE_DIRECTORY : 0;
+    }
+    AuroraReleaseSpinLock(&vol->Lock, irql);
+    return st;
+}
+
+static void tmpfs_release_node(IN PVOID VolumeCtx, IN PVOID Node)
+{
+    PTMPFS_VOLUME vol = (PTMPFS_VOLUME)VolumeCtx;
+    AURORA_IRQL irql;
+    if (!vol || !Node) return;
+    AuroraAcquireSpinLock(&vol->Lock, &irql);
+    TmpfsPutInode((PTMPFS_INODE)Node);
+    AuroraReleaseSpinLock(&vol->Lock, irql);
+}
+
+static NTSTATUS tmpfs_create(IN PVOID VolumeCtx, IN PVOID DirNode, IN PCSTR Name, IN UINT32 NameLength, IN UINT32 NodeFlags, OUT PVOID* Node)
+{
+    PTMPFS_VOLUME vol = (PTMPFS_VOLUME)VolumeCtx;
+    PTMPFS_INODE dir, inode;
+    PTMPFS_DIRENT* link;
+    PTMPFS_DIRENT e;
+    AURORA_IRQL irql;
+    UINT32 hash;
+    NTSTATUS st;
+
+    if (!vol || !Node) return STATUS_INVALID_PARAMETER;
+    st = TmpfsCheckName(Name, NameLength);
+    if (!NT_SUCCESS(st)) return st;
+    dir = DirNode ? (PTMPFS_INODE)DirNode : vol->Root;
+    hash = TmpfsHashName(Name, NameLength);
+
+    AuroraAcquireSpinLock(&vol->Lock, &irql);
+    if (!dir->Directory || !dir->Linked) {
+        st = dir->Directory ? STATUS_OBJECT_NAME_NOT_FOUND : STATUS_NOT_A_DIRECTORY;
+    } else if (*TmpfsDirFind(dir, Name, NameLength, hash)) {
+        st = STATUS_OBJECT_NAME_COLLISION;
+    } else {
+        e = (PTMPFS_DIRENT)AuroraAllocateMemory(sizeof(TMPFS_DIRENT) + NameLength);
+        inode = e ? TmpfsNewInode(vol, (NodeFlags & FS_NODE_DIRECTORY) != 0) : NULL;
+        if (!inode) {
+            if (e) AuroraFreeMemory(e);
+            st = STATUS_INSUFFICIENT_RESOURCES;
+        } else {
+            inode->RefCount = 2; /* the directory entry and the caller's node */
+            inode->Linked = TRUE;
+            e->Inode = inode;
+            e->Cookie = ++dir->NextCookie; /* cursor 0 is the start */
+            e->Hash = hash;
+            e->NameLength = (UINT16)NameLength;
+            memcpy(e->Name, Name, NameLength);
+            e->Name[NameLength] = '\0';
+            if (dir->Entries >= dir->BucketCount) TmpfsDirGrow(dir);
+            link = &dir->Buckets[hash & (dir->BucketCount - 1)];
+            e->Next = *link;
+            *link = e;
+            TmpfsOrderLink(dir, e, NULL);
+            dir->Entries++;
+            *Node = inode;
+        }
+    }
+    AuroraReleaseSpinLock(&vol->Lock, irql);
+    return st;
+}
+
+static NTSTATUS tmpfs_remove(IN PVOID VolumeCtx, IN PVOID DirNode, IN PCSTR Name, IN UINT32 NameLength)
+{
+    PTMPFS_VOLUME vol = (PTMPFS_VOLUME)VolumeCtx;
+    PTMPFS_INODE dir, inode;
+    PTMPFS_DIRENT* link;
+    PTMPFS_DIRENT e;
+    AURORA_IRQL irql;
+    NTSTATUS st = STATUS_SUCCESS;
+
+    if (!vol || !Name) return STATUS_INVALID_PARAMETER;
+    dir = DirNode ? (PTMPFS_INODE)DirNode : vol->Root;
+    AuroraAcquireSpinLock(&vol->Lock, &irql);
+    link = dir->Directory ? TmpfsDirFind(dir, Name, NameLength, TmpfsHashName(Name, NameLength)) : NULL;
+    e = link ? *link : NULL;
+    if (!e) {
+        st = dir->Directory ? STATUS_OBJECT_NAME_NOT_FOUND : STATUS_NOT_A_DIRECTORY;
+    } else if (e->Inode->Directory && e->Inode->Entries) {
+        st = STATUS_DIRECTORY_NOT_EMPTY;
+    } else {
+        *link = e->Next;
+        TmpfsOrderUnlink(dir, e);
+        dir->Entries--;
+        inode = e->Inode;
+        inode->Linked = FALSE;
+        /* Open files keep their data until the last close */
+        if (!inode->Directory && !inode->OpenCount) TmpfsFreeData(inode);
+        TmpfsPutInode(inode);
+        AuroraFreeMemory(e);
+    }
+    AuroraReleaseSpinLock(&vol->Lock, irql);
+    return st;
+}
+
+/* ---------------------------------------------------------------------------
+ * File operations
+ * --------------------------------------------------------------------------- */
+
+static NTSTATUS TmpfsOpenInode(PTMPFS_VOLUME Vol, PTMPFS_INODE Inode, FS_FILE* File)
+{
+    PTMPFS_FILE file = (PTMPFS_FILE)AuroraAllocateMemory(sizeof(TMPFS_FILE));
+    if (!file) return STATUS_INSUFFICIENT_RESOURCES;
+    memset(file, 0, sizeof(*file));
+    file->Inode = Inode;
+    Inode->RefCount++;
+    Inode->OpenCount++;
+    *File = (FS_FILE)file;
+    UNREFERENCED_PARAMETER(Vol);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS tmpfs_open_node(IN PVOID VolumeCtx, IN PVOID Node, OUT FS_FILE* File)
+{
+    PTMPFS_VOLUME vol = (PTMPFS_VOLUME)VolumeCtx;
+    AURORA_IRQL irql;
+    NTSTATUS st;
+    if (!vol || !File) return STATUS_INVALID_PARAMETER;
+    AuroraAcquireSpinLock(&vol->Lock, &irql);
+    st = TmpfsOpenInode(vol, Node ? (PTMPFS_INODE)Node : vol->Root, File);
+    AuroraReleaseSpinLock(&vol->Lock, irql);
+    return st;
+}
+
+/* Whole-path open for callers that bypass the dentry cache */
+static NTSTATUS tmpfs_open(IN PVOID VolumeCtx, IN PCSTR Path, OUT FS_FILE* File)
+{
+    PTMPFS_VOLUME vol = (PTMPFS_VOLUME)VolumeCtx;
+    PTMPFS_INODE cur;
+    AURORA_IRQL irql;
+    NTSTATUS st = STATUS_SUCCESS;
+    if (!vol || !Path || !File) return STATUS_INVALID_PARAMETER;
+    AuroraAcquireSpinLock(&vol->Lock, &irql);
+    cur = vol->Root;
+    while (*Path && NT_SUCCESS(st)) {
+        PCSTR name;
+        while (*Path == '/') Path++;
+        name = Path;
+        while (*Path && *Path != '/') Path++;
+        if (Path > name) st = TmpfsLookupLocked(cur, name, (UINT32)(Path - name), &cur);
+    }
+    if (NT_SUCCESS(st)) st = TmpfsOpenInode(vol, cur, File);
+    AuroraReleaseSpinLock(&vol->Lock, irql);
+    return st;
+}
+
+static NTSTATUS tmpfs_close(IN FS_FILE File)
+{
+    PTMPFS_FILE file = (PTMPFS_FILE)File;
+    PTMPFS_INODE inode;
+    PTMPFS_VOLUME vol;
+    AURORA_IRQL irql;
+    if (!file) return STATUS_INVALID_PARAMETER;
+    inode = file->Inode;
+    vol = inode->Volume;
+    AuroraAcquireSpinLock(&vol->Lock, &irql);
+    if (file->MarkerLinked) TmpfsOrderUnlink(inode, file->Marker);
+    if (--inode->OpenCount == 0 && !inode->Linked && !inode->Directory) TmpfsFreeData(inode);
+    TmpfsPutInode(inode);
+    AuroraReleaseSpinLock(&vol->Lock, irql);
+    if (file->Marker) AuroraFreeMemory(file->Marker);
+    AuroraFreeMemory(file);
+    return STATUS_SUCCESS;
+}
+
+/* The cursor is the cookie to resume from. Each open directory parks a
+ * marker in the order list where its last batch stopped, so following on
+ * costs nothing and entries created or removed meanwhile cannot shift it;
+ * any other cursor is found by walking the list. */
+static NTSTATUS tmpfs_read_dir(IN FS_FILE File, IN OUT PUINT64 Cursor, OUT PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesReturned)
+{
+    PTMPFS_FILE file = (PTMPFS_FILE)File;
+    PTMPFS_INODE dir;
+    PTMPFS_DIRENT e;
+    AURORA_IRQL irql;
+    UINT64 cursor;
+    UINT32 used = 0;
+
+    if (BytesReturned) *BytesReturned = 0;
+    if (!file || !Cursor || !BytesReturned) return STATUS_INVALID_PARAMETER;
+    dir = file->Inode;
+    if (!dir->Directory) return STATUS_NOT_A_DIRECTORY;
+    if (!file->Marker) {
+        file->Marker = (PTMPFS_DIRENT)AuroraAllocateMemory(sizeof(TMPFS_DIRENT));
+        if (!file->Marker) return STATUS_INSUFFICIENT_RESOURCES;
+        memset(file->Marker, 0, sizeof(TMPFS_DIRENT));
+    }
+
+    AuroraAcquireSpinLock(&dir->Volume->Lock, &irql);
+    cursor = *Cursor;
+    if (file->MarkerLinked && file->Marker->Cookie == cursor) {
+        e = file->Marker->OrderNext;
+    } else {
+        for (e = dir->First; e && (!e->Inode || e->Cookie < cursor); e = e->OrderNext) {}
+    }
+    for (; e; e = e->OrderNext) {
+        PTMPFS_INODE inode = e->Inode;
+        if (!inode) continue;
+        if (!FsPackDirent(Buffer, Size, &used, e->Name, e->NameLength, inode->Directory ? FS_DT_DIRECTORY : FS_DT_FILE,
+                          inode->Directory ? 0 : inode->Size, e->Cookie + 1)) {
+            break;
+        }
+        cursor = e->Cookie + 1;
+    }
+    /* Park the marker before the first entry not returned */
+    if (file->MarkerLinked) TmpfsOrderUnlink(dir, file->Marker);
+    TmpfsOrderLink(dir, file->Marker, e);
+    file->Marker->Cookie = cursor;
+    file->MarkerLinked = TRUE;
+    AuroraReleaseSpinLock(&dir->Volume->Lock, irql);
+
+    if (!used) return e ? STATUS_BUFFER_TOO_SMALL : STATUS_NO_MORE_ENTRIES;
+    *Cursor = cursor;
+    *BytesReturned = used;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS tmpfs_read_at(IN FS_FILE File, IN UINT64 Offset, IN PFS_IO_SEGMENT Segments, IN UINT32 SegmentCount, OUT PUINT64 BytesRead)
+{
+    PTMPFS_FILE file = (PTMPFS_FILE)File;
+    PTMPFS_INODE inode;
+    AURORA_IRQL irql;
+    UINT64 done = 0;
+    NTSTATUS st = STATUS_SUCCESS;
+
+    if (BytesRead) *BytesRead = 0;
+    if (!file || (!Segments && SegmentCount)) return STATUS_INVALID_PARAMETER;
+    inode = file->Inode;
+    if (inode->Directory) return STATUS_FILE_IS_A_DIRECTORY;
+    for (UINT32 i = 0; i < SegmentCount; i++) {
+        if (!Segments[i].Buffer && Segments[i].Length) return STATUS_INVALID_PARAMETER;
+    }
+
+    AuroraAcquireSpinLock(&inode->Volume->Lock, &irql);
+    for (UINT32 i = 0; i < SegmentCount && NT_SUCCESS(st); i++) {
+        UINT8* out = (UINT8*)Segments[i].Buffer;
+        UINT64 len = Segments[i].Length;
+        while (len && Offset + done < inode->Size) {
+            UINT64 at = Offset + done;
+            UINT32 off = (UINT32)(at & (TMPFS_PAGE_SIZE - 1));
+            UINT64 n = TMPFS_PAGE_SIZE - off;
+            UINT8* page;
+            if (n > len) n = len;
+            if (n > inode->Size - at) n = inode->Size - at;
+            st = TmpfsGetPage(inode, at >> TMPFS_PAGE_SHIFT, FALSE, &page);
+            if (!NT_SUCCESS(st)) break;
+            if (page) memcpy(out, page + off, (SIZE_T)n); else memset(out, 0, (SIZE_T)n);
+            out += n;
+            len -= n;
+            done += n;
+        }
+        if (len) break;
+    }
+    AuroraReleaseSpinLock(&inode->Volume->Lock, irql);
+    if (!NT_SUCCESS(st) && !done) return st;
+    if (BytesRead) *BytesRead = done;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS tmpfs_write_at(IN FS_FILE File, IN UINT64 Offset, IN PFS_IO_SEGMENT Segments, IN UINT32 SegmentCount, OUT PUINT64 BytesWritten)
+{
+    PTMPFS_FILE file = (PTMPFS_FILE)File;
+    PTMPFS_INODE inode;
+    AURORA_IRQL irql;
+    UINT64 done = 0;
+    NTSTATUS st = STATUS_SUCCESS;
+
+    if (BytesWritten) *BytesWritten = 0;
+    if (!file || (!Segments && SegmentCount)) return STATUS_INVALID_PARAMETER;
+    inode = file->Inode;
+    if (inode->Directory) return STATUS_FILE_IS_A_DIRECTORY;
+    for (UINT32 i = 0; i < SegmentCount; i++) {
+        if (!Segments[i].Buffer && Segments[i].Length) return STATUS_INVALID_PARAMETER;
+    }
+
+    AuroraAcquireSpinLock(&inode->Volume->Lock, &irql);
+    for (UINT32 i = 0; i < SegmentCount && NT_SUCCESS(st); i++) {
+        UINT8* in = (UINT8*)Segments[i].Buffer;
+        UINT64 len = Segments[i].Length;
+        while (len) {
+            UINT64 at = Offset + done;
+            UINT32 off = (UINT32)(at & (TMPFS_PAGE_SIZE - 1));
+            UINT64 n = TMPFS_PAGE_SIZE - off;
+            UINT8* page;
+            if (n > len) n = len;
+            st = TmpfsGetPage(inode, at >> TMPFS_PAGE_SHIFT, TRUE, &page);
+            if (!NT_SUCCESS(st)) break;
+            memcpy(page + off, in, (SIZE_T)n);
+            in += n;
+            len -= n;
+            done += n;
+            if (Offset + done > inode->Size) inode->Size = Offset + done;
+        }
+    }
+    AuroraReleaseSpinLock(&inode->Volume->Lock, irql);
+    if (!NT_SUCCESS(st) && !done) return st;
+    if (BytesWritten) *BytesWritten = done;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS tmpfs_read(IN FS_FILE File, OUT PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesRead)
+{
+    PTMPFS_FILE file = (PTMPFS_FILE)File;
+    FS_IO_SEGMENT seg;
+    UINT64 done = 0;
+    NTSTATUS st;
+    if (BytesRead) *BytesRead = 0;
+    if (!file) return STATUS_INVALID_PARAMETER;
+    seg.Buffer = Buffer;
+    seg.Length = Size;
+    st = tmpfs_read_at(File, file->Position, &seg, 1, &done);
+    if (!NT_SUCCESS(st)) return st;
+    file->Position += done;
+    if (BytesRead) *BytesRead = (UINT32)done;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS tmpfs_write(IN FS_FILE File, IN PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesWritten)
+{
+    PTMPFS_FILE file = (PTMPFS_FILE)File;
+    FS_IO_SEGMENT seg;
+    UINT64 done = 0;
+    NTSTATUS st;
+    if (BytesWritten) *BytesWritten = 0;
+    if (!file) return STATUS_INVALID_PARAMETER;
+    seg.Buffer = Buffer;
+    seg.Length = Size;
+    st = tmpfs_write_at(File, file->Position, &seg, 1, &done);
+    if (!NT_SUCCESS(st)) return st;
+    file->Position += done;
+    if (BytesWritten) *BytesWritten = (UINT32)done;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS tmpfs_seek(IN FS_FILE File, IN INT64 Offset, IN UINT32 Origin, OUT PUINT64 NewPosition)
+{
+    PTMPFS_FILE file = (PTMPFS_FILE)File;
+    INT64 base;
+    if (!file) return STATUS_INVALID_PARAMETER;
+    switch (Origin) {
+        case FS_SEEK_SET: base = 0; break;
+        case FS_SEEK_CUR: base = (INT64)file->Position; break;
+        case FS_SEEK_END: base = (INT64)file->Inode->Size; break;
+        default: return STATUS_INVALID_PARAMETER;
+    }
+    if (base + Offset < 0) return STATUS_INVALID_PARAMETER;
+    file->Position = (UINT64)(base + Offset);
+    if (NewPosition) *NewPosition = file->Position;
+    return STATUS_SUCCESS;
+}
+
+void FsAdapterRegisterTmpfs(void)
+{
+    static FS_DRIVER drv = {0};
+    AuroraInitializeSpinLock(&g_TmpfsLock);
+    drv.Name = "tmpfs";
+    drv.Ops.Mount = tmpfs_mount;
+    drv.Ops.Unmount = tmpfs_unmount;
+    drv.Ops.Open = tmpfs_open;
+    drv.Ops.Close = tmpfs_close;
+    drv.Ops.Read = tmpfs_read;
+    drv.Ops.Write = tmpfs_write;
+    drv.Ops.Seek = tmpfs_seek;
+    drv.Ops.Lookup = tmpfs_lookup;
+    drv.Ops.OpenNode = tmpfs_open_node;
+    drv.Ops.ReleaseNode = tmpfs_release_node;
+    drv.Ops.ReadAt = tmpfs_read_at;
+    drv.Ops.WriteAt = tmpfs_write_at;
+    drv.Ops.Create = tmpfs_create;
+    drv.Ops.Remove = tmpfs_remove;
+    drv.Ops.ReadDir = tmpfs_read_dir;
+    FsRegisterDriver(&drv);
+}
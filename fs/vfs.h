@@ -0,0 +1,168 @@
+/*
+ * Aurora Kernel - VFS internals shared by the FS core and the dentry cache
+ */
+#ifndef _VFS_H_
+#define _VFS_H_
+
+#include "../aurora.h"
+#include "../include/fs.h"
+
+#ifndef FS_DCACHE_BUCKETS
+#define FS_DCACHE_BUCKETS       1024    /* power of two */
+#endif
+#ifndef FS_DCACHE_MAX_UNUSED
+#define FS_DCACHE_MAX_UNUSED    8192    /* unreferenced dentries cached before reuse; referenced ones are unbounded */
+#endif
+#define FS_DCACHE_CHUNK         64      /* dentries allocated per pool refill */
+#define FS_DENTRY_INLINE_NAME   40
+#define FS_NAME_MAX             255
+#define FS_PATH_MAX             1024    /* volume-relative path handed to whole-path drivers */
+#ifndef FS_MOUNT_HASH_BUCKETS
+#define FS_MOUNT_HASH_BUCKETS   256     /* initial size, power of two; doubled as mounts are added */
+#endif
+#ifndef FS_PAGE_CACHE_HIGH_WATER
+#define FS_PAGE_CACHE_HIGH_WATER 16384  /* cached pages before clean ones are dropped at last close */
+#endif
+#define FS_READAHEAD_PAGES      16
+#define FS_RADIX_SHIFT          6
+#define FS_RADIX_SLOTS          (1u << FS_RADIX_SHIFT)
+
+/* Dentry flags */
+#define FS_DENTRY_ROOT          0x0001
+#define FS_DENTRY_DIRECTORY     0x0002
+#define FS_DENTRY_NEGATIVE      0x0004  /* name known not to exist */
+#define FS_DENTRY_RESOLVED      0x0008  /* Node came from the driver's Lookup */
+#define FS_DENTRY_ON_LRU        0x0010
+#define FS_DENTRY_HASHED        0x0020
+
+/* RefCount value of a dentry or mount being recycled; lockless walkers back off */
+#define FS_DENTRY_DEAD          0x80000000u
+
+/* FsDcacheWalk flags */
+#define FS_WALK_CREATE          0x0001  /* create missing directories on the root namespace volume */
+
+typedef struct _FS_VOLUME FS_VOLUME, *PFS_VOLUME;
+typedef struct _FS_PAGE_CACHE FS_PAGE_CACHE, *PFS_PAGE_CACHE;
+
+/*
+ * A mounted file system instance. Dentries belong to a volume; mounts show
+ * a volume (or, for bind mounts, a subtree of it) somewhere in the tree.
+ * The volume stays alive while any mount refers to it.
+ */
+struct _FS_VOLUME {
+    PFS_DRIVER Driver;              /* NULL for the root namespace volume */
+    PVOID VolumeData;               /* driver volume context */
+    PFS_DENTRY Root;
+    UINT32 MountCount;
+};
+
+/*
+ * A volume attached to the tree. Mounts are hashed on (Parent, Mountpoint)
+ * so crossing is one probe per component that carries FS_DENTRY Mounted,
+ * however many mounts exist. Like dentries they are recycled, never freed.
+ */
+struct _FS_MOUNT {
+    struct _FS_MOUNT* HashNext;
+    struct _FS_MOUNT* Parent;       /* NULL for the namespace root */
+    PFS_DENTRY Mountpoint;          /* dentry of Parent covered by this mount */
+    PFS_DENTRY Root;                /* volume root, or the source dentry of a bind mount */
+    PFS_VOLUME Volume;
+    volatile UINT32 RefCount;       /* attachment, child mounts, handles and walks */
+    UINT32 Hash;
+};
+
+/*
+ * One path component of one mounted volume. Dentries live in a type-stable
+ * pool and are recycled rather than freed, so a lockless walker may read a
+ * stale one but never unmapped memory; the cache sequence count tells it to
+ * retry. RefCount counts open handles, child dentries and in-flight walks;
+ * unreferenced dentries sit on the LRU and are the only reclaim candidates.
+ */
+struct _FS_DENTRY {
+    struct _FS_DENTRY* HashNext;
+    struct _FS_DENTRY* Parent;      /* self for a volume root */
+    struct _FS_DENTRY* LruPrev;
+    struct _FS_DENTRY* LruNext;
+    PFS_VOLUME Volume;
+    PVOID Node;                     /* driver node, NULL for the root or unresolved names */
+    volatile UINT32 RefCount;
+    volatile UINT32 Mounted;        /* mounts attached to this dentry */
+    PFS_PAGE_CACHE Cache;           /* file data, created on first cached open */
+    volatile UINT32 Flags;
+    UINT32 Hash;
+    UINT16 NameLength;
+    PCHAR Name;                     /* InlineName or LongName */
+    PCHAR LongName;                 /* kept across recycling, never freed */
+    CHAR InlineName[FS_DENTRY_INLINE_NAME];
+};
+
+/* Open file at the VFS level */
+struct _FS_HANDLE {
+    PFS_MOUNT Mount;
+    PFS_DRIVER Driver;
+    FS_FILE File;
+    PFS_DENTRY Dentry;
+    PFS_PAGE_CACHE Cache;           /* NULL when I/O goes straight to the driver */
+    UINT64 Position;                /* cached handles only; the driver's own is scratch */
+    volatile UINT32 RefCount;       /* the opener and requests in flight */
+    NTSTATUS WriteStatus;           /* driver's answer to a zero-length write at open */
+};
+
+/*
+ * Per-file page cache: a radix tree of pages keyed by page index. Each node
+ * has a dirty tag bit per slot, set when anything below it is dirty, so
+ * writeback finds dirty pages without visiting clean subtrees.
+ */
+typedef struct _FS_RADIX_NODE {
+    PVOID Slots[FS_RADIX_SLOTS];    /* child nodes, or pages in the bottom level */
+    UINT64 DirtyTags;
+    UINT32 Count;                   /* occupied slots */
+} FS_RADIX_NODE, *PFS_RADIX_NODE;
+
+struct _FS_PAGE_CACHE {
+    PFS_RADIX_NODE Root;
+    UINT32 Height;                  /* levels below Root, 0 for an empty tree */
+    UINT32 OpenCount;               /* handles; the last close writes back */
+    UINT64 FileSize;
+    UINT64 Pages;
+    UINT64 DirtyPages;
+    AURORA_SPINLOCK Lock;
+};
+
+/* dcache.c */
+NTSTATUS FsDcacheInitialize(void);
+NTSTATUS FsDcacheCreateVolume(IN PFS_DRIVER Driver OPTIONAL, IN PVOID VolumeData, OUT PFS_VOLUME* Volume);
+NTSTATUS FsDcacheReleaseVolume(IN PFS_VOLUME Volume);
+NTSTATUS FsDcacheWalk(IN PCSTR Path, IN UINT32 Flags, OUT PFS_MOUNT* Mount, OUT PFS_DENTRY* Dentry);
+NTSTATUS FsDcacheBuildPath(IN PFS_DENTRY Dentry, OUT PCHAR Buffer, IN UINT32 Size);
+void     FsDcacheMarkNegative(IN PFS_DENTRY Dentry);
+void     FsDcacheInstantiate(IN PFS_DENTRY Parent, IN PCSTR Name, IN UINT32 Length, IN PVOID Node, IN UINT32 NodeFlags);
+void     FsDcacheRemoved(IN PFS_DENTRY Dentry);
+void     FsDcacheLock(OUT PAURORA_IRQL Irql);
+void     FsDcacheUnlock(IN AURORA_IRQL Irql);
+void     FsDcacheWriteBegin(void);
+void     FsDcacheWriteEnd(void);
+void     FsDentryGetLocked(IN PFS_DENTRY Dentry);
+void     FsDentryPutLocked(IN PFS_DENTRY Dentry);
+void     FsDentryPut(IN PFS_DENTRY Dentry);
+
+/* pagecache.c */
+NTSTATUS FsPageCacheAttach(IN PFS_HANDLE Handle);
+NTSTATUS FsPageCacheDetach(IN PFS_HANDLE Handle);
+NTSTATUS FsPageCacheRead(IN PFS_HANDLE Handle, IN UINT64 Offset, OUT PVOID Buffer, IN UINT64 Size, OUT PUINT64 BytesRead);
+NTSTATUS FsPageCacheWrite(IN PFS_HANDLE Handle, IN UINT64 Offset, IN PVOID Buffer, IN UINT64 Size, OUT PUINT64 BytesWritten);
+NTSTATUS FsPageCacheWriteback(IN PFS_HANDLE Handle);
+void     FsPageCacheExtend(IN PFS_HANDLE Handle, IN UINT64 Size);
+void     FsPageCacheDestroy(IN PFS_PAGE_CACHE Cache);
+
+/* mount.c */
+NTSTATUS  FsMountInitialize(void);
+PFS_MOUNT FsMountRoot(void);
+PFS_MOUNT FsMountLookup(IN PFS_MOUNT Parent, IN PFS_DENTRY Mountpoint);
+BOOL      FsMountTryGet(IN PFS_MOUNT Mount);
+void      FsMountGet(IN PFS_MOUNT Mount);
+void      FsMountPut(IN PFS_MOUNT Mount);
+NTSTATUS  FsMountAttach(IN PFS_VOLUME Volume, IN PFS_DENTRY Root, IN PCSTR Target);
+NTSTATUS  FsMountDetach(IN PCSTR Target, OUT PFS_VOLUME* Orphaned);
+
+#endif /* _VFS_H_ */
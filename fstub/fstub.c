@@ -99,6 +99,8 @@ static NTSTATUS StubFsOpen(IN PVOID VolumeCtx, IN PCSTR Path, OUT FS_FILE* File)
 static NTSTATUS StubFsClose(IN FS_FILE File);
 static NTSTATUS StubFsRead(IN FS_FILE File, OUT PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesRead);
 static NTSTATUS StubFsWrite(IN FS_FILE File, IN PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesWritten);
+static NTSTATUS StubFsLookup(IN PVOID VolumeCtx, IN PVOID DirNode, IN PCSTR Name, IN UINT32 NameLength, OUT PVOID* Node, OUT PUINT32 NodeFlags);
+static NTSTATUS StubFsOpenNode(IN PVOID VolumeCtx, IN PVOID Node, OUT FS_FILE* File);
 
 /* ---------------------------------------------------------------------------
  * Path Parsing
@@ -199,6 +201,44 @@ static NTSTATUS StubFsOpen(IN PVOID VolumeCtx, IN PCSTR Path, OUT FS_FILE* File)
     return STATUS_SUCCESS;
 }
 
+/* ---------------------------------------------------------------------------
+ * Node Operations
+ * ---------------------------------------------------------------------------
+ * With Lookup/OpenNode the VFS dentry cache resolves names one component at
+ * a time and, once a path is cached, opens it without calling back into the
+ * parser above. Nodes here are simply the file kind; a real driver would
+ * hand out a referenced in-memory inode and drop it in ReleaseNode.
+ */
+
+static NTSTATUS StubFsLookup(IN PVOID VolumeCtx, IN PVOID DirNode, IN PCSTR Name, IN UINT32 NameLength, OUT PVOID* Node, OUT PUINT32 NodeFlags)
+{
+    CHAR path[16];
+    if(!VolumeCtx || !Name || !Node || !NodeFlags) return STATUS_INVALID_PARAMETER;
+    if(DirNode) return STATUS_NOT_A_DIRECTORY; /* only the root is a directory */
+    if(NameLength + 2 > sizeof(path)) return STATUS_OBJECT_NAME_NOT_FOUND;
+    path[0] = '/';
+    memcpy(path + 1, Name, NameLength);
+    path[NameLength + 1] = '\0';
+    STUBFS_FILE_KIND kind = StubFsClassifyPath(path);
+    if(kind == StubFileUnknown) return STATUS_OBJECT_NAME_NOT_FOUND;
+    *Node = (PVOID)(ULONG_PTR)kind;
+    *NodeFlags = 0;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS StubFsOpenNode(IN PVOID VolumeCtx, IN PVOID Node, OUT FS_FILE* File)
+{
+    if(!VolumeCtx || !File) return STATUS_INVALID_PARAMETER;
+    if(!Node) return STATUS_FILE_IS_A_DIRECTORY; /* STUBFS_TODO: directory handles */
+    STUBFS_FCB* fcb = (STUBFS_FCB*)AuroraAllocateMemory(sizeof(STUBFS_FCB));
+    if(!fcb) return STATUS_INSUFFICIENT_RESOURCES;
+    memset(fcb,0,sizeof(*fcb));
+    fcb->Kind = (STUBFS_FILE_KIND)(ULONG_PTR)Node;
+    fcb->Volume = VolumeCtx;
+    *File = (FS_FILE)fcb;
+    return STATUS_SUCCESS;
+}
+
 static NTSTATUS StubFsClose(IN FS_FILE File)
 {
     if(!File) return STATUS_INVALID_PARAMETER;
@@ -314,6 +354,8 @@ static void StubFsPopulateDriverStruct(void)
     g_StubFsDriver.Ops.Close   = StubFsClose;
     g_StubFsDriver.Ops.Read    = StubFsRead;
     g_StubFsDriver.Ops.Write   = StubFsWrite;
+    g_StubFsDriver.Ops.Lookup  = StubFsLookup;
+    g_StubFsDriver.Ops.OpenNode = StubFsOpenNode;
 }
 
 NTSTATUS StubFsRegister(void)
@@ -1,6 +1,7 @@
 /* Aurora HAL generic layer */
 #include "../aurora.h"
 #include "../include/hal.h"
+#include "../include/acpi.h"
 
 /* Assembly helpers */
 extern UINT64 HalAsmReadTsc(void);
@@ -9,8 +10,37 @@ extern void HalAsmHalt(void);
 
 static UINT64 g_Freq = 1000000000ULL; /* placeholder 1GHz */
 
+/* Per-CPU block reached through GS so the I/O paths can read the processor
+ * number with one load instead of a CPUID (which traps to the hypervisor). */
+#define HAL_MAX_PROCESSORS 256
+#define HAL_MSR_GS_BASE    0xC0000101
+typedef struct _HAL_PROCESSOR_BLOCK {
+    struct _HAL_PROCESSOR_BLOCK* Self;
+    UINT32 Number;
+} HAL_PROCESSOR_BLOCK, *PHAL_PROCESSOR_BLOCK;
+static HAL_PROCESSOR_BLOCK g_ProcessorBlocks[HAL_MAX_PROCESSORS];
+static BOOL g_PerCpuReady = FALSE;
+
+/* Initial APIC id from CPUID.1:EBX[31:24] */
+static UINT32 HalReadInitialApicId(void){
+    UINT32 a=1, b, c=0, d;
+    __asm__ volatile ("cpuid" : "+a"(a), "=b"(b), "+c"(c), "=d"(d));
+    return b >> 24;
+}
+
+void HalInitializeProcessor(void){
+    UINT32 id = HalReadInitialApicId() % HAL_MAX_PROCESSORS;
+    PHAL_PROCESSOR_BLOCK blk = &g_ProcessorBlocks[id];
+    UINT64 base = (UINT64)(uintptr_t)blk;
+    blk->Self = blk;
+    blk->Number = id;
+    __asm__ volatile ("wrmsr" : : "c"(HAL_MSR_GS_BASE), "a"((UINT32)base), "d"((UINT32)(base >> 32)));
+    g_PerCpuReady = TRUE;
+}
+
 NTSTATUS HalInitialize(void){
     /* Could calibrate TSC vs PIT/APIC here */
+    HalInitializeProcessor();
     return STATUS_SUCCESS;
 }
 
@@ -23,8 +53,81 @@ UINT64 HalQueryPerformanceFrequency(void){ return g_Freq; }
 
 void HalCpuPause(void){ HalAsmPause(); }
 void HalCpuHalt(void){ HalAsmHalt(); }
+/* Initial APIC id, cached in the per-CPU block; good enough to spread per-CPU queues */
+UINT32 HalGetCurrentProcessorNumber(void){
+    UINT32 n;
+    if(!g_PerCpuReady) return HalReadInitialApicId();
+    __asm__ volatile ("movl %%gs:%c1,%0" : "=r"(n) : "i"(__builtin_offsetof(HAL_PROCESSOR_BLOCK,Number)));
+    return n;
+}
+
+/* Enabled local APICs in the MADT, or 1 without ACPI. CPUID.1 EBX[23:16]
+ * only sizes a package's APIC id space, so it is no CPU count. */
+UINT32 HalGetProcessorCount(void){
+    static UINT32 g_ProcessorCount;
+    if(!g_ProcessorCount){
+        UINT32 n = 0;
+        if(AcpiInitialize()) AcpiEnumerateLapics(NULL, 0, &n);
+        g_ProcessorCount = n ? n : 1;
+    }
+    return g_ProcessorCount;
+}
 
 UINT8 HalInByte(UINT16 Port){ UINT8 v; __asm__ volatile ("inb %1,%0" : "=a"(v) : "d"(Port)); return v; }
 void HalOutByte(UINT16 Port, UINT8 Value){ __asm__ volatile ("outb %0,%1" : : "a"(Value), "d"(Port)); }
+UINT16 HalInWord(UINT16 Port){ UINT16 v; __asm__ volatile ("inw %1,%0" : "=a"(v) : "d"(Port)); return v; }
+void HalOutWord(UINT16 Port, UINT16 Value){ __asm__ volatile ("outw %0,%1" : : "a"(Value), "d"(Port)); }
+UINT32 HalInDword(UINT16 Port){ UINT32 v; __asm__ volatile ("inl %1,%0" : "=a"(v) : "d"(Port)); return v; }
+void HalOutDword(UINT16 Port, UINT32 Value){ __asm__ volatile ("outl %0,%1" : : "a"(Value), "d"(Port)); }
+
+#define HAL_COM1 0x3F8
+static BOOL g_SerialReady = FALSE;
+
+void HalSerialInitialize(void){
+    HalOutByte(HAL_COM1+1, 0x00); /* no interrupts */
+    HalOutByte(HAL_COM1+3, 0x80); /* DLAB */
+    HalOutByte(HAL_COM1+0, 0x01); /* 115200 baud */
+    HalOutByte(HAL_COM1+1, 0x00);
+    HalOutByte(HAL_COM1+3, 0x03); /* 8N1 */
+    HalOutByte(HAL_COM1+2, 0xC7); /* FIFO on, cleared, 14-byte threshold */
+    HalOutByte(HAL_COM1+4, 0x03); /* DTR | RTS */
+    g_SerialReady = TRUE;
+}
+
+void HalSerialWriteString(PCSTR Text){
+    if(!Text) return;
+    if(!g_SerialReady) HalSerialInitialize();
+    for(; *Text; ++Text){
+        int spins = 100000;
+        if(*Text=='\n'){ while(!(HalInByte(HAL_COM1+5) & 0x20) && --spins); HalOutByte(HAL_COM1, '\r'); spins = 100000; }
+        while(!(HalInByte(HAL_COM1+5) & 0x20) && --spins);
+        HalOutByte(HAL_COM1, (UINT8)*Text);
+    }
+}
+
+#define HAL_CR0_MP         (1ULL<<1)
+#define HAL_CR0_EM         (1ULL<<2)
+#define HAL_CR0_TS         (1ULL<<3)
+#define HAL_CR4_OSFXSR     (1ULL<<9)
+#define HAL_CR4_OSXMMEXCPT (1ULL<<10)
+
+void HalSimdBegin(PHAL_SIMD_STATE State){
+    UINT64 cr0, cr4;
+    State->Interrupts = HalInterruptsEnabled();
+    HalDisableInterrupts();
+    __asm__ volatile ("mov %%cr0,%0" : "=r"(cr0));
+    __asm__ volatile ("mov %%cr4,%0" : "=r"(cr4));
+    State->Cr0 = cr0;
+    if(!(cr4 & HAL_CR4_OSFXSR)){ cr4 |= HAL_CR4_OSFXSR | HAL_CR4_OSXMMEXCPT; __asm__ volatile ("mov %0,%%cr4" : : "r"(cr4)); }
+    cr0 = (cr0 & ~(HAL_CR0_EM | HAL_CR0_TS)) | HAL_CR0_MP; /* clear TS so the save itself cannot fault */
+    __asm__ volatile ("mov %0,%%cr0" : : "r"(cr0));
+    __asm__ volatile ("fxsave %0" : "=m"(State->FxArea));
+}
+
+void HalSimdEnd(PHAL_SIMD_STATE State){
+    __asm__ volatile ("fxrstor %0" : : "m"(State->FxArea));
+    __asm__ volatile ("mov %0,%%cr0" : : "r"(State->Cr0));
+    if(State->Interrupts) HalEnableInterrupts();
+}
 
 void HalMemoryBarrier(void){ __sync_synchronize(); }
@@ -99,6 +99,8 @@ BOOL   AcpiGetLapicFlags(UINT8 apicId, UINT32* flagsOut);
 /* Internal use: physical mapping helper (arch must provide) */
 void* AcpiMapPhysical(UINT64 phys, UINT32 length);
 
+/* RSDP handed over by the loader (UEFI); tried before the BIOS area scan */
+void AcpiSetRsdpAddress(UINT64 phys);
 BOOL AcpiInitialize(void);
 const ACPI_TABLE_HEADER* AcpiFindTable(const CHAR Sig[4]);
 
@@ -4,7 +4,9 @@
 #ifndef _BOOT_PROTOCOL_H_
 #define _BOOT_PROTOCOL_H_
 
+#ifndef _AURORA_H_  /* the kernel gets the fixed-width types from aurora.h */
 #include <stdint.h>
+#endif
 
 #define AURORA_BOOT_MAGIC 0x41555241  // 'AURA'
 #define AURORA_BOOT_VERSION 1
@@ -59,6 +61,16 @@ typedef struct {
     char cmdline[256];                 // Kernel command line
 } aurora_boot_info_t;
 
+// Kernel entry point. Loaders are built with the host (SysV) compiler and
+// the kernel with mingw (Microsoft x64), so the entry pins SysV on both
+// sides and BootInfo arrives in RDI whichever compiler built the caller.
+#if defined(__x86_64__)
+#define AURORA_BOOT_ENTRY_ABI __attribute__((sysv_abi))
+#else
+#define AURORA_BOOT_ENTRY_ABI
+#endif
+typedef void (AURORA_BOOT_ENTRY_ABI *aurora_kernel_entry_t)(aurora_boot_info_t* boot_info);
+
 // Function prototypes for bootloader implementations
 void aurora_boot_prepare_memory_map(aurora_boot_info_t* boot_info);
 void aurora_boot_setup_graphics(aurora_boot_info_t* boot_info);
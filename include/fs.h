@@ -12,26 +12,113 @@ extern "C" {
 #endif
 
 /* Basic FS limits */
-#ifndef FS_MAX_MOUNTS
-#define FS_MAX_MOUNTS 16
-#endif
 #ifndef FS_MAX_DRIVERS
 #define FS_MAX_DRIVERS 8
 #endif
 
+/* File system status codes not in the core set */
+#ifndef STATUS_DEVICE_BUSY
+#define STATUS_DEVICE_BUSY              0x80000011
+#endif
+#ifndef STATUS_END_OF_FILE
+#define STATUS_END_OF_FILE              0xC0000011
+#endif
+#ifndef STATUS_DISK_CORRUPT_ERROR
+#define STATUS_DISK_CORRUPT_ERROR       0xC0000032
+#endif
+#ifndef STATUS_OBJECT_NAME_NOT_FOUND
+#define STATUS_OBJECT_NAME_NOT_FOUND    0xC0000034
+#endif
+#ifndef STATUS_DISK_FULL
+#define STATUS_DISK_FULL                0xC000007F
+#endif
+#ifndef STATUS_MEDIA_WRITE_PROTECTED
+#define STATUS_MEDIA_WRITE_PROTECTED    0xC00000A2
+#endif
+#ifndef STATUS_FILE_IS_A_DIRECTORY
+#define STATUS_FILE_IS_A_DIRECTORY      0xC00000BA
+#endif
+#ifndef STATUS_DIRECTORY_NOT_EMPTY
+#define STATUS_DIRECTORY_NOT_EMPTY      0xC0000101
+#endif
+#ifndef STATUS_NOT_A_DIRECTORY
+#define STATUS_NOT_A_DIRECTORY          0xC0000103
+#endif
+#ifndef STATUS_NAME_TOO_LONG
+#define STATUS_NAME_TOO_LONG            0xC0000106
+#endif
+#ifndef STATUS_UNRECOGNIZED_VOLUME
+#define STATUS_UNRECOGNIZED_VOLUME      0xC000014F
+#endif
+#ifndef STATUS_FILE_TOO_LARGE
+#define STATUS_FILE_TOO_LARGE           0xC0000904
+#endif
+
+/* Seek origins */
+#define FS_SEEK_SET 0
+#define FS_SEEK_CUR 1
+#define FS_SEEK_END 2
+
 /* Forward decls */
 typedef struct _FS_DRIVER FS_DRIVER, *PFS_DRIVER;
 typedef struct _FS_MOUNT FS_MOUNT, *PFS_MOUNT;
 
 /* File handle (opaque) */
 typedef PVOID FS_FILE;
+/* Directory stream from FsOpenDir (opaque) */
 typedef PVOID FS_DIR;
 
-typedef struct _FS_MOUNT {
-    CHAR Name[32];
-    PVOID FsDriver;   /* placeholder */
-    PVOID VolumeData; /* placeholder */
-} FS_MOUNT, *PFS_MOUNT;
+/* VFS objects (see fs/vfs.h) */
+typedef struct _FS_DENTRY FS_DENTRY, *PFS_DENTRY;
+typedef struct _FS_HANDLE FS_HANDLE, *PFS_HANDLE;
+
+/* Lookup node flags */
+#define FS_NODE_DIRECTORY   0x0001
+
+/* Directory entry types */
+#define FS_DT_UNKNOWN       0
+#define FS_DT_FILE          1
+#define FS_DT_DIRECTORY     2
+
+/* One entry of a directory batch. Entries are packed back to back, each
+ * RecordLength bytes (a multiple of 8) with a NUL-terminated Name. Cursor
+ * resumes enumeration just after the entry. */
+typedef struct _FS_DIRENT {
+    UINT64 Cursor;
+    UINT64 Size;                    /* file size in bytes, 0 for directories */
+    UINT16 RecordLength;
+    UINT16 NameLength;
+    UINT8  Type;                    /* FS_DT_* */
+    UINT8  Reserved[3];
+    CHAR   Name[1];
+} FS_DIRENT, *PFS_DIRENT;
+
+#define FS_DIRENT_HEADER    24      /* offset of Name */
+
+/* One buffer of a vectored transfer */
+typedef struct _FS_IO_SEGMENT {
+    PVOID Buffer;
+    UINT64 Length;
+} FS_IO_SEGMENT, *PFS_IO_SEGMENT;
+
+/* Asynchronous request majors */
+#define FS_IO_READ          0
+#define FS_IO_WRITE         1
+
+/* Asynchronous positional transfer. The submitter owns the structure and
+ * its segments until Complete runs; Information is the byte count. */
+typedef struct _FS_IO_REQUEST {
+    UINT32 Major;                   /* FS_IO_READ or FS_IO_WRITE */
+    UINT32 SegmentCount;
+    PFS_IO_SEGMENT Segments;
+    UINT64 Offset;
+    NTSTATUS Status;                /* STATUS_PENDING until completion */
+    UINT64 Information;
+    void (*Complete)(struct _FS_IO_REQUEST* Request);
+    PVOID Context;
+    PFS_HANDLE Handle;              /* set by FsSubmitIo */
+    struct _FS_IO_REQUEST* Next;    /* queue link */
+} FS_IO_REQUEST, *PFS_IO_REQUEST;
 
 NTSTATUS FsInitialize(void);
 NTSTATUS FsShutdown(void);
@@ -45,18 +132,146 @@ typedef struct _FS_DRIVER_OPS {
     NTSTATUS (*Close)(IN FS_FILE File);
     NTSTATUS (*Read)(IN FS_FILE File, OUT PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesRead);
     NTSTATUS (*Write)(IN FS_FILE File, IN PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesWritten);
+    NTSTATUS (*Seek)(IN FS_FILE File, IN INT64 Offset, IN UINT32 Origin, OUT PUINT64 NewPosition OPTIONAL);
+    /* Optional per-component resolution. Drivers that provide these let the
+     * dentry cache walk paths itself; DirNode/Node NULL is the volume root.
+     * Node references stay valid until ReleaseNode. Without them the VFS
+     * passes whole paths to Open and caches only negative results. */
+    NTSTATUS (*Lookup)(IN PVOID VolumeCtx, IN PVOID DirNode OPTIONAL, IN PCSTR Name, IN UINT32 NameLength, OUT PVOID* Node, OUT PUINT32 NodeFlags);
+    NTSTATUS (*OpenNode)(IN PVOID VolumeCtx, IN PVOID Node OPTIONAL, OUT FS_FILE* File);
+    void     (*ReleaseNode)(IN PVOID VolumeCtx, IN PVOID Node);
+    /* Optional positional, vectored transfers. The file position is neither
+     * used nor moved, so callers sharing a file need not serialize, and a
+     * segment may be larger than 4 GiB. */
+    NTSTATUS (*ReadAt)(IN FS_FILE File, IN UINT64 Offset, IN PFS_IO_SEGMENT Segments, IN UINT32 SegmentCount, OUT PUINT64 BytesRead);
+    NTSTATUS (*WriteAt)(IN FS_FILE File, IN UINT64 Offset, IN PFS_IO_SEGMENT Segments, IN UINT32 SegmentCount, OUT PUINT64 BytesWritten);
+    /* Optional asynchronous submission for uncached files. Success means the
+     * request will be reported later through FsCompleteIo. */
+    NTSTATUS (*Submit)(IN FS_FILE File, IN PFS_IO_REQUEST Request);
+    /* Optional namespace changes for drivers with Lookup. Create returns a
+     * referenced node as Lookup does; Remove refuses non-empty directories. */
+    NTSTATUS (*Create)(IN PVOID VolumeCtx, IN PVOID DirNode OPTIONAL, IN PCSTR Name, IN UINT32 NameLength, IN UINT32 NodeFlags, OUT PVOID* Node);
+    NTSTATUS (*Remove)(IN PVOID VolumeCtx, IN PVOID DirNode OPTIONAL, IN PCSTR Name, IN UINT32 NameLength);
+    /* Optional batched enumeration of a file opened on a directory. Packs
+     * whole entries from *Cursor (0 = first) with FsPackDirent and advances
+     * *Cursor past the last one. A cursor stays valid while entries are
+     * added or removed elsewhere in the directory. NO_MORE_ENTRIES at the
+     * end, BUFFER_TOO_SMALL when not even one entry fits. */
+    NTSTATUS (*ReadDir)(IN FS_FILE File, IN OUT PUINT64 Cursor, OUT PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesReturned);
+    /* Optional preallocation of backing store for [Offset, Offset + Length),
+     * growing the file to cover it unless Flags has FS_ALLOCATE_KEEP_SIZE.
+     * The page cache also calls it with KEEP_SIZE for the dirty range before
+     * writeback, so the driver can place that range in one piece. */
+    NTSTATUS (*Allocate)(IN FS_FILE File, IN UINT64 Offset, IN UINT64 Length, IN UINT32 Flags);
 } FS_DRIVER_OPS, *PFS_DRIVER_OPS;
 
+/* Driver flags */
+#define FS_DRIVER_CACHED    0x0001  /* file data goes through the VFS page cache; needs Seek */
+
 /* Driver descriptor */
 struct _FS_DRIVER {
     PCSTR Name;          /* e.g., "fat32", "exfat", "ntfs" */
     FS_DRIVER_OPS Ops;
+    UINT32 Flags;        /* FS_DRIVER_* */
 };
 
 /* VFS API */
 NTSTATUS FsRegisterDriver(IN PFS_DRIVER Driver);
-NTSTATUS FsMount(IN PCSTR Device, IN PCSTR FsType, IN PCSTR MountName, IN PCSTR Options OPTIONAL);
-NTSTATUS FsUnmount(IN PCSTR MountName);
+/* Mount points are paths in the single namespace tree; a bare name such as
+ * "c" means "/c". Missing directories on the root namespace are created,
+ * and volumes may be mounted on directories of other volumes. */
+NTSTATUS FsMount(IN PCSTR Device, IN PCSTR FsType, IN PCSTR MountPath, IN PCSTR Options OPTIONAL);
+NTSTATUS FsBindMount(IN PCSTR SourcePath, IN PCSTR TargetPath);
+NTSTATUS FsUnmount(IN PCSTR MountPath);
+
+/* File API. Paths are absolute in the namespace tree. */
+NTSTATUS FsOpen(IN PCSTR Path, OUT PFS_HANDLE* Handle);
+NTSTATUS FsClose(IN PFS_HANDLE Handle);
+NTSTATUS FsRead(IN PFS_HANDLE Handle, OUT PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesRead);
+NTSTATUS FsWrite(IN PFS_HANDLE Handle, IN PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesWritten);
+NTSTATUS FsSeek(IN PFS_HANDLE Handle, IN INT64 Offset, IN UINT32 Origin, OUT PUINT64 NewPosition OPTIONAL);
+NTSTATUS FsFlush(IN PFS_HANDLE Handle);
+/* Create a file, or a directory when Flags has FS_NODE_DIRECTORY, and
+ * optionally open the new file. Remove leaves open handles usable. */
+NTSTATUS FsCreate(IN PCSTR Path, IN UINT32 Flags, OUT PFS_HANDLE* Handle OPTIONAL);
+NTSTATUS FsRemove(IN PCSTR Path);
+
+/* Directory enumeration. Each FsReadDir fills Buffer with as many packed
+ * FS_DIRENT records as fit; FsSeekDir takes 0 or a Cursor from a record. */
+NTSTATUS FsOpenDir(IN PCSTR Path, OUT FS_DIR* Dir);
+NTSTATUS FsReadDir(IN FS_DIR Dir, OUT PVOID Buffer, IN UINT32 Size, OUT PUINT32 BytesReturned);
+NTSTATUS FsSeekDir(IN FS_DIR Dir, IN UINT64 Cursor);
+NTSTATUS FsCloseDir(IN FS_DIR Dir);
+/* For drivers' ReadDir: append one record at *Used, FALSE if it does not fit */
+BOOL     FsPackDirent(OUT PVOID Buffer, IN UINT32 Size, IN OUT PUINT32 Used, IN PCSTR Name, IN UINT32 NameLength,
+                      IN UINT32 Type, IN UINT64 FileSize, IN UINT64 Cursor);
+
+/* Positional and vectored I/O. The handle position is left alone; a short
+ * count with success means end of file or an error after some data. */
+NTSTATUS FsReadAt(IN PFS_HANDLE Handle, IN UINT64 Offset, OUT PVOID Buffer, IN UINT64 Size, OUT PUINT64 BytesRead);
+NTSTATUS FsWriteAt(IN PFS_HANDLE Handle, IN UINT64 Offset, IN PVOID Buffer, IN UINT64 Size, OUT PUINT64 BytesWritten);
+NTSTATUS FsReadV(IN PFS_HANDLE Handle, IN UINT64 Offset, IN PFS_IO_SEGMENT Segments, IN UINT32 SegmentCount, OUT PUINT64 BytesRead);
+NTSTATUS FsWriteV(IN PFS_HANDLE Handle, IN UINT64 Offset, IN PFS_IO_SEGMENT Segments, IN UINT32 SegmentCount, OUT PUINT64 BytesWritten);
+
+/* Reserve space for [Offset, Offset + Length) so later writes there cannot
+ * run out of it. The file grows to cover the range unless KEEP_SIZE is set;
+ * drivers may give back kept space nothing was written to at close. */
+#define FS_ALLOCATE_KEEP_SIZE   0x0001
+NTSTATUS FsAllocate(IN PFS_HANDLE Handle, IN UINT64 Offset, IN UINT64 Length, IN UINT32 Flags);
+
+/* Asynchronous I/O. Requests go to the driver's Submit when it has one,
+ * else to the VFS I/O workers once started, else they complete before
+ * FsSubmitIo returns. The handle stays open until completion. */
+NTSTATUS FsSubmitIo(IN PFS_HANDLE Handle, IN PFS_IO_REQUEST Request);
+void     FsCompleteIo(IN PFS_IO_REQUEST Request, IN NTSTATUS Status, IN UINT64 Information);
+NTSTATUS FsStartIoWorkers(IN UINT32 Count);
+
+/* Dentry cache */
+typedef struct _FS_DCACHE_STATS {
+    UINT32 Dentries;        /* live (hashed) dentries */
+    UINT32 Negative;        /* of which negative */
+    UINT64 FastWalks;       /* walks completed without the lock */
+    UINT64 SlowWalks;       /* walks that fell back to the locked path */
+    UINT64 DriverLookups;   /* per-component lookups sent to drivers */
+    UINT64 NegativeHits;    /* opens failed from a negative dentry */
+    UINT64 Reclaimed;       /* dentries recycled from the LRU */
+} FS_DCACHE_STATS, *PFS_DCACHE_STATS;
+
+void FsDcacheQueryStats(OUT PFS_DCACHE_STATS Stats);
+
+/* Page cache */
+typedef struct _FS_PAGE_CACHE_STATS {
+    UINT64 Pages;           /* cached file pages */
+    UINT64 DirtyPages;
+    UINT64 Hits;            /* pages found in the cache */
+    UINT64 Misses;          /* pages read from the driver */
+    UINT64 DriverReads;     /* driver reads, each filling up to FS_READAHEAD_PAGES pages */
+    UINT64 WritebackPages;
+} FS_PAGE_CACHE_STATS, *PFS_PAGE_CACHE_STATS;
+
+void FsPageCacheQueryStats(OUT PFS_PAGE_CACHE_STATS Stats);
+
+/* tmpfs. Reclaimed pages go to the swap backend, which hands back a slot
+ * token (below 2^63) to Load them by later; Release drops a slot no longer
+ * needed. The backend can only be changed while nothing is swapped out. */
+typedef struct _TMPFS_SWAP_BACKEND {
+    NTSTATUS (*Store)(IN PVOID Context, IN PVOID Page, OUT PUINT64 Slot);
+    NTSTATUS (*Load)(IN PVOID Context, IN UINT64 Slot, OUT PVOID Page);
+    void (*Release)(IN PVOID Context, IN UINT64 Slot);     /* optional */
+    PVOID Context;
+} TMPFS_SWAP_BACKEND, *PTMPFS_SWAP_BACKEND;
+
+typedef struct _TMPFS_STATS {
+    UINT64 Pages;           /* resident data pages */
+    UINT64 SwappedPages;    /* pages held by the swap backend */
+    UINT64 SwapOuts;
+    UINT64 SwapIns;
+    UINT64 Inodes;
+} TMPFS_STATS, *PTMPFS_STATS;
+
+NTSTATUS TmpfsSetSwapBackend(IN PTMPFS_SWAP_BACKEND Backend OPTIONAL);
+UINT64 TmpfsReclaim(IN UINT64 Pages);
+void TmpfsQueryStats(OUT PTMPFS_STATS Stats);
 
 /* Built-in adapter registration helpers */
 void FsRegisterBuiltInDrivers(void);
@@ -8,5 +8,6 @@
 #define AURORA_FS_ENABLE_FAT32 1
 #define AURORA_FS_ENABLE_EXFAT 1
 #define AURORA_FS_ENABLE_NTFS  1
+#define AURORA_FS_ENABLE_TMPFS 1
 
 #endif /* _FS_CONFIG_H_ */
@@ -5,6 +5,7 @@
 
 /* Initialization */
 NTSTATUS HalInitialize(void);
+void HalInitializeProcessor(void); /* per CPU, before it issues I/O */
 
 /* Interrupt controller */
 void HalEnableInterrupts(void);
@@ -18,10 +19,32 @@ UINT64 HalQueryPerformanceFrequency(void);
 /* CPU */
 void HalCpuPause(void);
 void HalCpuHalt(void);
+UINT32 HalGetCurrentProcessorNumber(void);
+UINT32 HalGetProcessorCount(void);
 
 /* I/O Ports (legacy x86) */
 UINT8 HalInByte(UINT16 Port);
 void HalOutByte(UINT16 Port, UINT8 Value);
+UINT16 HalInWord(UINT16 Port);
+void HalOutWord(UINT16 Port, UINT16 Value);
+UINT32 HalInDword(UINT16 Port);
+void HalOutDword(UINT16 Port, UINT32 Value);
+
+/* Debug serial port (COM1) */
+void HalSerialInitialize(void);
+void HalSerialWriteString(PCSTR Text);
+
+/* Kernel SIMD regions. The kernel is built without SSE, so code that wants
+ * vector registers brackets them with Begin/End: interrupts are held off and
+ * the interrupted x87/SSE state is saved to State and restored afterwards. */
+typedef struct _HAL_SIMD_STATE {
+    UINT8  FxArea[512] __attribute__((aligned(16)));
+    UINT64 Cr0;
+    UINT32 Interrupts;
+} HAL_SIMD_STATE, *PHAL_SIMD_STATE;
+
+void HalSimdBegin(PHAL_SIMD_STATE State);
+void HalSimdEnd(PHAL_SIMD_STATE State);
 
 /* Memory barriers */
 void HalMemoryBarrier(void);
@@ -74,7 +74,10 @@ enum {
     IO_BLOCK_TYPE_SCSI,
     IO_BLOCK_TYPE_NVME,
     IO_BLOCK_TYPE_SDCARD,
-    IO_BLOCK_TYPE_VIRTIO_BLK
+    IO_BLOCK_TYPE_VIRTIO_BLK,
+    IO_BLOCK_TYPE_RAMDISK,
+    IO_BLOCK_TYPE_RAID,
+    IO_BLOCK_TYPE_MAX
 };
 
 /* HID minor types */
@@ -97,15 +100,126 @@ NTSTATUS IoRegisterDisplayDriver(void);
 NTSTATUS IoRegisterAudioDriver(void);
 NTSTATUS IoRegisterPosixVfsLayer(void); /* pseudo-driver for POSIX path translation */
 
+/* Block device extension (DeviceExtension of every IO_DEVICE_CLASS_BLOCK device) */
+typedef struct _BLOCK_DEVICE_EXTENSION {
+    UINT32 BlockSize;
+    UINT64 BlockCount;
+    UINT32 BlockType;  /* IO_BLOCK_TYPE_* */
+    UINT32 Features;   /* BLOCK_FEATURE_* advertised by the driver */
+    UINT32 CacheMode;  /* BLOCK_CACHE_* */
+    UINT32 QueueCount; /* hardware submission/completion queue pairs (0 = synchronous only) */
+    UINT32 MaxTransferBlocks; /* largest single command (0 = unlimited); the block layer splits */
+    PVOID  DriverContext;
+} BLOCK_DEVICE_EXTENSION, *PBLOCK_DEVICE_EXTENSION;
+
+/* Request flags passed to block rw handlers (bit 0 keeps the old BOOL Write meaning) */
+#define BLOCK_IO_WRITE            0x00000001
+#define BLOCK_IO_FUA              0x00000002  /* forced unit access: data on media before completion */
+
+/* Driver features */
+#define BLOCK_FEATURE_FUA         0x00000001  /* handler honours BLOCK_IO_FUA natively */
+#define BLOCK_FEATURE_FLUSH       0x00000002  /* device has a volatile write cache */
+
+/* Cache modes */
+#define BLOCK_CACHE_NONE          0  /* every request goes straight to the driver */
+#define BLOCK_CACHE_WRITETHROUGH  1  /* reads cached, writes synchronous */
+#define BLOCK_CACHE_WRITEBACK     2  /* writes dirty the cache, flushed in the background */
+
+typedef NTSTATUS (*PBLOCK_RW)(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer, UINT32 Flags);
+typedef NTSTATUS (*PBLOCK_FLUSH)(PAIO_DEVICE_OBJECT Dev);
+
+/* Asynchronous request for the multi-queue path. The submitter owns the
+ * structure until Complete runs; Queue is chosen by the block layer. */
+typedef struct _BLOCK_REQUEST {
+    UINT64 Lba;
+    UINT32 Count;
+    UINT32 Flags;            /* BLOCK_IO_* */
+    PVOID  Buffer;
+    NTSTATUS Status;
+    UINT32 Queue;
+    UINT64 SubmitTime;       /* HalQueryPerformanceCounter() */
+    UINT64 CompleteTime;
+    void (*Complete)(struct _BLOCK_REQUEST* Req);
+    PVOID  Context;
+    PAIO_DEVICE_OBJECT Device;
+    struct _BLOCK_REQUEST* Next; /* driver queue link */
+} BLOCK_REQUEST, *PBLOCK_REQUEST;
+
+/* Queue a request on hardware queue Req->Queue; completion is reported later via BlockCompleteRequest */
+typedef NTSTATUS (*PBLOCK_SUBMIT)(PAIO_DEVICE_OBJECT Dev, PBLOCK_REQUEST Req);
+/* Reap up to Budget completions from one queue (interrupt handler or polling loop) */
+typedef UINT32 (*PBLOCK_POLL)(PAIO_DEVICE_OBJECT Dev, UINT32 Queue, UINT32 Budget);
+
 /* Block layer API */
 NTSTATUS BlockSubsystemInitialize(void);
+NTSTATUS BlockRegisterRwHandler(UINT32 BlockType, PBLOCK_RW Fn);
+NTSTATUS BlockRegisterFlushHandler(UINT32 BlockType, PBLOCK_FLUSH Fn);
+NTSTATUS BlockRegisterQueueHandlers(UINT32 BlockType, PBLOCK_SUBMIT Submit, PBLOCK_POLL Poll);
+NTSTATUS BlockSubmitRequest(PAIO_DEVICE_OBJECT Dev, PBLOCK_REQUEST Req);
+UINT32   BlockPollCompletions(PAIO_DEVICE_OBJECT Dev, UINT32 Budget);
+void     BlockCompleteRequest(PBLOCK_REQUEST Req, NTSTATUS Status);
 NTSTATUS BlockRead(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer);
 NTSTATUS BlockWrite(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer);
+NTSTATUS BlockWriteEx(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer, UINT32 Flags);
+NTSTATUS BlockFlush(PAIO_DEVICE_OBJECT Dev);
+NTSTATUS BlockBarrier(PAIO_DEVICE_OBJECT Dev);
+NTSTATUS BlockSetCacheMode(PAIO_DEVICE_OBJECT Dev, UINT32 Mode);
+/* Uncached path used by the cache itself and by drivers stacked on other block devices */
+NTSTATUS BlockSubmitDirect(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer, UINT32 Flags);
+NTSTATUS BlockFlushDirect(PAIO_DEVICE_OBJECT Dev);
+
+/* Block buffer cache (io/bcache.c) */
+NTSTATUS BlockCacheInitialize(void);
+NTSTATUS BlockCacheRead(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer);
+NTSTATUS BlockCacheWrite(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer, UINT32 Flags);
+NTSTATUS BlockCacheFlushDevice(PAIO_DEVICE_OBJECT Dev);
+NTSTATUS BlockCacheInvalidateDevice(PAIO_DEVICE_OBJECT Dev);
+void     BlockCacheWritebackTick(void);
+NTSTATUS BlockCacheStartWriteback(void);
+
+/* Sparse RAM disk (kern/drivers/storage/ramdisk.c) */
+NTSTATUS RamDiskInitialize(void);
+PAIO_DEVICE_OBJECT RamDiskGetDevice(UINT32 Index); /* ram<Index>, NULL past ramdisk_count */
+
+/* Software RAID over the RAM disks (kern/drivers/storage/raid.c, engine in storage_rust.rs) */
+NTSTATUS RaidInitialize(void);
+PAIO_DEVICE_OBJECT RaidGetDevice(void); /* md0, NULL unless raid= was given */
+
+/* In-kernel block benchmark (io/blkbench.c) */
+#define BLOCK_BENCH_SEQUENTIAL    0
+#define BLOCK_BENCH_RANDOM        1
+
+typedef struct _BLOCK_BENCH_PARAMS {
+    UINT32 Pattern;          /* BLOCK_BENCH_* */
+    UINT32 ReadPercent;      /* 0..100, remainder are writes */
+    UINT32 QueueDepth;       /* outstanding requests */
+    UINT32 BlockBytes;       /* request size, multiple of device block size */
+    UINT64 TotalOps;         /* requests to complete */
+    UINT64 StartLba;
+    UINT64 RangeBlocks;      /* 0 = whole device from StartLba */
+    UINT64 Seed;
+} BLOCK_BENCH_PARAMS, *PBLOCK_BENCH_PARAMS;
+
+typedef struct _BLOCK_BENCH_RESULT {
+    UINT64 Ops;
+    UINT64 Errors;
+    UINT64 Bytes;
+    UINT64 ElapsedNs;
+    UINT64 Iops;
+    UINT64 BytesPerSec;
+    UINT64 LatMinNs, LatAvgNs, LatMaxNs;
+    UINT64 LatP50Ns, LatP90Ns, LatP99Ns, LatP999Ns;
+} BLOCK_BENCH_RESULT, *PBLOCK_BENCH_RESULT;
+
+NTSTATUS BlockBenchRun(PAIO_DEVICE_OBJECT Dev, PBLOCK_BENCH_PARAMS Params, PBLOCK_BENCH_RESULT Result);
+void     BlockBenchReport(PCSTR Label, PBLOCK_BENCH_PARAMS Params, PBLOCK_BENCH_RESULT Result);
+NTSTATUS BlockBenchRunStandardSuite(PAIO_DEVICE_OBJECT Dev);
 
 /* Registration */
 NTSTATUS IoRegisterDriver(IN PAIO_DRIVER_OBJECT Driver);
 NTSTATUS IoCreateDevice(IN PAIO_DRIVER_OBJECT Driver, IN PCHAR Name, IN UINT32 Type, OUT PAIO_DEVICE_OBJECT* DeviceOut);
 NTSTATUS IoDeleteDevice(IN PAIO_DEVICE_OBJECT Device);
+PAIO_DEVICE_OBJECT IoGetDeviceByName(IN PCSTR Name);
 NTSTATUS IoDriverInitialize(PAIO_DRIVER_OBJECT Driver, const char* Name);
 
 /* IRP lifecycle */
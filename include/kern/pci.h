@@ -0,0 +1,45 @@
+/* Aurora PCI bus interface for function drivers */
+#ifndef _AURORA_PCI_H_
+#define _AURORA_PCI_H_
+
+#include "../../aurora.h"
+
+#define PCI_CAP_ID_VNDR         0x09
+#define PCI_CAP_ID_MSIX         0x11
+
+typedef struct _pci_device {
+    UINT32 bus;
+    UINT32 device;
+    UINT32 function;
+    UINT32 vendor_id;
+    UINT32 device_id;
+    UINT32 class_code;
+    UINT32 revision;
+    UINT64 bar[6];
+    UINT32 irq;
+    UINT32 msi_enabled;
+    UINT32 msix_enabled;
+    UINT8 capabilities[256];
+    struct _pci_device* next;
+} pci_device_t;
+
+void PCIDriverInitialize(void);
+
+/* Lookup; pass the previous match as 'after' to continue (NULL starts over) */
+pci_device_t* pci_find_device(UINT16 vendor_id, UINT16 device_id);
+pci_device_t* pci_find_next(pci_device_t* after, UINT16 vendor_id, UINT16 device_id);
+pci_device_t* pci_find_class(UINT32 class_code);
+
+/* Configuration space */
+UINT32 pci_read_config32(pci_device_t* dev, UINT32 offset);
+UINT16 pci_read_config16(pci_device_t* dev, UINT32 offset);
+UINT8  pci_read_config8(pci_device_t* dev, UINT32 offset);
+void   pci_write_config32(pci_device_t* dev, UINT32 offset, UINT32 value);
+void   pci_write_config16(pci_device_t* dev, UINT32 offset, UINT16 value);
+void   pci_write_config8(pci_device_t* dev, UINT32 offset, UINT8 value);
+
+/* Returns the config offset of the next capability with cap_id after 'pos' (0 = from the list head), or 0 */
+UINT8  pci_next_capability(pci_device_t* dev, UINT8 pos, UINT8 cap_id);
+void   pci_enable_bus_master(pci_device_t* dev);
+
+#endif
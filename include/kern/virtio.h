@@ -0,0 +1,109 @@
+/* Aurora virtio 1.x support: modern PCI transport and virtqueues */
+#ifndef _AURORA_VIRTIO_H_
+#define _AURORA_VIRTIO_H_
+
+#include "../../aurora.h"
+#include "pci.h"
+
+#define VIRTIO_PCI_VENDOR               0x1AF4
+#define VIRTIO_PCI_MODERN_BASE          0x1040   /* modern device id = 0x1040 + virtio id */
+#define VIRTIO_ID_BLOCK                 2
+
+/* Device status */
+#define VIRTIO_STATUS_ACKNOWLEDGE       0x01
+#define VIRTIO_STATUS_DRIVER            0x02
+#define VIRTIO_STATUS_DRIVER_OK         0x04
+#define VIRTIO_STATUS_FEATURES_OK       0x08
+#define VIRTIO_STATUS_NEEDS_RESET       0x40
+#define VIRTIO_STATUS_FAILED            0x80
+
+/* Transport feature bits */
+#define VIRTIO_RING_F_INDIRECT_DESC     28
+#define VIRTIO_RING_F_EVENT_IDX         29
+#define VIRTIO_F_VERSION_1              32
+#define VIRTIO_F_RING_PACKED            34
+
+#define VIRTIO_BIT(b)                   (1ull << (b))
+
+/* Descriptor flags (shared by split and packed layouts) */
+#define VIRTQ_DESC_F_NEXT               0x0001
+#define VIRTQ_DESC_F_WRITE              0x0002
+#define VIRTQ_DESC_F_INDIRECT           0x0004
+#define VIRTQ_DESC_F_AVAIL              0x0080   /* packed only */
+#define VIRTQ_DESC_F_USED               0x8000   /* packed only */
+
+#define VIRTQ_MAX_SIZE                  256
+#define VIRTQ_MAX_INDIRECT              16       /* entries per indirect table */
+
+typedef struct _VIRTIO_PCI_DEVICE {
+    pci_device_t* Pci;
+    volatile UINT8* Common;      /* struct virtio_pci_common_cfg */
+    volatile UINT8* Notify;
+    volatile UINT8* Isr;
+    volatile UINT8* DeviceCfg;
+    UINT32 NotifyMultiplier;
+    UINT64 Features;             /* negotiated */
+    UINT32 Irq;
+} VIRTIO_PCI_DEVICE, *PVIRTIO_PCI_DEVICE;
+
+/* Scatter/gather element handed to VirtqAdd */
+typedef struct _VIRTQ_SG {
+    UINT64 Addr;                 /* bus address */
+    UINT32 Len;
+    BOOL   DeviceWrites;
+} VIRTQ_SG, *PVIRTQ_SG;
+
+typedef struct _VIRTQUEUE {
+    PVIRTIO_PCI_DEVICE Dev;
+    UINT16 Index;
+    UINT16 Size;
+    BOOL   Packed;
+    BOOL   EventIdx;
+    BOOL   Indirect;
+    volatile UINT16* NotifyAddr;
+    AURORA_SPINLOCK Lock;        /* held by the driver around Add/Kick/GetUsed */
+    BOOL   IntrEnabled;
+    UINT16 NumFree;
+    UINT16 NumAdded;             /* made available since the last kick */
+    PVOID  Tokens[VIRTQ_MAX_SIZE];
+    UINT16 ChainLen[VIRTQ_MAX_SIZE];
+    UINT8* IndirectPool;         /* VIRTQ_MAX_INDIRECT descriptors per id */
+    /* split ring */
+    volatile UINT8* Desc;
+    volatile UINT16* AvailFlags; volatile UINT16* AvailIdx; volatile UINT16* AvailRing; volatile UINT16* UsedEvent;
+    volatile UINT16* UsedFlags;  volatile UINT16* UsedIdx;  volatile UINT32* UsedRing;  volatile UINT16* AvailEvent;
+    UINT16 FreeHead;
+    UINT16 AvailShadow;
+    UINT16 LastUsed;
+    /* packed ring */
+    volatile UINT16* DriverEvent;  /* off_wrap, flags */
+    volatile UINT16* DeviceEvent;
+    UINT16 NextAvail;
+    BOOL   AvailWrap;
+    BOOL   UsedWrap;
+    UINT16 FreeIds[VIRTQ_MAX_SIZE];
+    UINT16 FreeIdCount;
+} VIRTQUEUE, *PVIRTQUEUE;
+
+/* Transport */
+NTSTATUS VirtioPciAttach(pci_device_t* Pci, PVIRTIO_PCI_DEVICE Dev);
+NTSTATUS VirtioPciNegotiate(PVIRTIO_PCI_DEVICE Dev, UINT64 Wanted);
+UINT16   VirtioPciQueueCount(PVIRTIO_PCI_DEVICE Dev);
+NTSTATUS VirtioPciSetupQueue(PVIRTIO_PCI_DEVICE Dev, UINT16 Index, UINT16 MaxSize, PVIRTQUEUE Vq);
+void     VirtioPciDriverOk(PVIRTIO_PCI_DEVICE Dev);
+void     VirtioPciFail(PVIRTIO_PCI_DEVICE Dev);
+UINT8    VirtioPciReadIsr(PVIRTIO_PCI_DEVICE Dev);
+UINT32   VirtioPciConfigGeneration(PVIRTIO_PCI_DEVICE Dev);
+
+/* Virtqueue (split or packed, chosen at setup). Callers serialise access with Vq->Lock. */
+NTSTATUS VirtqInitialize(PVIRTQUEUE Vq, UINT16 Size, UINT64* DescPa, UINT64* DriverPa, UINT64* DevicePa);
+NTSTATUS VirtqAdd(PVIRTQUEUE Vq, PVIRTQ_SG Sg, UINT32 Count, PVOID Token);
+void     VirtqKick(PVIRTQUEUE Vq);
+PVOID    VirtqGetUsed(PVIRTQUEUE Vq, UINT32* Len);
+void     VirtqDisableInterrupts(PVIRTQUEUE Vq);
+BOOL     VirtqEnableInterrupts(PVIRTQUEUE Vq);  /* FALSE if buffers were used meanwhile */
+
+/* Drivers */
+NTSTATUS VirtioBlkInitialize(void);
+
+#endif
@@ -54,6 +54,9 @@ typedef struct _MEMORY_STATISTICS {
     UINT64 HeapBytesFreed;
 } MEMORY_STATISTICS, *PMEMORY_STATISTICS;
 
+/* VAD Types */
+#define MEM_VAD_PRIVATE      1
+
 /* Virtual Address Descriptor */
 typedef struct _VIRTUAL_ADDRESS_DESCRIPTOR {
     PVOID BaseAddress;
@@ -0,0 +1,370 @@
+/* Block buffer cache with write-back support
+ *
+ * Buffers are one device block each, hashed by (device, lba) and kept on an
+ * LRU list. In BLOCK_CACHE_WRITEBACK mode writes only dirty the buffer; the
+ * writeback tick flushes a device once its oldest dirty buffer has aged past
+ * BCACHE_DIRTY_EXPIRE or the global dirty count crosses the high-water mark.
+ * Flushing sorts the device's dirty buffers by LBA and coalesces contiguous
+ * runs into one driver request each, so many small metadata writes become a
+ * few large ones. FUA writes bypass the dirty state and go straight down.
+ */
+#include "../aurora.h"
+#include "../include/io.h"
+#include "../include/kern.h"
+
+#ifndef BCACHE_MAX_BUFFERS
+#define BCACHE_MAX_BUFFERS        512
+#endif
+#define BCACHE_HASH_BUCKETS       256
+#define BCACHE_STAGING_BYTES      (64*1024)   /* largest coalesced write */
+#define BCACHE_DIRTY_EXPIRE       3000        /* system time ticks before a dirty buffer must go out */
+#define BCACHE_DIRTY_HIGH_WATER   (BCACHE_MAX_BUFFERS/2)
+#define BCACHE_WRITEBACK_INTERVAL 500         /* ms between writeback thread passes */
+
+#define BCACHE_BUF_VALID          0x1
+#define BCACHE_BUF_DIRTY          0x2
+#define BCACHE_BUF_WRITEBACK      0x4         /* copied to staging, write in flight */
+
+typedef struct _BCACHE_BUFFER {
+    PAIO_DEVICE_OBJECT Device;
+    UINT64 Lba;
+    UINT32 Flags;
+    UINT32 Size;
+    UINT64 DirtyTime;
+    UINT8* Data;
+    struct _BCACHE_BUFFER* HashNext;
+    struct _BCACHE_BUFFER* LruPrev;
+    struct _BCACHE_BUFFER* LruNext;
+    struct _BCACHE_BUFFER* DirtyPrev;
+    struct _BCACHE_BUFFER* DirtyNext;
+} BCACHE_BUFFER, *PBCACHE_BUFFER;
+
+static PBCACHE_BUFFER g_BcacheHash[BCACHE_HASH_BUCKETS];
+static PBCACHE_BUFFER g_LruHead, g_LruTail;     /* head = most recently used */
+static PBCACHE_BUFFER g_DirtyHead, g_DirtyTail; /* oldest dirty buffer at head */
+static PBCACHE_BUFFER g_FreeList;
+static UINT32 g_BufferCount, g_DirtyCount;
+static UINT8* g_Staging;
+static PBCACHE_BUFFER g_SortScratch[BCACHE_MAX_BUFFERS];
+static AURORA_SPINLOCK g_BcacheLock;
+static AURORA_SPINLOCK g_FlushLock;   /* one flusher at a time: owns g_Staging and g_SortScratch */
+static BOOL g_BcacheReady = FALSE;
+static BOOL g_WritebackThread = FALSE;     /* aging runs inline from BlockCacheWrite until set */
+
+static UINT32 BcacheHash(PAIO_DEVICE_OBJECT Dev, UINT64 Lba){
+    UINT64 h = ((UINT64)(uintptr_t)Dev >> 4) ^ (Lba * 0x9E3779B97F4A7C15ULL);
+    return (UINT32)(h >> 32) & (BCACHE_HASH_BUCKETS-1);
+}
+
+static void LruUnlink(PBCACHE_BUFFER b){
+    if(b->LruPrev) b->LruPrev->LruNext=b->LruNext; else g_LruHead=b->LruNext;
+    if(b->LruNext) b->LruNext->LruPrev=b->LruPrev; else g_LruTail=b->LruPrev;
+    b->LruPrev=b->LruNext=NULL;
+}
+static void LruPushFront(PBCACHE_BUFFER b){
+    b->LruPrev=NULL; b->LruNext=g_LruHead;
+    if(g_LruHead) g_LruHead->LruPrev=b; else g_LruTail=b;
+    g_LruHead=b;
+}
+
+static void DirtyLink(PBCACHE_BUFFER b){
+    b->Flags |= BCACHE_BUF_DIRTY;
+    b->DirtyTime = AuroraGetSystemTime();
+    b->DirtyNext=NULL; b->DirtyPrev=g_DirtyTail;
+    if(g_DirtyTail) g_DirtyTail->DirtyNext=b; else g_DirtyHead=b;
+    g_DirtyTail=b; g_DirtyCount++;
+}
+static void DirtyUnlink(PBCACHE_BUFFER b){
+    if(!(b->Flags & BCACHE_BUF_DIRTY)) return;
+    if(b->DirtyPrev) b->DirtyPrev->DirtyNext=b->DirtyNext; else g_DirtyHead=b->DirtyNext;
+    if(b->DirtyNext) b->DirtyNext->DirtyPrev=b->DirtyPrev; else g_DirtyTail=b->DirtyPrev;
+    b->DirtyPrev=b->DirtyNext=NULL;
+    b->Flags &= ~BCACHE_BUF_DIRTY; g_DirtyCount--;
+}
+
+static void HashUnlink(PBCACHE_BUFFER b){
+    PBCACHE_BUFFER* pp = &g_BcacheHash[BcacheHash(b->Device,b->Lba)];
+    while(*pp){ if(*pp==b){ *pp=b->HashNext; break; } pp=&(*pp)->HashNext; }
+    b->HashNext=NULL;
+}
+
+static PBCACHE_BUFFER BcacheLookup(PAIO_DEVICE_OBJECT Dev, UINT64 Lba){
+    PBCACHE_BUFFER b = g_BcacheHash[BcacheHash(Dev,Lba)];
+    while(b){ if(b->Device==Dev && b->Lba==Lba) return b; b=b->HashNext; }
+    return NULL;
+}
+
+/* Get a buffer for (Dev,Lba): a free one, a fresh allocation, or the least
+ * recently used clean buffer. Returns NULL if everything is dirty or busy;
+ * callers then fall back to the uncached path. Lock held. */
+static PBCACHE_BUFFER BcacheGetBuffer(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Size){
+    PBCACHE_BUFFER b = NULL;
+    if(g_FreeList && g_FreeList->Size==Size){ b=g_FreeList; g_FreeList=b->HashNext; }
+    else if(g_BufferCount < BCACHE_MAX_BUFFERS){
+        b = (PBCACHE_BUFFER)AuroraAllocateMemory(sizeof(BCACHE_BUFFER));
+        if(b){
+            memset(b,0,sizeof(*b));
+            b->Data = (UINT8*)AuroraAllocateMemory(Size);
+            if(!b->Data){ AuroraFreeMemory(b); b=NULL; }
+            else { b->Size=Size; g_BufferCount++; }
+        }
+    }
+    if(!b){
+        for(b=g_LruTail; b; b=b->LruPrev){
+            if(b->Size==Size && !(b->Flags & (BCACHE_BUF_DIRTY|BCACHE_BUF_WRITEBACK))) break;
+        }
+        if(!b) return NULL;
+        HashUnlink(b); LruUnlink(b);
+    }
+    b->Device=Dev; b->Lba=Lba; b->Flags=0; b->DirtyTime=0;
+    b->HashNext = g_BcacheHash[BcacheHash(Dev,Lba)];
+    g_BcacheHash[BcacheHash(Dev,Lba)] = b;
+    LruPushFront(b);
+    return b;
+}
+
+static void BcacheReleaseBuffer(PBCACHE_BUFFER b){
+    DirtyUnlink(b); HashUnlink(b); LruUnlink(b);
+    b->Flags=0; b->Device=NULL;
+    b->HashNext=g_FreeList; g_FreeList=b;
+}
+
+NTSTATUS BlockCacheInitialize(void){
+    if(g_BcacheReady) return STATUS_SUCCESS;
+    AuroraInitializeSpinLock(&g_BcacheLock);
+    AuroraInitializeSpinLock(&g_FlushLock);
+    memset(g_BcacheHash,0,sizeof(g_BcacheHash));
+    g_LruHead=g_LruTail=g_DirtyHead=g_DirtyTail=g_FreeList=NULL;
+    g_BufferCount=g_DirtyCount=0;
+    g_Staging = (UINT8*)AuroraAllocateMemory(BCACHE_STAGING_BYTES);
+    if(!g_Staging) return STATUS_INSUFFICIENT_RESOURCES;
+    g_BcacheReady = TRUE;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS BlockCacheRead(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer){
+    PBLOCK_DEVICE_EXTENSION ext = Dev ? (PBLOCK_DEVICE_EXTENSION)Dev->DeviceExtension : NULL;
+    UINT8* out = (UINT8*)Buffer;
+    UINT32 bs, i = 0;
+    AURORA_IRQL old;
+    if(!ext || !Buffer || !ext->BlockSize) return STATUS_INVALID_PARAMETER;
+    if(!g_BcacheReady) return BlockSubmitDirect(Dev,Lba,Count,Buffer,0);
+    bs = ext->BlockSize;
+    while(i < Count){
+        PBCACHE_BUFFER b;
+        UINT32 run = 0, j;
+        NTSTATUS st;
+        AuroraAcquireSpinLock(&g_BcacheLock,&old);
+        b = BcacheLookup(Dev,Lba+i);
+        if(b && (b->Flags & BCACHE_BUF_VALID)){
+            memcpy(out+(UINT64)i*bs, b->Data, bs);
+            LruUnlink(b); LruPushFront(b);
+            AuroraReleaseSpinLock(&g_BcacheLock,old);
+            i++; continue;
+        }
+        /* Miss: read the whole run of consecutive misses in one request */
+        while(i+run < Count){
+            PBCACHE_BUFFER h = BcacheLookup(Dev,Lba+i+run);
+            if(h && (h->Flags & BCACHE_BUF_VALID)) break;
+            run++;
+        }
+        AuroraReleaseSpinLock(&g_BcacheLock,old);
+        st = BlockSubmitDirect(Dev,Lba+i,run,out+(UINT64)i*bs,0);
+        if(!NT_SUCCESS(st)) return st;
+        AuroraAcquireSpinLock(&g_BcacheLock,&old);
+        for(j=0;j<run;j++){
+            PBCACHE_BUFFER h = BcacheLookup(Dev,Lba+i+j);
+            if(h && (h->Flags & BCACHE_BUF_VALID)){
+                /* Raced with a writer: the cached copy is newer than the media */
+                memcpy(out+(UINT64)(i+j)*bs, h->Data, bs);
+                continue;
+            }
+            if(!h) h = BcacheGetBuffer(Dev,Lba+i+j,bs);
+            if(!h) break;
+            memcpy(h->Data, out+(UINT64)(i+j)*bs, bs);
+            h->Flags |= BCACHE_BUF_VALID;
+        }
+        AuroraReleaseSpinLock(&g_BcacheLock,old);
+        i += run;
+    }
+    return STATUS_SUCCESS;
+}
+
+/* Refresh cached copies after data reached the media; blocks without a
+ * buffer are simply not cached. Lock held. */
+static void BcacheStoreClean(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, UINT8* In, UINT32 Bs){
+    UINT32 i;
+    for(i=0;i<Count;i++){
+        PBCACHE_BUFFER b = BcacheLookup(Dev,Lba+i);
+        if(!b) b = BcacheGetBuffer(Dev,Lba+i,Bs);
+        if(!b) continue;
+        memcpy(b->Data, In+(UINT64)i*Bs, Bs);
+        b->Flags |= BCACHE_BUF_VALID;
+        DirtyUnlink(b);
+    }
+}
+
+NTSTATUS BlockCacheWrite(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer, UINT32 Flags){
+    PBLOCK_DEVICE_EXTENSION ext = Dev ? (PBLOCK_DEVICE_EXTENSION)Dev->DeviceExtension : NULL;
+    UINT8* in = (UINT8*)Buffer;
+    UINT32 bs, i;
+    AURORA_IRQL old;
+    NTSTATUS st;
+    if(!ext || !Buffer || !ext->BlockSize) return STATUS_INVALID_PARAMETER;
+    Flags |= BLOCK_IO_WRITE;
+    if(!g_BcacheReady) return BlockSubmitDirect(Dev,Lba,Count,Buffer,Flags);
+    if(ext->BlockCount && (Lba >= ext->BlockCount || Count > ext->BlockCount - Lba)) return STATUS_INVALID_PARAMETER;
+    bs = ext->BlockSize;
+
+    if(ext->CacheMode != BLOCK_CACHE_WRITEBACK || (Flags & BLOCK_IO_FUA)){
+        /* Write-through / FUA: media first, then cached copies become clean */
+        st = BlockSubmitDirect(Dev,Lba,Count,Buffer,Flags);
+        if(!NT_SUCCESS(st)) return st;
+        AuroraAcquireSpinLock(&g_BcacheLock,&old);
+        BcacheStoreClean(Dev,Lba,Count,in,bs);
+        AuroraReleaseSpinLock(&g_BcacheLock,old);
+        return STATUS_SUCCESS;
+    }
+
+    AuroraAcquireSpinLock(&g_BcacheLock,&old);
+    for(i=0;i<Count;i++){
+        PBCACHE_BUFFER b = BcacheLookup(Dev,Lba+i);
+        if(!b) b = BcacheGetBuffer(Dev,Lba+i,bs);
+        if(!b) break;
+        memcpy(b->Data, in+(UINT64)i*bs, bs);
+        b->Flags |= BCACHE_BUF_VALID;
+        LruUnlink(b); LruPushFront(b);
+        if(!(b->Flags & BCACHE_BUF_DIRTY)) DirtyLink(b);
+    }
+    AuroraReleaseSpinLock(&g_BcacheLock,old);
+    if(i < Count){
+        /* Cache is full of dirty data: push this device out and write the rest through */
+        st = BlockCacheFlushDevice(Dev);
+        if(!NT_SUCCESS(st)) return st;
+        st = BlockSubmitDirect(Dev,Lba+i,Count-i,in+(UINT64)i*bs,Flags);
+        if(!NT_SUCCESS(st)) return st;
+        AuroraAcquireSpinLock(&g_BcacheLock,&old);
+        BcacheStoreClean(Dev,Lba+i,Count-i,in+(UINT64)i*bs,bs);
+        AuroraReleaseSpinLock(&g_BcacheLock,old);
+        return STATUS_SUCCESS;
+    }
+    if(g_DirtyCount > BCACHE_DIRTY_HIGH_WATER) return BlockCacheFlushDevice(Dev);
+    if(!g_WritebackThread) BlockCacheWritebackTick();
+    return STATUS_SUCCESS;
+}
+
+/* Shell sort by LBA: dirty sets are small and usually nearly ordered */
+static void BcacheSortByLba(PBCACHE_BUFFER* v, UINT32 n){
+    UINT32 gap, i, j;
+    for(gap=n/2; gap>0; gap/=2){
+        for(i=gap;i<n;i++){
+            PBCACHE_BUFFER t=v[i];
+            for(j=i; j>=gap && v[j-gap]->Lba > t->Lba; j-=gap) v[j]=v[j-gap];
+            v[j]=t;
+        }
+    }
+}
+
+/* Write back every dirty buffer of Dev, coalescing contiguous LBAs */
+NTSTATUS BlockCacheFlushDevice(PAIO_DEVICE_OBJECT Dev){
+    PBLOCK_DEVICE_EXTENSION ext = Dev ? (PBLOCK_DEVICE_EXTENSION)Dev->DeviceExtension : NULL;
+    PBCACHE_BUFFER b;
+    UINT32 n = 0, i = 0, bs, maxRun;
+    AURORA_IRQL old, flushOld;
+    NTSTATUS result = STATUS_SUCCESS;
+    if(!ext || !ext->BlockSize) return STATUS_INVALID_PARAMETER;
+    if(!g_BcacheReady) return STATUS_SUCCESS;
+    bs = ext->BlockSize;
+    maxRun = BCACHE_STAGING_BYTES / bs;
+    if(maxRun==0) maxRun=1;
+
+    /* g_BcacheLock is dropped around each submit so lookups keep running during the
+     * write; g_FlushLock (taken first) keeps a second flusher off the staging buffers */
+    AuroraAcquireSpinLock(&g_FlushLock,&flushOld);
+    AuroraAcquireSpinLock(&g_BcacheLock,&old);
+    for(b=g_DirtyHead; b && n<BCACHE_MAX_BUFFERS; b=b->DirtyNext){
+        if(b->Device==Dev && !(b->Flags & BCACHE_BUF_WRITEBACK)) g_SortScratch[n++]=b;
+    }
+    BcacheSortByLba(g_SortScratch,n);
+    while(i<n){
+        UINT32 run = 1, j;
+        UINT64 lba = g_SortScratch[i]->Lba;
+        NTSTATUS st;
+        while(i+run<n && run<maxRun && g_SortScratch[i+run]->Lba==lba+run) run++;
+        for(j=0;j<run;j++){
+            b = g_SortScratch[i+j];
+            memcpy(g_Staging+(UINT64)j*bs, b->Data, bs);
+            DirtyUnlink(b);
+            b->Flags |= BCACHE_BUF_WRITEBACK;
+        }
+        AuroraReleaseSpinLock(&g_BcacheLock,old);
+        st = BlockSubmitDirect(Dev,lba,run,g_Staging,BLOCK_IO_WRITE);
+        AuroraAcquireSpinLock(&g_BcacheLock,&old);
+        for(j=0;j<run;j++){
+            b = g_SortScratch[i+j];
+            b->Flags &= ~BCACHE_BUF_WRITEBACK;
+            /* Keep the data dirty on failure so a later pass retries it */
+            if(!NT_SUCCESS(st) && !(b->Flags & BCACHE_BUF_DIRTY)) DirtyLink(b);
+        }
+        if(!NT_SUCCESS(st)) result = st;
+        i += run;
+    }
+    AuroraReleaseSpinLock(&g_BcacheLock,old);
+    AuroraReleaseSpinLock(&g_FlushLock,flushOld);
+    return result;
+}
+
+/* Drop every cached block of Dev; dirty data is discarded, so flush first if it matters */
+NTSTATUS BlockCacheInvalidateDevice(PAIO_DEVICE_OBJECT Dev){
+    PBCACHE_BUFFER b, next;
+    AURORA_IRQL old;
+    if(!Dev) return STATUS_INVALID_PARAMETER;
+    if(!g_BcacheReady) return STATUS_SUCCESS;
+    AuroraAcquireSpinLock(&g_BcacheLock,&old);
+    for(b=g_LruHead; b; b=next){
+        next=b->LruNext;
+        if(b->Device==Dev && !(b->Flags & BCACHE_BUF_WRITEBACK)) BcacheReleaseBuffer(b);
+    }
+    AuroraReleaseSpinLock(&g_BcacheLock,old);
+    return STATUS_SUCCESS;
+}
+
+/* One writeback pass: flush each device whose oldest dirty buffer expired,
+ * or the oldest device outright when over the high-water mark. */
+void BlockCacheWritebackTick(void){
+    UINT64 now;
+    AURORA_IRQL old;
+    if(!g_BcacheReady) return;
+    now = AuroraGetSystemTime();
+    for(;;){
+        PAIO_DEVICE_OBJECT dev = NULL;
+        AuroraAcquireSpinLock(&g_BcacheLock,&old);
+        if(g_DirtyHead && (now - g_DirtyHead->DirtyTime >= BCACHE_DIRTY_EXPIRE || g_DirtyCount > BCACHE_DIRTY_HIGH_WATER))
+            dev = g_DirtyHead->Device;
+        AuroraReleaseSpinLock(&g_BcacheLock,old);
+        if(!dev) break;
+        if(!NT_SUCCESS(BlockCacheFlushDevice(dev))) break;
+    }
+}
+
+static VOID BlockCacheWritebackThread(PVOID Context){
+    (void)Context;
+    for(;;){
+        BlockCacheWritebackTick();
+        KernSleep(BCACHE_WRITEBACK_INTERVAL);
+    }
+}
+
+/* Hand aging to a background thread; before the scheduler is up this fails
+ * and BlockCacheWrite keeps running the writeback tick itself. */
+NTSTATUS BlockCacheStartWriteback(void){
+    PPROCESS proc;
+    THREAD_ID tid;
+    NTSTATUS st;
+    if(g_WritebackThread) return STATUS_SUCCESS;
+    proc = KernGetCurrentProcess();
+    if(!proc) return STATUS_NOT_INITIALIZED;
+    st = KernCreateThread(proc->ProcessId,(PVOID)BlockCacheWritebackThread,NULL,PriorityLow,&tid);
+    if(NT_SUCCESS(st)) g_WritebackThread = TRUE;
+    return st;
+}
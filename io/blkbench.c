@@ -0,0 +1,239 @@
+/* In-kernel block benchmark (fio-style)
+ * Keeps QueueDepth requests in flight through BlockSubmitRequest /
+ * BlockPollCompletions and records per-request latency in a log-linear
+ * histogram (8 sub-buckets per power of two, <= 12.5% error). Results are
+ * printed to the serial console so they can be scraped from a headless run. */
+#include "../aurora.h"
+#include "../include/io.h"
+#include "../include/hal.h"
+#include "../include/mem.h"
+
+#define BENCH_MAX_QD        64
+#define BENCH_SUB_BITS      3
+#define BENCH_SUB           (1u<<BENCH_SUB_BITS)
+#define BENCH_BUCKETS       (64*BENCH_SUB)
+#define BENCH_PAGE_SIZE     4096
+
+typedef struct _BENCH_STATE {
+    PBLOCK_BENCH_PARAMS Params;
+    UINT64 Freq;
+    UINT64 Completed, Errors, Bytes;
+    UINT64 LatSum, LatMin, LatMax;
+    UINT32 Free[BENCH_MAX_QD];  /* stack of idle slots */
+    UINT32 FreeCount;
+    UINT64 Hist[BENCH_BUCKETS];
+    BLOCK_REQUEST Req[BENCH_MAX_QD];
+} BENCH_STATE;
+
+static BENCH_STATE g_Bench; /* one run at a time; too large for a kernel stack */
+static UINT8* g_BenchBuffers;
+static UINT32 g_BenchBufferBytes;
+
+static UINT64 BenchRand(UINT64* s){ UINT64 x=*s; x^=x<<13; x^=x>>7; x^=x<<17; *s=x; return x; }
+
+static UINT64 BenchTicksToNs(UINT64 Ticks, UINT64 Freq){
+    if(!Freq) return Ticks;
+    return (Ticks/Freq)*1000000000ull + ((Ticks%Freq)*1000000000ull)/Freq;
+}
+
+static UINT32 BenchBucket(UINT64 v){
+    UINT32 msb;
+    if(v < BENCH_SUB) return (UINT32)v;
+    msb = 63 - (UINT32)__builtin_clzll(v);
+    return msb*BENCH_SUB + (UINT32)((v >> (msb-BENCH_SUB_BITS)) & (BENCH_SUB-1));
+}
+
+/* Upper bound of a bucket, so reported percentiles never understate latency */
+static UINT64 BenchBucketValue(UINT32 b){
+    UINT32 msb = b / BENCH_SUB, sub = b % BENCH_SUB;
+    if(b < BENCH_SUB) return b;
+    return (((UINT64)(BENCH_SUB+sub+1)) << (msb-BENCH_SUB_BITS)) - 1;
+}
+
+static UINT64 BenchPercentile(BENCH_STATE* s, UINT32 PerMille){
+    UINT64 want = (s->Completed * PerMille + 999) / 1000, seen = 0;
+    UINT32 b;
+    if(!want) want = 1;
+    for(b=0;b<BENCH_BUCKETS;b++){
+        seen += s->Hist[b];
+        if(seen >= want){ UINT64 v = BenchBucketValue(b); return v > s->LatMax ? s->LatMax : v; }
+    }
+    return s->LatMax;
+}
+
+static void BenchComplete(PBLOCK_REQUEST Req){
+    BENCH_STATE* s = (BENCH_STATE*)Req->Context;
+    UINT64 ns = BenchTicksToNs(Req->CompleteTime - Req->SubmitTime, s->Freq);
+    s->Completed++;
+    if(NT_SUCCESS(Req->Status)) s->Bytes += s->Params->BlockBytes; else s->Errors++;
+    s->LatSum += ns;
+    if(ns < s->LatMin) s->LatMin = ns;
+    if(ns > s->LatMax) s->LatMax = ns;
+    s->Hist[BenchBucket(ns)]++;
+    s->Free[s->FreeCount++] = (UINT32)(Req - s->Req);
+}
+
+static NTSTATUS BenchEnsureBuffers(UINT32 Bytes){
+    UINT64 seed = 0x9E3779B97F4A7C15ull;
+    UINT32 i;
+    if(g_BenchBuffers && g_BenchBufferBytes >= Bytes) return STATUS_SUCCESS;
+    g_BenchBuffers = (UINT8*)MemAllocPages((Bytes + BENCH_PAGE_SIZE-1)/BENCH_PAGE_SIZE);
+    if(!g_BenchBuffers) g_BenchBuffers = (UINT8*)AuroraAllocateMemory(Bytes);
+    if(!g_BenchBuffers){ g_BenchBufferBytes = 0; return STATUS_INSUFFICIENT_RESOURCES; }
+    g_BenchBufferBytes = Bytes;
+    /* Non-zero pattern so sparse targets really store the data */
+    for(i=0;i+8<=Bytes;i+=8) *(UINT64*)(g_BenchBuffers+i) = BenchRand(&seed);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS BlockBenchRun(PAIO_DEVICE_OBJECT Dev, PBLOCK_BENCH_PARAMS Params, PBLOCK_BENCH_RESULT Result){
+    PBLOCK_DEVICE_EXTENSION ext;
+    BENCH_STATE* s = &g_Bench;
+    UINT64 issued = 0, seqNext, range, slots, rng, t0, t1, elapsed;
+    UINT32 blocks, qd, i;
+    NTSTATUS st;
+    if(!Dev || !Params || !Result || !Dev->DeviceExtension) return STATUS_INVALID_PARAMETER;
+    ext = (PBLOCK_DEVICE_EXTENSION)Dev->DeviceExtension;
+    if(!ext->BlockSize || !Params->BlockBytes || (Params->BlockBytes % ext->BlockSize) || Params->ReadPercent > 100) return STATUS_INVALID_PARAMETER;
+    if(Params->StartLba >= ext->BlockCount) return STATUS_INVALID_PARAMETER;
+    blocks = Params->BlockBytes / ext->BlockSize;
+    range = Params->RangeBlocks ? Params->RangeBlocks : ext->BlockCount - Params->StartLba;
+    if(range > ext->BlockCount - Params->StartLba) range = ext->BlockCount - Params->StartLba;
+    slots = range / blocks;
+    if(!slots) return STATUS_INVALID_PARAMETER;
+    qd = Params->QueueDepth ? Params->QueueDepth : 1;
+    if(qd > BENCH_MAX_QD) qd = BENCH_MAX_QD;
+    st = BenchEnsureBuffers(qd * Params->BlockBytes);
+    if(!NT_SUCCESS(st)) return st;
+
+    memset(s,0,sizeof(*s));
+    s->Params = Params;
+    s->Freq = HalQueryPerformanceFrequency();
+    s->LatMin = ~0ull;
+    for(i=0;i<qd;i++) s->Free[s->FreeCount++] = qd-1-i;
+    rng = Params->Seed ? Params->Seed : 0x2545F4914F6CDD1Dull;
+    seqNext = 0;
+
+    t0 = HalQueryPerformanceCounter();
+    while(s->Completed < Params->TotalOps){
+        while(s->FreeCount && issued < Params->TotalOps){
+            UINT32 slot = s->Free[--s->FreeCount];
+            PBLOCK_REQUEST r = &s->Req[slot];
+            UINT64 idx;
+            if(Params->Pattern==BLOCK_BENCH_RANDOM) idx = BenchRand(&rng) % slots;
+            else { idx = seqNext++; if(seqNext==slots) seqNext = 0; }
+            memset(r,0,sizeof(*r));
+            r->Lba = Params->StartLba + idx*blocks;
+            r->Count = blocks;
+            r->Flags = (BenchRand(&rng) % 100) < Params->ReadPercent ? 0 : BLOCK_IO_WRITE;
+            r->Buffer = g_BenchBuffers + (UINT64)slot*Params->BlockBytes;
+            r->Complete = BenchComplete;
+            r->Context = s;
+            issued++;
+            st = BlockSubmitRequest(Dev,r);
+            if(!NT_SUCCESS(st)){
+                /* Rejected before reaching the queue: count it and recycle the slot */
+                r->SubmitTime = r->CompleteTime = HalQueryPerformanceCounter();
+                BlockCompleteRequest(r,st);
+            }
+        }
+        BlockPollCompletions(Dev,qd);
+    }
+    t1 = HalQueryPerformanceCounter();
+
+    elapsed = BenchTicksToNs(t1-t0,s->Freq);
+    if(!elapsed) elapsed = 1;
+    memset(Result,0,sizeof(*Result));
+    Result->Ops = s->Completed;
+    Result->Errors = s->Errors;
+    Result->Bytes = s->Bytes;
+    Result->ElapsedNs = elapsed;
+    /* ops * 1e9 / ns, split to stay within 64 bits for long runs */
+    Result->Iops = (s->Completed / elapsed) * 1000000000ull + ((s->Completed % elapsed) * 1000000000ull) / elapsed;
+    Result->BytesPerSec = (s->Bytes / elapsed) * 1000000000ull + ((s->Bytes % elapsed) * 1000ull / elapsed) * 1000000ull;
+    Result->LatMinNs = s->Completed ? s->LatMin : 0;
+    Result->LatMaxNs = s->LatMax;
+    Result->LatAvgNs = s->Completed ? s->LatSum / s->Completed : 0;
+    Result->LatP50Ns = BenchPercentile(s,500);
+    Result->LatP90Ns = BenchPercentile(s,900);
+    Result->LatP99Ns = BenchPercentile(s,990);
+    Result->LatP999Ns = BenchPercentile(s,999);
+    return s->Errors ? STATUS_UNSUCCESSFUL : STATUS_SUCCESS;
+}
+
+/* Tiny append-only formatter: AuroraDebugPrint has no 64-bit conversions */
+typedef struct _BENCH_LINE { CHAR Text[192]; UINT32 Len; } BENCH_LINE;
+
+static void BenchPutStr(BENCH_LINE* l, PCSTR s){ while(*s && l->Len < sizeof(l->Text)-1) l->Text[l->Len++] = *s++; l->Text[l->Len] = 0; }
+static void BenchPutU64(BENCH_LINE* l, UINT64 v){
+    CHAR tmp[21]; UINT32 n = 0;
+    do { tmp[n++] = (CHAR)('0' + v%10); v /= 10; } while(v);
+    while(n && l->Len < sizeof(l->Text)-1) l->Text[l->Len++] = tmp[--n];
+    l->Text[l->Len] = 0;
+}
+/* Nanoseconds rendered as microseconds with one decimal */
+static void BenchPutUs(BENCH_LINE* l, UINT64 ns){ BenchPutU64(l,ns/1000); BenchPutStr(l,"."); BenchPutU64(l,(ns%1000)/100); }
+static void BenchEmit(BENCH_LINE* l){ BenchPutStr(l,"\n"); HalSerialWriteString(l->Text); l->Text[--l->Len] = 0; AuroraDebugPrint("%s", l->Text); l->Len = 0; l->Text[0] = 0; }
+
+void BlockBenchReport(PCSTR Label, PBLOCK_BENCH_PARAMS Params, PBLOCK_BENCH_RESULT Result){
+    BENCH_LINE l; l.Len = 0; l.Text[0] = 0;
+    BenchPutStr(&l,"[blkbench] "); BenchPutStr(&l,Label ? Label : "job");
+    BenchPutStr(&l,Params->Pattern==BLOCK_BENCH_RANDOM ? " rand" : " seq");
+    BenchPutStr(&l," rd="); BenchPutU64(&l,Params->ReadPercent); BenchPutStr(&l,"%");
+    BenchPutStr(&l," bs="); BenchPutU64(&l,Params->BlockBytes);
+    BenchPutStr(&l," qd="); BenchPutU64(&l,Params->QueueDepth);
+    BenchPutStr(&l," ops="); BenchPutU64(&l,Result->Ops);
+    BenchPutStr(&l," err="); BenchPutU64(&l,Result->Errors);
+    BenchEmit(&l);
+    BenchPutStr(&l,"[blkbench]   iops="); BenchPutU64(&l,Result->Iops);
+    BenchPutStr(&l," bw="); BenchPutU64(&l,Result->BytesPerSec/1024); BenchPutStr(&l,"KiB/s");
+    BenchPutStr(&l," time="); BenchPutUs(&l,Result->ElapsedNs); BenchPutStr(&l,"us");
+    BenchEmit(&l);
+    BenchPutStr(&l,"[blkbench]   lat(us) min="); BenchPutUs(&l,Result->LatMinNs);
+    BenchPutStr(&l," avg="); BenchPutUs(&l,Result->LatAvgNs);
+    BenchPutStr(&l," p50="); BenchPutUs(&l,Result->LatP50Ns);
+    BenchPutStr(&l," p90="); BenchPutUs(&l,Result->LatP90Ns);
+    BenchPutStr(&l," p99="); BenchPutUs(&l,Result->LatP99Ns);
+    BenchPutStr(&l," p99.9="); BenchPutUs(&l,Result->LatP999Ns);
+    BenchPutStr(&l," max="); BenchPutUs(&l,Result->LatMaxNs);
+    BenchEmit(&l);
+}
+
+/* Default job list; blkbench_ops= and blkbench_range= on the command line
+ * scale it. The sequential write runs first so later reads hit real pages. */
+NTSTATUS BlockBenchRunStandardSuite(PAIO_DEVICE_OBJECT Dev){
+    static const struct { PCSTR Name; UINT32 Pattern, ReadPercent, QueueDepth, BlockBytes; } jobs[] = {
+        { "seqwrite-128k", BLOCK_BENCH_SEQUENTIAL,   0,  8, 128*1024 },
+        { "seqread-128k",  BLOCK_BENCH_SEQUENTIAL, 100,  8, 128*1024 },
+        { "randread-4k",   BLOCK_BENCH_RANDOM,     100,  1,   4*1024 },
+        { "randread-4k",   BLOCK_BENCH_RANDOM,     100, 32,   4*1024 },
+        { "randwrite-4k",  BLOCK_BENCH_RANDOM,       0, 32,   4*1024 },
+        { "randrw70-4k",   BLOCK_BENCH_RANDOM,      70, 16,   4*1024 },
+    };
+    BLOCK_BENCH_PARAMS p; BLOCK_BENCH_RESULT r;
+    PBLOCK_DEVICE_EXTENSION ext;
+    CHAR val[32];
+    UINT64 ops = 8192, rangeBytes = 64ull*1024*1024;
+    UINT32 i;
+    NTSTATUS st, worst = STATUS_SUCCESS;
+    if(!Dev || !Dev->DeviceExtension) return STATUS_INVALID_PARAMETER;
+    ext = (PBLOCK_DEVICE_EXTENSION)Dev->DeviceExtension;
+    if(AuroraGetBootParameter("blkbench_ops",val,sizeof(val))) ops = AuroraParseSize(val,ops);
+    if(AuroraGetBootParameter("blkbench_range",val,sizeof(val))) rangeBytes = AuroraParseSize(val,rangeBytes);
+    HalSerialInitialize();
+    for(i=0;i<sizeof(jobs)/sizeof(jobs[0]);i++){
+        memset(&p,0,sizeof(p));
+        p.Pattern = jobs[i].Pattern;
+        p.ReadPercent = jobs[i].ReadPercent;
+        p.QueueDepth = jobs[i].QueueDepth;
+        p.BlockBytes = jobs[i].BlockBytes;
+        p.TotalOps = ops;
+        p.RangeBlocks = rangeBytes / ext->BlockSize;
+        p.Seed = 0x1234567ull + i;
+        st = BlockBenchRun(Dev,&p,&r);
+        if(st==STATUS_INVALID_PARAMETER){ AuroraDebugPrint("[blkbench] %s skipped", jobs[i].Name); continue; }
+        BlockBenchReport(jobs[i].Name,&p,&r);
+        if(!NT_SUCCESS(st)) worst = st;
+    }
+    return worst;
+}
@@ -1,49 +1,238 @@
 /* Minimal Block Layer Abstraction */
 #include "../aurora.h"
 #include "../include/io.h"
+#include "../include/hal.h"
+#include "../include/mem.h"
+#include "../include/kern/pci.h"
+#include "../include/kern/driver.h"
 
-typedef struct _BLOCK_DEVICE_EXTENSION {
-    UINT32 BlockSize;
-    UINT64 BlockCount;
-    UINT32 BlockType; /* IO_BLOCK_TYPE_* */
-} BLOCK_DEVICE_EXTENSION, *PBLOCK_DEVICE_EXTENSION;
-
-/* Submit routine prototype for block devices (sync, PIO for now) */
-typedef NTSTATUS (*PBLOCK_RW)(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer, BOOL Write);
-
-static PBLOCK_RW g_BlockRwHandlers[IO_BLOCK_TYPE_VIRTIO_BLK+1];
+static PBLOCK_RW g_BlockRwHandlers[IO_BLOCK_TYPE_MAX];
+static PBLOCK_FLUSH g_BlockFlushHandlers[IO_BLOCK_TYPE_MAX];
+static PBLOCK_SUBMIT g_BlockSubmitHandlers[IO_BLOCK_TYPE_MAX];
+static PBLOCK_POLL g_BlockPollHandlers[IO_BLOCK_TYPE_MAX];
+static UINT32 g_BlockDefaultCacheMode = BLOCK_CACHE_WRITEBACK; /* for disks that opt into caching; see blkcache= */
 
 NTSTATUS BlockRegisterRwHandler(UINT32 BlockType, PBLOCK_RW Fn){
-    if(BlockType==0 || BlockType>IO_BLOCK_TYPE_VIRTIO_BLK) return STATUS_INVALID_PARAMETER;
+    if(BlockType==0 || BlockType>IO_BLOCK_TYPE_MAX-1) return STATUS_INVALID_PARAMETER;
     g_BlockRwHandlers[BlockType] = Fn; return STATUS_SUCCESS;
 }
 
-NTSTATUS BlockRead(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer){
+NTSTATUS BlockRegisterFlushHandler(UINT32 BlockType, PBLOCK_FLUSH Fn){
+    if(BlockType==0 || BlockType>IO_BLOCK_TYPE_MAX-1) return STATUS_INVALID_PARAMETER;
+    g_BlockFlushHandlers[BlockType] = Fn; return STATUS_SUCCESS;
+}
+
+NTSTATUS BlockRegisterQueueHandlers(UINT32 BlockType, PBLOCK_SUBMIT Submit, PBLOCK_POLL Poll){
+    if(BlockType==0 || BlockType>IO_BLOCK_TYPE_MAX-1) return STATUS_INVALID_PARAMETER;
+    if(!Submit != !Poll) return STATUS_INVALID_PARAMETER;
+    g_BlockSubmitHandlers[BlockType] = Submit; g_BlockPollHandlers[BlockType] = Poll; return STATUS_SUCCESS;
+}
+
+static PBLOCK_DEVICE_EXTENSION BlockGetExtension(PAIO_DEVICE_OBJECT Dev){
     PBLOCK_DEVICE_EXTENSION ext;
-    if(!Dev || !Buffer) return STATUS_INVALID_PARAMETER;
+    if(!Dev) return NULL;
     ext = (PBLOCK_DEVICE_EXTENSION)Dev->DeviceExtension;
-    if(!ext || ext->BlockType==0) return STATUS_INVALID_PARAMETER;
+    if(!ext || ext->BlockType==0 || ext->BlockType>IO_BLOCK_TYPE_MAX-1) return NULL;
+    return ext;
+}
+
+/* Device cache flush; a device without a flush handler has no volatile cache */
+NTSTATUS BlockFlushDirect(PAIO_DEVICE_OBJECT Dev){
+    PBLOCK_DEVICE_EXTENSION ext = BlockGetExtension(Dev);
+    if(!ext) return STATUS_INVALID_PARAMETER;
+    if(!g_BlockFlushHandlers[ext->BlockType]) return STATUS_SUCCESS;
+    return g_BlockFlushHandlers[ext->BlockType](Dev);
+}
+
+/* Issue a transfer in pieces no larger than the driver's per-command limit */
+static NTSTATUS BlockRwSplit(PBLOCK_DEVICE_EXTENSION ext, PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer, UINT32 Flags){
+    UINT8* p = (UINT8*)Buffer;
+    NTSTATUS st;
+    while(Count){
+        UINT32 n = (ext->MaxTransferBlocks && Count > ext->MaxTransferBlocks) ? ext->MaxTransferBlocks : Count;
+        st = g_BlockRwHandlers[ext->BlockType](Dev,Lba,n,p,Flags);
+        if(!NT_SUCCESS(st)) return st;
+        Lba += n; Count -= n; p += (UINT64)n * ext->BlockSize;
+    }
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS BlockSubmitDirect(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer, UINT32 Flags){
+    PBLOCK_DEVICE_EXTENSION ext = BlockGetExtension(Dev);
+    NTSTATUS st;
+    if(!ext || !Buffer) return STATUS_INVALID_PARAMETER;
     if(!g_BlockRwHandlers[ext->BlockType]) return STATUS_NOT_IMPLEMENTED;
-    return g_BlockRwHandlers[ext->BlockType](Dev,Lba,Count,Buffer,FALSE);
+    if(Count==0) return STATUS_SUCCESS;
+    if(ext->BlockCount && (Lba >= ext->BlockCount || Count > ext->BlockCount - Lba)) return STATUS_INVALID_PARAMETER;
+    /* Emulate FUA with write + cache flush when the driver cannot do it natively */
+    if((Flags & BLOCK_IO_FUA) && !(ext->Features & BLOCK_FEATURE_FUA)){
+        st = BlockRwSplit(ext,Dev,Lba,Count,Buffer,Flags & ~BLOCK_IO_FUA);
+        if(!NT_SUCCESS(st)) return st;
+        return BlockFlushDirect(Dev);
+    }
+    return BlockRwSplit(ext,Dev,Lba,Count,Buffer,Flags);
+}
+
+void BlockCompleteRequest(PBLOCK_REQUEST Req, NTSTATUS Status){
+    if(!Req) return;
+    Req->Status = Status;
+    Req->CompleteTime = HalQueryPerformanceCounter();
+    if(Req->Complete) Req->Complete(Req);
+}
+
+/* Multi-queue submission: requests are steered to the hardware queue of the
+ * submitting CPU so completions stay CPU-local. Drivers without queue
+ * handlers are driven synchronously and complete before this returns. */
+NTSTATUS BlockSubmitRequest(PAIO_DEVICE_OBJECT Dev, PBLOCK_REQUEST Req){
+    PBLOCK_DEVICE_EXTENSION ext = BlockGetExtension(Dev);
+    NTSTATUS st;
+    if(!ext || !Req || !Req->Buffer) return STATUS_INVALID_PARAMETER;
+    if(ext->BlockCount && (Req->Lba >= ext->BlockCount || Req->Count > ext->BlockCount - Req->Lba)) return STATUS_INVALID_PARAMETER;
+    Req->Device = Dev;
+    Req->Status = STATUS_PENDING;
+    Req->Next = NULL;
+    Req->SubmitTime = HalQueryPerformanceCounter();
+    if(!g_BlockSubmitHandlers[ext->BlockType] || ext->QueueCount==0){
+        Req->Queue = 0;
+        BlockCompleteRequest(Req, BlockSubmitDirect(Dev,Req->Lba,Req->Count,Req->Buffer,Req->Flags));
+        return STATUS_SUCCESS;
+    }
+    Req->Queue = HalGetCurrentProcessorNumber() % ext->QueueCount;
+    if(((Req->Flags & BLOCK_IO_FUA) && !(ext->Features & BLOCK_FEATURE_FUA)) ||
+       (ext->MaxTransferBlocks && Req->Count > ext->MaxTransferBlocks)){
+        /* Emulated FUA and oversized requests take the synchronous path, which can flush and split */
+        BlockCompleteRequest(Req, BlockSubmitDirect(Dev,Req->Lba,Req->Count,Req->Buffer,Req->Flags));
+        return STATUS_SUCCESS;
+    }
+    st = g_BlockSubmitHandlers[ext->BlockType](Dev,Req);
+    if(!NT_SUCCESS(st)) Req->Status = st;
+    return st;
+}
+
+/* Reap completions from every queue of Dev; returns the number completed */
+UINT32 BlockPollCompletions(PAIO_DEVICE_OBJECT Dev, UINT32 Budget){
+    PBLOCK_DEVICE_EXTENSION ext = BlockGetExtension(Dev);
+    UINT32 q, done = 0;
+    if(!ext || !g_BlockPollHandlers[ext->BlockType]) return 0;
+    for(q=0; q<ext->QueueCount && done<Budget; q++){
+        done += g_BlockPollHandlers[ext->BlockType](Dev,q,Budget-done);
+    }
+    return done;
+}
+
+NTSTATUS BlockRead(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer){
+    PBLOCK_DEVICE_EXTENSION ext = BlockGetExtension(Dev);
+    if(!ext || !Buffer) return STATUS_INVALID_PARAMETER;
+    if(ext->CacheMode != BLOCK_CACHE_NONE) return BlockCacheRead(Dev,Lba,Count,Buffer);
+    return BlockSubmitDirect(Dev,Lba,Count,Buffer,0);
+}
+
+NTSTATUS BlockWriteEx(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer, UINT32 Flags){
+    PBLOCK_DEVICE_EXTENSION ext = BlockGetExtension(Dev);
+    if(!ext || !Buffer) return STATUS_INVALID_PARAMETER;
+    Flags |= BLOCK_IO_WRITE;
+    if(ext->CacheMode != BLOCK_CACHE_NONE) return BlockCacheWrite(Dev,Lba,Count,Buffer,Flags);
+    return BlockSubmitDirect(Dev,Lba,Count,Buffer,Flags);
 }
 
 NTSTATUS BlockWrite(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer){
-    PBLOCK_DEVICE_EXTENSION ext;
-    if(!Dev || !Buffer) return STATUS_INVALID_PARAMETER;
-    ext = (PBLOCK_DEVICE_EXTENSION)Dev->DeviceExtension;
-    if(!ext || ext->BlockType==0) return STATUS_INVALID_PARAMETER;
-    if(!g_BlockRwHandlers[ext->BlockType]) return STATUS_NOT_IMPLEMENTED;
-    return g_BlockRwHandlers[ext->BlockType](Dev,Lba,Count,Buffer,TRUE);
+    return BlockWriteEx(Dev,Lba,Count,Buffer,0);
+}
+
+/* FLUSH: every write completed before the call is on stable media when it returns */
+NTSTATUS BlockFlush(PAIO_DEVICE_OBJECT Dev){
+    PBLOCK_DEVICE_EXTENSION ext = BlockGetExtension(Dev);
+    NTSTATUS st;
+    if(!ext) return STATUS_INVALID_PARAMETER;
+    if(ext->CacheMode == BLOCK_CACHE_WRITEBACK){
+        st = BlockCacheFlushDevice(Dev);
+        if(!NT_SUCCESS(st)) return st;
+    }
+    return BlockFlushDirect(Dev);
+}
+
+/* Barrier: writes issued before the call reach media before any write issued after it.
+ * Implemented as a drain (write back + device flush); callers that only need one
+ * record durable should prefer BlockWriteEx(...,BLOCK_IO_FUA). */
+NTSTATUS BlockBarrier(PAIO_DEVICE_OBJECT Dev){
+    return BlockFlush(Dev);
 }
 
-/* ATA PIO skeleton */
-/* PORT IO helpers (to be supplied by arch HAL) */
-extern UINT8 HalInByte(UINT16 Port);
-extern void HalOutByte(UINT16 Port, UINT8 Value);
-static inline void HalIoDelay(void){ for(volatile int i=0;i<1000;i++); }
+NTSTATUS BlockSetCacheMode(PAIO_DEVICE_OBJECT Dev, UINT32 Mode){
+    PBLOCK_DEVICE_EXTENSION ext = BlockGetExtension(Dev);
+    NTSTATUS st;
+    if(!ext || Mode > BLOCK_CACHE_WRITEBACK) return STATUS_INVALID_PARAMETER;
+    if(ext->CacheMode == Mode) return STATUS_SUCCESS;
+    /* Leaving write-back: nothing dirty may stay behind; leaving caching entirely: drop stale copies */
+    if(ext->CacheMode == BLOCK_CACHE_WRITEBACK){
+        st = BlockFlush(Dev);
+        if(!NT_SUCCESS(st)) return st;
+    }
+    if(Mode == BLOCK_CACHE_NONE) BlockCacheInvalidateDevice(Dev);
+    ext->CacheMode = Mode;
+    return STATUS_SUCCESS;
+}
 
+/* ATA (legacy IDE) driver
+ * Commands use PCI bus-master DMA (PRD tables, READ/WRITE DMA EXT for 48-bit
+ * LBA) when the controller exposes a bus-master BAR, and PIO otherwise. A DMA
+ * command completes from the channel IRQ; the waiter only services the
+ * channel itself if no IRQ was connected or the interrupt never arrives. */
 #define ATA_PRIMARY_IO  0x1F0
 #define ATA_PRIMARY_CTRL 0x3F6
+#define ATA_SECONDARY_IO  0x170
+#define ATA_SECONDARY_CTRL 0x376
+#define ATA_PRIMARY_IRQ   14
+#define ATA_SECONDARY_IRQ 15
+
+/* Task file registers (offsets from the I/O base) */
+#define ATA_REG_DATA      0
+#define ATA_REG_ERROR     1
+#define ATA_REG_COUNT     2
+#define ATA_REG_LBA0      3
+#define ATA_REG_LBA1      4
+#define ATA_REG_LBA2      5
+#define ATA_REG_DRIVE     6
+#define ATA_REG_STATUS    7
+#define ATA_REG_COMMAND   7
+
+#define ATA_SR_ERR   0x01
+#define ATA_SR_DRQ   0x08
+#define ATA_SR_DF    0x20
+#define ATA_SR_DRDY  0x40
+#define ATA_SR_BSY   0x80
+
+#define ATA_CTL_NIEN 0x02
+#define ATA_CTL_SRST 0x04
+
+#define ATA_CMD_READ_PIO      0x20
+#define ATA_CMD_READ_PIO_EXT  0x24
+#define ATA_CMD_READ_DMA_EXT  0x25
+#define ATA_CMD_WRITE_PIO     0x30
+#define ATA_CMD_WRITE_PIO_EXT 0x34
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_READ_DMA      0xC8
+#define ATA_CMD_WRITE_DMA     0xCA
+#define ATA_CMD_FLUSH         0xE7
+#define ATA_CMD_FLUSH_EXT     0xEA
+#define ATA_CMD_IDENTIFY      0xEC
+
+/* Bus-master IDE registers (offsets from the channel's BM base) */
+#define ATA_BM_CMD        0
+#define ATA_BM_STATUS     2
+#define ATA_BM_PRDT       4
+#define ATA_BM_CMD_START  0x01
+#define ATA_BM_CMD_READ   0x08  /* device -> memory */
+#define ATA_BM_ST_ACTIVE  0x01
+#define ATA_BM_ST_ERR     0x02
+#define ATA_BM_ST_IRQ     0x04
+
+#define ATA_PRD_EOT       0x8000
+#define ATA_PRD_MAX       512      /* one 4 KiB page of 8-byte entries */
+#define ATA_MAX_SECTORS48 65536
+#define ATA_MAX_SECTORS28 256
+#define ATA_SPIN_LIMIT    10000000 /* status polls before declaring a timeout */
+#define ATA_IRQ_GRACE     100000   /* polls before the waiter services the channel itself */
 
 /* Fallback status codes if not defined */
 #ifndef STATUS_DEVICE_NOT_CONNECTED
@@ -53,40 +242,316 @@ static inline void HalIoDelay(void){ for(volatile int i=0;i<1000;i++); }
 #define STATUS_IO_DEVICE_ERROR STATUS_UNSUCCESSFUL
 #endif
 
-static NTSTATUS AtaIdentify(UINT16 ioBase, UINT16 ctrlBase, UINT8 drive, UINT16* identifyBuf){
-    /* Very primitive: select drive and issue IDENTIFY */
-    HalOutByte(ioBase + 6, (drive?0xB0:0xA0));
-    HalIoDelay();
-    HalOutByte(ioBase + 2, 0); /* sector count */
-    HalOutByte(ioBase + 3, 0); /* LBA low */
-    HalOutByte(ioBase + 4, 0); /* LBA mid */
-    HalOutByte(ioBase + 5, 0); /* LBA hi */
-    HalOutByte(ioBase + 7, 0xEC); /* IDENTIFY */
-    if(HalInByte(ioBase + 7)==0){ return STATUS_DEVICE_NOT_CONNECTED; }
-    /* poll DRQ */
-    UINT8 status; int timeout=100000;
-    while(((status=HalInByte(ioBase+7)) & 0x08)==0){ if(status & 0x01) return STATUS_IO_DEVICE_ERROR; if(--timeout==0) return STATUS_TIMEOUT; }
-    for(int i=0;i<256;i++){ ((UINT16*)identifyBuf)[i] = *((volatile UINT16*)(uintptr_t)(ioBase)); }
+typedef struct _ATA_PRD { UINT32 Base; UINT16 Bytes; UINT16 Flags; } ATA_PRD;
+
+typedef struct _ATA_CHANNEL {
+    UINT16 IoBase, CtrlBase, BmBase;   /* BmBase 0 = no bus mastering */
+    UINT32 Irq;
+    BOOL IrqConnected;
+    AURORA_SPINLOCK Lock;
+    ATA_PRD* Prdt;
+    volatile BOOL Done;
+    volatile UINT8 BmStatus, AtaStatus;
+} ATA_CHANNEL;
+
+typedef struct _ATA_DRIVE {
+    ATA_CHANNEL* Channel;
+    UINT8 Slave;
+    BOOL Lba48, Dma;
+    UINT64 Sectors;
+} ATA_DRIVE;
+
+static ATA_CHANNEL g_AtaChannels[2];
+
+/* ~400ns: four reads of the alternate status register */
+static void AtaDelay400(ATA_CHANNEL* ch){ HalInByte(ch->CtrlBase); HalInByte(ch->CtrlBase); HalInByte(ch->CtrlBase); HalInByte(ch->CtrlBase); }
+
+static NTSTATUS AtaWaitNotBusy(ATA_CHANNEL* ch, UINT8* StatusOut){
+    UINT32 spins = ATA_SPIN_LIMIT; UINT8 s;
+    while((s = HalInByte(ch->CtrlBase)) & ATA_SR_BSY){ if(!--spins) return STATUS_TIMEOUT; HalCpuPause(); }
+    if(StatusOut) *StatusOut = s;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS AtaWaitDrq(ATA_CHANNEL* ch){
+    UINT8 s; NTSTATUS st = AtaWaitNotBusy(ch,&s);
+    if(!NT_SUCCESS(st)) return st;
+    if(s & (ATA_SR_ERR|ATA_SR_DF)) return STATUS_IO_DEVICE_ERROR;
+    return (s & ATA_SR_DRQ) ? STATUS_SUCCESS : STATUS_IO_DEVICE_ERROR;
+}
+
+static void AtaSelect(ATA_CHANNEL* ch, UINT8 Slave, UINT8 Head){
+    HalOutByte(ch->IoBase + ATA_REG_DRIVE, (UINT8)(0xE0 | (Slave<<4) | (Head & 0x0F)));
+    AtaDelay400(ch);
+}
+
+static NTSTATUS AtaIdentify(ATA_CHANNEL* ch, UINT8 drive, UINT16* identifyBuf){
+    UINT8 status;
+    AtaSelect(ch,drive,0);
+    HalOutByte(ch->IoBase + ATA_REG_COUNT, 0);
+    HalOutByte(ch->IoBase + ATA_REG_LBA0, 0);
+    HalOutByte(ch->IoBase + ATA_REG_LBA1, 0);
+    HalOutByte(ch->IoBase + ATA_REG_LBA2, 0);
+    HalOutByte(ch->IoBase + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    AtaDelay400(ch);
+    status = HalInByte(ch->IoBase + ATA_REG_STATUS);
+    if(status==0 || status==0xFF) return STATUS_DEVICE_NOT_CONNECTED; /* floating bus */
+    if(!NT_SUCCESS(AtaWaitNotBusy(ch,&status))) return STATUS_TIMEOUT;
+    /* ATAPI/SATA signatures land in LBA1/LBA2; only plain ATA disks are handled here */
+    if(HalInByte(ch->IoBase + ATA_REG_LBA1) || HalInByte(ch->IoBase + ATA_REG_LBA2)) return STATUS_NOT_SUPPORTED;
+    if(!NT_SUCCESS(AtaWaitDrq(ch))) return STATUS_IO_DEVICE_ERROR;
+    for(int i=0;i<256;i++) identifyBuf[i] = HalInWord(ch->IoBase + ATA_REG_DATA);
     return STATUS_SUCCESS;
 }
 
-static NTSTATUS AtaRwHandler(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer, BOOL Write){
-    (void)Dev;(void)Lba;(void)Count;(void)Buffer;(void)Write; return STATUS_NOT_IMPLEMENTED; }
+static void AtaSetupTaskFile(ATA_CHANNEL* ch, ATA_DRIVE* d, UINT64 Lba, UINT32 Count){
+    if(d->Lba48){
+        AtaSelect(ch,d->Slave,0);
+        HalOutByte(ch->IoBase + ATA_REG_COUNT, (UINT8)(Count >> 8));  /* 65536 encodes as 0 */
+        HalOutByte(ch->IoBase + ATA_REG_LBA0, (UINT8)(Lba >> 24));
+        HalOutByte(ch->IoBase + ATA_REG_LBA1, (UINT8)(Lba >> 32));
+        HalOutByte(ch->IoBase + ATA_REG_LBA2, (UINT8)(Lba >> 40));
+    } else {
+        AtaSelect(ch,d->Slave,(UINT8)(Lba >> 24));
+    }
+    HalOutByte(ch->IoBase + ATA_REG_COUNT, (UINT8)Count);
+    HalOutByte(ch->IoBase + ATA_REG_LBA0, (UINT8)Lba);
+    HalOutByte(ch->IoBase + ATA_REG_LBA1, (UINT8)(Lba >> 8));
+    HalOutByte(ch->IoBase + ATA_REG_LBA2, (UINT8)(Lba >> 16));
+}
+
+/* Channel interrupt: latch bus-master and device status, acknowledge both */
+static BOOL AtaServiceChannel(ATA_CHANNEL* ch){
+    UINT8 bm = HalInByte(ch->BmBase + ATA_BM_STATUS);
+    if(!(bm & ATA_BM_ST_IRQ)) return FALSE;
+    HalOutByte(ch->BmBase + ATA_BM_CMD, (UINT8)(HalInByte(ch->BmBase + ATA_BM_CMD) & ~ATA_BM_CMD_START));
+    ch->AtaStatus = HalInByte(ch->IoBase + ATA_REG_STATUS); /* reading STATUS deasserts INTRQ */
+    ch->BmStatus = bm;
+    HalOutByte(ch->BmBase + ATA_BM_STATUS, (UINT8)(bm | ATA_BM_ST_ERR | ATA_BM_ST_IRQ)); /* write-1-to-clear */
+    ch->Done = TRUE;
+    return TRUE;
+}
+
+/* Ctx is the channel, or NULL when both native-mode channels share one PCI line */
+static void AtaInterrupt(UINT32 Irq, PVOID Ctx){
+    (void)Irq;
+    if(Ctx){ AtaServiceChannel((ATA_CHANNEL*)Ctx); return; }
+    for(UINT32 c=0;c<2;c++) if(g_AtaChannels[c].IrqConnected) AtaServiceChannel(&g_AtaChannels[c]);
+}
+
+static void AtaResetChannel(ATA_CHANNEL* ch){
+    if(ch->BmBase) HalOutByte(ch->BmBase + ATA_BM_CMD, 0);
+    HalOutByte(ch->CtrlBase, ATA_CTL_SRST | ATA_CTL_NIEN);
+    AtaDelay400(ch);
+    HalOutByte(ch->CtrlBase, ch->IrqConnected ? 0 : ATA_CTL_NIEN);
+    AtaWaitNotBusy(ch,NULL);
+}
+
+/* Fill the PRD table for the virtual buffer Buf. Each page is translated on its
+ * own, so a buffer that is only virtually contiguous gets one entry per physical
+ * run; entries may not cross a 64 KiB boundary. Stops early at a page above
+ * 4 GiB (PRD bases are 32-bit). Returns bytes covered. */
+static UINT32 AtaBuildPrdt(ATA_CHANNEL* ch, UINT8* Buf, UINT32 Bytes){
+    UINT32 n = 0, covered = 0;
+    while(covered < Bytes){
+        UINT8* va = Buf + covered;
+        UINT64 pa = MemGetPhysicalAddress(va);
+        UINT32 len = (UINT32)(AURORA_PAGE_SIZE - ((uintptr_t)va & AURORA_PAGE_MASK));
+        UINT32 room = 0x10000 - (UINT32)(pa & 0xFFFF);
+        if(len > Bytes - covered) len = Bytes - covered;
+        if(len > room) len = room;
+        if(!pa || pa + len > 0x100000000ull) break;
+        if(n && ch->Prdt[n-1].Base + (UINT32)(ch->Prdt[n-1].Bytes ? ch->Prdt[n-1].Bytes : 0x10000) == (UINT32)pa && (pa & 0xFFFF)){
+            ch->Prdt[n-1].Bytes = (UINT16)(ch->Prdt[n-1].Bytes + len); /* physically contiguous with the previous page */
+        } else {
+            if(n == ATA_PRD_MAX) break;
+            ch->Prdt[n].Base = (UINT32)pa;
+            ch->Prdt[n].Bytes = (UINT16)len; /* 0 = 64 KiB */
+            ch->Prdt[n].Flags = 0;
+            n++;
+        }
+        covered += len;
+    }
+    if(n) ch->Prdt[n-1].Flags = ATA_PRD_EOT;
+    return covered;
+}
+
+static NTSTATUS AtaPioTransfer(ATA_DRIVE* d, UINT64 Lba, UINT32 Count, UINT8* Buf, BOOL Write);
+
+static NTSTATUS AtaDmaTransfer(ATA_DRIVE* d, UINT64 Lba, UINT32 Count, UINT8* Buf, BOOL Write){
+    ATA_CHANNEL* ch = d->Channel;
+    while(Count){
+        UINT32 n = Count, bytes, spins = 0;
+        bytes = AtaBuildPrdt(ch, Buf, n * 512);
+        n = bytes / 512; /* PRD table full or a high page: issue what it covers, loop for the rest */
+        if(n == 0){
+            /* The next sector touches memory above 4 GiB: move it by PIO */
+            NTSTATUS st = AtaPioTransfer(d, Lba, 1, Buf, Write);
+            if(!NT_SUCCESS(st)) return st;
+            Lba++; Count--; Buf += 512;
+            continue;
+        }
+        if(bytes != n * 512) AtaBuildPrdt(ch, Buf, n * 512);
+        HalOutByte(ch->BmBase + ATA_BM_CMD, Write ? 0 : ATA_BM_CMD_READ);
+        HalOutDword(ch->BmBase + ATA_BM_PRDT, (UINT32)MemGetPhysicalAddress(ch->Prdt));
+        HalOutByte(ch->BmBase + ATA_BM_STATUS, (UINT8)(HalInByte(ch->BmBase + ATA_BM_STATUS) | ATA_BM_ST_ERR | ATA_BM_ST_IRQ));
+        ch->Done = FALSE;
+        AtaSetupTaskFile(ch, d, Lba, n);
+        HalOutByte(ch->IoBase + ATA_REG_COMMAND, d->Lba48 ? (Write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT)
+                                                         : (Write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA));
+        HalOutByte(ch->BmBase + ATA_BM_CMD, (UINT8)((Write ? 0 : ATA_BM_CMD_READ) | ATA_BM_CMD_START));
+        while(!ch->Done){
+            if((!ch->IrqConnected || spins > ATA_IRQ_GRACE) && AtaServiceChannel(ch)) break;
+            if(++spins > ATA_SPIN_LIMIT){ AtaResetChannel(ch); return STATUS_TIMEOUT; }
+            HalCpuPause();
+        }
+        if((ch->BmStatus & ATA_BM_ST_ERR) || (ch->AtaStatus & (ATA_SR_ERR|ATA_SR_DF))) return STATUS_IO_DEVICE_ERROR;
+        Lba += n; Count -= n; Buf += (UINT64)n * 512;
+    }
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS AtaPioTransfer(ATA_DRIVE* d, UINT64 Lba, UINT32 Count, UINT8* Buf, BOOL Write){
+    ATA_CHANNEL* ch = d->Channel;
+    NTSTATUS st;
+    AtaSetupTaskFile(ch, d, Lba, Count);
+    HalOutByte(ch->IoBase + ATA_REG_COMMAND, d->Lba48 ? (Write ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_READ_PIO_EXT)
+                                                     : (Write ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO));
+    for(UINT32 s=0;s<Count;s++){
+        UINT16* w = (UINT16*)(Buf + (UINT64)s*512);
+        st = AtaWaitDrq(ch);
+        if(!NT_SUCCESS(st)) return st;
+        if(Write) for(int i=0;i<256;i++) HalOutWord(ch->IoBase + ATA_REG_DATA, w[i]);
+        else for(int i=0;i<256;i++) w[i] = HalInWord(ch->IoBase + ATA_REG_DATA);
+        AtaDelay400(ch);
+    }
+    if(Write){
+        UINT8 s;
+        st = AtaWaitNotBusy(ch,&s);
+        if(!NT_SUCCESS(st)) return st;
+        if(s & (ATA_SR_ERR|ATA_SR_DF)) return STATUS_IO_DEVICE_ERROR;
+    }
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS AtaRwHandler(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer, UINT32 Flags){
+    PBLOCK_DEVICE_EXTENSION ext = BlockGetExtension(Dev);
+    ATA_DRIVE* d = ext ? (ATA_DRIVE*)ext->DriverContext : NULL;
+    AURORA_IRQL old; NTSTATUS st; BOOL write = (Flags & BLOCK_IO_WRITE)!=0;
+    if(!d) return STATUS_INVALID_PARAMETER;
+    if(!d->Lba48 && Lba + Count > (1ull<<28)) return STATUS_INVALID_PARAMETER;
+    AuroraAcquireSpinLock(&d->Channel->Lock,&old);
+    /* PRD bases must be word aligned; pages above 4 GiB fall back to PIO inside AtaDmaTransfer */
+    if(d->Dma && !((uintptr_t)Buffer & 1)) st = AtaDmaTransfer(d,Lba,Count,(UINT8*)Buffer,write);
+    else st = AtaPioTransfer(d,Lba,Count,(UINT8*)Buffer,write);
+    AuroraReleaseSpinLock(&d->Channel->Lock,old);
+    return st;
+}
+
+static NTSTATUS AtaFlushHandler(PAIO_DEVICE_OBJECT Dev){
+    PBLOCK_DEVICE_EXTENSION ext = BlockGetExtension(Dev);
+    ATA_DRIVE* d = ext ? (ATA_DRIVE*)ext->DriverContext : NULL;
+    AURORA_IRQL old; NTSTATUS st; UINT8 s = 0;
+    if(!d) return STATUS_INVALID_PARAMETER;
+    AuroraAcquireSpinLock(&d->Channel->Lock,&old);
+    AtaSelect(d->Channel,d->Slave,0);
+    HalOutByte(d->Channel->IoBase + ATA_REG_COMMAND, d->Lba48 ? ATA_CMD_FLUSH_EXT : ATA_CMD_FLUSH);
+    AtaDelay400(d->Channel);
+    st = AtaWaitNotBusy(d->Channel,&s);
+    AuroraReleaseSpinLock(&d->Channel->Lock,old);
+    if(!NT_SUCCESS(st)) return st;
+    return (s & (ATA_SR_ERR|ATA_SR_DF)) ? STATUS_IO_DEVICE_ERROR : STATUS_SUCCESS;
+}
+
+/* Locate the IDE function and fill in per-channel ports (native or compatibility mode) */
+static void AtaSetupChannels(void){
+    pci_device_t* pci = pci_find_class(0x010100);
+    UINT32 progIf = pci ? (pci->class_code & 0xFF) : 0;
+    UINT16 bm = 0;
+    g_AtaChannels[0].IoBase = ATA_PRIMARY_IO;   g_AtaChannels[0].CtrlBase = ATA_PRIMARY_CTRL;   g_AtaChannels[0].Irq = ATA_PRIMARY_IRQ;
+    g_AtaChannels[1].IoBase = ATA_SECONDARY_IO; g_AtaChannels[1].CtrlBase = ATA_SECONDARY_CTRL; g_AtaChannels[1].Irq = ATA_SECONDARY_IRQ;
+    if(!pci) return;
+    if((progIf & 0x01) && pci->bar[0]){ g_AtaChannels[0].IoBase = (UINT16)pci->bar[0]; g_AtaChannels[0].CtrlBase = (UINT16)(pci->bar[1] + 2); g_AtaChannels[0].Irq = pci->irq; }
+    if((progIf & 0x04) && pci->bar[2]){ g_AtaChannels[1].IoBase = (UINT16)pci->bar[2]; g_AtaChannels[1].CtrlBase = (UINT16)(pci->bar[3] + 2); g_AtaChannels[1].Irq = pci->irq; }
+    if((progIf & 0x80) && pci->bar[4] && pci->bar[4] < 0x10000){
+        bm = (UINT16)pci->bar[4];
+        pci_enable_bus_master(pci);
+    }
+    if(bm){ g_AtaChannels[0].BmBase = bm; g_AtaChannels[1].BmBase = (UINT16)(bm + 8); }
+}
+
+/* Connect the IRQ of every bus-mastering channel that has drives; a line shared by
+ * both channels is registered once with a handler that services the two of them. */
+static void AtaConnectInterrupts(const UINT32* Found){
+    ATA_CHANNEL* pri = &g_AtaChannels[0];
+    ATA_CHANNEL* sec = &g_AtaChannels[1];
+    BOOL want0 = Found[0] && pri->BmBase && !pri->IrqConnected;
+    BOOL want1 = Found[1] && sec->BmBase && !sec->IrqConnected;
+    if(want0 && want1 && pri->Irq == sec->Irq){
+        if(aur_register_irq(pri->Irq,AtaInterrupt,NULL) == AUR_OK) pri->IrqConnected = sec->IrqConnected = TRUE;
+    } else {
+        if(want0 && aur_register_irq(pri->Irq,AtaInterrupt,pri) == AUR_OK) pri->IrqConnected = TRUE;
+        if(want1 && aur_register_irq(sec->Irq,AtaInterrupt,sec) == AUR_OK) sec->IrqConnected = TRUE;
+    }
+    for(UINT32 c=0;c<2;c++) if(g_AtaChannels[c].IrqConnected) HalOutByte(g_AtaChannels[c].CtrlBase, 0); /* clear nIEN */
+}
 
 static NTSTATUS AtaProbe(void){
-    /* allocate identify buffer (on stack for now) */
-    UINT16 identify[256];
-    if(!NT_SUCCESS(AtaIdentify(ATA_PRIMARY_IO,ATA_PRIMARY_CTRL,0,identify))) return STATUS_NOT_FOUND;
-    /* Create device */
-    extern NTSTATUS IoCreateDevice(IN PAIO_DRIVER_OBJECT Driver, IN PCHAR Name, IN UINT32 Type, OUT PAIO_DEVICE_OBJECT* DeviceOut);
-    extern NTSTATUS IoRegisterStorageDriver(void);
     static AIO_DRIVER_OBJECT storageRef; static int registered=0;
-    if(!registered){ IoRegisterStorageDriver(); /* storageRef unused placeholder */ registered=1; }
-    PAIO_DEVICE_OBJECT dev; IoCreateDevice(&storageRef,"ata0",IO_DEVICE_CLASS_BLOCK,&dev);
-    PBLOCK_DEVICE_EXTENSION ext = (PBLOCK_DEVICE_EXTENSION)AuroraAllocateMemory(sizeof(BLOCK_DEVICE_EXTENSION));
-    if(ext){ memset(ext,0,sizeof(*ext)); ext->BlockSize=512; ext->BlockCount=0; ext->BlockType=IO_BLOCK_TYPE_ATA; dev->DeviceExtension=ext; }
+    extern NTSTATUS IoRegisterStorageDriver(void);
+    UINT16 identify[256];
+    UINT32 found = 0, chFound[2] = {0,0};
+    AtaSetupChannels();
+    for(UINT32 c=0;c<2;c++){
+        ATA_CHANNEL* ch = &g_AtaChannels[c];
+        AuroraInitializeSpinLock(&ch->Lock);
+        HalOutByte(ch->CtrlBase, ATA_CTL_NIEN);
+        if(HalInByte(ch->IoBase + ATA_REG_STATUS) == 0xFF) continue; /* no channel */
+        if(ch->BmBase){
+            ch->Prdt = (ATA_PRD*)MemAllocPages(1); /* page-aligned, so never straddles 64 KiB */
+            if(ch->Prdt && MemGetPhysicalAddress(ch->Prdt) >= 0x100000000ull){ MemFreePages(ch->Prdt,1); ch->Prdt = NULL; }
+            if(!ch->Prdt) ch->BmBase = 0;
+        }
+        for(UINT8 drive=0;drive<2;drive++){
+            PAIO_DEVICE_OBJECT dev; PBLOCK_DEVICE_EXTENSION ext; ATA_DRIVE* d;
+            CHAR name[8] = "ata0";
+            if(!NT_SUCCESS(AtaIdentify(ch,drive,identify))) continue;
+            d = (ATA_DRIVE*)AuroraAllocateMemory(sizeof(ATA_DRIVE));
+            ext = (PBLOCK_DEVICE_EXTENSION)AuroraAllocateMemory(sizeof(BLOCK_DEVICE_EXTENSION));
+            if(!d || !ext){
+                if(d) AuroraFreeMemory(d);
+                if(ext) AuroraFreeMemory(ext);
+                continue;
+            }
+            memset(d,0,sizeof(*d)); memset(ext,0,sizeof(*ext));
+            d->Channel = ch; d->Slave = drive;
+            d->Lba48 = (identify[83] & (1<<10)) != 0;
+            d->Sectors = d->Lba48 ? ((UINT64)identify[103]<<48 | (UINT64)identify[102]<<32 | (UINT64)identify[101]<<16 | identify[100])
+                                  : ((UINT32)identify[61]<<16 | identify[60]);
+            d->Dma = ch->BmBase && (identify[49] & (1<<8));
+            if(!registered){ IoRegisterStorageDriver(); IoDriverInitialize(&storageRef,"ata"); registered=1; }
+            name[3] = (CHAR)('0' + c*2 + drive);
+            if(!NT_SUCCESS(IoCreateDevice(&storageRef,name,(IO_DEVICE_CLASS_BLOCK<<16)|IO_BLOCK_TYPE_ATA,&dev))){
+                AuroraFreeMemory(d);
+                AuroraFreeMemory(ext);
+                continue;
+            }
+            ext->BlockSize = 512; ext->BlockCount = d->Sectors; ext->BlockType = IO_BLOCK_TYPE_ATA;
+            ext->Features = BLOCK_FEATURE_FLUSH;
+            ext->MaxTransferBlocks = d->Lba48 ? ATA_MAX_SECTORS48 : ATA_MAX_SECTORS28;
+            ext->DriverContext = d;
+            dev->DeviceExtension = ext;
+            BlockSetCacheMode(dev,g_BlockDefaultCacheMode);
+            AuroraDebugPrint("[ata] %s %u MiB %s%s", name, (UINT32)(d->Sectors >> 11), d->Lba48 ? "lba48" : "lba28", d->Dma ? " dma" : " pio");
+            chFound[c]++; found++;
+        }
+        /* A PRD table no drive on the channel will use */
+        if(!chFound[c] && ch->Prdt){ MemFreePages(ch->Prdt,1); ch->Prdt = NULL; ch->BmBase = 0; }
+    }
+    if(!found) return STATUS_NOT_FOUND;
+    AtaConnectInterrupts(chFound);
     BlockRegisterRwHandler(IO_BLOCK_TYPE_ATA,AtaRwHandler);
-    AuroraDebugPrint("[ata] primary master present (stub)");
+    BlockRegisterFlushHandler(IO_BLOCK_TYPE_ATA,AtaFlushHandler);
     return STATUS_SUCCESS;
 }
 
@@ -96,8 +561,21 @@ static NTSTATUS NvmeScan(void){
     return STATUS_NOT_IMPLEMENTED;
 }
 
+/* blkcache=none|writethrough|writeback picks the cache mode for disks that
+ * benefit from one (ATA today); the default is write-back with aging. */
+static void BlockParseCacheParameter(void){
+    CHAR val[16];
+    if(!AuroraGetBootParameter("blkcache",val,sizeof(val))) return;
+    if(strcmp(val,"none")==0) g_BlockDefaultCacheMode = BLOCK_CACHE_NONE;
+    else if(strcmp(val,"writethrough")==0) g_BlockDefaultCacheMode = BLOCK_CACHE_WRITETHROUGH;
+    else if(strcmp(val,"writeback")==0) g_BlockDefaultCacheMode = BLOCK_CACHE_WRITEBACK;
+}
+
 /* Entry called after IO initialized */
 NTSTATUS BlockSubsystemInitialize(void){
+    BlockParseCacheParameter();
+    if(!NT_SUCCESS(BlockCacheInitialize())) g_BlockDefaultCacheMode = BLOCK_CACHE_NONE;
+    else if(g_BlockDefaultCacheMode == BLOCK_CACHE_WRITEBACK) BlockCacheStartWriteback();
     AtaProbe();
     NvmeScan();
     return STATUS_SUCCESS;
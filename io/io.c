@@ -54,6 +54,18 @@ NTSTATUS IoCreateDevice(IN PAIO_DRIVER_OBJECT Driver, IN PCHAR Name, IN UINT32 T
     return STATUS_SUCCESS;
 }
 
+PAIO_DEVICE_OBJECT IoGetDeviceByName(IN PCSTR Name){
+    PAIO_DEVICE_OBJECT dev;
+    AURORA_IRQL old;
+    if(!Name) return NULL;
+    AuroraAcquireSpinLock(&g_IoLock, &old);
+    for(dev = g_DeviceList; dev; dev = dev->Next){
+        if(strcmp(dev->Name, Name)==0) break;
+    }
+    AuroraReleaseSpinLock(&g_IoLock, old);
+    return dev;
+}
+
 NTSTATUS IoDeleteDevice(IN PAIO_DEVICE_OBJECT Device){
     (void)Device; /* TODO: unlink lists */
     return STATUS_NOT_IMPLEMENTED;
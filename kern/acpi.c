@@ -6,6 +6,7 @@
 
 static BOOL g_AcpiInitialized = FALSE;
 static PACPI_RSDP g_Rsdp = NULL;
+static UINT64 g_RsdpHint = 0;
 static const ACPI_TABLE_HEADER* g_Madt = NULL;
 static const ACPI_TABLE_HEADER* g_Hpet = NULL;
 static UINT64 g_LapicBase = 0;
@@ -33,6 +34,8 @@ __attribute__((weak)) void* AcpiMapPhysical(UINT64 phys, UINT32 length){
 static BOOL AcpiChecksumOk(const UINT8* data, UINT32 length){
     UINT8 sum=0; for(UINT32 i=0;i<length;i++) sum = (UINT8)(sum + data[i]); return sum==0; }
 
+void AcpiSetRsdpAddress(UINT64 phys){ g_RsdpHint = phys; }
+
 /* Scan for RSDP in EBDA (0x40E gives EBDA segment) and then high BIOS area */
 static PACPI_RSDP AcpiFindRsdp(void){
     /* EBDA segment pointer at 0x40E (word) */
@@ -43,6 +46,13 @@ static PACPI_RSDP AcpiFindRsdp(void){
         ebdaPhys = ((UINT32)ebdaSeg) << 4; /* segment to phys */
     }
     const CHAR sig[] = { 'R','S','D',' ','P','T','R',' ' };
+    if(g_RsdpHint){
+        PACPI_RSDP rsdp = (PACPI_RSDP)AcpiMapPhysical(g_RsdpHint, sizeof(ACPI_RSDP));
+        if(rsdp && memcmp(rsdp->Signature, sig, 8)==0){
+            UINT32 len = (rsdp->Revision >= 2) ? rsdp->Length : 20;
+            if(AcpiChecksumOk((const UINT8*)rsdp, len)) return rsdp;
+        }
+    }
     if(ebdaPhys && MemIsPhysicalAddressValid(ebdaPhys)){
         for(UINT32 p = ebdaPhys; p < ebdaPhys + 1024; p += 16){
             PACPI_RSDP rsdp = (PACPI_RSDP)(UINT_PTR)p;
@@ -1,6 +1,8 @@
 /* Aurora PCI/PCIe Bus Driver */
 #include "../../../aurora.h"
 #include "../../../include/kern/driver.h"
+#include "../../../include/kern/pci.h"
+#include "../../../include/hal.h"
 
 /* PCI Configuration Space Registers */
 #define PCI_VENDOR_ID           0x00
@@ -67,7 +69,6 @@
 #define PCI_CAP_ID_CHSWP        0x06
 #define PCI_CAP_ID_PCIX         0x07
 #define PCI_CAP_ID_HT           0x08
-#define PCI_CAP_ID_VNDR         0x09
 #define PCI_CAP_ID_DBG          0x0A
 #define PCI_CAP_ID_CCRC         0x0B
 #define PCI_CAP_ID_SHPC         0x0C
@@ -75,7 +76,6 @@
 #define PCI_CAP_ID_AGP3         0x0E
 #define PCI_CAP_ID_SECDEV       0x0F
 #define PCI_CAP_ID_EXP          0x10
-#define PCI_CAP_ID_MSIX         0x11
 #define PCI_CAP_ID_SATA         0x12
 #define PCI_CAP_ID_AF           0x13
 
@@ -94,23 +94,6 @@
 #define PCI_MSI_FLAGS_64BIT     0x0080
 #define PCI_MSI_FLAGS_MASKBIT   0x0100
 
-/* PCI Device Structure */
-typedef struct _pci_device {
-    UINT32 bus;
-    UINT32 device;
-    UINT32 function;
-    UINT32 vendor_id;
-    UINT32 device_id;
-    UINT32 class_code;
-    UINT32 revision;
-    UINT64 bar[6];
-    UINT32 irq;
-    UINT32 msi_enabled;
-    UINT32 msix_enabled;
-    UINT8 capabilities[256];
-    struct _pci_device* next;
-} pci_device_t;
-
 /* PCI Bus Private Data */
 typedef struct _pci_bus_priv {
     AURORA_SPINLOCK lock;
@@ -127,20 +110,16 @@ static pci_bus_priv_t g_pci_bus;
 static UINT32 pci_config_read32(UINT32 bus, UINT32 device, UINT32 function, UINT32 offset) {
     UINT32 address = 0x80000000 | (bus << 16) | (device << 11) | (function << 8) | (offset & 0xFC);
     
-    /* Use I/O ports for legacy PCI access */
-    // __asm__ volatile ("outl %0, $0xCF8" : : "a"(address));
-    // 
-    // UINT32 value;
-    // __asm__ volatile ("inl $0xCFC, %0" : "=a"(value));
-    // return value;
-    return 0; // Placeholder
+    /* Use I/O ports for legacy PCI access (mechanism #1) */
+    HalOutDword(0xCF8, address);
+    return HalInDword(0xCFC);
 }
 
 static void pci_config_write32(UINT32 bus, UINT32 device, UINT32 function, UINT32 offset, UINT32 value) {
     UINT32 address = 0x80000000 | (bus << 16) | (device << 11) | (function << 8) | (offset & 0xFC);
     
-    // __asm__ volatile ("outl %0, $0xCF8" : : "a"(address));
-    // __asm__ volatile ("outl %0, $0xCFC" : : "a"(value));
+    HalOutDword(0xCF8, address);
+    HalOutDword(0xCFC, value);
 }
 
 static UINT16 pci_config_read16(UINT32 bus, UINT32 device, UINT32 function, UINT32 offset) {
@@ -488,4 +467,67 @@ pci_device_t* pci_find_class(UINT32 class_code) {
     
     AuroraReleaseSpinLock(&g_pci_bus.lock, old_irql);
     return NULL;
-}
\ No newline at end of file
+}
+
+pci_device_t* pci_find_next(pci_device_t* after, UINT16 vendor_id, UINT16 device_id) {
+    AURORA_IRQL old_irql;
+    AuroraAcquireSpinLock(&g_pci_bus.lock, &old_irql);
+    
+    pci_device_t* pci_dev = after ? after->next : g_pci_bus.devices;
+    while (pci_dev) {
+        if (pci_dev->vendor_id == vendor_id && pci_dev->device_id == device_id) break;
+        pci_dev = pci_dev->next;
+    }
+    
+    AuroraReleaseSpinLock(&g_pci_bus.lock, old_irql);
+    return pci_dev;
+}
+
+/* Configuration space accessors for function drivers */
+UINT32 pci_read_config32(pci_device_t* dev, UINT32 offset) {
+    return pci_config_read32(dev->bus, dev->device, dev->function, offset);
+}
+
+UINT16 pci_read_config16(pci_device_t* dev, UINT32 offset) {
+    return pci_config_read16(dev->bus, dev->device, dev->function, offset);
+}
+
+UINT8 pci_read_config8(pci_device_t* dev, UINT32 offset) {
+    return pci_config_read8(dev->bus, dev->device, dev->function, offset);
+}
+
+void pci_write_config32(pci_device_t* dev, UINT32 offset, UINT32 value) {
+    pci_config_write32(dev->bus, dev->device, dev->function, offset, value);
+}
+
+void pci_write_config16(pci_device_t* dev, UINT32 offset, UINT16 value) {
+    pci_config_write16(dev->bus, dev->device, dev->function, offset, value);
+}
+
+void pci_write_config8(pci_device_t* dev, UINT32 offset, UINT8 value) {
+    pci_config_write8(dev->bus, dev->device, dev->function, offset, value);
+}
+
+UINT8 pci_next_capability(pci_device_t* dev, UINT8 pos, UINT8 cap_id) {
+    UINT32 guard = 48; /* a well-formed list cannot be longer than this */
+    
+    if (pos == 0) {
+        if (!(pci_read_config16(dev, PCI_STATUS) & PCI_STATUS_CAP_LIST)) return 0;
+        pos = pci_read_config8(dev, PCI_CAPABILITIES_PTR) & 0xFC;
+    } else {
+        pos = pci_read_config8(dev, pos + 1) & 0xFC;
+    }
+    
+    while (pos && guard--) {
+        if (pci_read_config8(dev, pos) == cap_id) return pos;
+        pos = pci_read_config8(dev, pos + 1) & 0xFC;
+    }
+    
+    return 0;
+}
+
+void pci_enable_bus_master(pci_device_t* dev) {
+    UINT16 cmd = pci_read_config16(dev, PCI_COMMAND);
+    cmd |= PCI_COMMAND_MEMORY | PCI_COMMAND_IO | PCI_COMMAND_MASTER;
+    pci_write_config16(dev, PCI_COMMAND, cmd);
+}
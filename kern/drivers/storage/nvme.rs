@@ -94,6 +94,9 @@ const NVME_CMD_RESV_REPORT: u8 = 0x0e;
 const NVME_CMD_RESV_ACQUIRE: u8 = 0x11;
 const NVME_CMD_RESV_RELEASE: u8 = 0x15;
 
+// Read/write command dword 12 flags
+const NVME_RW_FUA: u32 = 1 << 30;
+
 // NVMe command structure
 #[repr(C, packed)]
 #[derive(Debug, Clone, Copy)]
@@ -521,6 +524,22 @@ impl NvmeCtrl {
         Ok(())
     }
     
+    pub fn write_data_fua(&mut self, nsid: u32, lba: u64, blocks: u16, buffer: *const u8) -> Result<(), i32> {
+        let mut cmd: NvmeCommand = unsafe { mem::zeroed() };
+        
+        cmd.cdw0 = NVME_CMD_WRITE as u32;
+        cmd.nsid = nsid;
+        cmd.prp1 = buffer as u64; // In real implementation, would be DMA address
+        cmd.cdw10 = (lba & 0xffffffff) as u32;
+        cmd.cdw11 = (lba >> 32) as u32;
+        cmd.cdw12 = ((blocks - 1) as u32) | NVME_RW_FUA; // 0-based, forced unit access
+        
+        // Lets durability-sensitive writers skip a full-cache flush
+        self.submit_admin_cmd(&cmd)?;
+        
+        Ok(())
+    }
+    
     pub fn flush(&mut self, nsid: u32) -> Result<(), i32> {
         let mut cmd: NvmeCommand = unsafe { mem::zeroed() };
         
@@ -619,6 +638,20 @@ pub extern "C" fn nvme_write_blocks(ctrl: *mut NvmeCtrl, nsid: u32, lba: u64, bl
     }
 }
 
+#[no_mangle]
+pub extern "C" fn nvme_write_blocks_fua(ctrl: *mut NvmeCtrl, nsid: u32, lba: u64, blocks: u16, buffer: *const u8) -> i32 {
+    if ctrl.is_null() || buffer.is_null() {
+        return -1;
+    }
+    
+    unsafe {
+        match (*ctrl).write_data_fua(nsid, lba, blocks, buffer) {
+            Ok(()) => 0,
+            Err(e) => e,
+        }
+    }
+}
+
 #[no_mangle]
 pub extern "C" fn nvme_flush_namespace(ctrl: *mut NvmeCtrl, nsid: u32) -> i32 {
     if ctrl.is_null() {
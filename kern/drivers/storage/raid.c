@@ -0,0 +1,113 @@
+/* Aurora software RAID block device
+ * Assembles md0 over the RAM disks using the striping/mirroring/parity engine
+ * in storage_rust.rs. raid=0|1|5 on the command line selects the level and
+ * uses every disk created by ramdisk_count=<n> as a member; raid_chunk=<n>[K]
+ * sets the chunk size (default 64K). The engine issues member I/O through the
+ * block layer's submit/poll path and waits for it, and is not reentrant, so
+ * requests on md0 are serialised here. */
+#include "../../../aurora.h"
+#include "../../../include/io.h"
+
+/* storage_rust.rs */
+typedef struct _RAID_ENGINE RAID_ENGINE;
+extern RAID_ENGINE* storage_rust_create_raid(UINT32 Level, UINT32 StripeSize);
+extern void storage_rust_destroy_raid(RAID_ENGINE* Raid);
+extern INT32 storage_rust_raid_add_member(RAID_ENGINE* Raid, PVOID Dev, UINT64 Blocks, UINT32 BlockSize);
+extern UINT64 storage_rust_raid_capacity(const RAID_ENGINE* Raid);
+extern NTSTATUS storage_rust_raid_read(RAID_ENGINE* Raid, UINT64 Lba, UINT32 Count, UINT8* Buffer);
+extern NTSTATUS storage_rust_raid_write(RAID_ENGINE* Raid, UINT64 Lba, UINT32 Count, const UINT8* Buffer, UINT32 Flags);
+extern NTSTATUS storage_rust_raid_flush(RAID_ENGINE* Raid);
+
+/* RaidLevel numbering on the Rust side */
+#define RAID_ENGINE_RAID0  1
+#define RAID_ENGINE_RAID1  2
+#define RAID_ENGINE_RAID5  3
+
+typedef struct _RAID_DEVICE {
+    RAID_ENGINE* Engine;
+    AURORA_SPINLOCK Lock;
+} RAID_DEVICE, *PRAID_DEVICE;
+
+static RAID_DEVICE g_Raid;
+static PAIO_DEVICE_OBJECT g_RaidDevice;
+static AIO_DRIVER_OBJECT g_RaidDriver;
+
+static NTSTATUS RaidRwHandler(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer, UINT32 Flags){
+    PRAID_DEVICE rd = (PRAID_DEVICE)((PBLOCK_DEVICE_EXTENSION)Dev->DeviceExtension)->DriverContext;
+    AURORA_IRQL old; NTSTATUS st;
+    AuroraAcquireSpinLock(&rd->Lock,&old);
+    if(Flags & BLOCK_IO_WRITE) st = storage_rust_raid_write(rd->Engine,Lba,Count,(const UINT8*)Buffer,Flags);
+    else st = storage_rust_raid_read(rd->Engine,Lba,Count,(UINT8*)Buffer);
+    AuroraReleaseSpinLock(&rd->Lock,old);
+    return st;
+}
+
+/* Writes out partial RAID5 stripes still held in the stripe cache, then flushes every member */
+static NTSTATUS RaidFlushHandler(PAIO_DEVICE_OBJECT Dev){
+    PRAID_DEVICE rd = (PRAID_DEVICE)((PBLOCK_DEVICE_EXTENSION)Dev->DeviceExtension)->DriverContext;
+    AURORA_IRQL old; NTSTATUS st;
+    AuroraAcquireSpinLock(&rd->Lock,&old);
+    st = storage_rust_raid_flush(rd->Engine);
+    AuroraReleaseSpinLock(&rd->Lock,old);
+    return st;
+}
+
+PAIO_DEVICE_OBJECT RaidGetDevice(void){ return g_RaidDevice; }
+
+NTSTATUS RaidInitialize(void){
+    CHAR val[16];
+    PBLOCK_DEVICE_EXTENSION ext, mext;
+    PAIO_DEVICE_OBJECT member;
+    UINT32 level, raidLevel, chunk = 0, minMembers, i;
+    NTSTATUS st;
+    if(g_RaidDevice) return STATUS_SUCCESS;
+    if(!AuroraGetBootParameter("raid",val,sizeof(val))) return STATUS_NOT_FOUND;
+    switch(val[0]){
+        case '0': level = RAID_ENGINE_RAID0; raidLevel = 0; minMembers = 2; break;
+        case '1': level = RAID_ENGINE_RAID1; raidLevel = 1; minMembers = 2; break;
+        case '5': level = RAID_ENGINE_RAID5; raidLevel = 5; minMembers = 3; break;
+        default: return STATUS_INVALID_PARAMETER;
+    }
+    if(AuroraGetBootParameter("raid_chunk",val,sizeof(val))) chunk = (UINT32)AuroraParseSize(val,0);
+    for(i=0; RamDiskGetDevice(i); i++) {}
+    if(i < minMembers){
+        AuroraDebugPrint("[raid] raid%u needs %u members, have %u (ramdisk_count=)", raidLevel, minMembers, i);
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    g_Raid.Engine = storage_rust_create_raid(level,chunk);
+    if(!g_Raid.Engine) return STATUS_INSUFFICIENT_RESOURCES;
+    AuroraInitializeSpinLock(&g_Raid.Lock);
+    for(i=0; (member = RamDiskGetDevice(i)) != NULL; i++){
+        mext = (PBLOCK_DEVICE_EXTENSION)member->DeviceExtension;
+        if(storage_rust_raid_add_member(g_Raid.Engine,member,mext->BlockCount,mext->BlockSize) != 0) break;
+    }
+    if(i < minMembers || !storage_rust_raid_capacity(g_Raid.Engine)){
+        st = STATUS_INVALID_PARAMETER;
+        goto fail;
+    }
+
+    IoDriverInitialize(&g_RaidDriver,"raid");
+    BlockRegisterRwHandler(IO_BLOCK_TYPE_RAID,RaidRwHandler);
+    BlockRegisterFlushHandler(IO_BLOCK_TYPE_RAID,RaidFlushHandler);
+    ext = (PBLOCK_DEVICE_EXTENSION)AuroraAllocateMemory(sizeof(BLOCK_DEVICE_EXTENSION));
+    if(!ext){ st = STATUS_INSUFFICIENT_RESOURCES; goto fail; }
+    st = IoCreateDevice(&g_RaidDriver,"md0",(IO_DEVICE_CLASS_BLOCK<<16)|IO_BLOCK_TYPE_RAID,&g_RaidDevice);
+    if(!NT_SUCCESS(st)){ g_RaidDevice = NULL; goto fail; }
+    memset(ext,0,sizeof(*ext));
+    ext->BlockSize = ((PBLOCK_DEVICE_EXTENSION)RamDiskGetDevice(0)->DeviceExtension)->BlockSize;
+    ext->BlockCount = storage_rust_raid_capacity(g_Raid.Engine);
+    ext->BlockType = IO_BLOCK_TYPE_RAID;
+    ext->Features = BLOCK_FEATURE_FLUSH; /* the RAID5 stripe cache is volatile */
+    ext->CacheMode = BLOCK_CACHE_NONE;   /* members are RAM; the stripe cache already absorbs partial writes */
+    ext->DriverContext = &g_Raid;
+    g_RaidDevice->DeviceExtension = ext;
+    AuroraDebugPrint("[raid] md0 raid%u over %u members, %u MiB", raidLevel, i,
+                     (UINT32)((ext->BlockCount * ext->BlockSize) >> 20));
+    return STATUS_SUCCESS;
+
+fail:
+    storage_rust_destroy_raid(g_Raid.Engine);
+    g_Raid.Engine = NULL;
+    return st;
+}
@@ -0,0 +1,221 @@
+/* Aurora sparse RAM disk
+ * Backing store is a 3-level, 512-ary radix table of 4 KiB pages allocated
+ * on first write; never-written ranges read back as zeros, so the disk can be
+ * sized far beyond physical memory (ramdisk_size=<n>[K|M|G] on the command
+ * line). Requests are accepted on per-CPU queues (ramdisk_queues=<n>) and
+ * completed by the poll handler, which lets the block benchmark exercise the
+ * same submit/poll path that hardware drivers use. ramdisk_count=<n> creates
+ * ram0..ram<n-1>, enough members to assemble a software RAID array. */
+#include "../../../aurora.h"
+#include "../../../include/io.h"
+#include "../../../include/mem.h"
+#include "../../../include/hal.h"
+
+#define RD_BLOCK_SIZE        512
+#define RD_PAGE_SIZE         4096
+#define RD_PAGE_SHIFT        12
+#define RD_FANOUT_SHIFT      9
+#define RD_FANOUT            (1u<<RD_FANOUT_SHIFT)
+#define RD_LEVELS            3
+#define RD_MAX_PAGES         (1ull<<(RD_FANOUT_SHIFT*RD_LEVELS)) /* 512 GiB */
+#define RD_DEFAULT_SIZE      (64ull*1024*1024)
+#define RD_MAX_QUEUES        16
+#define RD_MAX_DISKS         8
+
+typedef struct _RD_QUEUE {
+    AURORA_SPINLOCK Lock;
+    PBLOCK_REQUEST Head, Tail;
+    UINT32 Depth;
+} RD_QUEUE;
+
+typedef struct _RAMDISK {
+    PVOID* Root;            /* level-0 table */
+    UINT64 SizeBytes;
+    UINT64 PagesAllocated;
+    AURORA_SPINLOCK AllocLock;
+    UINT32 QueueCount;
+    RD_QUEUE Queues[RD_MAX_QUEUES];
+} RAMDISK, *PRAMDISK;
+
+static RAMDISK g_RamDisks[RD_MAX_DISKS];
+static PAIO_DEVICE_OBJECT g_RamDiskDevices[RD_MAX_DISKS];
+static UINT32 g_RamDiskCount;
+static AIO_DRIVER_OBJECT g_RamDiskDriver;
+
+static PRAMDISK RdFromDevice(PAIO_DEVICE_OBJECT Dev){
+    return (PRAMDISK)((PBLOCK_DEVICE_EXTENSION)Dev->DeviceExtension)->DriverContext;
+}
+
+static PVOID RdAllocPage(void){
+    PVOID p = MemAllocPages(1);
+    if(!p) p = AuroraAllocateMemory(RD_PAGE_SIZE);
+    if(p) memset(p,0,RD_PAGE_SIZE);
+    return p;
+}
+
+/* Walk the radix table for Page; with Create set, missing interior tables and
+ * the leaf page are allocated. Returns NULL for holes (or on allocation failure). */
+static UINT8* RdLookupPage(PRAMDISK rd, UINT64 Page, BOOL Create){
+    PVOID* table = rd->Root;
+    AURORA_IRQL old;
+    UINT32 level;
+    for(level=0; level<RD_LEVELS; level++){
+        UINT32 idx = (UINT32)(Page >> (RD_FANOUT_SHIFT*(RD_LEVELS-1-level))) & (RD_FANOUT-1);
+        PVOID next = table[idx];
+        if(!next){
+            if(!Create) return NULL;
+            AuroraAcquireSpinLock(&rd->AllocLock,&old);
+            next = table[idx];
+            if(!next){
+                next = RdAllocPage();
+                if(next){ table[idx] = next; if(level==RD_LEVELS-1) rd->PagesAllocated++; }
+            }
+            AuroraReleaseSpinLock(&rd->AllocLock,old);
+            if(!next) return NULL;
+        }
+        if(level==RD_LEVELS-1) return (UINT8*)next;
+        table = (PVOID*)next;
+    }
+    return NULL;
+}
+
+static BOOL RdIsZero(const UINT8* p, UINT32 n){
+    const UINT64* q = (const UINT64*)p; UINT32 i;
+    for(i=0;i<n/8;i++) if(q[i]) return FALSE;
+    return TRUE;
+}
+
+static NTSTATUS RdTransfer(PRAMDISK rd, UINT64 Lba, UINT32 Count, UINT8* Buf, BOOL Write){
+    UINT64 off = Lba * RD_BLOCK_SIZE;
+    UINT64 left = (UINT64)Count * RD_BLOCK_SIZE;
+    if(off + left > rd->SizeBytes) return STATUS_INVALID_PARAMETER;
+    while(left){
+        UINT64 page = off >> RD_PAGE_SHIFT;
+        UINT32 in = (UINT32)(off & (RD_PAGE_SIZE-1));
+        UINT32 n = RD_PAGE_SIZE - in; if(n > left) n = (UINT32)left;
+        UINT8* p;
+        if(Write){
+            /* Writing zeros into a hole keeps it a hole */
+            p = RdLookupPage(rd,page,FALSE);
+            if(!p){
+                if(RdIsZero(Buf,n)) goto next;
+                p = RdLookupPage(rd,page,TRUE);
+                if(!p) return STATUS_INSUFFICIENT_RESOURCES;
+            }
+            memcpy(p+in,Buf,n);
+        } else {
+            p = RdLookupPage(rd,page,FALSE);
+            if(p) memcpy(Buf,p+in,n); else memset(Buf,0,n);
+        }
+next:
+        Buf += n; off += n; left -= n;
+    }
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS RamDiskRwHandler(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer, UINT32 Flags){
+    return RdTransfer(RdFromDevice(Dev),Lba,Count,(UINT8*)Buffer,(Flags & BLOCK_IO_WRITE)!=0);
+}
+
+static NTSTATUS RamDiskFlushHandler(PAIO_DEVICE_OBJECT Dev){
+    (void)Dev; return STATUS_SUCCESS; /* nothing volatile below us */
+}
+
+static NTSTATUS RamDiskSubmit(PAIO_DEVICE_OBJECT Dev, PBLOCK_REQUEST Req){
+    PRAMDISK rd = RdFromDevice(Dev);
+    RD_QUEUE* q; AURORA_IRQL old;
+    if(Req->Queue >= rd->QueueCount) return STATUS_INVALID_PARAMETER;
+    q = &rd->Queues[Req->Queue];
+    AuroraAcquireSpinLock(&q->Lock,&old);
+    Req->Next = NULL;
+    if(q->Tail) q->Tail->Next = Req; else q->Head = Req;
+    q->Tail = Req; q->Depth++;
+    AuroraReleaseSpinLock(&q->Lock,old);
+    return STATUS_SUCCESS;
+}
+
+static UINT32 RamDiskPoll(PAIO_DEVICE_OBJECT Dev, UINT32 Queue, UINT32 Budget){
+    PRAMDISK rd = RdFromDevice(Dev);
+    RD_QUEUE* q; AURORA_IRQL old; PBLOCK_REQUEST batch, r; UINT32 done = 0;
+    if(Queue >= rd->QueueCount || Budget==0) return 0;
+    q = &rd->Queues[Queue];
+    /* Detach up to Budget requests under the lock, then service them unlocked */
+    AuroraAcquireSpinLock(&q->Lock,&old);
+    batch = q->Head; r = NULL;
+    while(q->Head && done<Budget){ r = q->Head; q->Head = r->Next; done++; }
+    if(r) r->Next = NULL;
+    if(!q->Head) q->Tail = NULL;
+    q->Depth -= done;
+    AuroraReleaseSpinLock(&q->Lock,old);
+    while(batch){
+        PBLOCK_REQUEST next = batch->Next;
+        BlockCompleteRequest(batch, RdTransfer(rd,batch->Lba,batch->Count,(UINT8*)batch->Buffer,(batch->Flags & BLOCK_IO_WRITE)!=0));
+        batch = next;
+    }
+    return done;
+}
+
+PAIO_DEVICE_OBJECT RamDiskGetDevice(UINT32 Index){
+    return Index < g_RamDiskCount ? g_RamDiskDevices[Index] : NULL;
+}
+
+static NTSTATUS RdCreateDisk(UINT32 Index, UINT64 Size, UINT32 Queues){
+    PRAMDISK rd = &g_RamDisks[Index];
+    PBLOCK_DEVICE_EXTENSION ext;
+    CHAR name[8] = "ram0";
+    UINT32 i;
+    NTSTATUS st;
+    memset(rd,0,sizeof(*rd));
+    rd->Root = (PVOID*)RdAllocPage();
+    if(!rd->Root) return STATUS_INSUFFICIENT_RESOURCES;
+    rd->SizeBytes = Size;
+    rd->QueueCount = Queues;
+    AuroraInitializeSpinLock(&rd->AllocLock);
+    for(i=0;i<Queues;i++) AuroraInitializeSpinLock(&rd->Queues[i].Lock);
+
+    name[3] = (CHAR)('0' + Index);
+    st = IoCreateDevice(&g_RamDiskDriver,name,(IO_DEVICE_CLASS_BLOCK<<16)|IO_BLOCK_TYPE_RAMDISK,&g_RamDiskDevices[Index]);
+    if(!NT_SUCCESS(st)) return st;
+    ext = (PBLOCK_DEVICE_EXTENSION)AuroraAllocateMemory(sizeof(BLOCK_DEVICE_EXTENSION));
+    if(!ext) return STATUS_INSUFFICIENT_RESOURCES;
+    memset(ext,0,sizeof(*ext));
+    ext->BlockSize = RD_BLOCK_SIZE;
+    ext->BlockCount = Size / RD_BLOCK_SIZE;
+    ext->BlockType = IO_BLOCK_TYPE_RAMDISK;
+    ext->Features = BLOCK_FEATURE_FUA | BLOCK_FEATURE_FLUSH;
+    ext->CacheMode = BLOCK_CACHE_NONE; /* caching RAM in RAM only costs copies */
+    ext->QueueCount = Queues;
+    ext->DriverContext = rd;
+    g_RamDiskDevices[Index]->DeviceExtension = ext;
+    AuroraDebugPrint("[ramdisk] %s %u MiB, %u queues", name, (UINT32)(Size>>20), Queues);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS RamDiskInitialize(void){
+    CHAR val[32];
+    UINT64 size = RD_DEFAULT_SIZE;
+    UINT32 queues = 0, count = 1, i;
+    NTSTATUS st;
+    if(g_RamDiskCount) return STATUS_SUCCESS;
+    if(AuroraGetBootParameter("ramdisk_size",val,sizeof(val))) size = AuroraParseSize(val,RD_DEFAULT_SIZE);
+    if(AuroraGetBootParameter("ramdisk_queues",val,sizeof(val))) queues = (UINT32)AuroraParseSize(val,0);
+    if(AuroraGetBootParameter("ramdisk_count",val,sizeof(val))) count = (UINT32)AuroraParseSize(val,1);
+    size &= ~(UINT64)(RD_BLOCK_SIZE-1);
+    if(size==0) return STATUS_INVALID_PARAMETER;
+    if(size > RD_MAX_PAGES*RD_PAGE_SIZE) size = RD_MAX_PAGES*RD_PAGE_SIZE;
+    if(queues==0) queues = HalGetProcessorCount(); /* one queue per CPU by default */
+    if(queues > RD_MAX_QUEUES) queues = RD_MAX_QUEUES;
+    if(count==0) count = 1;
+    if(count > RD_MAX_DISKS) count = RD_MAX_DISKS;
+
+    IoDriverInitialize(&g_RamDiskDriver,"ramdisk");
+    BlockRegisterRwHandler(IO_BLOCK_TYPE_RAMDISK,RamDiskRwHandler);
+    BlockRegisterFlushHandler(IO_BLOCK_TYPE_RAMDISK,RamDiskFlushHandler);
+    BlockRegisterQueueHandlers(IO_BLOCK_TYPE_RAMDISK,RamDiskSubmit,RamDiskPoll);
+    for(i=0;i<count;i++){
+        st = RdCreateDisk(i,size,queues);
+        if(!NT_SUCCESS(st)) return i ? STATUS_SUCCESS : st; /* keep the disks that were created */
+        g_RamDiskCount = i + 1;
+    }
+    return STATUS_SUCCESS;
+}
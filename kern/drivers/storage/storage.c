@@ -7,6 +7,7 @@
 #include "../../../include/mem.h"
 #include "../../../include/io.h"
 #include "../../../include/hal.h"
+#include "../../../include/kern/virtio.h"
 
 // Storage Constants
 #define MAX_STORAGE_DEVICES     32
@@ -227,6 +228,7 @@ typedef struct _stor_req {
     PVOID  buffer;
     int write;
     volatile int done;
+    NTSTATUS status;
     struct _stor_req* next;
 } stor_req_t;
 
@@ -234,7 +236,7 @@ typedef struct _stor_priv {
     AURORA_SPINLOCK lock;
     stor_req_t* head; stor_req_t* tail;
     aur_block_geometry_t geo;
-    UINT8* backing; /* simple in-memory backing store */
+    PAIO_DEVICE_OBJECT backing; /* block device behind this node (ram0) */
     storage_device_t *modern_device; /* Link to modern device structure */
 } stor_priv_t;
 
@@ -253,6 +255,12 @@ extern void aur_storage_cache_flush(uint32_t cache_type);
 extern void aur_storage_dma_setup(uint64_t src, uint64_t dst, uint32_t size);
 extern void aur_storage_nvme_doorbell(void *doorbell, uint32_t value);
 
+// CRC32C for data integrity: raw register seeded with 0, no final inversion.
+// Goes through the runtime so CPUs without SSE4.2 fall back to tables.
+uint32_t aur_storage_crc32(const void *data, uint64_t length) {
+    return ~AuroraCrc32(AuroraCrcCastagnoli, 0xFFFFFFFF, data, length);
+}
+
 // Forward declarations
 static int nvme_init_device(storage_device_t *device, void *bar0);
 static int ahci_init_device(storage_device_t *device, void *abar);
@@ -520,10 +528,7 @@ static stor_req_t* queue_pop(stor_priv_t* p){
 }
 
 static void process_one(stor_priv_t* p, stor_req_t* r){
-    UINT64 off = r->lba * p->geo.block_size;
-    UINT64 bytes = (UINT64)r->count * p->geo.block_size;
-    if(r->write) memcpy(p->backing+off, r->buffer, bytes); else memcpy(r->buffer, p->backing+off, bytes);
-    // aur_mem_fence(); 
+    r->status = r->write ? BlockWrite(p->backing, r->lba, r->count, r->buffer) : BlockRead(p->backing, r->lba, r->count, r->buffer);
     r->done=1;
 }
 
@@ -534,9 +539,9 @@ static INT64 drv_storage_rw(aur_device_t* dev, void* buf, size_t size, UINT64 of
     if(size==0) return 0; if(off % priv->geo.block_size) return -1;
     UINT32 blocks = (UINT32)(size / priv->geo.block_size);
     if(blocks==0) return -1;
-    stor_req_t req; req.lba = off / priv->geo.block_size; req.count=blocks; req.buffer=buf; req.write=write; req.done=0; req.next=NULL;
-    queue_push(priv,&req); process_all(priv); /* synchronous poll */
-    while(!req.done) { /* spin */ }
+    stor_req_t req; req.lba = off / priv->geo.block_size; req.count=blocks; req.buffer=buf; req.write=write; req.done=0; req.status=STATUS_PENDING; req.next=NULL;
+    queue_push(priv,&req); process_all(priv); /* block layer completes synchronously */
+    if(!NT_SUCCESS(req.status)) return -1;
     return (INT64)(blocks * priv->geo.block_size);
 }
 
@@ -551,16 +556,20 @@ static aur_status_t drv_storage_ioctl(aur_device_t* dev, UINT32 code, void* inou
     stor_priv_t* p=(stor_priv_t*)dev->drvdata;
     if(code==AUR_IOCTL_GET_BLOCK_SIZE){ *(UINT32*)inout = p->geo.block_size; return AUR_OK; }
     if(code==AUR_IOCTL_GET_DISK_SIZE){ *(UINT64*)inout = p->geo.total_bytes; return AUR_OK; }
+    if(code==AUR_IOCTL_FLUSH_CACHE){ process_all(p); aur_storage_barrier(); return NT_SUCCESS(BlockFlush(p->backing)) ? AUR_OK : AUR_ERR_IO; }
     return AUR_ERR_UNSUPPORTED;
 }
 
 static aur_status_t drv_storage_probe(aur_device_t* dev){
-    static UINT8 backing_store[4*1024*1024]; /* 4 MiB */
+    PAIO_DEVICE_OBJECT ram = RamDiskGetDevice(0);
+    PBLOCK_DEVICE_EXTENSION rext;
+    if(!ram || !ram->DeviceExtension) return AUR_ERR_NOT_FOUND;
+    rext = (PBLOCK_DEVICE_EXTENSION)ram->DeviceExtension;
     stor_priv_t* priv = (stor_priv_t*)AuroraAllocateMemory(sizeof(stor_priv_t));
     if(!priv) return AUR_ERR_NOMEM; memset(priv,0,sizeof(*priv));
     AuroraInitializeSpinLock(&priv->lock);
-    priv->geo.block_size = 512; priv->geo.total_bytes = sizeof(backing_store);
-    priv->backing = backing_store;
+    priv->geo.block_size = rext->BlockSize; priv->geo.total_bytes = rext->BlockCount * rext->BlockSize;
+    priv->backing = ram;
     
     // Initialize modern storage device if available
     if (device_count < MAX_STORAGE_DEVICES) {
@@ -568,8 +577,8 @@ static aur_status_t drv_storage_probe(aur_device_t* dev){
         modern_device->id = device_count;
         strncpy(modern_device->name, dev->name, sizeof(modern_device->name)-1);
         strcpy(modern_device->model, "Aurora Legacy Storage");
-        modern_device->capacity = sizeof(backing_store);
-        modern_device->block_size = 512;
+        modern_device->capacity = priv->geo.total_bytes;
+        modern_device->block_size = priv->geo.block_size;
         modern_device->online = true;
         modern_device->readonly = false;
         modern_device->type = STORAGE_TYPE_UNKNOWN;
@@ -609,6 +618,15 @@ void StorageDriverInitialize(void){
     // Initialize request pool
     memset(io_request_pool, 0, sizeof(io_request_pool));
     
+    // Sparse RAM disk backs the legacy aurblk0 node
+    RamDiskInitialize();
+    
+    // raid=0|1|5 assembles md0 over the RAM disks
+    RaidInitialize();
+    
+    // Paravirtual disks (needs the PCI scan from PCIDriverInitialize)
+    VirtioBlkInitialize();
+    
     // Register legacy driver
     aur_driver_register(&g_storage_driver);
     memset(&g_storage_device,0,sizeof(g_storage_device));
@@ -616,6 +634,13 @@ void StorageDriverInitialize(void){
     g_storage_device.driver = &g_storage_driver;
     if(drv_storage_probe(&g_storage_device)==AUR_OK){ aur_device_add(&g_storage_device); }
     
+    // blkbench=1 on the command line runs the block benchmark against ram0
+    {
+        CHAR bench[8];
+        if(AuroraGetBootParameter("blkbench",bench,sizeof(bench)) && bench[0]!='0' && RamDiskGetDevice(0))
+            BlockBenchRunStandardSuite(RamDiskGetDevice(0));
+    }
+    
     // Initialize modern storage subsystem
     // This would typically scan PCI bus for NVMe/AHCI controllers
     
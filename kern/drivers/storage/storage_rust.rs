@@ -1,9 +1,17 @@
 // Aurora Storage Driver - Rust Module
 // High-level storage abstractions and advanced features
+//
+// Built as a no_std static library (see RUST_STORAGE_LIB in the top-level
+// Makefile) and linked into the kernel; C reaches it through the
+// storage_rust_* functions at the bottom of this file.
 
+#![no_std]
+
+use core::alloc::{GlobalAlloc, Layout};
 use core::ptr;
 use core::mem;
-use core::slice;
+use core::ffi::c_void;
+use core::sync::atomic::{AtomicU32, AtomicU64, Ordering};
 
 // Storage device types
 #[repr(C)]
@@ -77,7 +85,7 @@ pub struct IoRequest {
 
 // Storage statistics
 #[repr(C)]
-#[derive(Debug, Default)]
+#[derive(Debug, Default, Clone)]
 pub struct StorageStats {
     pub read_operations: u64,
     pub write_operations: u64,
@@ -206,7 +214,7 @@ pub struct StorageManager {
 impl StorageManager {
     pub fn new() -> Self {
         Self {
-            devices: [None; 16],
+            devices: [const { None }; 16],
             device_count: 0,
         }
     }
@@ -272,39 +280,290 @@ pub enum RaidLevel {
     Raid10 = 5,
 }
 
+// Block layer interface (include/io.h). Members are block devices
+// (PAIO_DEVICE_OBJECT) driven through the multi-queue submit/poll API, so a
+// request that spans several members is in flight on all of them at once.
+type NtStatus = u32;
+
+const STATUS_SUCCESS: NtStatus = 0x0000_0000;
+const STATUS_INVALID_PARAMETER: NtStatus = 0xC000_000D;
+const STATUS_INSUFFICIENT_RESOURCES: NtStatus = 0xC000_009A;
+const STATUS_NOT_SUPPORTED: NtStatus = 0xC000_00BB;
+const STATUS_IO_DEVICE_ERROR: NtStatus = 0xC000_0185;
+
+const BLOCK_IO_WRITE: u32 = 0x0000_0001;
+const BLOCK_IO_FUA: u32 = 0x0000_0002;
+
+#[repr(C)]
+pub struct BlockRequest {
+    lba: u64,
+    count: u32,
+    flags: u32,
+    buffer: *mut c_void,
+    status: NtStatus,
+    queue: u32,
+    submit_time: u64,
+    complete_time: u64,
+    complete: Option<extern "C" fn(*mut BlockRequest)>,
+    context: *mut c_void,
+    device: *mut c_void,
+    next: *mut BlockRequest,
+}
+
+// HAL_SIMD_STATE (include/hal.h)
+#[repr(C, align(16))]
+struct HalSimdState {
+    fx_area: [u8; 512],
+    cr0: u64,
+    interrupts: u32,
+}
+
+extern "C" {
+    fn BlockSubmitRequest(dev: *mut c_void, req: *mut BlockRequest) -> NtStatus;
+    fn BlockPollCompletions(dev: *mut c_void, budget: u32) -> u32;
+    fn BlockFlush(dev: *mut c_void) -> NtStatus;
+    fn HalSimdBegin(state: *mut HalSimdState);
+    fn HalSimdEnd(state: *mut HalSimdState);
+    fn HalCpuPause();
+}
+
+const RAID_MAX_MEMBERS: usize = 8;
+const RAID_BATCH: usize = 32;
+const RAID_STRIPE_CACHE: usize = 8;
+const RAID_DEFAULT_CHUNK: u32 = 64 * 1024;
+const RAID_SIMD_MIN: usize = 1024; // below this the FPU save costs more than it wins
+const STRIPE_NONE: u64 = u64::MAX;
+
+// XOR of srcs into dst (dst = srcs[0] ^ srcs[1] ^ ...). Used for RAID5
+// parity and reconstruction; dst may alias one of the sources.
+fn xor_blocks(dst: *mut u8, srcs: &[*const u8], len: usize) {
+    let mut done = 0;
+    if srcs.is_empty() {
+        return;
+    }
+    #[cfg(target_arch = "x86_64")]
+    {
+        if len >= RAID_SIMD_MIN {
+            done = len & !63;
+            unsafe {
+                let mut state: HalSimdState = mem::zeroed();
+                HalSimdBegin(&mut state);
+                xor_blocks_sse2(dst, srcs, done);
+                HalSimdEnd(&mut state);
+            }
+        }
+    }
+    // Scalar tail (and the whole buffer on small requests)
+    while done + 8 <= len {
+        unsafe {
+            let mut v = ptr::read_unaligned(srcs[0].add(done) as *const u64);
+            for s in &srcs[1..] {
+                v ^= ptr::read_unaligned(s.add(done) as *const u64);
+            }
+            ptr::write_unaligned(dst.add(done) as *mut u64, v);
+        }
+        done += 8;
+    }
+    while done < len {
+        unsafe {
+            let mut v = *srcs[0].add(done);
+            for s in &srcs[1..] {
+                v ^= *s.add(done);
+            }
+            *dst.add(done) = v;
+        }
+        done += 1;
+    }
+}
+
+// Four 16-byte lanes per iteration; only called between HalSimdBegin/End
+#[cfg(target_arch = "x86_64")]
+#[target_feature(enable = "sse2")]
+unsafe fn xor_blocks_sse2(dst: *mut u8, srcs: &[*const u8], len: usize) {
+    use core::arch::x86_64::{__m128i, _mm_loadu_si128, _mm_storeu_si128, _mm_xor_si128};
+    let mut off = 0;
+    while off < len {
+        let p = srcs[0].add(off) as *const __m128i;
+        let mut a = _mm_loadu_si128(p);
+        let mut b = _mm_loadu_si128(p.add(1));
+        let mut c = _mm_loadu_si128(p.add(2));
+        let mut d = _mm_loadu_si128(p.add(3));
+        for s in &srcs[1..] {
+            let q = s.add(off) as *const __m128i;
+            a = _mm_xor_si128(a, _mm_loadu_si128(q));
+            b = _mm_xor_si128(b, _mm_loadu_si128(q.add(1)));
+            c = _mm_xor_si128(c, _mm_loadu_si128(q.add(2)));
+            d = _mm_xor_si128(d, _mm_loadu_si128(q.add(3)));
+        }
+        let o = dst.add(off) as *mut __m128i;
+        _mm_storeu_si128(o, a);
+        _mm_storeu_si128(o.add(1), b);
+        _mm_storeu_si128(o.add(2), c);
+        _mm_storeu_si128(o.add(3), d);
+        off += 64;
+    }
+}
+
+fn alloc_zeroed(len: usize) -> Option<Vec<u8>> {
+    let mut v = Vec::new();
+    v.try_reserve_exact(len).ok()?;
+    v.resize(len, 0);
+    Some(v)
+}
+
+pub struct RaidMember {
+    dev: *mut c_void,
+    blocks: u64,
+    failed: bool,
+    inflight: AtomicU32, // requests outstanding on this member
+    head: AtomicU64,     // LBA just past the last request (approximate head position)
+}
+
+impl RaidMember {
+    const EMPTY: RaidMember = RaidMember {
+        dev: ptr::null_mut(),
+        blocks: 0,
+        failed: false,
+        inflight: AtomicU32::new(0),
+        head: AtomicU64::new(0),
+    };
+}
+
+// Member requests issued together and reaped together
+struct MemberBatch {
+    reqs: [BlockRequest; RAID_BATCH],
+    member: [u8; RAID_BATCH],
+    inflight: [*const AtomicU32; RAID_BATCH], // the member counter each request holds
+    len: usize,
+    pending: AtomicU32,
+}
+
+impl MemberBatch {
+    fn new() -> Self {
+        // All-zero is a valid BlockRequest (null pointers, no callback)
+        unsafe { mem::zeroed() }
+    }
+
+    fn is_full(&self) -> bool {
+        self.len == RAID_BATCH
+    }
+
+    fn push(&mut self, member: usize, lba: u64, count: u32, buf: *mut u8, flags: u32) {
+        let req = &mut self.reqs[self.len];
+        req.lba = lba;
+        req.count = count;
+        req.flags = flags;
+        req.buffer = buf as *mut c_void;
+        self.member[self.len] = member as u8;
+        self.len += 1;
+    }
+}
+
+// Completion: the context is the batch, the request's slot in it names the
+// member whose in-flight count drops
+extern "C" fn raid_request_done(req: *mut BlockRequest) {
+    unsafe {
+        let b = (*req).context as *const MemberBatch;
+        let i = req.offset_from((*b).reqs.as_ptr()) as usize;
+        (*(*b).inflight[i]).fetch_sub(1, Ordering::Relaxed);
+        (*b).pending.fetch_sub(1, Ordering::AcqRel);
+    }
+}
+
+// RAID5 stripe cache entry: the data chunks of one stripe in logical order.
+// Partial writes accumulate here until the stripe is complete (or evicted or
+// flushed), so parity is always computed from a whole stripe and never by
+// read-modify-write of old data and old parity.
+struct StripeEntry {
+    stripe: u64,
+    data: Vec<u8>,
+    valid: Vec<u64>, // one bit per block
+    dirty: bool,
+    last_use: u64,
+}
+
+impl StripeEntry {
+    const fn new() -> Self {
+        Self { stripe: STRIPE_NONE, data: Vec::new(), valid: Vec::new(), dirty: false, last_use: 0 }
+    }
+
+    fn is_valid(&self, block: u64) -> bool {
+        self.valid[(block / 64) as usize] & (1u64 << (block % 64)) != 0
+    }
+
+    fn set_valid(&mut self, start: u64, count: u64) {
+        for b in start..start + count {
+            self.valid[(b / 64) as usize] |= 1u64 << (b % 64);
+        }
+    }
+
+    fn all_valid(&self, start: u64, count: u64) -> bool {
+        (start..start + count).all(|b| self.is_valid(b))
+    }
+}
+
 pub struct RaidArray {
     level: RaidLevel,
-    devices: [Option<usize>; 8], // Device IDs
+    members: [RaidMember; RAID_MAX_MEMBERS],
     device_count: usize,
-    stripe_size: u32,
-    total_capacity: u64,
+    stripe_size: u32,    // chunk size in bytes per member
+    total_capacity: u64, // in blocks
+    block_size: u32,
+    chunk_blocks: u64,
+    stripe_cache: Vec<StripeEntry>,
+    cache_clock: u64,
+    parity: Vec<u8>,  // one chunk
+    rebuild: Vec<u8>, // one chunk per member, for reconstruction
+    fill: Vec<u8>,    // one stripe of data, for completing partial stripes
 }
 
 impl RaidArray {
     pub fn new(level: RaidLevel, stripe_size: u32) -> Self {
         Self {
             level,
-            devices: [None; 8],
+            members: [RaidMember::EMPTY; RAID_MAX_MEMBERS],
             device_count: 0,
-            stripe_size,
+            stripe_size: if stripe_size == 0 { RAID_DEFAULT_CHUNK } else { stripe_size },
             total_capacity: 0,
+            block_size: 0,
+            chunk_blocks: 0,
+            stripe_cache: Vec::new(),
+            cache_clock: 0,
+            parity: Vec::new(),
+            rebuild: Vec::new(),
+            fill: Vec::new(),
         }
     }
 
-    pub fn add_device(&mut self, device_id: usize) -> Result<(), i32> {
-        if self.device_count >= 8 {
+    // Members are added before the array is used; geometry is fixed by then
+    pub fn add_member(&mut self, dev: *mut c_void, blocks: u64, block_size: u32) -> Result<(), i32> {
+        if self.device_count >= RAID_MAX_MEMBERS {
             return Err(-1);
         }
-
-        for slot in &mut self.devices {
-            if slot.is_none() {
-                *slot = Some(device_id);
-                self.device_count += 1;
-                return Ok(());
+        if dev.is_null() || block_size == 0 || blocks == 0 {
+            return Err(-2);
+        }
+        if self.device_count == 0 {
+            if self.stripe_size % block_size != 0 {
+                return Err(-3);
             }
+            self.block_size = block_size;
+            self.chunk_blocks = (self.stripe_size / block_size) as u64;
+        } else if block_size != self.block_size {
+            return Err(-3);
         }
 
-        Err(-2)
+        let m = &mut self.members[self.device_count];
+        m.dev = dev;
+        m.blocks = blocks;
+        m.failed = false;
+        self.device_count += 1;
+
+        let smallest = self.members[..self.device_count].iter().map(|m| m.blocks).min().unwrap_or(0);
+        let per_member = if self.level == RaidLevel::Raid1 { smallest } else { smallest / self.chunk_blocks * self.chunk_blocks };
+        self.total_capacity = self.calculate_capacity(per_member);
+        self.stripe_cache.clear();
+        Ok(())
     }
 
     pub fn calculate_capacity(&mut self, device_capacity: u64) -> u64 {
@@ -317,6 +576,556 @@ impl RaidArray {
             _ => device_capacity,
         }
     }
+
+    pub fn capacity(&self) -> u64 {
+        self.total_capacity
+    }
+
+    fn failed_count(&self) -> usize {
+        self.members[..self.device_count].iter().filter(|m| m.failed).count()
+    }
+
+    fn fail_members(&mut self, mask: u32) {
+        for m in 0..self.device_count {
+            if mask & (1 << m) != 0 {
+                self.members[m].failed = true;
+            }
+        }
+    }
+
+    // Submit every request of the batch, then poll the members involved until
+    // all have completed. Returns a mask of members whose requests failed.
+    fn run_batch(&self, b: &mut MemberBatch) -> u32 {
+        let mut used: u32 = 0;
+        let mut failed: u32 = 0;
+        if b.len == 0 {
+            return 0;
+        }
+        b.pending.store(b.len as u32, Ordering::Release);
+        let ctx = b as *mut MemberBatch as *mut c_void;
+        for i in 0..b.len {
+            let m = b.member[i] as usize;
+            let counter = &self.members[m].inflight;
+            b.inflight[i] = counter;
+            let req = &mut b.reqs[i] as *mut BlockRequest;
+            unsafe {
+                (*req).complete = Some(raid_request_done);
+                (*req).context = ctx;
+            }
+            used |= 1 << m;
+            counter.fetch_add(1, Ordering::Relaxed);
+            let st = unsafe { BlockSubmitRequest(self.members[m].dev, req) };
+            if st != STATUS_SUCCESS {
+                // Rejected before it was queued: the completion never runs
+                unsafe { (*req).status = st };
+                counter.fetch_sub(1, Ordering::Relaxed);
+                b.pending.fetch_sub(1, Ordering::AcqRel);
+            }
+        }
+        while b.pending.load(Ordering::Acquire) != 0 {
+            for m in 0..self.device_count {
+                if used & (1 << m) != 0 {
+                    unsafe { BlockPollCompletions(self.members[m].dev, RAID_BATCH as u32) };
+                }
+            }
+            unsafe { HalCpuPause() };
+        }
+        for i in 0..b.len {
+            let m = b.member[i] as usize;
+            let req = &b.reqs[i];
+            self.members[m].head.store(req.lba + req.count as u64, Ordering::Relaxed);
+            if req.status != STATUS_SUCCESS {
+                failed |= 1 << m;
+            }
+        }
+        b.len = 0;
+        failed
+    }
+
+    fn check_range(&self, lba: u64, count: u32, buf: *const u8) -> NtStatus {
+        if buf.is_null() || count == 0 || lba >= self.total_capacity || count as u64 > self.total_capacity - lba {
+            return STATUS_INVALID_PARAMETER;
+        }
+        let ready = match self.level {
+            RaidLevel::Raid0 => self.device_count >= 1,
+            RaidLevel::Raid1 => self.device_count >= 2,
+            RaidLevel::Raid5 => self.device_count >= 3,
+            _ => return STATUS_NOT_SUPPORTED,
+        };
+        if ready { STATUS_SUCCESS } else { STATUS_INVALID_PARAMETER }
+    }
+
+    pub fn read(&mut self, lba: u64, count: u32, buf: *mut u8) -> NtStatus {
+        let st = self.check_range(lba, count, buf);
+        if st != STATUS_SUCCESS {
+            return st;
+        }
+        match self.level {
+            RaidLevel::Raid0 => self.raid0_io(lba, count, buf, 0),
+            RaidLevel::Raid1 => self.raid1_read(lba, count, buf),
+            _ => self.raid5_read(lba, count, buf),
+        }
+    }
+
+    pub fn write(&mut self, lba: u64, count: u32, buf: *const u8, flags: u32) -> NtStatus {
+        let st = self.check_range(lba, count, buf);
+        if st != STATUS_SUCCESS {
+            return st;
+        }
+        let flags = flags | BLOCK_IO_WRITE;
+        match self.level {
+            RaidLevel::Raid0 => self.raid0_io(lba, count, buf as *mut u8, flags),
+            RaidLevel::Raid1 => self.raid1_write(lba, count, buf, flags),
+            _ => self.raid5_write(lba, count, buf, flags),
+        }
+    }
+
+    // Write back any partial RAID5 stripes, then flush every member
+    pub fn flush(&mut self) -> NtStatus {
+        let mut result = STATUS_SUCCESS;
+        for i in 0..self.stripe_cache.len() {
+            let st = self.r5_flush_entry(i, 0);
+            if st != STATUS_SUCCESS {
+                result = st;
+            }
+        }
+        for m in 0..self.device_count {
+            if !self.members[m].failed && unsafe { BlockFlush(self.members[m].dev) } != STATUS_SUCCESS {
+                result = STATUS_IO_DEVICE_ERROR;
+            }
+        }
+        result
+    }
+
+    // RAID0: split at chunk boundaries, one member request per chunk piece
+    fn raid0_io(&mut self, lba: u64, count: u32, buf: *mut u8, flags: u32) -> NtStatus {
+        let n = self.device_count as u64;
+        let cb = self.chunk_blocks;
+        let bs = self.block_size as usize;
+        let mut b = MemberBatch::new();
+        let mut lba = lba;
+        let mut left = count as u64;
+        let mut p = buf;
+        while left > 0 {
+            let chunk = lba / cb;
+            let off = lba % cb;
+            let run = core::cmp::min(cb - off, left);
+            if b.is_full() && self.run_batch(&mut b) != 0 {
+                return STATUS_IO_DEVICE_ERROR;
+            }
+            b.push((chunk % n) as usize, (chunk / n) * cb + off, run as u32, p, flags);
+            lba += run;
+            left -= run;
+            p = unsafe { p.add(run as usize * bs) };
+        }
+        if self.run_batch(&mut b) != 0 {
+            return STATUS_IO_DEVICE_ERROR;
+        }
+        STATUS_SUCCESS
+    }
+
+    // RAID1 read balancing: the mirror with the fewest requests in flight or
+    // already queued in this batch, ties going to the one whose last request
+    // ended nearest this LBA
+    fn pick_mirror(&self, lba: u64, queued: &[u32; RAID_MAX_MEMBERS]) -> Option<usize> {
+        let mut best: Option<(u32, u64, usize)> = None;
+        for m in 0..self.device_count {
+            let member = &self.members[m];
+            if member.failed {
+                continue;
+            }
+            let load = member.inflight.load(Ordering::Relaxed) + queued[m];
+            let dist = member.head.load(Ordering::Relaxed).abs_diff(lba);
+            if best.map_or(true, |(l, d, _)| (load, dist) < (l, d)) {
+                best = Some((load, dist, m));
+            }
+        }
+        best.map(|(_, _, m)| m)
+    }
+
+    // Reads are cut into chunks spread over the healthy mirrors and issued as
+    // one batch, so a large read keeps every mirror busy at once
+    fn raid1_read(&mut self, lba: u64, count: u32, buf: *mut u8) -> NtStatus {
+        let bs = self.block_size as usize;
+        let cb = self.chunk_blocks;
+        loop {
+            let mut b = MemberBatch::new();
+            let mut queued = [0u32; RAID_MAX_MEMBERS];
+            let mut failed: u32 = 0;
+            let mut at = lba;
+            let end = lba + count as u64;
+            let mut p = buf;
+            while at < end {
+                let m = match self.pick_mirror(at, &queued) {
+                    Some(m) => m,
+                    None => return STATUS_IO_DEVICE_ERROR,
+                };
+                let run = cb.min(end - at);
+                b.push(m, at, run as u32, p, 0);
+                queued[m] += 1;
+                at += run;
+                p = unsafe { p.add(run as usize * bs) };
+                if b.is_full() {
+                    failed |= self.run_batch(&mut b);
+                    queued = [0; RAID_MAX_MEMBERS];
+                }
+            }
+            failed |= self.run_batch(&mut b);
+            if failed == 0 {
+                return STATUS_SUCCESS;
+            }
+            // Drop the failed mirrors and read the whole range again from the rest
+            self.fail_members(failed);
+        }
+    }
+
+    fn raid1_write(&mut self, lba: u64, count: u32, buf: *const u8, flags: u32) -> NtStatus {
+        let mut b = MemberBatch::new();
+        let mut targets: u32 = 0;
+        for m in 0..self.device_count {
+            if !self.members[m].failed {
+                b.push(m, lba, count, buf as *mut u8, flags);
+                targets |= 1 << m;
+            }
+        }
+        if targets == 0 {
+            return STATUS_IO_DEVICE_ERROR;
+        }
+        let failed = self.run_batch(&mut b);
+        self.fail_members(failed);
+        if failed == targets { STATUS_IO_DEVICE_ERROR } else { STATUS_SUCCESS }
+    }
+
+    // RAID5, left-symmetric: parity rotates down from the last member and the
+    // data chunks of a stripe start on the member after the parity chunk.
+    // Returns (data member, parity member).
+    fn r5_members(&self, stripe: u64, d: u64) -> (usize, usize) {
+        let n = self.device_count as u64;
+        let p = (n - 1) - stripe % n;
+        (((p + 1 + d) % n) as usize, p as usize)
+    }
+
+    fn data_disks(&self) -> u64 {
+        self.device_count as u64 - 1
+    }
+
+    fn chunk_bytes(&self) -> usize {
+        self.chunk_blocks as usize * self.block_size as usize
+    }
+
+    fn r5_buffers(&mut self) -> NtStatus {
+        let chunk = self.chunk_bytes();
+        let n = self.device_count;
+        if self.parity.len() != chunk {
+            match (alloc_zeroed(chunk), alloc_zeroed(chunk * n), alloc_zeroed(chunk * (n - 1))) {
+                (Some(p), Some(r), Some(f)) => {
+                    self.parity = p;
+                    self.rebuild = r;
+                    self.fill = f;
+                }
+                _ => return STATUS_INSUFFICIENT_RESOURCES,
+            }
+        }
+        if self.stripe_cache.is_empty() {
+            if self.stripe_cache.try_reserve_exact(RAID_STRIPE_CACHE).is_err() {
+                return STATUS_INSUFFICIENT_RESOURCES;
+            }
+            for _ in 0..RAID_STRIPE_CACHE {
+                self.stripe_cache.push(StripeEntry::new());
+            }
+        }
+        STATUS_SUCCESS
+    }
+
+    fn r5_cache_find(&self, stripe: u64) -> Option<usize> {
+        self.stripe_cache.iter().position(|e| e.stripe == stripe)
+    }
+
+    // Rebuild blocks [off, off+run) of data chunk d on a failed member from
+    // the same range of every surviving member
+    fn r5_rebuild(&mut self, stripe: u64, d: u64, off: u64, run: u64, dst: *mut u8) -> NtStatus {
+        let (target, _) = self.r5_members(stripe, d);
+        let bytes = run as usize * self.block_size as usize;
+        let chunk = self.chunk_bytes();
+        let mut srcs: [*const u8; RAID_MAX_MEMBERS] = [ptr::null(); RAID_MAX_MEMBERS];
+        let mut nsrc = 0;
+        let mut b = MemberBatch::new();
+        for m in 0..self.device_count {
+            if m == target {
+                continue;
+            }
+            if self.members[m].failed {
+                return STATUS_IO_DEVICE_ERROR; // second failure: data is lost
+            }
+            let p = unsafe { self.rebuild.as_mut_ptr().add(nsrc * chunk) };
+            b.push(m, stripe * self.chunk_blocks + off, run as u32, p, 0);
+            srcs[nsrc] = p;
+            nsrc += 1;
+        }
+        let failed = self.run_batch(&mut b);
+        if failed != 0 {
+            self.fail_members(failed);
+            return STATUS_IO_DEVICE_ERROR;
+        }
+        xor_blocks(dst, &srcs[..nsrc], bytes);
+        STATUS_SUCCESS
+    }
+
+    fn raid5_read(&mut self, lba: u64, count: u32, buf: *mut u8) -> NtStatus {
+        let st = self.r5_buffers();
+        if st != STATUS_SUCCESS {
+            return st;
+        }
+        let sb = self.data_disks() * self.chunk_blocks;
+        let bs = self.block_size as usize;
+        let mut lba = lba;
+        let mut left = count as u64;
+        let mut p = buf;
+        while left > 0 {
+            let run = core::cmp::min(sb - lba % sb, left);
+            let st = self.r5_read_stripe(lba / sb, lba % sb, run, p);
+            if st != STATUS_SUCCESS {
+                return st;
+            }
+            lba += run;
+            left -= run;
+            p = unsafe { p.add(run as usize * bs) };
+        }
+        STATUS_SUCCESS
+    }
+
+    fn r5_read_stripe(&mut self, stripe: u64, start: u64, count: u64, dst: *mut u8) -> NtStatus {
+        let bs = self.block_size as usize;
+        let cb = self.chunk_blocks;
+        let cached = self.r5_cache_find(stripe);
+        if let Some(i) = cached {
+            let e = &self.stripe_cache[i];
+            if e.all_valid(start, count) {
+                unsafe { ptr::copy_nonoverlapping(e.data.as_ptr().add(start as usize * bs), dst, count as usize * bs) };
+                return STATUS_SUCCESS;
+            }
+        }
+
+        // One request per chunk piece, all members at once; pieces on a
+        // failed member are rebuilt afterwards
+        let mut b = MemberBatch::new();
+        let mut lost: Option<(u64, u64, u64, *mut u8)> = None;
+        let mut pos = start;
+        while pos < start + count {
+            let d = pos / cb;
+            let off = pos % cb;
+            let run = core::cmp::min(cb - off, start + count - pos);
+            let p = unsafe { dst.add((pos - start) as usize * bs) };
+            let (m, _) = self.r5_members(stripe, d);
+            if self.members[m].failed {
+                lost = Some((d, off, run, p));
+            } else {
+                b.push(m, stripe * cb + off, run as u32, p, 0);
+            }
+            pos += run;
+        }
+        let failed = self.run_batch(&mut b);
+        if failed != 0 {
+            self.fail_members(failed);
+            if self.failed_count() > 1 {
+                return STATUS_IO_DEVICE_ERROR;
+            }
+            return self.r5_read_stripe(stripe, start, count, dst);
+        }
+        if let Some((d, off, run, p)) = lost {
+            let st = self.r5_rebuild(stripe, d, off, run, p);
+            if st != STATUS_SUCCESS {
+                return st;
+            }
+        }
+
+        // Blocks still waiting in the stripe cache are newer than the disks
+        if let Some(i) = cached {
+            let e = &self.stripe_cache[i];
+            for blk in start..start + count {
+                if e.is_valid(blk) {
+                    unsafe {
+                        ptr::copy_nonoverlapping(e.data.as_ptr().add(blk as usize * bs), dst.add((blk - start) as usize * bs), bs);
+                    }
+                }
+            }
+        }
+        STATUS_SUCCESS
+    }
+
+    fn raid5_write(&mut self, lba: u64, count: u32, buf: *const u8, flags: u32) -> NtStatus {
+        let st = self.r5_buffers();
+        if st != STATUS_SUCCESS {
+            return st;
+        }
+        let sb = self.data_disks() * self.chunk_blocks;
+        let bs = self.block_size as usize;
+        let mut lba = lba;
+        let mut left = count as u64;
+        let mut p = buf;
+        while left > 0 {
+            let stripe = lba / sb;
+            let start = lba % sb;
+            let run = core::cmp::min(sb - start, left);
+            let st = if start == 0 && run == sb {
+                // Whole stripe: parity comes straight from the caller's data
+                if let Some(i) = self.r5_cache_find(stripe) {
+                    self.stripe_cache[i].stripe = STRIPE_NONE;
+                    self.stripe_cache[i].dirty = false;
+                }
+                self.r5_write_full(stripe, p, flags)
+            } else {
+                self.r5_write_partial(stripe, start, run, p, flags)
+            };
+            if st != STATUS_SUCCESS {
+                return st;
+            }
+            lba += run;
+            left -= run;
+            p = unsafe { p.add(run as usize * bs) };
+        }
+        STATUS_SUCCESS
+    }
+
+    // Compute parity over a full stripe of data and write data and parity to
+    // every member in parallel. A single failed member is tolerated.
+    fn r5_write_full(&mut self, stripe: u64, data: *const u8, flags: u32) -> NtStatus {
+        let dd = self.data_disks();
+        let chunk = self.chunk_bytes();
+        let mut srcs: [*const u8; RAID_MAX_MEMBERS] = [ptr::null(); RAID_MAX_MEMBERS];
+        for d in 0..dd as usize {
+            srcs[d] = unsafe { data.add(d * chunk) };
+        }
+        xor_blocks(self.parity.as_mut_ptr(), &srcs[..dd as usize], chunk);
+
+        let mut b = MemberBatch::new();
+        for d in 0..dd {
+            let (m, _) = self.r5_members(stripe, d);
+            if !self.members[m].failed {
+                b.push(m, stripe * self.chunk_blocks, self.chunk_blocks as u32, srcs[d as usize] as *mut u8, flags);
+            }
+        }
+        let (_, pm) = self.r5_members(stripe, 0);
+        if !self.members[pm].failed {
+            b.push(pm, stripe * self.chunk_blocks, self.chunk_blocks as u32, self.parity.as_mut_ptr(), flags);
+        }
+        let failed = self.run_batch(&mut b);
+        self.fail_members(failed);
+        if self.failed_count() > 1 { STATUS_IO_DEVICE_ERROR } else { STATUS_SUCCESS }
+    }
+
+    fn r5_write_partial(&mut self, stripe: u64, start: u64, count: u64, src: *const u8, flags: u32) -> NtStatus {
+        let bs = self.block_size as usize;
+        let i = match self.r5_cache_slot(stripe) {
+            Ok(i) => i,
+            Err(st) => return st,
+        };
+        let sb = self.data_disks() * self.chunk_blocks;
+        self.cache_clock += 1;
+        let e = &mut self.stripe_cache[i];
+        unsafe { ptr::copy_nonoverlapping(src, e.data.as_mut_ptr().add(start as usize * bs), count as usize * bs) };
+        e.set_valid(start, count);
+        e.dirty = true;
+        e.last_use = self.cache_clock;
+        if e.all_valid(0, sb) || flags & BLOCK_IO_FUA != 0 {
+            return self.r5_flush_entry(i, flags & BLOCK_IO_FUA);
+        }
+        STATUS_SUCCESS
+    }
+
+    // Find the cache entry for stripe, or recycle the least recently used one
+    fn r5_cache_slot(&mut self, stripe: u64) -> Result<usize, NtStatus> {
+        if let Some(i) = self.r5_cache_find(stripe) {
+            return Ok(i);
+        }
+        let mut victim = 0;
+        for (i, e) in self.stripe_cache.iter().enumerate() {
+            if e.stripe == STRIPE_NONE {
+                victim = i;
+                break;
+            }
+            if e.last_use < self.stripe_cache[victim].last_use {
+                victim = i;
+            }
+        }
+        let st = self.r5_flush_entry(victim, 0);
+        if st != STATUS_SUCCESS {
+            return Err(st);
+        }
+        let sb = (self.data_disks() * self.chunk_blocks) as usize;
+        let bytes = sb * self.block_size as usize;
+        let e = &mut self.stripe_cache[victim];
+        if e.data.len() != bytes {
+            let words = (sb + 63) / 64;
+            let mut valid = Vec::new();
+            let data = match alloc_zeroed(bytes) {
+                Some(d) if valid.try_reserve_exact(words).is_ok() => d,
+                _ => return Err(STATUS_INSUFFICIENT_RESOURCES),
+            };
+            valid.resize(words, 0);
+            e.data = data;
+            e.valid = valid;
+        }
+        e.valid.iter_mut().for_each(|w| *w = 0);
+        e.stripe = stripe;
+        e.dirty = false;
+        Ok(victim)
+    }
+
+    // Complete a dirty stripe with the blocks it does not hold (read from the
+    // members, or rebuilt if one has failed) and write it out as a full stripe
+    fn r5_flush_entry(&mut self, i: usize, flags: u32) -> NtStatus {
+        if self.stripe_cache[i].stripe == STRIPE_NONE || !self.stripe_cache[i].dirty {
+            return STATUS_SUCCESS;
+        }
+        let stripe = self.stripe_cache[i].stripe;
+        let dd = self.data_disks();
+        let cb = self.chunk_blocks;
+        let bs = self.block_size as usize;
+        let chunk = self.chunk_bytes();
+        if !self.stripe_cache[i].all_valid(0, dd * cb) {
+            let mut b = MemberBatch::new();
+            let mut lost: Option<u64> = None;
+            for d in 0..dd {
+                if self.stripe_cache[i].all_valid(d * cb, cb) {
+                    continue;
+                }
+                let (m, _) = self.r5_members(stripe, d);
+                let p = unsafe { self.fill.as_mut_ptr().add(d as usize * chunk) };
+                if self.members[m].failed {
+                    lost = Some(d);
+                } else {
+                    b.push(m, stripe * cb, cb as u32, p, 0);
+                }
+            }
+            let failed = self.run_batch(&mut b);
+            if failed != 0 {
+                self.fail_members(failed);
+                return STATUS_IO_DEVICE_ERROR;
+            }
+            if let Some(d) = lost {
+                let p = unsafe { self.fill.as_mut_ptr().add(d as usize * chunk) };
+                let st = self.r5_rebuild(stripe, d, 0, cb, p);
+                if st != STATUS_SUCCESS {
+                    return st;
+                }
+            }
+            let e = &mut self.stripe_cache[i];
+            for blk in 0..dd * cb {
+                if !e.is_valid(blk) {
+                    let o = blk as usize * bs;
+                    e.data[o..o + bs].copy_from_slice(&self.fill[o..o + bs]);
+                }
+            }
+            e.set_valid(0, dd * cb);
+        }
+        let data = self.stripe_cache[i].data.as_ptr();
+        let st = self.r5_write_full(stripe, data, flags | BLOCK_IO_WRITE);
+        if st == STATUS_SUCCESS {
+            self.stripe_cache[i].dirty = false;
+        }
+        st
+    }
 }
 
 // C interface functions
@@ -422,17 +1231,95 @@ pub extern "C" fn storage_rust_destroy_raid(raid: *mut RaidArray) {
     }
 }
 
+#[no_mangle]
+pub extern "C" fn storage_rust_raid_add_member(raid: *mut RaidArray, dev: *mut c_void, blocks: u64, block_size: u32) -> i32 {
+    if raid.is_null() {
+        return -1;
+    }
+
+    unsafe {
+        match (*raid).add_member(dev, blocks, block_size) {
+            Ok(()) => 0,
+            Err(e) => e,
+        }
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn storage_rust_raid_capacity(raid: *const RaidArray) -> u64 {
+    if raid.is_null() {
+        return 0;
+    }
+
+    unsafe { (*raid).capacity() }
+}
+
+// Block I/O on the array; returns an NTSTATUS. Callers serialise access.
+#[no_mangle]
+pub extern "C" fn storage_rust_raid_read(raid: *mut RaidArray, lba: u64, count: u32, buffer: *mut u8) -> u32 {
+    if raid.is_null() {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    unsafe { (*raid).read(lba, count, buffer) }
+}
+
+#[no_mangle]
+pub extern "C" fn storage_rust_raid_write(raid: *mut RaidArray, lba: u64, count: u32, buffer: *const u8, flags: u32) -> u32 {
+    if raid.is_null() {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    unsafe { (*raid).write(lba, count, buffer, flags) }
+}
+
+#[no_mangle]
+pub extern "C" fn storage_rust_raid_flush(raid: *mut RaidArray) -> u32 {
+    if raid.is_null() {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    unsafe { (*raid).flush() }
+}
+
+// core and alloc ship prebuilt with unwinding enabled; under panic=abort nothing
+// unwinds, but the personality routine they reference still has to resolve
+#[no_mangle]
+pub extern "C" fn rust_eh_personality() {}
+
 // Panic handler for no_std environment
 #[panic_handler]
 fn panic(_info: &core::panic::PanicInfo) -> ! {
     loop {}
 }
 
-// Global allocator error handler
-#[alloc_error_handler]
-fn alloc_error_handler(_layout: core::alloc::Layout) -> ! {
-    loop {}
+// Heap for Box/Vec: whole pages from the memory manager. AuroraAllocateMemory
+// is a small bump pool that never frees, which the stripe cache would exhaust.
+extern "C" {
+    fn MemAllocPages(count: usize) -> *mut c_void;
+    fn MemFreePages(base: *mut c_void, count: usize);
 }
 
+const PAGE_SIZE: usize = 4096;
+
+struct KernelPageAllocator;
+
+unsafe impl GlobalAlloc for KernelPageAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        if layout.align() > PAGE_SIZE {
+            return ptr::null_mut();
+        }
+        MemAllocPages((layout.size() + PAGE_SIZE - 1) / PAGE_SIZE) as *mut u8
+    }
+
+    unsafe fn dealloc(&self, p: *mut u8, layout: Layout) {
+        MemFreePages(p as *mut c_void, (layout.size() + PAGE_SIZE - 1) / PAGE_SIZE);
+    }
+}
+
+#[global_allocator]
+static ALLOCATOR: KernelPageAllocator = KernelPageAllocator;
+
 extern crate alloc;
-use alloc::boxed::Box;
\ No newline at end of file
+use alloc::boxed::Box;
+use alloc::vec::Vec;
\ No newline at end of file
@@ -0,0 +1,394 @@
+/* Aurora virtio-blk driver
+ * Binds modern virtio-pci block functions (QEMU -device virtio-blk-pci),
+ * prefers packed virtqueues and falls back to split rings, and opens one
+ * request queue per CPU when VIRTIO_BLK_F_MQ is offered. Each request is
+ * header + data segments + status, normally carried by one indirect
+ * descriptor. Registers as IO_BLOCK_TYPE_VIRTIO_BLK with both the
+ * synchronous rw handler and the multi-queue submit/poll handlers.
+ * Boot parameters: virtio_packed=0 forces split rings, virtio_queues=<n>
+ * caps the queue count. */
+#include "../../../aurora.h"
+#include "../../../include/io.h"
+#include "../../../include/hal.h"
+#include "../../../include/mem.h"
+#include "../../../include/kern/driver.h"
+#include "../../../include/kern/virtio.h"
+
+/* virtio-blk feature bits */
+#define VIRTIO_BLK_F_SIZE_MAX       1
+#define VIRTIO_BLK_F_SEG_MAX        2
+#define VIRTIO_BLK_F_RO             5
+#define VIRTIO_BLK_F_BLK_SIZE       6
+#define VIRTIO_BLK_F_FLUSH          9
+#define VIRTIO_BLK_F_MQ             12
+
+/* struct virtio_blk_config */
+#define VBLK_CFG_CAPACITY           0x00
+#define VBLK_CFG_SIZE_MAX           0x08
+#define VBLK_CFG_SEG_MAX            0x0C
+#define VBLK_CFG_BLK_SIZE           0x14
+#define VBLK_CFG_NUM_QUEUES         0x22
+
+#define VIRTIO_BLK_T_IN             0
+#define VIRTIO_BLK_T_OUT            1
+#define VIRTIO_BLK_T_FLUSH          4
+
+#define VIRTIO_BLK_S_OK             0
+#define VIRTIO_BLK_S_IOERR          1
+#define VIRTIO_BLK_S_UNSUPP         2
+
+#define VBLK_MAX_DEVICES            4
+#define VBLK_MAX_QUEUES             16
+#define VBLK_QUEUE_SIZE             128
+#define VBLK_MAX_SEGS               (VIRTQ_MAX_INDIRECT-2)   /* header and status take two */
+#define VBLK_SEG_BYTES              (256u*1024)
+#define VBLK_SECTOR                 512
+
+typedef struct _VBLK_HDR {
+    UINT32 Type;
+    UINT32 Reserved;
+    UINT64 Sector;
+} VBLK_HDR;
+
+/* DMA-visible per-slot command state; Req is NULL for internal (flush) commands */
+typedef struct _VBLK_CMD {
+    VBLK_HDR Hdr;
+    volatile UINT8 Status;
+    UINT8 Pad[7];
+    PBLOCK_REQUEST Req;
+    volatile BOOL Done;
+} VBLK_CMD;
+
+typedef struct _VBLK_QUEUE {
+    VIRTQUEUE Vq;
+    VBLK_CMD* Cmds;
+    UINT16 FreeCmds[VBLK_QUEUE_SIZE];
+    UINT16 FreeCount;
+    PBLOCK_REQUEST WaitHead, WaitTail;   /* requests waiting for ring space */
+} VBLK_QUEUE;
+
+typedef struct _VBLK_DEVICE {
+    VIRTIO_PCI_DEVICE Vio;
+    PAIO_DEVICE_OBJECT Aio;
+    UINT32 BlockSize;
+    UINT32 SectorsPerBlock;
+    UINT32 MaxSegs;
+    UINT32 SegBytes;
+    BOOL   ReadOnly;
+    UINT32 QueueCount;
+    VBLK_QUEUE Queues[VBLK_MAX_QUEUES];
+} VBLK_DEVICE;
+
+static VBLK_DEVICE* g_VblkDevices[VBLK_MAX_DEVICES];
+static UINT32 g_VblkCount;
+static AIO_DRIVER_OBJECT g_VblkDriver;
+
+#define VBLK_CFG32(d,o)  (*(volatile UINT32*)((d)->Vio.DeviceCfg + (o)))
+#define VBLK_CFG16(d,o)  (*(volatile UINT16*)((d)->Vio.DeviceCfg + (o)))
+
+static VBLK_DEVICE* VblkFromAio(PAIO_DEVICE_OBJECT Dev){
+    PBLOCK_DEVICE_EXTENSION ext = Dev ? (PBLOCK_DEVICE_EXTENSION)Dev->DeviceExtension : NULL;
+    return ext ? (VBLK_DEVICE*)ext->DriverContext : NULL;
+}
+
+/* Build and post one command; called with the queue lock held */
+static NTSTATUS VblkPost(VBLK_DEVICE* d, VBLK_QUEUE* q, PBLOCK_REQUEST Req, UINT32 Type, VBLK_CMD** CmdOut){
+    VIRTQ_SG sg[VIRTQ_MAX_INDIRECT];
+    VBLK_CMD* cmd;
+    UINT32 n = 0, slot;
+    NTSTATUS st;
+    if(!q->FreeCount) return STATUS_INSUFFICIENT_RESOURCES;
+    slot = q->FreeCmds[q->FreeCount-1];
+    cmd = &q->Cmds[slot];
+    cmd->Hdr.Type = Type;
+    cmd->Hdr.Reserved = 0;
+    cmd->Hdr.Sector = Req ? Req->Lba * d->SectorsPerBlock : 0;
+    cmd->Status = 0xFF;
+    cmd->Req = Req;
+    cmd->Done = FALSE;
+    sg[n].Addr = MemGetPhysicalAddress(&cmd->Hdr); sg[n].Len = sizeof(VBLK_HDR); sg[n].DeviceWrites = FALSE; n++;
+    if(Req && Req->Count){
+        UINT8* va = (UINT8*)Req->Buffer;
+        UINT64 left = (UINT64)Req->Count * d->BlockSize;
+        /* The buffer is only virtually contiguous: translate it a page at a
+         * time and grow the last segment while pages stay physically adjacent */
+        while(left){
+            UINT64 pa = MemGetPhysicalAddress(va);
+            UINT32 len = (UINT32)(AURORA_PAGE_SIZE - ((ULONG_PTR)va & AURORA_PAGE_MASK));
+            if(len > left) len = (UINT32)left;
+            va += len; left -= len;
+            while(len){
+                UINT32 take;
+                if(n > 1 && sg[n-1].Addr + sg[n-1].Len == pa && sg[n-1].Len < d->SegBytes){
+                    take = d->SegBytes - sg[n-1].Len;
+                    if(take > len) take = len;
+                    sg[n-1].Len += take;
+                } else {
+                    if(n > d->MaxSegs) return STATUS_INVALID_PARAMETER; /* MaxTransferBlocks keeps us below this */
+                    take = len > d->SegBytes ? d->SegBytes : len;
+                    sg[n].Addr = pa; sg[n].Len = take; sg[n].DeviceWrites = (Type == VIRTIO_BLK_T_IN); n++;
+                }
+                pa += take; len -= take;
+            }
+        }
+    }
+    sg[n].Addr = MemGetPhysicalAddress((PVOID)&cmd->Status); sg[n].Len = 1; sg[n].DeviceWrites = TRUE; n++;
+    st = VirtqAdd(&q->Vq, sg, n, cmd);
+    if(!NT_SUCCESS(st)) return st;
+    q->FreeCount--;
+    if(CmdOut) *CmdOut = cmd;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS VblkStatus(UINT8 Status){
+    if(Status == VIRTIO_BLK_S_OK) return STATUS_SUCCESS;
+    if(Status == VIRTIO_BLK_S_UNSUPP) return STATUS_NOT_SUPPORTED;
+    return STATUS_UNSUCCESSFUL;
+}
+
+/* Reap used buffers, refill from the wait list and complete outside the lock */
+static UINT32 VblkReap(VBLK_DEVICE* d, UINT32 Queue, UINT32 Budget){
+    VBLK_QUEUE* q = &d->Queues[Queue];
+    PBLOCK_REQUEST doneHead = NULL, doneTail = NULL, r;
+    AURORA_IRQL old;
+    UINT32 done = 0;
+    VBLK_CMD* cmd;
+    AuroraAcquireSpinLock(&q->Vq.Lock,&old);
+    while(done < Budget && (cmd = (VBLK_CMD*)VirtqGetUsed(&q->Vq,NULL)) != NULL){
+        q->FreeCmds[q->FreeCount++] = (UINT16)(cmd - q->Cmds);
+        if(cmd->Req){
+            cmd->Req->Status = VblkStatus(cmd->Status);
+            cmd->Req->Next = NULL;
+            if(doneTail) doneTail->Next = cmd->Req; else doneHead = cmd->Req;
+            doneTail = cmd->Req;
+            done++;
+        }
+        cmd->Done = TRUE;
+    }
+    while((r = q->WaitHead) != NULL){
+        NTSTATUS st = VblkPost(d,q,r,(r->Flags & BLOCK_IO_WRITE) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN,NULL);
+        if(st == STATUS_INSUFFICIENT_RESOURCES) break;
+        q->WaitHead = r->Next;
+        if(!q->WaitHead) q->WaitTail = NULL;
+        if(!NT_SUCCESS(st)){
+            r->Status = st; r->Next = NULL;
+            if(doneTail) doneTail->Next = r; else doneHead = r;
+            doneTail = r;
+        }
+    }
+    VirtqKick(&q->Vq);
+    AuroraReleaseSpinLock(&q->Vq.Lock,old);
+    while(doneHead){
+        r = doneHead; doneHead = r->Next;
+        BlockCompleteRequest(r, r->Status);
+    }
+    return done;
+}
+
+static NTSTATUS VblkSubmit(PAIO_DEVICE_OBJECT Dev, PBLOCK_REQUEST Req){
+    VBLK_DEVICE* d = VblkFromAio(Dev);
+    VBLK_QUEUE* q;
+    AURORA_IRQL old;
+    NTSTATUS st;
+    if(!d) return STATUS_INVALID_PARAMETER;
+    if((Req->Flags & BLOCK_IO_WRITE) && d->ReadOnly) return STATUS_ACCESS_DENIED;
+    q = &d->Queues[Req->Queue % d->QueueCount];
+    AuroraAcquireSpinLock(&q->Vq.Lock,&old);
+    if(q->WaitHead) st = STATUS_INSUFFICIENT_RESOURCES; /* keep FIFO order behind waiters */
+    else st = VblkPost(d,q,Req,(Req->Flags & BLOCK_IO_WRITE) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN,NULL);
+    if(st == STATUS_INSUFFICIENT_RESOURCES){
+        Req->Next = NULL;
+        if(q->WaitTail) q->WaitTail->Next = Req; else q->WaitHead = Req;
+        q->WaitTail = Req;
+        st = STATUS_SUCCESS;
+    }
+    if(NT_SUCCESS(st)) VirtqKick(&q->Vq);
+    AuroraReleaseSpinLock(&q->Vq.Lock,old);
+    return st;
+}
+
+static UINT32 VblkPoll(PAIO_DEVICE_OBJECT Dev, UINT32 Queue, UINT32 Budget){
+    VBLK_DEVICE* d = VblkFromAio(Dev);
+    if(!d || Queue >= d->QueueCount) return 0;
+    return VblkReap(d,Queue,Budget);
+}
+
+static void VblkSyncComplete(PBLOCK_REQUEST Req){ *(volatile BOOL*)Req->Context = TRUE; }
+
+static NTSTATUS VblkRwHandler(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer, UINT32 Flags){
+    VBLK_DEVICE* d = VblkFromAio(Dev);
+    BLOCK_REQUEST req;
+    volatile BOOL done = FALSE;
+    NTSTATUS st;
+    if(!d) return STATUS_INVALID_PARAMETER;
+    memset(&req,0,sizeof(req));
+    req.Lba = Lba; req.Count = Count; req.Buffer = Buffer; req.Flags = Flags & BLOCK_IO_WRITE;
+    req.Queue = HalGetCurrentProcessorNumber() % d->QueueCount;
+    req.Complete = VblkSyncComplete;
+    req.Context = (PVOID)&done;
+    req.Device = Dev;
+    st = VblkSubmit(Dev,&req);
+    if(!NT_SUCCESS(st)) return st;
+    while(!done){
+        if(!VblkReap(d,req.Queue,VBLK_QUEUE_SIZE)) HalCpuPause();
+    }
+    return req.Status;
+}
+
+static NTSTATUS VblkFlushHandler(PAIO_DEVICE_OBJECT Dev){
+    VBLK_DEVICE* d = VblkFromAio(Dev);
+    VBLK_QUEUE* q;
+    VBLK_CMD* cmd = NULL;
+    AURORA_IRQL old;
+    NTSTATUS st;
+    if(!d) return STATUS_INVALID_PARAMETER;
+    /* Without F_FLUSH the device has no volatile cache: completed writes are already stable */
+    if(!(d->Vio.Features & VIRTIO_BIT(VIRTIO_BLK_F_FLUSH))) return STATUS_SUCCESS;
+    q = &d->Queues[HalGetCurrentProcessorNumber() % d->QueueCount];
+    for(;;){
+        AuroraAcquireSpinLock(&q->Vq.Lock,&old);
+        st = VblkPost(d,q,NULL,VIRTIO_BLK_T_FLUSH,&cmd);
+        if(NT_SUCCESS(st)) VirtqKick(&q->Vq);
+        AuroraReleaseSpinLock(&q->Vq.Lock,old);
+        if(st != STATUS_INSUFFICIENT_RESOURCES) break;
+        VblkReap(d,(UINT32)(q - d->Queues),VBLK_QUEUE_SIZE); /* make room */
+    }
+    if(!NT_SUCCESS(st)) return st;
+    while(!cmd->Done){
+        if(!VblkReap(d,(UINT32)(q - d->Queues),VBLK_QUEUE_SIZE)) HalCpuPause();
+    }
+    return VblkStatus(cmd->Status);
+}
+
+static void VblkInterrupt(UINT32 Irq, PVOID Ctx){
+    VBLK_DEVICE* d = (VBLK_DEVICE*)Ctx;
+    UINT32 i;
+    (void)Irq;
+    if(!(VirtioPciReadIsr(&d->Vio) & 1)) return; /* shared line, not ours */
+    for(i=0;i<d->QueueCount;i++){
+        do { VblkReap(d,i,VBLK_QUEUE_SIZE); } while(!VirtqEnableInterrupts(&d->Queues[i].Vq));
+    }
+}
+
+static UINT64 VblkReadCapacity(VBLK_DEVICE* d){
+    UINT32 gen, lo, hi;
+    do {
+        gen = VirtioPciConfigGeneration(&d->Vio);
+        lo = VBLK_CFG32(d,VBLK_CFG_CAPACITY);
+        hi = VBLK_CFG32(d,VBLK_CFG_CAPACITY+4);
+    } while(gen != VirtioPciConfigGeneration(&d->Vio));
+    return ((UINT64)hi << 32) | lo;
+}
+
+static NTSTATUS VblkProbe(pci_device_t* Pci){
+    VBLK_DEVICE* d;
+    PBLOCK_DEVICE_EXTENSION ext;
+    UINT64 wanted, sectors, bytes;
+    UINT32 i, maxQueues = VBLK_MAX_QUEUES, cpus;
+    CHAR val[16], name[IO_MAX_NAME];
+    NTSTATUS st;
+    if(g_VblkCount >= VBLK_MAX_DEVICES) return STATUS_INSUFFICIENT_RESOURCES;
+    d = (VBLK_DEVICE*)MemAllocPages((sizeof(VBLK_DEVICE) + 4095) / 4096);
+    if(!d) return STATUS_INSUFFICIENT_RESOURCES;
+    memset(d,0,sizeof(*d));
+    st = VirtioPciAttach(Pci,&d->Vio);
+    if(!NT_SUCCESS(st)) return st;
+    if(!d->Vio.DeviceCfg){ VirtioPciFail(&d->Vio); return STATUS_NOT_SUPPORTED; }
+
+    wanted = VIRTIO_BIT(VIRTIO_BLK_F_SIZE_MAX) | VIRTIO_BIT(VIRTIO_BLK_F_SEG_MAX) | VIRTIO_BIT(VIRTIO_BLK_F_RO) |
+             VIRTIO_BIT(VIRTIO_BLK_F_BLK_SIZE) | VIRTIO_BIT(VIRTIO_BLK_F_FLUSH) | VIRTIO_BIT(VIRTIO_BLK_F_MQ) |
+             VIRTIO_BIT(VIRTIO_RING_F_INDIRECT_DESC) | VIRTIO_BIT(VIRTIO_RING_F_EVENT_IDX) | VIRTIO_BIT(VIRTIO_F_RING_PACKED);
+    if(AuroraGetBootParameter("virtio_packed",val,sizeof(val)) && val[0]=='0') wanted &= ~VIRTIO_BIT(VIRTIO_F_RING_PACKED);
+    st = VirtioPciNegotiate(&d->Vio,wanted);
+    if(!NT_SUCCESS(st)) return st;
+
+    d->BlockSize = VBLK_SECTOR;
+    if(d->Vio.Features & VIRTIO_BIT(VIRTIO_BLK_F_BLK_SIZE)){
+        UINT32 bs = VBLK_CFG32(d,VBLK_CFG_BLK_SIZE);
+        if(bs >= VBLK_SECTOR && bs <= 4096 && !(bs & (bs-1))) d->BlockSize = bs;
+    }
+    d->SectorsPerBlock = d->BlockSize / VBLK_SECTOR;
+    d->ReadOnly = (d->Vio.Features & VIRTIO_BIT(VIRTIO_BLK_F_RO)) != 0;
+    d->SegBytes = VBLK_SEG_BYTES;
+    if(d->Vio.Features & VIRTIO_BIT(VIRTIO_BLK_F_SIZE_MAX)){
+        UINT32 sm = VBLK_CFG32(d,VBLK_CFG_SIZE_MAX);
+        if(sm >= d->BlockSize && sm < d->SegBytes) d->SegBytes = sm & ~(d->BlockSize-1);
+    }
+    d->MaxSegs = VBLK_MAX_SEGS;
+    if(d->Vio.Features & VIRTIO_BIT(VIRTIO_BLK_F_SEG_MAX)){
+        UINT32 sm = VBLK_CFG32(d,VBLK_CFG_SEG_MAX);
+        if(sm && sm < d->MaxSegs) d->MaxSegs = sm;
+    }
+
+    if(d->Vio.Features & VIRTIO_BIT(VIRTIO_BLK_F_MQ)) maxQueues = VBLK_CFG16(d,VBLK_CFG_NUM_QUEUES);
+    else maxQueues = 1;
+    cpus = HalGetProcessorCount();
+    if(maxQueues > cpus) maxQueues = cpus;
+    if(AuroraGetBootParameter("virtio_queues",val,sizeof(val))){ UINT32 v = (UINT32)AuroraParseSize(val,0); if(v && v < maxQueues) maxQueues = v; }
+    if(maxQueues > VBLK_MAX_QUEUES) maxQueues = VBLK_MAX_QUEUES;
+    if(maxQueues == 0) maxQueues = 1;
+
+    for(i=0;i<maxQueues;i++){
+        VBLK_QUEUE* q = &d->Queues[i];
+        UINT32 c;
+        st = VirtioPciSetupQueue(&d->Vio,(UINT16)i,VBLK_QUEUE_SIZE,&q->Vq);
+        if(!NT_SUCCESS(st)) break;
+        q->Cmds = (VBLK_CMD*)MemAllocPages((q->Vq.Size * sizeof(VBLK_CMD) + 4095) / 4096);
+        if(!q->Cmds){ st = STATUS_INSUFFICIENT_RESOURCES; break; }
+        memset(q->Cmds,0,q->Vq.Size * sizeof(VBLK_CMD));
+        for(c=0;c<q->Vq.Size;c++) q->FreeCmds[c] = (UINT16)(q->Vq.Size-1-c);
+        q->FreeCount = q->Vq.Size;
+        /* Without indirect descriptors a request occupies MaxSegs+2 ring slots */
+        if(!q->Vq.Indirect && d->MaxSegs + 2 > q->Vq.Size) d->MaxSegs = q->Vq.Size - 2;
+    }
+    if(i == 0){ VirtioPciFail(&d->Vio); return NT_SUCCESS(st) ? STATUS_NOT_FOUND : st; }
+    d->QueueCount = i;
+
+    /* Interrupts only when the line can be routed; otherwise completions are polled */
+    if(d->Vio.Irq && d->Vio.Irq < 0xFF && aur_register_irq(d->Vio.Irq,VblkInterrupt,d) == AUR_OK){
+        for(i=0;i<d->QueueCount;i++) VirtqEnableInterrupts(&d->Queues[i].Vq);
+    } else {
+        for(i=0;i<d->QueueCount;i++) VirtqDisableInterrupts(&d->Queues[i].Vq);
+    }
+    VirtioPciDriverOk(&d->Vio);
+
+    sectors = VblkReadCapacity(d);
+    if(!g_VblkCount) IoDriverInitialize(&g_VblkDriver,"virtio_blk");
+    strcpy(name,"vblk0"); name[4] = (CHAR)('0' + g_VblkCount);
+    st = IoCreateDevice(&g_VblkDriver,name,(IO_DEVICE_CLASS_BLOCK<<16)|IO_BLOCK_TYPE_VIRTIO_BLK,&d->Aio);
+    if(!NT_SUCCESS(st)) return st;
+    ext = (PBLOCK_DEVICE_EXTENSION)AuroraAllocateMemory(sizeof(BLOCK_DEVICE_EXTENSION));
+    if(!ext) return STATUS_INSUFFICIENT_RESOURCES;
+    memset(ext,0,sizeof(*ext));
+    ext->BlockSize = d->BlockSize;
+    ext->BlockCount = sectors / d->SectorsPerBlock;
+    ext->BlockType = IO_BLOCK_TYPE_VIRTIO_BLK;
+    ext->Features = (d->Vio.Features & VIRTIO_BIT(VIRTIO_BLK_F_FLUSH)) ? BLOCK_FEATURE_FLUSH : 0;
+    ext->CacheMode = BLOCK_CACHE_NONE;
+    ext->QueueCount = d->QueueCount;
+    /* Sized for a buffer that starts mid-page with no two pages physically
+     * adjacent: one segment per page plus one, or two per SegBytes when
+     * segments are smaller than a page */
+    bytes = (UINT64)(d->MaxSegs - 1) * (d->SegBytes >= AURORA_PAGE_SIZE ? AURORA_PAGE_SIZE : d->SegBytes / 2);
+    ext->MaxTransferBlocks = bytes >= d->BlockSize ? (UINT32)(bytes / d->BlockSize) : 1;
+    ext->DriverContext = d;
+    d->Aio->DeviceExtension = ext;
+    g_VblkDevices[g_VblkCount++] = d;
+    AuroraDebugPrint("[virtio-blk] %s %u MiB, %s ring, %u queues%s", name, (UINT32)((sectors * VBLK_SECTOR) >> 20),
+                     d->Queues[0].Vq.Packed ? "packed" : "split", d->QueueCount, d->ReadOnly ? ", read-only" : "");
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS VirtioBlkInitialize(void){
+    static const UINT16 ids[] = { VIRTIO_PCI_MODERN_BASE + VIRTIO_ID_BLOCK, 0x1001 /* transitional */ };
+    pci_device_t* pci;
+    UINT32 i;
+    BlockRegisterRwHandler(IO_BLOCK_TYPE_VIRTIO_BLK,VblkRwHandler);
+    BlockRegisterFlushHandler(IO_BLOCK_TYPE_VIRTIO_BLK,VblkFlushHandler);
+    BlockRegisterQueueHandlers(IO_BLOCK_TYPE_VIRTIO_BLK,VblkSubmit,VblkPoll);
+    for(i=0;i<sizeof(ids)/sizeof(ids[0]);i++){
+        pci = NULL;
+        while((pci = pci_find_next(pci,VIRTIO_PCI_VENDOR,ids[i])) != NULL) VblkProbe(pci);
+    }
+    return g_VblkCount ? STATUS_SUCCESS : STATUS_NOT_FOUND;
+}
@@ -0,0 +1,151 @@
+/* Aurora virtio-pci modern transport (virtio 1.x)
+ * Locates the common/notify/ISR/device configuration windows through the
+ * vendor-specific PCI capabilities and drives the status/feature handshake.
+ * Legacy (0.9.5, I/O port) devices are not supported. */
+#include "../../../aurora.h"
+#include "../../../include/kern/virtio.h"
+#include "../../../include/hal.h"
+
+/* virtio_pci_cap.cfg_type */
+#define VIRTIO_PCI_CAP_COMMON_CFG   1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG   2
+#define VIRTIO_PCI_CAP_ISR_CFG      3
+#define VIRTIO_PCI_CAP_DEVICE_CFG   4
+
+/* struct virtio_pci_common_cfg */
+#define VCOMMON_DFSELECT        0x00
+#define VCOMMON_DF              0x04
+#define VCOMMON_GFSELECT        0x08
+#define VCOMMON_GF              0x0C
+#define VCOMMON_MSIX            0x10
+#define VCOMMON_NUMQ            0x12
+#define VCOMMON_STATUS          0x14
+#define VCOMMON_CFGGENERATION   0x15
+#define VCOMMON_Q_SELECT        0x16
+#define VCOMMON_Q_SIZE          0x18
+#define VCOMMON_Q_MSIX          0x1A
+#define VCOMMON_Q_ENABLE        0x1C
+#define VCOMMON_Q_NOFF          0x1E
+#define VCOMMON_Q_DESCLO        0x20
+#define VCOMMON_Q_DESCHI        0x24
+#define VCOMMON_Q_AVAILLO       0x28
+#define VCOMMON_Q_AVAILHI       0x2C
+#define VCOMMON_Q_USEDLO        0x30
+#define VCOMMON_Q_USEDHI        0x34
+
+#define VIRTIO_MSI_NO_VECTOR    0xFFFF
+#define VIRTIO_RESET_SPINS      1000000
+
+#define VREG8(b,o)   (*(volatile UINT8*)((b)+(o)))
+#define VREG16(b,o)  (*(volatile UINT16*)((b)+(o)))
+#define VREG32(b,o)  (*(volatile UINT32*)((b)+(o)))
+
+static volatile UINT8* VirtioMapCap(pci_device_t* Pci, UINT8 Pos){
+    UINT8 bar = pci_read_config8(Pci, Pos + 4);
+    UINT32 off = pci_read_config32(Pci, Pos + 8);
+    if(bar > 5 || !Pci->bar[bar]) return NULL;
+    if(pci_read_config32(Pci, 0x10 + bar*4) & 1) return NULL; /* modern windows are never I/O BARs */
+    return (volatile UINT8*)(ULONG_PTR)(Pci->bar[bar] + off); /* identity-mapped MMIO */
+}
+
+static void VirtioSetStatus(PVIRTIO_PCI_DEVICE Dev, UINT8 Bits){
+    VREG8(Dev->Common,VCOMMON_STATUS) = (UINT8)(VREG8(Dev->Common,VCOMMON_STATUS) | Bits);
+}
+
+static NTSTATUS VirtioReset(PVIRTIO_PCI_DEVICE Dev){
+    UINT32 spins = VIRTIO_RESET_SPINS;
+    VREG8(Dev->Common,VCOMMON_STATUS) = 0;
+    while(VREG8(Dev->Common,VCOMMON_STATUS) != 0){
+        if(!--spins) return STATUS_TIMEOUT;
+        HalCpuPause();
+    }
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS VirtioPciAttach(pci_device_t* Pci, PVIRTIO_PCI_DEVICE Dev){
+    UINT8 pos = 0;
+    NTSTATUS st;
+    if(!Pci || !Dev) return STATUS_INVALID_PARAMETER;
+    memset(Dev,0,sizeof(*Dev));
+    Dev->Pci = Pci;
+    Dev->Irq = Pci->irq;
+    while((pos = pci_next_capability(Pci, pos, PCI_CAP_ID_VNDR)) != 0){
+        UINT8 type = pci_read_config8(Pci, pos + 3);
+        volatile UINT8* win;
+        if(type < VIRTIO_PCI_CAP_COMMON_CFG || type > VIRTIO_PCI_CAP_DEVICE_CFG) continue;
+        win = VirtioMapCap(Pci, pos);
+        if(!win) continue;
+        /* Keep the first capability of each type: the spec lists them in preference order */
+        switch(type){
+            case VIRTIO_PCI_CAP_COMMON_CFG: if(!Dev->Common) Dev->Common = win; break;
+            case VIRTIO_PCI_CAP_NOTIFY_CFG:
+                if(!Dev->Notify){ Dev->Notify = win; Dev->NotifyMultiplier = pci_read_config32(Pci, pos + 16); }
+                break;
+            case VIRTIO_PCI_CAP_ISR_CFG:    if(!Dev->Isr) Dev->Isr = win; break;
+            case VIRTIO_PCI_CAP_DEVICE_CFG: if(!Dev->DeviceCfg) Dev->DeviceCfg = win; break;
+        }
+    }
+    if(!Dev->Common || !Dev->Notify || !Dev->Isr) return STATUS_NOT_SUPPORTED;
+    pci_enable_bus_master(Pci);
+    st = VirtioReset(Dev);
+    if(!NT_SUCCESS(st)) return st;
+    VirtioSetStatus(Dev, VIRTIO_STATUS_ACKNOWLEDGE);
+    VirtioSetStatus(Dev, VIRTIO_STATUS_DRIVER);
+    VREG16(Dev->Common,VCOMMON_MSIX) = VIRTIO_MSI_NO_VECTOR; /* INTx + ISR until MSI-X is wired up */
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS VirtioPciNegotiate(PVIRTIO_PCI_DEVICE Dev, UINT64 Wanted){
+    UINT64 offered;
+    VREG32(Dev->Common,VCOMMON_DFSELECT) = 0; offered = VREG32(Dev->Common,VCOMMON_DF);
+    VREG32(Dev->Common,VCOMMON_DFSELECT) = 1; offered |= (UINT64)VREG32(Dev->Common,VCOMMON_DF) << 32;
+    if(!(offered & VIRTIO_BIT(VIRTIO_F_VERSION_1))){ VirtioPciFail(Dev); return STATUS_NOT_SUPPORTED; }
+    Dev->Features = offered & (Wanted | VIRTIO_BIT(VIRTIO_F_VERSION_1));
+    VREG32(Dev->Common,VCOMMON_GFSELECT) = 0; VREG32(Dev->Common,VCOMMON_GF) = (UINT32)Dev->Features;
+    VREG32(Dev->Common,VCOMMON_GFSELECT) = 1; VREG32(Dev->Common,VCOMMON_GF) = (UINT32)(Dev->Features >> 32);
+    VirtioSetStatus(Dev, VIRTIO_STATUS_FEATURES_OK);
+    if(!(VREG8(Dev->Common,VCOMMON_STATUS) & VIRTIO_STATUS_FEATURES_OK)){ VirtioPciFail(Dev); return STATUS_NOT_SUPPORTED; }
+    return STATUS_SUCCESS;
+}
+
+UINT16 VirtioPciQueueCount(PVIRTIO_PCI_DEVICE Dev){ return VREG16(Dev->Common,VCOMMON_NUMQ); }
+
+NTSTATUS VirtioPciSetupQueue(PVIRTIO_PCI_DEVICE Dev, UINT16 Index, UINT16 MaxSize, PVIRTQUEUE Vq){
+    UINT16 size;
+    UINT64 desc, drv, dev;
+    NTSTATUS st;
+    VREG16(Dev->Common,VCOMMON_Q_SELECT) = Index;
+    size = VREG16(Dev->Common,VCOMMON_Q_SIZE);
+    if(size == 0) return STATUS_NOT_FOUND;
+    if(VREG16(Dev->Common,VCOMMON_Q_ENABLE)) return STATUS_OBJECT_NAME_COLLISION;
+    if(MaxSize == 0 || MaxSize > VIRTQ_MAX_SIZE) MaxSize = VIRTQ_MAX_SIZE;
+    if(size > MaxSize){
+        size = MaxSize;
+        /* split rings must stay a power of two */
+        if(!(Dev->Features & VIRTIO_BIT(VIRTIO_F_RING_PACKED))) while(size & (size-1)) size &= (UINT16)(size-1);
+    }
+    memset(Vq,0,sizeof(*Vq));
+    Vq->Dev = Dev;
+    Vq->Index = Index;
+    Vq->Packed = (Dev->Features & VIRTIO_BIT(VIRTIO_F_RING_PACKED)) != 0;
+    Vq->EventIdx = (Dev->Features & VIRTIO_BIT(VIRTIO_RING_F_EVENT_IDX)) != 0;
+    Vq->Indirect = (Dev->Features & VIRTIO_BIT(VIRTIO_RING_F_INDIRECT_DESC)) != 0;
+    st = VirtqInitialize(Vq, size, &desc, &drv, &dev);
+    if(!NT_SUCCESS(st)) return st;
+    VREG16(Dev->Common,VCOMMON_Q_SIZE) = size;
+    VREG16(Dev->Common,VCOMMON_Q_MSIX) = VIRTIO_MSI_NO_VECTOR;
+    VREG32(Dev->Common,VCOMMON_Q_DESCLO) = (UINT32)desc;  VREG32(Dev->Common,VCOMMON_Q_DESCHI) = (UINT32)(desc >> 32);
+    VREG32(Dev->Common,VCOMMON_Q_AVAILLO) = (UINT32)drv;  VREG32(Dev->Common,VCOMMON_Q_AVAILHI) = (UINT32)(drv >> 32);
+    VREG32(Dev->Common,VCOMMON_Q_USEDLO) = (UINT32)dev;   VREG32(Dev->Common,VCOMMON_Q_USEDHI) = (UINT32)(dev >> 32);
+    Vq->NotifyAddr = (volatile UINT16*)(Dev->Notify + (UINT32)VREG16(Dev->Common,VCOMMON_Q_NOFF) * Dev->NotifyMultiplier);
+    VREG16(Dev->Common,VCOMMON_Q_ENABLE) = 1;
+    return STATUS_SUCCESS;
+}
+
+void VirtioPciDriverOk(PVIRTIO_PCI_DEVICE Dev){ VirtioSetStatus(Dev, VIRTIO_STATUS_DRIVER_OK); }
+void VirtioPciFail(PVIRTIO_PCI_DEVICE Dev){ VirtioSetStatus(Dev, VIRTIO_STATUS_FAILED); }
+
+/* Reading the ISR acknowledges the (INTx) interrupt */
+UINT8 VirtioPciReadIsr(PVIRTIO_PCI_DEVICE Dev){ return VREG8(Dev->Isr,0); }
+
+UINT32 VirtioPciConfigGeneration(PVIRTIO_PCI_DEVICE Dev){ return VREG8(Dev->Common,VCOMMON_CFGGENERATION); }
@@ -0,0 +1,285 @@
+/* Aurora virtqueues: packed ring (virtio 1.1) with split ring fallback
+ * Multi-element requests are placed in a per-id indirect table when
+ * VIRTIO_RING_F_INDIRECT_DESC is negotiated, so each request costs one ring
+ * slot. With VIRTIO_RING_F_EVENT_IDX the driver only notifies when the
+ * device asked for the range just published and only re-arms interrupts at
+ * the next expected used slot. */
+#include "../../../aurora.h"
+#include "../../../include/kern/virtio.h"
+#include "../../../include/mem.h"
+#include "../../../include/hal.h"
+
+#define VRING_AVAIL_F_NO_INTERRUPT      1
+#define VRING_USED_F_NO_NOTIFY          1
+
+#define VRING_PACKED_EVENT_ENABLE       0
+#define VRING_PACKED_EVENT_DISABLE      1
+#define VRING_PACKED_EVENT_DESC         2
+#define VRING_PACKED_WRAP_BIT           15
+
+#define VQ_PAGE_SIZE                    4096
+
+typedef struct _VRING_DESC {          /* split */
+    UINT64 Addr;
+    UINT32 Len;
+    UINT16 Flags;
+    UINT16 Next;
+} VRING_DESC;
+
+typedef struct _VRING_PACKED_DESC {
+    UINT64 Addr;
+    UINT32 Len;
+    UINT16 Id;
+    UINT16 Flags;
+} VRING_PACKED_DESC;
+
+/* Device-side: would publishing (Old, New] cross the event index? */
+static BOOL VringNeedEvent(UINT16 EventIdx, UINT16 New, UINT16 Old){
+    return (UINT16)(New - EventIdx - 1) < (UINT16)(New - Old);
+}
+
+static PVOID VqAllocZeroed(UINT32 Bytes){
+    UINT32 pages = (Bytes + VQ_PAGE_SIZE-1) / VQ_PAGE_SIZE;
+    PVOID p = MemAllocPages(pages);
+    if(p) memset(p,0,(SIZE_T)pages*VQ_PAGE_SIZE);
+    return p;
+}
+
+static UINT8* VqIndirectTable(PVIRTQUEUE Vq, UINT16 Id){
+    return Vq->IndirectPool + (UINT32)Id * VIRTQ_MAX_INDIRECT * 16;
+}
+
+NTSTATUS VirtqInitialize(PVIRTQUEUE Vq, UINT16 Size, UINT64* DescPa, UINT64* DriverPa, UINT64* DevicePa){
+    UINT32 i, bytes, availOff, usedOff;
+    UINT8* ring;
+    if(!Vq || Size == 0 || Size > VIRTQ_MAX_SIZE) return STATUS_INVALID_PARAMETER;
+    Vq->Size = Size;
+    Vq->NumFree = Size;
+    Vq->IntrEnabled = TRUE;
+    AuroraInitializeSpinLock(&Vq->Lock);
+    if(Vq->Indirect){
+        Vq->IndirectPool = (UINT8*)VqAllocZeroed((UINT32)Size * VIRTQ_MAX_INDIRECT * 16);
+        if(!Vq->IndirectPool) Vq->Indirect = FALSE; /* fall back to direct chains */
+    }
+    if(Vq->Packed){
+        /* descriptor ring, then driver and device event suppression areas */
+        bytes = (UINT32)Size*16 + 8;
+        ring = (UINT8*)VqAllocZeroed(bytes);
+        if(!ring) return STATUS_INSUFFICIENT_RESOURCES;
+        Vq->Desc = ring;
+        Vq->DriverEvent = (volatile UINT16*)(ring + (UINT32)Size*16);
+        Vq->DeviceEvent = (volatile UINT16*)(ring + (UINT32)Size*16 + 4);
+        Vq->AvailWrap = TRUE;
+        Vq->UsedWrap = TRUE;
+        for(i=0;i<Size;i++) Vq->FreeIds[i] = (UINT16)(Size-1-i);
+        Vq->FreeIdCount = Size;
+        *DescPa = MemGetPhysicalAddress(ring);
+        *DriverPa = MemGetPhysicalAddress((PVOID)Vq->DriverEvent);
+        *DevicePa = MemGetPhysicalAddress((PVOID)Vq->DeviceEvent);
+        return STATUS_SUCCESS;
+    }
+    /* split: desc (16-aligned) | avail (2-aligned) | used (4-aligned) */
+    availOff = (UINT32)Size*16;
+    usedOff = (availOff + 6 + 2u*Size + 3) & ~3u;
+    bytes = usedOff + 6 + 8u*Size;
+    ring = (UINT8*)VqAllocZeroed(bytes);
+    if(!ring) return STATUS_INSUFFICIENT_RESOURCES;
+    Vq->Desc = ring;
+    Vq->AvailFlags = (volatile UINT16*)(ring + availOff);
+    Vq->AvailIdx = Vq->AvailFlags + 1;
+    Vq->AvailRing = Vq->AvailFlags + 2;
+    Vq->UsedEvent = Vq->AvailRing + Size;
+    Vq->UsedFlags = (volatile UINT16*)(ring + usedOff);
+    Vq->UsedIdx = Vq->UsedFlags + 1;
+    Vq->UsedRing = (volatile UINT32*)(ring + usedOff + 4);
+    Vq->AvailEvent = (volatile UINT16*)(Vq->UsedRing + 2u*Size);
+    for(i=0;i<Size;i++) ((VRING_DESC*)ring)[i].Next = (UINT16)(i+1);
+    Vq->FreeHead = 0;
+    *DescPa = MemGetPhysicalAddress(ring);
+    *DriverPa = MemGetPhysicalAddress((PVOID)Vq->AvailFlags);
+    *DevicePa = MemGetPhysicalAddress((PVOID)Vq->UsedFlags);
+    return STATUS_SUCCESS;
+}
+
+static BOOL VqUseIndirect(PVIRTQUEUE Vq, UINT32 Count){
+    return Vq->Indirect && Count > 1 && Count <= VIRTQ_MAX_INDIRECT;
+}
+
+static NTSTATUS VqAddSplit(PVIRTQUEUE Vq, PVIRTQ_SG Sg, UINT32 Count, PVOID Token){
+    volatile VRING_DESC* desc = (volatile VRING_DESC*)Vq->Desc;
+    UINT16 head = Vq->FreeHead, idx, last = 0;
+    UINT32 i, need = VqUseIndirect(Vq,Count) ? 1 : Count;
+    if(Vq->NumFree < need) return STATUS_INSUFFICIENT_RESOURCES;
+    if(need == 1 && Count > 1){
+        VRING_DESC* tbl = (VRING_DESC*)VqIndirectTable(Vq,head);
+        for(i=0;i<Count;i++){
+            tbl[i].Addr = Sg[i].Addr;
+            tbl[i].Len = Sg[i].Len;
+            tbl[i].Flags = (UINT16)((Sg[i].DeviceWrites ? VIRTQ_DESC_F_WRITE : 0) | (i+1<Count ? VIRTQ_DESC_F_NEXT : 0));
+            tbl[i].Next = (UINT16)(i+1);
+        }
+        desc[head].Addr = MemGetPhysicalAddress(tbl);
+        desc[head].Len = Count * (UINT32)sizeof(VRING_DESC);
+        desc[head].Flags = VIRTQ_DESC_F_INDIRECT;
+        Vq->FreeHead = desc[head].Next;
+    } else {
+        idx = head;
+        for(i=0;i<Count;i++){
+            desc[idx].Addr = Sg[i].Addr;
+            desc[idx].Len = Sg[i].Len;
+            desc[idx].Flags = (UINT16)((Sg[i].DeviceWrites ? VIRTQ_DESC_F_WRITE : 0) | (i+1<Count ? VIRTQ_DESC_F_NEXT : 0));
+            last = idx;
+            idx = desc[idx].Next; /* free-list link doubles as the chain link */
+        }
+        Vq->FreeHead = desc[last].Next;
+    }
+    Vq->NumFree = (UINT16)(Vq->NumFree - need);
+    Vq->ChainLen[head] = (UINT16)need;
+    Vq->Tokens[head] = Token;
+    Vq->AvailRing[Vq->AvailShadow & (Vq->Size-1)] = head;
+    HalMemoryBarrier(); /* ring entry before index */
+    Vq->AvailShadow++;
+    *Vq->AvailIdx = Vq->AvailShadow;
+    Vq->NumAdded++;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS VqAddPacked(PVIRTQUEUE Vq, PVIRTQ_SG Sg, UINT32 Count, PVOID Token){
+    volatile VRING_PACKED_DESC* desc = (volatile VRING_PACKED_DESC*)Vq->Desc;
+    UINT32 i, need = VqUseIndirect(Vq,Count) ? 1 : Count;
+    UINT16 id, head = Vq->NextAvail, headFlags = 0, flags;
+    UINT16 availBits = Vq->AvailWrap ? VIRTQ_DESC_F_AVAIL : VIRTQ_DESC_F_USED;
+    if(Vq->NumFree < need || Vq->FreeIdCount == 0) return STATUS_INSUFFICIENT_RESOURCES;
+    id = Vq->FreeIds[--Vq->FreeIdCount];
+    if(need == 1 && Count > 1){
+        VRING_PACKED_DESC* tbl = (VRING_PACKED_DESC*)VqIndirectTable(Vq,id);
+        for(i=0;i<Count;i++){
+            tbl[i].Addr = Sg[i].Addr;
+            tbl[i].Len = Sg[i].Len;
+            tbl[i].Id = 0;
+            tbl[i].Flags = (UINT16)(Sg[i].DeviceWrites ? VIRTQ_DESC_F_WRITE : 0);
+        }
+        desc[head].Addr = MemGetPhysicalAddress(tbl);
+        desc[head].Len = Count * (UINT32)sizeof(VRING_PACKED_DESC);
+        desc[head].Id = id;
+        headFlags = (UINT16)(VIRTQ_DESC_F_INDIRECT | availBits);
+        if(++Vq->NextAvail == Vq->Size){ Vq->NextAvail = 0; Vq->AvailWrap = !Vq->AvailWrap; }
+    } else {
+        for(i=0;i<Count;i++){
+            UINT16 pos = Vq->NextAvail;
+            flags = (UINT16)((Sg[i].DeviceWrites ? VIRTQ_DESC_F_WRITE : 0) | (i+1<Count ? VIRTQ_DESC_F_NEXT : 0));
+            flags |= Vq->AvailWrap ? VIRTQ_DESC_F_AVAIL : VIRTQ_DESC_F_USED;
+            desc[pos].Addr = Sg[i].Addr;
+            desc[pos].Len = Sg[i].Len;
+            desc[pos].Id = id;
+            if(i == 0) headFlags = flags; else desc[pos].Flags = flags;
+            if(++Vq->NextAvail == Vq->Size){ Vq->NextAvail = 0; Vq->AvailWrap = !Vq->AvailWrap; }
+        }
+    }
+    /* The head's flags publish the whole chain, so they go last */
+    HalMemoryBarrier();
+    desc[head].Flags = headFlags;
+    Vq->NumFree = (UINT16)(Vq->NumFree - need);
+    Vq->ChainLen[id] = (UINT16)need;
+    Vq->Tokens[id] = Token;
+    Vq->NumAdded = (UINT16)(Vq->NumAdded + need);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS VirtqAdd(PVIRTQUEUE Vq, PVIRTQ_SG Sg, UINT32 Count, PVOID Token){
+    if(!Vq || !Sg || Count == 0 || !Token) return STATUS_INVALID_PARAMETER;
+    if(Count > Vq->Size && !VqUseIndirect(Vq,Count)) return STATUS_INVALID_PARAMETER;
+    return Vq->Packed ? VqAddPacked(Vq,Sg,Count,Token) : VqAddSplit(Vq,Sg,Count,Token);
+}
+
+void VirtqKick(PVIRTQUEUE Vq){
+    BOOL need;
+    if(!Vq->NumAdded) return;
+    HalMemoryBarrier(); /* publish before reading the device's suppression state */
+    if(Vq->Packed){
+        UINT16 offWrap = Vq->DeviceEvent[0], flags = Vq->DeviceEvent[1];
+        if(flags == VRING_PACKED_EVENT_DESC && Vq->EventIdx){
+            UINT16 newIdx = Vq->NextAvail, oldIdx = (UINT16)(newIdx - Vq->NumAdded);
+            UINT16 event = (UINT16)(offWrap & ~(1u << VRING_PACKED_WRAP_BIT));
+            BOOL wrap = (offWrap >> VRING_PACKED_WRAP_BIT) != 0;
+            if(wrap != Vq->AvailWrap) event = (UINT16)(event - Vq->Size);
+            need = VringNeedEvent(event,newIdx,oldIdx);
+        } else {
+            need = flags != VRING_PACKED_EVENT_DISABLE;
+        }
+    } else if(Vq->EventIdx){
+        need = VringNeedEvent(*Vq->AvailEvent, Vq->AvailShadow, (UINT16)(Vq->AvailShadow - Vq->NumAdded));
+    } else {
+        need = !(*Vq->UsedFlags & VRING_USED_F_NO_NOTIFY);
+    }
+    Vq->NumAdded = 0;
+    if(need) *Vq->NotifyAddr = Vq->Index;
+}
+
+static BOOL VqMoreUsed(PVIRTQUEUE Vq){
+    if(Vq->Packed){
+        UINT16 flags = ((volatile VRING_PACKED_DESC*)Vq->Desc)[Vq->LastUsed].Flags;
+        BOOL avail = (flags & VIRTQ_DESC_F_AVAIL) != 0, used = (flags & VIRTQ_DESC_F_USED) != 0;
+        return avail == used && used == Vq->UsedWrap;
+    }
+    return Vq->LastUsed != *Vq->UsedIdx;
+}
+
+static void VqRearmEvent(PVIRTQUEUE Vq){
+    if(Vq->Packed) Vq->DriverEvent[0] = (UINT16)(Vq->LastUsed | ((UINT16)Vq->UsedWrap << VRING_PACKED_WRAP_BIT));
+    else *Vq->UsedEvent = Vq->LastUsed;
+}
+
+PVOID VirtqGetUsed(PVIRTQUEUE Vq, UINT32* Len){
+    PVOID token;
+    UINT16 id;
+    if(!VqMoreUsed(Vq)) return NULL;
+    HalMemoryBarrier(); /* read the element only after seeing it published */
+    if(Vq->Packed){
+        volatile VRING_PACKED_DESC* d = &((volatile VRING_PACKED_DESC*)Vq->Desc)[Vq->LastUsed];
+        id = d->Id;
+        if(Len) *Len = d->Len;
+        if(id >= Vq->Size) return NULL;
+        Vq->LastUsed = (UINT16)(Vq->LastUsed + Vq->ChainLen[id]);
+        if(Vq->LastUsed >= Vq->Size){ Vq->LastUsed = (UINT16)(Vq->LastUsed - Vq->Size); Vq->UsedWrap = !Vq->UsedWrap; }
+        Vq->FreeIds[Vq->FreeIdCount++] = id;
+    } else {
+        volatile VRING_DESC* desc = (volatile VRING_DESC*)Vq->Desc;
+        UINT32 slot = (UINT32)(Vq->LastUsed & (Vq->Size-1)) * 2;
+        UINT16 last;
+        id = (UINT16)Vq->UsedRing[slot];
+        if(Len) *Len = Vq->UsedRing[slot+1];
+        if(id >= Vq->Size) return NULL;
+        last = id;
+        while(desc[last].Flags & VIRTQ_DESC_F_NEXT) last = desc[last].Next;
+        desc[last].Next = Vq->FreeHead;
+        Vq->FreeHead = id;
+        Vq->LastUsed++;
+    }
+    Vq->NumFree = (UINT16)(Vq->NumFree + Vq->ChainLen[id]);
+    token = Vq->Tokens[id];
+    Vq->Tokens[id] = NULL;
+    if(Vq->EventIdx && Vq->IntrEnabled) VqRearmEvent(Vq);
+    return token;
+}
+
+void VirtqDisableInterrupts(PVIRTQUEUE Vq){
+    Vq->IntrEnabled = FALSE;
+    if(Vq->Packed) Vq->DriverEvent[1] = VRING_PACKED_EVENT_DISABLE;
+    else if(!Vq->EventIdx) *Vq->AvailFlags = VRING_AVAIL_F_NO_INTERRUPT;
+    /* split + EVENT_IDX: leaving used_event behind LastUsed already suppresses interrupts */
+}
+
+BOOL VirtqEnableInterrupts(PVIRTQUEUE Vq){
+    Vq->IntrEnabled = TRUE;
+    if(Vq->EventIdx){
+        VqRearmEvent(Vq);
+        if(Vq->Packed){ HalMemoryBarrier(); Vq->DriverEvent[1] = VRING_PACKED_EVENT_DESC; }
+    } else if(Vq->Packed){
+        Vq->DriverEvent[1] = VRING_PACKED_EVENT_ENABLE;
+    } else {
+        *Vq->AvailFlags = 0;
+    }
+    HalMemoryBarrier(); /* re-check after arming so a racing completion is not lost */
+    return !VqMoreUsed(Vq);
+}
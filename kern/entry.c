@@ -1,9 +1,20 @@
 // Kernel Entry Point
 #include "../aurora.h"
 #include "../include/io.h"
+#include "../include/hal.h"
 #include "../include/fb.h"
+#include "../include/boot_protocol.h"
+#include "../include/acpi.h"
 
-void KiSystemStartup(void) {
+void AURORA_BOOT_ENTRY_ABI KiSystemStartup(aurora_boot_info_t* BootInfo) {
+    /* Boot parameters (ramdisk_size=, blkbench=, ...) are read by drivers during init */
+    if(BootInfo && BootInfo->magic == AURORA_BOOT_MAGIC){
+        BootInfo->cmdline[sizeof(BootInfo->cmdline)-1] = '\0';
+        AuroraSetCommandLine(BootInfo->cmdline);
+        /* UEFI has no RSDP in the BIOS area; the MADT gives the CPU count */
+        if(BootInfo->flags & AURORA_BOOT_FLAG_ACPI) AcpiSetRsdpAddress(BootInfo->acpi_rsdp_address);
+    }
+    HalInitialize(); /* per-CPU block for HalGetCurrentProcessorNumber */
     IoInitialize();
     /* Initialize example system stub & file system stub (best effort) */
     extern NTSTATUS SysStubInitialize(void); SysStubInitialize();
@@ -11,6 +22,8 @@ void KiSystemStartup(void) {
     if(FbInitialize() == STATUS_SUCCESS){
         FbWriteString(0,0,"Aurora Framebuffer Online\n", FB_RGB(255,255,255), FB_RGB(0,0,0));
     }
+    extern void PCIDriverInitialize(void); PCIDriverInitialize();
+    BlockSubsystemInitialize(); /* block cache + IDE; needs the PCI scan */
     extern void StorageDriverInitialize(void); StorageDriverInitialize();
     extern void DisplayDriverInitialize(void); DisplayDriverInitialize();
     extern void AudioDriverInitialize(void); AudioDriverInitialize();
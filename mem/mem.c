@@ -328,7 +328,7 @@ PVOID MemAllocateVirtualMemory(IN SIZE_T Size, IN UINT32 Protection)
             Descriptor->BaseAddress = Address;
             Descriptor->Size = Size;
             Descriptor->Protection = Protection;
-            Descriptor->Type = 1; /* Private */
+            Descriptor->Type = MEM_VAD_PRIVATE;
             Descriptor->Next = g_VirtualAddressHead;
             g_VirtualAddressHead = Descriptor;
             
@@ -1,5 +1,6 @@
 /* Generic (architecture-neutral) Aurora runtime support */
 #include "../aurora.h"
+#include "../include/mem.h"
 
 /* Some toolchains under freestanding may require explicit stdarg include. */
 #ifndef va_start
@@ -8,14 +9,26 @@
 
 /* ---------------- Memory / Allocation ---------------- */
 PVOID AuroraAllocateMemory(IN UINT64 Size){ return AuroraAllocatePool(Size); }
+#define AURORA_POOL_ARENA_PAGES 16 /* 64KB per arena once the static pool is used up */
 PVOID AuroraAllocatePool(IN UINT64 Size){
-    /* Simple bump allocator (shared, NOT thread-safe before spinlocks working) */
+    /* Simple bump allocator (shared, NOT thread-safe before spinlocks working).
+     * Boot allocations come from the static pool; after that it carves page
+     * arenas so pool users are bounded by memory, not by the pool size. */
     static unsigned char pool[1<<19]; /* 512KB */
-    static UINT64 off=0;
+    static unsigned char* arena = pool;
+    static UINT64 off=0, limit=sizeof(pool);
     if(Size==0) return NULL;
     UINT64 aligned = (Size + 7) & ~7ULL;
-    if(off + aligned > sizeof(pool)) return NULL;
-    void* p = &pool[off];
+    if(off + aligned > limit){
+        UINT64 pages = (aligned + 4095) / 4096;
+        unsigned char* fresh;
+        /* Oversized requests get their own pages and leave the arena alone */
+        if(pages > AURORA_POOL_ARENA_PAGES / 4) return MemAllocPages(pages);
+        fresh = (unsigned char*)MemAllocPages(AURORA_POOL_ARENA_PAGES);
+        if(!fresh) return NULL;
+        arena = fresh; off = 0; limit = AURORA_POOL_ARENA_PAGES * 4096ULL;
+    }
+    void* p = &arena[off];
     off += aligned;
     return p;
 }
@@ -32,6 +45,49 @@ UINT64 AuroraGetSystemTime(void){
 UINT32 AuroraGetCurrentProcessId(void){ return 1; }
 UINT32 AuroraGetCurrentThreadId(void){ return 1; }
 
+/* ---------------- Kernel command line ---------------- */
+static CHAR g_CommandLine[256];
+
+void AuroraSetCommandLine(IN PCSTR CommandLine){
+    if(!CommandLine){ g_CommandLine[0]='\0'; return; }
+    strncpy(g_CommandLine, CommandLine, sizeof(g_CommandLine)-1);
+    g_CommandLine[sizeof(g_CommandLine)-1]='\0';
+}
+
+BOOL AuroraGetBootParameter(IN PCSTR Name, OUT PCHAR Value, IN UINT32 ValueSize){
+    const CHAR* p = g_CommandLine;
+    size_t len;
+    if(!Name || !Value || ValueSize==0) return FALSE;
+    len = strlen(Name);
+    while(*p){
+        while(*p==' ') p++;
+        if(strncmp(p, Name, len)==0 && (p[len]=='=' || p[len]==' ' || p[len]=='\0')){
+            UINT32 n = 0;
+            p += len;
+            if(*p=='=') p++;
+            while(*p && *p!=' ' && n < ValueSize-1) Value[n++] = *p++;
+            Value[n] = '\0';
+            return TRUE;
+        }
+        while(*p && *p!=' ') p++;
+    }
+    return FALSE;
+}
+
+/* "64M", "2G", "4096", "512K" -> bytes */
+UINT64 AuroraParseSize(IN PCSTR Text, IN UINT64 Default){
+    UINT64 v = 0;
+    if(!Text || *Text<'0' || *Text>'9') return Default;
+    while(*Text>='0' && *Text<='9'){ v = v*10 + (UINT64)(*Text-'0'); Text++; }
+    switch(*Text){
+        case 'k': case 'K': v <<= 10; break;
+        case 'm': case 'M': v <<= 20; break;
+        case 'g': case 'G': v <<= 30; break;
+        default: break;
+    }
+    return v;
+}
+
 /* ---------------- GUID / Utility ---------------- */
 BOOL AuroraIsEqualGuid(IN PGUID a, IN PGUID b){ if(!a||!b) return FALSE; return memcmp(a,b,sizeof(GUID))==0; }
 
@@ -0,0 +1,167 @@
+/*
+ * Aurora Runtime - CRC32 and CRC32C
+ *
+ * Both polynomials run slicing-by-8: eight 256-entry tables fold eight
+ * input bytes per step instead of one. CRC32C also uses the SSE4.2 crc32
+ * instruction when CPUID reports it; the instruction only works on general
+ * registers, so no SIMD state has to be saved around it. Values follow the
+ * zlib convention: pass 0 to start, pass the previous result to continue,
+ * and the combine routines join the CRCs of two adjacent buffers without
+ * touching their bytes again.
+ */
+
+#include "../aurora.h"
+
+#define CRC32_POLYNOMIAL    0xEDB88320u     /* IEEE 802.3, reflected */
+#define CRC32C_POLYNOMIAL   0x82F63B78u     /* Castagnoli, reflected */
+
+typedef struct _CRC_TABLES {
+    UINT32 Polynomial;
+    volatile BOOL Ready;
+    UINT32 Slice[8][256];
+    UINT32 PowerOfTwo[32];      /* x^(2^k) mod P, for the combine operators */
+} CRC_TABLES, *PCRC_TABLES;
+
+static CRC_TABLES g_Crc32Tables = { CRC32_POLYNOMIAL, FALSE, {{0}}, {0} };
+static CRC_TABLES g_Crc32cTables = { CRC32C_POLYNOMIAL, FALSE, {{0}}, {0} };
+static volatile INT32 g_Crc32cHardware = -1;   /* -1 until CPUID has been asked */
+
+/* a * b modulo P, both reflected with x^0 in the top bit */
+static UINT32 CrcMultiplyModP(UINT32 Polynomial, UINT32 a, UINT32 b)
+{
+    UINT32 m = 1u << 31, p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ Polynomial : b >> 1;
+    }
+    return p;
+}
+
+/* Tables are rebuilt identically by racing callers, so no lock is needed */
+static PCRC_TABLES CrcGetTables(AURORA_CRC Kind)
+{
+    PCRC_TABLES t = Kind == AuroraCrcCastagnoli ? &g_Crc32cTables : &g_Crc32Tables;
+    if (t->Ready) return t;
+
+    for (UINT32 i = 0; i < 256; i++) {
+        UINT32 c = i;
+        for (UINT32 j = 0; j < 8; j++) c = (c & 1) ? (c >> 1) ^ t->Polynomial : c >> 1;
+        t->Slice[0][i] = c;
+    }
+    for (UINT32 i = 0; i < 256; i++) {
+        for (UINT32 k = 1; k < 8; k++) {
+            UINT32 c = t->Slice[k - 1][i];
+            t->Slice[k][i] = (c >> 8) ^ t->Slice[0][c & 0xFF];
+        }
+    }
+
+    UINT32 p = 1u << 30;        /* x^1 */
+    t->PowerOfTwo[0] = p;
+    for (UINT32 k = 1; k < 32; k++) t->PowerOfTwo[k] = p = CrcMultiplyModP(t->Polynomial, p, p);
+
+    __sync_synchronize();
+    t->Ready = TRUE;
+    return t;
+}
+
+static UINT32 CrcSoftware(PCRC_TABLES t, UINT32 c, const UINT8* p, UINT64 Size)
+{
+    while (Size && ((ULONG_PTR)p & 7)) {
+        c = t->Slice[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+        Size--;
+    }
+    while (Size >= 8) {
+        UINT32 lo = *(const UINT32*)p ^ c;
+        UINT32 hi = *(const UINT32*)(p + 4);
+        c = t->Slice[7][lo & 0xFF] ^ t->Slice[6][(lo >> 8) & 0xFF] ^
+            t->Slice[5][(lo >> 16) & 0xFF] ^ t->Slice[4][lo >> 24] ^
+            t->Slice[3][hi & 0xFF] ^ t->Slice[2][(hi >> 8) & 0xFF] ^
+            t->Slice[1][(hi >> 16) & 0xFF] ^ t->Slice[0][hi >> 24];
+        p += 8;
+        Size -= 8;
+    }
+    while (Size--) {
+        c = t->Slice[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+    }
+    return c;
+}
+
+#if defined(__x86_64__)
+/* CPUID.1:ECX[20] advertises SSE4.2 and with it the crc32 instruction */
+static BOOL CrcHardwarePresent(void)
+{
+    if (g_Crc32cHardware < 0) {
+        UINT32 a = 1, b, c = 0, d;
+        __asm__ volatile ("cpuid" : "+a"(a), "=b"(b), "+c"(c), "=d"(d));
+        g_Crc32cHardware = (c >> 20) & 1;
+    }
+    return g_Crc32cHardware > 0;
+}
+
+static UINT32 CrcHardware(UINT32 c, const UINT8* p, UINT64 Size)
+{
+    while (Size && ((ULONG_PTR)p & 7)) {
+        __asm__ ("crc32b %1, %0" : "+r"(c) : "rm"(*p));
+        p++;
+        Size--;
+    }
+    UINT64 c64 = c;
+    while (Size >= 8) {
+        __asm__ ("crc32q %1, %0" : "+r"(c64) : "rm"(*(const UINT64*)p));
+        p += 8;
+        Size -= 8;
+    }
+    c = (UINT32)c64;
+    while (Size--) {
+        __asm__ ("crc32b %1, %0" : "+r"(c) : "rm"(*p));
+        p++;
+    }
+    return c;
+}
+#else
+static BOOL CrcHardwarePresent(void) { g_Crc32cHardware = 0; return FALSE; }
+static UINT32 CrcHardware(UINT32 c, const UINT8* p, UINT64 Size) { (void)p; (void)Size; return c; }
+#endif
+
+void AuroraCrc32Initialize(void)
+{
+    CrcGetTables(AuroraCrcIeee);
+    CrcGetTables(AuroraCrcCastagnoli);
+    CrcHardwarePresent();
+}
+
+UINT32 AuroraCrc32(IN AURORA_CRC Kind, IN UINT32 Crc, IN const void* Data, IN UINT64 Size)
+{
+    if (!Data || Size == 0) return Crc;
+    if (Kind == AuroraCrcCastagnoli && CrcHardwarePresent()) {
+        return ~CrcHardware(~Crc, (const UINT8*)Data, Size);
+    }
+    return ~CrcSoftware(CrcGetTables(Kind), ~Crc, (const UINT8*)Data, Size);
+}
+
+UINT32 AuroraCrc32CombineOperator(IN AURORA_CRC Kind, IN UINT64 Length2)
+{
+    PCRC_TABLES t = CrcGetTables(Kind);
+    UINT32 p = 1u << 31;        /* x^0 */
+    UINT32 k = 3;               /* Length2 counts bytes: x^(8 * Length2) */
+    while (Length2) {
+        if (Length2 & 1) p = CrcMultiplyModP(t->Polynomial, t->PowerOfTwo[k & 31], p);
+        Length2 >>= 1;
+        k++;
+    }
+    return p;
+}
+
+UINT32 AuroraCrc32CombineWith(IN AURORA_CRC Kind, IN UINT32 Operator, IN UINT32 Crc1, IN UINT32 Crc2)
+{
+    return CrcMultiplyModP(CrcGetTables(Kind)->Polynomial, Operator, Crc1) ^ Crc2;
+}
+
+UINT32 AuroraCrc32Combine(IN AURORA_CRC Kind, IN UINT32 Crc1, IN UINT32 Crc2, IN UINT64 Length2)
+{
+    return AuroraCrc32CombineWith(Kind, AuroraCrc32CombineOperator(Kind, Length2), Crc1, Crc2);
+}
@@ -0,0 +1,182 @@
+/* Block buffer cache
+ * Puts a write-back cache in front of a spy block device whose "media" is a
+ * plain array and which counts the requests it is sent:
+ *   - writes only dirty the cache until a flush, reads of dirty blocks are
+ *     served from it, and the flush writes them out sorted by LBA in one
+ *     request per contiguous run
+ *   - a FUA write reaches the media at once, flagged FUA for a device that
+ *     honours it and followed by a device flush for one that does not, and
+ *     leaves its cached copy clean
+ *   - making room evicts only clean buffers: dirty data survives a flood of
+ *     reads, a write larger than the cache pushes the dirty part out before
+ *     writing the rest through, and crossing the high-water mark flushes
+ *   - a dirty buffer goes out on its own once it ages */
+#include "../aurora.h"
+#include "../include/io.h"
+
+int printf(const char* Format, ...);
+
+#define BS          512
+#define BLOCKS      8192
+#define CACHE_MAX   512     /* BCACHE_MAX_BUFFERS */
+#define HIGH_WATER  256     /* BCACHE_DIRTY_HIGH_WATER */
+#define EXPIRE      3000    /* BCACHE_DIRTY_EXPIRE */
+
+static int g_Failures;
+#define CHECK(c, ...) do { if(!(c)){ printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); g_Failures++; } } while(0)
+
+static UINT8 g_Media[BLOCKS*BS];
+static UINT32 g_Reads, g_Writes, g_FuaWrites, g_Flushes;
+static BLOCK_DEVICE_EXTENSION g_Ext;
+static AIO_DEVICE_OBJECT g_Dev;
+
+static NTSTATUS SpyRw(PAIO_DEVICE_OBJECT Dev, UINT64 Lba, UINT32 Count, PVOID Buffer, UINT32 Flags){
+    if(Flags & BLOCK_IO_WRITE){
+        memcpy(g_Media + Lba*BS, Buffer, (UINT64)Count*BS);
+        g_Writes++;
+        if(Flags & BLOCK_IO_FUA) g_FuaWrites++;
+    } else {
+        memcpy(Buffer, g_Media + Lba*BS, (UINT64)Count*BS);
+        g_Reads++;
+    }
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS SpyFlush(PAIO_DEVICE_OBJECT Dev){
+    g_Flushes++;
+    return STATUS_SUCCESS;
+}
+
+static UINT8 Pattern(UINT64 Lba, UINT32 Off, UINT32 Seed){
+    UINT64 x = (Lba * 0x9E3779B97F4A7C15ULL) ^ ((UINT64)Off * 0xBF58476D1CE4E5B9ULL) ^ ((UINT64)Seed * 0x94D049BB133111EBULL);
+    return (UINT8)(x >> 29);
+}
+
+static void Fill(UINT8* Buf, UINT64 Lba, UINT32 Count, UINT32 Seed){
+    for(UINT32 b=0;b<Count;b++) for(UINT32 i=0;i<BS;i++) Buf[(UINT64)b*BS+i] = Pattern(Lba+b,i,Seed);
+}
+
+static BOOL Matches(const UINT8* Buf, UINT64 Lba, UINT32 Count, UINT32 Seed){
+    for(UINT32 b=0;b<Count;b++) for(UINT32 i=0;i<BS;i++) if(Buf[(UINT64)b*BS+i] != Pattern(Lba+b,i,Seed)) return FALSE;
+    return TRUE;
+}
+
+static BOOL OnMedia(UINT64 Lba, UINT32 Count, UINT32 Seed){
+    return Matches(g_Media + Lba*BS, Lba, Count, Seed);
+}
+
+static void Write(UINT64 Lba, UINT32 Count, UINT32 Seed, UINT32 Flags){
+    static UINT8 buf[1024*BS];
+    Fill(buf,Lba,Count,Seed);
+    CHECK(NT_SUCCESS(BlockWriteEx(&g_Dev,Lba,Count,buf,Flags)), "write lba %llu count %u", (unsigned long long)Lba, Count);
+}
+
+/* Blocks read back through the cache match Seed */
+static BOOL Reads(UINT64 Lba, UINT32 Count, UINT32 Seed){
+    static UINT8 buf[1024*BS];
+    memset(buf,0,(UINT64)Count*BS);
+    return NT_SUCCESS(BlockRead(&g_Dev,Lba,Count,buf)) && Matches(buf,Lba,Count,Seed);
+}
+
+/* 64 blocks written one at a time in reverse, plus two past a gap: three
+ * runs, 32 KiB at most, so three requests */
+static void WriteBack(void){
+    UINT32 writes = g_Writes, reads = g_Reads;
+    for(UINT32 i=64;i>0;i--) Write(100+i-1,1,1,0);
+    Write(200,1,1,0);
+    Write(201,1,1,0);
+    Write(210,1,1,0);
+    CHECK(g_Writes == writes, "%u writes reached the device before a flush", g_Writes - writes);
+    CHECK(!OnMedia(100,1,1) && !OnMedia(200,1,1), "dirty data on the media before a flush");
+    CHECK(Reads(100,64,1) && Reads(200,2,1), "dirty blocks read back wrong");
+    CHECK(g_Reads == reads, "reads of dirty blocks went to the device");
+
+    CHECK(NT_SUCCESS(BlockFlush(&g_Dev)), "flush");
+    CHECK(OnMedia(100,64,1) && OnMedia(200,2,1) && OnMedia(210,1,1), "flush left the media stale");
+    CHECK(g_Writes - writes == 3, "flush took %u requests, not 3", g_Writes - writes);
+    CHECK(g_Flushes > 0, "no device flush");
+    writes = g_Writes;
+    CHECK(NT_SUCCESS(BlockFlush(&g_Dev)) && g_Writes == writes, "a second flush wrote again");
+}
+
+static void Fua(void){
+    UINT32 writes, flushes;
+    Write(300,1,2,0);
+    writes = g_Writes;
+    Write(300,1,3,BLOCK_IO_FUA);
+    CHECK(g_Writes == writes + 1 && g_FuaWrites == 1, "FUA write: %u requests, %u flagged", g_Writes - writes, g_FuaWrites);
+    CHECK(OnMedia(300,1,3), "FUA data not on the media");
+    /* The cached copy is clean and current */
+    CHECK(NT_SUCCESS(BlockFlush(&g_Dev)) && g_Writes == writes + 1, "FUA left its buffer dirty");
+    CHECK(Reads(300,1,3), "FUA block reads back stale");
+
+    /* Emulated: a plain write, then a device flush */
+    g_Ext.Features &= ~BLOCK_FEATURE_FUA;
+    writes = g_Writes;
+    flushes = g_Flushes;
+    Write(301,1,4,BLOCK_IO_FUA);
+    CHECK(g_Writes == writes + 1 && g_FuaWrites == 1 && g_Flushes == flushes + 1, "emulated FUA: %u writes, %u flushes", g_Writes - writes, g_Flushes - flushes);
+    CHECK(OnMedia(301,1,4), "emulated FUA data not on the media");
+    g_Ext.Features |= BLOCK_FEATURE_FUA;
+}
+
+static void Eviction(void){
+    UINT32 writes, reads, wrong = 0;
+
+    /* Dirty blocks stay put while reads cycle the cache twice over */
+    for(UINT32 i=0;i<200;i++) Write(1000+i,1,5,0);
+    writes = g_Writes;
+    for(UINT32 i=0;i<2*CACHE_MAX;i++) if(!Reads(2000+i,1,0)) wrong++;
+    CHECK(wrong == 0, "%u blocks read back wrong", wrong);
+    CHECK(g_Writes == writes && !OnMedia(1000,1,5), "reads forced dirty blocks out");
+    reads = g_Reads;
+    CHECK(Reads(1000,200,5), "dirty blocks lost to eviction");
+    CHECK(g_Reads == reads, "dirty blocks were evicted and read from the device");
+
+    /* More blocks than the cache holds in one write: the dirty part is
+       written back to make room and the rest goes through */
+    Write(4000,CACHE_MAX + 100,6,0);
+    CHECK(OnMedia(1000,200,5), "dirty blocks not written back to make room");
+    CHECK(OnMedia(4000,CACHE_MAX + 100,6), "oversized write not on the media");
+    CHECK(Reads(4000,CACHE_MAX + 100,6), "oversized write reads back wrong");
+    writes = g_Writes;
+    CHECK(NT_SUCCESS(BlockFlush(&g_Dev)) && g_Writes == writes, "oversized write left dirty buffers");
+
+    /* Past the high-water mark the device is flushed without being asked */
+    for(UINT32 i=0;i<=HIGH_WATER;i++) Write(6000+2*i,1,7,0);
+    CHECK(g_Writes > writes && OnMedia(6000,1,7) && OnMedia(6000+2*HIGH_WATER,1,7), "high-water mark did not flush");
+}
+
+/* The writeback tick pushes out a buffer older than the expiry */
+static void Aging(void){
+    UINT32 writes;
+    CHECK(NT_SUCCESS(BlockFlush(&g_Dev)), "flush");
+    writes = g_Writes;
+    Write(7000,1,8,0);
+    BlockCacheWritebackTick();
+    CHECK(g_Writes == writes && !OnMedia(7000,1,8), "fresh buffer written back");
+    for(UINT32 i=0;i<EXPIRE && g_Writes == writes;i++) BlockCacheWritebackTick();
+    CHECK(g_Writes == writes + 1 && OnMedia(7000,1,8), "aged buffer not written back");
+}
+
+int main(void){
+    /* The media starts out holding seed 0 */
+    Fill(g_Media,0,BLOCKS,0);
+    g_Ext.BlockSize = BS;
+    g_Ext.BlockCount = BLOCKS;
+    g_Ext.BlockType = IO_BLOCK_TYPE_SDCARD;
+    g_Ext.Features = BLOCK_FEATURE_FUA | BLOCK_FEATURE_FLUSH;
+    g_Ext.CacheMode = BLOCK_CACHE_WRITEBACK;
+    g_Dev.DeviceExtension = &g_Ext;
+    CHECK(NT_SUCCESS(BlockRegisterRwHandler(IO_BLOCK_TYPE_SDCARD,SpyRw)), "register rw");
+    CHECK(NT_SUCCESS(BlockRegisterFlushHandler(IO_BLOCK_TYPE_SDCARD,SpyFlush)), "register flush");
+    CHECK(NT_SUCCESS(BlockCacheInitialize()), "cache init");
+
+    WriteBack();
+    Fua();
+    Eviction();
+    Aging();
+
+    printf("bcache: %s\n", g_Failures ? "FAILED" : "ok");
+    return g_Failures ? 1 : 0;
+}
@@ -0,0 +1,368 @@
+/* exFAT driver through the VFS
+ * Formats a RAM disk as exFAT (4 KiB clusters, a compressed up-case table),
+ * writes through the VFS, and checks the result both read back after a
+ * remount and straight off the disk after unmount:
+ *   - data written in odd-sized pieces across cluster and sector edges
+ *     reads back the same before and after a remount
+ *   - a file that grows into free space stays one NoFatChain run; two files
+ *     grown in alternation turn into FAT chains that read back in order
+ *   - each stream entry holds the new size under a valid set checksum, the
+ *     bitmap marks exactly the clusters in use, and unmount clears the
+ *     volume-dirty flag
+ *   - names match case-insensitively through the up-case table
+ *   - a read-only mount refuses writes */
+#include "../aurora.h"
+#include "../include/io.h"
+#include "../include/fs.h"
+
+int printf(const char* Format, ...);
+void* malloc(size_t Size);
+
+#define BS              512
+#define SPC_SHIFT       3                       /* 8 sectors, 4 KiB clusters */
+#define CLUSTER         (BS << SPC_SHIFT)
+#define FAT_OFFSET      24                      /* after the main and backup boot regions */
+#define EOC             0xFFFFFFFF
+
+#define BITMAP_CLUSTER  2
+#define UPCASE_CLUSTER  3
+#define ROOT_CLUSTER    4
+#define HELLO_CLUSTER   5
+
+#define STREAM_ALLOC    0x01
+#define STREAM_NO_FAT   0x02
+#define VOLUME_DIRTY    0x0002
+
+static int g_Failures;
+#define CHECK(c, ...) do { if(!(c)){ printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); g_Failures++; } } while(0)
+
+typedef struct _LAYOUT {
+    UINT32 FatSectors;
+    UINT32 HeapSector;
+    UINT32 Clusters;
+} LAYOUT;
+
+static LAYOUT g_Layout;
+static PAIO_DEVICE_OBJECT g_Disk;
+
+/* 'a'..'z' fold to 'A'..'Z'; everything else maps to itself */
+static UINT16 g_UpCase[2 + 26];
+
+static void Put16(UINT8* P, UINT16 V){ P[0]=(UINT8)V; P[1]=(UINT8)(V>>8); }
+static void Put32(UINT8* P, UINT32 V){ Put16(P,(UINT16)V); Put16(P+2,(UINT16)(V>>16)); }
+static void Put64(UINT8* P, UINT64 V){ Put32(P,(UINT32)V); Put32(P+4,(UINT32)(V>>32)); }
+static UINT16 Get16(const UINT8* P){ return (UINT16)(P[0] | (P[1]<<8)); }
+static UINT32 Get32(const UINT8* P){ return P[0] | (P[1]<<8) | (P[2]<<16) | ((UINT32)P[3]<<24); }
+static UINT64 Get64(const UINT8* P){ return Get32(P) | ((UINT64)Get32(P+4) << 32); }
+
+static UINT32 ClusterSector(UINT32 Cluster){ return g_Layout.HeapSector + ((Cluster - 2) << SPC_SHIFT); }
+
+static void WriteSector(UINT32 Sector, const UINT8* Data){
+    CHECK(NT_SUCCESS(BlockWrite(g_Disk,Sector,1,(PVOID)Data)), "format write sector %u", Sector);
+}
+
+static UINT16 Fold(UINT16 C){ return (C >= 'a' && C <= 'z') ? (UINT16)(C - 32) : C; }
+
+static UINT16 NameHash(const char* Name){
+    UINT16 hash = 0;
+    for(; *Name; Name++){
+        UINT16 c = Fold((UINT8)*Name);
+        hash = (UINT16)(((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c & 0xFF));
+        hash = (UINT16)(((hash & 1) ? 0x8000 : 0) + (hash >> 1) + (c >> 8));
+    }
+    return hash;
+}
+
+static UINT16 SetChecksum(const UINT8* Set, UINT32 Entries){
+    UINT16 sum = 0;
+    for(UINT32 i=0; i<Entries*32; i++){
+        if(i == 2 || i == 3) continue;
+        sum = (UINT16)(((sum & 1) ? 0x8000 : 0) + (sum >> 1) + Set[i]);
+    }
+    return sum;
+}
+
+/* File entry set for Name at E; returns the number of entries used */
+static UINT32 SetFile(UINT8* E, const char* Name, UINT32 Cluster, UINT64 Size){
+    UINT32 len = (UINT32)strlen(Name), names = (len + 14) / 15;
+    memset(E,0,(2 + names) * 32);
+    E[0] = 0x85; E[1] = (UINT8)(1 + names); Put16(E+4,0x20);
+    E[32] = 0xC0; E[33] = Cluster ? STREAM_ALLOC | STREAM_NO_FAT : 0; E[35] = (UINT8)len;
+    Put16(E+36,NameHash(Name)); Put64(E+40,Size); Put32(E+52,Cluster); Put64(E+56,Size);
+    for(UINT32 i=0; i<len; i++){
+        UINT8* n = E + (2 + i/15)*32;
+        n[0] = 0xC1;
+        Put16(n + 2 + (i%15)*2, (UINT16)Name[i]);
+    }
+    Put16(E+2,SetChecksum(E,2 + names));
+    return 2 + names;
+}
+
+static UINT32 BootChecksum(const UINT8* Region, UINT32 Bytes){
+    UINT32 sum = 0;
+    for(UINT32 i=0; i<Bytes; i++){
+        if(i == 106 || i == 107 || i == 112) continue;
+        sum = ((sum & 1) ? 0x80000000 : 0) + (sum >> 1) + Region[i];
+    }
+    return sum;
+}
+
+/* mkfs.exfat -s 8 equivalent: bitmap, up-case table and root in clusters
+ * 2-4, plus FILE.BIN, OTHER.BIN and FRAG.BIN (empty) and hello.txt (one
+ * cluster) in the root */
+static void Format(UINT32 Sectors){
+    static UINT8 region[12*BS];
+    UINT8 s[BS];
+    UINT32 at = 0;
+
+    g_Layout.FatSectors = 1;
+    for(;;){
+        UINT32 heap = (FAT_OFFSET + g_Layout.FatSectors + (1u << SPC_SHIFT) - 1) & ~((1u << SPC_SHIFT) - 1);
+        UINT32 clusters = (Sectors - heap) >> SPC_SHIFT;
+        UINT32 need = ((clusters + 2) * 4 + BS - 1) / BS;
+        g_Layout.HeapSector = heap;
+        g_Layout.Clusters = clusters;
+        if(need <= g_Layout.FatSectors) break;
+        g_Layout.FatSectors = need;
+    }
+
+    /* Main boot region, then the same again as the backup */
+    memset(region,0,sizeof(region));
+    region[0]=0xEB; region[1]=0x76; region[2]=0x90; memcpy(region+3,"EXFAT   ",8);
+    Put64(region+72,Sectors); Put32(region+80,FAT_OFFSET); Put32(region+84,g_Layout.FatSectors);
+    Put32(region+88,g_Layout.HeapSector); Put32(region+92,g_Layout.Clusters); Put32(region+96,ROOT_CLUSTER);
+    Put32(region+100,0x12345678); Put16(region+104,0x0100); region[108]=9; region[109]=SPC_SHIFT; region[110]=1;
+    region[111]=0x80; region[510]=0x55; region[511]=0xAA;
+    for(UINT32 i=1;i<=8;i++) Put32(region + i*BS + BS-4, 0xAA550000);
+    UINT32 sum = BootChecksum(region,11*BS);
+    for(UINT32 i=0;i<BS/4;i++) Put32(region + 11*BS + i*4, sum);
+    for(UINT32 i=0;i<12;i++){ WriteSector(i,region+i*BS); WriteSector(12+i,region+i*BS); }
+
+    /* FAT: the metadata and hello.txt are single clusters */
+    memset(s,0,BS);
+    for(UINT32 i=1;i<g_Layout.FatSectors;i++) WriteSector(FAT_OFFSET+i,s);
+    Put32(s,0xFFFFFFF8); Put32(s+4,EOC);
+    for(UINT32 c=BITMAP_CLUSTER;c<=HELLO_CLUSTER;c++) Put32(s+c*4,EOC);
+    WriteSector(FAT_OFFSET,s);
+
+    /* Bitmap, whole cluster */
+    memset(s,0,BS);
+    for(UINT32 i=1;i<(1u << SPC_SHIFT);i++) WriteSector(ClusterSector(BITMAP_CLUSTER)+i,s);
+    s[0] = 0x0F;
+    WriteSector(ClusterSector(BITMAP_CLUSTER),s);
+
+    /* Up-case table: identity up to 'a', then the 26 capitals */
+    g_UpCase[0] = 0xFFFF; g_UpCase[1] = 'a';
+    for(UINT32 i=0;i<26;i++) g_UpCase[2+i] = (UINT16)('A' + i);
+    memset(s,0,BS);
+    for(UINT32 i=0;i<sizeof(g_UpCase)/2;i++) Put16(s+i*2,g_UpCase[i]);
+    WriteSector(ClusterSector(UPCASE_CLUSTER),s);
+
+    /* Root directory */
+    memset(s,0,BS);
+    for(UINT32 i=1;i<(1u << SPC_SHIFT);i++) WriteSector(ClusterSector(ROOT_CLUSTER)+i,s);
+    s[0] = 0x81; Put32(s+20,BITMAP_CLUSTER); Put64(s+24,(g_Layout.Clusters + 7) / 8);
+    s[32] = 0x82; Put32(s+52,UPCASE_CLUSTER); Put64(s+56,sizeof(g_UpCase));
+    at = 64;
+    at += SetFile(s+at,"FILE.BIN",0,0) * 32;
+    at += SetFile(s+at,"OTHER.BIN",0,0) * 32;
+    at += SetFile(s+at,"FRAG.BIN",0,0) * 32;
+    at += SetFile(s+at,"hello.txt",HELLO_CLUSTER,13) * 32;
+    WriteSector(ClusterSector(ROOT_CLUSTER),s);
+
+    memset(s,0,BS);
+    memcpy(s,"hello, world\n",13);
+    WriteSector(ClusterSector(HELLO_CLUSTER),s);
+}
+
+/* ---------------- On-disk checks (volume unmounted) ---------------- */
+
+typedef struct _STREAM_INFO {
+    UINT8 Flags;
+    UINT32 Cluster;
+    UINT64 Size;
+    UINT64 ValidSize;
+    BOOL ChecksumOk;
+} STREAM_INFO;
+
+/* Stream entry of the root file Name (matched exactly) */
+static BOOL RootEntry(const char* Name, STREAM_INFO* Info){
+    static UINT8 dir[CLUSTER];
+    UINT32 len = (UINT32)strlen(Name);
+    CHECK(NT_SUCCESS(BlockRead(g_Disk,ClusterSector(ROOT_CLUSTER),CLUSTER/BS,dir)), "read root");
+    for(UINT32 o=0; o<CLUSTER && dir[o]; o+=32){
+        UINT8* e = dir + o;
+        if(e[0] != 0x85 || e[35] != len) continue;
+        UINT32 i;
+        for(i=0;i<len;i++) if(Get16(e + (2 + i/15)*32 + 2 + (i%15)*2) != (UINT8)Name[i]) break;
+        if(i < len) continue;
+        Info->Flags = e[33];
+        Info->Cluster = Get32(e+52);
+        Info->Size = Get64(e+56);
+        Info->ValidSize = Get64(e+40);
+        Info->ChecksumOk = SetChecksum(e,1 + e[1]) == Get16(e+2);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static UINT32 FatEntry(UINT32 Cluster){
+    UINT8 s[BS];
+    CHECK(NT_SUCCESS(BlockRead(g_Disk,FAT_OFFSET + Cluster/(BS/4),1,s)), "read FAT");
+    return Get32(s + (Cluster % (BS/4))*4);
+}
+
+static UINT32 ChainLength(UINT32 First){
+    UINT32 n = 0;
+    for(UINT32 c = First; c != EOC; c = FatEntry(c)){
+        if(c < 2 || c >= g_Layout.Clusters + 2 || ++n > g_Layout.Clusters) return 0xFFFFFFFF;
+    }
+    return n;
+}
+
+static UINT32 UsedClusters(void){
+    static UINT8 bitmap[CLUSTER];
+    UINT32 n = 0;
+    CHECK(NT_SUCCESS(BlockRead(g_Disk,ClusterSector(BITMAP_CLUSTER),CLUSTER/BS,bitmap)), "read bitmap");
+    for(UINT32 c=0;c<g_Layout.Clusters;c++) if((bitmap[c>>3] >> (c&7)) & 1) n++;
+    return n;
+}
+
+static BOOL VolumeDirty(void){
+    UINT8 s[BS];
+    CHECK(NT_SUCCESS(BlockRead(g_Disk,0,1,s)), "read boot sector");
+    return (Get16(s+106) & VOLUME_DIRTY) != 0;
+}
+
+/* ---------------- Tests ---------------- */
+
+static UINT8 Byte(UINT64 Off, UINT32 Seed){ return (UINT8)((Off * 131 + Seed) ^ (Off >> 9)); }
+
+static void Fill(UINT8* B, UINT64 Off, UINT32 Len, UINT32 Seed){ for(UINT32 i=0;i<Len;i++) B[i] = Byte(Off+i,Seed); }
+
+static BOOL Matches(const UINT8* B, UINT64 Off, UINT32 Len, UINT32 Seed){
+    for(UINT32 i=0;i<Len;i++) if(B[i] != Byte(Off+i,Seed)) return FALSE;
+    return TRUE;
+}
+
+static PFS_HANDLE Open(const char* Path){
+    PFS_HANDLE h = NULL;
+    CHECK(NT_SUCCESS(FsOpen(Path,&h)) && h, "open %s", Path);
+    return h;
+}
+
+static void WriteAt(PFS_HANDLE H, UINT64 Off, UINT32 Len, UINT32 Seed){
+    static UINT8 buf[65536];
+    UINT64 done = 0;
+    Fill(buf,Off,Len,Seed);
+    CHECK(NT_SUCCESS(FsWriteAt(H,Off,buf,Len,&done)) && done == Len, "write %u at %llu", Len, (unsigned long long)Off);
+}
+
+/* Path holds Size bytes of Seed's pattern */
+static void CheckContents(const char* Path, UINT32 Size, UINT32 Seed, const char* When){
+    static UINT8 buf[512*1024];
+    UINT64 done = 0;
+    PFS_HANDLE h = Open(Path);
+    if(!h) return;
+    memset(buf,0,Size + 1);
+    CHECK(NT_SUCCESS(FsReadAt(h,0,buf,Size + 1,&done)) && done == Size, "%s: read %llu of %u bytes %s", Path, (unsigned long long)done, Size, When);
+    CHECK(Matches(buf,0,Size,Seed), "%s: data wrong %s", Path, When);
+    CHECK(NT_SUCCESS(FsClose(h)), "close %s", Path);
+}
+
+static void Mount(void){ CHECK(NT_SUCCESS(FsMount("ram0","exfat","/x",NULL)), "mount"); }
+static void Unmount(void){ CHECK(NT_SUCCESS(FsUnmount("/x")), "unmount"); }
+
+#define FILE_SIZE   300001
+#define FRAG_SIZE   (16*CLUSTER + 100)
+
+/* Pieces of 1000-odd bytes cross every sector and cluster edge */
+static void RoundTrip(void){
+    static UINT8 buf[64];
+    UINT64 done = 0;
+    STREAM_INFO info;
+
+    Mount();
+    PFS_HANDLE h = Open("/x/hello.txt");
+    CHECK(NT_SUCCESS(FsReadAt(h,0,buf,sizeof(buf),&done)) && done == 13 && memcmp(buf,"hello, world\n",13) == 0, "hello.txt reads wrong");
+    CHECK(NT_SUCCESS(FsClose(h)), "close");
+
+    h = Open("/x/FILE.BIN");
+    for(UINT32 off=0; off<FILE_SIZE; off+=1237) WriteAt(h,off,off + 1237 > FILE_SIZE ? FILE_SIZE - off : 1237,1);
+    CHECK(NT_SUCCESS(FsClose(h)), "close");
+    CheckContents("/x/FILE.BIN",FILE_SIZE,1,"before unmount");
+    Unmount();
+
+    CHECK(!VolumeDirty(), "unmount left the volume dirty");
+    CHECK(RootEntry("FILE.BIN",&info), "FILE.BIN entry missing");
+    CHECK(info.ChecksumOk, "FILE.BIN set checksum wrong");
+    CHECK(info.Size == FILE_SIZE && info.ValidSize == FILE_SIZE, "FILE.BIN: size %llu, valid %llu", (unsigned long long)info.Size, (unsigned long long)info.ValidSize);
+    CHECK(info.Flags == (STREAM_ALLOC | STREAM_NO_FAT), "FILE.BIN grew into free space but flags are %x", info.Flags);
+    CHECK(UsedClusters() == 4 + (FILE_SIZE + CLUSTER - 1) / CLUSTER, "%u clusters in use", UsedClusters());
+
+    Mount();
+    CheckContents("/x/FILE.BIN",FILE_SIZE,1,"after remount");
+    CheckContents("/x/file.bin",FILE_SIZE,1,"under a lower-case name");
+    Unmount();
+}
+
+/* One cluster at a time in alternation, each flushed before the next, so
+ * neither file can stay contiguous */
+static void Fragmented(void){
+    STREAM_INFO a, b;
+    UINT32 used = UsedClusters();
+    Mount();
+    PFS_HANDLE ha = Open("/x/OTHER.BIN"), hb = Open("/x/FRAG.BIN");
+    for(UINT32 off=0; off<FRAG_SIZE; off+=CLUSTER){
+        UINT32 n = off + CLUSTER > FRAG_SIZE ? FRAG_SIZE - off : CLUSTER;
+        WriteAt(ha,off,n,2);
+        CHECK(NT_SUCCESS(FsFlush(ha)), "flush OTHER.BIN");
+        WriteAt(hb,off,n,3);
+        CHECK(NT_SUCCESS(FsFlush(hb)), "flush FRAG.BIN");
+    }
+    CHECK(NT_SUCCESS(FsClose(ha)) && NT_SUCCESS(FsClose(hb)), "close");
+    Unmount();
+
+    CHECK(RootEntry("OTHER.BIN",&a) && RootEntry("FRAG.BIN",&b), "entries missing");
+    CHECK(a.ChecksumOk && b.ChecksumOk, "set checksums wrong");
+    CHECK(a.Size == FRAG_SIZE && b.Size == FRAG_SIZE, "sizes %llu and %llu", (unsigned long long)a.Size, (unsigned long long)b.Size);
+    CHECK(a.Flags == STREAM_ALLOC && b.Flags == STREAM_ALLOC, "alternating files still flagged NoFatChain: %x %x", a.Flags, b.Flags);
+    CHECK(ChainLength(a.Cluster) == 17 && ChainLength(b.Cluster) == 17, "chains of %u and %u clusters", ChainLength(a.Cluster), ChainLength(b.Cluster));
+    CHECK(UsedClusters() == used + 34, "%u clusters in use, expected %u", UsedClusters(), used + 34);
+
+    Mount();
+    CheckContents("/x/OTHER.BIN",FRAG_SIZE,2,"after remount");
+    CheckContents("/x/FRAG.BIN",FRAG_SIZE,3,"after remount");
+    CheckContents("/x/FILE.BIN",FILE_SIZE,1,"next to the chained files");
+    Unmount();
+}
+
+static void ReadOnly(void){
+    PFS_HANDLE h;
+    UINT64 done = 0;
+    UINT8 b = 0xFF;
+    CHECK(NT_SUCCESS(FsMount("ram0","exfat","/x","ro")), "read-only mount");
+    h = Open("/x/FILE.BIN");
+    CHECK(!NT_SUCCESS(FsWriteAt(h,0,&b,1,&done)) || !NT_SUCCESS(FsFlush(h)), "read-only mount took a write");
+    FsClose(h);
+    Unmount();
+    Mount();
+    CheckContents("/x/FILE.BIN",FILE_SIZE,1,"after a write to a read-only mount");
+    Unmount();
+}
+
+int main(void){
+    AuroraSetCommandLine("ramdisk_count=1 ramdisk_size=32M");
+    CHECK(NT_SUCCESS(RamDiskInitialize()), "ramdisk init");
+    g_Disk = RamDiskGetDevice(0);
+    if(!g_Disk){ printf("FAIL: ram0 not created\n"); return 1; }
+    Format((UINT32)((PBLOCK_DEVICE_EXTENSION)g_Disk->DeviceExtension)->BlockCount);
+    CHECK(NT_SUCCESS(FsInitialize()), "fs init");
+
+    RoundTrip();
+    Fragmented();
+    ReadOnly();
+
+    printf("exfat: %s\n", g_Failures ? "FAILED" : "ok");
+    return g_Failures ? 1 : 0;
+}
@@ -0,0 +1,338 @@
+/* FAT32 driver through the VFS
+ * Formats a RAM disk as FAT32 (one 512-byte sector per cluster), mounts it
+ * and checks the on-disk result after unmount by reading the FAT and the
+ * root directory straight off the disk:
+ *   - two handles on one file share its chain, so a flush through a handle
+ *     opened before the file had clusters neither allocates a second chain
+ *     nor leaks the first, and a close only trims once the last one goes
+ *   - every cluster marked in use belongs to a file (no leaked runs)
+ *   - mount, unmount and a failed mount give back every page they took
+ *   - two files appended 4 KiB at a time in alternation end up in at most
+ *     two runs each, one per writeback
+ *   - a 1 MiB keep-size reservation stays whole while another file is
+ *     written back, and close frees the part that was not written
+ * Usage: fat32_test resident|cached (a FAT small enough to load whole, or
+ * one large enough for the sector cache) */
+#include "../aurora.h"
+#include "../include/io.h"
+#include "../include/fs.h"
+#include "../include/mem.h"
+
+int printf(const char* Format, ...);
+int strcmp(const char* A, const char* B);
+void* malloc(size_t Size);
+void free(void* Ptr);
+
+extern SIZE_T g_HostPagesInUse;
+
+#define BS          512
+#define RESERVED    32
+#define NUM_FATS    2
+#define EOC         0x0FFFFFFF
+
+static int g_Failures;
+#define CHECK(c, ...) do { if(!(c)){ printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); g_Failures++; } } while(0)
+
+typedef struct _LAYOUT {
+    UINT32 FatSectors;
+    UINT32 DataSector;
+    UINT32 Clusters;
+} LAYOUT;
+
+static LAYOUT g_Layout;
+static UINT32 g_Sectors;
+static PAIO_DEVICE_OBJECT g_Disk;
+
+static void Put16(UINT8* P, UINT16 V){ P[0]=(UINT8)V; P[1]=(UINT8)(V>>8); }
+static void Put32(UINT8* P, UINT32 V){ Put16(P,(UINT16)V); Put16(P+2,(UINT16)(V>>16)); }
+static UINT32 Get32(const UINT8* P){ return P[0] | (P[1]<<8) | (P[2]<<16) | ((UINT32)P[3]<<24); }
+
+static void WriteSector(UINT32 Sector, const UINT8* Data){
+    CHECK(NT_SUCCESS(BlockWrite(g_Disk,Sector,1,(PVOID)Data)), "format write sector %u", Sector);
+}
+
+static void SetDirent(UINT8* E, const char* Name83, UINT8 Attr, UINT32 Cluster, UINT32 Size){
+    memcpy(E,Name83,11);
+    E[11] = Attr;
+    Put16(E+20,(UINT16)(Cluster>>16));
+    Put16(E+26,(UINT16)Cluster);
+    Put32(E+28,Size);
+}
+
+/* mkfs.vfat -F 32 -s 1 -R 32 equivalent, plus FILE.BIN and FILE2.BIN
+ * (empty) and HELLO.TXT (one cluster) in the root */
+static void Format(UINT32 Sectors){
+    UINT8 s[BS];
+    UINT32 fs = 1;
+    g_Sectors = Sectors;
+    for(;;){
+        UINT32 clusters = Sectors - RESERVED - NUM_FATS*fs;
+        UINT32 need = ((clusters + 2) * 4 + BS - 1) / BS;
+        if(need <= fs) break;
+        fs = need;
+    }
+    g_Layout.FatSectors = fs;
+    g_Layout.DataSector = RESERVED + NUM_FATS*fs;
+    g_Layout.Clusters = Sectors - g_Layout.DataSector;
+
+    memset(s,0,BS);
+    s[0]=0xEB; s[1]=0x58; s[2]=0x90; memcpy(s+3,"AURTEST ",8);
+    Put16(s+11,BS); s[13]=1; Put16(s+14,RESERVED); s[16]=NUM_FATS; s[21]=0xF8;
+    Put32(s+32,Sectors); Put32(s+36,fs); Put32(s+44,2); Put16(s+48,1); Put16(s+50,6);
+    s[66]=0x29; memcpy(s+82,"FAT32   ",8); s[510]=0x55; s[511]=0xAA;
+    WriteSector(0,s);
+    WriteSector(6,s);
+
+    memset(s,0,BS);
+    Put32(s,0x41615252); Put32(s+484,0x61417272); Put32(s+488,g_Layout.Clusters-2); Put32(s+492,4); Put32(s+508,0xAA550000);
+    WriteSector(1,s);
+
+    for(UINT32 f=0; f<NUM_FATS; f++){
+        memset(s,0,BS);
+        for(UINT32 i=1; i<fs; i++) WriteSector(RESERVED + f*fs + i, s);
+        Put32(s,0x0FFFFFF8); Put32(s+4,EOC); Put32(s+8,EOC); Put32(s+12,EOC);
+        WriteSector(RESERVED + f*fs, s);
+    }
+
+    memset(s,0,BS);
+    SetDirent(s,"FILE    BIN",0x20,0,0);
+    SetDirent(s+32,"HELLO   TXT",0x20,3,13);
+    SetDirent(s+64,"FILE2   BIN",0x20,0,0);
+    WriteSector(g_Layout.DataSector,s);
+    memset(s,0,BS);
+    memcpy(s,"hello, world\n",13);
+    WriteSector(g_Layout.DataSector+1,s);
+}
+
+/* ---------------- On-disk checks (volume unmounted) ---------------- */
+
+static UINT32* g_Fat;
+
+static void LoadFat(void){
+    UINT32 bytes = g_Layout.FatSectors * BS;
+    if(!g_Fat) g_Fat = (UINT32*)malloc(bytes);
+    CHECK(NT_SUCCESS(BlockRead(g_Disk,RESERVED,g_Layout.FatSectors,g_Fat)), "read FAT");
+}
+
+static UINT32 ChainLength(UINT32 First){
+    UINT32 n = 0;
+    for(UINT32 c = First; c >= 2 && c < 0x0FFFFFF8; c = g_Fat[c] & 0x0FFFFFFF){
+        if(c > g_Layout.Clusters + 1 || ++n > g_Layout.Clusters) return 0xFFFFFFFF;
+    }
+    return n;
+}
+
+/* Contiguous stretches in the chain from First */
+static UINT32 Runs(UINT32 First){
+    UINT32 n = 0;
+    if(ChainLength(First) == 0xFFFFFFFF) return 0xFFFFFFFF;
+    for(UINT32 c = First; c >= 2 && c < 0x0FFFFFF8; c = g_Fat[c] & 0x0FFFFFFF){
+        if((g_Fat[c] & 0x0FFFFFFF) != c + 1) n++;
+    }
+    return n;
+}
+
+static UINT32 UsedClusters(void){
+    UINT32 n = 0;
+    for(UINT32 c=2; c<g_Layout.Clusters+2; c++) if(g_Fat[c] & 0x0FFFFFFF) n++;
+    return n;
+}
+
+static void RootEntry(const char* Name83, PUINT32 Cluster, PUINT32 Size){
+    UINT8 s[BS];
+    *Cluster = *Size = 0xFFFFFFFF;
+    CHECK(NT_SUCCESS(BlockRead(g_Disk,g_Layout.DataSector,1,s)), "read root");
+    for(UINT32 o=0; o<BS; o+=32){
+        if(memcmp(s+o,Name83,11) == 0){
+            *Cluster = ((UINT32)(s[o+20] | (s[o+21]<<8)) << 16) | s[o+26] | (s[o+27]<<8);
+            *Size = Get32(s+o+28);
+        }
+    }
+}
+
+/* FILE.BIN holds Size bytes in a chain of exactly its length, and besides
+ * the root and HELLO.TXT nothing else is allocated */
+static void CheckFile(UINT32 Size, const char* What){
+    UINT32 cluster, size, want = (Size + BS - 1) / BS;
+    LoadFat();
+    RootEntry("FILE    BIN",&cluster,&size);
+    CHECK(size == Size, "%s: dirent size %u, expected %u", What, size, Size);
+    CHECK(ChainLength(cluster) == want, "%s: chain of %u clusters, expected %u", What, ChainLength(cluster), want);
+    CHECK(UsedClusters() == 2 + want, "%s: %u clusters in use, expected %u", What, UsedClusters(), 2 + want);
+}
+
+/* ---------------- Tests ---------------- */
+
+static UINT8 Byte(UINT64 Off, UINT32 Seed){ return (UINT8)((Off * 131 + Seed) ^ (Off >> 9)); }
+
+static void Fill(UINT8* B, UINT64 Off, UINT32 Len, UINT32 Seed){ for(UINT32 i=0;i<Len;i++) B[i] = Byte(Off+i,Seed); }
+
+static BOOL Matches(const UINT8* B, UINT64 Off, UINT32 Len, UINT32 Seed){
+    for(UINT32 i=0;i<Len;i++) if(B[i] != Byte(Off+i,Seed)) return FALSE;
+    return TRUE;
+}
+
+static PFS_HANDLE Open(const char* Path){
+    PFS_HANDLE h = NULL;
+    CHECK(NT_SUCCESS(FsOpen(Path,&h)) && h, "open %s", Path);
+    return h;
+}
+
+static void WriteAt(PFS_HANDLE H, UINT64 Off, UINT32 Len, UINT32 Seed){
+    static UINT8 buf[65536];
+    UINT64 done = 0;
+    Fill(buf,Off,Len,Seed);
+    CHECK(NT_SUCCESS(FsWriteAt(H,Off,buf,Len,&done)) && done == Len, "write %u at %llu", Len, (unsigned long long)Off);
+}
+
+static void Mount(void){ CHECK(NT_SUCCESS(FsMount("ram0","fat32","/mnt",NULL)), "mount"); }
+static void Unmount(void){ CHECK(NT_SUCCESS(FsUnmount("/mnt")), "unmount"); }
+
+/* The second handle is opened while the file has no clusters; the flush
+ * through it must extend the chain the first one allocated */
+static void SharedHandles(void){
+    static UINT8 buf[8192];
+    UINT64 done = 0;
+    Mount();
+    PFS_HANDLE a = Open("/mnt/FILE.BIN"), b = Open("/mnt/FILE.BIN");
+    WriteAt(a,0,3000,1);
+    CHECK(NT_SUCCESS(FsFlush(a)), "flush a");
+    WriteAt(b,3000,2000,1);
+    CHECK(NT_SUCCESS(FsFlush(b)), "flush b");
+    CHECK(NT_SUCCESS(FsClose(b)), "close b");
+    CHECK(NT_SUCCESS(FsReadAt(a,0,buf,sizeof(buf),&done)) && done == 5000, "read back %llu bytes", (unsigned long long)done);
+    CHECK(Matches(buf,0,5000,1), "data read through a");
+    CHECK(NT_SUCCESS(FsClose(a)), "close a");
+    Unmount();
+    CheckFile(5000, "shared handles");
+
+    /* A fresh mount sees the same bytes */
+    Mount();
+    a = Open("/mnt/FILE.BIN");
+    memset(buf,0,sizeof(buf));
+    CHECK(NT_SUCCESS(FsReadAt(a,0,buf,sizeof(buf),&done)) && done == 5000, "reread %llu bytes", (unsigned long long)done);
+    CHECK(Matches(buf,0,5000,1), "data after remount");
+    CHECK(NT_SUCCESS(FsClose(a)), "close");
+    Unmount();
+}
+
+/* Clusters reserved through one handle survive another handle's close and
+ * are trimmed back to the size at the last close */
+static void TrimAtLastClose(void){
+    static UINT8 buf[32768];
+    UINT64 done = 0;
+    Mount();
+    PFS_HANDLE a = Open("/mnt/FILE.BIN"), b = Open("/mnt/FILE.BIN");
+    CHECK(NT_SUCCESS(FsAllocate(a,0,65536,FS_ALLOCATE_KEEP_SIZE)), "allocate");
+    WriteAt(b,5000,100,2);
+    CHECK(NT_SUCCESS(FsClose(b)), "close b");
+    WriteAt(a,20000,1000,3);
+    CHECK(NT_SUCCESS(FsFlush(a)), "flush a");
+    CHECK(NT_SUCCESS(FsReadAt(a,0,buf,sizeof(buf),&done)) && done == 21000, "size %llu", (unsigned long long)done);
+    CHECK(Matches(buf,0,5000,1) && Matches(buf+5000,5000,100,2) && Matches(buf+20000,20000,1000,3), "data");
+    CHECK(NT_SUCCESS(FsClose(a)), "close a");
+    Unmount();
+    CheckFile(21000, "trim at last close");
+}
+
+/* Pages taken by a mount (FAT buffer, dirty bits, free-run index) come back
+ * at unmount, and a mount that fails gives back what it took */
+static void NoPageLeaks(void){
+    SIZE_T before;
+    Mount();
+    PFS_HANDLE h = Open("/mnt/FILE.BIN");
+    WriteAt(h,21000,4096,4);
+    CHECK(NT_SUCCESS(FsClose(h)), "close");
+    Unmount();
+    before = g_HostPagesInUse;
+    for(int i=0;i<8;i++){
+        Mount();
+        h = Open("/mnt/HELLO.TXT");
+        CHECK(NT_SUCCESS(FsClose(h)), "close");
+        Unmount();
+    }
+    CHECK(g_HostPagesInUse == before, "mount/unmount cycles leaked %lld pages", (long long)(g_HostPagesInUse - before));
+    before = g_HostPagesInUse;
+    CHECK(!NT_SUCCESS(FsMount("ram1","fat32","/bad",NULL)), "blank disk mounted");
+    CHECK(g_HostPagesInUse == before, "failed mount leaked %lld pages", (long long)(g_HostPagesInUse - before));
+    CheckFile(25096, "after cycles");
+}
+
+/* Writeback gives each file its dirty range as one run, so files appended
+ * in alternation interleave once per flush rather than once per write. A
+ * 64-cluster hole left ahead of FILE2.BIN would swallow a page-sized
+ * request; it must be passed over for the whole range. */
+static void AlternatingAppends(void){
+    UINT32 ca, sa, cb, sb, size = 128*4096;
+    Format(g_Sectors);
+    Mount();
+    PFS_HANDLE a = Open("/mnt/FILE.BIN"), b = Open("/mnt/FILE2.BIN");
+    CHECK(NT_SUCCESS(FsAllocate(a,0,64*BS,FS_ALLOCATE_KEEP_SIZE)), "reserve");
+    WriteAt(b,0,4096,6);
+    CHECK(NT_SUCCESS(FsFlush(b)), "flush b");
+    CHECK(NT_SUCCESS(FsClose(a)), "close a");
+    a = Open("/mnt/FILE.BIN");
+    for(UINT32 i=0; i<128; i++){
+        WriteAt(a,(UINT64)i*4096,4096,5);
+        WriteAt(b,(UINT64)(i+1)*4096,4096,6);
+        if(i == 63) CHECK(NT_SUCCESS(FsFlush(b)) && NT_SUCCESS(FsFlush(a)), "flush halfway");
+    }
+    CHECK(NT_SUCCESS(FsClose(a)) && NT_SUCCESS(FsClose(b)), "close");
+    Unmount();
+    LoadFat();
+    RootEntry("FILE    BIN",&ca,&sa);
+    RootEntry("FILE2   BIN",&cb,&sb);
+    CHECK(sa == size && ChainLength(ca) == size/BS, "FILE.BIN: %u bytes in %u clusters", sa, ChainLength(ca));
+    CHECK(sb == size + 4096 && ChainLength(cb) == (size + 4096)/BS, "FILE2.BIN: %u bytes in %u clusters", sb, ChainLength(cb));
+    CHECK(Runs(ca) <= 2 && Runs(cb) <= 2, "alternating appends: %u and %u runs", Runs(ca), Runs(cb));
+    for(UINT32 c=4; c<4+64; c++) if(g_Fat[c]){ CHECK(FALSE, "cluster %u of the hole was used", c); break; }
+    CHECK(UsedClusters() == 2 + (2*size + 4096)/BS, "%u clusters in use", UsedClusters());
+}
+
+/* A keep-size reservation holds its clusters past end of file while
+ * another file is written back, and close frees what was not written */
+static void Reservation(void){
+    static UINT8 buf[4096];
+    UINT32 ca, sa, cb, sb, want = (100000 + BS - 1) / BS;
+    UINT64 done = 0;
+    Format(g_Sectors);
+    Mount();
+    PFS_HANDLE a = Open("/mnt/FILE.BIN"), b = Open("/mnt/FILE2.BIN");
+    CHECK(NT_SUCCESS(FsAllocate(a,0,1024*1024,FS_ALLOCATE_KEEP_SIZE)), "reserve 1 MiB");
+    for(UINT32 off=0; off<256*1024; off+=4096) WriteAt(b,off,4096,7);
+    CHECK(NT_SUCCESS(FsFlush(b)), "flush b");
+    for(UINT32 off=0; off<100000; off+=4096) WriteAt(a,off,off + 4096 > 100000 ? 100000 - off : 4096,8);
+    CHECK(NT_SUCCESS(FsFlush(a)), "flush a");
+    CHECK(NT_SUCCESS(FsReadAt(a,98304,buf,sizeof(buf),&done)) && done == 100000 - 98304, "keep-size grew the file");
+    CHECK(NT_SUCCESS(FsClose(b)) && NT_SUCCESS(FsClose(a)), "close");
+    Unmount();
+    LoadFat();
+    RootEntry("FILE    BIN",&ca,&sa);
+    RootEntry("FILE2   BIN",&cb,&sb);
+    CHECK(sa == 100000 && ChainLength(ca) == want && Runs(ca) == 1, "FILE.BIN: %u bytes in %u clusters", sa, ChainLength(ca));
+    /* The reservation was one run from FILE.BIN's first cluster */
+    CHECK(sb == 256*1024 && ChainLength(cb) == 256*1024/BS && Runs(cb) == 1, "FILE2.BIN: %u clusters in %u runs", ChainLength(cb), Runs(cb));
+    CHECK(cb + 256*1024/BS <= ca || cb >= ca + 1024*1024/BS, "FILE2.BIN at %u inside the reservation at %u", cb, ca);
+    CHECK(UsedClusters() == 2 + want + 256*1024/BS, "reservation not freed at close: %u clusters in use", UsedClusters());
+}
+
+int main(int argc, char** argv){
+    BOOL cached = argc > 1 && strcmp(argv[1],"cached") == 0;
+    /* 64 MiB gives a 512 KiB FAT; 160 MiB one past the 1 MiB resident limit */
+    AuroraSetCommandLine(cached ? "ramdisk_count=2 ramdisk_size=160M" : "ramdisk_count=2 ramdisk_size=64M");
+    CHECK(NT_SUCCESS(RamDiskInitialize()), "ramdisk init");
+    g_Disk = RamDiskGetDevice(0);
+    if(!g_Disk){ printf("FAIL: ram0 not created\n"); return 1; }
+    Format((UINT32)((PBLOCK_DEVICE_EXTENSION)g_Disk->DeviceExtension)->BlockCount);
+    CHECK(cached == (g_Layout.FatSectors * BS > 1024*1024), "FAT of %u sectors is not %s", g_Layout.FatSectors, cached ? "cached" : "resident");
+    CHECK(NT_SUCCESS(FsInitialize()), "fs init");
+
+    SharedHandles();
+    TrimAtLastClose();
+    NoPageLeaks();
+    AlternatingAppends();
+    Reservation();
+
+    printf("fat32 %s: %s\n", cached ? "cached" : "resident", g_Failures ? "FAILED" : "ok");
+    return g_Failures ? 1 : 0;
+}
@@ -0,0 +1,434 @@
+/* Registry hive
+ * Builds hives in memory and on a tmpfs volume mounted at /h:
+ *   - CRC32 and CRC32C match the standard check values and a bitwise
+ *     reference at every length, and combining two CRCs equals the CRC of
+ *     the joined buffers
+ *   - a key with more subkeys than one lh leaf holds turns into an ri index
+ *     of leaves, lists and finds every subkey, and collapses back to one lh
+ *     leaf once most are deleted
+ *   - values of 4 bytes or less are stored inline in their value cell and,
+ *     like a larger value, read back the same from a demand-loaded reload
+ *   - flushes write LOG1 and LOG2 in turn; after a crash the newest log is
+ *     replayed, a torn newest log falls back to the older one, and loading
+ *     reconciles the replayed log into the primary file
+ *   - HiveCompactStep, run to completion in small steps, shrinks a
+ *     fragmented hive and every key and value left reads back, down a key
+ *     chain deeper than a recursive walk could take
+ *   - NTCoreGetValues answers a repeated read from its value cache, and
+ *     goes back to the hive once NTCoreSetValues changed the key */
+#include "../aurora.h"
+#include "../include/fs.h"
+#include "../config/hive/hive.h"
+
+int printf(const char* Format, ...);
+
+static int g_Failures;
+#define CHECK(c, ...) do { if(!(c)){ printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); g_Failures++; } } while(0)
+
+/* NTCore has no header of its own; these mirror config/ntcore/api.c */
+typedef enum _NTCORE_VALUE_TYPE {
+    NTCoreValueString = 1,
+    NTCoreValueDword = 2,
+    NTCoreValueQword = 3,
+    NTCoreValueBinary = 4,
+    NTCoreValueMultiString = 5
+} NTCORE_VALUE_TYPE;
+
+typedef struct _NTCORE_VALUE_REQUEST {
+    UINT32 KeyHandle;
+    PCSTR ValueName;
+    NTCORE_VALUE_TYPE Type;
+    PVOID Data;
+    UINT32 BufferSize;
+    UINT32 DataSize;
+    NTSTATUS Status;
+    UINT32 Generation;
+    BOOLEAN FromCache;
+} NTCORE_VALUE_REQUEST, *PNTCORE_VALUE_REQUEST;
+
+typedef struct _NTCORE_VALUE_CACHE* PNTCORE_VALUE_CACHE;
+
+NTSTATUS NTCoreInitializeConfig(void);
+NTSTATUS NTCoreCreateKey(IN PCSTR KeyPath, OUT PUINT32 KeyHandle);
+NTSTATUS NTCoreCreateValueCache(IN UINT32 EntryCount, OUT PNTCORE_VALUE_CACHE* Cache);
+VOID NTCoreDestroyValueCache(IN PNTCORE_VALUE_CACHE Cache);
+NTSTATUS NTCoreGetValueCacheStatistics(IN PNTCORE_VALUE_CACHE Cache, OUT PUINT32 Hits, OUT PUINT32 Misses);
+NTSTATUS NTCoreGetValues(IN PNTCORE_VALUE_CACHE Cache, IN OUT PNTCORE_VALUE_REQUEST Requests, IN UINT32 Count);
+NTSTATUS NTCoreSetValues(IN OUT PNTCORE_VALUE_REQUEST Requests, IN UINT32 Count);
+
+#define INDEX_KEYS      1500
+#define INDEX_KEEP      5
+#define COMPACT_KEYS    2000
+#define CHAIN_DEPTH     300
+#define COMPACT_BUDGET  (16 * 1024)
+
+/* "<Prefix><n>" */
+static const char* Name(const char* Prefix, UINT32 N){
+    static char name[64];
+    char digits[12];
+    UINT32 n = 0, at = 0;
+    while(*Prefix) name[at++] = *Prefix++;
+    do { digits[n++] = (char)('0' + N % 10); N /= 10; } while(N);
+    while(n) name[at++] = digits[--n];
+    name[at] = '\0';
+    return name;
+}
+
+static PHIVE NewHive(const char* HiveName, UINT32 Size){
+    PHIVE h = NULL;
+    CHECK(NT_SUCCESS(HiveInitialize(&h,HiveName,HiveTypeUser)), "init %s", HiveName);
+    CHECK(h && NT_SUCCESS(HiveCreate(h,Size)), "create %s", HiveName);
+    return h;
+}
+
+static UINT16 CellSignature(PHIVE Hive, UINT32 Offset){
+    return ((PCELL_HEADER)((UINT8*)Hive->BaseAddress + Offset))->Signature;
+}
+
+static UINT32 GetDword(PHIVE Hive, UINT32 Key, PCSTR Value){
+    UINT32 data = 0xFFFFFFFF, size = sizeof(data), type = 0;
+    if(!NT_SUCCESS(HiveGetValue(Hive,Key,Value,&type,&data,&size)) || size != sizeof(data) || type != ValueTypeDword) return 0xFFFFFFFF;
+    return data;
+}
+
+/* ---------------- CRC ---------------- */
+
+static UINT32 CrcReference(UINT32 Polynomial, const UINT8* p, UINT32 n){
+    UINT32 c = 0xFFFFFFFF;
+    while(n--){
+        c ^= *p++;
+        for(int k=0;k<8;k++) c = (c >> 1) ^ (Polynomial & (0u - (c & 1)));
+    }
+    return ~c;
+}
+
+static void Crc(void){
+    static UINT8 buf[70000];
+    UINT32 seed = 12345, bad = 0;
+    for(UINT32 i=0;i<sizeof(buf);i++){ seed = seed*1103515245 + 12345; buf[i] = (UINT8)(seed >> 16); }
+
+    AuroraCrc32Initialize();
+    CHECK(AuroraCrc32(AuroraCrcIeee,0,"123456789",9) == 0xCBF43926, "crc32 check value");
+    CHECK(AuroraCrc32(AuroraCrcCastagnoli,0,"123456789",9) == 0xE3069283, "crc32c check value");
+    CHECK(HiveCalculateCrc32Checksum("123456789",9) == 0xCBF43926, "hive crc32");
+    CHECK(HiveCalculateCrc32cChecksum("123456789",9) == 0xE3069283, "hive crc32c");
+
+    /* Every length through the short and unaligned paths, from odd starts */
+    for(UINT32 n=0;n<300;n++){
+        if(AuroraCrc32(AuroraCrcIeee,0,buf+(n&7),n) != CrcReference(0xEDB88320,buf+(n&7),n)) bad++;
+        if(AuroraCrc32(AuroraCrcCastagnoli,0,buf+(n&7),n) != CrcReference(0x82F63B78,buf+(n&7),n)) bad++;
+    }
+    CHECK(bad == 0, "%u short crcs differ from the reference", bad);
+    CHECK(AuroraCrc32(AuroraCrcIeee,0,buf+1,sizeof(buf)-1) == CrcReference(0xEDB88320,buf+1,sizeof(buf)-1), "long crc32");
+    CHECK(AuroraCrc32(AuroraCrcCastagnoli,0,buf+1,sizeof(buf)-1) == CrcReference(0x82F63B78,buf+1,sizeof(buf)-1), "long crc32c");
+
+    for(int kind=0;kind<2;kind++){
+        AURORA_CRC k = kind ? AuroraCrcCastagnoli : AuroraCrcIeee;
+        UINT32 whole = AuroraCrc32(k,0,buf,sizeof(buf));
+        UINT32 splits[] = { 0, 1, 1234, 65536, sizeof(buf)-1, sizeof(buf) };
+        for(UINT32 i=0;i<sizeof(splits)/sizeof(splits[0]);i++){
+            UINT32 s = splits[i];
+            UINT32 a = AuroraCrc32(k,0,buf,s), b = AuroraCrc32(k,0,buf+s,sizeof(buf)-s);
+            CHECK(AuroraCrc32Combine(k,a,b,sizeof(buf)-s) == whole, "combine kind %d split %u", kind, s);
+            CHECK(AuroraCrc32CombineWith(k,AuroraCrc32CombineOperator(k,sizeof(buf)-s),a,b) == whole, "combine operator kind %d split %u", kind, s);
+            CHECK(AuroraCrc32(k,a,buf+s,sizeof(buf)-s) == whole, "chained kind %d split %u", kind, s);
+        }
+    }
+}
+
+/* ---------------- Subkey index ---------------- */
+
+static void Index(void){
+    PHIVE h = NewHive("INDEX", 1024*1024);
+    UINT32 parent, key, missing = 0, listed = 0;
+    CHAR name[64];
+
+    CHECK(NT_SUCCESS(HiveCreateKey(h,"Index",&parent)), "create Index");
+    for(UINT32 i=0;i<INDEX_KEYS;i++){
+        if(!NT_SUCCESS(HiveCreateKey(h,Name("Index\\k",i),&key))){ missing++; }
+    }
+    CHECK(missing == 0, "%u subkeys not created", missing);
+
+    PKEY_CELL p = HiveGetKeyCell(h,parent);
+    CHECK(p->SubKeysCount == INDEX_KEYS, "%u subkeys counted", p->SubKeysCount);
+    CHECK(CellSignature(h,p->SubKeysList) == CellTypeIndexRoot, "no ri index past one leaf");
+    if(CellSignature(h,p->SubKeysList) == CellTypeIndexRoot){
+        PINDEX_ROOT_CELL root = (PINDEX_ROOT_CELL)HiveGetCell(h,p->SubKeysList);
+        CHECK(root->Count >= (INDEX_KEYS + HIVE_INDEX_LEAF_MAX - 1) / HIVE_INDEX_LEAF_MAX, "ri index of %u leaves", root->Count);
+    }
+
+    /* Lookups walk the index, not the hint cache */
+    HiveClearHints(h);
+    missing = 0;
+    for(UINT32 i=0;i<INDEX_KEYS;i++) if(!NT_SUCCESS(HiveFindKey(h,Name("Index\\k",i),&key))) missing++;
+    CHECK(missing == 0, "%u subkeys not found through the ri index", missing);
+    for(;;){
+        UINT32 size = sizeof(name);
+        if(HiveEnumerateKeys(h,parent,listed,name,&size) != STATUS_SUCCESS) break;
+        listed++;
+    }
+    CHECK(listed == INDEX_KEYS, "%u of %u subkeys listed", listed, INDEX_KEYS);
+
+    for(UINT32 i=INDEX_KEEP;i<INDEX_KEYS;i++){
+        if(!NT_SUCCESS(HiveDeleteKey(h,Name("Index\\k",i)))) missing++;
+    }
+    CHECK(missing == 0, "%u subkeys not deleted", missing);
+    p = HiveGetKeyCell(h,parent);
+    CHECK(p->SubKeysCount == INDEX_KEEP, "%u subkeys left", p->SubKeysCount);
+    CHECK(CellSignature(h,p->SubKeysList) == CellTypeHashLeaf, "ri index did not collapse to an lh leaf");
+
+    HiveClearHints(h);
+    for(UINT32 i=0;i<INDEX_KEYS;i++){
+        NTSTATUS st = HiveFindKey(h,Name("Index\\k",i),&key);
+        if(i < INDEX_KEEP ? !NT_SUCCESS(st) : st != STATUS_NOT_FOUND) missing++;
+    }
+    CHECK(missing == 0, "%u lookups wrong after the collapse", missing);
+    HiveClose(h);
+}
+
+/* ---------------- Inline values, journal ---------------- */
+
+static const UINT8 g_Small[4] = { 0xA1, 0xB2, 0xC3, 0xD4 };
+static UINT8 g_Large[300];
+
+/* Value cell named Value under Key, NULL if there is none */
+static PVALUE_CELL FindValueCell(PHIVE Hive, UINT32 Key, PCSTR Value){
+    PKEY_CELL k = HiveGetKeyCell(Hive,Key);
+    PUINT32 list = k && k->ValuesCount ? (PUINT32)HiveGetCell(Hive,k->ValuesList) : NULL;
+    for(UINT32 i=0; list && i<k->ValuesCount; i++){
+        PVALUE_CELL v = HiveGetValueCell(Hive,list[i]);
+        if(v && v->NameLength == strlen(Value) && memcmp(v->Name,Value,v->NameLength) == 0) return v;
+    }
+    return NULL;
+}
+
+static void SetValues(PHIVE Hive, UINT32 Key){
+    for(UINT32 i=0;i<sizeof(g_Large);i++) g_Large[i] = (UINT8)(i*7 + 1);
+    for(UINT32 n=1;n<=4;n++){
+        CHECK(NT_SUCCESS(HiveSetValue(Hive,Key,Name("small",n),ValueTypeBinary,(PVOID)g_Small,n)), "set small%u", n);
+    }
+    CHECK(NT_SUCCESS(HiveSetValue(Hive,Key,"large",ValueTypeBinary,g_Large,sizeof(g_Large))), "set large");
+}
+
+static void CheckValues(PHIVE Hive, UINT32 Key, const char* When){
+    UINT8 buf[sizeof(g_Large)];
+    UINT32 type, size;
+    for(UINT32 n=1;n<=4;n++){
+        size = sizeof(buf);
+        type = 0;
+        CHECK(NT_SUCCESS(HiveGetValue(Hive,Key,Name("small",n),&type,buf,&size)) && type == ValueTypeBinary &&
+              size == n && memcmp(buf,g_Small,n) == 0, "small%u reads back wrong %s", n, When);
+    }
+    size = sizeof(buf);
+    CHECK(NT_SUCCESS(HiveGetValue(Hive,Key,"large",&type,buf,&size)) && size == sizeof(g_Large) &&
+          memcmp(buf,g_Large,sizeof(g_Large)) == 0, "large reads back wrong %s", When);
+}
+
+static BOOL FileExists(PCSTR Path){
+    PFS_HANDLE f;
+    if(!NT_SUCCESS(FsOpen(Path,&f))) return FALSE;
+    FsClose(f);
+    return TRUE;
+}
+
+static void SetGeneration(PHIVE Hive, UINT32 Key, UINT32 Generation){
+    CHECK(NT_SUCCESS(HiveSetValue(Hive,Key,"Gen",ValueTypeDword,&Generation,sizeof(Generation))), "set Gen %u", Generation);
+    CHECK(NT_SUCCESS(HiveFlush(Hive)), "flush Gen %u", Generation);
+}
+
+/* Load /h/JOURNAL and return its "Log" key in *Key */
+static PHIVE Load(PUINT32 Key, const char* When){
+    PHIVE h = NULL;
+    *Key = 0;
+    CHECK(NT_SUCCESS(HiveLoadFromFile("/h/JOURNAL",&h)) && h, "load %s", When);
+    if(!h) return NULL;
+    CHECK(h->Bins != NULL, "hive not demand loaded %s", When);
+    CHECK(NT_SUCCESS(HiveFindKey(h,"Log",Key)), "Log missing %s", When);
+    return h;
+}
+
+/* Drop the journal without merging the logs, as a crash would */
+static void Crash(PHIVE Hive){
+    HiveJournalRelease(Hive);
+    HiveClose(Hive);
+}
+
+static void Journal(void){
+    PHIVE h = NewHive("JOURNAL", 2*1024*1024);
+    UINT32 key;
+    PFS_HANDLE f;
+    UINT8 garbage[64];
+    UINT64 written = 0;
+
+    CHECK(NT_SUCCESS(HiveCreateKey(h,"Log",&key)), "create Log");
+    SetValues(h,key);
+    for(UINT32 n=1;n<=4;n++){
+        PVALUE_CELL v = FindValueCell(h,key,Name("small",n));
+        CHECK(v && v->DataLength == n && memcmp(&v->DataOffset,g_Small,n) == 0, "small%u not stored inline", n);
+    }
+    PVALUE_CELL v = FindValueCell(h,key,"large");
+    CHECK(v && v->DataLength == sizeof(g_Large) && memcmp(HiveGetCell(h,v->DataOffset),g_Large,sizeof(g_Large)) == 0, "large not in its own cell");
+
+    CHECK(NT_SUCCESS(HiveSetBackingFile(h,"/h/JOURNAL")), "attach /h/JOURNAL");
+    SetGeneration(h,key,1);
+    CHECK(FileExists("/h/JOURNAL.LOG1") && !FileExists("/h/JOURNAL.LOG2"), "first flush did not write LOG1 alone");
+    SetGeneration(h,key,2);
+    CHECK(FileExists("/h/JOURNAL.LOG2"), "second flush did not write LOG2");
+    Crash(h);
+
+    /* Tear the newest log: loading falls back to LOG1 */
+    memset(garbage,0x5A,sizeof(garbage));
+    CHECK(NT_SUCCESS(FsOpen("/h/JOURNAL.LOG2",&f)), "open LOG2");
+    CHECK(NT_SUCCESS(FsWriteAt(f,1024,garbage,sizeof(garbage),&written)) && written == sizeof(garbage), "tear LOG2");
+    FsClose(f);
+    h = Load(&key,"with a torn LOG2");
+    if(!h) return;
+    CHECK(GetDword(h,key,"Gen") == 1, "torn LOG2: Gen %u, not 1 from LOG1", GetDword(h,key,"Gen"));
+    CheckValues(h,key,"after replaying LOG1");
+
+    /* Two more flushes continue the sequence, LOG2 then LOG1; the newest wins */
+    SetGeneration(h,key,3);
+    SetGeneration(h,key,4);
+    Crash(h);
+    h = Load(&key,"after a second crash");
+    if(!h) return;
+    CHECK(GetDword(h,key,"Gen") == 4, "Gen %u, not 4 from the newest log", GetDword(h,key,"Gen"));
+
+    /* Loading reconciled the replayed log: the primary file alone has it */
+    Crash(h);
+    HiveJournalDiscardLogs("/h/JOURNAL");
+    CHECK(!FileExists("/h/JOURNAL.LOG1") && !FileExists("/h/JOURNAL.LOG2"), "logs not discarded");
+    h = Load(&key,"from the primary file alone");
+    if(!h) return;
+    CHECK(GetDword(h,key,"Gen") == 4, "primary file holds Gen %u, not 4", GetDword(h,key,"Gen"));
+    CheckValues(h,key,"after reconcile");
+    CHECK(NT_SUCCESS(HiveClose(h)), "close");
+
+    /* A clean close leaves nothing to replay */
+    h = Load(&key,"after a clean close");
+    if(!h) return;
+    CHECK(GetDword(h,key,"Gen") == 4, "Gen %u after a clean close", GetDword(h,key,"Gen"));
+    CheckValues(h,key,"after a clean close");
+    HiveClose(h);
+}
+
+/* ---------------- Compaction ---------------- */
+
+static UINT32 Pattern(UINT32 N, UINT32 I){
+    return N*2654435761u + I;
+}
+
+static void Compact(void){
+    PHIVE h = NewHive("COMPACT", 1024*1024);
+    static UINT32 keys[COMPACT_KEYS];
+    static char chain[CHAIN_DEPTH*2 + 8];
+    UINT32 data[50], buf[50], key, deep, steps = 0, failed = 0;
+    BOOLEAN done = FALSE;
+    NTSTATUS st = STATUS_SUCCESS;
+
+    /* Keys first, then their values: compaction leaves key cells in place,
+       so the values are what fills the tail */
+    for(UINT32 i=0;i<COMPACT_KEYS;i++) if(!NT_SUCCESS(HiveCreateKey(h,Name("C\\k",i),&keys[i]))) failed++;
+    UINT32 at = 0;
+    chain[at++] = 'D';
+    for(UINT32 d=0;d<CHAIN_DEPTH;d++){ chain[at++] = '\\'; chain[at++] = 'x'; }
+    chain[at] = '\0';
+    CHECK(NT_SUCCESS(HiveCreateKey(h,chain,&deep)), "create a key %u deep", CHAIN_DEPTH);
+    for(UINT32 i=0;i<COMPACT_KEYS;i++){
+        for(UINT32 j=0;j<50;j++) data[j] = Pattern(i,j);
+        if(!NT_SUCCESS(HiveSetValue(h,keys[i],"v",ValueTypeBinary,data,sizeof(data)))) failed++;
+    }
+    for(UINT32 j=0;j<50;j++) data[j] = Pattern(CHAIN_DEPTH,j);
+    CHECK(NT_SUCCESS(HiveSetValue(h,deep,"v",ValueTypeBinary,data,sizeof(data))), "set deep value");
+    CHECK(failed == 0, "%u keys or values not created", failed);
+
+    failed = 0;
+    for(UINT32 i=0;i<COMPACT_KEYS;i++) if(i % 4 && !NT_SUCCESS(HiveDeleteKey(h,Name("C\\k",i)))) failed++;
+    CHECK(failed == 0, "%u keys not deleted", failed);
+
+    failed = 0;
+    SIZE_T before = h->Size;
+    while(!done && steps < 10000){
+        st = HiveCompactStep(h,COMPACT_BUDGET,&done);
+        if(!NT_SUCCESS(st)) break;
+        steps++;
+    }
+    CHECK(NT_SUCCESS(st) && done, "compaction stopped: 0x%x after %u steps", (unsigned)st, steps);
+    CHECK(steps > 1, "compaction finished in %u step", steps);
+    CHECK(h->Size < before/2, "hive only shrank from %u to %u bytes", (unsigned)before, (unsigned)h->Size);
+
+    HiveClearHints(h);
+    for(UINT32 i=0;i<COMPACT_KEYS;i++){
+        NTSTATUS found = HiveFindKey(h,Name("C\\k",i),&key);
+        if(i % 4){
+            if(found != STATUS_NOT_FOUND) failed++;
+            continue;
+        }
+        UINT32 type = 0, size = sizeof(buf);
+        if(!NT_SUCCESS(found) || key != keys[i] || !NT_SUCCESS(HiveGetValue(h,key,"v",&type,buf,&size)) || size != sizeof(buf)){
+            failed++;
+            continue;
+        }
+        for(UINT32 j=0;j<50;j++) if(buf[j] != Pattern(i,j)){ failed++; break; }
+    }
+    CHECK(failed == 0, "%u keys or values wrong after compaction", failed);
+    UINT32 type = 0, size = sizeof(buf);
+    CHECK(NT_SUCCESS(HiveFindKey(h,chain,&key)) && key == deep && NT_SUCCESS(HiveGetValue(h,key,"v",&type,buf,&size)) &&
+          buf[0] == Pattern(CHAIN_DEPTH,0) && buf[49] == Pattern(CHAIN_DEPTH,49), "deep key wrong after compaction");
+    HiveClose(h);
+}
+
+/* ---------------- NTCore value cache ---------------- */
+
+static void Cache(void){
+    PNTCORE_VALUE_CACHE cache = NULL;
+    NTCORE_VALUE_REQUEST req[2];
+    UINT32 key, a = 0x1234, b[8], outA, outB[8], hits = 0, misses = 0;
+
+    for(UINT32 i=0;i<8;i++) b[i] = i*3;
+    CHECK(NT_SUCCESS(NTCoreCreateKey("Software\\Test",&key)), "create Software\\Test");
+    memset(req,0,sizeof(req));
+    req[0].KeyHandle = key; req[0].ValueName = "A"; req[0].Type = NTCoreValueDword; req[0].Data = &a; req[0].DataSize = sizeof(a);
+    req[1].KeyHandle = key; req[1].ValueName = "B"; req[1].Type = NTCoreValueBinary; req[1].Data = b; req[1].DataSize = sizeof(b);
+    CHECK(NT_SUCCESS(NTCoreSetValues(req,2)), "set A and B");
+    CHECK(NT_SUCCESS(NTCoreCreateValueCache(0,&cache)) && cache, "create value cache");
+    if(!cache) return;
+
+    for(int pass=0;pass<3;pass++){
+        memset(req,0,sizeof(req));
+        outA = 0;
+        memset(outB,0,sizeof(outB));
+        req[0].KeyHandle = key; req[0].ValueName = "A"; req[0].Data = &outA; req[0].BufferSize = sizeof(outA);
+        req[1].KeyHandle = key; req[1].ValueName = "B"; req[1].Data = outB; req[1].BufferSize = sizeof(outB);
+        CHECK(NT_SUCCESS(NTCoreGetValues(cache,req,2)), "get pass %d", pass);
+        CHECK(NT_SUCCESS(req[0].Status) && req[0].DataSize == sizeof(outA) && outA == a, "pass %d: A reads %x", pass, outA);
+        CHECK(NT_SUCCESS(req[1].Status) && req[1].DataSize == sizeof(outB) && memcmp(outB,b,sizeof(b)) == 0, "pass %d: B reads back wrong", pass);
+        /* Pass 0 fills the cache, pass 1 hits it, pass 2 follows a set */
+        CHECK(req[0].FromCache == (pass == 1) && req[1].FromCache == (pass == 1),
+              "pass %d: served from %s", pass, req[0].FromCache ? "the cache" : "the hive");
+        if(pass == 1){
+            a = 0xBEEF;
+            memset(req,0,sizeof(req));
+            req[0].KeyHandle = key; req[0].ValueName = "A"; req[0].Type = NTCoreValueDword; req[0].Data = &a; req[0].DataSize = sizeof(a);
+            CHECK(NT_SUCCESS(NTCoreSetValues(req,1)), "set A again");
+        }
+    }
+    CHECK(NT_SUCCESS(NTCoreGetValueCacheStatistics(cache,&hits,&misses)), "cache statistics");
+    CHECK(hits == 2 && misses == 4, "%u hits and %u misses, not 2 and 4", hits, misses);
+    NTCoreDestroyValueCache(cache);
+}
+
+int main(void){
+    CHECK(NT_SUCCESS(FsInitialize()), "fs init");
+    CHECK(NT_SUCCESS(FsMount("tmpfs","tmpfs","/h",NULL)), "mount tmpfs");
+    /* Sets up the hive system and the SYSTEM hive NTCore keys live in */
+    CHECK(NT_SUCCESS(NTCoreInitializeConfig()), "ntcore init");
+
+    Crc();
+    Index();
+    Journal();
+    Compact();
+    Cache();
+    printf("hive: %s\n", g_Failures ? "FAILED" : "ok");
+    return g_Failures ? 1 : 0;
+}
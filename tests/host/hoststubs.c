@@ -0,0 +1,85 @@
+/* Host stand-ins for the hardware and scheduler services the kernel sources
+ * under test call. Pages come from a bitmap arena; port I/O reads back as a
+ * floating bus, so hardware probes find nothing; there is one CPU and no
+ * scheduler, so thread creation fails and callers take their inline paths. */
+#include "../../aurora.h"
+#include "../../include/hal.h"
+#include "../../include/mem.h"
+#include "../../include/kern.h"
+#include "../../include/kern/pci.h"
+#include "../../include/kern/driver.h"
+
+void* aligned_alloc(size_t Alignment, size_t Size);
+
+/* ---------------- Memory ---------------- */
+/* Pages come from one arena tracked by a bitmap, so, as with the kernel's
+ * physical allocator, any page of a multi-page allocation can be freed on
+ * its own. The arena is only address space until pages are touched. */
+#define HOST_ARENA_PAGES (1u<<18) /* 1 GiB */
+static UINT8* g_Arena;
+static UINT32 g_PageMap[HOST_ARENA_PAGES/32];
+static SIZE_T g_PageHint;
+SIZE_T g_HostPagesInUse; /* pages handed out and not yet freed, for leak checks */
+
+static BOOL HostPageUsed(SIZE_T Page){ return (g_PageMap[Page/32] >> (Page%32)) & 1; }
+static void HostPageMark(SIZE_T Page, BOOL Used){
+    if(Used) g_PageMap[Page/32] |= 1u << (Page%32); else g_PageMap[Page/32] &= ~(1u << (Page%32));
+}
+
+PVOID MemAllocPages(IN SIZE_T PageCount){
+    SIZE_T start, run = 0, scanned = 0, page = g_PageHint;
+    if(PageCount == 0 || PageCount > HOST_ARENA_PAGES) return NULL;
+    if(!g_Arena && !(g_Arena = (UINT8*)aligned_alloc(AURORA_PAGE_SIZE, (SIZE_T)HOST_ARENA_PAGES * AURORA_PAGE_SIZE))) return NULL;
+    /* Next fit from the last allocation, wrapping once */
+    while(scanned++ < HOST_ARENA_PAGES + PageCount){
+        if(page == HOST_ARENA_PAGES){ page = 0; run = 0; }
+        run = HostPageUsed(page) ? 0 : run + 1;
+        page++;
+        if(run < PageCount) continue;
+        start = page - PageCount;
+        for(SIZE_T i=0;i<PageCount;i++) HostPageMark(start+i, TRUE);
+        g_PageHint = page;
+        g_HostPagesInUse += PageCount;
+        memset(g_Arena + start * AURORA_PAGE_SIZE, 0, PageCount * AURORA_PAGE_SIZE);
+        return g_Arena + start * AURORA_PAGE_SIZE;
+    }
+    return NULL;
+}
+VOID MemFreePages(IN PVOID Base, IN SIZE_T PageCount){
+    SIZE_T start;
+    if(!Base) return;
+    start = (SIZE_T)((UINT8*)Base - g_Arena) / AURORA_PAGE_SIZE;
+    for(SIZE_T i=0;i<PageCount;i++) HostPageMark(start+i, FALSE);
+    g_HostPagesInUse -= PageCount;
+}
+UINT64 MemGetPhysicalAddress(IN PVOID VirtualAddress){ return (UINT64)(uintptr_t)VirtualAddress; }
+
+/* ---------------- HAL ---------------- */
+static UINT64 g_HostTsc;
+UINT64 HalQueryPerformanceCounter(void){ return ++g_HostTsc; }
+UINT64 HalQueryPerformanceFrequency(void){ return 1000000000ULL; }
+void HalCpuPause(void){ }
+void HalMemoryBarrier(void){ __sync_synchronize(); }
+UINT32 HalGetCurrentProcessorNumber(void){ return 0; }
+UINT32 HalGetProcessorCount(void){ return 1; }
+UINT8 HalInByte(UINT16 Port){ (void)Port; return 0xFF; }
+void HalOutByte(UINT16 Port, UINT8 Value){ (void)Port; (void)Value; }
+UINT16 HalInWord(UINT16 Port){ (void)Port; return 0xFFFF; }
+void HalOutWord(UINT16 Port, UINT16 Value){ (void)Port; (void)Value; }
+UINT32 HalInDword(UINT16 Port){ (void)Port; return 0xFFFFFFFF; }
+void HalOutDword(UINT16 Port, UINT32 Value){ (void)Port; (void)Value; }
+void HalSimdBegin(PHAL_SIMD_STATE State){ (void)State; } /* host code may use SSE freely */
+void HalSimdEnd(PHAL_SIMD_STATE State){ (void)State; }
+
+/* ---------------- Buses / interrupts ---------------- */
+pci_device_t* pci_find_class(UINT32 class_code){ (void)class_code; return NULL; }
+void pci_enable_bus_master(pci_device_t* dev){ (void)dev; }
+aur_status_t aur_register_irq(UINT32 irq, aur_irq_handler_t h, PVOID ctx){ (void)irq; (void)h; (void)ctx; return AUR_ERR_UNSUPPORTED; }
+
+/* ---------------- Scheduler ---------------- */
+PPROCESS KernGetCurrentProcess(void){ return NULL; }
+NTSTATUS KernCreateThread(IN PROCESS_ID ProcessId, IN PVOID StartAddress, IN PVOID Parameter, IN THREAD_PRIORITY Priority, OUT PTHREAD_ID ThreadId){
+    (void)ProcessId; (void)StartAddress; (void)Parameter; (void)Priority; (void)ThreadId;
+    return STATUS_NOT_IMPLEMENTED;
+}
+NTSTATUS KernSleep(IN UINT32 Milliseconds){ (void)Milliseconds; return STATUS_SUCCESS; }
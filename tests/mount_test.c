@@ -0,0 +1,203 @@
+/* Mount tree scaling
+ * Registers a stub file system ("fstub") whose volumes each hold one file,
+ * "id", reading back the number the volume was mounted with, and mounts
+ * 5000 of them at /m/<n>:
+ *   - every mount succeeds, well past the old 8192-dentry pool (each mount
+ *     pins its mountpoint and its root) and the 256 mount hash buckets
+ *   - /m/<n>/id resolves to volume n for every n, also through a bind mount
+ *   - a mount with an open handle refuses to go; all others unmount, each
+ *     volume is released exactly once, and the recycled records remount */
+#include "../aurora.h"
+#include "../include/fs.h"
+
+int printf(const char* Format, ...);
+void* malloc(size_t Size);
+void free(void* Ptr);
+
+#define VOLUMES     5000
+
+static int g_Failures;
+#define CHECK(c, ...) do { if(!(c)){ printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); g_Failures++; } } while(0)
+
+typedef struct _STUB_VOLUME {
+    UINT32 Id;
+    UINT32 Node;                /* the "id" file; its address is the node */
+} STUB_VOLUME, *PSTUB_VOLUME;
+
+typedef struct _STUB_FILE {
+    PSTUB_VOLUME Volume;
+    BOOL Directory;
+    UINT32 Position;
+} STUB_FILE, *PSTUB_FILE;
+
+static UINT32 g_LiveVolumes;
+static UINT32 g_OpenFiles;
+
+static UINT32 Number(const char* Text){
+    UINT32 n = 0;
+    for(; *Text; Text++) n = n*10 + (UINT32)(*Text - '0');
+    return n;
+}
+
+/* Device is the volume number in decimal */
+static NTSTATUS StubMount(PCSTR Device, PCSTR Options, PVOID* VolumeCtx){
+    PSTUB_VOLUME v = (PSTUB_VOLUME)malloc(sizeof(STUB_VOLUME));
+    if(!v) return STATUS_INSUFFICIENT_RESOURCES;
+    v->Id = Number(Device);
+    v->Node = 0;
+    g_LiveVolumes++;
+    *VolumeCtx = v;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS StubUnmount(PVOID VolumeCtx){
+    CHECK(g_LiveVolumes > 0, "unmount of volume %u twice", ((PSTUB_VOLUME)VolumeCtx)->Id);
+    g_LiveVolumes--;
+    free(VolumeCtx);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS StubLookup(PVOID VolumeCtx, PVOID DirNode, PCSTR Name, UINT32 NameLength, PVOID* Node, PUINT32 NodeFlags){
+    PSTUB_VOLUME v = (PSTUB_VOLUME)VolumeCtx;
+    if(DirNode) return STATUS_NOT_A_DIRECTORY;
+    if(NameLength != 2 || memcmp(Name,"id",2) != 0) return STATUS_OBJECT_NAME_NOT_FOUND;
+    *Node = &v->Node;
+    *NodeFlags = 0;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS StubOpenNode(PVOID VolumeCtx, PVOID Node, FS_FILE* File){
+    PSTUB_FILE f = (PSTUB_FILE)malloc(sizeof(STUB_FILE));
+    if(!f) return STATUS_INSUFFICIENT_RESOURCES;
+    f->Volume = (PSTUB_VOLUME)VolumeCtx;
+    f->Directory = Node == NULL;
+    f->Position = 0;
+    g_OpenFiles++;
+    *File = f;
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS StubClose(FS_FILE File){
+    g_OpenFiles--;
+    free(File);
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS StubRead(FS_FILE File, PVOID Buffer, UINT32 Size, PUINT32 BytesRead){
+    PSTUB_FILE f = (PSTUB_FILE)File;
+    UINT32 n;
+    if(f->Directory) return STATUS_FILE_IS_A_DIRECTORY;
+    n = f->Position < 4 ? 4 - f->Position : 0;
+    if(n > Size) n = Size;
+    memcpy(Buffer, (UINT8*)&f->Volume->Id + f->Position, n);
+    f->Position += n;
+    *BytesRead = n;
+    return STATUS_SUCCESS;
+}
+
+static void StubRelease(PVOID VolumeCtx, PVOID Node){
+}
+
+static void Register(void){
+    static FS_DRIVER drv;
+    drv.Name = "fstub";
+    drv.Ops.Mount = StubMount;
+    drv.Ops.Unmount = StubUnmount;
+    drv.Ops.Lookup = StubLookup;
+    drv.Ops.OpenNode = StubOpenNode;
+    drv.Ops.ReleaseNode = StubRelease;
+    drv.Ops.Close = StubClose;
+    drv.Ops.Read = StubRead;
+    CHECK(NT_SUCCESS(FsRegisterDriver(&drv)), "register fstub");
+}
+
+static const char* Decimal(UINT32 N){
+    static char text[12];
+    char digits[12];
+    UINT32 n = 0, at = 0;
+    do { digits[n++] = (char)('0' + N % 10); N /= 10; } while(N);
+    while(n) text[at++] = digits[--n];
+    text[at] = '\0';
+    return text;
+}
+
+/* "/m/<n>" followed by Suffix */
+static const char* Path(UINT32 N, const char* Suffix){
+    static char path[64];
+    const char* d = Decimal(N);
+    UINT32 at = 3;
+    memcpy(path,"/m/",3);
+    while(*d) path[at++] = *d++;
+    while(*Suffix) path[at++] = *Suffix++;
+    path[at] = '\0';
+    return path;
+}
+
+/* Volume number that Path's "id" file reads back, or ~0 */
+static UINT32 ReadId(const char* Path){
+    PFS_HANDLE h;
+    UINT32 id = 0xFFFFFFFF, got = 0;
+    if(!NT_SUCCESS(FsOpen(Path,&h))) return 0xFFFFFFFF;
+    if(!NT_SUCCESS(FsRead(h,&id,sizeof(id),&got)) || got != sizeof(id)) id = 0xFFFFFFFF;
+    CHECK(NT_SUCCESS(FsClose(h)), "close %s", Path);
+    return id;
+}
+
+static UINT32 MountAll(void){
+    UINT32 mounted = 0;
+    for(UINT32 i=0; i<VOLUMES; i++){
+        NTSTATUS st = FsMount(Decimal(i),"fstub",Path(i,""),NULL);
+        if(!NT_SUCCESS(st)){
+            CHECK(FALSE, "mount %s: 0x%x", Path(i,""), (unsigned)st);
+            break;
+        }
+        mounted++;
+    }
+    return mounted;
+}
+
+static void Resolve(void){
+    UINT32 wrong = 0;
+    for(UINT32 i=0; i<VOLUMES; i++) if(ReadId(Path(i,"/id")) != i) wrong++;
+    CHECK(wrong == 0, "%u of %u mounts resolved to the wrong volume", wrong, VOLUMES);
+    /* The same walk again is served from the dentry cache */
+    wrong = 0;
+    for(UINT32 i=0; i<VOLUMES; i+=7) if(ReadId(Path(i,"/id")) != i) wrong++;
+    CHECK(wrong == 0, "%u cached walks resolved to the wrong volume", wrong);
+    CHECK(ReadId(Path(VOLUMES,"/id")) == 0xFFFFFFFF, "unmounted %s resolved", Path(VOLUMES,"/id"));
+
+    CHECK(NT_SUCCESS(FsBindMount(Path(4321,""),"/b")), "bind mount");
+    CHECK(ReadId("/b/id") == 4321, "bind mount shows the wrong volume");
+    CHECK(NT_SUCCESS(FsUnmount("/b")), "unmount bind");
+    CHECK(ReadId("/b/id") == 0xFFFFFFFF, "bind mount still resolves");
+}
+
+static void UnmountAll(void){
+    PFS_HANDLE h;
+    UINT32 failed = 0;
+    CHECK(NT_SUCCESS(FsOpen(Path(10,"/id"),&h)), "open");
+    CHECK(FsUnmount(Path(10,"")) == STATUS_DEVICE_BUSY, "busy mount unmounted");
+    CHECK(NT_SUCCESS(FsClose(h)), "close");
+    for(UINT32 i=0; i<VOLUMES; i++) if(!NT_SUCCESS(FsUnmount(Path(i,"")))) failed++;
+    CHECK(failed == 0, "%u unmounts failed", failed);
+    CHECK(g_LiveVolumes == 0 && g_OpenFiles == 0, "%u volumes and %u files left", g_LiveVolumes, g_OpenFiles);
+    CHECK(ReadId(Path(77,"/id")) == 0xFFFFFFFF, "unmounted volume still resolves");
+}
+
+int main(void){
+    UINT32 mounted;
+    CHECK(NT_SUCCESS(FsInitialize()), "fs init");
+    Register();
+    mounted = MountAll();
+    CHECK(mounted == VOLUMES && g_LiveVolumes == VOLUMES, "%u of %u volumes mounted", mounted, VOLUMES);
+    Resolve();
+    UnmountAll();
+
+    /* Mount records and dentries freed above are reused */
+    mounted = MountAll();
+    CHECK(mounted == VOLUMES, "remount: %u of %u volumes mounted", mounted, VOLUMES);
+    CHECK(ReadId(Path(VOLUMES-1,"/id")) == VOLUMES-1, "remounted volume resolves wrongly");
+    printf("mount: %u volumes\n", mounted);
+    printf("mount: %s\n", g_Failures ? "FAILED" : "ok");
+    return g_Failures ? 1 : 0;
+}
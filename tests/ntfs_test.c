@@ -0,0 +1,438 @@
+/* NTFS driver through the VFS
+ * Builds a small NTFS volume on a RAM disk (4 KiB clusters, 1 KiB records,
+ * 4 KiB index blocks) and reads it back through the VFS:
+ *   - $MFT is split over two runs, so records past the first are found
+ *     through record 0's $DATA
+ *   - the root $I30 index is a two-level B+tree (INDEX_ROOT over two INDX
+ *     blocks); lookups descend it, case-insensitively through $UpCase,
+ *     which folds a non-ASCII letter the ASCII fallback would miss
+ *   - a file fragmented over physically adjacent runs, a sparse run and a
+ *     run behind the first reads back with zeros in the hole
+ *   - bytes past InitializedSize read as zeros even though the clusters
+ *     hold data
+ *   - listings come back in index order without DOS aliases or metadata
+ *     records, and resume the same way one entry per call or from a seek
+ *   - a record with a torn update sequence is refused */
+#include "../aurora.h"
+#include "../include/io.h"
+#include "../include/fs.h"
+
+int printf(const char* Format, ...);
+int strcmp(const char* A, const char* B);
+void* malloc(size_t Size);
+
+#define CLUSTER     4096
+#define RECORD      1024
+#define VOLUME_CLUSTERS 1024
+#define MFT_RECORDS 48
+#define SPARSE      (~0ULL)
+#define USN         0x0007
+
+/* Cluster map */
+#define LCN_MFT1    4           /* records 0..15 */
+#define LCN_INDX    8           /* root index blocks, VCN 0 and 1 */
+#define LCN_MFT2    12          /* records 16..47 */
+#define LCN_UPCASE  20
+#define LCN_BIG_C   100         /* third run of big.bin, behind the first */
+#define LCN_BIG_A   200
+#define LCN_ZETA    300
+
+#define BIG_SIZE    300000
+#define ZETA_SIZE   10000
+#define ZETA_INIT   5000
+
+static int g_Failures;
+#define CHECK(c, ...) do { if(!(c)){ printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); g_Failures++; } } while(0)
+
+static UINT8* g_Image;
+static PAIO_DEVICE_OBJECT g_Disk;
+
+static void Put16(UINT8* P, UINT16 V){ P[0]=(UINT8)V; P[1]=(UINT8)(V>>8); }
+static void Put32(UINT8* P, UINT32 V){ Put16(P,(UINT16)V); Put16(P+2,(UINT16)(V>>16)); }
+static void Put64(UINT8* P, UINT64 V){ Put32(P,(UINT32)V); Put32(P+4,(UINT32)(V>>32)); }
+
+static UINT8 Byte(UINT64 Off, UINT32 Seed){ return (UINT8)((Off * 131 + Seed) ^ (Off >> 9)); }
+
+static UINT8* Cluster(UINT64 Lcn){ return g_Image + Lcn * CLUSTER; }
+
+static UINT8* Record(UINT32 N){ return N < 16 ? Cluster(LCN_MFT1) + N*RECORD : Cluster(LCN_MFT2) + (N-16)*RECORD; }
+
+/* Stamp the update sequence: the last two bytes of each 512-byte stride move
+ * into the array and are replaced by the sequence number */
+static void Protect(UINT8* Block, UINT32 Size){
+    UINT8* usa = Block + (Block[4] | (Block[5]<<8));
+    Put16(usa,USN);
+    for(UINT32 i=1; i<=Size/512; i++){
+        memcpy(usa + 2*i, Block + i*512 - 2, 2);
+        Put16(Block + i*512 - 2, USN);
+    }
+}
+
+/* ---------------- File records ---------------- */
+
+static UINT32 g_At;     /* next attribute offset in the record being built */
+
+static void BeginRecord(UINT8* R, UINT16 Flags){
+    memset(R,0,RECORD);
+    memcpy(R,"FILE",4); Put16(R+4,48); Put16(R+6,RECORD/512+1);
+    Put16(R+16,1); Put16(R+18,1); Put16(R+20,56); Put16(R+22,Flags); Put32(R+28,RECORD);
+    g_At = 56;
+}
+
+static void EndRecord(UINT8* R){
+    Put32(R+g_At,0xFFFFFFFF);
+    Put32(R+24,g_At+8);
+    Protect(R,RECORD);
+}
+
+static UINT32 PutName(UINT8* P, const char* Name){
+    UINT32 n = 0;
+    for(; Name && Name[n]; n++) Put16(P + 2*n,(UINT8)Name[n]);
+    return n;
+}
+
+static void Resident(UINT8* R, UINT32 Type, const char* Name, const void* Value, UINT32 Length){
+    UINT8* a = R + g_At;
+    UINT32 n = PutName(a+24,Name), voff = (24 + 2*n + 7) & ~7u;
+    Put32(a,Type); a[9]=(UINT8)n; Put16(a+10,24);
+    Put32(a+16,Length); Put16(a+20,(UINT16)voff);
+    memcpy(a+voff,Value,Length);
+    Put32(a+4,(voff + Length + 7) & ~7u);
+    g_At += (voff + Length + 7) & ~7u;
+}
+
+typedef struct _RUN { UINT64 Lcn; UINT64 Length; } RUN;
+
+static UINT32 Bytes(INT64 V, BOOL Signed){
+    UINT32 n = 1;
+    if(Signed) while(n < 8 && (V < -(1LL << (8*n-1)) || V >= (1LL << (8*n-1)))) n++;
+    else while(n < 8 && (UINT64)V >> (8*n)) n++;
+    return n;
+}
+
+static void NonResident(UINT8* R, UINT32 Type, const char* Name, const RUN* Runs, UINT32 Count, UINT64 DataSize, UINT64 InitSize){
+    UINT8* a = R + g_At;
+    UINT32 n = PutName(a+64,Name), off = (64 + 2*n + 7) & ~7u, p = off;
+    UINT64 vcn = 0;
+    INT64 lcn = 0;
+    Put32(a,Type); a[8]=1; a[9]=(UINT8)n; Put16(a+10,64);
+    for(UINT32 i=0; i<Count; i++){
+        UINT32 lb = Bytes((INT64)Runs[i].Length,FALSE), ob = 0;
+        INT64 delta = 0;
+        if(Runs[i].Lcn != SPARSE){ delta = (INT64)Runs[i].Lcn - lcn; ob = Bytes(delta,TRUE); lcn = (INT64)Runs[i].Lcn; }
+        a[p++] = (UINT8)((ob<<4) | lb);
+        for(UINT32 b=0; b<lb; b++) a[p++] = (UINT8)(Runs[i].Length >> (8*b));
+        for(UINT32 b=0; b<ob; b++) a[p++] = (UINT8)((UINT64)delta >> (8*b));
+        vcn += Runs[i].Length;
+    }
+    a[p++] = 0;
+    Put64(a+24,vcn-1); Put16(a+32,(UINT16)off);
+    Put64(a+40,vcn*CLUSTER); Put64(a+48,DataSize); Put64(a+56,InitSize);
+    Put32(a+4,(p + 7) & ~7u);
+    g_At += (p + 7) & ~7u;
+}
+
+/* ---------------- $I30 indexes ---------------- */
+
+typedef struct _ENTRY {
+    UINT32 Record;
+    const char* Name;   /* NULL for the end marker */
+    UINT8 Namespace;    /* 1 Win32, 2 DOS */
+    BOOL Directory;
+    UINT64 Size;
+    INT64 Child;        /* subnode VCN, or -1 */
+} ENTRY;
+
+/* Names are Latin-1 so a test can use a letter only $UpCase folds */
+static UINT32 PackEntries(UINT8* P, const ENTRY* E, UINT32 Count, BOOL* Large){
+    UINT32 at = 0;
+    for(UINT32 i=0; i<Count; i++){
+        UINT8* ie = P + at;
+        UINT32 key = 0, len;
+        memset(ie,0,16);
+        if(E[i].Name){
+            UINT8* fn = ie + 16;
+            UINT32 n = 0;
+            memset(fn,0,66);
+            for(; E[i].Name[n]; n++) Put16(fn + 66 + 2*n,(UINT8)E[i].Name[n]);
+            Put64(fn,5 | (1ULL<<48));
+            Put64(fn+48,E[i].Size);
+            Put32(fn+56,E[i].Directory ? 0x10000000 : 0x20);
+            fn[64]=(UINT8)n; fn[65]=E[i].Namespace;
+            key = 66 + 2*n;
+            Put64(ie,E[i].Record | (1ULL<<48));
+        }
+        len = (16 + key + 7) & ~7u;
+        if(E[i].Child >= 0){ Put64(ie+len,(UINT64)E[i].Child); len += 8; *Large = TRUE; }
+        Put16(ie+8,(UINT16)len); Put16(ie+10,(UINT16)key);
+        Put16(ie+12,(UINT16)((E[i].Name ? 0 : 2) | (E[i].Child >= 0 ? 1 : 0)));
+        at += len;
+    }
+    return at;
+}
+
+static void IndexRoot(UINT8* R, const ENTRY* E, UINT32 Count){
+    static UINT8 v[RECORD];
+    BOOL large = FALSE;
+    UINT32 len = PackEntries(v+32,E,Count,&large);
+    memset(v,0,32);
+    Put32(v,0x30); Put32(v+4,1); Put32(v+8,CLUSTER); v[12]=1;
+    Put32(v+16,16); Put32(v+20,16+len); Put32(v+24,16+len); v[28]=large ? 1 : 0;
+    Resident(R,0x90,"$I30",v,32+len);
+}
+
+static void IndexBlock(UINT64 Vcn, const ENTRY* E, UINT32 Count){
+    UINT8* b = Cluster(LCN_INDX + Vcn);
+    BOOL large = FALSE;
+    UINT32 len;
+    memset(b,0,CLUSTER);
+    memcpy(b,"INDX",4); Put16(b+4,40); Put16(b+6,CLUSTER/512+1); Put64(b+16,Vcn);
+    len = PackEntries(b+64,E,Count,&large);
+    Put32(b+24,40); Put32(b+28,40+len); Put32(b+32,CLUSTER-24); b[36]=large ? 1 : 0;
+    Protect(b,CLUSTER);
+}
+
+/* ---------------- Volume ---------------- */
+
+static void FillRun(UINT64 Lcn, UINT64 Clusters, UINT64 FileOffset){
+    for(UINT64 i=0; i<Clusters*CLUSTER; i++) Cluster(Lcn)[i] = Byte(FileOffset+i,0);
+}
+
+static void Format(void){
+    static const ENTRY root[] = {
+        { 20, "MID", 1, FALSE, 3, 0 },
+        { 0, NULL, 0, FALSE, 0, 1 },
+    };
+    static const ENTRY vcn0[] = {
+        { 0, "$MFT", 3, FALSE, MFT_RECORDS*RECORD, -1 },
+        { 16, "alpha.txt", 1, FALSE, 6, -1 },
+        { 17, "big.bin", 1, FALSE, BIG_SIZE, -1 },
+        { 17, "BIG~1.BIN", 2, FALSE, BIG_SIZE, -1 },
+        { 24, "caf\xE9", 1, FALSE, 4, -1 },
+        { 18, "Hello.txt", 1, FALSE, 5, -1 },
+        { 0, NULL, 0, FALSE, 0, -1 },
+    };
+    static const ENTRY vcn1[] = {
+        { 19, "notes", 1, TRUE, 0, -1 },
+        { 21, "zeta.bin", 1, FALSE, ZETA_SIZE, -1 },
+        { 0, NULL, 0, FALSE, 0, -1 },
+    };
+    static const ENTRY notes[] = {
+        { 22, "a", 1, FALSE, 1, -1 },
+        { 23, "b", 1, FALSE, 1, -1 },
+        { 0, NULL, 0, FALSE, 0, -1 },
+    };
+    static const RUN mft[] = { { LCN_MFT1, 4 }, { LCN_MFT2, 8 } };
+    static const RUN indx[] = { { LCN_INDX, 2 } };
+    static const RUN upcase[] = { { LCN_UPCASE, 32 } };
+    /* A and B are physically adjacent but separate pairs; C lies behind A */
+    static const RUN big[] = { { LCN_BIG_A, 10 }, { LCN_BIG_A+10, 10 }, { SPARSE, 10 }, { LCN_BIG_C, 44 } };
+    static const RUN zeta[] = { { LCN_ZETA, 3 } };
+    UINT8* b = g_Image;
+
+    memset(g_Image,0,VOLUME_CLUSTERS*CLUSTER);
+    b[0]=0xEB; b[1]=0x52; b[2]=0x90; memcpy(b+3,"NTFS    ",8);
+    Put16(b+11,512); b[13]=CLUSTER/512; b[21]=0xF8;
+    Put64(b+40,VOLUME_CLUSTERS*(CLUSTER/512)-1); Put64(b+48,LCN_MFT1); Put64(b+56,2);
+    b[64]=0xF6; b[68]=1; b[510]=0x55; b[511]=0xAA;
+
+    for(UINT32 r=0; r<MFT_RECORDS; r++){ BeginRecord(Record(r),r < 16 ? 1 : 0); EndRecord(Record(r)); }
+
+    BeginRecord(Record(0),1);
+    NonResident(Record(0),0x80,NULL,mft,2,MFT_RECORDS*RECORD,MFT_RECORDS*RECORD);
+    EndRecord(Record(0));
+
+    BeginRecord(Record(5),3);
+    IndexRoot(Record(5),root,2);
+    NonResident(Record(5),0xA0,"$I30",indx,1,2*CLUSTER,2*CLUSTER);
+    EndRecord(Record(5));
+    IndexBlock(0,vcn0,7);
+    IndexBlock(1,vcn1,3);
+
+    BeginRecord(Record(10),1);
+    NonResident(Record(10),0x80,NULL,upcase,1,0x20000,0x20000);
+    EndRecord(Record(10));
+    for(UINT32 c=0; c<0x10000; c++){
+        UINT32 u = (c >= 'a' && c <= 'z') || (c >= 0xE0 && c <= 0xFE && c != 0xF7) ? c - 0x20 : c;
+        Put16(Cluster(LCN_UPCASE) + 2*c,(UINT16)u);
+    }
+
+#define RESIDENT_FILE(n, text) \
+    BeginRecord(Record(n),1); Resident(Record(n),0x80,NULL,text,sizeof(text)-1); EndRecord(Record(n))
+    RESIDENT_FILE(16,"alpha\n");
+    RESIDENT_FILE(18,"Hello");
+    RESIDENT_FILE(20,"mid");
+    RESIDENT_FILE(22,"A");
+    RESIDENT_FILE(23,"B");
+    RESIDENT_FILE(24,"cafe");
+#undef RESIDENT_FILE
+
+    BeginRecord(Record(17),1);
+    NonResident(Record(17),0x80,NULL,big,4,BIG_SIZE,BIG_SIZE);
+    EndRecord(Record(17));
+    FillRun(LCN_BIG_A,20,0);
+    FillRun(LCN_BIG_C,44,30*CLUSTER);
+
+    BeginRecord(Record(19),3);
+    IndexRoot(Record(19),notes,3);
+    EndRecord(Record(19));
+
+    /* The clusters hold data past InitializedSize that must not be returned */
+    BeginRecord(Record(21),1);
+    NonResident(Record(21),0x80,NULL,zeta,1,ZETA_SIZE,ZETA_INIT);
+    EndRecord(Record(21));
+    FillRun(LCN_ZETA,3,0);
+
+    CHECK(NT_SUCCESS(BlockWrite(g_Disk,0,VOLUME_CLUSTERS*(CLUSTER/512),g_Image)), "write image");
+}
+
+/* ---------------- Tests ---------------- */
+
+static void Mount(void){ CHECK(NT_SUCCESS(FsMount("ram0","ntfs","/n",NULL)), "mount"); }
+static void Unmount(void){ CHECK(NT_SUCCESS(FsUnmount("/n")), "unmount"); }
+
+/* Reads the whole of Path into Buffer; returns the byte count */
+static UINT64 ReadFile(const char* Path, UINT8* Buffer, UINT32 Size){
+    PFS_HANDLE h = NULL;
+    UINT64 done = 0;
+    NTSTATUS st = FsOpen(Path,&h);
+    CHECK(NT_SUCCESS(st), "open %s: 0x%x", Path, (unsigned)st);
+    if(!NT_SUCCESS(st)) return 0;
+    memset(Buffer,0xCC,Size);
+    CHECK(NT_SUCCESS(FsReadAt(h,0,Buffer,Size,&done)), "read %s", Path);
+    CHECK(NT_SUCCESS(FsClose(h)), "close %s", Path);
+    return done;
+}
+
+static void Lookups(void){
+    static const struct { const char* Path; const char* Text; } files[] = {
+        { "/n/alpha.txt", "alpha\n" },
+        { "/n/ALPHA.TXT", "alpha\n" },
+        { "/n/hello.txt", "Hello" },
+        { "/n/mid", "mid" },
+        { "/n/caf\xC3\xA9", "cafe" },
+        { "/n/CAF\xC3\x89", "cafe" },
+        { "/n/notes/a", "A" },
+        { "/n/NOTES/B", "B" },
+        { "/n/BIG~1.BIN", NULL },
+    };
+    static UINT8 buf[64];
+    PFS_HANDLE h = NULL;
+    for(UINT32 i=0; i<sizeof(files)/sizeof(files[0]); i++){
+        UINT64 n = ReadFile(files[i].Path,buf,sizeof(buf));
+        if(files[i].Text) CHECK(n == strlen(files[i].Text) && memcmp(buf,files[i].Text,n) == 0, "%s: %llu bytes", files[i].Path, (unsigned long long)n);
+        else CHECK(n == sizeof(buf), "%s through its DOS alias", files[i].Path);
+    }
+    CHECK(FsOpen("/n/missing",&h) == STATUS_OBJECT_NAME_NOT_FOUND, "missing name found");
+    CHECK(FsOpen("/n/mie",&h) == STATUS_OBJECT_NAME_NOT_FOUND, "name between root keys found");
+    CHECK(FsOpen("/n/zzz",&h) == STATUS_OBJECT_NAME_NOT_FOUND, "name past the last key found");
+    CHECK(FsOpen("/n/alpha.txt/x",&h) == STATUS_NOT_A_DIRECTORY, "file walked as a directory");
+}
+
+static void Streams(void){
+    UINT8* buf = (UINT8*)malloc(BIG_SIZE + CLUSTER);
+    UINT64 n = ReadFile("/n/big.bin",buf,BIG_SIZE + CLUSTER), bad = 0;
+    CHECK(n == BIG_SIZE, "big.bin: %llu bytes", (unsigned long long)n);
+    for(UINT64 i=0; i<BIG_SIZE; i++){
+        UINT8 want = i >= 20*CLUSTER && i < 30*CLUSTER ? 0 : Byte(i,0);
+        if(buf[i] != want && bad++ == 0) printf("big.bin differs at %llu\n", (unsigned long long)i);
+    }
+    CHECK(bad == 0, "big.bin: %llu bytes wrong", (unsigned long long)bad);
+
+    n = ReadFile("/n/zeta.bin",buf,4*CLUSTER);
+    bad = 0;
+    CHECK(n == ZETA_SIZE, "zeta.bin: %llu bytes", (unsigned long long)n);
+    for(UINT64 i=0; i<ZETA_SIZE; i++) if(buf[i] != (i < ZETA_INIT ? Byte(i,0) : 0)) bad++;
+    CHECK(bad == 0, "zeta.bin: %llu bytes wrong past or before InitializedSize", (unsigned long long)bad);
+}
+
+static const struct { const char* Name; UINT8 Type; UINT64 Size; } g_Listing[] = {
+    { "alpha.txt", FS_DT_FILE, 6 },
+    { "big.bin", FS_DT_FILE, BIG_SIZE },
+    { "caf\xC3\xA9", FS_DT_FILE, 4 },
+    { "Hello.txt", FS_DT_FILE, 5 },
+    { "MID", FS_DT_FILE, 3 },
+    { "notes", FS_DT_DIRECTORY, 0 },
+    { "zeta.bin", FS_DT_FILE, ZETA_SIZE },
+};
+#define LISTING (sizeof(g_Listing)/sizeof(g_Listing[0]))
+
+/* Reads the stream to the end with Size-byte batches, checking each record
+ * against the listing from entry First on; returns the entries seen */
+static UINT32 ListFrom(FS_DIR Dir, UINT32 First, UINT32 Size, UINT64* Cursors){
+    static UINT64 buf[512];
+    UINT32 seen = First, got;
+    NTSTATUS st;
+    while(NT_SUCCESS(st = FsReadDir(Dir,buf,Size,&got))){
+        for(UINT32 off=0; off<got; off+=((PFS_DIRENT)((UINT8*)buf+off))->RecordLength){
+            PFS_DIRENT d = (PFS_DIRENT)((UINT8*)buf+off);
+            if(seen < LISTING){
+                CHECK(strcmp(d->Name,g_Listing[seen].Name) == 0, "entry %u is %s, expected %s", seen, d->Name, g_Listing[seen].Name);
+                CHECK(d->Type == g_Listing[seen].Type && d->Size == g_Listing[seen].Size, "%s: type %u size %llu",
+                      d->Name, d->Type, (unsigned long long)d->Size);
+                if(Cursors) Cursors[seen] = d->Cursor;
+            }
+            seen++;
+        }
+    }
+    CHECK(st == STATUS_NO_MORE_ENTRIES, "listing ended with 0x%x", (unsigned)st);
+    return seen;
+}
+
+static void Listings(void){
+    static UINT64 buf[8];
+    UINT64 cursors[LISTING];
+    UINT32 got;
+    FS_DIR d;
+    CHECK(NT_SUCCESS(FsOpenDir("/n",&d)), "opendir");
+    CHECK(FsReadDir(d,buf,16,&got) == STATUS_BUFFER_TOO_SMALL, "16-byte batch");
+    CHECK(ListFrom(d,0,4096,cursors) == LISTING, "one batch: wrong entry count");
+    /* 40 bytes hold exactly one of these records, so every call resumes by name */
+    CHECK(NT_SUCCESS(FsSeekDir(d,0)), "rewind");
+    CHECK(ListFrom(d,0,40,NULL) == LISTING, "one per call: wrong entry count");
+    /* A cursor from an earlier pass resumes by position */
+    CHECK(NT_SUCCESS(FsSeekDir(d,cursors[3])), "seek");
+    CHECK(ListFrom(d,4,4096,NULL) == LISTING, "after seek: wrong entry count");
+    CHECK(NT_SUCCESS(FsCloseDir(d)), "closedir");
+
+    CHECK(NT_SUCCESS(FsOpenDir("/n/notes",&d)), "opendir notes");
+    CHECK(NT_SUCCESS(FsReadDir(d,buf,sizeof(buf),&got)) && got == 64, "notes: %u bytes", got);
+    CHECK(strcmp(((PFS_DIRENT)buf)->Name,"a") == 0 && strcmp(((PFS_DIRENT)((UINT8*)buf+32))->Name,"b") == 0, "notes listing");
+    CHECK(FsReadDir(d,buf,sizeof(buf),&got) == STATUS_NO_MORE_ENTRIES, "notes end");
+    CHECK(NT_SUCCESS(FsCloseDir(d)), "closedir notes");
+    CHECK(FsOpenDir("/n/alpha.txt",&d) == STATUS_NOT_A_DIRECTORY, "listing a file");
+}
+
+/* Clobber the tail of alpha.txt's second sector as a torn write would */
+static void TornRecord(void){
+    UINT8 s[512];
+    UINT64 sector = ((UINT64)LCN_MFT2*CLUSTER + RECORD)/512 - 1;
+    PFS_HANDLE h = NULL;
+    CHECK(NT_SUCCESS(BlockRead(g_Disk,sector,1,s)), "read record sector");
+    s[510] ^= 0xFF;
+    CHECK(NT_SUCCESS(BlockWrite(g_Disk,sector,1,s)), "write record sector");
+    Mount();
+    CHECK(FsOpen("/n/alpha.txt",&h) == STATUS_DISK_CORRUPT_ERROR, "torn record accepted");
+    CHECK(NT_SUCCESS(FsOpen("/n/Hello.txt",&h)) && NT_SUCCESS(FsClose(h)), "neighbouring record");
+    Unmount();
+}
+
+int main(void){
+    AuroraSetCommandLine("ramdisk_count=1 ramdisk_size=4M");
+    CHECK(NT_SUCCESS(RamDiskInitialize()), "ramdisk init");
+    g_Disk = RamDiskGetDevice(0);
+    if(!g_Disk){ printf("FAIL: ram0 not created\n"); return 1; }
+    CHECK(NT_SUCCESS(FsInitialize()), "fs init");
+    g_Image = (UINT8*)malloc(VOLUME_CLUSTERS*CLUSTER);
+    Format();
+
+    Mount();
+    Lookups();
+    Streams();
+    Listings();
+    Unmount();
+    TornRecord();
+
+    printf("ntfs: %s\n", g_Failures ? "FAILED" : "ok");
+    return g_Failures ? 1 : 0;
+}
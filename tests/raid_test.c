@@ -0,0 +1,148 @@
+/* RAID engine over RAM disks
+ * Boots ramdisk.c + raid.c + the Rust engine against the real block layer
+ * with raid=<level> on the command line, then checks data round trips
+ * through md0 and lands on the members where the level puts it:
+ *   raid0: chunk c of the array is chunk c/n on member c%n
+ *   raid1: every member holds an identical copy
+ *   raid5: after a flush, each stripe XORs to zero across the members
+ * Usage: raid_test 0|1|5 */
+#include "../aurora.h"
+#include "../include/io.h"
+
+int printf(const char* Format, ...);
+int atoi(const char* Text);
+void* malloc(size_t Size);
+
+#define MEMBERS      4
+#define CHUNK_BYTES  (16*1024)
+#define BS           512
+#define CHUNK_BLOCKS (CHUNK_BYTES/BS)
+
+static int g_Failures;
+#define CHECK(c, ...) do { if(!(c)){ printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); g_Failures++; } } while(0)
+
+static UINT8 Pattern(UINT64 Lba, UINT32 Off, UINT32 Seed){
+    UINT64 x = (Lba * 0x9E3779B97F4A7C15ULL) ^ ((UINT64)Off * 0xBF58476D1CE4E5B9ULL) ^ Seed;
+    return (UINT8)(x >> 29);
+}
+
+static void Fill(UINT8* Buf, UINT64 Lba, UINT32 Count, UINT32 Seed){
+    for(UINT32 b=0;b<Count;b++) for(UINT32 i=0;i<BS;i++) Buf[(UINT64)b*BS+i] = Pattern(Lba+b,i,Seed);
+}
+
+static BOOL Matches(const UINT8* Buf, UINT64 Lba, UINT32 Count, UINT32 Seed){
+    for(UINT32 b=0;b<Count;b++) for(UINT32 i=0;i<BS;i++) if(Buf[(UINT64)b*BS+i] != Pattern(Lba+b,i,Seed)) return FALSE;
+    return TRUE;
+}
+
+/* Writes of assorted sizes and alignments covering [0, Blocks), then read-back
+ * both before and after a flush (RAID5 serves unflushed partial stripes from
+ * its stripe cache). */
+static void RoundTrip(PAIO_DEVICE_OBJECT Md, UINT64 Blocks, UINT32 Seed){
+    static const UINT32 sizes[] = { 1, 7, CHUNK_BLOCKS, 3*CHUNK_BLOCKS+5, 2, 100, 64 };
+    UINT8* buf = (UINT8*)malloc((UINT64)256*BS);
+    UINT64 lba = 0; UINT32 k = 0;
+    while(lba < Blocks){
+        UINT32 n = sizes[k++ % (sizeof(sizes)/sizeof(sizes[0]))];
+        if(lba + n > Blocks) n = (UINT32)(Blocks - lba);
+        Fill(buf,lba,n,Seed);
+        CHECK(NT_SUCCESS(BlockWrite(Md,lba,n,buf)), "write lba %llu count %u", (unsigned long long)lba, n);
+        lba += n;
+    }
+    for(lba=0; lba<Blocks; lba+=200){
+        UINT32 n = (UINT32)((Blocks - lba) < 200 ? (Blocks - lba) : 200);
+        memset(buf,0,(UINT64)n*BS);
+        CHECK(NT_SUCCESS(BlockRead(Md,lba,n,buf)), "read lba %llu", (unsigned long long)lba);
+        CHECK(Matches(buf,lba,n,Seed), "data mismatch before flush near lba %llu", (unsigned long long)lba);
+    }
+    CHECK(NT_SUCCESS(BlockFlush(Md)), "flush");
+    for(lba=0; lba<Blocks; lba+=256){
+        UINT32 n = (UINT32)((Blocks - lba) < 256 ? (Blocks - lba) : 256);
+        memset(buf,0,(UINT64)n*BS);
+        CHECK(NT_SUCCESS(BlockRead(Md,lba,n,buf)), "read lba %llu", (unsigned long long)lba);
+        CHECK(Matches(buf,lba,n,Seed), "data mismatch after flush near lba %llu", (unsigned long long)lba);
+    }
+}
+
+static void CheckRaid0Layout(UINT64 Blocks, UINT32 Seed){
+    UINT8 blk[BS];
+    for(UINT64 lba=0; lba<Blocks; lba+=CHUNK_BLOCKS/2+3){
+        UINT64 chunk = lba / CHUNK_BLOCKS;
+        PAIO_DEVICE_OBJECT m = RamDiskGetDevice((UINT32)(chunk % MEMBERS));
+        UINT64 mlba = (chunk / MEMBERS) * CHUNK_BLOCKS + lba % CHUNK_BLOCKS;
+        CHECK(NT_SUCCESS(BlockRead(m,mlba,1,blk)), "member read");
+        CHECK(Matches(blk,lba,1,Seed), "raid0 lba %llu not at member %llu lba %llu",
+              (unsigned long long)lba, (unsigned long long)(chunk % MEMBERS), (unsigned long long)mlba);
+    }
+}
+
+static void CheckRaid1Mirrors(UINT64 Blocks, UINT32 Seed){
+    UINT8 blk[BS];
+    for(UINT32 m=0; m<MEMBERS; m++){
+        for(UINT64 lba=0; lba<Blocks; lba+=97){
+            CHECK(NT_SUCCESS(BlockRead(RamDiskGetDevice(m),lba,1,blk)), "member read");
+            CHECK(Matches(blk,lba,1,Seed), "raid1 member %u lba %llu differs", m, (unsigned long long)lba);
+        }
+    }
+}
+
+static void CheckRaid5Parity(UINT64 MemberBlocks){
+    UINT8 acc[BS], blk[BS];
+    UINT64 bad = 0;
+    for(UINT64 lba=0; lba<MemberBlocks; lba+=13){
+        memset(acc,0,sizeof(acc));
+        for(UINT32 m=0; m<MEMBERS; m++){
+            CHECK(NT_SUCCESS(BlockRead(RamDiskGetDevice(m),lba,1,blk)), "member read");
+            for(UINT32 i=0;i<BS;i++) acc[i] ^= blk[i];
+        }
+        for(UINT32 i=0;i<BS;i++) if(acc[i]){ bad++; break; }
+    }
+    CHECK(bad == 0, "raid5: %llu member rows do not XOR to zero", (unsigned long long)bad);
+}
+
+int main(int argc, char** argv){
+    static char cmdline[128] = "ramdisk_count=4 ramdisk_size=4M ramdisk_queues=2 raid_chunk=16K raid=";
+    int level = argc > 1 ? atoi(argv[1]) : 0;
+    PAIO_DEVICE_OBJECT md;
+    PBLOCK_DEVICE_EXTENSION ext;
+    UINT64 memberBlocks, expect;
+
+    cmdline[strlen(cmdline)] = (char)('0' + level);
+    AuroraSetCommandLine(cmdline);
+    CHECK(NT_SUCCESS(RamDiskInitialize()), "ramdisk init");
+    CHECK(NT_SUCCESS(RaidInitialize()), "raid init");
+    md = RaidGetDevice();
+    if(!md){ printf("FAIL: md0 not created\n"); return 1; }
+    ext = (PBLOCK_DEVICE_EXTENSION)md->DeviceExtension;
+    memberBlocks = ((PBLOCK_DEVICE_EXTENSION)RamDiskGetDevice(0)->DeviceExtension)->BlockCount;
+    expect = level == 0 ? memberBlocks * MEMBERS : level == 1 ? memberBlocks : memberBlocks * (MEMBERS - 1);
+    CHECK(ext->BlockCount == expect, "capacity %llu, expected %llu", (unsigned long long)ext->BlockCount, (unsigned long long)expect);
+
+    RoundTrip(md, ext->BlockCount, 0x1234);
+    if(level == 0) CheckRaid0Layout(ext->BlockCount, 0x1234);
+    if(level == 1) CheckRaid1Mirrors(ext->BlockCount, 0x1234);
+    if(level == 5) CheckRaid5Parity(memberBlocks);
+
+    /* Overwrite a window straddling stripes and make sure neighbours survive */
+    {
+        static UINT8 buf[(3*CHUNK_BLOCKS)*BS];
+        UINT64 lba = 5*CHUNK_BLOCKS - 11;
+        Fill(buf, lba, 2*CHUNK_BLOCKS, 0x77);
+        CHECK(NT_SUCCESS(BlockWrite(md,lba,2*CHUNK_BLOCKS,buf)), "overwrite");
+        CHECK(NT_SUCCESS(BlockFlush(md)), "flush");
+        CHECK(NT_SUCCESS(BlockRead(md,lba-CHUNK_BLOCKS/2,3*CHUNK_BLOCKS,buf)), "read window");
+        CHECK(Matches(buf, lba-CHUNK_BLOCKS/2, CHUNK_BLOCKS/2, 0x1234), "left neighbour clobbered");
+        CHECK(Matches(buf + (UINT64)(CHUNK_BLOCKS/2)*BS, lba, 2*CHUNK_BLOCKS, 0x77), "overwrite lost");
+        CHECK(Matches(buf + (UINT64)(CHUNK_BLOCKS/2 + 2*CHUNK_BLOCKS)*BS, lba+2*CHUNK_BLOCKS, CHUNK_BLOCKS/2, 0x1234), "right neighbour clobbered");
+        if(level == 5) CheckRaid5Parity(memberBlocks);
+    }
+
+    /* Out of range requests are refused, not wrapped onto members */
+    {
+        UINT8 blk[BS];
+        CHECK(!NT_SUCCESS(BlockRead(md,ext->BlockCount,1,blk)), "read past end accepted");
+    }
+
+    printf("raid%d: %s\n", level, g_Failures ? "FAILED" : "ok");
+    return g_Failures ? 1 : 0;
+}
@@ -0,0 +1,137 @@
+/* Batched directory listing through the VFS
+ * Creates a 100k-entry tmpfs directory and lists it with FsReadDir:
+ *   - short names pack into 32-byte records, so a 64 KiB buffer takes 2048
+ *     entries and the whole directory comes back in 49 calls, in creation
+ *     order, each name exactly once
+ *   - entries removed and created between batches neither shift the cursor
+ *     nor repeat or drop the entries still ahead of it
+ *   - a cursor from an earlier record resumes after it even once the entry
+ *     it names is gone */
+#include "../aurora.h"
+#include "../include/fs.h"
+
+int printf(const char* Format, ...);
+void* malloc(size_t Size);
+
+#define ENTRIES     100000
+#define BATCH       65536
+#define RECORD      32          /* FS_DIRENT_HEADER + up to 7 name bytes, rounded */
+
+static int g_Failures;
+#define CHECK(c, ...) do { if(!(c)){ printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); g_Failures++; } } while(0)
+
+static UINT64 g_Batch[BATCH/8];
+static UINT8* g_Seen;           /* times each numbered entry was listed */
+static UINT64* g_Cursor;        /* cursor of each entry's latest record */
+
+/* "/t/d/<n>" */
+static const char* Path(UINT32 N){
+    static char path[32];
+    char digits[12];
+    UINT32 n = 0, at = 5;
+    memcpy(path,"/t/d/",5);
+    do { digits[n++] = (char)('0' + N % 10); N /= 10; } while(N);
+    while(n) path[at++] = digits[--n];
+    path[at] = '\0';
+    return path;
+}
+
+static UINT32 Number(const char* Name){
+    UINT32 n = 0;
+    for(; *Name; Name++) n = n*10 + (UINT32)(*Name - '0');
+    return n;
+}
+
+/* One FsReadDir; counts every record in g_Seen and returns how many came
+ * back, or 0 at the end */
+static UINT32 Batch(FS_DIR Dir, UINT32 Size, PUINT32 Previous){
+    UINT32 got = 0, count = 0;
+    NTSTATUS st = FsReadDir(Dir,g_Batch,Size,&got);
+    if(st == STATUS_NO_MORE_ENTRIES) return 0;
+    CHECK(NT_SUCCESS(st), "readdir: 0x%x", (unsigned)st);
+    if(!NT_SUCCESS(st)) return 0;
+    for(UINT32 off=0; off<got; off+=((PFS_DIRENT)((UINT8*)g_Batch+off))->RecordLength){
+        PFS_DIRENT d = (PFS_DIRENT)((UINT8*)g_Batch+off);
+        UINT32 n = Number(d->Name);
+        CHECK(n < ENTRIES + 1000 && d->Type == FS_DT_FILE && d->RecordLength == RECORD, "record %s", d->Name);
+        if(n >= ENTRIES + 1000) continue;
+        g_Seen[n]++;
+        /* Names were created in increasing order and tmpfs lists in creation order */
+        if(Previous){
+            CHECK(*Previous == 0xFFFFFFFF || n > *Previous, "%u listed after %u", n, *Previous);
+            *Previous = n;
+        }
+        g_Cursor[n] = d->Cursor;
+        count++;
+    }
+    return count;
+}
+
+static void Populate(void){
+    CHECK(NT_SUCCESS(FsMount("tmpfs","tmpfs","/t",NULL)), "mount");
+    CHECK(NT_SUCCESS(FsCreate("/t/d",FS_NODE_DIRECTORY,NULL)), "mkdir");
+    for(UINT32 i=0; i<ENTRIES; i++){
+        NTSTATUS st = FsCreate(Path(i),0,NULL);
+        if(!NT_SUCCESS(st)){
+            CHECK(FALSE, "create %s: 0x%x", Path(i), (unsigned)st);
+            break;
+        }
+    }
+}
+
+static void FullListing(void){
+    UINT32 calls = 0, previous = 0xFFFFFFFF, total = 0, n, missing = 0;
+    FS_DIR d;
+    memset(g_Seen,0,ENTRIES + 1000);
+    CHECK(NT_SUCCESS(FsOpenDir("/t/d",&d)), "opendir");
+    while((n = Batch(d,BATCH,&previous)) != 0){
+        calls++;
+        total += n;
+    }
+    CHECK(NT_SUCCESS(FsCloseDir(d)), "closedir");
+    for(UINT32 i=0; i<ENTRIES; i++) if(g_Seen[i] != 1) missing++;
+    CHECK(total == ENTRIES && missing == 0, "%u entries listed, %u not exactly once", total, missing);
+    CHECK(calls == (ENTRIES + BATCH/RECORD - 1) / (BATCH/RECORD), "%u calls for %u entries", calls, total);
+    printf("tmpfs: %u entries in %u calls of %u bytes\n", total, calls, BATCH);
+}
+
+/* Between batches, remove entries on both sides of the cursor and add new
+ * ones; everything still ahead must come back once */
+static void ChangesBetweenBatches(void){
+    UINT32 previous = 0xFFFFFFFF, listed, missing = 0, repeated = 0;
+    FS_DIR d;
+    memset(g_Seen,0,ENTRIES + 1000);
+    CHECK(NT_SUCCESS(FsOpenDir("/t/d",&d)), "opendir");
+    listed = Batch(d,BATCH,&previous);
+    CHECK(listed == BATCH/RECORD, "first batch: %u entries", listed);
+    for(UINT32 i=1000; i<1100; i++) CHECK(NT_SUCCESS(FsRemove(Path(i))), "remove %s", Path(i));
+    for(UINT32 i=listed-5; i<listed+5; i++) CHECK(NT_SUCCESS(FsRemove(Path(i))), "remove %s", Path(i));
+    for(UINT32 i=ENTRIES; i<ENTRIES+1000; i++) CHECK(NT_SUCCESS(FsCreate(Path(i),0,NULL)), "create %s", Path(i));
+    while(Batch(d,BATCH,&previous) != 0) {}
+    for(UINT32 i=0; i<ENTRIES+1000; i++){
+        BOOL gone = (i >= 1000 && i < 1100) || (i >= listed-5 && i < listed+5);
+        UINT32 want = gone ? (i < listed ? 1 : 0) : 1;
+        if(g_Seen[i] > want) repeated++;
+        else if(g_Seen[i] < want) missing++;
+    }
+    CHECK(missing == 0 && repeated == 0, "after changes: %u missing, %u repeated", missing, repeated);
+
+    /* Resume from a cursor handed out before its entry was removed */
+    memset(g_Seen,0,ENTRIES + 1000);
+    previous = 0xFFFFFFFF;
+    CHECK(NT_SUCCESS(FsSeekDir(d,g_Cursor[1000])), "seek");
+    CHECK(Batch(d,BATCH,&previous) == BATCH/RECORD && g_Seen[1100] == 1 && g_Seen[999] == 0 && g_Seen[1000] == 0,
+          "seek past a removed entry resumed at %u", previous);
+    CHECK(NT_SUCCESS(FsCloseDir(d)), "closedir");
+}
+
+int main(void){
+    g_Seen = (UINT8*)malloc(ENTRIES + 1000);
+    g_Cursor = (UINT64*)malloc((ENTRIES + 1000) * sizeof(UINT64));
+    CHECK(NT_SUCCESS(FsInitialize()), "fs init");
+    Populate();
+    FullListing();
+    ChangesBetweenBatches();
+    printf("tmpfs: %s\n", g_Failures ? "FAILED" : "ok");
+    return g_Failures ? 1 : 0;
+}